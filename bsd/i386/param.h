@@ -109,6 +109,8 @@
 #define	MBIGCLBYTES	(1 << MBIGCLSHIFT)	/* size of a big cluster */
 #define	M16KCLSHIFT	14			/* 16384 */
 #define	M16KCLBYTES	(1 << M16KCLSHIFT)	/* size of a jumbo cluster */
+#define	M64KCLSHIFT	16			/* 65536 */
+#define	M64KCLBYTES	(1 << M64KCLSHIFT)	/* size of a 64KB jumbo cluster */
 
 #define	MCLOFSET	(MCLBYTES - 1)
 #ifndef NMBCLUSTERS
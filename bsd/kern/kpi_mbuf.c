@@ -1382,3 +1382,28 @@ mbuf_get_unsent_data_bytes(const mbuf_t m, u_int32_t *unsent_data)
 	*unsent_data = m->m_pkthdr.pkt_unsent_databytes;
 	return (0);
 }
+
+errno_t
+mbuf_allocpacket_array(mbuf_how_t how, size_t bufsize, mbuf_t *array,
+    unsigned int *count)
+{
+	if (array == NULL || count == NULL || *count == 0)
+		return (EINVAL);
+
+	if (bufsize != MCLBYTES && bufsize != MBIGCLBYTES &&
+	    (bufsize != M16KCLBYTES || njcl == 0))
+		return (EINVAL);
+
+	*count = m_getpackets_array(array, *count, how, bufsize);
+
+	return ((*count > 0) ? 0 : ENOMEM);
+}
+
+unsigned int
+mbuf_freem_array(mbuf_t *array, unsigned int count)
+{
+	if (array == NULL || count == 0)
+		return (0);
+
+	return (m_freem_array(array, count));
+}
@@ -82,6 +82,7 @@
 #include <dev/random/randomdev.h>
 
 #include <kern/kern_types.h>
+#include <kern/clock.h>
 #include <kern/simple_lock.h>
 #include <kern/queue.h>
 #include <kern/sched_prim.h>
@@ -319,6 +320,7 @@ static int mbuf_worker_ready;	/* worker thread is runnable */
 static int mbuf_expand_mcl;	/* number of cluster creation requets */
 static int mbuf_expand_big;	/* number of big cluster creation requests */
 static int mbuf_expand_16k;	/* number of 16KB cluster creation requests */
+static int mbuf_expand_64k;	/* number of 64KB cluster creation requests */
 static int ncpu;		/* number of CPUs */
 static ppnum_t *mcl_paddr;	/* Array of cluster physical addresses */
 static ppnum_t mcl_pages;	/* Size of array (# physical pages) */
@@ -336,24 +338,28 @@ typedef enum {
 	MC_CL,		/* Cluster */
 	MC_BIGCL,	/* Large (4KB) cluster */
 	MC_16KCL,	/* Jumbo (16KB) cluster */
+	MC_64KCL,	/* Jumbo (64KB) cluster */
 	MC_MBUF_CL,	/* mbuf + cluster */
 	MC_MBUF_BIGCL,	/* mbuf + large (4KB) cluster */
-	MC_MBUF_16KCL	/* mbuf + jumbo (16KB) cluster */
+	MC_MBUF_16KCL,	/* mbuf + jumbo (16KB) cluster */
+	MC_MBUF_64KCL	/* mbuf + jumbo (64KB) cluster */
 } mbuf_class_t;
 
 #define	MBUF_CLASS_MIN		MC_MBUF
-#define	MBUF_CLASS_MAX		MC_MBUF_16KCL
-#define	MBUF_CLASS_LAST		MC_16KCL
+#define	MBUF_CLASS_MAX		MC_MBUF_64KCL
+#define	MBUF_CLASS_LAST		MC_64KCL
 #define	MBUF_CLASS_VALID(c) \
 	((int)(c) >= MBUF_CLASS_MIN && (int)(c) <= MBUF_CLASS_MAX)
 #define	MBUF_CLASS_COMPOSITE(c) \
 	((int)(c) > MBUF_CLASS_LAST)
+#define	MBUF_CLASS_JUMBO(c) \
+	((c) == MC_16KCL || (c) == MC_64KCL)
 
 
 /*
  * mbuf specific mcache allocation request flags.
  */
-#define	MCR_COMP	MCR_USR1 /* for MC_MBUF_{CL,BIGCL,16KCL} caches */
+#define	MCR_COMP	MCR_USR1 /* for MC_MBUF_{CL,BIGCL,16KCL,64KCL} caches */
 
 /*
  * Per-cluster slab structure.
@@ -386,7 +392,7 @@ typedef struct mcl_slab {
 	int8_t		sl_refcnt;	/* outstanding allocations */
 	int8_t		sl_chunks;	/* chunks (bufs) in this slab */
 	u_int16_t	sl_flags;	/* slab flags (see below) */
-	u_int16_t	sl_len;		/* slab length */
+	u_int32_t	sl_len;		/* slab length */
 	void		*sl_base;	/* base of allocated memory */
 	void		*sl_head;	/* first free buffer */
 	TAILQ_ENTRY(mcl_slab) sl_link;	/* next/prev slab on freelist */
@@ -413,6 +419,16 @@ typedef struct mcl_slabg {
  */
 #define	NSLABSP16KB	(M16KCLBYTES >> PAGE_SHIFT)
 
+/*
+ * Number of slabs needed to control a 64KB cluster object.
+ */
+#define	NSLABSP64KB	(M64KCLBYTES >> PAGE_SHIFT)
+
+/*
+ * Number of slabs needed to control a jumbo cluster of the given class.
+ */
+#define	NSLABSPJCL(c)	((c) == MC_64KCL ? NSLABSP64KB : NSLABSP16KB)
+
 /*
  * Per-cluster audit structure.
  */
@@ -476,6 +492,8 @@ static unsigned int slabgrp;	/* # of entries in slabs table */
 int nclusters;			/* # of clusters for non-jumbo (legacy) sizes */
 int njcl;			/* # of clusters for jumbo sizes */
 int njclbytes;			/* size of a jumbo cluster */
+int nj64cl;			/* # of clusters for 64KB jumbo size */
+static int mbuf_jcl64k = 0;	/* % of the jumbo pool for 64KB clusters */
 unsigned char *mbutl;		/* first mapped cluster address */
 unsigned char *embutl;		/* ending virtual address of mclusters */
 int _max_linkhdr;		/* largest link-level header */
@@ -620,6 +638,8 @@ static mbuf_table_t mbuf_table[] = {
 	    NULL, NULL, 0, 0, 0, 0, 1000 },
 	{ MC_16KCL, NULL, TAILQ_HEAD_INITIALIZER(m_slablist(MC_16KCL)),
 	    NULL, NULL, 0, 0, 0, 0, 1000 },
+	{ MC_64KCL, NULL, TAILQ_HEAD_INITIALIZER(m_slablist(MC_64KCL)),
+	    NULL, NULL, 0, 0, 0, 0, 250 },
 	/*
 	 * The following are special caches; they serve as intermediate
 	 * caches backed by the above rudimentary caches.  Each object
@@ -631,6 +651,7 @@ static mbuf_table_t mbuf_table[] = {
 	{ MC_MBUF_CL, NULL, { NULL, NULL }, NULL, NULL, 0, 0, 0, 0, 2000 },
 	{ MC_MBUF_BIGCL, NULL, { NULL, NULL }, NULL, NULL, 0, 0, 0, 0, 1000 },
 	{ MC_MBUF_16KCL, NULL, { NULL, NULL }, NULL, NULL, 0, 0, 0, 0, 1000 },
+	{ MC_MBUF_64KCL, NULL, { NULL, NULL }, NULL, NULL, 0, 0, 0, 0, 250 },
 };
 
 #define	NELEM(a)	(sizeof (a) / sizeof ((a)[0]))
@@ -878,6 +899,9 @@ static boolean_t mbuf_report_usage(mbuf_class_t);
 #define	MBUF_16KCL_INIT(m, buf, rfa, ref, flag)	\
 	MEXT_INIT(m, buf, m_maxsize(MC_16KCL), m_16kfree, NULL, rfa, ref, flag)
 
+#define	MBUF_64KCL_INIT(m, buf, rfa, ref, flag)	\
+	MEXT_INIT(m, buf, m_maxsize(MC_64KCL), m_64kfree, NULL, rfa, ref, flag)
+
 /*
  * Macro to convert BSD malloc sleep flag to mcache's
  */
@@ -1055,6 +1079,11 @@ mbuf_stat_sync(void)
 			sp->mbcl_ctotal -= m_total(MC_MBUF_16KCL);
 			break;
 
+		case MC_64KCL:
+			/* Deduct clusters used in composite cache */
+			sp->mbcl_ctotal -= m_total(MC_MBUF_64KCL);
+			break;
+
 		default:
 			break;
 		}
@@ -1229,20 +1258,38 @@ mbuf_table_init(void)
 
 		/* Update nclusters with rounded down value of njcl */
 		nclusters = P2ROUNDDOWN(nmbclusters - njcl, NCLPG);
+
+		/*
+		 * Optionally carve mbuf_jcl64k percent (at most half) of
+		 * the jumbo pool out for 64KB clusters, used by bulk
+		 * transfers to keep socket buffer chains short.  None by
+		 * default, since drivers receive jumbo frames into 16KB
+		 * clusters.  Each takes 32 2KB clusters; nj64cl is in
+		 * 2KB unit, and what remains in njcl is for 16KB clusters.
+		 */
+		PE_parse_boot_argn("mbuf_jcl64k", &mbuf_jcl64k,
+		    sizeof (mbuf_jcl64k));
+		if (mbuf_jcl64k < 0)
+			mbuf_jcl64k = 0;
+		else if (mbuf_jcl64k > 50)
+			mbuf_jcl64k = 50;
+		nj64cl = P2ROUNDDOWN((njcl / 100) * mbuf_jcl64k, NCLPJ64CL);
+		njcl -= nj64cl;
 	}
 
 	/*
 	 * njcl is valid only on platforms with 16KB jumbo clusters or
 	 * with 16KB pages, where it is configured to 1/3 of the pool
-	 * size.  On these platforms, the remaining is used for 2KB
-	 * and 4KB clusters.  On platforms without 16KB jumbo clusters,
-	 * the entire pool is used for both 2KB and 4KB clusters.  A 4KB
+	 * size, less the nj64cl carved out of it for 64KB clusters.
+	 * On these platforms, the remaining is used for 2KB and 4KB
+	 * clusters.  On platforms without 16KB jumbo clusters, the
+	 * entire pool is used for both 2KB and 4KB clusters.  A 4KB
 	 * cluster can either be splitted into 16 mbufs, or into 2 2KB
 	 * clusters.
 	 *
-	 *  +---+---+------------ ... -----------+------- ... -------+
-	 *  | c | b |              s             |        njcl       |
-	 *  +---+---+------------ ... -----------+------- ... -------+
+	 *  +---+---+------------ ... -----------+------- ... ---+--------+
+	 *  | c | b |              s             |      njcl     | nj64cl |
+	 *  +---+---+------------ ... -----------+------- ... ---+--------+
 	 *
 	 * 1/32th of the shared region is reserved for pure 2KB and 4KB
 	 * clusters (1/64th each.)
@@ -1305,6 +1352,17 @@ mbuf_table_init(void)
 	m_size(MC_MBUF_16KCL) = m_size(MC_MBUF) + m_size(MC_16KCL);
 	(void) snprintf(m_cname(MC_MBUF_16KCL), MAX_MBUF_CNAME, "mbuf_16kcl");
 
+	m_minlimit(MC_64KCL) = 0;
+	m_maxlimit(MC_64KCL) = (nj64cl >> NCLPJ64CLSHIFT); /* in 64KB unit */
+	m_maxsize(MC_64KCL) = m_size(MC_64KCL) = M64KCLBYTES;
+	(void) snprintf(m_cname(MC_64KCL), MAX_MBUF_CNAME, "64kcl");
+
+	m_minlimit(MC_MBUF_64KCL) = 0;
+	m_maxlimit(MC_MBUF_64KCL) = m_maxlimit(MC_64KCL);
+	m_maxsize(MC_MBUF_64KCL) = M64KCLBYTES;
+	m_size(MC_MBUF_64KCL) = m_size(MC_MBUF) + m_size(MC_64KCL);
+	(void) snprintf(m_cname(MC_MBUF_64KCL), MAX_MBUF_CNAME, "mbuf_64kcl");
+
 	/*
 	 * Initialize the legacy mbstat structure.
 	 */
@@ -1587,8 +1645,7 @@ mbinit(void)
 		u_int32_t flags;
 
 		flags = mbuf_debug;
-		if (m_class(m) == MC_MBUF_CL || m_class(m) == MC_MBUF_BIGCL ||
-		    m_class(m) == MC_MBUF_16KCL) {
+		if (MBUF_CLASS_COMPOSITE(m_class(m))) {
 			allocfunc = mbuf_cslab_alloc;
 			freefunc = mbuf_cslab_free;
 			auditfunc = mbuf_cslab_audit;
@@ -1609,6 +1666,9 @@ mbinit(void)
 		if ((m_class(m) == MC_MBUF_16KCL || m_class(m) == MC_16KCL) &&
 		    njcl == 0)
 			flags |= MCF_NOCPUCACHE;
+		if ((m_class(m) == MC_MBUF_64KCL || m_class(m) == MC_64KCL) &&
+		    nj64cl == 0)
+			flags |= MCF_NOCPUCACHE;
 
 		if (!mclfindleak)
 			flags |= MCF_NOLEAKLOG;
@@ -1666,7 +1726,7 @@ mbinit(void)
 	printf("%s: done [%d MB total pool size, (%d/%d) split]\n", __func__,
 	    (nmbclusters << MCLSHIFT) >> MBSHIFT,
 	    (nclusters << MCLSHIFT) >> MBSHIFT,
-	    (njcl << MCLSHIFT) >> MBSHIFT);
+	    ((njcl + nj64cl) << MCLSHIFT) >> MBSHIFT);
 }
 
 /*
@@ -1746,25 +1806,25 @@ slab_alloc(mbuf_class_t class, int wait)
 		VERIFY(sp->sl_refcnt >= 1 && sp->sl_chunks == NBCLPG &&
 		    sp->sl_len == PAGE_SIZE && 
 		    (sp->sl_refcnt < NBCLPG || sp->sl_head == NULL));
-	} else if (class == MC_16KCL) {
+	} else if (MBUF_CLASS_JUMBO(class)) {
 		mcl_slab_t *nsp;
 		int k;
 
-		--m_infree(MC_16KCL);
+		--m_infree(class);
 		VERIFY(sp->sl_refcnt == 1 && sp->sl_chunks == 1 &&
 		    sp->sl_len == m_maxsize(class) && sp->sl_head == NULL);
 		/*
-		 * Increment 2nd-Nth slab reference, where N is NSLABSP16KB.
-		 * A 16KB big cluster takes NSLABSP16KB slabs, each having at
-		 * most 1 reference.
+		 * Increment 2nd-Nth slab reference, where N is NSLABSPJCL.
+		 * A 16KB or 64KB jumbo cluster takes NSLABSPJCL slabs, each
+		 * having at most 1 reference.
 		 */
-		for (nsp = sp, k = 1; k < NSLABSP16KB; k++) {
+		for (nsp = sp, k = 1; k < NSLABSPJCL(class); k++) {
 			nsp = nsp->sl_next;
 			/* Next slab must already be present */
 			VERIFY(nsp != NULL);
 			nsp->sl_refcnt++;
 			VERIFY(!slab_is_detached(nsp));
-			VERIFY(nsp->sl_class == MC_16KCL &&
+			VERIFY(nsp->sl_class == class &&
 			    nsp->sl_flags == (SLF_MAPPED | SLF_PARTIAL) &&
 			    nsp->sl_refcnt == 1 && nsp->sl_chunks == 0 &&
 			    nsp->sl_len == 0 && nsp->sl_base == sp->sl_base &&
@@ -1815,6 +1875,7 @@ slab_free(mbuf_class_t class, mcache_obj_t *buf)
 	lck_mtx_assert(mbuf_mlock, LCK_MTX_ASSERT_OWNED);
 
 	VERIFY(class != MC_16KCL || njcl > 0);
+	VERIFY(class != MC_64KCL || nj64cl > 0);
 	VERIFY(buf->obj_next == NULL);
 
 	sp = slab_get(buf);
@@ -1841,24 +1902,24 @@ slab_free(mbuf_class_t class, mcache_obj_t *buf)
 		VERIFY(sp->sl_refcnt >= 0 && sp->sl_chunks == NBCLPG);
 		VERIFY(sp->sl_refcnt < (NBCLPG - 1) ||
 		    (slab_is_detached(sp) && sp->sl_head == NULL));
-	} else if (class == MC_16KCL) {
+	} else if (MBUF_CLASS_JUMBO(class)) {
 		mcl_slab_t *nsp;
 		int k;
 		/*
-		 * A 16KB cluster takes NSLABSP16KB slabs, all must
+		 * A 16KB or 64KB cluster takes NSLABSPJCL slabs, all must
 		 * now have 0 reference.
 		 */
 		VERIFY(IS_P2ALIGNED(buf, PAGE_SIZE));
 		VERIFY(sp->sl_refcnt == 0 && sp->sl_chunks == 1 &&
 		    sp->sl_len == m_maxsize(class) && sp->sl_head == NULL);
 		VERIFY(slab_is_detached(sp));
-		for (nsp = sp, k = 1; k < NSLABSP16KB; k++) {
+		for (nsp = sp, k = 1; k < NSLABSPJCL(class); k++) {
 			nsp = nsp->sl_next;
 			/* Next slab must already be present */
 			VERIFY(nsp != NULL);
 			nsp->sl_refcnt--;
 			VERIFY(slab_is_detached(nsp));
-			VERIFY(nsp->sl_class == MC_16KCL &&
+			VERIFY(nsp->sl_class == class &&
 			    (nsp->sl_flags & (SLF_MAPPED | SLF_PARTIAL)) &&
 			    nsp->sl_refcnt == 0 && nsp->sl_chunks == 0 &&
 			    nsp->sl_len == 0 && nsp->sl_base == sp->sl_base &&
@@ -1901,8 +1962,8 @@ slab_free(mbuf_class_t class, mcache_obj_t *buf)
 		mbstat.m_bigclfree = (++m_infree(MC_BIGCL)) +
 		    m_infree(MC_MBUF_BIGCL);
 		buf->obj_next = sp->sl_head;
-	} else if (class == MC_16KCL) {
-		++m_infree(MC_16KCL);
+	} else if (MBUF_CLASS_JUMBO(class)) {
+		++m_infree(class);
 	} else {
 		++m_infree(MC_MBUF);
 		buf->obj_next = sp->sl_head;
@@ -2216,6 +2277,7 @@ cslab_alloc(mbuf_class_t class, mcache_obj_t ***plist, unsigned int num)
 
 	VERIFY(need > 0);
 	VERIFY(class != MC_MBUF_16KCL || njcl > 0);
+	VERIFY(class != MC_MBUF_64KCL || nj64cl > 0);
 	lck_mtx_assert(mbuf_mlock, LCK_MTX_ASSERT_OWNED);
 
 	/* Get what we can from the freelist */
@@ -2237,9 +2299,10 @@ cslab_alloc(mbuf_class_t class, mcache_obj_t ***plist, unsigned int num)
 			    clsp->sl_refcnt <= NBCLPG);
 		}
 
-		if (class == MC_MBUF_16KCL) {
+		if (class == MC_MBUF_16KCL || class == MC_MBUF_64KCL) {
 			int k;
-			for (nsp = clsp, k = 1; k < NSLABSP16KB; k++) {
+			for (nsp = clsp, k = 1;
+			    k < NSLABSPJCL(clsp->sl_class); k++) {
 				nsp = nsp->sl_next;
 				/* Next slab must already be present */
 				VERIFY(nsp != NULL);
@@ -2280,15 +2343,18 @@ cslab_free(mbuf_class_t class, mcache_obj_t *list, int purged)
 
 	ASSERT(MBUF_CLASS_VALID(class) && MBUF_CLASS_COMPOSITE(class));
 	VERIFY(class != MC_MBUF_16KCL || njcl > 0);
+	VERIFY(class != MC_MBUF_64KCL || nj64cl > 0);
 	lck_mtx_assert(mbuf_mlock, LCK_MTX_ASSERT_OWNED);
 
 	if (class == MC_MBUF_CL) {
 		cl_class = MC_CL;
 	} else if (class == MC_MBUF_BIGCL) {
 		cl_class = MC_BIGCL;
-	} else {
-		VERIFY(class == MC_MBUF_16KCL);
+	} else if (class == MC_MBUF_16KCL) {
 		cl_class = MC_16KCL;
+	} else {
+		VERIFY(class == MC_MBUF_64KCL);
+		cl_class = MC_64KCL;
 	}
 
 	o = tail = list;
@@ -2324,9 +2390,9 @@ cslab_free(mbuf_class_t class, mcache_obj_t *list, int purged)
 			VERIFY(clsp->sl_refcnt >= 1 && 
 			    clsp->sl_refcnt <= NBCLPG);
 		}
-		if (cl_class == MC_16KCL) {
+		if (MBUF_CLASS_JUMBO(cl_class)) {
 			int k;
-			for (nsp = clsp, k = 1; k < NSLABSP16KB; k++) {
+			for (nsp = clsp, k = 1; k < NSLABSPJCL(cl_class); k++) {
 				nsp = nsp->sl_next;
 				/* Next slab must already be present */
 				VERIFY(nsp != NULL);
@@ -2370,12 +2436,7 @@ cslab_free(mbuf_class_t class, mcache_obj_t *list, int purged)
 
 			/* And free the cluster */
 			((mcache_obj_t *)cl)->obj_next = NULL;
-			if (class == MC_MBUF_CL)
-				slab_free(MC_CL, cl);
-			else if (class == MC_MBUF_BIGCL)
-				slab_free(MC_BIGCL, cl);
-			else
-				slab_free(MC_16KCL, cl);
+			slab_free(cl_class, cl);
 		}
 
 		++num;
@@ -2421,6 +2482,7 @@ mbuf_cslab_alloc(void *arg, mcache_obj_t ***plist, unsigned int needed,
 	ASSERT(needed > 0);
 
 	VERIFY(class != MC_MBUF_16KCL || njcl > 0);
+	VERIFY(class != MC_MBUF_64KCL || nj64cl > 0);
 
 	/* There should not be any slab for this class */
 	VERIFY(m_slab_cnt(class) == 0 &&
@@ -2470,9 +2532,11 @@ mbuf_cslab_alloc(void *arg, mcache_obj_t ***plist, unsigned int needed,
 		cl_class = MC_CL;
 	} else if (class == MC_MBUF_BIGCL) {
 		cl_class = MC_BIGCL;
-	} else {
-		VERIFY(class == MC_MBUF_16KCL);
+	} else if (class == MC_MBUF_16KCL) {
 		cl_class = MC_16KCL;
+	} else {
+		VERIFY(class == MC_MBUF_64KCL);
+		cl_class = MC_64KCL;
 	}
 	needed = mcache_alloc_ext(m_cache(cl_class), &clp_list, needed, wait);
 	if (needed == 0) {
@@ -2541,12 +2605,7 @@ mbuf_cslab_alloc(void *arg, mcache_obj_t ***plist, unsigned int needed,
 				mcache_set_pattern(MCACHE_FREE_PATTERN, m,
 				    m_maxsize(MC_MBUF));
 
-				if (class == MC_MBUF_CL)
-					size = m_maxsize(MC_CL);
-				else if (class == MC_MBUF_BIGCL)
-					size = m_maxsize(MC_BIGCL);
-				else
-					size = m_maxsize(MC_16KCL);
+				size = m_maxsize(cl_class);
 
 				mcache_set_pattern(MCACHE_FREE_PATTERN, cl,
 				    size);
@@ -2554,7 +2613,9 @@ mbuf_cslab_alloc(void *arg, mcache_obj_t ***plist, unsigned int needed,
 		}
 
 		MBUF_INIT(ms, 0, MT_FREE);
-		if (class == MC_MBUF_16KCL) {
+		if (class == MC_MBUF_64KCL) {
+			MBUF_64KCL_INIT(ms, cl, rfa, 0, EXTF_COMPOSITE);
+		} else if (class == MC_MBUF_16KCL) {
 			MBUF_16KCL_INIT(ms, cl, rfa, 0, EXTF_COMPOSITE);
 		} else if (class == MC_MBUF_BIGCL) {
 			MBUF_BIGCL_INIT(ms, cl, rfa, 0, EXTF_COMPOSITE);
@@ -2644,8 +2705,10 @@ mbuf_cslab_audit(void *arg, mcache_obj_t *list, boolean_t alloc)
 		cl_class = MC_CL;
 	else if (class == MC_MBUF_BIGCL)
 		cl_class = MC_BIGCL;
-	else
+	else if (class == MC_MBUF_16KCL)
 		cl_class = MC_16KCL;
+	else
+		cl_class = MC_64KCL;
 	cl_size = m_maxsize(cl_class);
 
 	while ((m = ms = (struct mbuf *)list) != NULL) {
@@ -2681,9 +2744,10 @@ mbuf_cslab_audit(void *arg, mcache_obj_t *list, boolean_t alloc)
 			VERIFY(clsp->sl_refcnt >= 1 &&
 			    clsp->sl_refcnt <= NBCLPG);
 
-		if (class == MC_MBUF_16KCL) {
+		if (class == MC_MBUF_16KCL || class == MC_MBUF_64KCL) {
 			int k;
-			for (nsp = clsp, k = 1; k < NSLABSP16KB; k++) {
+			for (nsp = clsp, k = 1;
+			    k < NSLABSPJCL(clsp->sl_class); k++) {
 				nsp = nsp->sl_next;
 				/* Next slab must already be present */
 				VERIFY(nsp != NULL);
@@ -2723,18 +2787,22 @@ m_clalloc(const u_int32_t num, const int wait, const u_int32_t bufsize)
 	mbuf_class_t class;
 
 	/* Set if a buffer allocation needs allocation of multiple pages */
-	large_buffer = ((bufsize == m_maxsize(MC_16KCL)) &&
-		PAGE_SIZE < M16KCLBYTES);
+	large_buffer = (((bufsize == m_maxsize(MC_16KCL)) &&
+		PAGE_SIZE < M16KCLBYTES) || bufsize == m_maxsize(MC_64KCL));
 	VERIFY(bufsize == m_maxsize(MC_BIGCL) ||
-	    bufsize == m_maxsize(MC_16KCL));
+	    bufsize == m_maxsize(MC_16KCL) ||
+	    bufsize == m_maxsize(MC_64KCL));
 
 	VERIFY((bufsize == PAGE_SIZE) ||
-	    (bufsize > PAGE_SIZE && bufsize == m_maxsize(MC_16KCL)));
+	    (bufsize > PAGE_SIZE && (bufsize == m_maxsize(MC_16KCL) ||
+	    bufsize == m_maxsize(MC_64KCL))));
 
 	if (bufsize == m_size(MC_BIGCL))
 		class = MC_BIGCL;
-	else
+	else if (bufsize == m_size(MC_16KCL))
 		class = MC_16KCL;
+	else
+		class = MC_64KCL;
 
 	lck_mtx_assert(mbuf_mlock, LCK_MTX_ASSERT_OWNED);
 
@@ -2772,9 +2840,11 @@ m_clalloc(const u_int32_t num, const int wait, const u_int32_t bufsize)
 	/*
 	 * If we did ask for "n" 16KB physically contiguous chunks
 	 * and didn't get them, then please try again without this
-	 * restriction.
+	 * restriction.  64KB clusters are only handed out when they
+	 * are physically contiguous, so that a single DMA segment
+	 * covers each of them; don't retry for those.
 	 */
-	if (large_buffer && page == 0)
+	if (large_buffer && page == 0 && class != MC_64KCL)
 		page = kmem_mb_alloc(mb_map, size, 0);
 
 	if (page == 0) {
@@ -2815,9 +2885,9 @@ m_clalloc(const u_int32_t num, const int wait, const u_int32_t bufsize)
 		} else {
 			/*
 			 * if multiple 4K pages are being used for a
-			 * 16K cluster 
-			 */ 
-			needed = numpages / NSLABSP16KB;
+			 * 16K or 64K cluster
+			 */
+			needed = numpages / NSLABSPJCL(class);
 		}
 
 		i = mcache_alloc_ext(mcache_audit_cache,
@@ -2880,40 +2950,40 @@ m_clalloc(const u_int32_t num, const int wait, const u_int32_t bufsize)
 			}
 			++count;
 		} else if ((bufsize > PAGE_SIZE) &&
-		    (i % NSLABSP16KB) == 0) {
-			union m16kcluster *m16kcl = (union m16kcluster *)page;
+		    (i % NSLABSPJCL(class)) == 0) {
+			mcache_obj_t *jcl = (mcache_obj_t *)page;
 			mcl_slab_t *nsp;
 			int k;
-				
-			/* One for the entire 16KB */
-			sp = slab_get(m16kcl);
+
+			/* One for the entire 16KB or 64KB */
+			sp = slab_get(jcl);
 			if (mclaudit != NULL)
-				mcl_audit_init(m16kcl, &mca_list, NULL, 0, 1);
+				mcl_audit_init(jcl, &mca_list, NULL, 0, 1);
 
 			VERIFY(sp->sl_refcnt == 0 && sp->sl_flags == 0);
-			slab_init(sp, MC_16KCL, SLF_MAPPED,
-			    m16kcl, m16kcl, bufsize, 0, 1);
-			m16kcl->m16kcl_next = NULL;
+			slab_init(sp, class, SLF_MAPPED,
+			    jcl, jcl, bufsize, 0, 1);
+			jcl->obj_next = NULL;
 
 			/*
 			 * 2nd-Nth page's slab is part of the first one,
-			 * where N is NSLABSP16KB.
+			 * where N is NSLABSPJCL.
 			 */
-			for (k = 1; k < NSLABSP16KB; k++) {
+			for (k = 1; k < NSLABSPJCL(class); k++) {
 				nsp = slab_get(((union mbigcluster *)page) + k);
 				VERIFY(nsp->sl_refcnt == 0 &&
 				    nsp->sl_flags == 0);
-				slab_init(nsp, MC_16KCL,
+				slab_init(nsp, class,
 				    SLF_MAPPED | SLF_PARTIAL,
-				    m16kcl, NULL, 0, 0, 0);
+				    jcl, NULL, 0, 0, 0);
 			}
 			/* Insert this slab */
-			slab_insert(sp, MC_16KCL);
+			slab_insert(sp, class);
 
 			/* Update stats now since slab_get drops the lock */
-			++m_infree(MC_16KCL);
-			++m_total(MC_16KCL);
-			VERIFY(m_total(MC_16KCL) <= m_maxlimit(MC_16KCL));
+			++m_infree(class);
+			++m_total(class);
+			VERIFY(m_total(class) <= m_maxlimit(class));
 			++count;
 		}
 	}
@@ -2960,7 +3030,7 @@ out:
 
 		if (m_infree(MC_BIGCL) >= num)
 			return (1);
-	} else {
+	} else if (class == MC_16KCL) {
 		if (i > 0) {
 			/*
 			 * Remember total number of 16KB clusters needed
@@ -2976,6 +3046,22 @@ out:
 
 		if (m_infree(MC_16KCL) >= num)
 			return (1);
+	} else {
+		if (i > 0) {
+			/*
+			 * Remember total number of 64KB clusters needed
+			 * at this time.
+			 */
+			i += m_total(MC_64KCL);
+			if (i > mbuf_expand_64k) {
+				mbuf_expand_64k = i;
+				if (mbuf_worker_ready)
+					wakeup((caddr_t)&mbuf_worker_run);
+			}
+		}
+
+		if (m_infree(MC_64KCL) >= num)
+			return (1);
 	}
 	return (0);
 }
@@ -2991,7 +3077,7 @@ freelist_populate(mbuf_class_t class, unsigned int num, int wait)
 	mbuf_class_t super_class;
 
 	VERIFY(class == MC_MBUF || class == MC_CL || class == MC_BIGCL ||
-	    class == MC_16KCL);
+	    MBUF_CLASS_JUMBO(class));
 
 	lck_mtx_assert(mbuf_mlock, LCK_MTX_ASSERT_OWNED);
 
@@ -3179,9 +3265,15 @@ mbuf_cached_above(mbuf_class_t class, int wait)
 			return (!mcache_bkt_isempty(m_cache(MC_MBUF_16KCL)));
 		break;
 
+	case MC_64KCL:
+		if (wait & MCR_COMP)
+			return (!mcache_bkt_isempty(m_cache(MC_MBUF_64KCL)));
+		break;
+
 	case MC_MBUF_CL:
 	case MC_MBUF_BIGCL:
 	case MC_MBUF_16KCL:
+	case MC_MBUF_64KCL:
 		break;
 
 	default:
@@ -3209,11 +3301,13 @@ mbuf_steal(mbuf_class_t class, unsigned int num)
 	case MC_CL:
 	case MC_BIGCL:
 	case MC_16KCL:
+	case MC_64KCL:
 		return (FALSE);
 
 	case MC_MBUF_CL:
 	case MC_MBUF_BIGCL:
 	case MC_MBUF_16KCL:
+	case MC_MBUF_64KCL:
 		/* Get the required number of constructed objects if possible */
 		if (m_infree(class) > m_minlimit(class)) {
 			tot = cslab_alloc(class, &list,
@@ -3243,6 +3337,7 @@ m_reclaim(mbuf_class_t class, unsigned int num, boolean_t comp)
 	VERIFY(m_total(MC_CL) <= m_maxlimit(MC_CL));
 	VERIFY(m_total(MC_BIGCL) <= m_maxlimit(MC_BIGCL));
 	VERIFY(m_total(MC_16KCL) <= m_maxlimit(MC_16KCL));
+	VERIFY(m_total(MC_64KCL) <= m_maxlimit(MC_64KCL));
 
 	/*
 	 * This logic can be made smarter; for now, simply mark
@@ -3277,6 +3372,11 @@ m_reclaim(mbuf_class_t class, unsigned int num, boolean_t comp)
 			m_wantpurge(MC_MBUF_16KCL)++;
 		break;
 
+	case MC_64KCL:
+		if (!comp)
+			m_wantpurge(MC_MBUF_64KCL)++;
+		break;
+
 	default:
 		VERIFY(0);
 		/* NOTREACHED */
@@ -3430,6 +3530,9 @@ m_free(struct mbuf *m)
 			} else if (m->m_ext.ext_free == m_16kfree) {
 				mcache_free(m_cache(MC_16KCL),
 				    m->m_ext.ext_buf);
+			} else if (m->m_ext.ext_free == m_64kfree) {
+				mcache_free(m_cache(MC_64KCL),
+				    m->m_ext.ext_buf);
 			} else {
 				(*(m->m_ext.ext_free))(m->m_ext.ext_buf,
 				    m->m_ext.ext_size, m->m_ext.ext_arg);
@@ -3454,9 +3557,11 @@ m_free(struct mbuf *m)
 				mcache_free(m_cache(MC_MBUF_CL), m);
 			} else if (m->m_ext.ext_free == m_bigfree) {
 				mcache_free(m_cache(MC_MBUF_BIGCL), m);
-			} else {
-				VERIFY(m->m_ext.ext_free == m_16kfree);
+			} else if (m->m_ext.ext_free == m_16kfree) {
 				mcache_free(m_cache(MC_MBUF_16KCL), m);
+			} else {
+				VERIFY(m->m_ext.ext_free == m_64kfree);
+				mcache_free(m_cache(MC_MBUF_64KCL), m);
 			}
 			return (n);
 		}
@@ -3501,6 +3606,9 @@ m_clattach(struct mbuf *m, int type, caddr_t extbuf,
 			} else if (m->m_ext.ext_free == m_16kfree) {
 				mcache_free(m_cache(MC_16KCL),
 				    m->m_ext.ext_buf);
+			} else if (m->m_ext.ext_free == m_64kfree) {
+				mcache_free(m_cache(MC_64KCL),
+				    m->m_ext.ext_buf);
 			} else {
 				(*(m->m_ext.ext_free))(m->m_ext.ext_buf,
 				    m->m_ext.ext_size, m->m_ext.ext_arg);
@@ -3525,9 +3633,11 @@ m_clattach(struct mbuf *m, int type, caddr_t extbuf,
 				mcache_free(m_cache(MC_MBUF_CL), m);
 			} else if (m->m_ext.ext_free == m_bigfree) {
 				mcache_free(m_cache(MC_MBUF_BIGCL), m);
-			} else {
-				VERIFY(m->m_ext.ext_free == m_16kfree);
+			} else if (m->m_ext.ext_free == m_16kfree) {
 				mcache_free(m_cache(MC_MBUF_16KCL), m);
+			} else {
+				VERIFY(m->m_ext.ext_free == m_64kfree);
+				mcache_free(m_cache(MC_MBUF_64KCL), m);
 			}
 			/*
 			 * Allocate a new mbuf, since we didn't divorce
@@ -3647,6 +3757,24 @@ m_mclhasreference(struct mbuf *m)
 	return ((MEXT_FLAGS(m) & EXTF_READONLY) ? 1 : 0);
 }
 
+/*
+ * m_mclwritable() checks if the data of an mbuf may be modified in
+ * place: it is internal, or in one of the allocator's own clusters that
+ * no other mbuf references.  Buffers attached with m_clattach() (pages,
+ * driver memory) never are.
+ */
+int
+m_mclwritable(struct mbuf *m)
+{
+	if (!(m->m_flags & M_EXT))
+		return (1);
+	if (m_mclhasreference(m))
+		return (0);
+
+	return (m->m_ext.ext_free == NULL || m->m_ext.ext_free == m_bigfree ||
+	    m->m_ext.ext_free == m_16kfree || m->m_ext.ext_free == m_64kfree);
+}
+
 __private_extern__ caddr_t
 m_bigalloc(int wait)
 {
@@ -3719,6 +3847,42 @@ m_m16kget(struct mbuf *m, int wait)
 	return (m);
 }
 
+__private_extern__ caddr_t
+m_64kalloc(int wait)
+{
+	int mcflags = MSLEEPF(wait);
+
+	/* Is this due to a non-blocking retry?  If so, then try harder */
+	if (mcflags & MCR_NOSLEEP)
+		mcflags |= MCR_TRYHARD;
+
+	return (mcache_alloc(m_cache(MC_64KCL), mcflags));
+}
+
+__private_extern__ void
+m_64kfree(caddr_t p, __unused u_int size, __unused caddr_t arg)
+{
+	mcache_free(m_cache(MC_64KCL), p);
+}
+
+/* m_m64kget() add a 64KB mbuf cluster to a normal mbuf */
+__private_extern__ struct mbuf *
+m_m64kget(struct mbuf *m, int wait)
+{
+	struct ext_ref *rfa;
+
+	if ((rfa = mcache_alloc(ref_cache, MSLEEPF(wait))) == NULL)
+		return (m);
+
+	m->m_ext.ext_buf =  m_64kalloc(wait);
+	if (m->m_ext.ext_buf != NULL) {
+		MBUF_64KCL_INIT(m, m->m_ext.ext_buf, rfa, 1, 0);
+	} else {
+		mcache_free(ref_cache, rfa);
+	}
+	return (m);
+}
+
 /*
  * "Move" mbuf pkthdr from "from" to "to".
  * "from" must have M_PKTHDR set, and "to" must be empty.
@@ -3846,13 +4010,15 @@ m_getpackets_internal(unsigned int *num_needed, int num_with_pkthdrs,
 
 	ASSERT(bufsize == m_maxsize(MC_CL) ||
 	    bufsize == m_maxsize(MC_BIGCL) ||
-	    bufsize == m_maxsize(MC_16KCL));
+	    bufsize == m_maxsize(MC_16KCL) ||
+	    bufsize == m_maxsize(MC_64KCL));
 
 	/*
-	 * Caller must first check for njcl because this
+	 * Caller must first check for njcl (nj64cl) because this
 	 * routine is internal and not exposed/used via KPI.
 	 */
 	VERIFY(bufsize != m_maxsize(MC_16KCL) || njcl > 0);
+	VERIFY(bufsize != m_maxsize(MC_64KCL) || nj64cl > 0);
 
 	top = NULL;
 	np = &top;
@@ -3872,8 +4038,10 @@ m_getpackets_internal(unsigned int *num_needed, int num_with_pkthdrs,
 		cp = m_cache(MC_MBUF_CL);
 	else if (bufsize == m_maxsize(MC_BIGCL))
 		cp = m_cache(MC_MBUF_BIGCL);
-	else
+	else if (bufsize == m_maxsize(MC_16KCL))
 		cp = m_cache(MC_MBUF_16KCL);
+	else
+		cp = m_cache(MC_MBUF_64KCL);
 	needed = mcache_alloc_ext(cp, &mp_list, needed, mcflags);
 
 	for (pnum = 0; pnum < needed; pnum++) {
@@ -3890,7 +4058,9 @@ m_getpackets_internal(unsigned int *num_needed, int num_with_pkthdrs,
 		flag = MEXT_FLAGS(m);
 
 		MBUF_INIT(m, num_with_pkthdrs, MT_DATA);
-		if (bufsize == m_maxsize(MC_16KCL)) {
+		if (bufsize == m_maxsize(MC_64KCL)) {
+			MBUF_64KCL_INIT(m, cl, rfa, 1, flag);
+		} else if (bufsize == m_maxsize(MC_16KCL)) {
 			MBUF_16KCL_INIT(m, cl, rfa, 1, flag);
 		} else if (bufsize == m_maxsize(MC_BIGCL)) {
 			MBUF_BIGCL_INIT(m, cl, rfa, 1, flag);
@@ -3939,6 +4109,113 @@ m_getpackets_internal(unsigned int *num_needed, int num_with_pkthdrs,
 	return (top);
 }
 
+/*
+ * Fill the caller's array with up to num_needed packets, each one being a
+ * single packet header mbuf with a cluster of size bufsize attached, for
+ * use by drivers replenishing their receive rings.  The composite mbuf +
+ * cluster objects are obtained from the cache layer in one batch, and
+ * each packet is handed back with m_len and m_pkthdr.len already covering
+ * the entire cluster.  This never blocks to satisfy the whole request; it
+ * returns the number of packets that were placed in the array.
+ */
+__private_extern__ unsigned int
+m_getpackets_array(struct mbuf **array, unsigned int num_needed, int wait,
+    size_t bufsize)
+{
+	struct mbuf *m;
+	unsigned int pnum, needed;
+	mcache_obj_t *mp_list = NULL;
+	int mcflags = MSLEEPF(wait) | MCR_TRYHARD;
+	u_int32_t flag;
+	struct ext_ref *rfa;
+	mcache_t *cp;
+	void *cl;
+
+	VERIFY(bufsize == m_maxsize(MC_CL) ||
+	    bufsize == m_maxsize(MC_BIGCL) ||
+	    (bufsize == m_maxsize(MC_16KCL) && njcl > 0));
+
+	if (bufsize == m_maxsize(MC_CL))
+		cp = m_cache(MC_MBUF_CL);
+	else if (bufsize == m_maxsize(MC_BIGCL))
+		cp = m_cache(MC_MBUF_BIGCL);
+	else
+		cp = m_cache(MC_MBUF_16KCL);
+	needed = mcache_alloc_ext(cp, &mp_list, num_needed, mcflags);
+
+	for (pnum = 0; pnum < needed; pnum++) {
+		m = (struct mbuf *)mp_list;
+		mp_list = mp_list->obj_next;
+
+		VERIFY(m->m_type == MT_FREE && m->m_flags == M_EXT);
+		cl = m->m_ext.ext_buf;
+		rfa = MEXT_RFA(m);
+
+		ASSERT(cl != NULL && rfa != NULL);
+		VERIFY(MBUF_IS_COMPOSITE(m));
+
+		flag = MEXT_FLAGS(m);
+
+		MBUF_INIT(m, 1, MT_DATA);
+		if (bufsize == m_maxsize(MC_16KCL)) {
+			MBUF_16KCL_INIT(m, cl, rfa, 1, flag);
+		} else if (bufsize == m_maxsize(MC_BIGCL)) {
+			MBUF_BIGCL_INIT(m, cl, rfa, 1, flag);
+		} else {
+			MBUF_CL_INIT(m, cl, rfa, 1, flag);
+		}
+		m->m_len = m->m_pkthdr.len = bufsize;
+
+#if CONFIG_MACF_NET
+		if (mac_mbuf_label_init(m, wait) != 0) {
+			/* Account for what's been handed out so far */
+			mtype_stat_add(MT_DATA, pnum + 1);
+			mtype_stat_sub(MT_FREE, pnum + 1);
+			m_freem(m);
+			if (mp_list != NULL)
+				mcache_free_ext(cp, mp_list);
+			return (pnum);
+		}
+#endif /* MAC_NET */
+		array[pnum] = m;
+	}
+	VERIFY(mp_list == NULL);
+
+	if (pnum > 0) {
+		mtype_stat_add(MT_DATA, pnum);
+		mtype_stat_sub(MT_FREE, pnum);
+	}
+
+	return (pnum);
+}
+
+/*
+ * Free the packets held in an array, e.g. the unused part of a receive
+ * ring on teardown, in one pass through the cache layer.  NULL entries
+ * are skipped and every entry is cleared.  Returns the number of packets
+ * freed.
+ */
+__private_extern__ unsigned int
+m_freem_array(struct mbuf **array, unsigned int num)
+{
+	struct mbuf *top = NULL, **np = &top;
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		struct mbuf *m = array[i];
+
+		if (m == NULL)
+			continue;
+		array[i] = NULL;
+		/* m_freem_list() walks m_nextpkt, so only link packet heads */
+		VERIFY(m->m_nextpkt == NULL);
+		*np = m;
+		np = &m->m_nextpkt;
+	}
+
+	return ((top != NULL) ? m_freem_list(top) : 0);
+}
+
 /*
  * Return list of mbuf linked by m_nextpkt.  Try for numlist, and if
  * wantall is not set, return whatever number were available.  The size of
@@ -4345,9 +4622,11 @@ m_freem_list(struct mbuf *m)
 	mcache_obj_t *mcl_list = NULL;
 	mcache_obj_t *mbc_list = NULL;
 	mcache_obj_t *m16k_list = NULL;
+	mcache_obj_t *m64k_list = NULL;
 	mcache_obj_t *m_mcl_list = NULL;
 	mcache_obj_t *m_mbc_list = NULL;
 	mcache_obj_t *m_m16k_list = NULL;
+	mcache_obj_t *m_m64k_list = NULL;
 	mcache_obj_t *ref_list = NULL;
 	int pktcount = 0;
 	int mt_free = 0, mt_data = 0, mt_header = 0, mt_soname = 0, mt_tag = 0;
@@ -4392,6 +4671,9 @@ m_freem_list(struct mbuf *m)
 				} else if (m->m_ext.ext_free == m_16kfree) {
 					o->obj_next = m16k_list;
 					m16k_list = o;
+				} else if (m->m_ext.ext_free == m_64kfree) {
+					o->obj_next = m64k_list;
+					m64k_list = o;
 				} else {
 					(*(m->m_ext.ext_free))((caddr_t)o,
 					    m->m_ext.ext_size,
@@ -4433,10 +4715,13 @@ m_freem_list(struct mbuf *m)
 				} else if (m->m_ext.ext_free == m_bigfree) {
 					o->obj_next = m_mbc_list;
 					m_mbc_list = o;
-				} else {
-					VERIFY(m->m_ext.ext_free == m_16kfree);
+				} else if (m->m_ext.ext_free == m_16kfree) {
 					o->obj_next = m_m16k_list;
 					m_m16k_list = o;
+				} else {
+					VERIFY(m->m_ext.ext_free == m_64kfree);
+					o->obj_next = m_m64k_list;
+					m_m64k_list = o;
 				}
 				m = next;
 				continue;
@@ -4489,12 +4774,16 @@ simple_free:
 		mcache_free_ext(m_cache(MC_BIGCL), mbc_list);
 	if (m16k_list != NULL)
 		mcache_free_ext(m_cache(MC_16KCL), m16k_list);
+	if (m64k_list != NULL)
+		mcache_free_ext(m_cache(MC_64KCL), m64k_list);
 	if (m_mcl_list != NULL)
 		mcache_free_ext(m_cache(MC_MBUF_CL), m_mcl_list);
 	if (m_mbc_list != NULL)
 		mcache_free_ext(m_cache(MC_MBUF_BIGCL), m_mbc_list);
 	if (m_m16k_list != NULL)
 		mcache_free_ext(m_cache(MC_MBUF_16KCL), m_m16k_list);
+	if (m_m64k_list != NULL)
+		mcache_free_ext(m_cache(MC_MBUF_64KCL), m_m64k_list);
 	if (ref_list != NULL)
 		mcache_free_ext(ref_cache, ref_list);
 
@@ -5264,12 +5553,14 @@ m_howmany(int num, size_t bufsize)
 	int i = 0, j = 0;
 	u_int32_t m_mbclusters, m_clusters, m_bigclusters, m_16kclusters;
 	u_int32_t m_mbfree, m_clfree, m_bigclfree, m_16kclfree;
+	u_int32_t m_64kclusters;
 	u_int32_t sumclusters, freeclusters;
 	u_int32_t percent_pool, percent_kmem;
 	u_int32_t mb_growth, mb_growth_thresh;
 
 	VERIFY(bufsize == m_maxsize(MC_BIGCL) ||
-	    bufsize == m_maxsize(MC_16KCL));
+	    bufsize == m_maxsize(MC_16KCL) ||
+	    bufsize == m_maxsize(MC_64KCL));
 
 	lck_mtx_assert(mbuf_mlock, LCK_MTX_ASSERT_OWNED);
 
@@ -5278,6 +5569,7 @@ m_howmany(int num, size_t bufsize)
 	m_clusters = m_total(MC_CL);
 	m_bigclusters = m_total(MC_BIGCL) << NCLPBGSHIFT;
 	m_16kclusters = m_total(MC_16KCL);
+	m_64kclusters = m_total(MC_64KCL);
 	sumclusters = m_mbclusters + m_clusters + m_bigclusters;
 
 	m_mbfree = m_infree(MC_MBUF) >> NMBPCLSHIFT;
@@ -5289,7 +5581,9 @@ m_howmany(int num, size_t bufsize)
 	/* Bail if we've maxed out the mbuf memory map */
 	if ((bufsize == m_maxsize(MC_BIGCL) && sumclusters >= nclusters) ||
 	    (njcl > 0 && bufsize == m_maxsize(MC_16KCL) &&
-	    (m_16kclusters << NCLPJCLSHIFT) >= njcl)) {
+	    (m_16kclusters << NCLPJCLSHIFT) >= njcl) ||
+	    (nj64cl > 0 && bufsize == m_maxsize(MC_64KCL) &&
+	    (m_64kclusters << NCLPJ64CLSHIFT) >= nj64cl)) {
 		return (0);
 	}
 
@@ -5349,7 +5643,7 @@ m_howmany(int num, size_t bufsize)
 		VERIFY((m_total(MC_BIGCL) + i) <= m_maxlimit(MC_BIGCL));
 		VERIFY(sumclusters + (i << 1) <= nclusters);
 
-	} else { /* 16K CL */
+	} else if (bufsize == m_maxsize(MC_16KCL)) {
 		VERIFY(njcl > 0);
 		/* Ensure at least num clusters are available */
 		if (num >= m_16kclfree)
@@ -5364,6 +5658,19 @@ m_howmany(int num, size_t bufsize)
 		if (i + m_16kclusters >= m_maxlimit(MC_16KCL))
 			i = m_maxlimit(MC_16KCL) - m_16kclusters;
 		VERIFY((m_total(MC_16KCL) + i) <= m_maxlimit(MC_16KCL));
+	} else { /* 64K CL */
+		VERIFY(nj64cl > 0);
+		/* Ensure at least num clusters are available */
+		if (num >= m_infree(MC_64KCL))
+			i = num - m_infree(MC_64KCL);
+
+		/*
+		 * Grow the 64KCL pool only as needed; each one pins
+		 * 16 contiguous pages.
+		 */
+		if (i + m_64kclusters >= m_maxlimit(MC_64KCL))
+			i = m_maxlimit(MC_64KCL) - m_64kclusters;
+		VERIFY((m_total(MC_64KCL) + i) <= m_maxlimit(MC_64KCL));
 	}
 	return (i);
 }
@@ -5743,6 +6050,8 @@ m_dup(struct mbuf *m, int how)
 				n = m_mbigget(n, how);
 			else if (m->m_len <= m_maxsize(MC_16KCL) && njcl > 0)
 				n = m_m16kget(n, how);
+			else if (m->m_len <= m_maxsize(MC_64KCL) && nj64cl > 0)
+				n = m_m64kget(n, how);
 			if (!(n->m_flags & M_EXT)) {
 				(void) m_free(n);
 				goto nospace;
@@ -6121,6 +6430,8 @@ mbuf_waiter_inc(mbuf_class_t class, boolean_t comp)
 			mcache_waiter_inc(m_cache(MC_MBUF_BIGCL));
 		} else if (class == MC_16KCL) {
 			mcache_waiter_inc(m_cache(MC_MBUF_16KCL));
+		} else if (class == MC_64KCL) {
+			mcache_waiter_inc(m_cache(MC_MBUF_64KCL));
 		} else {
 			mcache_waiter_inc(m_cache(MC_MBUF_CL));
 			mcache_waiter_inc(m_cache(MC_MBUF_BIGCL));
@@ -6142,6 +6453,8 @@ mbuf_waiter_dec(mbuf_class_t class, boolean_t comp)
 			mcache_waiter_dec(m_cache(MC_MBUF_BIGCL));
 		} else if (class == MC_16KCL) {
 			mcache_waiter_dec(m_cache(MC_MBUF_16KCL));
+		} else if (class == MC_64KCL) {
+			mcache_waiter_dec(m_cache(MC_MBUF_64KCL));
 		} else {
 			mcache_waiter_dec(m_cache(MC_MBUF_CL));
 			mcache_waiter_dec(m_cache(MC_MBUF_BIGCL));
@@ -6289,6 +6602,19 @@ mbuf_worker_thread(void)
 			if (n > 0)
 				(void) freelist_populate(MC_16KCL, n, M_WAIT);
 		}
+		if (mbuf_expand_64k) {
+			int n;
+
+			/* Adjust to current number of 64 KB cluster in use */
+			n = mbuf_expand_64k -
+			    (m_total(MC_64KCL) - m_infree(MC_64KCL));
+			if ((n + m_total(MC_64KCL)) > m_maxlimit(MC_64KCL))
+				n = m_maxlimit(MC_64KCL) - m_total(MC_64KCL);
+			mbuf_expand_64k = 0;
+
+			if (n > 0)
+				(void) freelist_populate(MC_64KCL, n, M_WAIT);
+		}
 
 		/*
 		 * Because we can run out of memory before filling the mbuf
@@ -6409,9 +6735,9 @@ slab_insert(mcl_slab_t *sp, mbuf_class_t class)
 	 * If a buffer spans multiple contiguous pages then mark them as
 	 * detached too
 	 */
-	if (class == MC_16KCL) {
+	if (MBUF_CLASS_JUMBO(class)) {
 		int k;
-		for (k = 1; k < NSLABSP16KB; k++) {
+		for (k = 1; k < NSLABSPJCL(class); k++) {
 			sp = sp->sl_next;
 			/* Next slab must already be present */
 			VERIFY(sp != NULL && slab_is_detached(sp));
@@ -6429,8 +6755,8 @@ slab_remove(mcl_slab_t *sp, mbuf_class_t class)
 	m_slab_cnt(class)--;
 	TAILQ_REMOVE(&m_slablist(class), sp, sl_link);
 	slab_detach(sp);
-	if (class == MC_16KCL) {
-		for (k = 1; k < NSLABSP16KB; k++) {
+	if (MBUF_CLASS_JUMBO(class)) {
+		for (k = 1; k < NSLABSPJCL(class); k++) {
 			sp = sp->sl_next;
 			/* Next slab must already be present */
 			VERIFY(sp != NULL);
@@ -6617,6 +6943,7 @@ mcl_audit_buf2mca(mbuf_class_t class, mcache_obj_t *mobj)
 		mca = mclaudit[ix].cl_audit[m_idx];
 		break;
 	case MC_16KCL:
+	case MC_64KCL:
 		/*
 		 * Same as above, but only return the first element.
 		 */
@@ -7066,6 +7393,7 @@ mbuf_dump(void)
 	u_int32_t m_mbufs = 0, m_clfree = 0, m_bigclfree = 0;
 	u_int32_t m_mbufclfree = 0, m_mbufbigclfree = 0;
 	u_int32_t m_16kclusters = 0, m_16kclfree = 0, m_mbuf16kclfree = 0;
+	u_int32_t m_64kclusters = 0, m_64kclfree = 0, m_mbuf64kclfree = 0;
 	int nmbtypes = sizeof (mbstat.m_mtypes) / sizeof (short);
 	uint8_t seen[256];
 	struct mbtypes *mp;
@@ -7093,12 +7421,17 @@ mbuf_dump(void)
 		} else if (njcl > 0 && m_class(i) == MC_16KCL) {
 			m_16kclfree = sp->mbcl_total - sp->mbcl_active;
 			m_16kclusters = sp->mbcl_total;
+		} else if (nj64cl > 0 && m_class(i) == MC_64KCL) {
+			m_64kclfree = sp->mbcl_total - sp->mbcl_active;
+			m_64kclusters = sp->mbcl_total;
 		} else if (m_class(i) == MC_MBUF_CL) {
 			m_mbufclfree = sp->mbcl_total - sp->mbcl_active;
 		} else if (m_class(i) == MC_MBUF_BIGCL) {
 			m_mbufbigclfree = sp->mbcl_total - sp->mbcl_active;
 		} else if (njcl > 0 && m_class(i) == MC_MBUF_16KCL) {
 			m_mbuf16kclfree = sp->mbcl_total - sp->mbcl_active;
+		} else if (nj64cl > 0 && m_class(i) == MC_MBUF_64KCL) {
+			m_mbuf64kclfree = sp->mbcl_total - sp->mbcl_active;
 		}
 
 		mem = sp->mbcl_ctotal * sp->mbcl_size;
@@ -7112,6 +7445,7 @@ mbuf_dump(void)
 	m_clfree += m_mbufclfree;
 	m_bigclfree += m_mbufbigclfree;
 	m_16kclfree += m_mbuf16kclfree;
+	m_64kclfree += m_mbuf64kclfree;
 
 	totmbufs = 0;
 	for (mp = mbtypes; mp->mt_name != NULL; mp++)
@@ -7156,6 +7490,12 @@ mbuf_dump(void)
 		    njclbytes / 1024);
 		MBUF_DUMP_BUF_CHK();
 	}
+	if (nj64cl > 0) {
+		k = snprintf(c, clen, "%u/%u mbuf %uKB clusters in use\n",
+		    m_64kclusters - m_64kclfree, m_64kclusters,
+		    M64KCLBYTES / 1024);
+		MBUF_DUMP_BUF_CHK();
+	}
 	totused = totmem - totfree;
 	if (totmem == 0) {
 		totpct = 0;
@@ -7582,9 +7922,10 @@ m_drain(void)
 				break;
 			}
 			case MC_16KCL:
+			case MC_64KCL:
 				m_infree(mc)--;
 				m_total(mc)--;
-				for (nsp = sp, k = 1; k < NSLABSP16KB; k++) {
+				for (nsp = sp, k = 1; k < NSLABSPJCL(mc); k++) {
 					nsp = nsp->sl_next;
 					VERIFY(nsp->sl_refcnt == 0 && 
 					    nsp->sl_base != NULL &&
@@ -7646,6 +7987,190 @@ m_drain_force_sysctl SYSCTL_HANDLER_ARGS
 	return (err);
 }
 
+#if DEBUG || DEVELOPMENT
+#define	MB_REFILL_BENCH_MAXRING		4096
+#define	MB_REFILL_BENCH_MAXROUNDS	100000
+
+static int
+mb_refill_bench_sysctl SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct mb_refill_bench mrb;
+	struct mbuf **ring;
+	uint64_t start, end;
+	unsigned int i, n, round;
+	int err;
+
+	bzero(&mrb, sizeof (mrb));
+	mrb.mrb_ringsize = 512;
+	mrb.mrb_rounds = 1000;
+	mrb.mrb_bufsize = MCLBYTES;
+	if (req->newptr != USER_ADDR_NULL) {
+		err = SYSCTL_IN(req, &mrb, sizeof (mrb));
+		if (err != 0)
+			return (err);
+	}
+	if (mrb.mrb_ringsize == 0 ||
+	    mrb.mrb_ringsize > MB_REFILL_BENCH_MAXRING ||
+	    mrb.mrb_rounds == 0 || mrb.mrb_rounds > MB_REFILL_BENCH_MAXROUNDS)
+		return (EINVAL);
+	if (mrb.mrb_bufsize != m_maxsize(MC_CL) &&
+	    mrb.mrb_bufsize != m_maxsize(MC_BIGCL) &&
+	    (mrb.mrb_bufsize != m_maxsize(MC_16KCL) || njcl == 0))
+		return (EINVAL);
+
+	ring = _MALLOC(sizeof (*ring) * mrb.mrb_ringsize, M_TEMP,
+	    M_WAITOK | M_ZERO);
+	if (ring == NULL)
+		return (ENOMEM);
+
+	/* One packet at a time, the way drivers refill today */
+	start = mach_absolute_time();
+	for (round = 0; round < mrb.mrb_rounds; round++) {
+		for (i = 0; i < mrb.mrb_ringsize; i++) {
+			unsigned int one = 1, nsegs = 1;
+
+			/* Same as mbuf_allocpacket() with maxchunks of 1 */
+			ring[i] = m_allocpacket_internal(&one,
+			    mrb.mrb_bufsize, &nsegs, M_DONTWAIT, 1, 0);
+			if (ring[i] == NULL)
+				break;
+			ring[i]->m_len = ring[i]->m_pkthdr.len =
+			    mrb.mrb_bufsize;
+		}
+		mrb.mrb_packets += i;
+		for (n = i, i = 0; i < n; i++) {
+			m_freem(ring[i]);
+			ring[i] = NULL;
+		}
+	}
+	end = mach_absolute_time();
+	absolutetime_to_nanoseconds(end - start, &mrb.mrb_single_ns);
+
+	/* Batched */
+	start = mach_absolute_time();
+	for (round = 0; round < mrb.mrb_rounds; round++) {
+		n = m_getpackets_array(ring, mrb.mrb_ringsize, M_DONTWAIT,
+		    mrb.mrb_bufsize);
+		(void) m_freem_array(ring, n);
+	}
+	end = mach_absolute_time();
+	absolutetime_to_nanoseconds(end - start, &mrb.mrb_bulk_ns);
+
+	_FREE(ring, M_TEMP);
+
+	return (SYSCTL_OUT(req, &mrb, sizeof (mrb)));
+}
+
+#define	MB_JCL64K_TEST_MAXCOUNT		256
+#define	MB_JCL64K_TEST_MAXROUNDS	10000
+
+static int
+mb_jcl64k_test_sysctl SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct mb_jcl64k_test mjt;
+	caddr_t *ring;
+	struct mbuf *m, *top;
+	uint64_t start, end;
+	unsigned int i, n, round, size;
+	u_int32_t draincnt;
+	int err = 0;
+
+	if (nj64cl == 0)
+		return (ENOTSUP);
+
+	bzero(&mjt, sizeof (mjt));
+	mjt.mjt_count = 16;
+	mjt.mjt_rounds = 100;
+	if (req->newptr != USER_ADDR_NULL) {
+		err = SYSCTL_IN(req, &mjt, sizeof (mjt));
+		if (err != 0)
+			return (err);
+	}
+	if (mjt.mjt_count == 0 || mjt.mjt_count > MB_JCL64K_TEST_MAXCOUNT ||
+	    mjt.mjt_rounds == 0 || mjt.mjt_rounds > MB_JCL64K_TEST_MAXROUNDS)
+		return (EINVAL);
+	mjt.mjt_raw = mjt.mjt_composite = 0;
+	mjt.mjt_raw_ns = mjt.mjt_composite_ns = 0;
+	mjt.mjt_drained = 0;
+
+	ring = _MALLOC(sizeof (*ring) * mjt.mjt_count, M_TEMP,
+	    M_WAITOK | M_ZERO);
+	if (ring == NULL)
+		return (ENOMEM);
+
+	size = m_maxsize(MC_64KCL);
+	lck_mtx_lock(mbuf_mlock);
+	mjt.mjt_total_before = m_total(MC_64KCL);
+	lck_mtx_unlock(mbuf_mlock);
+
+	/* Bare 64KB clusters; touch both ends of each */
+	start = mach_absolute_time();
+	for (round = 0; round < mjt.mjt_rounds; round++) {
+		for (i = 0; i < mjt.mjt_count; i++) {
+			if ((ring[i] = m_64kalloc(M_DONTWAIT)) == NULL)
+				break;
+			ring[i][0] = ring[i][size - 1] = (char)round;
+		}
+		mjt.mjt_raw += i;
+		if (round == mjt.mjt_rounds - 1) {
+			lck_mtx_lock(mbuf_mlock);
+			mjt.mjt_total_peak = m_total(MC_64KCL);
+			lck_mtx_unlock(mbuf_mlock);
+		}
+		for (n = i, i = 0; i < n; i++) {
+			m_64kfree(ring[i], size, NULL);
+			ring[i] = NULL;
+		}
+	}
+	end = mach_absolute_time();
+	absolutetime_to_nanoseconds(end - start, &mjt.mjt_raw_ns);
+
+	/* mbuf + 64KB cluster composites, as sosend() takes them */
+	start = mach_absolute_time();
+	for (round = 0; round < mjt.mjt_rounds && err == 0; round++) {
+		n = mjt.mjt_count;
+		top = m_getpackets_internal(&n, 1, M_DONTWAIT, 0, size);
+		for (m = top; m != NULL; m = m->m_nextpkt) {
+			if (!(m->m_flags & M_EXT) ||
+			    m->m_ext.ext_size != size ||
+			    m->m_ext.ext_free != m_64kfree) {
+				err = EIO;
+				break;
+			}
+			mjt.mjt_composite++;
+		}
+		if (top != NULL)
+			(void) m_freem_list(top);
+	}
+	end = mach_absolute_time();
+	absolutetime_to_nanoseconds(end - start, &mjt.mjt_composite_ns);
+
+	_FREE(ring, M_TEMP);
+	if (err != 0)
+		return (err);
+
+	/*
+	 * Give everything back: empty the per-CPU caches and let
+	 * m_drain() return the idle slabs, subject to its usual
+	 * kern.ipc.mb_drain_maxint throttling.
+	 */
+	(void) mcache_purge_cache(m_cache(MC_MBUF_64KCL), FALSE);
+	(void) mcache_purge_cache(m_cache(MC_64KCL), FALSE);
+	lck_mtx_lock(mbuf_mlock);
+	draincnt = mbstat.m_drain;
+	lck_mtx_unlock(mbuf_mlock);
+	m_drain();
+	lck_mtx_lock(mbuf_mlock);
+	mjt.mjt_drained = (mbstat.m_drain != draincnt);
+	mjt.mjt_total_after = m_total(MC_64KCL);
+	lck_mtx_unlock(mbuf_mlock);
+
+	return (SYSCTL_OUT(req, &mjt, sizeof (mjt)));
+}
+#endif /* DEBUG || DEVELOPMENT */
+
 SYSCTL_DECL(_kern_ipc);
 SYSCTL_PROC(_kern_ipc, KIPC_MBSTAT, mbstat,
     CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED,
@@ -7672,3 +8197,13 @@ SYSCTL_PROC(_kern_ipc, OID_AUTO, mb_drain_force,
 SYSCTL_INT(_kern_ipc, OID_AUTO, mb_drain_maxint,
     CTLFLAG_RW | CTLFLAG_LOCKED, &mb_drain_maxint, 0,
     "Minimum time interval between garbage collection");
+#if DEBUG || DEVELOPMENT
+SYSCTL_PROC(_kern_ipc, OID_AUTO, mb_refill_bench,
+    CTLTYPE_STRUCT | CTLFLAG_RW | CTLFLAG_LOCKED, NULL, 0,
+    mb_refill_bench_sysctl, "S,mb_refill_bench",
+    "Compare single and batched receive ring refill");
+SYSCTL_PROC(_kern_ipc, OID_AUTO, mb_jcl64k_test,
+    CTLTYPE_STRUCT | CTLFLAG_RW | CTLFLAG_LOCKED, NULL, 0,
+    mb_jcl64k_test_sysctl, "S,mb_jcl64k_test",
+    "Allocate, free and drain 64KB clusters");
+#endif /* DEBUG || DEVELOPMENT */
@@ -865,3 +865,23 @@ m_sum16(struct mbuf *m, uint32_t off, uint32_t len)
 
 	return (~cpu_in_cksum(m, len, off, 0) & 0xffff);
 }
+
+extern int cpu_in_cksum_copy(struct mbuf *m, int len, int off, void *dst,
+    uint32_t initial_sum);
+
+/*
+ * Same as m_copydata() followed by m_sum16() on the copied span, except
+ * that the data is read only once.
+ */
+uint16_t
+m_copydata_sum16(struct mbuf *m, uint32_t off, uint32_t len, void *vp)
+{
+	int mlen;
+
+	if ((mlen = m_length2(m, NULL)) < (off + len)) {
+		panic("%s: mbuf len (%d) < off+len (%d+%d)\n", __func__,
+		    mlen, off, len);
+	}
+
+	return (~cpu_in_cksum_copy(m, len, off, vp, 0) & 0xffff);
+}
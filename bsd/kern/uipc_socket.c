@@ -156,8 +156,10 @@ static lck_mtx_t	*so_cache_mtx;
 
 static void	filt_sordetach(struct knote *kn);
 static int	filt_soread(struct knote *kn, long hint);
+static int	filt_soread_nolock(struct knote *kn, struct socket *so);
 static void	filt_sowdetach(struct knote *kn);
 static int	filt_sowrite(struct knote *kn, long hint);
+static int	filt_sowrite_nolock(struct knote *kn, struct socket *so);
 static void	filt_sockdetach(struct knote *kn);
 static int	filt_sockev(struct knote *kn, long hint);
 static void	filt_socktouch(struct knote *kn, struct kevent_internal_s *kev,
@@ -247,6 +249,30 @@ int sosendjcl_ignore_capab = 0;
 SYSCTL_INT(_kern_ipc, OID_AUTO, sosendjcl_ignore_capab,
 	CTLFLAG_RW | CTLFLAG_LOCKED, &sosendjcl_ignore_capab, 0, "");
 
+/*
+ * Set to prefer 64KB jumbo clusters (if available) over 16KB ones for
+ * writes of at least 64KB, when jumbo clusters are otherwise allowed
+ * per sosendjcl above.  Bulk senders then build socket buffer chains
+ * with a quarter of the mbufs, which in turn shortens the walks done
+ * by sbappend, sbcompress, sbdrop and tcp_output.  Has no effect
+ * unless the 64KB cluster pool was set up with the mbuf_jcl64k boot-arg.
+ */
+int sosendjcl64k = 1;
+SYSCTL_INT(_kern_ipc, OID_AUTO, sosendjcl64k,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &sosendjcl64k, 0, "");
+
+/*
+ * Set to let the EVFILT_READ and EVFILT_WRITE filters answer the common
+ * case from the socket buffer snapshots (see sbsnap_update()) without
+ * taking the socket lock, when they are not called from a wakeup that
+ * already holds it.  Under contention this keeps kevent() callers from
+ * queueing behind the protocol on the socket lock just to be told that
+ * data is there.
+ */
+int so_filt_nolock = 1;
+SYSCTL_INT(_kern_ipc, OID_AUTO, so_filt_nolock,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &so_filt_nolock, 0, "");
+
 /*
  * Set this to ignore SOF1_IF_2KCL and use big clusters for large
  * writes on the socket for all protocols on any network interfaces.
@@ -1991,6 +2017,7 @@ sosend(struct socket *so, struct sockaddr *addr, struct uio *uio,
 				int chainlength;
 				int bytes_to_copy;
 				boolean_t jumbocl;
+				boolean_t jumbo64cl;
 				boolean_t bigcl;
 				int bytes_to_alloc;
 
@@ -2022,6 +2049,8 @@ sosend(struct socket *so, struct sockaddr *addr, struct uio *uio,
 				    ((so->so_flags & SOF_MULTIPAGES) ||
 				    sosendjcl_ignore_capab) &&
 				    bigcl;
+				jumbo64cl = jumbocl && sosendjcl64k &&
+				    nj64cl > 0;
 
 				socket_unlock(so, 0);
 
@@ -2044,6 +2073,28 @@ sosend(struct socket *so, struct sockaddr *addr, struct uio *uio,
 					 * sure to release any clusters we
 					 * haven't yet consumed.
 					 */
+					if (freelist == NULL &&
+					    bytes_to_alloc >= M64KCLBYTES &&
+					    jumbo64cl) {
+						/*
+						 * Only whole 64 KB clusters;
+						 * the tail goes into smaller
+						 * clusters on the next pass.
+						 */
+						num_needed =
+						    bytes_to_alloc / M64KCLBYTES;
+
+						freelist =
+						    m_getpackets_internal(
+						    (unsigned int *)&num_needed,
+						    hdrs_needed, M_WAIT, 0,
+						    M64KCLBYTES);
+						/*
+						 * Fall back to 16K cluster size
+						 * if allocation failed
+						 */
+					}
+
 					if (freelist == NULL &&
 					    bytes_to_alloc > MBIGCLBYTES &&
 					    jumbocl) {
@@ -2203,6 +2254,7 @@ sosend(struct socket *so, struct sockaddr *addr, struct uio *uio,
 						break;
 					}
 					bytes_to_copy = min(resid, space);
+					bytes_to_alloc = bytes_to_copy;
 
 				} while (space > 0 &&
 				    (chainlength < sosendmaxchain || atomic ||
@@ -3506,6 +3558,7 @@ dontblock:
 				m->m_data += len;
 				m->m_len -= len;
 				so->so_rcv.sb_cc -= len;
+				sbsnap_update(&so->so_rcv);
 			}
 		}
 		if (so->so_oobmark) {
@@ -4112,6 +4165,7 @@ restart:
 			m->m_data += len;
 			m->m_len -= len;
 			so->so_rcv.sb_cc -= len;
+			sbsnap_update(&so->so_rcv);
 			flags |= MSG_RCVMORE;
 		} else {
 			(void) sbdroprecord(&so->so_rcv);
@@ -4420,6 +4474,7 @@ sorflush(struct socket *so)
 	sb->sb_upcallarg	= NULL;
 	sb->sb_flags		&= ~(SB_SEL|SB_UPCALL);
 	sb->sb_flags		|= SB_DROP;
+	sbsnap_update(sb);
 
 	sbunlock(sb, TRUE);	/* keep socket locked */
 
@@ -5785,14 +5840,50 @@ filt_sordetach(struct knote *kn)
 	socket_unlock(so, 1);
 }
 
+/*
+ * Lock-free check of filt_soread() for the plain data case.  Returns 1
+ * if the socket is not readable, in which case no event is delivered and
+ * the knote needn't be updated; returns 0 if it may be readable or is in
+ * any state that needs the locked path.  The knote is never written here,
+ * as kn_data and kn_flags belong to the locked path; the filter takes the
+ * lock to fill them in whenever it reports an event.  A state change
+ * racing with this check is always followed by a locked KNOTE from
+ * sowakeup(), so a stale answer here is corrected by the next event.
+ */
+static int
+filt_soread_nolock(struct knote *kn, struct socket *so)
+{
+	u_int64_t snap;
+	int64_t lowwat;
+
+	if ((so->so_options & SO_ACCEPTCONN) || so->so_oobmark != 0 ||
+	    (so->so_state & (SS_RCVATMARK|SS_CANTRCVMORE)) ||
+	    so->so_error != 0 || (so->so_flags & SOF_CONTENT_FILTER))
+		return (0);
+
+	snap = SBSNAP_READ(&so->so_rcv_snap);
+	lowwat = so->so_rcv.sb_lowat;
+	if (kn->kn_sfflags & NOTE_LOWAT) {
+		if (kn->kn_sdata > so->so_rcv.sb_hiwat)
+			lowwat = so->so_rcv.sb_hiwat;
+		else if (kn->kn_sdata > lowwat)
+			lowwat = kn->kn_sdata;
+		return ((int64_t)(SBSNAP_CC(snap) - SBSNAP_AUX(snap)) < lowwat);
+	}
+	return ((int64_t)SBSNAP_CC(snap) < lowwat);
+}
+
 /*ARGSUSED*/
 static int
 filt_soread(struct knote *kn, long hint)
 {
 	struct socket *so = (struct socket *)kn->kn_fp->f_fglob->fg_data;
 
-	if ((hint & SO_FILT_HINT_LOCKED) == 0)
+	if ((hint & SO_FILT_HINT_LOCKED) == 0) {
+		if (so_filt_nolock && filt_soread_nolock(kn, so))
+			return (0);
 		socket_lock(so, 1);
+	}
 
 	if (so->so_options & SO_ACCEPTCONN) {
 		int isempty;
@@ -5913,6 +6004,34 @@ so_wait_for_if_feedback(struct socket *so)
 	return (0);
 }
 
+/*
+ * Lock-free check of filt_sowrite(); see filt_soread_nolock().  States
+ * that need more than the send buffer space, including the not-sent low
+ * water mark check which has to walk protocol state, use the locked path.
+ */
+static int
+filt_sowrite_nolock(struct knote *kn, struct socket *so)
+{
+	int64_t lowwat;
+
+	if ((so->so_state & SS_CANTSENDMORE) || so->so_error != 0 ||
+	    (so->so_flags & (SOF_NOTSENT_LOWAT|SOF_CONTENT_FILTER)) ||
+	    (so->so_flags1 & SOF1_PRECONNECT_DATA))
+		return (0);
+
+	if (!socanwrite(so) || so_wait_for_if_feedback(so))
+		return (1);
+
+	lowwat = so->so_snd.sb_lowat;
+	if (kn->kn_sfflags & NOTE_LOWAT) {
+		if (kn->kn_sdata > so->so_snd.sb_hiwat)
+			lowwat = so->so_snd.sb_hiwat;
+		else if (kn->kn_sdata > lowwat)
+			lowwat = kn->kn_sdata;
+	}
+	return (sbspace_nolock(&so->so_snd) < lowwat);
+}
+
 /*ARGSUSED*/
 static int
 filt_sowrite(struct knote *kn, long hint)
@@ -5920,8 +6039,11 @@ filt_sowrite(struct knote *kn, long hint)
 	struct socket *so = (struct socket *)kn->kn_fp->f_fglob->fg_data;
 	int ret = 0;
 
-	if ((hint & SO_FILT_HINT_LOCKED) == 0)
+	if ((hint & SO_FILT_HINT_LOCKED) == 0) {
+		if (so_filt_nolock && filt_sowrite_nolock(kn, so))
+			return (0);
 		socket_lock(so, 1);
+	}
 
 	kn->kn_data = sbspace(&so->so_snd);
 	if (so->so_state & SS_CANTSENDMORE) {
@@ -98,6 +98,8 @@
 
 #include <mach/vm_param.h>
 
+#include <netinet/tcp_tls.h>
+
 #if MPTCP
 #include <netinet/mptcp_var.h>
 #endif
@@ -1397,6 +1399,9 @@ sbappendstream_rcvdemux(struct socket *so, struct mbuf *m, uint32_t seqnum,
 		ret = sbappendmptcpstream_rcv(&so->so_rcv, m);
 	}
 #endif /* MPTCP */
+	else if (so->so_flags1 & SOF1_TLS_RX) {
+		ret = tcp_tls_input(so, m);
+	}
 	else {
 		ret = sbappendstream(&so->so_rcv, m);
 	}
@@ -1691,6 +1696,7 @@ sbcompress(struct sockbuf *sb, struct mbuf *m, struct mbuf *n)
 				/* XXX: Probably don't need */
 				sb->sb_ctl += m->m_len;
 			}
+			sbsnap_update(sb);
 			m = m_free(m);
 			continue;
 		}
@@ -1866,6 +1872,7 @@ sbdrop(struct sockbuf *sb, int len)
 				 */
 				sb->sb_cc = 0;
 				sb->sb_mbcnt = 0;
+				sbsnap_update(sb);
 				if (!(sb->sb_flags & SB_RECV) &&
 				    (sb->sb_so->so_flags & SOF_ENABLE_MSGS)) {
 					sb->sb_so->so_msg_state->
@@ -1884,6 +1891,7 @@ sbdrop(struct sockbuf *sb, int len)
 			if (m->m_type != MT_DATA && m->m_type != MT_HEADER &&
 			    m->m_type != MT_OOBDATA)
 				sb->sb_ctl -= len;
+			sbsnap_update(sb);
 			break;
 		}
 		len -= m->m_len;
@@ -2323,6 +2331,40 @@ sbspace(struct sockbuf *sb)
 	return (space);
 }
 
+/*
+ * Unlocked estimate of sbspace(), computed from the published snapshot
+ * of the buffer counts rather than the live ones.  The result may be
+ * stale by the time it is returned, but sb_cc and sb_mbcnt always come
+ * from the same update.  No content filter compensation is done here,
+ * so callers must take the locked path for sockets with
+ * SOF_CONTENT_FILTER set.  Only meaningful for so_snd, whose snapshot
+ * carries sb_mbcnt.
+ */
+int
+sbspace_nolock(struct sockbuf *sb)
+{
+	u_int64_t snap;
+	u_int32_t hiwat, preconn_hiwat;
+	int space;
+
+	VERIFY(!(sb->sb_flags & SB_RECV) && sb == &sb->sb_so->so_snd);
+
+	snap = SBSNAP_READ(&sb->sb_so->so_snd_snap);
+	hiwat = *(volatile u_int32_t *)&sb->sb_hiwat;
+	preconn_hiwat = *(volatile u_int32_t *)&sb->sb_preconn_hiwat;
+
+	space = imin((int)(hiwat - SBSNAP_CC(snap)),
+	    (int)(*(volatile u_int32_t *)&sb->sb_mbmax - SBSNAP_AUX(snap)));
+
+	if (preconn_hiwat != 0)
+		space = imin((int)(preconn_hiwat - SBSNAP_CC(snap)), space);
+
+	if (space < 0)
+		space = 0;
+
+	return (space);
+}
+
 /*
  * If this socket has priority queues, check if there is enough
  * space in the priority queue for this msg.
@@ -2431,6 +2473,8 @@ sballoc(struct sockbuf *sb, struct mbuf *m)
 	 */
 	if (!(sb->sb_flags & SB_RECV))
 		OSAddAtomic(cnt, &total_snd_byte_count);
+
+	sbsnap_update(sb);
 }
 
 /* adjust counters in sb reflecting freeing of m */
@@ -2458,6 +2502,33 @@ sbfree(struct sockbuf *sb, struct mbuf *m)
 	if (!(sb->sb_flags & SB_RECV)) {
 		OSAddAtomic(cnt, &total_snd_byte_count);
 	}
+
+	sbsnap_update(sb);
+}
+
+/*
+ * Republish the snapshot of sb's counts for the lock-free readiness
+ * checks in the kevent filters.  Must be called with the socket lock
+ * held after any change to sb_cc, sb_ctl or sb_mbcnt.  The snapshot is
+ * a single aligned 64-bit word, so a reader never sees sb_cc from one
+ * update paired with the other count from another.
+ */
+void
+sbsnap_update(struct sockbuf *sb)
+{
+	struct socket *so = sb->sb_so;
+
+	if (so == NULL)
+		return;
+
+	if (sb == &so->so_rcv) {
+		*(volatile u_int64_t *)&so->so_rcv_snap =
+		    ((u_int64_t)sb->sb_ctl << 32) | sb->sb_cc;
+	} else if (sb == &so->so_snd) {
+		*(volatile u_int64_t *)&so->so_snd_snap =
+		    ((u_int64_t)sb->sb_mbcnt << 32) | sb->sb_cc;
+	}
+	/* else a detached copy, e.g. the one in sorflush() */
 }
 
 /*
@@ -2964,6 +3035,9 @@ SYSCTL_INT(_kern_ipc, OID_AUTO, njcl,
 SYSCTL_INT(_kern_ipc, OID_AUTO, njclbytes,
 	CTLFLAG_RD | CTLFLAG_LOCKED, &njclbytes, 0, "");
 
+SYSCTL_INT(_kern_ipc, OID_AUTO, nj64cl,
+	CTLFLAG_RD | CTLFLAG_LOCKED, &nj64cl, 0, "");
+
 SYSCTL_INT(_kern_ipc, KIPC_SOQLIMITCOMPAT, soqlimitcompat,
 	CTLFLAG_RW | CTLFLAG_LOCKED, &soqlimitcompat, 1,
 	"Enable socket queue limit compatibility");
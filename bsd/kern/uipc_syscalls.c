@@ -177,6 +177,15 @@ static u_int externalize_recv_msghdr_array(void *, int, int, u_int,
     const struct user_msghdr_x *, struct recv_msg_elem *);
 static struct recv_msg_elem *alloc_recv_msg_array(u_int count);
 static void free_recv_msg_array(struct recv_msg_elem *, u_int);
+static int sendmsg_x_one(struct proc *, struct socket *,
+    struct user_msghdr_x *, uio_t, int);
+static int sendmsg_x_run(struct proc *, struct socket *, struct uio **,
+    u_int, u_int, int, int);
+static int sendmsg_x_stream(struct proc *, struct socket *,
+    struct user_msghdr_x *, struct uio **, u_int, int);
+static int recvmsg_x_stream(struct proc *, struct socket *,
+    struct user_msghdr_x *, struct recv_msg_elem *, u_int, int *);
+static void uio_append_iovs(uio_t, uio_t);
 
 SYSCTL_DECL(_kern_ipc);
 
@@ -186,6 +195,20 @@ SYSCTL_UINT(_kern_ipc, OID_AUTO, maxsendmsgx,
 static u_int somaxrecvmsgx = 100;
 SYSCTL_UINT(_kern_ipc, OID_AUTO, maxrecvmsgx,
 	CTLFLAG_RW | CTLFLAG_LOCKED, &somaxrecvmsgx, 0, "");
+/*
+ * Set to let sendmsg_x() and recvmsg_x() on stream sockets move each run
+ * of plain messages (no address, control data or flags) with a single
+ * call into sosend()/soreceive(), i.e. one socket lock acquisition and
+ * one protocol entry per run rather than per message.
+ */
+static u_int somsgxstream = 1;
+SYSCTL_UINT(_kern_ipc, OID_AUTO, msgx_stream,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &somsgxstream, 0, "");
+
+/*
+ * Per-message flags accepted by sendmsg_x() in msg_flags
+ */
+#define	SENDMSG_X_MSGFLAGS	(MSG_OOB | MSG_DONTROUTE | MSG_EOR)
 
 /*
  * System call interface to the socket abstraction.
@@ -1536,6 +1559,144 @@ done:
 	return (error);
 }
 
+/*
+ * Send one message of a sendmsg_x() batch on its own, with its address,
+ * control data and per-message flags.
+ */
+static int
+sendmsg_x_one(struct proc *p, struct socket *so, struct user_msghdr_x *mp,
+    uio_t auio, int flags)
+{
+	struct user_msghdr user_msg;
+	int32_t tmpval;
+
+	user_msg.msg_flags = mp->msg_flags;
+	user_msg.msg_controllen = mp->msg_controllen;
+	user_msg.msg_control = mp->msg_control;
+	user_msg.msg_iovlen = mp->msg_iovlen;
+	user_msg.msg_iov = mp->msg_iov;
+	user_msg.msg_namelen = mp->msg_namelen;
+	user_msg.msg_name = mp->msg_name;
+
+	return (sendit(p, so, &user_msg, auio, flags | mp->msg_flags,
+	    &tmpval));
+}
+
+/*
+ * Append the remaining iovecs of "src" to "dst"
+ */
+static void
+uio_append_iovs(uio_t dst, uio_t src)
+{
+	user_addr_t base;
+	user_size_t len;
+	int i;
+
+	for (i = 0; i < uio_iovcnt(src); i++) {
+		if (uio_getiov(src, i, &base, &len) == 0 && len != 0)
+			(void) uio_addiov(dst, base, len);
+	}
+}
+
+/*
+ * Send messages [first, last) of a sendmsg_x() batch on a stream socket
+ * with a single call to pru_sosend(), then account the bytes sent back to
+ * each message in order.
+ */
+static int
+sendmsg_x_run(struct proc *p, struct socket *so, struct uio **uiop,
+    u_int first, u_int last, int iovcnt, int flags)
+{
+	uio_t auio;
+	user_ssize_t len;
+	u_int i;
+	int error;
+
+	if (iovcnt == 0)
+		return (0);
+	auio = uio_create(iovcnt, 0,
+	    IS_64BIT_PROCESS(p) ? UIO_USERSPACE64 : UIO_USERSPACE32,
+	    UIO_WRITE);
+	if (auio == NULL)
+		return (ENOMEM);
+	for (i = first; i < last; i++)
+		uio_append_iovs(auio, uiop[i]);
+
+	len = uio_resid(auio);
+	error = so->so_proto->pr_usrreqs->pru_sosend(so, NULL, auio, NULL,
+	    NULL, flags);
+	len -= uio_resid(auio);
+
+	for (i = first; i < last && len > 0; i++) {
+		user_ssize_t n = uio_resid(uiop[i]);
+
+		if (n > len)
+			n = len;
+		uio_update(uiop[i], n);
+		len -= n;
+	}
+	uio_free(auio);
+
+	return (error);
+}
+
+/*
+ * sendmsg_x() on a stream socket: there are no record boundaries to
+ * preserve, so consecutive plain messages are coalesced into one send.
+ * A message with an address, control data or flags ends the current run
+ * and is sent on its own so that its ancillary data stays attached to
+ * the right byte of the stream.
+ *
+ * The batch stops at the first message that isn't sent in full, as
+ * happens on a non-blocking socket once the send buffer fills up (sendit()
+ * then reports success for the bytes it took); queueing later messages
+ * behind a truncated one would no longer match the order of the caller's
+ * byte stream.
+ */
+static int
+sendmsg_x_stream(struct proc *p, struct socket *so,
+    struct user_msghdr_x *user_msg_x, struct uio **uiop, u_int cnt, int flags)
+{
+	u_int i, first = 0;
+	int iovcnt = 0;
+	int error = 0;
+
+	for (i = 0; i < cnt; i++) {
+		struct user_msghdr_x *mp = user_msg_x + i;
+		int n = uio_iovcnt(uiop[i]);
+
+		if (mp->msg_name != USER_ADDR_NULL ||
+		    mp->msg_control != USER_ADDR_NULL ||
+		    mp->msg_flags != 0) {
+			if (first < i) {
+				error = sendmsg_x_run(p, so, uiop, first, i,
+				    iovcnt, flags);
+				if (error != 0 || uio_resid(uiop[i - 1]) != 0)
+					return (error);
+			}
+			error = sendmsg_x_one(p, so, mp, uiop[i], flags);
+			if (error != 0 || uio_resid(uiop[i]) != 0)
+				return (error);
+			first = i + 1;
+			iovcnt = 0;
+			continue;
+		}
+		if (iovcnt + n > UIO_MAXIOV) {
+			error = sendmsg_x_run(p, so, uiop, first, i, iovcnt,
+			    flags);
+			if (error != 0 || uio_resid(uiop[i - 1]) != 0)
+				return (error);
+			first = i;
+			iovcnt = 0;
+		}
+		iovcnt += n;
+	}
+	if (first < cnt)
+		error = sendmsg_x_run(p, so, uiop, first, cnt, iovcnt, flags);
+
+	return (error);
+}
+
 int
 sendmsg_x(struct proc *p, struct sendmsg_x_args *uap, user_ssize_t *retval)
 {
@@ -1551,6 +1712,7 @@ sendmsg_x(struct proc *p, struct sendmsg_x_args *uap, user_ssize_t *retval)
 	void *umsgp = NULL;
 	u_int uiocnt;
 	int has_addr_or_ctl = 0;
+	int has_flags = 0;
 
 	KERNEL_DEBUG(DBG_FNC_SENDMSG_X | DBG_FUNC_START, 0, 0, 0, 0, 0);
 
@@ -1630,12 +1792,14 @@ sendmsg_x(struct proc *p, struct sendmsg_x_args *uap, user_ssize_t *retval)
 		struct user_msghdr_x *mp = user_msg_x + i;
 
 		/*
-		 * No flags on send message
+		 * Only a few flags make sense on a single message
 		 */
-		if (mp->msg_flags != 0) {
+		if (mp->msg_flags & ~SENDMSG_X_MSGFLAGS) {
 			error = EINVAL;
 			goto out;
 		}
+		if (mp->msg_flags != 0)
+			has_flags = 1;
 		/*
 		 * No support for address or ancillary data (yet)
 		 */
@@ -1673,26 +1837,16 @@ sendmsg_x(struct proc *p, struct sendmsg_x_args *uap, user_ssize_t *retval)
 	 */
 	if (so->so_proto->pr_usrreqs->pru_sosend_list !=
 	    pru_sosend_list_notsupp &&
-	    has_addr_or_ctl == 0 && somaxsendmsgx == 0) {
+	    has_addr_or_ctl == 0 && has_flags == 0 && somaxsendmsgx == 0) {
 		error = so->so_proto->pr_usrreqs->pru_sosend_list(so, uiop,
 		    uap->cnt, uap->flags);
+	} else if (so->so_type == SOCK_STREAM && somsgxstream != 0) {
+		error = sendmsg_x_stream(p, so, user_msg_x, uiop, uap->cnt,
+		    uap->flags);
 	} else {
 		for (i = 0; i < uap->cnt; i++) {
-			struct user_msghdr_x *mp = user_msg_x + i;
-			struct user_msghdr user_msg;
-			uio_t auio = uiop[i];
-			int32_t tmpval;
-
-			user_msg.msg_flags = mp->msg_flags;
-			user_msg.msg_controllen = mp->msg_controllen;
-			user_msg.msg_control = mp->msg_control;
-			user_msg.msg_iovlen = mp->msg_iovlen;
-			user_msg.msg_iov = mp->msg_iov;
-			user_msg.msg_namelen = mp->msg_namelen;
-			user_msg.msg_name = mp->msg_name;
-
-			error = sendit(p, so, &user_msg, auio, uap->flags,
-			    &tmpval);
+			error = sendmsg_x_one(p, so, user_msg_x + i, uiop[i],
+			    uap->flags);
 			if (error != 0)
 				break;
 		}
@@ -2171,6 +2325,109 @@ done:
 	return (error);
 }
 
+/*
+ * recvmsg_x() on a stream socket.  Consecutive messages that ask for
+ * neither an address nor control data are filled by a single call to
+ * pru_soreceive() with one uio spanning all their buffers, which are
+ * then filled in order.  A message that asks for control data is
+ * received on its own so the control data is returned with the data it
+ * arrived with.  Only the first receive may block, and the batch ends
+ * as soon as the socket buffer runs dry.
+ */
+static int
+recvmsg_x_stream(struct proc *p, struct socket *so,
+    struct user_msghdr_x *user_msg_x, struct recv_msg_elem *recv_msg_array,
+    u_int cnt, int *flagsp)
+{
+	int flags = *flagsp;
+	int error = 0;
+	u_int i = 0;
+
+	while (i < cnt && error == 0) {
+		struct recv_msg_elem *recv_msg_elem = recv_msg_array + i;
+		user_ssize_t len;
+		int rflags, iovcnt, short_read;
+		uio_t auio;
+		u_int j, k;
+
+		if (i > 0)
+			flags |= MSG_DONTWAIT;
+		rflags = flags;
+
+		if (recv_msg_elem->which & (SOCK_MSG_SA | SOCK_MSG_CONTROL)) {
+			struct sockaddr **psa;
+			struct mbuf **controlp;
+
+			psa = (recv_msg_elem->which & SOCK_MSG_SA) ?
+			    &recv_msg_elem->psa : NULL;
+			controlp = (recv_msg_elem->which & SOCK_MSG_CONTROL) ?
+			    &recv_msg_elem->controlp : NULL;
+
+			len = uio_resid(recv_msg_elem->uio);
+			error = so->so_proto->pr_usrreqs->pru_soreceive(so,
+			    psa, recv_msg_elem->uio, NULL, controlp, &rflags);
+			len -= uio_resid(recv_msg_elem->uio);
+			if (len > 0 || recv_msg_elem->controlp != NULL)
+				recv_msg_elem->which |= SOCK_MSG_DATA;
+			user_msg_x[i].msg_flags |= (rflags & (MSG_OOB | MSG_EOR));
+			i++;
+			if (uio_resid(recv_msg_elem->uio) != 0)
+				break;
+			continue;
+		}
+
+		iovcnt = 0;
+		for (j = i; j < cnt; j++) {
+			int n = uio_iovcnt(recv_msg_array[j].uio);
+
+			if ((recv_msg_array[j].which &
+			    (SOCK_MSG_SA | SOCK_MSG_CONTROL)) ||
+			    (j > i && iovcnt + n > UIO_MAXIOV))
+				break;
+			iovcnt += n;
+		}
+		if (iovcnt == 0) {
+			/* Nothing but empty buffers in this run */
+			i = j;
+			continue;
+		}
+		auio = uio_create(iovcnt, 0,
+		    IS_64BIT_PROCESS(p) ? UIO_USERSPACE64 : UIO_USERSPACE32,
+		    UIO_READ);
+		if (auio == NULL) {
+			error = ENOMEM;
+			break;
+		}
+		for (k = i; k < j; k++)
+			uio_append_iovs(auio, recv_msg_array[k].uio);
+
+		len = uio_resid(auio);
+		error = so->so_proto->pr_usrreqs->pru_soreceive(so, NULL,
+		    auio, NULL, NULL, &rflags);
+		len -= uio_resid(auio);
+		short_read = (uio_resid(auio) != 0);
+		uio_free(auio);
+
+		for (k = i; k < j && len > 0; k++) {
+			user_ssize_t n = uio_resid(recv_msg_array[k].uio);
+
+			if (n > len)
+				n = len;
+			uio_update(recv_msg_array[k].uio, n);
+			recv_msg_array[k].which |= SOCK_MSG_DATA;
+			len -= n;
+		}
+		i = j;
+		if (short_read)
+			break;
+	}
+	if ((*flagsp & MSG_DONTWAIT) == 0)
+		flags &= ~MSG_DONTWAIT;
+	*flagsp = flags;
+
+	return (error);
+}
+
 int
 recvmsg_x(struct proc *p, struct recvmsg_x_args *uap, user_ssize_t *retval)
 {
@@ -2279,6 +2536,9 @@ recvmsg_x(struct proc *p, struct recvmsg_x_args *uap, user_ssize_t *retval)
 	    somaxrecvmsgx == 0) {
 		error = so->so_proto->pr_usrreqs->pru_soreceive_list(so,
 		    recv_msg_array, uap->cnt, &uap->flags);
+	} else if (so->so_type == SOCK_STREAM && somsgxstream != 0) {
+		error = recvmsg_x_stream(p, so, user_msg_x, recv_msg_array,
+		    uap->cnt, &uap->flags);
 	} else {
 		int flags = uap->flags;
 
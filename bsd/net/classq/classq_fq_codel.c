@@ -0,0 +1,761 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/cdefs.h>
+#include <sys/param.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/systm.h>
+#include <sys/sysctl.h>
+#include <sys/syslog.h>
+#include <sys/errno.h>
+#include <sys/kernel.h>
+
+#include <kern/zalloc.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/dlil.h>
+
+#include <net/classq/classq_fq_codel.h>
+#include <net/flowhash.h>
+#include <net/net_osdep.h>
+#include <dev/random/randomdev.h>
+
+/*
+ * Flow Queue CoDel
+ *
+ * T. Hoeiland-Joergensen, P. McKenney, D. Taht, J. Gettys, E. Dumazet
+ * https://tools.ietf.org/html/rfc8290
+ *
+ * K. Nichols, V. Jacobson, A. McGregor, J. Iyengar
+ * https://tools.ietf.org/html/rfc8289
+ *
+ * Packets of a class are spread over FQ_CODEL_FLOWS flow queues by
+ * hashing pkt_flowid.  Flows are served by deficit round robin, with
+ * newly active flows (the "new" list) served ahead of flows that have
+ * already used up a quantum (the "old" list), so sparse flows such as
+ * request/response traffic see little queueing delay.  Each flow runs
+ * its own CoDel instance, which drops (or ECN marks) at dequeue time
+ * once the sojourn time of the flow has stayed above the target for
+ * a whole interval.
+ *
+ * The class queue handed in by the scheduler holds no packets; only
+ * its qlen and qsize are maintained here, so that the scheduler can
+ * keep using qempty()/qlen() on it.  Since CoDel drops packets the
+ * scheduler never sees, the interface queue length and drop counters
+ * are adjusted here for those packets.
+ */
+
+#define	FQ_CODEL_HASH		net_flowhash_mh3_x86_32
+#define	FQ_CODEL_FLOWMASK	(FQ_CODEL_FLOWS - 1)
+
+#define	FQ_CODEL_FLOW(_fqc, _i)	(&(*(_fqc)->fqc_flows)[_i])
+
+#define	FQ_CODEL_TARGET_DEFAULT	(5ULL * 1000 * 1000)	/* 5ms */
+#define	FQ_CODEL_INTERVAL_DEFAULT (100ULL * 1000 * 1000) /* 100ms */
+
+/* used when the interface MTU is not yet known */
+#define	FQ_CODEL_QUANTUM_DEFAULT	1514
+
+#define	FQ_CODEL_ZONE_MAX	32		/* maximum elements in zone */
+#define	FQ_CODEL_ZONE_NAME	"classq_fq_codel" /* zone name */
+
+#define	FQ_CODEL_FLOWS_ZONE_MAX	32		/* maximum elements in zone */
+#define	FQ_CODEL_FLOWS_ZONE_NAME "classq_fq_codel_flows" /* zone name */
+
+static unsigned int fq_codel_size;	/* size of zone element */
+static struct zone *fq_codel_zone;	/* zone for fq_codel */
+
+static unsigned int fq_codel_flows_size; /* size of zone element */
+static struct zone *fq_codel_flows_zone; /* zone for fq_codel_flows */
+
+/* internal function prototypes */
+static u_int64_t fq_codel_uptime(void);
+static u_int32_t fq_codel_isqrt(u_int64_t);
+static inline u_int64_t fq_codel_control_law(u_int64_t, u_int64_t,
+    u_int32_t);
+static void fq_codel_calc_params(struct fq_codel *);
+static inline struct fq_codel_flow *fq_codel_classify(struct fq_codel *,
+    struct pkthdr *);
+static inline void fq_codel_q_dec(class_queue_t *, struct mbuf *);
+static void fq_codel_drop(struct fq_codel *, struct mbuf *);
+static struct fq_codel_flow *fq_codel_fattest(struct fq_codel *);
+static struct mbuf *fq_codel_flow_getq(struct fq_codel *, class_queue_t *,
+    struct fq_codel_flow *, u_int64_t, boolean_t *);
+static struct mbuf *fq_codel_flow_dequeue(struct fq_codel *,
+    class_queue_t *, struct fq_codel_flow *, u_int64_t);
+static boolean_t fq_codel_mark_or_drop(struct fq_codel *, struct mbuf *);
+static struct mbuf *fq_codel_dequeue(struct fq_codel *, class_queue_t *);
+static void fq_codel_resetq(struct fq_codel *);
+
+SYSCTL_NODE(_net_classq, OID_AUTO, fq_codel, CTLFLAG_RW|CTLFLAG_LOCKED, 0,
+    "FQ-CoDel");
+
+static u_int64_t fq_codel_target_qdelay = 0;	/* 0 indicates "automatic" */
+SYSCTL_QUAD(_net_classq_fq_codel, OID_AUTO, target_qdelay,
+    CTLFLAG_RW|CTLFLAG_LOCKED, &fq_codel_target_qdelay,
+    "FQ-CoDel target queue delay in nanoseconds");
+
+static u_int64_t fq_codel_update_interval = 0;	/* 0 indicates "automatic" */
+SYSCTL_QUAD(_net_classq_fq_codel, OID_AUTO, update_interval,
+    CTLFLAG_RW|CTLFLAG_LOCKED, &fq_codel_update_interval,
+    "FQ-CoDel interval in nanoseconds");
+
+static u_int32_t fq_codel_quantum = 0;		/* 0 indicates "automatic" */
+SYSCTL_UINT(_net_classq_fq_codel, OID_AUTO, quantum,
+    CTLFLAG_RW|CTLFLAG_LOCKED, &fq_codel_quantum, 0,
+    "FQ-CoDel DRR quantum in bytes");
+
+void
+fq_codel_init(void)
+{
+	_CASSERT(FQCF_ECN4 == CLASSQF_ECN4);
+	_CASSERT(FQCF_ECN6 == CLASSQF_ECN6);
+	_CASSERT(!(FQ_CODEL_FLOWS & FQ_CODEL_FLOWMASK));
+
+	fq_codel_size = sizeof (struct fq_codel);
+	fq_codel_zone = zinit(fq_codel_size,
+	    FQ_CODEL_ZONE_MAX * fq_codel_size, 0, FQ_CODEL_ZONE_NAME);
+	if (fq_codel_zone == NULL) {
+		panic("%s: failed allocating %s", __func__, FQ_CODEL_ZONE_NAME);
+		/* NOTREACHED */
+	}
+	zone_change(fq_codel_zone, Z_EXPAND, TRUE);
+	zone_change(fq_codel_zone, Z_CALLERACCT, TRUE);
+
+	fq_codel_flows_size = sizeof (*((struct fq_codel *)0)->fqc_flows);
+	fq_codel_flows_zone = zinit(fq_codel_flows_size,
+	    FQ_CODEL_FLOWS_ZONE_MAX * fq_codel_flows_size, 0,
+	    FQ_CODEL_FLOWS_ZONE_NAME);
+	if (fq_codel_flows_zone == NULL) {
+		panic("%s: failed allocating %s", __func__,
+		    FQ_CODEL_FLOWS_ZONE_NAME);
+		/* NOTREACHED */
+	}
+	zone_change(fq_codel_flows_zone, Z_EXPAND, TRUE);
+	zone_change(fq_codel_flows_zone, Z_CALLERACCT, TRUE);
+}
+
+static u_int64_t
+fq_codel_uptime(void)
+{
+	struct timespec now;
+	u_int64_t now_ns;
+
+	nanouptime(&now);
+	net_timernsec(&now, &now_ns);
+	return (now_ns);
+}
+
+/* integer square root, rounded down */
+static u_int32_t
+fq_codel_isqrt(u_int64_t x)
+{
+	u_int64_t r = 0, b = (1ULL << 62);
+
+	while (b > x)
+		b >>= 2;
+	while (b != 0) {
+		if (x >= r + b) {
+			x -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+		b >>= 2;
+	}
+	return ((u_int32_t)r);
+}
+
+/*
+ * CoDel control law: the next drop happens interval/sqrt(count) after t.
+ * The square root is taken in Q8 so that small counts stay accurate.
+ */
+static inline u_int64_t
+fq_codel_control_law(u_int64_t t, u_int64_t interval, u_int32_t count)
+{
+	return (t + ((interval << 8) / fq_codel_isqrt((u_int64_t)count << 16)));
+}
+
+static void
+fq_codel_calc_params(struct fq_codel *fqc)
+{
+	struct ifnet *ifp = fqc->fqc_ifp;
+	u_int64_t target, interval;
+	u_int32_t quantum;
+
+	target = IFCQ_TARGET_QDELAY(&ifp->if_snd);
+	if (fq_codel_target_qdelay != 0)
+		target = fq_codel_target_qdelay;
+	if (target == 0)
+		target = FQ_CODEL_TARGET_DEFAULT;
+
+	/*
+	 * If a delay has been added to ifnet start callback for
+	 * coalescing, packets sit in the queue for that much longer.
+	 */
+	if ((ifp->if_eflags & IFEF_ENQUEUE_MULTI) &&
+	    ifp->if_start_delay_timeout > 0)
+		target += ifp->if_start_delay_timeout;
+
+	interval = fq_codel_update_interval;
+	if (interval == 0)
+		interval = FQ_CODEL_INTERVAL_DEFAULT;
+	if (interval < target)
+		interval = target;
+
+	quantum = fq_codel_quantum;
+	if (quantum == 0 && ifp->if_mtu > 0)
+		quantum = ifp->if_mtu + ifp->if_hdrlen;
+	if (quantum == 0)
+		quantum = FQ_CODEL_QUANTUM_DEFAULT;
+
+	fqc->fqc_target = target;
+	fqc->fqc_interval = interval;
+	fqc->fqc_quantum = quantum;
+}
+
+/*
+ * fq_codel support routines
+ */
+struct fq_codel *
+fq_codel_alloc(struct ifnet *ifp, u_int32_t qid, u_int32_t qlim,
+    u_int32_t flags)
+{
+	struct fq_codel *fqc;
+
+	VERIFY(ifp != NULL && qlim > 0);
+
+	fqc = zalloc(fq_codel_zone);
+	if (fqc == NULL) {
+		log(LOG_ERR, "%s: FQ-CoDel unable to allocate\n",
+		    if_name(ifp));
+		return (NULL);
+	}
+	bzero(fqc, fq_codel_size);
+
+	if ((fqc->fqc_flows = zalloc(fq_codel_flows_zone)) == NULL) {
+		log(LOG_ERR, "%s: FQ-CoDel unable to allocate flows\n",
+		    if_name(ifp));
+		fq_codel_destroy(fqc);
+		return (NULL);
+	}
+
+	fqc->fqc_ifp = ifp;
+	fqc->fqc_qlim = qlim;
+	fqc->fqc_qid = qid;
+	fqc->fqc_flags = (flags & FQCF_USERFLAGS);
+#if !PF_ECN
+	if (fqc->fqc_flags & FQCF_ECN) {
+		fqc->fqc_flags &= ~FQCF_ECN;
+		log(LOG_ERR, "%s: FQ-CoDel qid=%d, ECN not available; "
+		    "ignoring FQCF_ECN flag!\n", if_name(ifp), fqc->fqc_qid);
+	}
+#endif /* !PF_ECN */
+
+	fq_codel_resetq(fqc);
+
+	return (fqc);
+}
+
+void
+fq_codel_destroy(struct fq_codel *fqc)
+{
+	int i;
+
+	if (fqc->fqc_peek != NULL) {
+		m_freem(fqc->fqc_peek);
+		fqc->fqc_peek = NULL;
+	}
+	if (fqc->fqc_flows != NULL) {
+		for (i = 0; i < FQ_CODEL_FLOWS; i++)
+			_flushq(&FQ_CODEL_FLOW(fqc, i)->fqf_q);
+		zfree(fq_codel_flows_zone, fqc->fqc_flows);
+		fqc->fqc_flows = NULL;
+	}
+	zfree(fq_codel_zone, fqc);
+}
+
+static void
+fq_codel_resetq(struct fq_codel *fqc)
+{
+	struct ifnet *ifp = fqc->fqc_ifp;
+	int i;
+
+	bzero(fqc->fqc_flows, fq_codel_flows_size);
+	for (i = 0; i < FQ_CODEL_FLOWS; i++) {
+		_qinit(&FQ_CODEL_FLOW(fqc, i)->fqf_q, Q_DROPTAIL,
+		    fqc->fqc_qlim);
+	}
+	STAILQ_INIT(&fqc->fqc_new_flows);
+	STAILQ_INIT(&fqc->fqc_old_flows);
+	fqc->fqc_fudge = RandomULong();
+
+	fq_codel_calc_params(fqc);
+	bzero(&fqc->fqc_stats, sizeof (fqc->fqc_stats));
+
+	if (!classq_verbose)
+		return;
+
+	log(LOG_DEBUG, "%s: FQ-CoDel qid=%d, flows=%d, quantum=%d, "
+	    "target=%llu nsec, interval=%llu nsec, flags=0x%x\n",
+	    if_name(ifp), fqc->fqc_qid, FQ_CODEL_FLOWS, fqc->fqc_quantum,
+	    fqc->fqc_target, fqc->fqc_interval, fqc->fqc_flags);
+}
+
+void
+fq_codel_getstats(struct fq_codel *fqc, struct fq_codel_stats *sp)
+{
+	struct fq_codel_flow *fqf;
+
+	*sp = *(&fqc->fqc_stats);
+	sp->target_qdelay = fqc->fqc_target;
+	sp->update_interval = fqc->fqc_interval;
+	sp->quantum = fqc->fqc_quantum;
+	sp->flows = FQ_CODEL_FLOWS;
+	sp->flags = fqc->fqc_flags;
+	sp->new_flows = sp->old_flows = 0;
+	STAILQ_FOREACH(fqf, &fqc->fqc_new_flows, fqf_link)
+		sp->new_flows++;
+	STAILQ_FOREACH(fqf, &fqc->fqc_old_flows, fqf_link)
+		sp->old_flows++;
+}
+
+static inline struct fq_codel_flow *
+fq_codel_classify(struct fq_codel *fqc, struct pkthdr *pkt)
+{
+	u_int32_t idx;
+
+	idx = FQ_CODEL_HASH(&pkt->pkt_flowid, sizeof (pkt->pkt_flowid),
+	    fqc->fqc_fudge) & FQ_CODEL_FLOWMASK;
+	return (FQ_CODEL_FLOW(fqc, idx));
+}
+
+/* account for a packet leaving the (packet-less) class queue */
+static inline void
+fq_codel_q_dec(class_queue_t *q, struct mbuf *m)
+{
+	VERIFY(qlen(q) > 0);
+	qlen(q)--;
+
+	/* qsize is an approximation, so adjust if necessary */
+	if (((int)qsize(q) - m_length(m)) > 0)
+		qsize(q) -= m_length(m);
+	else if (qsize(q) != 0)
+		qsize(q) = 0;
+}
+
+/*
+ * Free a packet that was already taken off the class queue but which
+ * the scheduler will never see; keep the interface queue consistent.
+ */
+static void
+fq_codel_drop(struct fq_codel *fqc, struct mbuf *m)
+{
+	struct ifclassq *ifq = &fqc->fqc_ifp->if_snd;
+	u_int32_t len = m_pktlen(m);
+
+	IFCQ_CONVERT_LOCK(ifq);
+	VERIFY(!IFCQ_IS_EMPTY(ifq));
+	IFCQ_DEC_LEN(ifq);
+	IFCQ_DEC_BYTES(ifq, len);
+	IFCQ_DROP_ADD(ifq, 1, len);
+	m_freem(m);
+}
+
+static struct fq_codel_flow *
+fq_codel_fattest(struct fq_codel *fqc)
+{
+	struct fq_codel_flow *fqf, *fat = NULL;
+	int i;
+
+	for (i = 0; i < FQ_CODEL_FLOWS; i++) {
+		fqf = FQ_CODEL_FLOW(fqc, i);
+		if (qempty(&fqf->fqf_q))
+			continue;
+		if (fat == NULL || qsize(&fqf->fqf_q) > qsize(&fat->fqf_q))
+			fat = fqf;
+	}
+	return (fat);
+}
+
+int
+fq_codel_addq(struct fq_codel *fqc, class_queue_t *q, struct mbuf *m,
+    struct pf_mtag *t)
+{
+#pragma unused(t)
+	struct pkthdr *pkt = &m->m_pkthdr;
+	struct fq_codel_flow *fqf, *fat;
+	struct mbuf *n;
+
+	if (fqc->fqc_flags & FQCF_SUSPENDED) {
+		fqc->fqc_stats.drop_suspended++;
+		IFCQ_CONVERT_LOCK(&fqc->fqc_ifp->if_snd);
+		m_freem(m);
+		return (CLASSQEQ_DROPPED_SP);
+	}
+
+	if (pkt->pkt_enqueue_ts == 0)
+		pkt->pkt_enqueue_ts = fq_codel_uptime();
+	if (pkt->pkt_flowid == 0)
+		fqc->fqc_stats.null_flowid++;
+
+	fqf = fq_codel_classify(fqc, pkt);
+
+	/*
+	 * When the class is full, make room by dropping from the head of
+	 * the flow with the largest backlog; if that is our own flow, the
+	 * arriving packet is the one to go.
+	 */
+	if (qlen(q) >= qlimit(q)) {
+		fat = fq_codel_fattest(fqc);
+		fqc->fqc_stats.drop_overflow++;
+		if (fat == NULL || fat == fqf ||
+		    qsize(&fat->fqf_q) <= qsize(&fqf->fqf_q)) {
+			IFCQ_CONVERT_LOCK(&fqc->fqc_ifp->if_snd);
+			m_freem(m);
+			return (CLASSQEQ_DROPPED);
+		}
+		n = _getq(&fat->fqf_q);
+		fq_codel_q_dec(q, n);
+		fq_codel_drop(fqc, n);
+	}
+
+	_addq(&fqf->fqf_q, m);
+	qlen(q)++;
+	VERIFY(qlen(q) != 0);
+	qsize(q) += m_length(m);
+
+	if (!(fqf->fqf_flags & (FQF_NEW | FQF_OLD))) {
+		fqf->fqf_flags |= FQF_NEW;
+		fqf->fqf_deficit = fqc->fqc_quantum;
+		STAILQ_INSERT_TAIL(&fqc->fqc_new_flows, fqf, fqf_link);
+		fqc->fqc_stats.new_flow_count++;
+	}
+
+	/* successfully queued */
+	return (CLASSQEQ_SUCCESS);
+}
+
+/*
+ * Take the head packet off a flow and decide whether CoDel considers
+ * it droppable: the sojourn time has been above target for at least
+ * an interval, and the flow holds more than one quantum of backlog.
+ */
+static struct mbuf *
+fq_codel_flow_getq(struct fq_codel *fqc, class_queue_t *q,
+    struct fq_codel_flow *fqf, u_int64_t now, boolean_t *ok_to_drop)
+{
+	struct mbuf *m;
+	u_int64_t sojourn = 0;
+
+	*ok_to_drop = FALSE;
+	if ((m = _getq(&fqf->fqf_q)) == NULL) {
+		fqf->fqf_first_above = 0;
+		return (NULL);
+	}
+	fq_codel_q_dec(q, m);
+
+	if (now > m->m_pkthdr.pkt_enqueue_ts)
+		sojourn = now - m->m_pkthdr.pkt_enqueue_ts;
+	m->m_pkthdr.pkt_enqueue_ts = 0;
+	if (sojourn > fqc->fqc_stats.max_sojourn)
+		fqc->fqc_stats.max_sojourn = sojourn;
+
+	if (sojourn < fqc->fqc_target ||
+	    qsize(&fqf->fqf_q) <= fqc->fqc_quantum) {
+		/* went below target, or not enough backlog to bother */
+		fqf->fqf_first_above = 0;
+	} else if (fqf->fqf_first_above == 0) {
+		fqf->fqf_first_above = now + fqc->fqc_interval;
+	} else if (now >= fqf->fqf_first_above) {
+		*ok_to_drop = TRUE;
+	}
+	return (m);
+}
+
+/* returns TRUE if the packet was ECN marked instead of dropped */
+static boolean_t
+fq_codel_mark_or_drop(struct fq_codel *fqc, struct mbuf *m)
+{
+#if PF_ECN
+	if ((fqc->fqc_flags & FQCF_ECN) &&
+	    mark_ecn(m, m_pftag(m), fqc->fqc_flags)) {
+		fqc->fqc_stats.marked_packets++;
+		return (TRUE);
+	}
+#endif /* PF_ECN */
+	fqc->fqc_stats.drop_codel++;
+	fq_codel_drop(fqc, m);
+	return (FALSE);
+}
+
+/* CoDel dequeue for a single flow, RFC 8289 section 5.5 */
+static struct mbuf *
+fq_codel_flow_dequeue(struct fq_codel *fqc, class_queue_t *q,
+    struct fq_codel_flow *fqf, u_int64_t now)
+{
+	struct mbuf *m;
+	boolean_t drop;
+	u_int32_t delta;
+
+	m = fq_codel_flow_getq(fqc, q, fqf, now, &drop);
+	if (m == NULL) {
+		fqf->fqf_flags &= ~FQF_DROPPING;
+		return (NULL);
+	}
+
+	if (fqf->fqf_flags & FQF_DROPPING) {
+		if (!drop) {
+			/* sojourn time below target; leave dropping state */
+			fqf->fqf_flags &= ~FQF_DROPPING;
+			return (m);
+		}
+		while (now >= fqf->fqf_drop_next &&
+		    (fqf->fqf_flags & FQF_DROPPING)) {
+			fqf->fqf_count++;
+			if (fq_codel_mark_or_drop(fqc, m)) {
+				fqf->fqf_drop_next = fq_codel_control_law(
+				    fqf->fqf_drop_next, fqc->fqc_interval,
+				    fqf->fqf_count);
+				return (m);
+			}
+			m = fq_codel_flow_getq(fqc, q, fqf, now, &drop);
+			if (!drop) {
+				fqf->fqf_flags &= ~FQF_DROPPING;
+			} else {
+				fqf->fqf_drop_next = fq_codel_control_law(
+				    fqf->fqf_drop_next, fqc->fqc_interval,
+				    fqf->fqf_count);
+			}
+		}
+	} else if (drop) {
+		if (!fq_codel_mark_or_drop(fqc, m))
+			m = fq_codel_flow_getq(fqc, q, fqf, now, &drop);
+		fqf->fqf_flags |= FQF_DROPPING;
+
+		/*
+		 * If we were dropping recently, resume at the previous
+		 * drop rate rather than starting over from a count of 1.
+		 */
+		delta = fqf->fqf_count - fqf->fqf_lastcount;
+		if (delta > 1 && (int64_t)(now - fqf->fqf_drop_next) <
+		    (int64_t)(16 * fqc->fqc_interval))
+			fqf->fqf_count = delta;
+		else
+			fqf->fqf_count = 1;
+		fqf->fqf_lastcount = fqf->fqf_count;
+		fqf->fqf_drop_next = fq_codel_control_law(now,
+		    fqc->fqc_interval, fqf->fqf_count);
+	}
+	return (m);
+}
+
+/* DRR over the new and old flow lists, RFC 8290 section 4.2 */
+static struct mbuf *
+fq_codel_dequeue(struct fq_codel *fqc, class_queue_t *q)
+{
+	struct fq_codel_flowlist *list;
+	struct fq_codel_flow *fqf;
+	struct mbuf *m;
+	u_int64_t now;
+
+	if (fqc->fqc_flags & FQCF_SUSPENDED)
+		return (NULL);
+
+	now = fq_codel_uptime();
+	for (;;) {
+		if (!STAILQ_EMPTY(&fqc->fqc_new_flows))
+			list = &fqc->fqc_new_flows;
+		else if (!STAILQ_EMPTY(&fqc->fqc_old_flows))
+			list = &fqc->fqc_old_flows;
+		else
+			return (NULL);
+
+		fqf = STAILQ_FIRST(list);
+		if (fqf->fqf_deficit <= 0) {
+			/* quantum used up; go to the back of the old list */
+			fqf->fqf_deficit += fqc->fqc_quantum;
+			STAILQ_REMOVE_HEAD(list, fqf_link);
+			fqf->fqf_flags &= ~FQF_NEW;
+			fqf->fqf_flags |= FQF_OLD;
+			STAILQ_INSERT_TAIL(&fqc->fqc_old_flows, fqf, fqf_link);
+			continue;
+		}
+
+		if ((m = fq_codel_flow_dequeue(fqc, q, fqf, now)) == NULL) {
+			/*
+			 * An empty new flow moves to the old list, so that
+			 * a flow cannot stay "new" by sending one packet
+			 * per round; an empty old flow becomes inactive.
+			 */
+			STAILQ_REMOVE_HEAD(list, fqf_link);
+			if (list == &fqc->fqc_new_flows &&
+			    !STAILQ_EMPTY(&fqc->fqc_old_flows)) {
+				fqf->fqf_flags &= ~FQF_NEW;
+				fqf->fqf_flags |= FQF_OLD;
+				STAILQ_INSERT_TAIL(&fqc->fqc_old_flows, fqf,
+				    fqf_link);
+			} else {
+				fqf->fqf_flags &= ~(FQF_NEW | FQF_OLD);
+			}
+			continue;
+		}
+
+		fqf->fqf_deficit -= m_pktlen(m);
+		return (m);
+	}
+}
+
+struct mbuf *
+fq_codel_getq(struct fq_codel *fqc, class_queue_t *q)
+{
+	struct mbuf *m;
+
+	/* hand out what fq_codel_pollq picked, if anything */
+	if ((m = fqc->fqc_peek) != NULL) {
+		fqc->fqc_peek = NULL;
+		fq_codel_q_dec(q, m);
+		return (m);
+	}
+	return (fq_codel_dequeue(fqc, q));
+}
+
+/*
+ * The packet at the "head" of a FQ-CoDel queue is not known until the
+ * DRR and CoDel decisions have been made, so polling runs a dequeue
+ * and parks the result until the following fq_codel_getq.
+ */
+struct mbuf *
+fq_codel_pollq(struct fq_codel *fqc, class_queue_t *q)
+{
+	struct mbuf *m;
+
+	if (fqc->fqc_peek == NULL &&
+	    (m = fq_codel_dequeue(fqc, q)) != NULL) {
+		fqc->fqc_peek = m;
+		qlen(q)++;
+		qsize(q) += m_length(m);
+	}
+	return (fqc->fqc_peek);
+}
+
+void
+fq_codel_purgeq(struct fq_codel *fqc, class_queue_t *q, u_int32_t flow,
+    u_int32_t *packets, u_int32_t *bytes)
+{
+	struct fq_codel_flow *fqf;
+	u_int32_t cnt = 0, len = 0;
+	struct mbuf *m;
+	int i;
+
+	IFCQ_CONVERT_LOCK(&fqc->fqc_ifp->if_snd);
+
+	if ((m = fqc->fqc_peek) != NULL &&
+	    (flow == 0 || m->m_pkthdr.pkt_flowid == flow)) {
+		fqc->fqc_peek = NULL;
+		fq_codel_q_dec(q, m);
+		cnt++;
+		len += m_pktlen(m);
+		m_freem(m);
+	}
+
+	for (i = 0; i < FQ_CODEL_FLOWS; i++) {
+		fqf = FQ_CODEL_FLOW(fqc, i);
+		/* flow of 0 means all flows */
+		while ((m = _getq_flow(&fqf->fqf_q, flow)) != NULL) {
+			fq_codel_q_dec(q, m);
+			cnt++;
+			len += m_pktlen(m);
+			m_freem(m);
+		}
+	}
+
+	/*
+	 * Emptied flows are left on their lists; fq_codel_dequeue takes
+	 * them off as it comes across them.
+	 */
+	if (packets != NULL)
+		*packets = cnt;
+	if (bytes != NULL)
+		*bytes = len;
+}
+
+void
+fq_codel_updateq(struct fq_codel *fqc, cqev_t ev)
+{
+	struct ifnet *ifp = fqc->fqc_ifp;
+
+	VERIFY(ifp != NULL);
+
+	switch (ev) {
+	case CLASSQ_EV_LINK_BANDWIDTH:
+	case CLASSQ_EV_LINK_MTU:
+		fq_codel_calc_params(fqc);
+		if (classq_verbose) {
+			log(LOG_DEBUG, "%s: FQ-CoDel qid=%d, quantum=%d "
+			    "target=%llu nsec after %s\n", if_name(ifp),
+			    fqc->fqc_qid, fqc->fqc_quantum, fqc->fqc_target,
+			    ifclassq_ev2str(ev));
+		}
+		break;
+
+	case CLASSQ_EV_LINK_LATENCY:
+	case CLASSQ_EV_LINK_UP:
+	case CLASSQ_EV_LINK_DOWN:
+	default:
+		break;
+	}
+}
+
+int
+fq_codel_suspendq(struct fq_codel *fqc, class_queue_t *q, boolean_t on)
+{
+#pragma unused(q)
+	struct ifnet *ifp = fqc->fqc_ifp;
+
+	VERIFY(ifp != NULL);
+
+	if ((on && (fqc->fqc_flags & FQCF_SUSPENDED)) ||
+	    (!on && !(fqc->fqc_flags & FQCF_SUSPENDED)))
+		return (0);
+
+	if (classq_verbose) {
+		log(LOG_DEBUG, "%s: FQ-CoDel qid=%d, setting state to %s",
+		    if_name(ifp), fqc->fqc_qid,
+		    (on ? "SUSPENDED" : "RUNNING"));
+	}
+
+	if (on)
+		fqc->fqc_flags |= FQCF_SUSPENDED;
+	else
+		fqc->fqc_flags &= ~FQCF_SUSPENDED;
+
+	return (0);
+}
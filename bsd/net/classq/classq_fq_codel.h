@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _NET_CLASSQ_CLASSQ_FQ_CODEL_H_
+#define	_NET_CLASSQ_CLASSQ_FQ_CODEL_H_
+
+#ifdef PRIVATE
+#ifdef BSD_KERNEL_PRIVATE
+#include <sys/queue.h>
+#include <net/classq/if_classq.h>
+#endif /* BSD_KERNEL_PRIVATE */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	FQ_CODEL_FLOWS_SHIFT	7
+#define	FQ_CODEL_FLOWS		(1 << FQ_CODEL_FLOWS_SHIFT)	/* per class */
+
+struct fq_codel_stats {
+	u_int64_t		target_qdelay;	/* CoDel target, in nsec */
+	u_int64_t		update_interval; /* CoDel interval, in nsec */
+	u_int32_t		quantum;	/* DRR quantum, in bytes */
+	u_int32_t		flows;		/* number of flow queues */
+	u_int32_t		new_flows;	/* flows on the new list */
+	u_int32_t		old_flows;	/* flows on the old list */
+	u_int32_t		flags;
+	u_int32_t		pad;
+	u_int64_t		drop_codel;	/* dropped by CoDel at dequeue */
+	u_int64_t		drop_overflow;	/* dropped from fattest flow */
+	u_int64_t		drop_suspended;	/* dropped while suspended */
+	u_int64_t		marked_packets;	/* ECN marked by CoDel */
+	u_int64_t		new_flow_count;	/* flows that became new */
+	u_int64_t		null_flowid;	/* packets without a flow ID */
+	u_int64_t		max_sojourn;	/* largest sojourn seen, in nsec */
+};
+
+#ifdef BSD_KERNEL_PRIVATE
+/*
+ * Per-flow queue.  The packets themselves live in fqf_q, which is an
+ * ordinary class_queue_t; the CoDel state follows RFC 8289.
+ */
+struct fq_codel_flow {
+	class_queue_t		fqf_q;		/* packets of this flow */
+	STAILQ_ENTRY(fq_codel_flow) fqf_link;	/* on new or old list */
+	int32_t			fqf_deficit;	/* DRR deficit, in bytes */
+	u_int32_t		fqf_flags;	/* FQF_* */
+	u_int32_t		fqf_count;	/* drops since entering dropping */
+	u_int32_t		fqf_lastcount;	/* count at last dropping exit */
+	u_int64_t		fqf_first_above; /* when sojourn went above */
+	u_int64_t		fqf_drop_next;	/* next drop time, in nsec */
+};
+
+/* flow queue flags */
+#define	FQF_NEW		0x01	/* on the new flows list */
+#define	FQF_OLD		0x02	/* on the old flows list */
+#define	FQF_DROPPING	0x04	/* CoDel is in dropping state */
+
+STAILQ_HEAD(fq_codel_flowlist, fq_codel_flow);
+
+/* FQ-CoDel flags */
+#define	FQCF_ECN4	0x01	/* use packet marking for IPv4 packets */
+#define	FQCF_ECN6	0x02	/* use packet marking for IPv6 packets */
+#define	FQCF_ECN	(FQCF_ECN4 | FQCF_ECN6)
+#define	FQCF_SUSPENDED	0x1000	/* queue is suspended */
+
+#define	FQCF_USERFLAGS	(FQCF_ECN4 | FQCF_ECN6)
+
+typedef struct fq_codel {
+	u_int32_t	fqc_flags;	/* FQ-CoDel flags */
+	u_int32_t	fqc_qid;
+	u_int32_t	fqc_qlim;
+	u_int32_t	fqc_quantum;	/* DRR quantum, in bytes */
+	u_int32_t	fqc_fudge;	/* flow hash perturbation */
+	u_int64_t	fqc_target;	/* CoDel target sojourn, in nsec */
+	u_int64_t	fqc_interval;	/* CoDel interval, in nsec */
+	struct ifnet	*fqc_ifp;	/* back pointer to ifnet */
+
+	/* packet handed out by fq_codel_pollq, not yet dequeued */
+	struct mbuf	*fqc_peek;
+
+	/* DRR lists */
+	struct fq_codel_flowlist fqc_new_flows;
+	struct fq_codel_flowlist fqc_old_flows;
+
+	/* flow queues */
+	struct fq_codel_flow (*fqc_flows)[FQ_CODEL_FLOWS];
+
+	/* statistics */
+	struct fq_codel_stats fqc_stats __attribute__((aligned(8)));
+} fq_codel_t;
+
+extern void fq_codel_init(void);
+extern struct fq_codel *fq_codel_alloc(struct ifnet *, u_int32_t, u_int32_t,
+    u_int32_t);
+extern void fq_codel_destroy(struct fq_codel *);
+extern int fq_codel_addq(struct fq_codel *, class_queue_t *, struct mbuf *,
+    struct pf_mtag *);
+extern struct mbuf *fq_codel_getq(struct fq_codel *, class_queue_t *);
+extern struct mbuf *fq_codel_pollq(struct fq_codel *, class_queue_t *);
+extern void fq_codel_purgeq(struct fq_codel *, class_queue_t *, u_int32_t,
+    u_int32_t *, u_int32_t *);
+extern void fq_codel_getstats(struct fq_codel *, struct fq_codel_stats *);
+extern void fq_codel_updateq(struct fq_codel *, cqev_t);
+extern int fq_codel_suspendq(struct fq_codel *, class_queue_t *, boolean_t);
+#endif /* BSD_KERNEL_PRIVATE */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PRIVATE */
+#endif /* _NET_CLASSQ_CLASSQ_FQ_CODEL_H_ */
@@ -49,6 +49,7 @@
 #include <net/classq/classq_blue.h>
 #endif /* CLASSQ_BLUE */
 #include <net/classq/classq_sfb.h>
+#include <net/classq/classq_fq_codel.h>
 #include <net/pktsched/pktsched.h>
 
 #include <libkern/libkern.h>
@@ -58,8 +59,9 @@
 #endif /* PF_ALTQ */
 
 static errno_t ifclassq_dequeue_common(struct ifclassq *, mbuf_svc_class_t,
-    u_int32_t, struct mbuf **, struct mbuf **, u_int32_t *, u_int32_t *,
-    boolean_t);
+    u_int32_t, u_int32_t, struct mbuf **, struct mbuf **, u_int32_t *,
+    u_int32_t *, boolean_t);
+static inline void ifclassq_dequeue_stamp(struct ifclassq *, struct mbuf *);
 static struct mbuf *ifclassq_poll_common(struct ifclassq *,
     mbuf_svc_class_t, boolean_t);
 static struct mbuf *ifclassq_tbr_dequeue_common(struct ifclassq *, int,
@@ -82,6 +84,7 @@ classq_init(void)
 	blue_init();
 #endif /* CLASSQ_BLUE */
 	sfb_init();
+	fq_codel_init();
 }
 
 int
@@ -107,6 +110,8 @@ ifclassq_setup(struct ifnet *ifp, u_int32_t sflags, boolean_t reuse)
 	VERIFY(ifq->ifcq_enqueue == NULL);
 	VERIFY(ifq->ifcq_dequeue == NULL);
 	VERIFY(ifq->ifcq_dequeue_sc == NULL);
+	VERIFY(ifq->ifcq_dequeue_multi == NULL);
+	VERIFY(ifq->ifcq_dequeue_sc_multi == NULL);
 	VERIFY(ifq->ifcq_request == NULL);
 
 	if (ifp->if_eflags & IFEF_TXSTART) {
@@ -196,6 +201,8 @@ ifclassq_teardown(struct ifnet *ifp)
 	VERIFY(ifq->ifcq_enqueue == NULL);
 	VERIFY(ifq->ifcq_dequeue == NULL);
 	VERIFY(ifq->ifcq_dequeue_sc == NULL);
+	VERIFY(ifq->ifcq_dequeue_multi == NULL);
+	VERIFY(ifq->ifcq_dequeue_sc_multi == NULL);
 	VERIFY(ifq->ifcq_request == NULL);
 	IFCQ_LEN(ifq) = 0;
 	IFCQ_BYTES(ifq) = 0;
@@ -232,6 +239,58 @@ ifclassq_pktsched_setup(struct ifclassq *ifq)
 	return (err);
 }
 
+#define	IFCQ_QALG_FLAGS	(PKTSCHEDF_QALG_RED | PKTSCHEDF_QALG_RIO |	\
+	PKTSCHEDF_QALG_BLUE | PKTSCHEDF_QALG_SFB | PKTSCHEDF_QALG_FQ_CODEL)
+
+/*
+ * Switch the queueing algorithm used by the classes of the scheduler;
+ * the existing scheduler instance is torn down (and its queues flushed)
+ * before being set up again with the new algorithm.
+ */
+int
+ifclassq_set_qalg(struct ifclassq *ifq, u_int32_t qalg)
+{
+	u_int32_t osflags, rflags;
+	int err = 0;
+
+	if (qalg != PKTSCHEDF_QALG_SFB && qalg != PKTSCHEDF_QALG_FQ_CODEL)
+		return (EINVAL);
+
+	IFCQ_LOCK(ifq);
+	if (!IFCQ_IS_READY(ifq)) {
+		IFCQ_UNLOCK(ifq);
+		return (ENXIO);
+	}
+	osflags = ifq->ifcq_sflags;
+	if ((osflags & IFCQ_QALG_FLAGS) == qalg) {
+		IFCQ_UNLOCK(ifq);
+		return (0);
+	}
+
+	rflags = (ifq->ifcq_flags & IFCQF_ENABLED);
+	ifq->ifcq_sflags = (osflags & ~IFCQ_QALG_FLAGS) | qalg;
+	(void) pktsched_teardown(ifq);
+	err = ifclassq_pktsched_setup(ifq);
+	if (err != 0) {
+		/* put back the previous algorithm */
+		ifq->ifcq_sflags = osflags;
+		(void) pktsched_teardown(ifq);
+		if (ifclassq_pktsched_setup(ifq) != 0)
+			panic("%s: unable to restore scheduler on %s\n",
+			    __func__, if_name(ifq->ifcq_ifp));
+	}
+	ifq->ifcq_flags |= rflags;
+	IFCQ_UNLOCK(ifq);
+
+	return (err);
+}
+
+u_int32_t
+ifclassq_get_qalg(struct ifclassq *ifq)
+{
+	return (ifq->ifcq_sflags & IFCQ_QALG_FLAGS);
+}
+
 void
 ifclassq_set_maxlen(struct ifclassq *ifq, u_int32_t maxqlen)
 {
@@ -294,36 +353,61 @@ ifclassq_enqueue(struct ifclassq *ifq, struct mbuf *m)
 }
 
 errno_t
-ifclassq_dequeue(struct ifclassq *ifq, u_int32_t limit, struct mbuf **head,
-    struct mbuf **tail, u_int32_t *cnt, u_int32_t *len)
+ifclassq_dequeue(struct ifclassq *ifq, u_int32_t pkt_limit,
+    u_int32_t byte_limit, struct mbuf **head, struct mbuf **tail,
+    u_int32_t *cnt, u_int32_t *len)
 {
-	return (ifclassq_dequeue_common(ifq, MBUF_SC_UNSPEC, limit, head, tail,
-	    cnt, len, FALSE));
+	return (ifclassq_dequeue_common(ifq, MBUF_SC_UNSPEC, pkt_limit,
+	    byte_limit, head, tail, cnt, len, FALSE));
 }
 
 errno_t
 ifclassq_dequeue_sc(struct ifclassq *ifq, mbuf_svc_class_t sc,
-    u_int32_t limit, struct mbuf **head, struct mbuf **tail, u_int32_t *cnt,
-    u_int32_t *len)
+    u_int32_t pkt_limit, u_int32_t byte_limit, struct mbuf **head,
+    struct mbuf **tail, u_int32_t *cnt, u_int32_t *len)
 {
-	return (ifclassq_dequeue_common(ifq, sc, limit, head, tail,
-	    cnt, len, TRUE));
+	return (ifclassq_dequeue_common(ifq, sc, pkt_limit, byte_limit,
+	    head, tail, cnt, len, TRUE));
+}
+
+static inline void
+ifclassq_dequeue_stamp(struct ifclassq *ifq, struct mbuf *m)
+{
+	struct ifnet *ifp = ifq->ifcq_ifp;
+
+#if MEASURE_BW
+	m->m_pkthdr.pkt_bwseq =
+	    atomic_add_64_ov(&(ifp->if_bw.cur_seq), m_pktlen(m));
+#endif /* MEASURE_BW */
+	if (IFNET_IS_CELLULAR(ifp)) {
+		m->m_pkthdr.pkt_flags |= PKTF_VALID_UNSENT_DATA;
+		m->m_pkthdr.pkt_unsent_databytes =
+		    (total_snd_byte_count << MSIZESHIFT) +
+		    ifq->ifcq_bytes;
+	}
 }
 
 static errno_t
 ifclassq_dequeue_common(struct ifclassq *ifq, mbuf_svc_class_t sc,
-    u_int32_t limit, struct mbuf **head, struct mbuf **tail, u_int32_t *cnt,
-    u_int32_t *len, boolean_t drvmgt)
+    u_int32_t pkt_limit, u_int32_t byte_limit, struct mbuf **head,
+    struct mbuf **tail, u_int32_t *cnt, u_int32_t *len, boolean_t drvmgt)
 {
 	struct ifnet *ifp = ifq->ifcq_ifp;
 	u_int32_t i = 0, l = 0;
-	struct mbuf **first, *last;
+	struct mbuf **first, *last, *m;
+	boolean_t multi;
 #if PF_ALTQ
 	struct ifaltq *altq = IFCQ_ALTQ(ifq);
 	boolean_t draining;
 #endif /* PF_ALTQ */
 
 	VERIFY(!drvmgt || MBUF_VALID_SC(sc));
+	VERIFY(pkt_limit > 0 && byte_limit > 0);
+
+	if (pkt_limit > CLASSQ_DEQUEUE_MAX_PKT_LIMIT)
+		pkt_limit = CLASSQ_DEQUEUE_MAX_PKT_LIMIT;
+	if (byte_limit > CLASSQ_DEQUEUE_MAX_BYTE_LIMIT)
+		byte_limit = CLASSQ_DEQUEUE_MAX_BYTE_LIMIT;
 
 	*head = NULL;
 	first = &(*head);
@@ -332,7 +416,42 @@ ifclassq_dequeue_common(struct ifclassq *ifq, mbuf_svc_class_t sc,
 	ifq = &ifp->if_snd;
 	IFCQ_LOCK_SPIN(ifq);
 
-	while (i < limit) {
+	/*
+	 * If the scheduler can hand over a whole chain, get it in one
+	 * call; the token bucket regulator and ALTQ still need to be
+	 * asked one packet at a time.
+	 */
+	multi = (pkt_limit > 1 && !IFCQ_TBR_IS_ENABLED(ifq) &&
+	    (drvmgt ? ifq->ifcq_dequeue_sc_multi != NULL :
+	    ifq->ifcq_dequeue_multi != NULL));
+#if PF_ALTQ
+	multi = (multi && IFCQ_IS_DRAINING(ifq));
+#endif /* PF_ALTQ */
+	if (multi) {
+#if PF_ALTQ
+		u_int32_t qlen = IFCQ_LEN(ifq);
+#endif /* PF_ALTQ */
+		int err;
+
+		if (drvmgt) {
+			IFCQ_DEQUEUE_SC_MULTI(ifq, sc, pkt_limit, byte_limit,
+			    head, &last, &i, &l, err);
+		} else {
+			IFCQ_DEQUEUE_MULTI(ifq, pkt_limit, byte_limit,
+			    head, &last, &i, &l, err);
+		}
+		VERIFY((err == 0) == (i != 0));
+#if PF_ALTQ
+		VERIFY(ifq->ifcq_drain >= (qlen - IFCQ_LEN(ifq)));
+		ifq->ifcq_drain -= (qlen - IFCQ_LEN(ifq));
+#endif /* PF_ALTQ */
+		VERIFY(i <= pkt_limit);
+		for (m = *head; m != NULL; m = m->m_nextpkt)
+			ifclassq_dequeue_stamp(ifq, m);
+		goto done;
+	}
+
+	while (i < pkt_limit && l < byte_limit) {
 #if PF_ALTQ
 		u_int32_t qlen;
 
@@ -385,20 +504,12 @@ ifclassq_dequeue_common(struct ifclassq *ifq, mbuf_svc_class_t sc,
 
 		l += (*head)->m_pkthdr.len;
 
-#if MEASURE_BW
-		(*head)->m_pkthdr.pkt_bwseq =
-		    atomic_add_64_ov(&(ifp->if_bw.cur_seq), m_pktlen(*head));
-#endif /* MEASURE_BW */
-		if (IFNET_IS_CELLULAR(ifp)) {
-			(*head)->m_pkthdr.pkt_flags |= PKTF_VALID_UNSENT_DATA;
-			(*head)->m_pkthdr.pkt_unsent_databytes =
-			    (total_snd_byte_count << MSIZESHIFT) +
-			    ifq->ifcq_bytes;
-		}
+		ifclassq_dequeue_stamp(ifq, *head);
 		head = &(*head)->m_nextpkt;
 		i++;
 	}
 
+done:
 	IFCQ_UNLOCK(ifq);
 
 	if (tail != NULL)
@@ -487,13 +598,16 @@ ifclassq_update(struct ifclassq *ifq, cqev_t ev)
 int
 ifclassq_attach(struct ifclassq *ifq, u_int32_t type, void *discipline,
     ifclassq_enq_func enqueue, ifclassq_deq_func dequeue,
-    ifclassq_deq_sc_func dequeue_sc, ifclassq_req_func request)
+    ifclassq_deq_sc_func dequeue_sc, ifclassq_deq_multi_func dequeue_multi,
+    ifclassq_deq_sc_multi_func dequeue_sc_multi, ifclassq_req_func request)
 {
 	IFCQ_LOCK_ASSERT_HELD(ifq);
 
 	VERIFY(ifq->ifcq_disc == NULL);
 	VERIFY(enqueue != NULL);
 	VERIFY(!(dequeue != NULL && dequeue_sc != NULL));
+	VERIFY(dequeue_multi == NULL || dequeue != NULL);
+	VERIFY(dequeue_sc_multi == NULL || dequeue_sc != NULL);
 	VERIFY(request != NULL);
 
 	ifq->ifcq_type = type;
@@ -501,6 +615,8 @@ ifclassq_attach(struct ifclassq *ifq, u_int32_t type, void *discipline,
 	ifq->ifcq_enqueue = enqueue;
 	ifq->ifcq_dequeue = dequeue;
 	ifq->ifcq_dequeue_sc = dequeue_sc;
+	ifq->ifcq_dequeue_multi = dequeue_multi;
+	ifq->ifcq_dequeue_sc_multi = dequeue_sc_multi;
 	ifq->ifcq_request = request;
 
 	return (0);
@@ -518,6 +634,8 @@ ifclassq_detach(struct ifclassq *ifq)
 	ifq->ifcq_enqueue = NULL;
 	ifq->ifcq_dequeue = NULL;
 	ifq->ifcq_dequeue_sc = NULL;
+	ifq->ifcq_dequeue_multi = NULL;
+	ifq->ifcq_dequeue_sc_multi = NULL;
 	ifq->ifcq_request = NULL;
 
 	return (0);
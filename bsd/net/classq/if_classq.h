@@ -34,6 +34,11 @@
 
 #ifdef BSD_KERNEL_PRIVATE
 #include <net/classq/classq.h>
+
+/* upper bounds for a single dequeue call */
+#define	CLASSQ_DEQUEUE_MAX_PKT_LIMIT	2048
+#define	CLASSQ_DEQUEUE_MAX_BYTE_LIMIT	(1024 * 1024)
+
 /* classq dequeue op arg */
 typedef enum cqdq_op {
 	CLASSQDQ_REMOVE =	1,	/* dequeue mbuf from the queue */
@@ -111,6 +116,11 @@ typedef int (*ifclassq_enq_func)(struct ifclassq *, struct mbuf *);
 typedef struct mbuf *(*ifclassq_deq_func)(struct ifclassq *, enum cqdq_op);
 typedef struct mbuf *(*ifclassq_deq_sc_func)(struct ifclassq *,
     mbuf_svc_class_t, enum cqdq_op);
+typedef int (*ifclassq_deq_multi_func)(struct ifclassq *, u_int32_t,
+    u_int32_t, struct mbuf **, struct mbuf **, u_int32_t *, u_int32_t *);
+typedef int (*ifclassq_deq_sc_multi_func)(struct ifclassq *,
+    mbuf_svc_class_t, u_int32_t, u_int32_t, struct mbuf **, struct mbuf **,
+    u_int32_t *, u_int32_t *);
 typedef int (*ifclassq_req_func)(struct ifclassq *, enum cqrq, void *);
 
 /*
@@ -158,6 +168,8 @@ struct ifclassq {
 	ifclassq_enq_func	ifcq_enqueue;
 	ifclassq_deq_func	ifcq_dequeue;
 	ifclassq_deq_sc_func	ifcq_dequeue_sc;
+	ifclassq_deq_multi_func	ifcq_dequeue_multi;
+	ifclassq_deq_sc_multi_func ifcq_dequeue_sc_multi;
 	ifclassq_req_func	ifcq_request;
 
 	/* token bucket regulator */
@@ -273,6 +285,23 @@ struct if_ifclassq_stats {
 	(_m) = (*(_ifq)->ifcq_dequeue_sc)(_ifq, _sc, CLASSQDQ_REMOVE);	\
 } while (0)
 
+/*
+ * Dequeue a chain of packets, bounded by a packet and a byte limit, in
+ * one call into the scheduler; at least one packet is returned if any
+ * is available, even if it alone exceeds the byte limit.
+ */
+#define	IFCQ_DEQUEUE_MULTI(_ifq, _pkt_limit, _byte_limit, _head, _tail,	\
+    _cnt, _len, _err) do {						\
+	(_err) = (*(_ifq)->ifcq_dequeue_multi)(_ifq, _pkt_limit,	\
+	    _byte_limit, _head, _tail, _cnt, _len);			\
+} while (0)
+
+#define	IFCQ_DEQUEUE_SC_MULTI(_ifq, _sc, _pkt_limit, _byte_limit, _head, \
+    _tail, _cnt, _len, _err) do {					\
+	(_err) = (*(_ifq)->ifcq_dequeue_sc_multi)(_ifq, _sc, _pkt_limit, \
+	    _byte_limit, _head, _tail, _cnt, _len);			\
+} while (0)
+
 #define	IFCQ_TBR_DEQUEUE(_ifcq, _m) do {				\
 	(_m) = ifclassq_tbr_dequeue(_ifcq, CLASSQDQ_REMOVE);		\
 } while (0)
@@ -358,21 +387,24 @@ struct if_ifclassq_stats {
 extern int ifclassq_setup(struct ifnet *, u_int32_t, boolean_t);
 extern void ifclassq_teardown(struct ifnet *);
 extern int ifclassq_pktsched_setup(struct ifclassq *);
+extern int ifclassq_set_qalg(struct ifclassq *, u_int32_t);
+extern u_int32_t ifclassq_get_qalg(struct ifclassq *);
 extern void ifclassq_set_maxlen(struct ifclassq *, u_int32_t);
 extern u_int32_t ifclassq_get_maxlen(struct ifclassq *);
 extern int ifclassq_get_len(struct ifclassq *, mbuf_svc_class_t,
     u_int32_t *, u_int32_t *);
 extern errno_t ifclassq_enqueue(struct ifclassq *, struct mbuf *);
-extern errno_t ifclassq_dequeue(struct ifclassq *, u_int32_t, struct mbuf **,
-    struct mbuf **, u_int32_t *, u_int32_t *);
+extern errno_t ifclassq_dequeue(struct ifclassq *, u_int32_t, u_int32_t,
+    struct mbuf **, struct mbuf **, u_int32_t *, u_int32_t *);
 extern errno_t ifclassq_dequeue_sc(struct ifclassq *, mbuf_svc_class_t,
-    u_int32_t, struct mbuf **, struct mbuf **, u_int32_t *, u_int32_t *);
+    u_int32_t, u_int32_t, struct mbuf **, struct mbuf **, u_int32_t *,
+    u_int32_t *);
 extern struct mbuf *ifclassq_poll(struct ifclassq *);
 extern struct mbuf *ifclassq_poll_sc(struct ifclassq *, mbuf_svc_class_t);
 extern void ifclassq_update(struct ifclassq *, cqev_t);
 extern int ifclassq_attach(struct ifclassq *, u_int32_t, void *,
     ifclassq_enq_func, ifclassq_deq_func, ifclassq_deq_sc_func,
-    ifclassq_req_func);
+    ifclassq_deq_multi_func, ifclassq_deq_sc_multi_func, ifclassq_req_func);
 extern int ifclassq_detach(struct ifclassq *);
 extern int ifclassq_getqstats(struct ifclassq *, u_int32_t,
     void *, u_int32_t *);
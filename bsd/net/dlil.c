@@ -68,6 +68,7 @@
 #include <net/kpi_protocol.h>
 #include <net/if_types.h>
 #include <net/if_llreach.h>
+#include <net/if_nbr.h>
 #include <net/kpi_interfacefilter.h>
 #include <net/classq/classq.h>
 #include <net/classq/classq_sfb.h>
@@ -1505,6 +1506,7 @@ dlil_init(void)
 	zone_change(dlif_udpstat_zone, Z_CALLERACCT, FALSE);
 
 	ifnet_llreach_init();
+	nbr_init();
 
 	TAILQ_INIT(&dlil_ifnet_head);
 	TAILQ_INIT(&ifnet_head);
@@ -1567,6 +1569,9 @@ dlil_init(void)
 	/* Initialize the pktap virtual interface */
 	pktap_init();
 
+	/* Select the checksum block kernels for this CPU */
+	cpu_in_cksum_init();
+
 #if DEBUG
 	/* Run self-tests */
 	dlil_verify_sum16();
@@ -3138,7 +3143,8 @@ ifnet_dequeue(struct ifnet *ifp, struct mbuf **mp)
 		return (ENXIO);
 	if (!ifnet_is_attached(ifp, 1))
 		return (ENXIO);
-	rc = ifclassq_dequeue(&ifp->if_snd, 1, mp, NULL, NULL, NULL);
+	rc = ifclassq_dequeue(&ifp->if_snd, 1, CLASSQ_DEQUEUE_MAX_BYTE_LIMIT,
+	    mp, NULL, NULL, NULL);
 	ifnet_decr_iorefcnt(ifp);
 
 	return (rc);
@@ -3157,7 +3163,8 @@ ifnet_dequeue_service_class(struct ifnet *ifp, mbuf_svc_class_t sc,
 	if (!ifnet_is_attached(ifp, 1))
 		return (ENXIO);
 	
-	rc = ifclassq_dequeue_sc(&ifp->if_snd, sc, 1, mp, NULL, NULL, NULL);
+	rc = ifclassq_dequeue_sc(&ifp->if_snd, sc, 1,
+	    CLASSQ_DEQUEUE_MAX_BYTE_LIMIT, mp, NULL, NULL, NULL);
 	ifnet_decr_iorefcnt(ifp);
 	return (rc);
 }
@@ -3175,7 +3182,27 @@ ifnet_dequeue_multi(struct ifnet *ifp, u_int32_t limit, struct mbuf **head,
 	if (!ifnet_is_attached(ifp, 1))
 		return (ENXIO);
 	
-	rc = ifclassq_dequeue(&ifp->if_snd, limit, head, tail, cnt, len);
+	rc = ifclassq_dequeue(&ifp->if_snd, limit,
+	    CLASSQ_DEQUEUE_MAX_BYTE_LIMIT, head, tail, cnt, len);
+	ifnet_decr_iorefcnt(ifp);
+	return (rc);
+}
+
+errno_t
+ifnet_dequeue_multi_bytes(struct ifnet *ifp, u_int32_t byte_limit,
+    struct mbuf **head, struct mbuf **tail, u_int32_t *cnt, u_int32_t *len)
+{
+	errno_t rc;
+	if (ifp == NULL || head == NULL || byte_limit < 1)
+		return (EINVAL);
+	else if (!(ifp->if_eflags & IFEF_TXSTART) ||
+	    (ifp->if_output_sched_model != IFNET_SCHED_MODEL_NORMAL))
+		return (ENXIO);
+	if (!ifnet_is_attached(ifp, 1))
+		return (ENXIO);
+
+	rc = ifclassq_dequeue(&ifp->if_snd, CLASSQ_DEQUEUE_MAX_PKT_LIMIT,
+	    byte_limit, head, tail, cnt, len);
 	ifnet_decr_iorefcnt(ifp);
 	return (rc);
 }
@@ -3193,8 +3220,8 @@ ifnet_dequeue_service_class_multi(struct ifnet *ifp, mbuf_svc_class_t sc,
 		return (ENXIO);
 	if (!ifnet_is_attached(ifp, 1))
 		return (ENXIO);
-	rc = ifclassq_dequeue_sc(&ifp->if_snd, sc, limit, head,
-	    tail, cnt, len);
+	rc = ifclassq_dequeue_sc(&ifp->if_snd, sc, limit,
+	    CLASSQ_DEQUEUE_MAX_BYTE_LIMIT, head, tail, cnt, len);
 	ifnet_decr_iorefcnt(ifp);
 	return (rc);
 }
@@ -7971,6 +7998,8 @@ static struct {
 };
 #define	SUMTBL_MAX	((int)sizeof (sumtbl) / (int)sizeof (sumtbl[0]))
 
+static uint8_t copybuf[sizeof (sumdata) + sizeof (uint64_t)];
+
 static void
 dlil_verify_sum16(void)
 {
@@ -8024,6 +8053,18 @@ dlil_verify_sum16(void)
 				    len, i, sum, sumtbl[n].sum);
 				/* NOTREACHED */
 			}
+			/* Fused copy and sum16 test, to an unaligned target */
+			bzero(copybuf, sizeof (copybuf));
+			sum = m_copydata_sum16(m, i, len, copybuf + n % 3);
+
+			/* Something is horribly broken; stop now */
+			if (sum != sumtbl[n].sum ||
+			    bcmp(copybuf + n % 3, c, len) != 0) {
+				panic("%s: broken m_copydata_sum16 for len=%d "
+				    "offset=%d sum=0x%04x [expected=0x%04x]\n",
+				    __func__, len, i, sum, sumtbl[n].sum);
+				/* NOTREACHED */
+			}
 #if INET
 			/* Simple sum16 contiguous buffer test by aligment */
 			sum = b_sum16(c, len);
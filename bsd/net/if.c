@@ -1994,7 +1994,9 @@ ifioctl(struct socket *so, u_long cmd, caddr_t data, struct proc *p)
 	case SIOCGIFPROBECONNECTIVITY:		/* struct ifreq */
 	case SIOCGSTARTDELAY:			/* struct ifreq */
 	case SIOCGECNMODE:			/* struct ifreq */
-	case SIOCSECNMODE: {			/* struct ifreq */
+	case SIOCSECNMODE:			/* struct ifreq */
+	case SIOCGIFQALG:			/* struct ifreq */
+	case SIOCSIFQALG: {			/* struct ifreq */
 		struct ifreq ifr;
 		bcopy(data, &ifr, sizeof (ifr));
 		ifr.ifr_name[IFNAMSIZ - 1] = '\0';
@@ -2804,6 +2806,26 @@ ifioctl_ifreq(struct socket *so, u_long cmd, struct ifreq *ifr, struct proc *p)
 		} else
 			error = EINVAL;
 		break;
+	case SIOCGIFQALG:
+		if (ifclassq_get_qalg(&ifp->if_snd) == PKTSCHEDF_QALG_FQ_CODEL)
+			ifr->ifr_qalg = IFRTYPE_QALG_FQ_CODEL;
+		else
+			ifr->ifr_qalg = IFRTYPE_QALG_SFB;
+		break;
+	case SIOCSIFQALG:
+		if ((error = priv_check_cred(kauth_cred_get(),
+		    PRIV_NET_INTERFACE_CONTROL, 0)) != 0)
+			return (error);
+		if (ifr->ifr_qalg == IFRTYPE_QALG_DEFAULT ||
+		    ifr->ifr_qalg == IFRTYPE_QALG_SFB)
+			error = ifclassq_set_qalg(&ifp->if_snd,
+			    PKTSCHEDF_QALG_SFB);
+		else if (ifr->ifr_qalg == IFRTYPE_QALG_FQ_CODEL)
+			error = ifclassq_set_qalg(&ifp->if_snd,
+			    PKTSCHEDF_QALG_FQ_CODEL);
+		else
+			error = EINVAL;
+		break;
 	default:
 		VERIFY(0);
 		/* NOTREACHED */
@@ -4331,6 +4353,8 @@ ifioctl_cassert(void)
 	case SIOCGIFPROBECONNECTIVITY:
 	case SIOCGECNMODE:
 	case SIOCSECNMODE:
+	case SIOCGIFQALG:
+	case SIOCSIFQALG:
 		;
 	}
 }
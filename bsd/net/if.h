@@ -492,6 +492,10 @@ struct	ifreq {
 #define	IFRTYPE_ECN_DEFAULT		0
 #define	IFRTYPE_ECN_ENABLE			1
 #define	IFRTYPE_ECN_DISABLE			2
+		u_int32_t ifru_qalg;
+#define	IFRTYPE_QALG_DEFAULT		0
+#define	IFRTYPE_QALG_SFB		1
+#define	IFRTYPE_QALG_FQ_CODEL		2
 #endif /* PRIVATE */
 	} ifr_ifru;
 #define	ifr_addr	ifr_ifru.ifru_addr	/* address */
@@ -535,6 +539,7 @@ struct	ifreq {
 #define ifr_interface_state	ifr_ifru.ifru_interface_state
 #define	ifr_probe_connectivity	ifr_ifru.ifru_probe_connectivity
 #define	ifr_ecn_mode	ifr_ifru.ifru_ecn_mode
+#define	ifr_qalg	ifr_ifru.ifru_qalg
 #endif /* PRIVATE */
 };
 
@@ -130,6 +130,9 @@
 #include <libkern/libkern.h>
 
 #include <kern/zalloc.h>
+#include <kern/cpu_number.h>
+#include <machine/machine_routines.h>
+#include <libkern/OSAtomic.h>
 
 #if NBPFILTER > 0
 #include <net/bpf.h>
@@ -262,6 +265,27 @@
 
 #define	BRIDGE_RTHASH_MASK(sc)		((sc)->sc_rthash_size - 1)
 
+/*
+ * bridge_forward_fast() walks the route hash and the member list without
+ * the bridge lock.  The hash chains, the table itself and sc_iflist are
+ * changed with the lock held, between BRIDGE_RTSEQ_BEGIN and
+ * BRIDGE_RTSEQ_END; a reader that finds sc_rtseq odd, or changed since it
+ * started, can't trust its walk.  Route nodes, members and old tables are
+ * freed only once the lockless readers that could still see them are gone.
+ */
+#define	BRIDGE_RTSEQ_BEGIN(_sc)		do {				\
+	(_sc)->sc_rtseq++;						\
+	OSMemoryBarrier();						\
+} while (0)
+#define	BRIDGE_RTSEQ_END(_sc)		do {				\
+	OSMemoryBarrier();						\
+	(_sc)->sc_rtseq++;						\
+} while (0)
+
+#define	BRIDGE_READERS(_sc, _cpu)					\
+	((volatile SInt32 *)(void *)((_sc)->sc_rd_pcpu +		\
+	    (size_t)(_cpu) * CPU_CACHE_LINE_SIZE))
+
 /*
  * Maximum number of addresses to cache.
  */
@@ -333,7 +357,7 @@ struct bridge_rtnode {
 	uint8_t			brt_flags;	/* address flags */
 	uint8_t			brt_addr[ETHER_ADDR_LEN];
 	uint16_t		brt_vlan;	/* vlan id */
-
+	uint32_t		brt_limbo_gen;	/* reader gen when unhashed */
 };
 #define	brt_ifp			brt_dst->bif_ifp
 
@@ -374,6 +398,11 @@ struct bridge_softc {
 	struct _bridge_rtnode_list sc_rtlist;	/* list version of above */
 	uint32_t		sc_rthash_key;	/* key for hash */
 	uint32_t		sc_rthash_size;	/* size of the hash table */
+	volatile uint32_t	sc_rtseq;	/* odd while sc_rthash changes */
+	volatile uint32_t	sc_rd_gen;	/* lockless reader generation */
+	caddr_t			sc_rd_pcpu;	/* per-CPU reader counts */
+	void			*sc_rd_pcpu_buf;
+	struct _bridge_rtnode_list sc_rtlimbo;	/* unhashed, not yet freed */
 	TAILQ_HEAD(, bridge_iflist) sc_spanlist;	/* span ports list */
 	struct bstp_state	sc_stp;		/* STP state */
 	uint32_t		sc_brtexceeded;	/* # of cache drops */
@@ -443,6 +472,8 @@ static void	bridge_rtdelete(struct bridge_softc *, struct ifnet *ifp, int);
 
 static void	bridge_forward(struct bridge_softc *, struct bridge_iflist *,
 		    struct mbuf *);
+static boolean_t bridge_forward_fast(struct bridge_softc *,
+		    struct bridge_iflist *, struct mbuf *);
 
 static void	bridge_aging_timer(struct bridge_softc *sc);
 
@@ -468,12 +499,22 @@ static void	bridge_rthash_resize(struct bridge_softc *);
 static int	bridge_rtnode_addr_cmp(const uint8_t *, const uint8_t *);
 static struct bridge_rtnode *bridge_rtnode_lookup(struct bridge_softc *,
 		    const uint8_t *, uint16_t);
+static struct bridge_rtnode *bridge_rtnode_lookup_fast(struct bridge_softc *,
+		    const uint8_t *, uint16_t, uint32_t);
+static void	bridge_rtnode_publish(struct bridge_rtnode **,
+		    struct bridge_rtnode *);
 static int	bridge_rtnode_hash(struct bridge_softc *,
 		    struct bridge_rtnode *);
 static int	bridge_rtnode_insert(struct bridge_softc *,
 		    struct bridge_rtnode *);
 static void	bridge_rtnode_destroy(struct bridge_softc *,
 		    struct bridge_rtnode *);
+static void	bridge_rtreclaim(struct bridge_softc *);
+static uint32_t	bridge_rd_enter(struct bridge_softc *);
+static void	bridge_rd_exit(struct bridge_softc *, uint32_t);
+static uint32_t	bridge_rd_count(struct bridge_softc *, uint32_t);
+static void	bridge_rd_sync(struct bridge_softc *);
+static boolean_t bridge_rtseq_retry(struct bridge_softc *, uint32_t);
 #if BRIDGESTP
 static void	bridge_rtable_expire(struct ifnet *, int);
 static void	bridge_state_change(struct ifnet *, int);
@@ -594,6 +635,12 @@ SYSCTL_UINT(_net_link_bridge, OID_AUTO, rtable_hash_size_max,
 	&bridge_rtable_hash_size_max, 0,
 	"Maximum size of the routing hash table");
 
+static int bridge_fastfwd = 1;
+SYSCTL_INT(_net_link_bridge, OID_AUTO, fastfwd,
+	CTLFLAG_RW|CTLFLAG_LOCKED,
+	&bridge_fastfwd, 0,
+	"Forward unicast frames to known hosts without the bridge lock");
+
 #if BRIDGE_DEBUG_DELAYED_CALLBACK
 static int bridge_delayed_callback_delay = 0;
 SYSCTL_INT(_net_link_bridge, OID_AUTO, delayed_callback_delay,
@@ -1878,6 +1925,11 @@ bridge_iff_input(void *cookie, ifnet_t ifp, protocol_family_t protocol,
 		goto out;
 	}
 
+	if (bridge_forward_fast(sc, bif, m)) {
+		error = EJUSTRETURN;
+		goto out;
+	}
+
 	error = bridge_input(ifp, m, *frame_ptr);
 
 	/* Adjust packet back to original */
@@ -2092,7 +2144,9 @@ bridge_delete_member(struct bridge_softc *sc, struct bridge_iflist *bif,
 	 * when we release the bridge lock below
 	 */
 	BRIDGE_XLOCK(sc);
+	BRIDGE_RTSEQ_BEGIN(sc);
 	TAILQ_REMOVE(&sc->sc_iflist, bif, bif_next);
+	BRIDGE_RTSEQ_END(sc);
 	BRIDGE_XDROP(sc);
 
 	if (!gone) {
@@ -2171,6 +2225,9 @@ bridge_delete_member(struct bridge_softc *sc, struct bridge_iflist *bif,
 	KASSERT(bif->bif_addrcnt == 0,
 	    ("%s: %d bridge routes referenced", __func__, bif->bif_addrcnt));
 
+	/* nothing can find it now; wait for whoever still might have */
+	bridge_rd_sync(sc);
+
 	filt_attached = bif->bif_flags & BIFF_FILTER_ATTACHED;
 
 	/*
@@ -2304,7 +2361,9 @@ bridge_ioctl_add(struct bridge_softc *sc, void *arg)
 	/*
 	 * XXX: XLOCK HERE!?!
 	 */
+	BRIDGE_RTSEQ_BEGIN(sc);		/* publish bif to bridge_forward_fast() */
 	TAILQ_INSERT_TAIL(&sc->sc_iflist, bif, bif_next);
+	BRIDGE_RTSEQ_END(sc);
 
 #if HAS_IF_CAP
 	/* Set interface capabilities to the intersection set of all members */
@@ -3598,19 +3657,19 @@ bridge_enqueue(struct bridge_softc *sc, struct ifnet *dst_ifp, struct mbuf *m)
 {
 	int len, error = 0;
 	short mflags;
-	struct mbuf *m0;
+	struct mbuf *m0, *head = NULL, **tailp = &head;
+	struct flowadv adv = { FADV_SUCCESS };
+	u_int32_t npkts = 0, nbytes = 0;
 
 	VERIFY(dst_ifp != NULL);
 
 	/*
-	 * We may be sending a fragment so traverse the mbuf
+	 * We may be sending a fragment so traverse the mbuf; the packets
+	 * are then handed to the interface in a single call.
 	 *
 	 * NOTE: bridge_fragment() is called only when PFIL_HOOKS is enabled.
 	 */
 	for (; m; m = m0) {
-		errno_t _error;
-		struct flowadv adv = { FADV_SUCCESS };
-
 		m0 = m->m_nextpkt;
 		m->m_nextpkt = NULL;
 
@@ -3639,23 +3698,23 @@ bridge_enqueue(struct bridge_softc *sc, struct ifnet *dst_ifp, struct mbuf *m)
 		}
 #endif /* HAS_IF_CAP */
 
-		_error = dlil_output(dst_ifp, 0, m, NULL, NULL, 1, &adv);
-
-		/* Preserve existing error value */
-		if (error == 0) {
-			if (_error != 0)
-				error = _error;
-			else if (adv.code == FADV_FLOW_CONTROLLED)
-				error = EQFULL;
-			else if (adv.code == FADV_SUSPENDED)
-				error = EQSUSPENDED;
-		}
+		*tailp = m;
+		tailp = &m->m_nextpkt;
+		npkts++;
+		nbytes += len;
+	}
+	if (head == NULL)
+		return (0);
 
-		if (_error == 0) {
-			(void) ifnet_stat_increment_out(sc->sc_ifp, 1, len, 0);
-		} else {
-			(void) ifnet_stat_increment_out(sc->sc_ifp, 0, 0, 1);
-		}
+	error = dlil_output(dst_ifp, 0, head, NULL, NULL, 1, &adv);
+	if (error == 0) {
+		if (adv.code == FADV_FLOW_CONTROLLED)
+			error = EQFULL;
+		else if (adv.code == FADV_SUSPENDED)
+			error = EQSUSPENDED;
+		(void) ifnet_stat_increment_out(sc->sc_ifp, npkts, nbytes, 0);
+	} else {
+		(void) ifnet_stat_increment_out(sc->sc_ifp, 0, 0, npkts);
 	}
 
 	return (error);
@@ -4130,6 +4189,134 @@ drop:
 	m_freem(m);
 }
 
+/*
+ * bridge_forward_fast:
+ *
+ *	Forward a unicast frame to a known destination without the
+ *	bridge lock, doing what bridge_input() and bridge_forward() would
+ *	do with it.  Returns FALSE, having done nothing, when the frame
+ *	needs anything more: a destination or a source that isn't learned
+ *	yet, spanning tree, filters, taps, or a frame for the bridge or one
+ *	of its members.  Learning only refreshes the age of the source's
+ *	node, at most once a second.
+ *
+ *	The source member is the interface filter's cookie, and is stable
+ *	for the duration of the call.  The destination is found through
+ *	the route hash, and the other members through sc_iflist; both stay
+ *	allocated for as long as we are in the reader section, and nothing
+ *	seen in either is acted on unless sc_rtseq shows that neither
+ *	changed meanwhile.
+ */
+static boolean_t
+bridge_forward_fast(struct bridge_softc *sc, struct bridge_iflist *sbif,
+	struct mbuf *m)
+{
+	struct ifnet *ifp = sc->sc_ifp, *src_if, *dst_if;
+	struct bridge_iflist *bif, *dbif;
+	struct bridge_rtnode *brt;
+	struct ether_header *eh;
+	unsigned long expire;
+	uint32_t g, seq;
+	uint16_t vlan;
+	int len;
+
+	if (!bridge_fastfwd || (m->m_flags & (M_BCAST|M_MCAST)) != 0 ||
+	    (ifp->if_flags & IFF_RUNNING) == 0)
+		return (FALSE);
+#ifdef IFF_MONITOR
+	if ((ifp->if_flags & IFF_MONITOR) != 0)
+		return (FALSE);
+#endif /* IFF_MONITOR */
+#if defined(PFIL_HOOKS)
+	if (PFIL_HOOKED(&inet_pfil_hook) || PFIL_HOOKED_INET6)
+		return (FALSE);
+#endif /* PFIL_HOOKS */
+	if ((sbif->bif_flags & BIFF_HOST_FILTER) ||
+	    (sbif->bif_ifflags & (IFBIF_STP|IFBIF_SPAN)) ||
+	    !TAILQ_EMPTY(&sc->sc_spanlist) || sc->sc_bpf_input != NULL)
+		return (FALSE);
+#ifdef DEV_CARP
+	/* CARP addresses are for bridge_input() to sort out */
+	return (FALSE);
+#endif /* DEV_CARP */
+
+	src_if = sbif->bif_ifp;
+	eh = mtod(m, struct ether_header *);
+	vlan = VLANTAGOF(m);
+
+	/* for the bridge or one of its members, or sent by one of them */
+	if (memcmp(eh->ether_dhost, IF_LLADDR(ifp), ETHER_ADDR_LEN) == 0 ||
+	    memcmp(eh->ether_dhost, IF_LLADDR(src_if), ETHER_ADDR_LEN) == 0)
+		return (FALSE);
+
+	g = bridge_rd_enter(sc);
+	seq = sc->sc_rtseq;
+	OSMemoryBarrier();
+	if (seq & 1)
+		goto slow;
+
+	/* a member being added or removed sends us to the slow path below */
+	TAILQ_FOREACH(bif, &sc->sc_iflist, bif_next) {
+		if (bif->bif_ifp->if_type == IFT_GIF)
+			continue;
+		if (memcmp(IF_LLADDR(bif->bif_ifp), eh->ether_dhost,
+		    ETHER_ADDR_LEN) == 0 ||
+		    memcmp(IF_LLADDR(bif->bif_ifp), eh->ether_shost,
+		    ETHER_ADDR_LEN) == 0)
+			goto slow;
+	}
+
+	/* a new or moved source is learned with the lock held */
+	if (sbif->bif_ifflags & IFBIF_LEARNING) {
+		brt = bridge_rtnode_lookup_fast(sc, eh->ether_shost,
+		    vlan == 0 ? 1 : vlan, seq);
+		if (brt == NULL || ((brt->brt_flags & IFBAF_TYPEMASK) ==
+		    IFBAF_DYNAMIC && brt->brt_dst != sbif))
+			goto slow;
+		expire = (unsigned long) net_uptime() + sc->sc_brttimeout;
+		if (brt->brt_expire != expire)
+			brt->brt_expire = expire;
+	}
+
+	brt = bridge_rtnode_lookup_fast(sc, eh->ether_dhost, vlan, seq);
+	if (brt == NULL || (dbif = brt->brt_dst) == NULL)
+		goto slow;
+	dst_if = dbif->bif_ifp;
+	if (dst_if == src_if) {
+		/* destined for someone on "this" side of the bridge */
+		if (bridge_rtseq_retry(sc, seq))
+			goto slow;
+		bridge_rd_exit(sc, g);
+		(void) ifnet_stat_increment_in(ifp, 1, m->m_pkthdr.len, 0);
+		m_freem(m);
+		return (TRUE);
+	}
+	if ((dst_if->if_flags & IFF_RUNNING) == 0 ||
+	    (sbif->bif_ifflags & dbif->bif_ifflags & IFBIF_PRIVATE) ||
+	    (dbif->bif_ifflags & IFBIF_STP))
+		goto slow;
+#if HAS_DHCPRA_MASK
+	if ((dst_if->if_extflags & IFEXTF_DHCPRA_MASK) != 0)
+		goto slow;
+#endif /* HAS_DHCPRA_MASK */
+
+	/* everything above was seen in a consistent table */
+	if (bridge_rtseq_retry(sc, seq))
+		goto slow;
+	bridge_rd_exit(sc, g);
+
+	len = m->m_pkthdr.len;
+	if ((mbuf_flags(m) & MBUF_PROMISC))
+		mbuf_setflags_mask(m, 0, MBUF_PROMISC);
+	(void) ifnet_stat_increment_in(ifp, 1, len, 0);
+	(void) bridge_enqueue(sc, dst_if, m);
+	return (TRUE);
+
+slow:
+	bridge_rd_exit(sc, g);
+	return (FALSE);
+}
+
 #if BRIDGE_DEBUG
 
 char *ether_ntop(char *, size_t, const u_char *);
@@ -4675,6 +4862,7 @@ bridge_rtupdate(struct bridge_softc *sc, const uint8_t *dst, uint16_t vlan,
 		 * initialize the expiration time and Ethernet
 		 * address.
 		 */
+		bridge_rtreclaim(sc);
 		brt = zalloc_noblock(bridge_rtnode_pool);
 		if (brt == NULL)
 			return (ENOMEM);
@@ -4687,13 +4875,13 @@ bridge_rtupdate(struct bridge_softc *sc, const uint8_t *dst, uint16_t vlan,
 
 		memcpy(brt->brt_addr, dst, ETHER_ADDR_LEN);
 		brt->brt_vlan = vlan;
-
+		/* lockless readers may find it as soon as it is hashed */
+		brt->brt_dst = bif;
 
 		if ((error = bridge_rtnode_insert(sc, brt)) != 0) {
 			zfree(bridge_rtnode_pool, brt);
 			return (error);
 		}
-		brt->brt_dst = bif;
 		bif->bif_addrcnt++;
 #if BRIDGE_DEBUG
 		if (if_bridge_debug & BR_DBGF_RT_TABLE)
@@ -4713,10 +4901,12 @@ bridge_rtupdate(struct bridge_softc *sc, const uint8_t *dst, uint16_t vlan,
 	}
 
 	if ((flags & IFBAF_TYPEMASK) == IFBAF_DYNAMIC) {
-		unsigned long now;
+		unsigned long expire;
 
-		now = (unsigned long) net_uptime();
-		brt->brt_expire = now + sc->sc_brttimeout;
+		/* at most one store a second, the node is shared */
+		expire = (unsigned long) net_uptime() + sc->sc_brttimeout;
+		if (brt->brt_expire != expire)
+			brt->brt_expire = expire;
 	}
 	if (setflags)
 		brt->brt_flags = flags;
@@ -4786,6 +4976,7 @@ bridge_aging_timer(struct bridge_softc *sc)
 	BRIDGE_LOCK_ASSERT_HELD(sc);
 
 	bridge_rtage(sc);
+	bridge_rtreclaim(sc);
 
 	if ((sc->sc_ifp->if_flags & IFF_RUNNING) &&
 	    (sc->sc_flags & SCF_DETACHING) == 0) {
@@ -4905,6 +5096,18 @@ bridge_rtable_init(struct bridge_softc *sc)
 	sc->sc_rthash_key = RandomULong();
 
 	LIST_INIT(&sc->sc_rtlist);
+	LIST_INIT(&sc->sc_rtlimbo);
+
+	sc->sc_rd_pcpu_buf = _MALLOC((ml_get_max_cpus() + 1) *
+	    CPU_CACHE_LINE_SIZE, M_DEVBUF, M_WAITOK | M_ZERO);
+	if (sc->sc_rd_pcpu_buf == NULL) {
+		printf("%s: no memory\n", __func__);
+		_FREE(sc->sc_rthash, M_DEVBUF);
+		sc->sc_rthash = NULL;
+		return (ENOMEM);
+	}
+	sc->sc_rd_pcpu = (caddr_t)P2ROUNDUP((intptr_t)sc->sc_rd_pcpu_buf,
+	    CPU_CACHE_LINE_SIZE);
 
 	return (0);
 }
@@ -4958,6 +5161,7 @@ bridge_rthash_delayed_resize(struct bridge_softc *sc)
 	/*
 	 * Fail safe from here on
 	 */
+	BRIDGE_RTSEQ_BEGIN(sc);
 	old_rthash = sc->sc_rthash;
 	sc->sc_rthash = new_rthash;
 	sc->sc_rthash_size = new_rthash_size;
@@ -4975,6 +5179,10 @@ bridge_rthash_delayed_resize(struct bridge_softc *sc)
 		LIST_REMOVE(brt, brt_hash);
 		(void) bridge_rtnode_hash(sc, brt);
 	}
+	BRIDGE_RTSEQ_END(sc);
+
+	/* lockless readers may still be walking the old table */
+	bridge_rd_sync(sc);
 out:
 	if (error == 0) {
 #if BRIDGE_DEBUG
@@ -5031,12 +5239,24 @@ bridge_rthash_resize(struct bridge_softc *sc)
 static void
 bridge_rtable_fini(struct bridge_softc *sc)
 {
+	struct bridge_rtnode *brt;
+
 	KASSERT(sc->sc_brtcnt == 0,
 	    ("%s: %d bridge routes referenced", __func__, sc->sc_brtcnt));
+	/* no members are left, hence no lockless readers */
+	while ((brt = LIST_FIRST(&sc->sc_rtlimbo)) != NULL) {
+		LIST_REMOVE(brt, brt_list);
+		zfree(bridge_rtnode_pool, brt);
+	}
 	if (sc->sc_rthash) {
 		_FREE(sc->sc_rthash, M_DEVBUF);
 		sc->sc_rthash = NULL;
 	}
+	if (sc->sc_rd_pcpu_buf != NULL) {
+		_FREE(sc->sc_rd_pcpu_buf, M_DEVBUF);
+		sc->sc_rd_pcpu_buf = NULL;
+		sc->sc_rd_pcpu = NULL;
+	}
 }
 
 /*
@@ -5115,6 +5335,41 @@ bridge_rtnode_lookup(struct bridge_softc *sc, const uint8_t *addr,
 	return (NULL);
 }
 
+/*
+ * bridge_rtnode_lookup_fast:
+ *
+ *	Same as bridge_rtnode_lookup(), without the bridge lock, from
+ *	within a bridge_rd_enter() section; seq is sc_rtseq as sampled
+ *	by the caller.  The node returned stays allocated until the
+ *	section ends, but the caller must check bridge_rtseq_retry()
+ *	before relying on it being (or not being) in the table.
+ */
+static struct bridge_rtnode *
+bridge_rtnode_lookup_fast(struct bridge_softc *sc, const uint8_t *addr,
+	uint16_t vlan, uint32_t seq)
+{
+	struct _bridge_rtnode_list *rthash;
+	struct bridge_rtnode *brt;
+	uint32_t hash;
+	int dir;
+
+	/* make sure the table, its size and its key go together */
+	rthash = sc->sc_rthash;
+	hash = bridge_rthash(sc, addr);
+	if (bridge_rtseq_retry(sc, seq))
+		return (NULL);
+
+	LIST_FOREACH(brt, &rthash[hash], brt_hash) {
+		dir = bridge_rtnode_addr_cmp(addr, brt->brt_addr);
+		if (dir == 0 && (brt->brt_vlan == vlan || vlan == 0))
+			return (brt);
+		if (dir > 0)
+			return (NULL);
+	}
+
+	return (NULL);
+}
+
 /*
  * bridge_rtnode_hash:
  *
@@ -5135,7 +5390,7 @@ bridge_rtnode_hash(struct bridge_softc *sc, struct bridge_rtnode *brt)
 
 	lbrt = LIST_FIRST(&sc->sc_rthash[hash]);
 	if (lbrt == NULL) {
-		LIST_INSERT_HEAD(&sc->sc_rthash[hash], brt, brt_hash);
+		bridge_rtnode_publish(&LIST_FIRST(&sc->sc_rthash[hash]), brt);
 		goto out;
 	}
 
@@ -5154,11 +5409,11 @@ bridge_rtnode_hash(struct bridge_softc *sc, struct bridge_rtnode *brt)
 			return (EEXIST);
 		}
 		if (dir > 0) {
-			LIST_INSERT_BEFORE(lbrt, brt, brt_hash);
+			bridge_rtnode_publish(lbrt->brt_hash.le_prev, brt);
 			goto out;
 		}
 		if (LIST_NEXT(lbrt, brt_hash) == NULL) {
-			LIST_INSERT_AFTER(lbrt, brt, brt_hash);
+			bridge_rtnode_publish(&LIST_NEXT(lbrt, brt_hash), brt);
 			goto out;
 		}
 		lbrt = LIST_NEXT(lbrt, brt_hash);
@@ -5176,6 +5431,26 @@ out:
 	return (0);
 }
 
+/*
+ * bridge_rtnode_publish:
+ *
+ *	Link a bridge node into a hash chain ahead of *prevp, only once
+ *	its linkage is set up, as lockless readers may be walking the
+ *	chain.
+ */
+static void
+bridge_rtnode_publish(struct bridge_rtnode **prevp, struct bridge_rtnode *brt)
+{
+	struct bridge_rtnode *next = *prevp;
+
+	brt->brt_hash.le_next = next;
+	brt->brt_hash.le_prev = prevp;
+	if (next != NULL)
+		next->brt_hash.le_prev = &brt->brt_hash.le_next;
+	OSMemoryBarrier();
+	*prevp = brt;
+}
+
 /*
  * bridge_rtnode_insert:
  *
@@ -5187,7 +5462,9 @@ bridge_rtnode_insert(struct bridge_softc *sc, struct bridge_rtnode *brt)
 {
 	int error;
 
+	BRIDGE_RTSEQ_BEGIN(sc);
 	error = bridge_rtnode_hash(sc, brt);
+	BRIDGE_RTSEQ_END(sc);
 	if (error != 0)
 		return (error);
 
@@ -5202,19 +5479,144 @@ bridge_rtnode_insert(struct bridge_softc *sc, struct bridge_rtnode *brt)
 /*
  * bridge_rtnode_destroy:
  *
- *	Destroy a bridge rtnode.
+ *	Destroy a bridge rtnode.  It is unhashed right away, but only
+ *	freed by bridge_rtreclaim() once no lockless reader can see it.
  */
 static void
 bridge_rtnode_destroy(struct bridge_softc *sc, struct bridge_rtnode *brt)
 {
 	BRIDGE_LOCK_ASSERT_HELD(sc);
 
+	BRIDGE_RTSEQ_BEGIN(sc);
 	LIST_REMOVE(brt, brt_hash);
+	BRIDGE_RTSEQ_END(sc);
 
 	LIST_REMOVE(brt, brt_list);
 	sc->sc_brtcnt--;
 	brt->brt_dst->bif_addrcnt--;
-	zfree(bridge_rtnode_pool, brt);
+
+	brt->brt_limbo_gen = sc->sc_rd_gen;
+	LIST_INSERT_HEAD(&sc->sc_rtlimbo, brt, brt_list);
+}
+
+/*
+ * bridge_rtreclaim:
+ *
+ *	Free the rtnodes unhashed by bridge_rtnode_destroy().  Each is
+ *	stamped with the reader generation current when it was unhashed;
+ *	once the generation has moved past the stamp and the readers of the
+ *	previous generation are gone, nobody can be looking at it.
+ */
+static void
+bridge_rtreclaim(struct bridge_softc *sc)
+{
+	struct bridge_rtnode *brt, *nbrt;
+	uint32_t g;
+
+	BRIDGE_LOCK_ASSERT_HELD(sc);
+
+	if (LIST_EMPTY(&sc->sc_rtlimbo))
+		return;
+
+	g = sc->sc_rd_gen;
+	if (bridge_rd_count(sc, g - 1) != 0)
+		return;
+
+	LIST_FOREACH_SAFE(brt, &sc->sc_rtlimbo, brt_list, nbrt) {
+		if (brt->brt_limbo_gen == g)
+			continue;
+		LIST_REMOVE(brt, brt_list);
+		zfree(bridge_rtnode_pool, brt);
+	}
+
+	/* move on; what's left goes once this generation's readers drain */
+	if (!LIST_EMPTY(&sc->sc_rtlimbo)) {
+		OSMemoryBarrier();
+		sc->sc_rd_gen = g + 1;
+		OSMemoryBarrier();
+	}
+}
+
+/*
+ * bridge_rd_enter:
+ *
+ *	Enter a lockless lookup section; returns the reader generation to
+ *	hand back to bridge_rd_exit().  The generation is re-read after
+ *	announcing ourselves, so that a writer moving it on either sees
+ *	this reader or is seen by it.
+ */
+static uint32_t
+bridge_rd_enter(struct bridge_softc *sc)
+{
+	volatile SInt32 *readers;
+	uint32_t g;
+
+again:
+	g = sc->sc_rd_gen;
+	readers = BRIDGE_READERS(sc, cpu_number());
+	OSIncrementAtomic(&readers[g & 1]);
+	OSMemoryBarrier();
+	if (sc->sc_rd_gen != g) {
+		OSDecrementAtomic(&readers[g & 1]);
+		goto again;
+	}
+	return (g);
+}
+
+static void
+bridge_rd_exit(struct bridge_softc *sc, uint32_t g)
+{
+	OSMemoryBarrier();
+	OSDecrementAtomic(&BRIDGE_READERS(sc, cpu_number())[g & 1]);
+}
+
+static uint32_t
+bridge_rd_count(struct bridge_softc *sc, uint32_t g)
+{
+	uint32_t cpu, ncpu, n = 0;
+
+	ncpu = ml_get_max_cpus();
+	for (cpu = 0; cpu < ncpu; cpu++)
+		n += BRIDGE_READERS(sc, cpu)[g & 1];
+
+	return (n);
+}
+
+/*
+ * bridge_rd_sync:
+ *
+ *	Wait until every lockless reader that started before the call is
+ *	gone.  Readers never block, so this spins rather than sleeps; it is
+ *	only used when a member or a whole table goes away.
+ */
+static void
+bridge_rd_sync(struct bridge_softc *sc)
+{
+	uint32_t g;
+
+	BRIDGE_LOCK_ASSERT_HELD(sc);
+
+	g = sc->sc_rd_gen;
+	while (bridge_rd_count(sc, g - 1) != 0)
+		delay(1);
+	OSMemoryBarrier();
+	sc->sc_rd_gen = g + 1;
+	OSMemoryBarrier();
+	while (bridge_rd_count(sc, g) != 0)
+		delay(1);
+}
+
+/*
+ * bridge_rtseq_retry:
+ *
+ *	Returns TRUE if the route hash was being changed when a lockless
+ *	walk sampled sc_rtseq, or has been changed since.
+ */
+static boolean_t
+bridge_rtseq_retry(struct bridge_softc *sc, uint32_t seq)
+{
+	OSMemoryBarrier();
+	return ((seq & 1) != 0 || sc->sc_rtseq != seq);
 }
 
 #if BRIDGESTP
@@ -66,6 +66,10 @@ static errno_t	ipsec_ctl_setopt(kern_ctl_ref kctlref, u_int32_t unit, void *unit
 /* Network Interface functions */
 static void     ipsec_start(ifnet_t	interface);
 static errno_t	ipsec_output(ifnet_t interface, mbuf_t data);
+static errno_t	ipsec_output_v4(ifnet_t interface, mbuf_t data,
+				u_int outgoing_if);
+static void		ipsec_output_v4_done(mbuf_t data, struct secasvar *sav,
+				void *arg);
 static errno_t	ipsec_demux(ifnet_t interface, mbuf_t data, char *frame_header,
 							protocol_family_t *protocol);
 static errno_t	ipsec_add_proto(ifnet_t interface, protocol_family_t protocol,
@@ -618,12 +622,10 @@ ipsec_output(ifnet_t	interface,
 {
 	struct ipsec_pcb	*pcb = ifnet_softc(interface);
     struct ipsec_output_state ipsec_state;
-    struct route ro;
     struct route_in6 ro6;
     int	length;
     struct ip *ip;
     struct ip6_hdr *ip6;
-    struct ip_out_args ipoa;
     struct ip6_out_args ip6oa;
     int error = 0;
     u_int ip_version = 0;
@@ -649,13 +651,29 @@ ipsec_output(ifnet_t	interface,
             af = AF_INET;
             bpf_tap_out(pcb->ipsec_ifp, DLT_NULL, data, &af, sizeof(af));
 			
+            /*
+             * Set traffic class and protocol now; they are carried
+             * through encryption, which may finish after the pcb is gone.
+             */
+            m_set_service_class(data, pcb->ipsec_output_service_class);
+            data->m_pkthdr.pkt_proto = ip->ip_p;
+            
             /* Apply encryption */
             bzero(&ipsec_state, sizeof(ipsec_state));
             ipsec_state.m = data;
             ipsec_state.dst = (struct sockaddr *)&ip->ip_dst;
             bzero(&ipsec_state.ro, sizeof(ipsec_state.ro));
+            ipsec_state.done = ipsec_output_v4_done;
+            ipsec_state.done_arg = interface;
 			
+            ifnet_reference(interface);
             error = ipsec4_interface_output(&ipsec_state, interface);
+            if (error == EJUSTRETURN) {
+                /* ESP crypto workers took it, and the reference */
+                error = 0;
+                goto done;
+            }
+            ifnet_release(interface);
             /* Tunneled in IPv6 - packet is gone */
             if (error == 0 && ipsec_state.tunneled == 6) {
                 goto done;
@@ -667,46 +685,8 @@ ipsec_output(ifnet_t	interface,
                 goto ipsec_output_err;
             }
             
-            /* Set traffic class, set flow */
-            m_set_service_class(data, pcb->ipsec_output_service_class);
-            data->m_pkthdr.pkt_flowsrc = FLOWSRC_IFNET;
-            data->m_pkthdr.pkt_flowid = interface->if_flowhash;
-            data->m_pkthdr.pkt_proto = ip->ip_p;
-            data->m_pkthdr.pkt_flags = (PKTF_FLOW_ID | PKTF_FLOW_ADV | PKTF_FLOW_LOCALSRC);
-            
-            /* Flip endian-ness for ip_output */
-            ip = mtod(data, struct ip *);
-            NTOHS(ip->ip_len);
-            NTOHS(ip->ip_off);
-            
-            /* Increment statistics */
-            length = mbuf_pkthdr_len(data);
-            ifnet_stat_increment_out(interface, 1, length, 0);
-			
-            /* Send to ip_output */
-            bzero(&ro, sizeof(ro));
-			
-            flags = IP_OUTARGS |	/* Passing out args to specify interface */
-			IP_NOIPSEC;				/* To ensure the packet doesn't go through ipsec twice */
-			
-            bzero(&ipoa, sizeof(ipoa));
-            ipoa.ipoa_flowadv.code = 0;
-            ipoa.ipoa_flags = IPOAF_SELECT_SRCIF | IPOAF_BOUND_SRCADDR;
-            if (ipsec_state.outgoing_if) {
-                ipoa.ipoa_boundif = ipsec_state.outgoing_if;
-                ipoa.ipoa_flags |= IPOAF_BOUND_IF;
-            }
-            
-            adv = &ipoa.ipoa_flowadv;
-            
-            (void) ip_output(data, NULL, &ro, flags, NULL, &ipoa);
+            error = ipsec_output_v4(interface, data, ipsec_state.outgoing_if);
             data = NULL;
-            
-            if (adv->code == FADV_FLOW_CONTROLLED || adv->code == FADV_SUSPENDED) {
-                error = ENOBUFS;
-                ifnet_disable_output(interface);
-            }
-            
             goto done;
         case 6:
             af = AF_INET6;
@@ -784,6 +764,70 @@ ipsec_output_err:
 	goto done;
 }
 
+/*
+ * Send an encrypted IPv4 packet on its way.  Returns ENOBUFS when the
+ * underlying interface asks for the flow to be held off.
+ */
+static errno_t
+ipsec_output_v4(ifnet_t interface, mbuf_t data, u_int outgoing_if)
+{
+	struct ip_out_args ipoa;
+	struct route ro;
+	struct ip *ip;
+	int flags;
+	errno_t error = 0;
+
+	/* Set flow */
+	data->m_pkthdr.pkt_flowsrc = FLOWSRC_IFNET;
+	data->m_pkthdr.pkt_flowid = interface->if_flowhash;
+	data->m_pkthdr.pkt_flags = (PKTF_FLOW_ID | PKTF_FLOW_ADV | PKTF_FLOW_LOCALSRC);
+
+	/* Flip endian-ness for ip_output */
+	ip = mtod(data, struct ip *);
+	NTOHS(ip->ip_len);
+	NTOHS(ip->ip_off);
+
+	/* Increment statistics */
+	ifnet_stat_increment_out(interface, 1, mbuf_pkthdr_len(data), 0);
+
+	/* Send to ip_output */
+	bzero(&ro, sizeof(ro));
+
+	flags = IP_OUTARGS |	/* Passing out args to specify interface */
+		IP_NOIPSEC;	/* To ensure the packet doesn't go through ipsec twice */
+
+	bzero(&ipoa, sizeof(ipoa));
+	ipoa.ipoa_flowadv.code = 0;
+	ipoa.ipoa_flags = IPOAF_SELECT_SRCIF | IPOAF_BOUND_SRCADDR;
+	if (outgoing_if) {
+		ipoa.ipoa_boundif = outgoing_if;
+		ipoa.ipoa_flags |= IPOAF_BOUND_IF;
+	}
+
+	(void) ip_output(data, NULL, &ro, flags, NULL, &ipoa);
+
+	if (ipoa.ipoa_flowadv.code == FADV_FLOW_CONTROLLED ||
+	    ipoa.ipoa_flowadv.code == FADV_SUSPENDED) {
+		error = ENOBUFS;
+		ifnet_disable_output(interface);
+	}
+
+	return error;
+}
+
+/* Completion of ESP output done by the async crypto workers */
+static void
+ipsec_output_v4_done(mbuf_t data, struct secasvar *sav, void *arg)
+{
+	ifnet_t interface = arg;
+
+	if (data != NULL)
+		(void) ipsec_output_v4(interface, data, sav->sah->outgoing_if);
+	else
+		ifnet_stat_increment_out(interface, 0, 0, 1);
+	ifnet_release(interface);
+}
+
 static void
 ipsec_start(ifnet_t	interface)
 {
@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Per-interface neighbor tables and expiry wheels; see if_nbr.h.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/sysctl.h>
+#include <sys/mcache.h>
+#include <kern/locks.h>
+#include <libkern/OSAtomic.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/route.h>
+#include <net/flowhash.h>
+#include <net/if_nbr.h>
+
+#include <dev/random/randomdev.h>
+
+/* tries at a busy route before a lookup gives up on the table */
+#define	NBR_LOOKUP_TRIES	4
+
+static lck_grp_attr_t	*nbr_lck_grp_attr;
+static lck_grp_t	*nbr_lck_grp;
+static lck_attr_t	*nbr_lck_attr;
+
+static u_int32_t nbr_buckets = 64;	/* for tables allocated later */
+
+struct nbr_stat nbr_stat;
+
+static int sysctl_nbr_buckets SYSCTL_HANDLER_ARGS;
+
+SYSCTL_DECL(_net_link_generic_system);
+
+SYSCTL_PROC(_net_link_generic_system, OID_AUTO, nbr_buckets,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, &nbr_buckets, 0,
+    sysctl_nbr_buckets, "IU",
+    "Initial hash buckets in a per-interface neighbor table");
+
+SYSCTL_STRUCT(_net_link_generic_system, OID_AUTO, nbr_stat,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &nbr_stat, nbr_stat,
+    "Neighbor table statistics");
+
+static struct nbr_table *nbr_table_alloc(struct ifnet *, int, u_int32_t,
+    u_int32_t);
+static void nbr_table_grow(struct nbr_table **);
+static void nbr_wheel_link(struct nbr_wheel *, struct nbr_entry *,
+    u_int64_t);
+static void nbr_wheel_unlink(struct nbr_wheel *, struct nbr_entry *);
+static void nbr_wheel_take(struct nbr_wheel *, struct nbr_list *);
+static void nbr_wheel_far(struct nbr_wheel *, u_int64_t);
+
+static int
+sysctl_nbr_buckets SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	u_int32_t i;
+	int err;
+
+	i = nbr_buckets;
+	err = sysctl_handle_int(oidp, &i, 0, req);
+	if (err != 0 || req->newptr == USER_ADDR_NULL)
+		return (err);
+
+	if (i < 16 || i > NBR_BUCKETS_MAX || (i & (i - 1)) != 0)
+		return (EINVAL);
+
+	nbr_buckets = i;
+	return (0);
+}
+
+void
+nbr_init(void)
+{
+	nbr_lck_grp_attr = lck_grp_attr_alloc_init();
+	nbr_lck_grp = lck_grp_alloc_init("nbr_table", nbr_lck_grp_attr);
+	nbr_lck_attr = lck_attr_alloc_init();
+}
+
+static struct nbr_table *
+nbr_table_alloc(struct ifnet *ifp, int af, u_int32_t n, u_int32_t seed)
+{
+	struct nbr_table *nt;
+	u_int32_t i;
+
+	MALLOC(nt, struct nbr_table *, sizeof (*nt), M_RTABLE,
+	    M_WAITOK | M_ZERO);
+	if (nt == NULL)
+		return (NULL);
+	MALLOC(nt->nt_buckets, struct nbr_bucket *,
+	    n * sizeof (*nt->nt_buckets), M_RTABLE, M_WAITOK | M_ZERO);
+	if (nt->nt_buckets == NULL) {
+		FREE(nt, M_RTABLE);
+		return (NULL);
+	}
+	for (i = 0; i < n; i++) {
+		lck_mtx_init(&nt->nt_buckets[i].nb_lock, nbr_lck_grp,
+		    nbr_lck_attr);
+		LIST_INIT(&nt->nt_buckets[i].nb_head);
+	}
+	nt->nt_ifp = ifp;
+	nt->nt_af = af;
+	nt->nt_mask = n - 1;
+	nt->nt_seed = seed;
+	nbr_stat.ns_tables++;
+	return (nt);
+}
+
+/*
+ * Replace a table by one with twice the buckets.  The seed stays, so
+ * the entries keep their hashes.  Inserts and removes are serialized
+ * by rnh_lock; lookups only hold one bucket lock at a time, and miss
+ * in an old bucket once it has been emptied.
+ */
+static void
+nbr_table_grow(struct nbr_table **ntp)
+{
+	struct nbr_table *ont = *ntp, *nt;
+	struct nbr_bucket *nb;
+	struct nbr_entry *ne;
+	u_int32_t i;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+
+	nt = nbr_table_alloc(ont->nt_ifp, ont->nt_af,
+	    (ont->nt_mask + 1) << 1, ont->nt_seed);
+	if (nt == NULL)
+		return;
+
+	for (i = 0; i <= ont->nt_mask; i++) {
+		nb = &ont->nt_buckets[i];
+		lck_mtx_lock_spin(&nb->nb_lock);
+		while ((ne = LIST_FIRST(&nb->nb_head)) != NULL) {
+			LIST_REMOVE(ne, ne_link);
+			/* not yet seen by lookups; no need to lock */
+			LIST_INSERT_HEAD(&nt->nt_buckets[ne->ne_hash &
+			    nt->nt_mask].nb_head, ne, ne_link);
+			ne->ne_tab = nt;
+			nt->nt_count++;
+		}
+		lck_mtx_unlock(&nb->nb_lock);
+	}
+	VERIFY(nt->nt_count == ont->nt_count);
+	ont->nt_count = 0;
+	nt->nt_old = ont;
+	OSMemoryBarrier();
+	*ntp = nt;
+	nbr_stat.ns_grown++;
+}
+
+static __inline u_int32_t
+nbr_addrlen(int af)
+{
+	return ((af == AF_INET) ? sizeof (struct in_addr) :
+	    sizeof (struct in6_addr));
+}
+
+static __inline struct nbr_table **
+nbr_tablep(struct ifnet *ifp, int af)
+{
+	return ((af == AF_INET) ? &ifp->if_nbr_in : &ifp->if_nbr_in6);
+}
+
+/*
+ * Set up the entry embedded in a route's llinfo; the key is the route's
+ * destination, which stays the same for the life of the route.
+ */
+void
+nbr_entry_init(struct nbr_entry *ne, struct rtentry *rt)
+{
+	struct sockaddr *dst = rt_key(rt);
+
+	bzero(ne, sizeof (*ne));
+	ne->ne_rt = rt;
+	ne->ne_slot = NBR_SLOT_NONE;
+	if (dst->sa_family == AF_INET) {
+		ne->ne_addr.ne_in = SIN(dst)->sin_addr;
+	} else {
+		VERIFY(dst->sa_family == AF_INET6);
+		ne->ne_addr.ne_in6 = SIN6(dst)->sin6_addr;
+	}
+}
+
+/*
+ * Hash an entry in the table of the interface.  If there is no table and
+ * none can be had, the entry is left out, and lookups of it go through
+ * the radix tree.
+ */
+void
+nbr_insert(struct ifnet *ifp, struct nbr_entry *ne)
+{
+	struct rtentry *rt = ne->ne_rt;
+	int af = rt_key(rt)->sa_family;
+	struct nbr_table *nt, **ntp = nbr_tablep(ifp, af);
+	struct nbr_bucket *nb;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+	RT_LOCK_ASSERT_HELD(rt);
+	VERIFY(ne->ne_tab == NULL);
+
+	if ((nt = *ntp) == NULL) {
+		/* may block */
+		RT_CONVERT_LOCK(rt);
+		if ((nt = nbr_table_alloc(ifp, af, nbr_buckets,
+		    RandomULong())) == NULL)
+			return;
+		/* lookups read the pointer without rnh_lock */
+		OSMemoryBarrier();
+		*ntp = nt;
+	}
+
+	ne->ne_hash = net_flowhash(&ne->ne_addr, nbr_addrlen(af),
+	    nt->nt_seed);
+	nb = &nt->nt_buckets[ne->ne_hash & nt->nt_mask];
+	lck_mtx_lock_spin(&nb->nb_lock);
+	LIST_INSERT_HEAD(&nb->nb_head, ne, ne_link);
+	ne->ne_tab = nt;
+	lck_mtx_unlock(&nb->nb_lock);
+	atomic_add_32(&nt->nt_count, 1);
+
+	if (nt->nt_count > ((nt->nt_mask + 1) << 1) &&
+	    nt->nt_mask + 1 < NBR_BUCKETS_MAX) {
+		RT_CONVERT_LOCK(rt);
+		nbr_table_grow(ntp);
+	}
+}
+
+void
+nbr_remove(struct nbr_entry *ne)
+{
+	struct nbr_table *nt = ne->ne_tab;
+	struct nbr_bucket *nb;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+	RT_LOCK_ASSERT_HELD(ne->ne_rt);
+
+	if (nt == NULL)
+		return;
+
+	nb = &nt->nt_buckets[ne->ne_hash & nt->nt_mask];
+	lck_mtx_lock_spin(&nb->nb_lock);
+	LIST_REMOVE(ne, ne_link);
+	ne->ne_tab = NULL;
+	lck_mtx_unlock(&nb->nb_lock);
+	atomic_add_32(&nt->nt_count, -1);
+}
+
+/*
+ * Find the neighbor route for an address on an interface.  On success
+ * the route is returned locked, with a reference held for the caller,
+ * as rtalloc1_scoped() followed by RT_LOCK() would.  NULL means that the
+ * caller should fall back to the radix tree: the address is not in the
+ * table, or its route stayed busy.
+ */
+struct rtentry *
+nbr_lookup(struct ifnet *ifp, int af, const void *addr)
+{
+	struct nbr_table *nt = *nbr_tablep(ifp, af);
+	u_int32_t len = nbr_addrlen(af);
+	struct nbr_bucket *nb;
+	struct nbr_entry *ne;
+	struct rtentry *rt;
+	u_int32_t hash;
+	int tries;
+
+	if (nt == NULL || nt->nt_count == 0)
+		return (NULL);
+
+	hash = net_flowhash(addr, len, nt->nt_seed);
+	nb = &nt->nt_buckets[hash & nt->nt_mask];
+	for (tries = 0; tries < NBR_LOOKUP_TRIES; tries++) {
+		lck_mtx_lock_spin(&nb->nb_lock);
+		LIST_FOREACH(ne, &nb->nb_head, ne_link) {
+			if (ne->ne_hash == hash &&
+			    bcmp(&ne->ne_addr, addr, len) == 0)
+				break;
+		}
+		if (ne == NULL) {
+			lck_mtx_unlock(&nb->nb_lock);
+			return (NULL);
+		}
+		/*
+		 * rt_lock comes before the bucket lock, so only try for
+		 * it; the entry being in the table keeps the route around.
+		 */
+		rt = ne->ne_rt;
+		if (rt_trylock(rt)) {
+			lck_mtx_unlock(&nb->nb_lock);
+			if ((rt->rt_flags & (RTF_UP | RTF_CONDEMNED)) !=
+			    RTF_UP) {
+				RT_UNLOCK(rt);
+				return (NULL);
+			}
+			RT_ADDREF_LOCKED(rt);
+			return (rt);
+		}
+		lck_mtx_unlock(&nb->nb_lock);
+	}
+	nbr_stat.ns_busy++;
+	return (NULL);
+}
+
+void
+nbr_wheel_init(struct nbr_wheel *nw)
+{
+	u_int32_t i;
+
+	bzero(nw, sizeof (*nw));
+	lck_mtx_init(&nw->nw_lock, nbr_lck_grp, nbr_lck_attr);
+	TAILQ_INIT(&nw->nw_due);
+	TAILQ_INIT(&nw->nw_far);
+	for (i = 0; i < NBR_WHEEL_SLOTS; i++)
+		TAILQ_INIT(&nw->nw_slot[i]);
+}
+
+/*
+ * Put an entry on the slot for its deadline, or on the far list if that
+ * is a turn or more away.  A deadline that has passed gets the slot that
+ * nbr_wheel_advance() will take off next.
+ */
+static void
+nbr_wheel_link(struct nbr_wheel *nw, struct nbr_entry *ne, u_int64_t deadline)
+{
+	lck_mtx_assert(&nw->nw_lock, LCK_MTX_ASSERT_OWNED);
+	VERIFY(ne->ne_slot == NBR_SLOT_NONE);
+
+	ne->ne_deadline = deadline;
+	if (deadline < nw->nw_time + NBR_WHEEL_SLOTS) {
+		ne->ne_slot = MAX(deadline, nw->nw_time) % NBR_WHEEL_SLOTS;
+		TAILQ_INSERT_TAIL(&nw->nw_slot[ne->ne_slot], ne, ne_tlink);
+	} else {
+		ne->ne_slot = NBR_SLOT_FAR;
+		TAILQ_INSERT_TAIL(&nw->nw_far, ne, ne_tlink);
+	}
+	nw->nw_count++;
+}
+
+static void
+nbr_wheel_unlink(struct nbr_wheel *nw, struct nbr_entry *ne)
+{
+	lck_mtx_assert(&nw->nw_lock, LCK_MTX_ASSERT_OWNED);
+
+	switch (ne->ne_slot) {
+	case NBR_SLOT_NONE:
+		return;
+	case NBR_SLOT_FAR:
+		TAILQ_REMOVE(&nw->nw_far, ne, ne_tlink);
+		break;
+	case NBR_SLOT_DUE:
+		TAILQ_REMOVE(&nw->nw_due, ne, ne_tlink);
+		break;
+	default:
+		VERIFY(ne->ne_slot < NBR_WHEEL_SLOTS);
+		TAILQ_REMOVE(&nw->nw_slot[ne->ne_slot], ne, ne_tlink);
+		break;
+	}
+	ne->ne_slot = NBR_SLOT_NONE;
+	VERIFY(nw->nw_count > 0);
+	nw->nw_count--;
+}
+
+/*
+ * (Re)arm an entry to be due at the given net_uptime(), or disarm it if
+ * that is 0.  The caller holds whatever protects the entry's expiry in
+ * the protocol, which for ARP and ND6 is the route's rt_lock.
+ */
+void
+nbr_wheel_sched(struct nbr_wheel *nw, struct nbr_entry *ne,
+    u_int64_t deadline)
+{
+	lck_mtx_lock_spin(&nw->nw_lock);
+	nbr_wheel_unlink(nw, ne);
+	if (deadline != 0)
+		nbr_wheel_link(nw, ne, deadline);
+	lck_mtx_unlock(&nw->nw_lock);
+}
+
+void
+nbr_wheel_unsched(struct nbr_wheel *nw, struct nbr_entry *ne)
+{
+	nbr_wheel_sched(nw, ne, 0);
+}
+
+/* Move the entries of a slot to the due list */
+static void
+nbr_wheel_take(struct nbr_wheel *nw, struct nbr_list *head)
+{
+	struct nbr_entry *ne;
+
+	while ((ne = TAILQ_FIRST(head)) != NULL) {
+		TAILQ_REMOVE(head, ne, ne_tlink);
+		TAILQ_INSERT_TAIL(&nw->nw_due, ne, ne_tlink);
+		ne->ne_slot = NBR_SLOT_DUE;
+		nbr_stat.ns_due++;
+	}
+}
+
+/*
+ * Bring in the far entries that now fall within a turn of the wheel,
+ * once per turn; those already due go straight to the due list.
+ */
+static void
+nbr_wheel_far(struct nbr_wheel *nw, u_int64_t now)
+{
+	struct nbr_entry *ne, *nne;
+
+	for (ne = TAILQ_FIRST(&nw->nw_far); ne != NULL; ne = nne) {
+		nne = TAILQ_NEXT(ne, ne_tlink);
+		if (ne->ne_deadline >= nw->nw_time + NBR_WHEEL_SLOTS)
+			continue;
+		TAILQ_REMOVE(&nw->nw_far, ne, ne_tlink);
+		if (ne->ne_deadline <= now) {
+			TAILQ_INSERT_TAIL(&nw->nw_due, ne, ne_tlink);
+			ne->ne_slot = NBR_SLOT_DUE;
+			nbr_stat.ns_due++;
+		} else {
+			ne->ne_slot = ne->ne_deadline % NBR_WHEEL_SLOTS;
+			TAILQ_INSERT_TAIL(&nw->nw_slot[ne->ne_slot], ne,
+			    ne_tlink);
+		}
+		nbr_stat.ns_far++;
+	}
+}
+
+/*
+ * Take every entry due at or before now off the slots, onto the due list
+ * that nbr_wheel_pop() hands out.  Entries armed from then on for now or
+ * earlier get the next second's slot, so that a timer going through the
+ * due list does not see again an entry it has just rearmed.
+ */
+void
+nbr_wheel_advance(struct nbr_wheel *nw, u_int64_t now)
+{
+	u_int32_t i;
+
+	lck_mtx_lock_spin(&nw->nw_lock);
+	if (now >= nw->nw_time + NBR_WHEEL_SLOTS) {
+		/* a turn or more has gone by; every slot is due */
+		for (i = 0; i < NBR_WHEEL_SLOTS; i++)
+			nbr_wheel_take(nw, &nw->nw_slot[i]);
+		nw->nw_time = now + 1;
+		nbr_wheel_far(nw, now);
+	} else {
+		while (nw->nw_time <= now) {
+			nbr_wheel_take(nw,
+			    &nw->nw_slot[nw->nw_time % NBR_WHEEL_SLOTS]);
+			if ((++nw->nw_time % NBR_WHEEL_SLOTS) == 0)
+				nbr_wheel_far(nw, now);
+		}
+	}
+	lck_mtx_unlock(&nw->nw_lock);
+}
+
+/* Take the next entry off the due list, or return NULL */
+struct nbr_entry *
+nbr_wheel_pop(struct nbr_wheel *nw)
+{
+	struct nbr_entry *ne;
+
+	lck_mtx_lock_spin(&nw->nw_lock);
+	if ((ne = TAILQ_FIRST(&nw->nw_due)) != NULL)
+		nbr_wheel_unlink(nw, ne);
+	lck_mtx_unlock(&nw->nw_lock);
+	return (ne);
+}
+
+/*
+ * When nbr_wheel_advance() next has work to do, or 0 if the wheel is
+ * empty.  For far entries that is the end of the current turn, when
+ * they are looked at again, rather than their own deadline.
+ */
+u_int64_t
+nbr_wheel_next(struct nbr_wheel *nw)
+{
+	u_int64_t next = 0;
+	u_int32_t k;
+
+	lck_mtx_lock_spin(&nw->nw_lock);
+	if (nw->nw_count == 0)
+		goto done;
+	if (!TAILQ_EMPTY(&nw->nw_due)) {
+		next = TAILQ_FIRST(&nw->nw_due)->ne_deadline;
+		goto done;
+	}
+	if (!TAILQ_EMPTY(&nw->nw_far))
+		next = nw->nw_time | (NBR_WHEEL_SLOTS - 1);
+	for (k = 0; k < NBR_WHEEL_SLOTS; k++) {
+		if (next != 0 && nw->nw_time + k >= next)
+			break;
+		if (!TAILQ_EMPTY(&nw->nw_slot[(nw->nw_time + k) %
+		    NBR_WHEEL_SLOTS])) {
+			next = nw->nw_time + k;
+			break;
+		}
+	}
+done:
+	lck_mtx_unlock(&nw->nw_lock);
+	return (next);
+}
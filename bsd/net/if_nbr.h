@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef	_NET_IF_NBR_H_
+#define	_NET_IF_NBR_H_
+
+#ifdef BSD_KERNEL_PRIVATE
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <kern/locks.h>
+#include <netinet/in.h>
+
+/*
+ * Per-interface neighbor tables, shared by ARP and ND6.
+ *
+ * Neighbor cache entries are still cloned host routes, with their state
+ * in the route's llinfo; the radix tree remains where they are created
+ * and deleted, and what routing socket listings and the forwarding path
+ * see.  In addition, every entry is hashed by its L3 address in a table
+ * belonging to the interface it was created on, so that a resolver that
+ * knows the interface finds the route with one bucket lock instead of a
+ * radix walk under rnh_lock.
+ *
+ * Each bucket has its own lock.  Entries are put in and taken out of the
+ * table by the protocol's rtrequest callback, with rnh_lock and the
+ * route's rt_lock held; a bucket lock is taken last, so a lookup holding
+ * one may only try for rt_lock, and gives up if the route is busy.  The
+ * route cannot be freed while its entry is in a table, as that needs an
+ * RTM_DELETE first.
+ *
+ * A table starts small and doubles when it averages more than two
+ * entries per bucket.  The entries are moved over one old bucket at a
+ * time, so a lookup in the old table meanwhile may miss and go to the
+ * radix tree; the old table is kept, since a lookup may still be about
+ * to lock one of its buckets.
+ *
+ * Expiry is kept on a timing wheel per protocol, with one-second slots
+ * for the next NBR_WHEEL_SLOTS seconds and a list for anything further
+ * out, which is looked at once per turn of the wheel.  The protocol
+ * timer takes only the entries that are due, rather than walking them
+ * all.  Tables are allocated on the first neighbor of an interface, and
+ * are kept for as long as the ifnet, which is never freed.
+ */
+
+#define	NBR_WHEEL_SLOTS	256		/* seconds covered by the slots */
+#define	NBR_BUCKETS_MAX	65536		/* a table grows up to this */
+
+struct nbr_table;
+
+struct nbr_entry {
+	LIST_ENTRY(nbr_entry) ne_link;	/* on the hash bucket */
+	TAILQ_ENTRY(nbr_entry) ne_tlink; /* on the wheel */
+	struct nbr_table *ne_tab;	/* table hashed in, or NULL */
+	struct rtentry	*ne_rt;		/* the neighbor's route */
+	u_int64_t	ne_deadline;	/* when due, in net_uptime() */
+	u_int32_t	ne_slot;	/* see below */
+	u_int32_t	ne_hash;
+	union {
+		struct in_addr	ne_in;
+		struct in6_addr	ne_in6;
+	} ne_addr;
+};
+
+/* ne_slot values other than a slot index */
+#define	NBR_SLOT_NONE	0xffffffff	/* not on the wheel */
+#define	NBR_SLOT_FAR	0xfffffffe	/* too far out for the slots */
+#define	NBR_SLOT_DUE	0xfffffffd	/* taken off, waiting for the timer */
+
+struct nbr_bucket {
+	decl_lck_mtx_data(, nb_lock);
+	LIST_HEAD(, nbr_entry) nb_head;
+};
+
+struct nbr_table {
+	struct ifnet	*nt_ifp;
+	int		nt_af;
+	u_int32_t	nt_mask;	/* # of buckets - 1 */
+	u_int32_t	nt_seed;	/* hash seed */
+	u_int32_t	nt_count;	/* # of entries in the table */
+	struct nbr_bucket *nt_buckets;
+	struct nbr_table *nt_old;	/* table grown out of, kept */
+};
+
+TAILQ_HEAD(nbr_list, nbr_entry);
+
+struct nbr_wheel {
+	decl_lck_mtx_data(, nw_lock);
+	u_int64_t	nw_time;	/* next second to be taken off */
+	u_int32_t	nw_count;	/* # of entries on the wheel */
+	struct nbr_list	nw_due;		/* due, not yet handled */
+	struct nbr_list	nw_far;		/* NBR_WHEEL_SLOTS or more out */
+	struct nbr_list	nw_slot[NBR_WHEEL_SLOTS];
+};
+
+struct nbr_stat {
+	u_int64_t	ns_tables;	/* tables allocated */
+	u_int64_t	ns_grown;	/* tables replaced by a larger one */
+	u_int64_t	ns_busy;	/* lookups that found the route locked */
+	u_int64_t	ns_due;		/* entries taken off a wheel as due */
+	u_int64_t	ns_far;		/* entries moved from a far list */
+};
+
+extern struct nbr_stat nbr_stat;
+
+extern void nbr_init(void);
+extern void nbr_entry_init(struct nbr_entry *, struct rtentry *);
+extern void nbr_insert(struct ifnet *, struct nbr_entry *);
+extern void nbr_remove(struct nbr_entry *);
+extern struct rtentry *nbr_lookup(struct ifnet *, int, const void *);
+
+extern void nbr_wheel_init(struct nbr_wheel *);
+extern void nbr_wheel_sched(struct nbr_wheel *, struct nbr_entry *,
+    u_int64_t);
+extern void nbr_wheel_unsched(struct nbr_wheel *, struct nbr_entry *);
+extern void nbr_wheel_advance(struct nbr_wheel *, u_int64_t);
+extern struct nbr_entry *nbr_wheel_pop(struct nbr_wheel *);
+extern u_int64_t nbr_wheel_next(struct nbr_wheel *);
+#endif /* BSD_KERNEL_PRIVATE */
+#endif /* _NET_IF_NBR_H_ */
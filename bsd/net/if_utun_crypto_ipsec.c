@@ -45,6 +45,7 @@
 #include <netinet6/esp.h>
 #include <netinet6/esp6.h>
 #include <netinet6/ipsec.h>
+#include <netkey/key.h>
 #include <net/bpf.h>
 
 extern lck_mtx_t *sadb_mutex;
@@ -356,7 +357,7 @@ utun_ipsec_alloc_sav (struct secashead                *sah,
 	(*sav)->utun_pcb = (__typeof__((*sav)->utun_pcb))pcb;
 	(*sav)->utun_is_keepalive_fn = (__typeof__((*sav)->utun_is_keepalive_fn))utun_pkt_is_ipsec_keepalive;
 	(*sav)->utun_in_fn = (__typeof__((*sav)->utun_in_fn))utun_pkt_ipsec_input;
-	(*sav)->refcnt++; // for the pcb
+	KEY_SAV_ADDREF(*sav); // for the pcb
 	lck_mtx_unlock(sadb_mutex);
 	utun_free(keya);
 	utun_free(keye);
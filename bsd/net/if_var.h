@@ -688,6 +688,7 @@ struct proto_hash_entry;
 struct dlil_threading_info;
 struct tcpstat_local;
 struct udpstat_local;
+struct nbr_table;
 #if PF
 struct pfi_kif;
 #endif /* PF */
@@ -886,6 +887,9 @@ struct ifnet {
 	decl_lck_rw_data(, if_llreach_lock);
 	struct ll_reach_tree	if_ll_srcs;	/* source link-layer tree */
 
+	struct nbr_table	*if_nbr_in;	/* ARP neighbor table */
+	struct nbr_table	*if_nbr_in6;	/* ND6 neighbor table */
+
 	void			*if_bridge;	/* bridge glue */
 
 	u_int32_t		if_want_aggressive_drain;
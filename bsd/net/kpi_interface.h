@@ -1320,6 +1320,38 @@ extern errno_t ifnet_dequeue_service_class(ifnet_t interface,
 extern errno_t ifnet_dequeue_multi(ifnet_t interface, u_int32_t max,
     mbuf_t *first_packet, mbuf_t *last_packet, u_int32_t *cnt, u_int32_t *len);
 
+/*
+	@function ifnet_dequeue_multi_bytes
+	@discussion Dequeue one or more packets from the output queue of
+		an interface which implements the new driver output model,
+		where the scheduling model is set to
+		IFNET_SCHED_MODEL_NORMAL.  The limit is specified in terms
+		of maximum number of bytes to return; the last packet of
+		the chain may take the total past that limit.  The number
+		of packets returned is also capped internally.  The returned
+		packet chain is traversable with mbuf_nextpkt().
+	@param interface The interface to dequeue the packets from.
+	@param max_bytes The maximum number of bytes in the packet chain
+		that may be returned to the caller; this needs to be a
+		non-zero value for any packet to be returned.
+	@param first_packet Pointer to the first packet being dequeued.
+	@param last_packet Pointer to the last packet being dequeued.  Caller
+		may supply NULL if not interested in value.
+	@param cnt Pointer to a storage for the number of packets dequeued.
+		Caller may supply NULL if not interested in value.
+	@param len Pointer to a storage for the total length (in bytes)
+		of the dequeued packets.  Caller may supply NULL if not
+		interested in value.
+	@result May return EINVAL if the parameters are invalid, ENXIO if
+		the interface doesn't implement the new driver output model
+		or the output scheduling model isn't IFNET_SCHED_MODEL_NORMAL,
+		or EAGAIN if there is currently no packet available to
+		be dequeued.
+ */
+extern errno_t ifnet_dequeue_multi_bytes(ifnet_t interface,
+    u_int32_t max_bytes, mbuf_t *first_packet, mbuf_t *last_packet,
+    u_int32_t *cnt, u_int32_t *len);
+
 /*
 	@function ifnet_dequeue_service_class_multi
 	@discussion Dequeue one or more packets of a particular service class
@@ -278,9 +278,13 @@ static u_int32_t necp_kernel_socket_policies_condition_mask;
 static size_t necp_kernel_socket_policies_count;
 static size_t necp_kernel_socket_policies_non_app_count;
 static LIST_HEAD(_necpkernelsocketconnectpolicies, necp_kernel_socket_policy) necp_kernel_socket_policies;
-#define	NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS 5
+#define	NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS 9
+#define	NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS 5
+#define	NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS (NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS * NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS)
 #define	NECP_SOCKET_MAP_APP_ID_TO_BUCKET(appid) (appid ? (appid%(NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS - 1) + 1) : 0)
-static struct necp_kernel_socket_policy **necp_kernel_socket_policies_map[NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS];
+#define	NECP_SOCKET_MAP_IF_INDEX_TO_BUCKET(index) NECP_MAP_INDEX_TO_BUCKET(index, NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS)
+#define	NECP_SOCKET_MAP_BUCKET(appid, index) (NECP_SOCKET_MAP_APP_ID_TO_BUCKET(appid) * NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS + NECP_SOCKET_MAP_IF_INDEX_TO_BUCKET(index))
+static struct necp_kernel_socket_policy **necp_kernel_socket_policies_map[NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS];
 static struct necp_kernel_socket_policy **necp_kernel_socket_policies_app_layer_map;
 /*
  * A note on policy 'maps': these are used for boosting efficiency when matching policies. For each dimension of the map,
@@ -288,15 +292,25 @@ static struct necp_kernel_socket_policy **necp_kernel_socket_policies_app_layer_
  * buckets lead to an array of policy pointers that form the list applicable when the (parameter%(NUM_BUCKETS - 1) + 1) == bucket_index.
  *
  * For example, a packet with policy ID of 7, when there are 4 ID buckets, will map to bucket (7%3 + 1) = 2.
+ *
+ * The maps have two dimensions, the ID (app ID for sockets, socket policy ID for IP output) and the bound interface
+ * index, flattened as (id_bucket * NUM_IF_BUCKETS + if_bucket). A policy that is not scoped to all interfaces only
+ * matches unbound traffic unless it names a bound interface, so most policies land in a single interface bucket.
+ * Every bucket keeps the policies in global order, so order, session and skip semantics are unchanged.
  */
+#define	NECP_MAP_INDEX_TO_BUCKET(index, num) (index ? (index%(num - 1) + 1) : 0)
 
 static u_int32_t necp_kernel_ip_output_policies_condition_mask;
 static size_t necp_kernel_ip_output_policies_count;
 static size_t necp_kernel_ip_output_policies_non_id_count;
 static LIST_HEAD(_necpkernelipoutputpolicies, necp_kernel_ip_output_policy) necp_kernel_ip_output_policies;
 #define	NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS 5
+#define	NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS 5
+#define	NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS (NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS * NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS)
 #define	NECP_IP_OUTPUT_MAP_ID_TO_BUCKET(id) (id ? (id%(NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS - 1) + 1) : 0)
-static struct necp_kernel_ip_output_policy **necp_kernel_ip_output_policies_map[NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS];
+#define	NECP_IP_OUTPUT_MAP_IF_INDEX_TO_BUCKET(index) NECP_MAP_INDEX_TO_BUCKET(index, NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS)
+#define	NECP_IP_OUTPUT_MAP_BUCKET(id, index) (NECP_IP_OUTPUT_MAP_ID_TO_BUCKET(id) * NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS + NECP_IP_OUTPUT_MAP_IF_INDEX_TO_BUCKET(index))
+static struct necp_kernel_ip_output_policy **necp_kernel_ip_output_policies_map[NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS];
 
 static struct necp_session *necp_create_session(u_int32_t control_unit);
 static void necp_delete_session(struct necp_session *session);
@@ -3030,7 +3044,7 @@ necp_kernel_socket_policies_dump_all(void)
 	if (necp_debug) {
 		struct necp_kernel_socket_policy *policy = NULL;
 		int policy_i;
-		int app_i;
+		int bucket_i;
 		char result_string[MAX_RESULT_STRING_LEN];
 		char proc_name_string[MAXCOMLEN + 1];
 		memset(result_string, 0, MAX_RESULT_STRING_LEN);
@@ -3049,10 +3063,10 @@ necp_kernel_socket_policies_dump_all(void)
 
 		NECPLOG0(LOG_DEBUG, "NECP Socket Policies:\n");
 		NECPLOG0(LOG_DEBUG, "-----------\n");
-		for (app_i = 0; app_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS; app_i++) {
-			NECPLOG(LOG_DEBUG, "\tApp Bucket: %d\n", app_i);
-			for (policy_i = 0; necp_kernel_socket_policies_map[app_i] != NULL && (necp_kernel_socket_policies_map[app_i])[policy_i] != NULL; policy_i++) {
-				policy = (necp_kernel_socket_policies_map[app_i])[policy_i];
+		for (bucket_i = 0; bucket_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS; bucket_i++) {
+			NECPLOG(LOG_DEBUG, "\tApp Bucket: %d Interface Bucket: %d\n", bucket_i / NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS, bucket_i % NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS);
+			for (policy_i = 0; necp_kernel_socket_policies_map[bucket_i] != NULL && (necp_kernel_socket_policies_map[bucket_i])[policy_i] != NULL; policy_i++) {
+				policy = (necp_kernel_socket_policies_map[bucket_i])[policy_i];
 				proc_name(policy->session_pid, proc_name_string, MAXCOMLEN);
 				NECPLOG(LOG_DEBUG, "\t%3d. Policy ID: %5d\tProcess: %10.10s\tOrder: %04d.%04d\tMask: %5x\tResult: %s\n", policy_i, policy->id, proc_name_string, policy->session_order, policy->order, policy->condition_mask, necp_get_result_description(result_string, policy->result, policy->result_parameter));
 			}
@@ -3245,12 +3259,46 @@ necp_kernel_socket_policy_is_unnecessary(struct necp_kernel_socket_policy *polic
 	return (FALSE);
 }
 
+static inline bool
+necp_kernel_policy_is_in_interface_bucket(u_int32_t condition_mask, u_int32_t condition_negated_mask, ifnet_t cond_bound_interface, int if_i, int num_if_buckets)
+{
+	if (condition_mask & NECP_KERNEL_CONDITION_ALL_INTERFACES) {
+		return (TRUE);
+	}
+
+	if (condition_mask & NECP_KERNEL_CONDITION_BOUND_INTERFACE) {
+		if (condition_negated_mask & NECP_KERNEL_CONDITION_BOUND_INTERFACE) {
+			return (TRUE);
+		}
+		u_int32_t cond_bound_interface_index = cond_bound_interface ? cond_bound_interface->if_index : 0;
+		return (NECP_MAP_INDEX_TO_BUCKET(cond_bound_interface_index, num_if_buckets) == if_i);
+	}
+
+	// Without an interface condition, the policy only matches unbound sockets/packets
+	return (if_i == 0);
+}
+
+static inline bool
+necp_kernel_socket_policy_is_in_bucket(struct necp_kernel_socket_policy *policy, int bucket_i)
+{
+	int app_i = bucket_i / NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS;
+	int if_i = bucket_i % NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS;
+
+	if ((policy->condition_mask & NECP_KERNEL_CONDITION_APP_ID) &&
+		!(policy->condition_negated_mask & NECP_KERNEL_CONDITION_APP_ID) &&
+		NECP_SOCKET_MAP_APP_ID_TO_BUCKET(policy->cond_app_id) != app_i) {
+		return (FALSE);
+	}
+
+	return (necp_kernel_policy_is_in_interface_bucket(policy->condition_mask, policy->condition_negated_mask, policy->cond_bound_interface, if_i, NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_IF_BUCKETS));
+}
+
 static bool
 necp_kernel_socket_policies_reprocess(void)
 {
-	int app_i;
-	int bucket_allocation_counts[NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS];
-	int bucket_current_free_index[NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS];
+	int bucket_i;
+	int bucket_allocation_counts[NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS];
+	int bucket_current_free_index[NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS];
 	int app_layer_allocation_count = 0;
 	int app_layer_current_free_index = 0;
 	struct necp_kernel_socket_policy *kernel_policy = NULL;
@@ -3265,14 +3313,14 @@ necp_kernel_socket_policies_reprocess(void)
 	necp_kernel_socket_policies_non_app_count = 0;
 
 	// Reset all maps to NULL
-	for (app_i = 0; app_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS; app_i++) {
-		if (necp_kernel_socket_policies_map[app_i] != NULL) {
-			FREE(necp_kernel_socket_policies_map[app_i], M_NECP);
-			necp_kernel_socket_policies_map[app_i] = NULL;
+	for (bucket_i = 0; bucket_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS; bucket_i++) {
+		if (necp_kernel_socket_policies_map[bucket_i] != NULL) {
+			FREE(necp_kernel_socket_policies_map[bucket_i], M_NECP);
+			necp_kernel_socket_policies_map[bucket_i] = NULL;
 		}
 
 		// Init counts
-		bucket_allocation_counts[app_i] = 0;
+		bucket_allocation_counts[bucket_i] = 0;
 	}
 	if (necp_kernel_socket_policies_app_layer_map != NULL) {
 		FREE(necp_kernel_socket_policies_app_layer_map, M_NECP);
@@ -3293,27 +3341,27 @@ necp_kernel_socket_policies_reprocess(void)
 		if (!(kernel_policy->condition_mask & NECP_KERNEL_CONDITION_APP_ID) ||
 			kernel_policy->condition_negated_mask & NECP_KERNEL_CONDITION_APP_ID) {
 			necp_kernel_socket_policies_non_app_count++;
-			for (app_i = 0; app_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS; app_i++) {
-				bucket_allocation_counts[app_i]++;
+		}
+		for (bucket_i = 0; bucket_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS; bucket_i++) {
+			if (necp_kernel_socket_policy_is_in_bucket(kernel_policy, bucket_i)) {
+				bucket_allocation_counts[bucket_i]++;
 			}
-		} else {
-			bucket_allocation_counts[NECP_SOCKET_MAP_APP_ID_TO_BUCKET(kernel_policy->cond_app_id)]++;
 		}
 	}
 
 	// Allocate maps
-	for (app_i = 0; app_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS; app_i++) {
-		if (bucket_allocation_counts[app_i] > 0) {
+	for (bucket_i = 0; bucket_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS; bucket_i++) {
+		if (bucket_allocation_counts[bucket_i] > 0) {
 			// Allocate a NULL-terminated array of policy pointers for each bucket
-			MALLOC(necp_kernel_socket_policies_map[app_i], struct necp_kernel_socket_policy **, sizeof(struct necp_kernel_socket_policy *) * (bucket_allocation_counts[app_i] + 1), M_NECP, M_WAITOK);
-			if (necp_kernel_socket_policies_map[app_i] == NULL) {
+			MALLOC(necp_kernel_socket_policies_map[bucket_i], struct necp_kernel_socket_policy **, sizeof(struct necp_kernel_socket_policy *) * (bucket_allocation_counts[bucket_i] + 1), M_NECP, M_WAITOK);
+			if (necp_kernel_socket_policies_map[bucket_i] == NULL) {
 				goto fail;
 			}
 
 			// Initialize the first entry to NULL
-			(necp_kernel_socket_policies_map[app_i])[0] = NULL;
+			(necp_kernel_socket_policies_map[bucket_i])[0] = NULL;
 		}
-		bucket_current_free_index[app_i] = 0;
+		bucket_current_free_index[bucket_i] = 0;
 	}
 	MALLOC(necp_kernel_socket_policies_app_layer_map, struct necp_kernel_socket_policy **, sizeof(struct necp_kernel_socket_policy *) * (app_layer_allocation_count + 1), M_NECP, M_WAITOK);
 	if (necp_kernel_socket_policies_app_layer_map == NULL) {
@@ -3324,21 +3372,12 @@ necp_kernel_socket_policies_reprocess(void)
 	// Fill out maps
 	LIST_FOREACH(kernel_policy, &necp_kernel_socket_policies, chain) {
 		// Insert pointers into map
-		if (!(kernel_policy->condition_mask & NECP_KERNEL_CONDITION_APP_ID) ||
-			kernel_policy->condition_negated_mask & NECP_KERNEL_CONDITION_APP_ID) {
-			for (app_i = 0; app_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS; app_i++) {
-				if (!necp_kernel_socket_policy_is_unnecessary(kernel_policy, necp_kernel_socket_policies_map[app_i], bucket_current_free_index[app_i])) {
-					(necp_kernel_socket_policies_map[app_i])[(bucket_current_free_index[app_i])] = kernel_policy;
-					bucket_current_free_index[app_i]++;
-					(necp_kernel_socket_policies_map[app_i])[(bucket_current_free_index[app_i])] = NULL;
-				}
-			}
-		} else {
-			app_i = NECP_SOCKET_MAP_APP_ID_TO_BUCKET(kernel_policy->cond_app_id);
-			if (!necp_kernel_socket_policy_is_unnecessary(kernel_policy, necp_kernel_socket_policies_map[app_i], bucket_current_free_index[app_i])) {
-				(necp_kernel_socket_policies_map[app_i])[(bucket_current_free_index[app_i])] = kernel_policy;
-				bucket_current_free_index[app_i]++;
-				(necp_kernel_socket_policies_map[app_i])[(bucket_current_free_index[app_i])] = NULL;
+		for (bucket_i = 0; bucket_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS; bucket_i++) {
+			if (necp_kernel_socket_policy_is_in_bucket(kernel_policy, bucket_i) &&
+				!necp_kernel_socket_policy_is_unnecessary(kernel_policy, necp_kernel_socket_policies_map[bucket_i], bucket_current_free_index[bucket_i])) {
+				(necp_kernel_socket_policies_map[bucket_i])[(bucket_current_free_index[bucket_i])] = kernel_policy;
+				bucket_current_free_index[bucket_i]++;
+				(necp_kernel_socket_policies_map[bucket_i])[(bucket_current_free_index[bucket_i])] = NULL;
 			}
 		}
 
@@ -3359,10 +3398,10 @@ fail:
 	necp_kernel_application_policies_count = 0;
 	necp_kernel_socket_policies_count = 0;
 	necp_kernel_socket_policies_non_app_count = 0;
-	for (app_i = 0; app_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_APP_ID_BUCKETS; app_i++) {
-		if (necp_kernel_socket_policies_map[app_i] != NULL) {
-			FREE(necp_kernel_socket_policies_map[app_i], M_NECP);
-			necp_kernel_socket_policies_map[app_i] = NULL;
+	for (bucket_i = 0; bucket_i < NECP_KERNEL_SOCKET_POLICIES_MAP_NUM_BUCKETS; bucket_i++) {
+		if (necp_kernel_socket_policies_map[bucket_i] != NULL) {
+			FREE(necp_kernel_socket_policies_map[bucket_i], M_NECP);
+			necp_kernel_socket_policies_map[bucket_i] = NULL;
 		}
 	}
 	if (necp_kernel_socket_policies_app_layer_map != NULL) {
@@ -4149,7 +4188,7 @@ necp_kernel_ip_output_policies_dump_all(void)
 	if (necp_debug) {
 		struct necp_kernel_ip_output_policy *policy = NULL;
 		int policy_i;
-		int id_i;
+		int bucket_i;
 		char result_string[MAX_RESULT_STRING_LEN];
 		char proc_name_string[MAXCOMLEN + 1];
 		memset(result_string, 0, MAX_RESULT_STRING_LEN);
@@ -4157,10 +4196,10 @@ necp_kernel_ip_output_policies_dump_all(void)
 
 		NECPLOG0(LOG_DEBUG, "NECP IP Output Policies:\n");
 		NECPLOG0(LOG_DEBUG, "-----------\n");
-		for (id_i = 0; id_i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS; id_i++) {
-			NECPLOG(LOG_DEBUG, " ID Bucket: %d\n", id_i);
-			for (policy_i = 0; necp_kernel_ip_output_policies_map[id_i] != NULL && (necp_kernel_ip_output_policies_map[id_i])[policy_i] != NULL; policy_i++) {
-				policy = (necp_kernel_ip_output_policies_map[id_i])[policy_i];
+		for (bucket_i = 0; bucket_i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS; bucket_i++) {
+			NECPLOG(LOG_DEBUG, " ID Bucket: %d Interface Bucket: %d\n", bucket_i / NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS, bucket_i % NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS);
+			for (policy_i = 0; necp_kernel_ip_output_policies_map[bucket_i] != NULL && (necp_kernel_ip_output_policies_map[bucket_i])[policy_i] != NULL; policy_i++) {
+				policy = (necp_kernel_ip_output_policies_map[bucket_i])[policy_i];
 				proc_name(policy->session_pid, proc_name_string, MAXCOMLEN);
 				NECPLOG(LOG_DEBUG, "\t%3d. Policy ID: %5d\tProcess: %10.10s\tOrder: %04d.%04d.%d\tMask: %5x\tResult: %s\n", policy_i, policy->id, proc_name_string, policy->session_order, policy->order, policy->suborder, policy->condition_mask, necp_get_result_description(result_string, policy->result, policy->result_parameter));
 			}
@@ -4300,12 +4339,26 @@ necp_kernel_ip_output_policy_is_unnecessary(struct necp_kernel_ip_output_policy
 	return (FALSE);
 }
 
+static inline bool
+necp_kernel_ip_output_policy_is_in_bucket(struct necp_kernel_ip_output_policy *policy, int bucket_i)
+{
+	int id_i = bucket_i / NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS;
+	int if_i = bucket_i % NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS;
+
+	if ((policy->condition_mask & NECP_KERNEL_CONDITION_POLICY_ID) &&
+		NECP_IP_OUTPUT_MAP_ID_TO_BUCKET(policy->cond_policy_id) != id_i) {
+		return (FALSE);
+	}
+
+	return (necp_kernel_policy_is_in_interface_bucket(policy->condition_mask, policy->condition_negated_mask, policy->cond_bound_interface, if_i, NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_IF_BUCKETS));
+}
+
 static bool
 necp_kernel_ip_output_policies_reprocess(void)
 {
 	int i;
-	int bucket_allocation_counts[NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS];
-	int bucket_current_free_index[NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS];
+	int bucket_allocation_counts[NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS];
+	int bucket_current_free_index[NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS];
 	struct necp_kernel_ip_output_policy *kernel_policy = NULL;
 
 	lck_rw_assert(&necp_kernel_policy_lock, LCK_RW_ASSERT_EXCLUSIVE);
@@ -4315,7 +4368,7 @@ necp_kernel_ip_output_policies_reprocess(void)
 	necp_kernel_ip_output_policies_count = 0;
 	necp_kernel_ip_output_policies_non_id_count = 0;
 
-	for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS; i++) {
+	for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS; i++) {
 		if (necp_kernel_ip_output_policies_map[i] != NULL) {
 			FREE(necp_kernel_ip_output_policies_map[i], M_NECP);
 			necp_kernel_ip_output_policies_map[i] = NULL;
@@ -4333,15 +4386,15 @@ necp_kernel_ip_output_policies_reprocess(void)
 		// Update bucket counts
 		if (!(kernel_policy->condition_mask & NECP_KERNEL_CONDITION_POLICY_ID)) {
 			necp_kernel_ip_output_policies_non_id_count++;
-			for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS; i++) {
+		}
+		for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS; i++) {
+			if (necp_kernel_ip_output_policy_is_in_bucket(kernel_policy, i)) {
 				bucket_allocation_counts[i]++;
 			}
-		} else {
-			bucket_allocation_counts[NECP_IP_OUTPUT_MAP_ID_TO_BUCKET(kernel_policy->cond_policy_id)]++;
 		}
 	}
 
-	for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS; i++) {
+	for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS; i++) {
 		if (bucket_allocation_counts[i] > 0) {
 			// Allocate a NULL-terminated array of policy pointers for each bucket
 			MALLOC(necp_kernel_ip_output_policies_map[i], struct necp_kernel_ip_output_policy **, sizeof(struct necp_kernel_ip_output_policy *) * (bucket_allocation_counts[i] + 1), M_NECP, M_WAITOK);
@@ -4357,17 +4410,9 @@ necp_kernel_ip_output_policies_reprocess(void)
 
 	LIST_FOREACH(kernel_policy, &necp_kernel_ip_output_policies, chain) {
 		// Insert pointers into map
-		if (!(kernel_policy->condition_mask & NECP_KERNEL_CONDITION_POLICY_ID)) {
-			for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS; i++) {
-				if (!necp_kernel_ip_output_policy_is_unnecessary(kernel_policy, necp_kernel_ip_output_policies_map[i], bucket_current_free_index[i])) {
-					(necp_kernel_ip_output_policies_map[i])[(bucket_current_free_index[i])] = kernel_policy;
-					bucket_current_free_index[i]++;
-					(necp_kernel_ip_output_policies_map[i])[(bucket_current_free_index[i])] = NULL;
-				}
-			}
-		} else {
-			i = NECP_IP_OUTPUT_MAP_ID_TO_BUCKET(kernel_policy->cond_policy_id);
-			if (!necp_kernel_ip_output_policy_is_unnecessary(kernel_policy, necp_kernel_ip_output_policies_map[i], bucket_current_free_index[i])) {
+		for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS; i++) {
+			if (necp_kernel_ip_output_policy_is_in_bucket(kernel_policy, i) &&
+				!necp_kernel_ip_output_policy_is_unnecessary(kernel_policy, necp_kernel_ip_output_policies_map[i], bucket_current_free_index[i])) {
 				(necp_kernel_ip_output_policies_map[i])[(bucket_current_free_index[i])] = kernel_policy;
 				bucket_current_free_index[i]++;
 				(necp_kernel_ip_output_policies_map[i])[(bucket_current_free_index[i])] = NULL;
@@ -4382,7 +4427,7 @@ fail:
 	necp_kernel_ip_output_policies_condition_mask = 0;
 	necp_kernel_ip_output_policies_count = 0;
 	necp_kernel_ip_output_policies_non_id_count = 0;
-	for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_ID_BUCKETS; i++) {
+	for (i = 0; i < NECP_KERNEL_IP_OUTPUT_POLICIES_MAP_NUM_BUCKETS; i++) {
 		if (necp_kernel_ip_output_policies_map[i] != NULL) {
 			FREE(necp_kernel_ip_output_policies_map[i], M_NECP);
 			necp_kernel_ip_output_policies_map[i] = NULL;
@@ -5456,7 +5501,7 @@ necp_socket_find_policy_match(struct inpcb *inp, struct sockaddr *override_local
 	}
 
 	// Match socket to policy
-	matched_policy = necp_socket_find_policy_match_with_info_locked(necp_kernel_socket_policies_map[NECP_SOCKET_MAP_APP_ID_TO_BUCKET(info.application_id)], &info, &filter_control_unit, &route_rule_id, &service_action, &service, netagent_ids, NECP_MAX_NETAGENTS);
+	matched_policy = necp_socket_find_policy_match_with_info_locked(necp_kernel_socket_policies_map[NECP_SOCKET_MAP_BUCKET(info.application_id, info.bound_interface_index)], &info, &filter_control_unit, &route_rule_id, &service_action, &service, netagent_ids, NECP_MAX_NETAGENTS);
 	// If the socket matched a scoped service policy, mark as Drop if not registered.
 	// This covers the cases in which a service is required (on demand) but hasn't started yet.
 	if ((service_action == NECP_KERNEL_POLICY_RESULT_TRIGGER_SCOPED ||
@@ -5700,7 +5745,7 @@ necp_ip_output_find_policy_match_locked(necp_kernel_policy_id socket_policy_id,
 	u_int32_t skip_session_order = 0;
 	int i;
 	struct necp_kernel_ip_output_policy *matched_policy = NULL;
-	struct necp_kernel_ip_output_policy **policy_search_array = necp_kernel_ip_output_policies_map[NECP_IP_OUTPUT_MAP_ID_TO_BUCKET(socket_policy_id)];
+	struct necp_kernel_ip_output_policy **policy_search_array = necp_kernel_ip_output_policies_map[NECP_IP_OUTPUT_MAP_BUCKET(socket_policy_id, bound_interface_index)];
 	if (policy_search_array != NULL) {
 		for (i = 0; policy_search_array[i] != NULL; i++) {
 			if (necp_drop_all_order != 0 && policy_search_array[i]->session_order >= necp_drop_all_order) {
@@ -6658,7 +6703,7 @@ necp_socket_is_allowed_to_send_recv_internal(struct inpcb *inp, struct sockaddr
 		goto done;
 	}
 
-	struct necp_kernel_socket_policy *matched_policy = necp_socket_find_policy_match_with_info_locked(necp_kernel_socket_policies_map[NECP_SOCKET_MAP_APP_ID_TO_BUCKET(info.application_id)], &info, NULL, &route_rule_id, &service_action, &service, netagent_ids, NECP_MAX_NETAGENTS);
+	struct necp_kernel_socket_policy *matched_policy = necp_socket_find_policy_match_with_info_locked(necp_kernel_socket_policies_map[NECP_SOCKET_MAP_BUCKET(info.application_id, info.bound_interface_index)], &info, NULL, &route_rule_id, &service_action, &service, netagent_ids, NECP_MAX_NETAGENTS);
 	if (matched_policy != NULL) {
 		if (matched_policy->result == NECP_KERNEL_POLICY_RESULT_DROP ||
 			matched_policy->result == NECP_KERNEL_POLICY_RESULT_SOCKET_DIVERT ||
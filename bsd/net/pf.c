@@ -81,9 +81,14 @@
 
 #include <libkern/crypto/md5.h>
 #include <libkern/libkern.h>
+#include <libkern/OSAtomic.h>
 
 #include <mach/thread_act.h>
 
+#include <kern/cpu_number.h>
+#include <kern/cpu_data.h>
+#include <machine/machine_routines.h>
+
 #include <net/if.h>
 #include <net/if_types.h>
 #include <net/bpf.h>
@@ -156,8 +161,33 @@ lck_mtx_t *pf_lock = &pf_lock_data;
 lck_rw_t *pf_perim_lock = &pf_perim_lock_data;
 
 /* state tables */
-struct pf_state_tree_lan_ext	 pf_statetbl_lan_ext;
-struct pf_state_tree_ext_gwy	 pf_statetbl_ext_gwy;
+struct pf_state_hash	 pf_statetbl_lan_ext;
+struct pf_state_hash	 pf_statetbl_ext_gwy;
+
+/*
+ * Bounds on the number of buckets per state table, and the load factors
+ * at which the purge thread grows or shrinks them
+ */
+#define	PF_STATETBL_MINBUCKETS	1024
+#define	PF_STATETBL_MAXBUCKETS	(1 << 22)
+#define	PF_STATETBL_GROW(n)	((n) > 2)	/* n is keys per bucket */
+#define	PF_STATETBL_SHRINK(n)	((n) > 8)	/* n is buckets per key */
+
+static u_int32_t	 pf_statetbl_seed;
+
+/* lock-free snapshot of the main filter ruleset, see pfvar.h */
+struct pf_rulesnap	*pf_rulesnap;
+static int		 pf_rulesnap_dirty = 1;
+static volatile u_int32_t pf_rulesnap_gen;	/* reader generation */
+static caddr_t		 pf_rulesnap_rd_pcpu;	/* per-CPU reader counts */
+static void		*pf_rulesnap_rd_buf;
+
+/* candidate rule classifier for the main filter ruleset, see pfvar.h */
+#define	PF_RULECLS_MINRULES	64		/* below this, just walk */
+#define	PF_RULECLS_MAXSIZE	(32 * 1024 * 1024)	/* bytes */
+
+struct pf_rulecls	*pf_rulecls;
+static int		 pf_rulecls_dirty = 1;
 
 struct pf_palist	 pf_pabuf;
 struct pf_status	 pf_status;
@@ -259,6 +289,12 @@ static int		 pf_test_rule(struct pf_rule **, struct pf_state **,
 			    int, struct pfi_kif *, struct mbuf *, int,
 			    void *, struct pf_pdesc *, struct pf_rule **,
 			    struct pf_ruleset **, struct ifqueue *);
+static void		 pf_rulecls_lookup(struct pf_rulecls *,
+			    struct pfi_kif *, int, sa_family_t, u_int8_t,
+			    struct pf_addr *, struct pf_addr *, u_int16_t,
+			    u_int16_t, struct pf_rulecls_match *);
+static u_int32_t	 pf_rulecls_next(struct pf_rulecls *,
+			    struct pf_rulecls_match *, u_int32_t);
 #if DUMMYNET
 static int		 pf_test_dummynet(struct pf_rule **, int, 
 			    struct pfi_kif *, struct mbuf **, 
@@ -317,6 +353,15 @@ static int		 pf_src_connlimit(struct pf_state **);
 static void		 pf_stateins_err(const char *, struct pf_state *,
 			    struct pfi_kif *);
 static int		 pf_check_congestion(struct ifqueue *);
+static u_int32_t	 pf_state_key_hash(struct pf_state_key *, int);
+static struct pf_state_key *pf_statetbl_find(struct pf_state_hash *,
+			    struct pf_state_key *);
+static struct pf_state_key *pf_statetbl_insert(struct pf_state_hash *,
+			    struct pf_state_key *);
+static void		 pf_statetbl_remove(struct pf_state_hash *,
+			    struct pf_state_key *);
+static int		 pf_statetbl_resize(struct pf_state_hash *, u_int32_t);
+static void		 pf_statetbl_adjust(struct pf_state_hash *);
 
 #if 0
 static const char *pf_pptp_ctrl_type_name(u_int16_t code);
@@ -484,10 +529,6 @@ struct pf_state_tree_id tree_id;
 struct pf_state_queue state_list;
 
 RB_GENERATE(pf_src_tree, pf_src_node, entry, pf_src_compare);
-RB_GENERATE(pf_state_tree_lan_ext, pf_state_key,
-    entry_lan_ext, pf_state_compare_lan_ext);
-RB_GENERATE(pf_state_tree_ext_gwy, pf_state_key,
-    entry_ext_gwy, pf_state_compare_ext_gwy);
 RB_GENERATE(pf_state_tree_id, pf_state,
     entry_id, pf_state_compare_id);
 
@@ -1053,6 +1094,223 @@ pf_state_compare_id(struct pf_state *a, struct pf_state *b)
 	return (0);
 }
 
+/* fields hashed for a state table lookup; see pf_state_key_hash() */
+struct pf_statetbl_hkey {
+	u_int32_t	addr1[4];
+	u_int32_t	addr2[4];
+	u_int32_t	xport1;
+	u_int32_t	xport2;
+	u_int8_t	af;
+	u_int8_t	proto;
+	u_int8_t	proto_variant;
+	u_int8_t	pad;
+};
+
+/*
+ * Hash the fields of a state key that pf_state_compare_lan_ext() (or
+ * pf_state_compare_ext_gwy() for PF_SH_EXT_GWY) compares unconditionally.
+ * Anything that may act as a wildcard -- the external port or address
+ * under address- or endpoint-independent UDP filtering, the GRE call ID,
+ * the application state -- is left out, so that keys which compare equal
+ * always hash equal.
+ */
+static u_int32_t
+pf_state_key_hash(struct pf_state_key *sk, int which)
+{
+	struct pf_statetbl_hkey hk __attribute__((aligned(8)));
+	struct pf_state_host *h1, *h2;
+	sa_family_t af;
+	int extfilter = PF_EXTFILTER_APD;
+
+	if (which == PF_SH_LAN_EXT) {
+		h1 = &sk->lan;
+		h2 = &sk->ext_lan;
+		af = sk->af_lan;
+	} else {
+		h1 = &sk->gwy;
+		h2 = &sk->ext_gwy;
+		af = sk->af_gwy;
+	}
+
+	bzero(&hk, sizeof (hk));
+	hk.af = af;
+	hk.proto = sk->proto;
+
+	switch (sk->proto) {
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		hk.xport1 = h1->xport.port;
+		break;
+
+	case IPPROTO_TCP:
+		hk.xport1 = h1->xport.port;
+		hk.xport2 = h2->xport.port;
+		break;
+
+	case IPPROTO_UDP:
+		hk.proto_variant = sk->proto_variant;
+		extfilter = sk->proto_variant;
+		hk.xport1 = h1->xport.port;
+		if (extfilter < PF_EXTFILTER_AD)
+			hk.xport2 = h2->xport.port;
+		break;
+
+	case IPPROTO_ESP:
+		/* the SPI is on the external side for lan_ext only */
+		hk.xport1 = (which == PF_SH_LAN_EXT) ?
+		    h2->xport.spi : h1->xport.spi;
+		break;
+
+	default:
+		break;
+	}
+
+	switch (af) {
+#if INET
+	case AF_INET:
+		hk.addr1[0] = h1->addr.addr32[0];
+		if (extfilter < PF_EXTFILTER_EI)
+			hk.addr2[0] = h2->addr.addr32[0];
+		break;
+#endif /* INET */
+#if INET6
+	case AF_INET6:
+		bcopy(&h1->addr, hk.addr1, sizeof (hk.addr1));
+		if (extfilter < PF_EXTFILTER_EI)
+			bcopy(&h2->addr, hk.addr2, sizeof (hk.addr2));
+		break;
+#endif /* INET6 */
+	}
+
+	return (net_flowhash(&hk, sizeof (hk), pf_statetbl_seed));
+}
+
+static __inline int
+pf_statetbl_compare(int which, struct pf_state_key *a, struct pf_state_key *b)
+{
+	return ((which == PF_SH_LAN_EXT) ? pf_state_compare_lan_ext(a, b) :
+	    pf_state_compare_ext_gwy(a, b));
+}
+
+#define	PF_STATETBL_BUCKET(tbl, h)	\
+	(&(tbl)->psh_buckets[(h) & ((tbl)->psh_nbuckets - 1)])
+
+static struct pf_state_key *
+pf_statetbl_find(struct pf_state_hash *tbl, struct pf_state_key *key)
+{
+	int which = tbl->psh_which;
+	struct pf_state_key *sk;
+	u_int32_t h;
+
+	h = pf_state_key_hash(key, which);
+	LIST_FOREACH(sk, PF_STATETBL_BUCKET(tbl, h), entry_hash[which]) {
+		if (sk->hash[which] == h &&
+		    pf_statetbl_compare(which, key, sk) == 0)
+			return (sk);
+	}
+	return (NULL);
+}
+
+/*
+ * Like RB_INSERT: returns the key already in the table that compares
+ * equal to sk, or NULL after inserting sk.
+ */
+static struct pf_state_key *
+pf_statetbl_insert(struct pf_state_hash *tbl, struct pf_state_key *sk)
+{
+	int which = tbl->psh_which;
+	struct pf_state_key *cur;
+	u_int32_t h;
+
+	h = pf_state_key_hash(sk, which);
+	LIST_FOREACH(cur, PF_STATETBL_BUCKET(tbl, h), entry_hash[which]) {
+		if (cur->hash[which] == h &&
+		    pf_statetbl_compare(which, sk, cur) == 0)
+			return (cur);
+	}
+	sk->hash[which] = h;
+	LIST_INSERT_HEAD(PF_STATETBL_BUCKET(tbl, h), sk, entry_hash[which]);
+	tbl->psh_count++;
+
+	return (NULL);
+}
+
+static void
+pf_statetbl_remove(struct pf_state_hash *tbl, struct pf_state_key *sk)
+{
+	VERIFY(tbl->psh_count > 0);
+	LIST_REMOVE(sk, entry_hash[tbl->psh_which]);
+	tbl->psh_count--;
+}
+
+/*
+ * Rehash a state table into nbuckets buckets.  Keys carry their hash
+ * values, so this is a walk of the chains without any recomputation.
+ */
+static int
+pf_statetbl_resize(struct pf_state_hash *tbl, u_int32_t nbuckets)
+{
+	int which = tbl->psh_which;
+	struct pf_state_keyhead *nb, *ob = tbl->psh_buckets;
+	struct pf_state_key *sk;
+	u_int32_t i, onbuckets = tbl->psh_nbuckets;
+
+	VERIFY(powerof2(nbuckets));
+
+	nb = _MALLOC(nbuckets * sizeof (*nb), M_TEMP, M_NOWAIT | M_ZERO);
+	if (nb == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < onbuckets; i++) {
+		while ((sk = LIST_FIRST(&ob[i])) != NULL) {
+			LIST_REMOVE(sk, entry_hash[which]);
+			LIST_INSERT_HEAD(&nb[sk->hash[which] & (nbuckets - 1)],
+			    sk, entry_hash[which]);
+		}
+	}
+	tbl->psh_buckets = nb;
+	tbl->psh_nbuckets = nbuckets;
+	if (ob != NULL)
+		_FREE(ob, M_TEMP);
+
+	return (0);
+}
+
+void
+pf_statetbl_init(void)
+{
+	pf_statetbl_seed = RandomULong();
+
+	pf_statetbl_lan_ext.psh_which = PF_SH_LAN_EXT;
+	pf_statetbl_ext_gwy.psh_which = PF_SH_EXT_GWY;
+	if (pf_statetbl_resize(&pf_statetbl_lan_ext,
+	    PF_STATETBL_MINBUCKETS) != 0 ||
+	    pf_statetbl_resize(&pf_statetbl_ext_gwy,
+	    PF_STATETBL_MINBUCKETS) != 0)
+		panic("%s: unable to allocate state tables", __func__);
+}
+
+/*
+ * Called periodically by the purge thread, with pf_lock held, to keep
+ * the state tables' load factor within bounds.  Resizing here rather
+ * than on insertion keeps the rehash off the packet path.
+ */
+static void
+pf_statetbl_adjust(struct pf_state_hash *tbl)
+{
+	u_int32_t n = tbl->psh_nbuckets;
+
+	while (PF_STATETBL_GROW(tbl->psh_count / n) &&
+	    n < PF_STATETBL_MAXBUCKETS)
+		n <<= 1;
+	while (n > PF_STATETBL_MINBUCKETS &&
+	    PF_STATETBL_SHRINK(n / MAX(tbl->psh_count, 1)))
+		n >>= 1;
+
+	if (n != tbl->psh_nbuckets)
+		(void) pf_statetbl_resize(tbl, n);
+}
+
 #if INET6
 void
 pf_addrcpy(struct pf_addr *dst, struct pf_addr *src, sa_family_t af)
@@ -1092,20 +1350,19 @@ pf_find_state(struct pfi_kif *kif, struct pf_state_key_cmp *key, u_int dir)
 
 	switch (dir) {
 	case PF_OUT:
-		sk = RB_FIND(pf_state_tree_lan_ext, &pf_statetbl_lan_ext,
+		sk = pf_statetbl_find(&pf_statetbl_lan_ext,
 		    (struct pf_state_key *)key);
 		break;
 	case PF_IN:
-		sk = RB_FIND(pf_state_tree_ext_gwy, &pf_statetbl_ext_gwy,
+		sk = pf_statetbl_find(&pf_statetbl_ext_gwy,
 		    (struct pf_state_key *)key);
 		/*
 		 * NAT64 is done only on input, for packets coming in from
 		 * from the LAN side, need to lookup the lan_ext tree.
 		 */
 		if (sk == NULL) {
-			sk = RB_FIND(pf_state_tree_lan_ext,
-				     &pf_statetbl_lan_ext,
-				     (struct pf_state_key *)key);
+			sk = pf_statetbl_find(&pf_statetbl_lan_ext,
+			    (struct pf_state_key *)key);
 			if (sk && sk->af_lan == sk->af_gwy)
 				sk = NULL;
 		}
@@ -1133,20 +1390,19 @@ pf_find_state_all(struct pf_state_key_cmp *key, u_int dir, int *more)
 
 	switch (dir) {
 	case PF_OUT:
-		sk = RB_FIND(pf_state_tree_lan_ext,
-		    &pf_statetbl_lan_ext, (struct pf_state_key *)key);
+		sk = pf_statetbl_find(&pf_statetbl_lan_ext,
+		    (struct pf_state_key *)key);
 		break;
 	case PF_IN:
-		sk = RB_FIND(pf_state_tree_ext_gwy,
-		    &pf_statetbl_ext_gwy, (struct pf_state_key *)key);
+		sk = pf_statetbl_find(&pf_statetbl_ext_gwy,
+		    (struct pf_state_key *)key);
 		/*
 		 * NAT64 is done only on input, for packets coming in from
 		 * from the LAN side, need to lookup the lan_ext tree.
 		 */
 		if ((sk == NULL) && pf_nat64_configured) {
-			sk = RB_FIND(pf_state_tree_lan_ext,
-					&pf_statetbl_lan_ext,
-					(struct pf_state_key *)key);
+			sk = pf_statetbl_find(&pf_statetbl_lan_ext,
+			    (struct pf_state_key *)key);
 			if (sk && sk->af_lan == sk->af_gwy)
 				sk = NULL;
 		}
@@ -1412,7 +1668,7 @@ pf_insert_state(struct pfi_kif *kif, struct pf_state *s)
 	VERIFY(s->state_key != NULL);
 	s->kif = kif;
 
-	if ((cur = RB_INSERT(pf_state_tree_lan_ext, &pf_statetbl_lan_ext,
+	if ((cur = pf_statetbl_insert(&pf_statetbl_lan_ext,
 	    s->state_key)) != NULL) {
 		/* key exists. check for same kif, if none, add to key */
 		TAILQ_FOREACH(sp, &cur->states, next)
@@ -1427,8 +1683,8 @@ pf_insert_state(struct pfi_kif *kif, struct pf_state *s)
 	}
 
 	/* if cur != NULL, we already found a state key and attached to it */
-	if (cur == NULL && (cur = RB_INSERT(pf_state_tree_ext_gwy,
-	    &pf_statetbl_ext_gwy, s->state_key)) != NULL) {
+	if (cur == NULL && (cur = pf_statetbl_insert(&pf_statetbl_ext_gwy,
+	    s->state_key)) != NULL) {
 		/* must not happen. we must have found the sk above! */
 		pf_stateins_err("tree_ext_gwy", s, kif);
 		pf_detach_state(s, PF_DT_SKIP_EXTGWY);
@@ -1510,6 +1766,10 @@ pf_purge_thread_cont(int err)
 	pf_purge_expired_states(1 + (pf_status.states
 	    / pf_default_rule.timeout[PFTM_INTERVAL]));
 
+	/* keep the state table load factor in check */
+	pf_statetbl_adjust(&pf_statetbl_lan_ext);
+	pf_statetbl_adjust(&pf_statetbl_ext_gwy);
+
 	/* purge other expired types every PFTM_INTERVAL seconds */
 	if (++nloops >= pf_default_rule.timeout[PFTM_INTERVAL]) {
 		pf_purge_expired_fragments();
@@ -4134,11 +4394,9 @@ pf_detach_state(struct pf_state *s, int flags)
 	TAILQ_REMOVE(&sk->states, s, next);
 	if (--sk->refcnt == 0) {
 		if (!(flags & PF_DT_SKIP_EXTGWY))
-			RB_REMOVE(pf_state_tree_ext_gwy,
-			    &pf_statetbl_ext_gwy, sk);
+			pf_statetbl_remove(&pf_statetbl_ext_gwy, sk);
 		if (!(flags & PF_DT_SKIP_LANEXT))
-			RB_REMOVE(pf_state_tree_lan_ext,
-			    &pf_statetbl_lan_ext, sk);
+			pf_statetbl_remove(&pf_statetbl_lan_ext, sk);
 		if (sk->app_state)
 			pool_put(&pf_app_state_pl, sk->app_state);
 		pool_put(&pf_state_key_pl, sk);
@@ -4610,6 +4868,9 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 	struct pf_grev1_hdr	*grev1 = pd->hdr.grev1;
 	union pf_state_xport bxport, bdxport, nxport, sxport, dxport;
 	struct pf_state_key	 psk;
+	struct pf_rulecls	*pcl = NULL;
+	struct pf_rulecls_match	 pcm;
+	u_int32_t		 ci;
 
 	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
 
@@ -4911,7 +5172,27 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 	if (nr && nr->tag > 0)
 		tag = nr->tag;
 
+	/*
+	 * Rules of the main ruleset that the classifier leaves out can't
+	 * match this packet, so only its candidates are evaluated.
+	 */
+	if (r != NULL && (pcl = pf_rulecls) != NULL) {
+		if (pd->proto == IPPROTO_TCP || pd->proto == IPPROTO_UDP)
+			pf_rulecls_lookup(pcl, kif, direction, pd->af,
+			    pd->proto, saddr, daddr, th->th_sport,
+			    th->th_dport, &pcm);
+		else
+			pf_rulecls_lookup(pcl, kif, direction, pd->af,
+			    pd->proto, saddr, daddr, 0, 0, &pcm);
+	}
+
 	while (r != NULL) {
+		if (pcl != NULL && asd == 0 &&
+		    (ci = pf_rulecls_next(pcl, &pcm, r->nr)) != r->nr) {
+			if (ci >= pcl->pcl_nrules)
+				break;
+			r = pcl->pcl_rules[ci];
+		}
 		r->evaluations++;
 		if (pfi_kif_match(r->kif, kif) == r->ifnot)
 			r = r->skip[PF_SKIP_IFP].ptr;
@@ -8315,13 +8596,12 @@ pf_test_state_esp(struct pf_state **state, int direction, struct pfi_kif *kif,
 			if (s) {
 				struct pf_state_key *sk = s->state_key;
 
-				RB_REMOVE(pf_state_tree_ext_gwy,
-				    &pf_statetbl_ext_gwy, sk);
+				pf_statetbl_remove(&pf_statetbl_ext_gwy, sk);
 				sk->lan.xport.spi = sk->gwy.xport.spi =
 				    esp->spi;
 
-				if (RB_INSERT(pf_state_tree_ext_gwy,
-				    &pf_statetbl_ext_gwy, sk))
+				if (pf_statetbl_insert(&pf_statetbl_ext_gwy,
+				    sk))
 					pf_detach_state(s, PF_DT_SKIP_EXTGWY);
 				else
 					*state = s;
@@ -8333,12 +8613,11 @@ pf_test_state_esp(struct pf_state **state, int direction, struct pfi_kif *kif,
 			if (s) {
 				struct pf_state_key *sk = s->state_key;
 
-				RB_REMOVE(pf_state_tree_lan_ext,
-				    &pf_statetbl_lan_ext, sk);
+				pf_statetbl_remove(&pf_statetbl_lan_ext, sk);
 				sk->ext_lan.xport.spi = esp->spi;
 
-				if (RB_INSERT(pf_state_tree_lan_ext,
-				    &pf_statetbl_lan_ext, sk))
+				if (pf_statetbl_insert(&pf_statetbl_lan_ext,
+				    sk))
 					pf_detach_state(s, PF_DT_SKIP_LANEXT);
 				else
 					*state = s;
@@ -9048,6 +9327,1186 @@ pf_check_proto_cksum(struct mbuf *m, int off, int len, u_int8_t p,
 	return (0);
 }
 
+/*
+ * Candidate rule classifier.  Built from the active main filter ruleset
+ * with pf_perim_lock held exclusive; pf_test_rule() uses it with the lock
+ * held shared, and pf_rulesnap_test() through the snapshot's prs_cls.
+ */
+struct pf_rulecls_range {
+	struct pf_rulecls_key	 lo;
+	struct pf_rulecls_key	 hi;
+};
+
+extern void qsort(void *, size_t, size_t,
+    int (*)(const void *, const void *));
+
+#define	PF_RULECLS_ROW(pcl, bits, row)					\
+	((bits) + (size_t)(row) * (pcl)->pcl_nwords)
+#define	PF_RULECLS_SET(row, i)						\
+	((row)[(i) / 64] |= (1ULL << ((i) % 64)))
+
+static int
+pf_rulecls_key_cmp(const void *a, const void *b)
+{
+	const struct pf_rulecls_key *ka = a, *kb = b;
+
+	if (ka->pck_hi != kb->pck_hi)
+		return ((ka->pck_hi < kb->pck_hi) ? -1 : 1);
+	if (ka->pck_lo != kb->pck_lo)
+		return ((ka->pck_lo < kb->pck_lo) ? -1 : 1);
+	return (0);
+}
+
+static int
+pf_rulecls_ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t pa = (uintptr_t)*(void * const *)a;
+	uintptr_t pb = (uintptr_t)*(void * const *)b;
+
+	return ((pa < pb) ? -1 : (pa > pb));
+}
+
+static void
+pf_rulecls_key_inc(struct pf_rulecls_key *k)
+{
+	if (++k->pck_lo == 0)
+		k->pck_hi++;
+}
+
+static void
+pf_rulecls_key_dec(struct pf_rulecls_key *k)
+{
+	if (k->pck_lo-- == 0)
+		k->pck_hi--;
+}
+
+/*
+ * Addresses are ordered as numbers in network byte order, so that the
+ * addresses under a prefix mask form a single range.
+ */
+static void
+pf_rulecls_addr_key(struct pf_addr *a, sa_family_t af,
+    struct pf_rulecls_key *k)
+{
+	if (af == AF_INET) {
+		k->pck_hi = 0;
+		k->pck_lo = ntohl(a->addr32[0]);
+	} else {
+		k->pck_hi = ((u_int64_t)ntohl(a->addr32[0]) << 32) |
+		    ntohl(a->addr32[1]);
+		k->pck_lo = ((u_int64_t)ntohl(a->addr32[2]) << 32) |
+		    ntohl(a->addr32[3]);
+	}
+}
+
+static void
+pf_rulecls_max_key(int d, sa_family_t af, struct pf_rulecls_key *k)
+{
+	k->pck_hi = 0;
+	if (d == PF_RULECLS_SRC_PORT || d == PF_RULECLS_DST_PORT)
+		k->pck_lo = 0xffff;
+	else if (af == AF_INET)
+		k->pck_lo = 0xffffffff;
+	else
+		k->pck_hi = k->pck_lo = ~0ULL;
+}
+
+static int
+pf_rulecls_port_range(struct pf_rulecls_range *rg, int n, int lo, int hi)
+{
+	if (lo < 0)
+		lo = 0;
+	if (hi > 0xffff)
+		hi = 0xffff;
+	if (lo <= hi) {
+		rg[n].lo.pck_hi = rg[n].hi.pck_hi = 0;
+		rg[n].lo.pck_lo = lo;
+		rg[n].hi.pck_lo = hi;
+		n++;
+	}
+	return (n);
+}
+
+/* the ports pf_match_port() accepts, as host order ranges */
+static int
+pf_rulecls_port_ranges(u_int8_t op, u_int16_t p1, u_int16_t p2,
+    struct pf_rulecls_range *rg)
+{
+	int a1 = ntohs(p1), a2 = ntohs(p2), n = 0;
+
+	switch (op) {
+	case PF_OP_IRG:
+		return (pf_rulecls_port_range(rg, n, a1 + 1, a2 - 1));
+	case PF_OP_XRG:
+		n = pf_rulecls_port_range(rg, n, 0, a1 - 1);
+		return (pf_rulecls_port_range(rg, n, a2 + 1, 0xffff));
+	case PF_OP_RRG:
+		return (pf_rulecls_port_range(rg, n, a1, a2));
+	case PF_OP_EQ:
+		return (pf_rulecls_port_range(rg, n, a1, a1));
+	case PF_OP_NE:
+		n = pf_rulecls_port_range(rg, n, 0, a1 - 1);
+		return (pf_rulecls_port_range(rg, n, a1 + 1, 0xffff));
+	case PF_OP_LT:
+		return (pf_rulecls_port_range(rg, n, 0, a1 - 1));
+	case PF_OP_LE:
+		return (pf_rulecls_port_range(rg, n, 0, a1));
+	case PF_OP_GT:
+		return (pf_rulecls_port_range(rg, n, a1 + 1, 0xffff));
+	case PF_OP_GE:
+		return (pf_rulecls_port_range(rg, n, a1, 0xffff));
+	}
+	return (-1);
+}
+
+/*
+ * The addresses PF_MISMATCHAW() lets through.  Only prefix masks are
+ * expressed; pf_match_addr_range() compares addresses in host byte order,
+ * so address ranges (and everything else) match the whole dimension.
+ */
+static int
+pf_rulecls_addr_ranges(struct pf_rule_addr *ra, sa_family_t af,
+    struct pf_rulecls_range *rg)
+{
+	struct pf_rulecls_key a, m, lo, hi, max;
+	int n = 0;
+
+	if (ra->addr.type != PF_ADDR_ADDRMASK)
+		return (-1);
+	if (PF_AZERO(&ra->addr.v.a.mask, af))
+		return (ra->neg ? 0 : -1);
+
+	pf_rulecls_addr_key(&ra->addr.v.a.addr, af, &a);
+	pf_rulecls_addr_key(&ra->addr.v.a.mask, af, &m);
+	pf_rulecls_max_key(PF_RULECLS_SRC_ADDR, af, &max);
+	/* host part of the mask, which must be all the low bits */
+	m.pck_hi = ~m.pck_hi & max.pck_hi;
+	m.pck_lo = ~m.pck_lo & max.pck_lo;
+	if (m.pck_hi == 0 ? (m.pck_lo & (m.pck_lo + 1)) != 0 :
+	    (m.pck_lo != ~0ULL || (m.pck_hi & (m.pck_hi + 1)) != 0))
+		return (-1);
+	lo.pck_hi = a.pck_hi & ~m.pck_hi;
+	lo.pck_lo = a.pck_lo & ~m.pck_lo;
+	hi.pck_hi = lo.pck_hi | m.pck_hi;
+	hi.pck_lo = lo.pck_lo | m.pck_lo;
+
+	if (!ra->neg) {
+		rg[n].lo = lo;
+		rg[n].hi = hi;
+		return (++n);
+	}
+	if (lo.pck_hi != 0 || lo.pck_lo != 0) {
+		rg[n].lo.pck_hi = rg[n].lo.pck_lo = 0;
+		rg[n].hi = lo;
+		pf_rulecls_key_dec(&rg[n++].hi);
+	}
+	if (pf_rulecls_key_cmp(&hi, &max) != 0) {
+		rg[n].lo = hi;
+		pf_rulecls_key_inc(&rg[n].lo);
+		rg[n++].hi = max;
+	}
+	return (n);
+}
+
+/*
+ * The values in dimension d, for packets of family af, at which rule r
+ * can match: at most two ranges in rg, their number returned, or -1 if
+ * r can match at any value.
+ */
+static int
+pf_rulecls_ranges(struct pf_rule *r, int d, sa_family_t af,
+    struct pf_rulecls_range *rg)
+{
+	struct pf_rule_addr *ra;
+
+	if (r->af != 0 && r->af != af)
+		return (0);
+
+	switch (d) {
+	case PF_RULECLS_SRC_ADDR:
+	case PF_RULECLS_DST_ADDR:
+		ra = (d == PF_RULECLS_SRC_ADDR) ? &r->src : &r->dst;
+		return (pf_rulecls_addr_ranges(ra, af, rg));
+	default:
+		/* pf_test_rule() looks at ports of TCP and UDP rules only */
+		if (r->proto != IPPROTO_TCP && r->proto != IPPROTO_UDP)
+			return (-1);
+		ra = (d == PF_RULECLS_SRC_PORT) ? &r->src : &r->dst;
+		return (pf_rulecls_port_ranges(ra->xport.range.op,
+		    ra->xport.range.port[0], ra->xport.range.port[1], rg));
+	}
+}
+
+/* index of the range containing k */
+static u_int32_t
+pf_rulecls_find(struct pf_rulecls_dim *pcd, struct pf_rulecls_key *k)
+{
+	u_int32_t lo = 0, hi = pcd->pcd_nranges, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (pf_rulecls_key_cmp(&pcd->pcd_lo[mid], k) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+static u_int64_t *
+pf_rulecls_alloc_rows(struct pf_rulecls *pcl, u_int32_t nrows)
+{
+	size_t size = (size_t)nrows * pcl->pcl_nwords * sizeof (u_int64_t);
+
+	if ((pcl->pcl_size += size) > PF_RULECLS_MAXSIZE)
+		return (NULL);
+	return (_MALLOC(size, M_TEMP, M_WAITOK | M_ZERO));
+}
+
+static int
+pf_rulecls_build_dim(struct pf_rulecls *pcl, int d, sa_family_t af)
+{
+	struct pf_rulecls_dim *pcd = &pcl->pcl_dim[af == AF_INET6][d];
+	struct pf_rulecls_range rg[2];
+	struct pf_rulecls_key max, *b;
+	u_int64_t *any, *row;
+	u_int32_t n = pcl->pcl_nrules, nb, i, j, w;
+	int c, k;
+
+	pf_rulecls_max_key(d, af, &max);
+	pcl->pcl_size += (4 * n + 1) * sizeof (*b);
+	b = _MALLOC((4 * n + 1) * sizeof (*b), M_TEMP, M_WAITOK | M_ZERO);
+	if (b == NULL)
+		return (ENOMEM);
+	pcd->pcd_lo = b;
+
+	/* every range start and every value just past a range's end */
+	nb = 1;
+	for (i = 0; i < n; i++) {
+		c = pf_rulecls_ranges(pcl->pcl_rules[i], d, af, rg);
+		for (k = 0; k < c; k++) {
+			b[nb++] = rg[k].lo;
+			if (pf_rulecls_key_cmp(&rg[k].hi, &max) != 0) {
+				b[nb] = rg[k].hi;
+				pf_rulecls_key_inc(&b[nb++]);
+			}
+		}
+	}
+	qsort(b, nb, sizeof (*b), pf_rulecls_key_cmp);
+	for (i = j = 1; i < nb; i++) {
+		if (pf_rulecls_key_cmp(&b[i], &b[j - 1]) != 0)
+			b[j++] = b[i];
+	}
+	pcd->pcd_nranges = j;
+
+	if ((pcd->pcd_bits = pf_rulecls_alloc_rows(pcl, j + 1)) == NULL)
+		return (ENOMEM);
+	/* scratch row past the end for the rules matching anywhere */
+	any = PF_RULECLS_ROW(pcl, pcd->pcd_bits, j);
+	for (i = 0; i < n; i++) {
+		c = pf_rulecls_ranges(pcl->pcl_rules[i], d, af, rg);
+		if (c < 0) {
+			PF_RULECLS_SET(any, i);
+			continue;
+		}
+		for (k = 0; k < c; k++) {
+			u_int32_t first = pf_rulecls_find(pcd, &rg[k].lo);
+			u_int32_t last = pf_rulecls_find(pcd, &rg[k].hi);
+
+			for (j = first; j <= last; j++) {
+				row = PF_RULECLS_ROW(pcl, pcd->pcd_bits, j);
+				PF_RULECLS_SET(row, i);
+			}
+		}
+	}
+	for (j = 0; j < pcd->pcd_nranges; j++) {
+		row = PF_RULECLS_ROW(pcl, pcd->pcd_bits, j);
+		for (w = 0; w < pcl->pcl_nwords; w++)
+			row[w] |= any[w];
+	}
+	return (0);
+}
+
+static int
+pf_rulecls_build(struct pf_rulecls *pcl)
+{
+	struct pf_rule *r;
+	u_int64_t *row;
+	u_int32_t n = pcl->pcl_nrules, nprotos = 1, i, j;
+	int d, error;
+
+	if ((pcl->pcl_dir = pf_rulecls_alloc_rows(pcl, 2)) == NULL)
+		return (ENOMEM);
+	for (i = 0; i < n; i++) {
+		r = pcl->pcl_rules[i];
+		if (r->direction != PF_OUT)
+			PF_RULECLS_SET(PF_RULECLS_ROW(pcl, pcl->pcl_dir, 0), i);
+		if (r->direction != PF_IN)
+			PF_RULECLS_SET(PF_RULECLS_ROW(pcl, pcl->pcl_dir, 1), i);
+		if (r->proto != 0 && pcl->pcl_proto_row[r->proto] == 0)
+			pcl->pcl_proto_row[r->proto] = nprotos++;
+	}
+
+	if ((pcl->pcl_proto = pf_rulecls_alloc_rows(pcl, nprotos)) == NULL)
+		return (ENOMEM);
+	for (i = 0; i < n; i++) {
+		r = pcl->pcl_rules[i];
+		for (j = 0; j < nprotos; j++) {
+			if (r->proto != 0 && pcl->pcl_proto_row[r->proto] != j)
+				continue;
+			PF_RULECLS_SET(PF_RULECLS_ROW(pcl, pcl->pcl_proto, j),
+			    i);
+		}
+	}
+
+	pcl->pcl_kifs = _MALLOC(n * sizeof (struct pfi_kif *), M_TEMP,
+	    M_WAITOK);
+	if (pcl->pcl_kifs == NULL)
+		return (ENOMEM);
+	for (i = j = 0; i < n; i++) {
+		if (pcl->pcl_rules[i]->kif != NULL)
+			pcl->pcl_kifs[j++] = pcl->pcl_rules[i]->kif;
+	}
+	qsort(pcl->pcl_kifs, j, sizeof (struct pfi_kif *), pf_rulecls_ptr_cmp);
+	for (i = 0, pcl->pcl_nkifs = 0; i < j; i++) {
+		if (pcl->pcl_nkifs == 0 ||
+		    pcl->pcl_kifs[pcl->pcl_nkifs - 1] != pcl->pcl_kifs[i])
+			pcl->pcl_kifs[pcl->pcl_nkifs++] = pcl->pcl_kifs[i];
+	}
+	/* the last row is for interfaces no rule names */
+	pcl->pcl_kif = pf_rulecls_alloc_rows(pcl, pcl->pcl_nkifs + 1);
+	if (pcl->pcl_kif == NULL)
+		return (ENOMEM);
+	for (i = 0; i < n; i++) {
+		r = pcl->pcl_rules[i];
+		for (j = 0; j <= pcl->pcl_nkifs; j++) {
+			if ((j < pcl->pcl_nkifs ?
+			    pfi_kif_match(r->kif, pcl->pcl_kifs[j]) :
+			    r->kif == NULL) == r->ifnot)
+				continue;
+			row = PF_RULECLS_ROW(pcl, pcl->pcl_kif, j);
+			PF_RULECLS_SET(row, i);
+		}
+	}
+
+	for (d = 0; d < PF_RULECLS_NDIMS; d++) {
+#if INET
+		if ((error = pf_rulecls_build_dim(pcl, d, AF_INET)) != 0)
+			return (error);
+#endif /* INET */
+#if INET6
+		if ((error = pf_rulecls_build_dim(pcl, d, AF_INET6)) != 0)
+			return (error);
+#endif /* INET6 */
+	}
+	return (0);
+}
+
+static void
+pf_rulecls_free(struct pf_rulecls *pcl)
+{
+	struct pf_rulecls_dim *pcd;
+	int a, d;
+
+	for (a = 0; a < 2; a++) {
+		for (d = 0; d < PF_RULECLS_NDIMS; d++) {
+			pcd = &pcl->pcl_dim[a][d];
+			if (pcd->pcd_lo != NULL)
+				_FREE(pcd->pcd_lo, M_TEMP);
+			if (pcd->pcd_bits != NULL)
+				_FREE(pcd->pcd_bits, M_TEMP);
+		}
+	}
+	if (pcl->pcl_kif != NULL)
+		_FREE(pcl->pcl_kif, M_TEMP);
+	if (pcl->pcl_kifs != NULL)
+		_FREE(pcl->pcl_kifs, M_TEMP);
+	if (pcl->pcl_proto != NULL)
+		_FREE(pcl->pcl_proto, M_TEMP);
+	if (pcl->pcl_dir != NULL)
+		_FREE(pcl->pcl_dir, M_TEMP);
+	if (pcl->pcl_rules != NULL)
+		_FREE(pcl->pcl_rules, M_TEMP);
+	_FREE(pcl, M_TEMP);
+}
+
+/*
+ * Select the rows for a packet.  Ports are in network byte order and
+ * are ignored unless proto is TCP or UDP.
+ */
+static void
+pf_rulecls_lookup(struct pf_rulecls *pcl, struct pfi_kif *kif, int dir,
+    sa_family_t af, u_int8_t proto, struct pf_addr *saddr,
+    struct pf_addr *daddr, u_int16_t sport, u_int16_t dport,
+    struct pf_rulecls_match *pcm)
+{
+	struct pf_rulecls_dim *pcd;
+	struct pf_rulecls_key k;
+	u_int32_t lo = 0, hi = pcl->pcl_nkifs, mid;
+	int n = 0;
+
+	if (dir == PF_IN || dir == PF_OUT)
+		pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl, pcl->pcl_dir,
+		    dir == PF_OUT);
+	pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl, pcl->pcl_proto,
+	    pcl->pcl_proto_row[proto]);
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((uintptr_t)pcl->pcl_kifs[mid] < (uintptr_t)kif)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == pcl->pcl_nkifs || pcl->pcl_kifs[lo] != kif)
+		lo = pcl->pcl_nkifs;
+	pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl, pcl->pcl_kif, lo);
+
+	if (af == AF_INET || af == AF_INET6) {
+		pcd = pcl->pcl_dim[af == AF_INET6];
+		pf_rulecls_addr_key(saddr, af, &k);
+		pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+		    pcd[PF_RULECLS_SRC_ADDR].pcd_bits,
+		    pf_rulecls_find(&pcd[PF_RULECLS_SRC_ADDR], &k));
+		pf_rulecls_addr_key(daddr, af, &k);
+		pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+		    pcd[PF_RULECLS_DST_ADDR].pcd_bits,
+		    pf_rulecls_find(&pcd[PF_RULECLS_DST_ADDR], &k));
+		if (proto == IPPROTO_TCP || proto == IPPROTO_UDP) {
+			k.pck_hi = 0;
+			k.pck_lo = ntohs(sport);
+			pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+			    pcd[PF_RULECLS_SRC_PORT].pcd_bits,
+			    pf_rulecls_find(&pcd[PF_RULECLS_SRC_PORT], &k));
+			k.pck_lo = ntohs(dport);
+			pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+			    pcd[PF_RULECLS_DST_PORT].pcd_bits,
+			    pf_rulecls_find(&pcd[PF_RULECLS_DST_PORT], &k));
+		}
+	}
+	pcm->pcm_nrows = n;
+}
+
+/*
+ * The first candidate rule numbered i or higher, or pcl_nrules if none.
+ */
+static u_int32_t
+pf_rulecls_next(struct pf_rulecls *pcl, struct pf_rulecls_match *pcm,
+    u_int32_t i)
+{
+	u_int32_t w = i / 64;
+	u_int64_t bits;
+	int j;
+
+	if (i >= pcl->pcl_nrules)
+		return (pcl->pcl_nrules);
+	bits = ~0ULL << (i % 64);
+	for (;;) {
+		for (j = 0; j < pcm->pcm_nrows && bits != 0; j++)
+			bits &= pcm->pcm_row[j][w];
+		if (bits != 0)
+			return (w * 64 + __builtin_ctzll(bits));
+		if (++w == pcl->pcl_nwords)
+			return (pcl->pcl_nrules);
+		bits = ~0ULL;
+	}
+}
+
+/*
+ * Retire the classifier before the active rules change.  Caller holds
+ * pf_perim_lock exclusive.
+ */
+void
+pf_rulecls_invalidate(void)
+{
+	lck_rw_assert(pf_perim_lock, LCK_RW_ASSERT_EXCLUSIVE);
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	pf_rulecls_dirty = 1;
+	if (pf_rulecls != NULL) {
+		pf_rulecls_free(pf_rulecls);
+		pf_rulecls = NULL;
+	}
+}
+
+/*
+ * Build a classifier for the main filter ruleset after
+ * pf_rulecls_invalidate(), if it has enough rules to be worth one and
+ * the classifier fits in PF_RULECLS_MAXSIZE.  Caller holds pf_perim_lock
+ * exclusive.
+ */
+void
+pf_rulecls_update(void)
+{
+	struct pf_rulequeue *rq;
+	struct pf_rulecls *pcl;
+	struct pf_rule *r;
+	u_int32_t n;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (!pf_rulecls_dirty)
+		return;
+	lck_rw_assert(pf_perim_lock, LCK_RW_ASSERT_EXCLUSIVE);
+	VERIFY(pf_rulecls == NULL);
+	pf_rulecls_dirty = 0;
+
+	rq = pf_main_ruleset.rules[PF_RULESET_FILTER].active.ptr;
+	n = 0;
+	TAILQ_FOREACH(r, rq, entries) {
+		/* candidates are found by rule number */
+		if (r->nr != n)
+			return;
+		n++;
+	}
+	if (n < PF_RULECLS_MINRULES)
+		return;
+
+	pcl = _MALLOC(sizeof (*pcl), M_TEMP, M_WAITOK | M_ZERO);
+	if (pcl == NULL)
+		return;
+	pcl->pcl_nrules = n;
+	pcl->pcl_nwords = (n + 63) / 64;
+	pcl->pcl_rules = _MALLOC(n * sizeof (struct pf_rule *), M_TEMP,
+	    M_WAITOK);
+	if (pcl->pcl_rules == NULL) {
+		pf_rulecls_free(pcl);
+		return;
+	}
+	n = 0;
+	TAILQ_FOREACH(r, rq, entries)
+		pcl->pcl_rules[n++] = r;
+
+	if (pf_rulecls_build(pcl) != 0) {
+		pf_rulecls_free(pcl);
+		return;
+	}
+	pf_rulecls = pcl;
+}
+
+#define	PF_RULESNAP_CTRS(prs, cpu)					\
+	((struct pf_rulesnap_ctr *)(void *)((prs)->prs_ctrs +		\
+	    (size_t)(cpu) * (prs)->prs_stride))
+
+#define	PF_RULESNAP_READERS(cpu)					\
+	((volatile SInt32 *)(void *)(pf_rulesnap_rd_pcpu +		\
+	    (size_t)(cpu) * CPU_CACHE_LINE_SIZE))
+
+/*
+ * Allocate the per-CPU reader counts.  Without them no snapshot is ever
+ * built, and every packet is filtered under pf_lock.
+ */
+void
+pf_rulesnap_init(void)
+{
+	pf_rulesnap_rd_buf = _MALLOC((ml_get_max_cpus() + 1) *
+	    CPU_CACHE_LINE_SIZE, M_TEMP, M_WAITOK | M_ZERO);
+	if (pf_rulesnap_rd_buf == NULL)
+		return;
+	pf_rulesnap_rd_pcpu = (caddr_t)P2ROUNDUP((intptr_t)pf_rulesnap_rd_buf,
+	    CPU_CACHE_LINE_SIZE);
+}
+
+/*
+ * Enter a section in which pf_rulesnap, its classifier and the pfi_kif
+ * structures may be used without locks.  Preemption stays disabled until
+ * pf_rulesnap_rd_exit(); that keeps the per-CPU counter slots touched in
+ * between private to this CPU, and bounds how long pf_rulesnap_sync()
+ * spins.
+ */
+static u_int32_t
+pf_rulesnap_rd_enter(void)
+{
+	volatile SInt32 *readers;
+	u_int32_t g;
+
+	disable_preemption();
+	readers = PF_RULESNAP_READERS(cpu_number());
+again:
+	g = pf_rulesnap_gen;
+	readers[g & 1]++;
+	OSMemoryBarrier();
+	if (pf_rulesnap_gen != g) {
+		readers[g & 1]--;
+		goto again;
+	}
+	return (g);
+}
+
+static void
+pf_rulesnap_rd_exit(u_int32_t g)
+{
+	OSMemoryBarrier();
+	PF_RULESNAP_READERS(cpu_number())[g & 1]--;
+	enable_preemption();
+}
+
+static u_int32_t
+pf_rulesnap_rd_count(u_int32_t g)
+{
+	u_int32_t cpu, ncpu, n = 0;
+
+	ncpu = ml_get_max_cpus();
+	for (cpu = 0; cpu < ncpu; cpu++)
+		n += PF_RULESNAP_READERS(cpu)[g & 1];
+
+	return (n);
+}
+
+/*
+ * Wait until every reader section that started before the call has
+ * ended, so that whatever it could have seen may be freed.  Sections
+ * never block, so this spins rather than sleeps.  Caller holds pf_lock,
+ * which serializes generation changes.
+ */
+void
+pf_rulesnap_sync(void)
+{
+	u_int32_t g;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (pf_rulesnap_rd_pcpu == NULL)
+		return;
+
+	g = pf_rulesnap_gen;
+	while (pf_rulesnap_rd_count(g - 1) != 0)
+		delay(1);
+	OSMemoryBarrier();
+	pf_rulesnap_gen = g + 1;
+	OSMemoryBarrier();
+	while (pf_rulesnap_rd_count(g) != 0)
+		delay(1);
+}
+
+/*
+ * A rule may go into the snapshot only if matching it needs nothing but
+ * the packet headers and data that is copied into the snapshot, and
+ * acting on it needs nothing but a pass or a drop.
+ */
+static int
+pf_rulesnap_eligible(struct pf_rule *r)
+{
+	struct pf_addr_wrap *aw[2] = { &r->src.addr, &r->dst.addr };
+	int i;
+
+	if (r->action != PF_PASS && r->action != PF_DROP)
+		return (0);
+	if (r->anchor != NULL || r->keep_state || r->log || r->rt ||
+	    r->tag || r->match_tag || r->prob || r->qid || r->pqid ||
+	    r->uid.op || r->gid.op || r->os_fingerprint != PF_OSFP_ANY ||
+	    PF_RTABLEID_IS_VALID(r->rtableid))
+		return (0);
+	if (r->rule_flag &
+	    (PFRULE_RETURNRST | PFRULE_RETURNICMP | PFRULE_RETURN))
+		return (0);
+	for (i = 0; i < 2; i++) {
+		if (aw[i]->type != PF_ADDR_ADDRMASK &&
+		    aw[i]->type != PF_ADDR_RANGE)
+			return (0);
+	}
+	return (1);
+}
+
+static void
+pf_rulesnap_compile(struct pf_rulesnap_rule *sr, struct pf_rule *r,
+    u_int32_t nrules)
+{
+	int i;
+
+	sr->psr_rule = r;
+	sr->psr_kif = r->kif;
+	sr->psr_src = r->src;
+	sr->psr_dst = r->dst;
+	for (i = 0; i < PF_SKIP_COUNT; i++) {
+		sr->psr_skip[i] = (r->skip[i].ptr != NULL) ?
+		    r->skip[i].ptr->nr : nrules;
+	}
+	sr->psr_rule_flag = r->rule_flag;
+	sr->psr_action = r->action;
+	sr->psr_direction = r->direction;
+	sr->psr_quick = r->quick;
+	sr->psr_ifnot = r->ifnot;
+	sr->psr_af = r->af;
+	sr->psr_proto = r->proto;
+	sr->psr_type = r->type;
+	sr->psr_code = r->code;
+	sr->psr_flags = r->flags;
+	sr->psr_flagset = r->flagset;
+	sr->psr_tos = r->tos;
+}
+
+static void
+pf_rulesnap_free(struct pf_rulesnap *prs)
+{
+	if (prs->prs_ctrs_buf != NULL)
+		_FREE(prs->prs_ctrs_buf, M_TEMP);
+	if (prs->prs_base != NULL)
+		_FREE(prs->prs_base, M_TEMP);
+	if (prs->prs_rules != NULL)
+		_FREE(prs->prs_rules, M_TEMP);
+	_FREE(prs, M_TEMP);
+}
+
+/*
+ * Counts a rule has collected in the snapshot since its last clear.
+ * The per-CPU slots are only ever added to; a clear moves prs_base.
+ */
+static void
+pf_rulesnap_sum(struct pf_rulesnap *prs, u_int32_t idx,
+    struct pf_rulesnap_ctr *sum)
+{
+	struct pf_rulesnap_ctr *ctr, *base = &prs->prs_base[idx];
+	u_int32_t cpu;
+
+	sum->evaluations = -base->evaluations;
+	sum->packets[0] = -base->packets[0];
+	sum->packets[1] = -base->packets[1];
+	sum->bytes[0] = -base->bytes[0];
+	sum->bytes[1] = -base->bytes[1];
+	for (cpu = 0; cpu < prs->prs_ncpu; cpu++) {
+		ctr = &PF_RULESNAP_CTRS(prs, cpu)[idx];
+		sum->evaluations += ctr->evaluations;
+		sum->packets[0] += ctr->packets[0];
+		sum->packets[1] += ctr->packets[1];
+		sum->bytes[0] += ctr->bytes[0];
+		sum->bytes[1] += ctr->bytes[1];
+	}
+}
+
+/*
+ * Retire the current snapshot, folding its counters back into the rules
+ * and pf_status, before the active rules, their counters or the
+ * classifier change.  Caller holds pf_perim_lock exclusive; packets
+ * still being filtered against the snapshot are waited out first.
+ */
+void
+pf_rulesnap_invalidate(void)
+{
+	struct pf_rulesnap *prs = pf_rulesnap;
+	struct pf_rulesnap_ctr sum;
+	struct pf_rule *r;
+	u_int32_t i;
+
+	lck_rw_assert(pf_perim_lock, LCK_RW_ASSERT_EXCLUSIVE);
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	pf_rulesnap_dirty = 1;
+	if (prs == NULL)
+		return;
+	pf_rulesnap = NULL;
+	pf_rulesnap_sync();
+
+	for (i = 0; i <= prs->prs_nrules; i++) {
+		r = prs->prs_rules[i].psr_rule;
+		pf_rulesnap_sum(prs, i, &sum);
+		r->evaluations += sum.evaluations;
+		r->packets[0] += sum.packets[0];
+		r->packets[1] += sum.packets[1];
+		r->bytes[0] += sum.bytes[0];
+		r->bytes[1] += sum.bytes[1];
+		/* each packet matched exactly one rule */
+		pf_status.counters[PFRES_MATCH] +=
+		    sum.packets[0] + sum.packets[1];
+	}
+	pf_rulesnap_free(prs);
+}
+
+/*
+ * Build a new snapshot after pf_rulesnap_invalidate(), if the active
+ * rulesets allow one, and publish it.  Called after pf_rulecls_update(),
+ * whose classifier the snapshot takes over; caller holds pf_perim_lock
+ * exclusive.
+ */
+void
+pf_rulesnap_update(void)
+{
+	struct pf_rulequeue *rq;
+	struct pf_rulesnap *prs;
+	struct pf_rule *r;
+	u_int32_t n, i;
+	int rs;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (!pf_rulesnap_dirty)
+		return;
+	lck_rw_assert(pf_perim_lock, LCK_RW_ASSERT_EXCLUSIVE);
+	VERIFY(pf_rulesnap == NULL);
+	pf_rulesnap_dirty = 0;
+
+	if (pf_rulesnap_rd_pcpu == NULL)
+		return;
+	for (rs = 0; rs < PF_RULESET_MAX; rs++) {
+		if (rs != PF_RULESET_FILTER &&
+		    !TAILQ_EMPTY(pf_main_ruleset.rules[rs].active.ptr))
+			return;
+	}
+	if (!pf_rulesnap_eligible(&pf_default_rule))
+		return;
+
+	rq = pf_main_ruleset.rules[PF_RULESET_FILTER].active.ptr;
+	n = 0;
+	TAILQ_FOREACH(r, rq, entries) {
+		/* skip steps are translated through the rule numbers */
+		if (r->nr != n || !pf_rulesnap_eligible(r))
+			return;
+		n++;
+	}
+
+	prs = _MALLOC(sizeof (*prs), M_TEMP, M_WAITOK | M_ZERO);
+	if (prs == NULL)
+		return;
+	prs->prs_ncpu = ml_get_max_cpus();
+	prs->prs_stride = P2ROUNDUP((n + 1) * sizeof (struct pf_rulesnap_ctr),
+	    CPU_CACHE_LINE_SIZE);
+	prs->prs_rules = _MALLOC((n + 1) * sizeof (struct pf_rulesnap_rule),
+	    M_TEMP, M_WAITOK | M_ZERO);
+	prs->prs_base = _MALLOC((n + 1) * sizeof (struct pf_rulesnap_ctr),
+	    M_TEMP, M_WAITOK | M_ZERO);
+	prs->prs_ctrs_buf = _MALLOC(prs->prs_ncpu * prs->prs_stride +
+	    CPU_CACHE_LINE_SIZE, M_TEMP, M_WAITOK | M_ZERO);
+	if (prs->prs_rules == NULL || prs->prs_base == NULL ||
+	    prs->prs_ctrs_buf == NULL) {
+		pf_rulesnap_free(prs);
+		return;
+	}
+	prs->prs_ctrs = (caddr_t)P2ROUNDUP((intptr_t)prs->prs_ctrs_buf,
+	    CPU_CACHE_LINE_SIZE);
+
+	i = 0;
+	TAILQ_FOREACH(r, rq, entries)
+		pf_rulesnap_compile(&prs->prs_rules[i++], r, n);
+	pf_rulesnap_compile(&prs->prs_rules[n], &pf_default_rule, n);
+	prs->prs_nrules = n;
+	/* both are rebuilt from the same rules */
+	if (pf_rulecls != NULL && pf_rulecls->pcl_nrules == n)
+		prs->prs_cls = pf_rulecls;
+
+	OSMemoryBarrier();
+	pf_rulesnap = prs;
+}
+
+/*
+ * Add the counts a rule has collected in the current snapshot to the
+ * copy of it being returned to user space.
+ */
+void
+pf_rulesnap_copyout(struct pf_rule *src, struct pf_rule *dst)
+{
+	struct pf_rulesnap *prs = pf_rulesnap;
+	struct pf_rulesnap_ctr sum;
+
+	if (prs == NULL || src->nr >= prs->prs_nrules ||
+	    prs->prs_rules[src->nr].psr_rule != src)
+		return;
+
+	pf_rulesnap_sum(prs, src->nr, &sum);
+	dst->evaluations += sum.evaluations;
+	dst->packets[0] += sum.packets[0];
+	dst->packets[1] += sum.packets[1];
+	dst->bytes[0] += sum.bytes[0];
+	dst->bytes[1] += sum.bytes[1];
+}
+
+/*
+ * Reset a rule's snapshot counts along with its own.  Packets may be
+ * adding to the per-CPU slots meanwhile, so move the baseline instead
+ * of zeroing them.
+ */
+void
+pf_rulesnap_clear(struct pf_rule *r)
+{
+	struct pf_rulesnap *prs = pf_rulesnap;
+	struct pf_rulesnap_ctr sum, *base;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (prs == NULL || r->nr >= prs->prs_nrules ||
+	    prs->prs_rules[r->nr].psr_rule != r)
+		return;
+
+	pf_rulesnap_sum(prs, r->nr, &sum);
+	base = &prs->prs_base[r->nr];
+	base->evaluations += sum.evaluations;
+	base->packets[0] += sum.packets[0];
+	base->packets[1] += sum.packets[1];
+	base->bytes[0] += sum.bytes[0];
+	base->bytes[1] += sum.bytes[1];
+	/* pf_status keeps counting these */
+	pf_status.counters[PFRES_MATCH] += sum.packets[0] + sum.packets[1];
+}
+
+void
+pf_rulesnap_status(struct pf_status *s)
+{
+	struct pf_rulesnap *prs = pf_rulesnap;
+	struct pf_rulesnap_ctr sum;
+	u_int32_t i;
+
+	if (prs == NULL)
+		return;
+
+	for (i = 0; i <= prs->prs_nrules; i++) {
+		pf_rulesnap_sum(prs, i, &sum);
+		s->counters[PFRES_MATCH] += sum.packets[0] + sum.packets[1];
+	}
+}
+
+/*
+ * pf_rulesnap_test() body, run inside a reader section.  Leaves freeing
+ * a dropped packet to the caller.
+ */
+static int
+pf_rulesnap_eval(struct pf_rulesnap *prs, int af, int dir,
+    struct ifnet *ifp, struct mbuf *m, int *actionp)
+{
+	struct pf_rulecls *pcl = prs->prs_cls;
+	struct pf_rulecls_match pcm;
+	struct pf_rulesnap_rule *sr;
+	struct pf_rulesnap_ctr *ctr;
+	struct pfi_kif_ctr *kc;
+	struct pf_mtag *pf_mtag;
+	struct pfi_kif *kif;
+	struct pf_addr *saddr, *daddr;
+	u_int16_t sport, dport;
+	u_int32_t i, n, rm;
+	int off, tot_len, hlen, action;
+	u_int8_t proto, tos, sc, th_flags = 0;
+
+	if (!pf_status.running || pf_status.states != 0)
+		return (0);
+
+	if ((pf_mtag = pf_get_mtag(m)) == NULL)
+		return (0);
+	if (pf_mtag->pftag_flags & PF_TAG_GENERATED) {
+		*actionp = PF_PASS;
+		return (1);
+	}
+
+	/*
+	 * pfi_kif_unref() frees a pfi_kif only after pf_rulesnap_sync(),
+	 * so this one stays valid until the section ends.
+	 */
+	if ((kif = (struct pfi_kif *)ifp->if_pf_kif) == NULL)
+		return (0);
+	if (kif->pfik_flags & PFI_IFLAG_SKIP) {
+		*actionp = PF_PASS;
+		return (1);
+	}
+
+	switch (af) {
+#if INET
+	case AF_INET: {
+		struct ip *h = mtod(m, struct ip *);
+
+		if (m->m_pkthdr.len < (int)sizeof (*h) || h->ip_hl != 5 ||
+		    (h->ip_off & htons(IP_MF | IP_OFFMASK)))
+			return (0);
+		saddr = (struct pf_addr *)(void *)&h->ip_src;
+		daddr = (struct pf_addr *)(void *)&h->ip_dst;
+		proto = h->ip_p;
+		tos = h->ip_tos;
+		off = sizeof (*h);
+		tot_len = ntohs(h->ip_len);
+		break;
+	}
+#endif /* INET */
+#if INET6
+	case AF_INET6: {
+		struct ip6_hdr *h = mtod(m, struct ip6_hdr *);
+
+		if (m->m_pkthdr.len < (int)sizeof (*h) || h->ip6_plen == 0)
+			return (0);
+		saddr = (struct pf_addr *)(void *)&h->ip6_src;
+		daddr = (struct pf_addr *)(void *)&h->ip6_dst;
+		proto = h->ip6_nxt;
+		tos = 0;
+		off = sizeof (*h);
+		tot_len = ntohs(h->ip6_plen) + sizeof (*h);
+		break;
+	}
+#endif /* INET6 */
+	default:
+		return (0);
+	}
+
+	switch (proto) {
+	case IPPROTO_TCP: {
+		struct tcphdr th;
+
+		hlen = sizeof (th);
+		if (tot_len < off + hlen || m->m_pkthdr.len < off + hlen)
+			return (0);
+		m_copydata(m, off, hlen, (caddr_t)&th);
+		sport = th.th_sport;
+		dport = th.th_dport;
+		th_flags = th.th_flags;
+		break;
+	}
+	case IPPROTO_UDP: {
+		struct udphdr uh;
+
+		hlen = sizeof (uh);
+		if (tot_len < off + hlen || m->m_pkthdr.len < off + hlen)
+			return (0);
+		m_copydata(m, off, hlen, (caddr_t)&uh);
+		if (uh.uh_dport == 0 ||
+		    ntohs(uh.uh_ulen) > m->m_pkthdr.len - off ||
+		    ntohs(uh.uh_ulen) < sizeof (struct udphdr))
+			return (0);
+		sport = uh.uh_sport;
+		dport = uh.uh_dport;
+		break;
+	}
+	default:
+		return (0);
+	}
+	sc = MBUF_SCIDX(mbuf_get_service_class(m));
+
+	/* same walk as pf_test_rule(), minus what the snapshot excludes */
+	n = prs->prs_nrules;
+	ctr = PF_RULESNAP_CTRS(prs, cpu_number());
+	if (pcl != NULL)
+		pf_rulecls_lookup(pcl, kif, dir, af, proto, saddr, daddr,
+		    sport, dport, &pcm);
+	rm = n;
+	i = 0;
+	while (i < n) {
+		if (pcl != NULL && (i = pf_rulecls_next(pcl, &pcm, i)) >= n)
+			break;
+		sr = &prs->prs_rules[i];
+		ctr[i].evaluations++;
+		if (pfi_kif_match(sr->psr_kif, kif) == sr->psr_ifnot)
+			i = sr->psr_skip[PF_SKIP_IFP];
+		else if (sr->psr_direction && sr->psr_direction != dir)
+			i = sr->psr_skip[PF_SKIP_DIR];
+		else if (sr->psr_af && sr->psr_af != af)
+			i = sr->psr_skip[PF_SKIP_AF];
+		else if (sr->psr_proto && sr->psr_proto != proto)
+			i = sr->psr_skip[PF_SKIP_PROTO];
+		else if (PF_MISMATCHAW(&sr->psr_src.addr, saddr, af,
+		    sr->psr_src.neg, kif))
+			i = sr->psr_skip[PF_SKIP_SRC_ADDR];
+		else if (sr->psr_proto == proto &&
+		    sr->psr_src.xport.range.op &&
+		    !pf_match_port(sr->psr_src.xport.range.op,
+		    sr->psr_src.xport.range.port[0],
+		    sr->psr_src.xport.range.port[1], sport))
+			i = sr->psr_skip[PF_SKIP_SRC_PORT];
+		else if (PF_MISMATCHAW(&sr->psr_dst.addr, daddr, af,
+		    sr->psr_dst.neg, NULL))
+			i = sr->psr_skip[PF_SKIP_DST_ADDR];
+		else if (sr->psr_proto == proto &&
+		    sr->psr_dst.xport.range.op &&
+		    !pf_match_port(sr->psr_dst.xport.range.op,
+		    sr->psr_dst.xport.range.port[0],
+		    sr->psr_dst.xport.range.port[1], dport))
+			i = sr->psr_skip[PF_SKIP_DST_PORT];
+		/* icmp type and code are 0 for TCP and UDP */
+		else if ((sr->psr_type && sr->psr_type != 1) ||
+		    (sr->psr_code && sr->psr_code != 1))
+			i++;
+		else if ((sr->psr_rule_flag & PFRULE_TOS) && sr->psr_tos &&
+		    !(sr->psr_tos & tos))
+			i++;
+		else if ((sr->psr_rule_flag & PFRULE_DSCP) && sr->psr_tos &&
+		    !(sr->psr_tos & (tos & DSCP_MASK)))
+			i++;
+		else if ((sr->psr_rule_flag & PFRULE_SC) && sr->psr_tos &&
+		    ((sr->psr_tos & SCIDX_MASK) != sc))
+			i++;
+		else if (sr->psr_rule_flag & PFRULE_FRAGMENT)
+			i++;
+		else if (proto == IPPROTO_TCP &&
+		    (sr->psr_flagset & th_flags) != sr->psr_flags)
+			i++;
+		else {
+			rm = i;
+			if (sr->psr_quick)
+				break;
+			i++;
+		}
+	}
+
+	sr = &prs->prs_rules[rm];
+	action = sr->psr_action;
+	ctr[rm].packets[dir == PF_OUT]++;
+	ctr[rm].bytes[dir == PF_OUT] += tot_len;
+	kc = PFI_KIF_CTRS(kif, cpu_number());
+	kc->pkc_packets[af == AF_INET6][dir == PF_OUT][action != PF_PASS]++;
+	kc->pkc_bytes[af == AF_INET6][dir == PF_OUT][action != PF_PASS] +=
+	    tot_len;
+
+	if (action != PF_PASS) {
+		*actionp = PF_DROP;
+		return (1);
+	}
+
+	if (!(m->m_pkthdr.pkt_flags & PKTF_FLOW_ID)) {
+		struct pf_state_key psk;
+
+		bzero(&psk, sizeof (psk));
+		psk.proto = proto;
+		psk.af_lan = psk.af_gwy = af;
+		if (dir == PF_OUT) {
+			PF_ACPY(&psk.lan.addr, saddr, af);
+			PF_ACPY(&psk.ext_lan.addr, daddr, af);
+			psk.lan.xport.port = sport;
+			psk.ext_lan.xport.port = dport;
+		} else {
+			PF_ACPY(&psk.lan.addr, daddr, af);
+			PF_ACPY(&psk.ext_lan.addr, saddr, af);
+			psk.lan.xport.port = dport;
+			psk.ext_lan.xport.port = sport;
+		}
+		/*
+		 * This may rarely re-randomize pf_hash_seed without pf_lock;
+		 * racing writers all store a random value, which is fine.
+		 */
+		m->m_pkthdr.pkt_flowid = pf_calc_state_key_flowhash(&psk);
+		m->m_pkthdr.pkt_flowsrc = FLOWSRC_PF;
+		m->m_pkthdr.pkt_flags |= PKTF_FLOW_ID;
+	}
+	m->m_pkthdr.pkt_proto = proto;
+
+	*actionp = PF_PASS;
+	return (1);
+}
+
+/*
+ * Filter a TCP or UDP packet against the ruleset snapshot, without
+ * pf_perim_lock or pf_lock.  Returns 0, leaving the packet untouched,
+ * if there is no snapshot or the packet needs anything it can't provide
+ * (existing states, fragments, IP options or IPv6 extension headers,
+ * other protocols, malformed headers); the caller must then run pf_test()
+ * or pf_test6() under pf_lock.  Otherwise returns 1 with the verdict in
+ * *actionp, having freed the packet on PF_DROP, with the same effects
+ * pf_test_rule() would have had for it.
+ */
+int
+pf_rulesnap_test(int af, int dir, struct ifnet *ifp, struct mbuf **m0,
+    int *actionp)
+{
+	struct pf_rulesnap *prs;
+	u_int32_t g;
+	int done = 0;
+
+	if (pf_rulesnap == NULL)
+		return (0);
+
+	g = pf_rulesnap_rd_enter();
+	if ((prs = pf_rulesnap) != NULL)
+		done = pf_rulesnap_eval(prs, af, dir, ifp, *m0, actionp);
+	pf_rulesnap_rd_exit(g);
+
+	if (done && *actionp != PF_PASS) {
+		m_freem(*m0);
+		*m0 = NULL;
+	}
+	return (done);
+}
+
 #if INET
 #define PF_APPLE_UPDATE_PDESC_IPv4()				\
 	do {							\
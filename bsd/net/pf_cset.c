@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Compact tables.
+ *
+ * A table defined with PFR_CSET_MINADDRS or more addresses through
+ * pfr_ina_define() is loaded into a struct pfr_cset instead of a pair of
+ * radix trees: the prefixes are sorted once, and the address space of each
+ * family is cut into intervals at every prefix boundary, each interval
+ * naming the most specific prefix that covers it.  That costs a few dozen
+ * bytes per address instead of a pfr_kentry, loads in O(n log n), and a
+ * lookup is a binary search bounded, for IPv4, by a direct index on the
+ * top address bits.
+ *
+ * The set is never modified after it is built; it is installed, replaced
+ * and freed only with pf_perim_lock held exclusive, so the packet path can
+ * search it without further locking.  Compact entries carry no per-address
+ * counters.  Incremental changes (pfr_add_addrs() and friends) first
+ * convert the table back to radix entries through pfr_cset_expand().
+ *
+ * pf_table.c copies the addresses in and owns the table side; this file
+ * only builds and searches the set, and has no other kernel dependencies.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+
+#include <netinet/in.h>
+#include <net/pfvar.h>
+
+#define	PFR_CSET_MINBITS	8
+#define	PFR_CSET_MAXBITS	16
+#define	PFR_CSET_K6_LE(a, b)	((a)->hi < (b)->hi ||			\
+	((a)->hi == (b)->hi && (a)->lo <= (b)->lo))
+
+static int pfr_cset_order(const struct pfr_centry *,
+    const struct pfr_centry *);
+static int pfr_cset_cmp(const void *, const void *);
+static void pfr_cset_key(const struct pfr_centry *, struct pfr_cset_k6 *);
+static int pfr_cset_lim(const struct pfr_centry *, struct pfr_cset_k6 *);
+static void pfr_cset_emit(struct pfr_cset_k6 *, u_int32_t *, u_int32_t *,
+    const struct pfr_cset_k6 *, u_int32_t);
+static u_int32_t pfr_cset_sweep(struct pfr_centry *, u_int32_t, u_int32_t,
+    struct pfr_cset_k6 *, u_int32_t *);
+static struct pfr_cset *pfr_cset_build(struct pfr_centry *, u_int32_t,
+    size_t);
+
+extern void qsort(void *, size_t, size_t,
+    int (*)(const void *, const void *));
+
+static int
+pfr_cset_order(const struct pfr_centry *a, const struct pfr_centry *b)
+{
+	int d;
+
+	if (a->pfrce_af != b->pfrce_af)
+		return (a->pfrce_af < b->pfrce_af ? -1 : 1);
+	if ((d = memcmp(&a->pfrce_addr, &b->pfrce_addr,
+	    sizeof (a->pfrce_addr))) != 0)
+		return (d);
+	if (a->pfrce_net != b->pfrce_net)
+		return (a->pfrce_net < b->pfrce_net ? -1 : 1);
+	return (0);
+}
+
+static int
+pfr_cset_cmp(const void *a, const void *b)
+{
+	const struct pfr_centry *p = a, *q = b;
+	int d;
+
+	if ((d = pfr_cset_order(p, q)) != 0)
+		return (d);
+	/* keep the first of duplicate definitions, as the radix load does */
+	return (p->pfrce_seq < q->pfrce_seq ? -1 :
+	    (p->pfrce_seq > q->pfrce_seq));
+}
+
+/*
+ * Both families are swept as 128-bit keys; an IPv4 address occupies the
+ * top 32 bits, so a prefix of length net spans 2^(128 - net) keys either
+ * way.
+ */
+static void
+pfr_cset_key(const struct pfr_centry *ce, struct pfr_cset_k6 *k)
+{
+	const struct pf_addr *a = &ce->pfrce_addr;
+
+	if (ce->pfrce_af == AF_INET) {
+		k->hi = (u_int64_t)ntohl(a->addr32[0]) << 32;
+		k->lo = 0;
+	} else {
+		k->hi = ((u_int64_t)ntohl(a->addr32[0]) << 32) |
+		    ntohl(a->addr32[1]);
+		k->lo = ((u_int64_t)ntohl(a->addr32[2]) << 32) |
+		    ntohl(a->addr32[3]);
+	}
+}
+
+/*
+ * First key past the prefix; returns 0 if the prefix runs to the end of
+ * the address space.
+ */
+static int
+pfr_cset_lim(const struct pfr_centry *ce, struct pfr_cset_k6 *lim)
+{
+	int		 bits = 128 - ce->pfrce_net;
+	u_int64_t	 o;
+
+	if (ce->pfrce_net == 0)
+		return (0);
+	pfr_cset_key(ce, lim);
+	if (bits >= 64) {
+		o = lim->hi;
+		lim->hi += 1ULL << (bits - 64);
+		return (lim->hi > o);
+	}
+	o = lim->lo;
+	lim->lo += 1ULL << bits;
+	if (lim->lo < o && ++lim->hi == 0)
+		return (0);
+	return (1);
+}
+
+static void
+pfr_cset_emit(struct pfr_cset_k6 *start, u_int32_t *owner, u_int32_t *n,
+    const struct pfr_cset_k6 *k, u_int32_t o)
+{
+	/* a later boundary at the same key supersedes the earlier one */
+	if (*n > 0 && start[*n - 1].hi == k->hi && start[*n - 1].lo == k->lo)
+		(*n)--;
+	if (*n > 0 && owner[*n - 1] == o)
+		return;
+	start[*n] = *k;
+	owner[*n] = o;
+	(*n)++;
+}
+
+/*
+ * Cut the address space at the boundaries of ent[first..last), which are
+ * sorted by start and then by length, so that each prefix is visited
+ * after every prefix containing it.  Prefixes are either nested or
+ * disjoint, so the covering prefixes form a stack at most 129 deep.
+ * Produces at most 2n + 1 intervals.
+ */
+static u_int32_t
+pfr_cset_sweep(struct pfr_centry *ent, u_int32_t first, u_int32_t last,
+    struct pfr_cset_k6 *start, u_int32_t *owner)
+{
+	struct pfr_cset_k6	 k, lim;
+	u_int32_t		 stk[129], sp = 0, n = 0, i;
+
+	bzero(&k, sizeof (k));
+	pfr_cset_emit(start, owner, &n, &k, PFR_CSET_NONE);
+	for (i = first; i < last; i++) {
+		pfr_cset_key(&ent[i], &k);
+		while (sp > 0 && pfr_cset_lim(&ent[stk[sp - 1]], &lim) &&
+		    PFR_CSET_K6_LE(&lim, &k)) {
+			sp--;
+			pfr_cset_emit(start, owner, &n, &lim,
+			    sp > 0 ? stk[sp - 1] : PFR_CSET_NONE);
+		}
+		VERIFY(sp < sizeof (stk) / sizeof (stk[0]));
+		stk[sp++] = i;
+		pfr_cset_emit(start, owner, &n, &k, i);
+	}
+	while (sp > 0 && pfr_cset_lim(&ent[stk[sp - 1]], &lim)) {
+		sp--;
+		pfr_cset_emit(start, owner, &n, &lim,
+		    sp > 0 ? stk[sp - 1] : PFR_CSET_NONE);
+	}
+	return (n);
+}
+
+/*
+ * Build the interval arrays over ent[0..nent), which must be sorted with
+ * pfr_cset_cmp() and free of duplicates.  On success the set owns ent,
+ * an allocation of entsize bytes.
+ */
+static struct pfr_cset *
+pfr_cset_build(struct pfr_centry *ent, u_int32_t nent, size_t entsize)
+{
+	struct pfr_cset_k6	*start;
+	struct pfr_cset		*cs;
+	u_int32_t		*owner, nv4, n4 = 0, n6 = 0, bits = 0, s, i;
+	size_t			 tmpn, size;
+	caddr_t			 p;
+
+	/* AF_INET sorts before AF_INET6 */
+	for (nv4 = 0; nv4 < nent && ent[nv4].pfrce_af == AF_INET; nv4++)
+		;
+
+	tmpn = 2 * (size_t)nent + 2;
+	start = _MALLOC(tmpn * sizeof (*start), M_TEMP, M_WAITOK);
+	owner = _MALLOC(tmpn * sizeof (*owner), M_TEMP, M_WAITOK);
+	if (start == NULL || owner == NULL) {
+		cs = NULL;
+		goto done;
+	}
+	if (nv4 > 0)
+		n4 = pfr_cset_sweep(ent, 0, nv4, start, owner);
+	if (nent > nv4)
+		n6 = pfr_cset_sweep(ent, nv4, nent, start + n4, owner + n4);
+
+	size = sizeof (*cs) + n6 * (sizeof (struct pfr_cset_k6) +
+	    sizeof (u_int32_t));
+	if (n4 > 0) {
+		for (bits = PFR_CSET_MINBITS; bits < PFR_CSET_MAXBITS &&
+		    (1U << bits) < n4; bits++)
+			;
+		size += (2 * n4 + (1U << bits) + 1) * sizeof (u_int32_t);
+	}
+	cs = _MALLOC(size, M_RTABLE, M_WAITOK | M_ZERO);
+	if (cs == NULL)
+		goto done;
+
+	/* 64-bit keys first, right after the (8-byte aligned) header */
+	p = (caddr_t)(cs + 1);
+	cs->pcs_v6start = (struct pfr_cset_k6 *)(void *)p;
+	p += n6 * sizeof (struct pfr_cset_k6);
+	cs->pcs_v6ent = (u_int32_t *)(void *)p;
+	p += n6 * sizeof (u_int32_t);
+	cs->pcs_v4start = (u_int32_t *)(void *)p;
+	p += n4 * sizeof (u_int32_t);
+	cs->pcs_v4ent = (u_int32_t *)(void *)p;
+	p += n4 * sizeof (u_int32_t);
+	cs->pcs_v4idx = (u_int32_t *)(void *)p;
+
+	for (i = 0; i < n4; i++) {
+		cs->pcs_v4start[i] = (u_int32_t)(start[i].hi >> 32);
+		cs->pcs_v4ent[i] = owner[i];
+	}
+	bcopy(start + n4, cs->pcs_v6start, n6 * sizeof (struct pfr_cset_k6));
+	bcopy(owner + n4, cs->pcs_v6ent, n6 * sizeof (u_int32_t));
+	if (n4 > 0) {
+		/* last interval starting at or before each slot */
+		for (i = 0, s = 0; s < (1U << bits); s++) {
+			while (i + 1 < n4 &&
+			    cs->pcs_v4start[i + 1] <= (s << (32 - bits)))
+				i++;
+			cs->pcs_v4idx[s] = i;
+		}
+		cs->pcs_v4idx[s] = n4 - 1;
+	}
+	cs->pcs_ent = ent;
+	cs->pcs_nent = nent;
+	cs->pcs_v4cnt = n4;
+	cs->pcs_v4bits = bits;
+	cs->pcs_v6cnt = n6;
+	cs->pcs_size = size + entsize;
+done:
+	if (start != NULL)
+		_FREE(start, M_TEMP);
+	if (owner != NULL)
+		_FREE(owner, M_TEMP);
+	return (cs);
+}
+
+/*
+ * Sort ent[0..nent), which pfr_cset_load() filled in load order, drop
+ * duplicate definitions and build the set over what is left.  On success
+ * the set owns ent; on failure the caller still does.
+ */
+struct pfr_cset *
+pfr_cset_create(struct pfr_centry *ent, u_int32_t nent)
+{
+	u_int32_t	 i, n;
+
+	qsort(ent, nent, sizeof (*ent), pfr_cset_cmp);
+	for (i = 0, n = 0; i < nent; i++) {
+		if (n > 0 && pfr_cset_order(&ent[n - 1], &ent[i]) == 0)
+			continue;
+		if (n != i)
+			ent[n] = ent[i];
+		n++;
+	}
+	return (pfr_cset_build(ent, n, nent * sizeof (*ent)));
+}
+
+void
+pfr_cset_free(struct pfr_cset *cs)
+{
+	_FREE(cs->pcs_ent, M_RTABLE);
+	_FREE(cs, M_RTABLE);
+}
+
+/*
+ * Longest prefix match; needs no lock beyond what keeps cs alive.
+ */
+struct pfr_centry *
+pfr_cset_match(struct pfr_cset *cs, struct pf_addr *a, sa_family_t af)
+{
+	struct pfr_cset_k6	 k;
+	u_int32_t		 key, lo, hi, mid, o;
+
+	switch (af) {
+#if INET
+	case AF_INET:
+		if (cs->pcs_v4cnt == 0)
+			return (NULL);
+		key = ntohl(a->addr32[0]);
+		lo = cs->pcs_v4idx[key >> (32 - cs->pcs_v4bits)];
+		hi = cs->pcs_v4idx[(key >> (32 - cs->pcs_v4bits)) + 1];
+		while (lo < hi) {
+			mid = lo + (hi - lo + 1) / 2;
+			if (cs->pcs_v4start[mid] <= key)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		o = cs->pcs_v4ent[lo];
+		break;
+#endif /* INET */
+#if INET6
+	case AF_INET6:
+		if (cs->pcs_v6cnt == 0)
+			return (NULL);
+		k.hi = ((u_int64_t)ntohl(a->addr32[0]) << 32) |
+		    ntohl(a->addr32[1]);
+		k.lo = ((u_int64_t)ntohl(a->addr32[2]) << 32) |
+		    ntohl(a->addr32[3]);
+		lo = 0;
+		hi = cs->pcs_v6cnt - 1;
+		while (lo < hi) {
+			mid = lo + (hi - lo + 1) / 2;
+			if (PFR_CSET_K6_LE(&cs->pcs_v6start[mid], &k))
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		o = cs->pcs_v6ent[lo];
+		break;
+#endif /* INET6 */
+	default:
+		return (NULL);
+	}
+	return (o == PFR_CSET_NONE ? NULL : &cs->pcs_ent[o]);
+}
+
+/*
+ * Exact match on address and prefix length.
+ */
+struct pfr_centry *
+pfr_cset_lookup(struct pfr_cset *cs, struct pfr_addr *ad)
+{
+	struct pfr_centry	 key;
+	u_int32_t		 lo = 0, hi = cs->pcs_nent, mid;
+	int			 d;
+
+	bzero(&key, sizeof (key));
+	bcopy(&ad->pfra_u, &key.pfrce_addr, sizeof (ad->pfra_u));
+	key.pfrce_af = ad->pfra_af;
+	key.pfrce_net = ad->pfra_net;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		d = pfr_cset_order(&cs->pcs_ent[mid], &key);
+		if (d == 0)
+			return (&cs->pcs_ent[mid]);
+		if (d < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (NULL);
+}
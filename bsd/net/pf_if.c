@@ -70,6 +70,9 @@
 #include <sys/kernel.h>
 #include <sys/time.h>
 #include <sys/malloc.h>
+#include <sys/mcache.h>
+
+#include <machine/machine_routines.h>
 
 #include <net/if.h>
 #include <net/if_types.h>
@@ -88,6 +91,7 @@
 #include <net/pfvar.h>
 
 struct pfi_kif			*pfi_all = NULL;
+size_t				pfi_kif_ctr_stride;	/* per CPU */
 
 static struct pool		pfi_addr_pl;
 static struct pfi_ifhead	pfi_ifs;
@@ -99,6 +103,8 @@ static int			pfi_buffer_max;
 __private_extern__ void pfi_kifaddr_update(void *);
 
 static void pfi_kif_update(struct pfi_kif *);
+static void pfi_kif_sum(struct pfi_kif *, struct pfi_kif_ctr *);
+static void pfi_kif_counters(struct pfi_kif *, struct pfi_kif_ctr *);
 static void pfi_dynaddr_update(struct pfi_dynaddr *dyn);
 static void pfi_table_update(struct pfr_ktable *, struct pfi_kif *, int, int);
 static void pfi_instance_add(struct ifnet *, int, int);
@@ -126,6 +132,8 @@ pfi_initialize(void)
 	pfi_buffer_max = 64;
 	pfi_buffer = _MALLOC(pfi_buffer_max * sizeof (*pfi_buffer),
 	    PFI_MTYPE, M_WAITOK);
+	pfi_kif_ctr_stride = P2ROUNDUP(sizeof (struct pfi_kif_ctr),
+	    CPU_CACHE_LINE_SIZE);
 
 	if ((pfi_all = pfi_kif_get(IFG_ALL)) == NULL)
 		panic("pfi_kif_get for pfi_all failed");
@@ -155,6 +163,14 @@ pfi_kif_get(const char *kif_name)
 	/* create new one */
 	if ((kif = _MALLOC(sizeof (*kif), PFI_MTYPE, M_WAITOK|M_ZERO)) == NULL)
 		return (NULL);
+	kif->pfik_pcpu_buf = _MALLOC(ml_get_max_cpus() * pfi_kif_ctr_stride +
+	    CPU_CACHE_LINE_SIZE, PFI_MTYPE, M_WAITOK|M_ZERO);
+	if (kif->pfik_pcpu_buf == NULL) {
+		_FREE(kif, PFI_MTYPE);
+		return (NULL);
+	}
+	kif->pfik_pcpu = (caddr_t)P2ROUNDUP((intptr_t)kif->pfik_pcpu_buf,
+	    CPU_CACHE_LINE_SIZE);
 
 	strlcpy(kif->pfik_name, kif_name, sizeof (kif->pfik_name));
 	kif->pfik_tzero = pf_calendar_time_second();
@@ -213,9 +229,59 @@ pfi_kif_unref(struct pfi_kif *kif, enum pfi_kif_refs what)
 		return;
 
 	RB_REMOVE(pfi_ifhead, &pfi_ifs, kif);
+	/* pf_rulesnap_test() may still be counting packets on it */
+	pf_rulesnap_sync();
+	_FREE(kif->pfik_pcpu_buf, PFI_MTYPE);
 	_FREE(kif, PFI_MTYPE);
 }
 
+/*
+ * Add up what pf_rulesnap_test() has counted in the per-CPU slots.
+ */
+static void
+pfi_kif_sum(struct pfi_kif *kif, struct pfi_kif_ctr *sum)
+{
+	struct pfi_kif_ctr	*kc;
+	u_int32_t		 cpu, ncpu;
+	int			 i, j, k;
+
+	bzero(sum, sizeof (*sum));
+	ncpu = ml_get_max_cpus();
+	for (cpu = 0; cpu < ncpu; cpu++) {
+		kc = PFI_KIF_CTRS(kif, cpu);
+		for (i = 0; i < 2; i++)
+			for (j = 0; j < 2; j++)
+				for (k = 0; k < 2; k++) {
+					sum->pkc_packets[i][j][k] +=
+						kc->pkc_packets[i][j][k];
+					sum->pkc_bytes[i][j][k] +=
+						kc->pkc_bytes[i][j][k];
+				}
+	}
+}
+
+/*
+ * Interface counts since the last clear: those kept under pf_lock plus
+ * the per-CPU ones above pfik_base.
+ */
+static void
+pfi_kif_counters(struct pfi_kif *kif, struct pfi_kif_ctr *ctr)
+{
+	int	i, j, k;
+
+	pfi_kif_sum(kif, ctr);
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < 2; j++)
+			for (k = 0; k < 2; k++) {
+				ctr->pkc_packets[i][j][k] +=
+					kif->pfik_packets[i][j][k] -
+					kif->pfik_base.pkc_packets[i][j][k];
+				ctr->pkc_bytes[i][j][k] +=
+					kif->pfik_bytes[i][j][k] -
+					kif->pfik_base.pkc_bytes[i][j][k];
+			}
+}
+
 int
 pfi_kif_match(struct pfi_kif *rule_kif, struct pfi_kif *packet_kif)
 {
@@ -595,6 +661,7 @@ pfi_update_status(const char *name, struct pf_status *pfs)
 {
 	struct pfi_kif		*p;
 	struct pfi_kif_cmp	 key;
+	struct pfi_kif_ctr	 ctr;
 	int			 i, j, k;
 
 	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
@@ -605,20 +672,25 @@ pfi_update_status(const char *name, struct pf_status *pfs)
 		return;
 
 	if (pfs != NULL) {
+		pfi_kif_counters(p, &ctr);
 		bzero(pfs->pcounters, sizeof (pfs->pcounters));
 		bzero(pfs->bcounters, sizeof (pfs->bcounters));
 		for (i = 0; i < 2; i++)
 			for (j = 0; j < 2; j++)
 				for (k = 0; k < 2; k++) {
 					pfs->pcounters[i][j][k] +=
-						p->pfik_packets[i][j][k];
+						ctr.pkc_packets[i][j][k];
 					pfs->bcounters[i][j] +=
-						p->pfik_bytes[i][j][k];
+						ctr.pkc_bytes[i][j][k];
 				}
 	} else {
-		/* just clear statistics */
+		/*
+		 * just clear statistics; the per-CPU ones may be counting
+		 * packets right now, so move their baseline instead
+		 */
 		bzero(p->pfik_packets, sizeof (p->pfik_packets));
 		bzero(p->pfik_bytes, sizeof (p->pfik_bytes));
+		pfi_kif_sum(p, &p->pfik_base);
 		p->pfik_tzero = pf_calendar_time_second();
 	}
 }
@@ -637,6 +709,7 @@ pfi_get_ifaces(const char *name, user_addr_t buf, int *size)
 			continue;
 		if (*size > n++) {
 			struct pfi_uif u;
+			struct pfi_kif_ctr ctr;
 
 			if (!p->pfik_tzero)
 				p->pfik_tzero = pf_calendar_time_second();
@@ -645,9 +718,10 @@ pfi_get_ifaces(const char *name, user_addr_t buf, int *size)
 			/* return the user space version of pfi_kif */
 			bzero(&u, sizeof (u));
 			bcopy(p->pfik_name, &u.pfik_name, sizeof (u.pfik_name));
-			bcopy(p->pfik_packets, &u.pfik_packets,
+			pfi_kif_counters(p, &ctr);
+			bcopy(ctr.pkc_packets, &u.pfik_packets,
 			    sizeof (u.pfik_packets));
-			bcopy(p->pfik_bytes, &u.pfik_bytes,
+			bcopy(ctr.pkc_bytes, &u.pfik_bytes,
 			    sizeof (u.pfik_bytes));
 			u.pfik_tzero = p->pfik_tzero;
 			u.pfik_flags = p->pfik_flags;
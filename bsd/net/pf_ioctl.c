@@ -278,13 +278,15 @@ static int		 pf_rtlabel_add(struct pf_addr_wrap *);
 static void		 pf_rtlabel_remove(struct pf_addr_wrap *);
 static void		 pf_rtlabel_copyout(struct pf_addr_wrap *);
 
+static int pf_test_hook(int, int, struct ifnet *, struct mbuf **,
+    struct ip_fw_args *, int);
 #if INET
 static int pf_inet_hook(struct ifnet *, struct mbuf **, int,
-    struct ip_fw_args *);
+    struct ip_fw_args *, int);
 #endif /* INET */
 #if INET6
 static int pf_inet6_hook(struct ifnet *, struct mbuf **, int,
-    struct ip_fw_args *);
+    struct ip_fw_args *, int);
 #endif /* INET6 */
 
 #define	DPFPRINTF(n, x) if (pf_status.debug >= (n)) printf x
@@ -549,6 +551,8 @@ pfinit(void)
 	bzero(&pf_status, sizeof (pf_status));
 	pf_status.debug = PF_DEBUG_URGENT;
 	pf_hash_seed = RandomULong();
+	pf_statetbl_init();
+	pf_rulesnap_init();
 
 	/* XXX do our best to avoid a conflict */
 	pf_status.hostid = random();
@@ -1407,6 +1411,8 @@ pf_rule_copyout(struct pf_rule *src, struct pf_rule *dst)
 
 	dst->entries.tqe_prev = NULL;
 	dst->entries.tqe_next = NULL;
+
+	pf_rulesnap_copyout(src, dst);
 }
 
 static void
@@ -1608,6 +1614,7 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 	int p64 = proc_is64bit(p);
 	int error = 0;
 	int minordev = minor(dev);
+	int excl;
 
 	if (kauth_cred_issuser(kauth_cred_get()) == 0)
 		return (EPERM);
@@ -1755,13 +1762,36 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 	}
 #endif /* PF_ALTQ */
 
-	if (flags & FWRITE)
+	/*
+	 * DIOCINSERTRULE and DIOCDELETERULE change the active rules even
+	 * without FWRITE; the ruleset snapshot and classifier are replaced
+	 * only with pf_perim_lock held exclusive.
+	 */
+	excl = ((flags & FWRITE) || cmd == DIOCINSERTRULE ||
+	    cmd == DIOCDELETERULE);
+	if (excl)
 		lck_rw_lock_exclusive(pf_perim_lock);
 	else
 		lck_rw_lock_shared(pf_perim_lock);
 
 	lck_mtx_lock(pf_lock);
 
+	switch (cmd) {
+	case DIOCXCOMMIT:
+	case DIOCCHANGERULE:
+	case DIOCINSERTRULE:
+	case DIOCDELETERULE:
+		/* these change the active rules; the snapshot goes first */
+		pf_rulesnap_invalidate();
+		pf_rulecls_invalidate();
+		break;
+	case DIOCCLRRULECTRS:
+	case DIOCCLRSTATUS:
+		/* these change the rule counters */
+		pf_rulesnap_invalidate();
+		break;
+	}
+
 	switch (cmd) {
 
 	case DIOCSTART:
@@ -1906,6 +1936,7 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 
 		PFIOC_STRUCT_BEGIN(&pf_status, s, error = ENOMEM; break;);
 		pfi_update_status(s->ifname, s);
+		pf_rulesnap_status(s);
 		PFIOC_STRUCT_END(s, addr);
 		break;
 	}
@@ -2320,6 +2351,11 @@ pfioctl(dev_t dev, u_long cmd, caddr_t addr, int flags, struct proc *p)
 		break;
 	}
 
+	if (excl) {
+		pf_rulecls_update();
+		pf_rulesnap_update();
+	}
+
 	lck_mtx_unlock(pf_lock);
 	lck_rw_done(pf_perim_lock);
 
@@ -3271,6 +3307,7 @@ pfioctl_ioc_rule(u_long cmd, int minordev, struct pfioc_rule *pr, struct proc *p
 			rule->evaluations = 0;
 			rule->packets[0] = rule->packets[1] = 0;
 			rule->bytes[0] = rule->bytes[1] = 0;
+			pf_rulesnap_clear(rule);
 		}
 		break;
 	}
@@ -4856,15 +4893,18 @@ pf_af_hook(struct ifnet *ifp, struct mbuf **mppn, struct mbuf **mp,
 	struct mbuf *nextpkt;
 	net_thread_marks_t marks;
 	struct ifnet * pf_ifp = ifp;
+	int locked;
 
 	marks = net_thread_marks_push(NET_THREAD_HELD_PF);
 
-	if (marks != net_thread_marks_none) {
-		lck_rw_lock_shared(pf_perim_lock);
-		if (!pf_is_enabled)
-			goto done;
-		lck_mtx_lock(pf_lock);
-	}
+	/*
+	 * pf_perim_lock and pf_lock are taken further down, and only if the
+	 * ruleset snapshot can't decide the packet; when re-entered from
+	 * within pf this thread already holds them.
+	 */
+	locked = (marks == net_thread_marks_none);
+	if (!locked && !pf_is_enabled)
+		goto done;
 
 	if (mppn != NULL && *mppn != NULL)
 		VERIFY(*mppn == *mp);
@@ -4890,13 +4930,13 @@ pf_af_hook(struct ifnet *ifp, struct mbuf **mppn, struct mbuf **mp,
 	switch (af) {
 #if INET
 	case AF_INET: {
-		error = pf_inet_hook(pf_ifp, mp, input, fwa);
+		error = pf_inet_hook(pf_ifp, mp, input, fwa, locked);
 		break;
 	}
 #endif /* INET */
 #if INET6
 	case AF_INET6:
-		error = pf_inet6_hook(pf_ifp, mp, input, fwa);
+		error = pf_inet6_hook(pf_ifp, mp, input, fwa, locked);
 		break;
 #endif /* INET6 */
 	default:
@@ -4918,22 +4958,61 @@ pf_af_hook(struct ifnet *ifp, struct mbuf **mppn, struct mbuf **mp,
 			*mppn = nextpkt;
 	}
 
-	if (marks != net_thread_marks_none)
-		lck_mtx_unlock(pf_lock);
-
 done:
-	if (marks != net_thread_marks_none)
-		lck_rw_done(pf_perim_lock);
-
 	net_thread_marks_pop(marks);
 	return (error);
 }
 
 
+/*
+ * Filter one packet against the lock-free ruleset snapshot when the
+ * caller doesn't hold pf_lock, and with pf_test() or pf_test6() under
+ * pf_perim_lock and pf_lock when it does or when the snapshot can't
+ * decide the packet.
+ */
+static int
+pf_test_hook(int af, int dir, struct ifnet *ifp, struct mbuf **mp,
+    struct ip_fw_args *fwa, int locked)
+{
+	int action = PF_PASS;
+
+	if (!locked && (fwa == NULL || fwa->fwa_pf_rule == NULL) &&
+	    pf_rulesnap_test(af, dir, ifp, mp, &action))
+		return (action);
+
+	if (!locked) {
+		lck_rw_lock_shared(pf_perim_lock);
+		/* pf may have been stopped since pf_af_hook() looked */
+		if (!pf_is_enabled) {
+			lck_rw_done(pf_perim_lock);
+			return (PF_PASS);
+		}
+		lck_mtx_lock(pf_lock);
+	}
+	switch (af) {
+#if INET
+	case AF_INET:
+		action = pf_test(dir, ifp, mp, NULL, fwa);
+		break;
+#endif /* INET */
+#if INET6
+	case AF_INET6:
+		action = pf_test6(dir, ifp, mp, NULL, fwa);
+		break;
+#endif /* INET6 */
+	}
+	if (!locked) {
+		lck_mtx_unlock(pf_lock);
+		lck_rw_done(pf_perim_lock);
+	}
+
+	return (action);
+}
+
 #if INET
 static int
 pf_inet_hook(struct ifnet *ifp, struct mbuf **mp, int input,
-    struct ip_fw_args *fwa)
+    struct ip_fw_args *fwa, int locked)
 {
 	struct mbuf *m = *mp;
 #if BYTE_ORDER != BIG_ENDIAN
@@ -4963,7 +5042,8 @@ pf_inet_hook(struct ifnet *ifp, struct mbuf **mp, int input,
 	HTONS(ip->ip_len);
 	HTONS(ip->ip_off);
 #endif
-	if (pf_test(input ? PF_IN : PF_OUT, ifp, mp, NULL, fwa) != PF_PASS) {
+	if (pf_test_hook(AF_INET, input ? PF_IN : PF_OUT, ifp, mp, fwa,
+	    locked) != PF_PASS) {
 		if (*mp != NULL) {
 			m_freem(*mp);
 			*mp = NULL;
@@ -4988,7 +5068,7 @@ pf_inet_hook(struct ifnet *ifp, struct mbuf **mp, int input,
 #if INET6
 int
 pf_inet6_hook(struct ifnet *ifp, struct mbuf **mp, int input,
-    struct ip_fw_args *fwa)
+    struct ip_fw_args *fwa, int locked)
 {
 	int error = 0;
 
@@ -5014,7 +5094,8 @@ pf_inet6_hook(struct ifnet *ifp, struct mbuf **mp, int input,
 		}
 	}
 
-	if (pf_test6(input ? PF_IN : PF_OUT, ifp, mp, NULL, fwa) != PF_PASS) {
+	if (pf_test_hook(AF_INET6, input ? PF_IN : PF_OUT, ifp, mp, fwa,
+	    locked) != PF_PASS) {
 		if (*mp != NULL) {
 			m_freem(*mp);
 			*mp = NULL;
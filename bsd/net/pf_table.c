@@ -124,6 +124,8 @@
 #define ENQUEUE_UNMARKED_ONLY	(1)
 #define INVERT_NEG_FLAG		(1)
 
+#define	PFR_CSET_MINADDRS	1024	/* below this, define into radix */
+
 struct pfr_walktree {
 	enum pfrw_op {
 		PFRW_MARK,
@@ -139,6 +141,7 @@ struct pfr_walktree {
 		user_addr_t		 pfrw1_astats;
 		struct pfr_kentryworkq	*pfrw1_workq;
 		struct pfr_kentry	*pfrw1_kentry;
+		struct pfr_centry	*pfrw1_centry;
 		struct pfi_dynaddr	*pfrw1_dyn;
 	}	 pfrw_1;
 	int	 pfrw_free;
@@ -148,6 +151,7 @@ struct pfr_walktree {
 #define pfrw_astats	pfrw_1.pfrw1_astats
 #define pfrw_workq	pfrw_1.pfrw1_workq
 #define pfrw_kentry	pfrw_1.pfrw1_kentry
+#define pfrw_centry	pfrw_1.pfrw1_centry
 #define pfrw_dyn	pfrw_1.pfrw1_dyn
 #define pfrw_cnt	pfrw_free
 
@@ -199,6 +203,12 @@ static void pfr_clean_node_mask(struct pfr_ktable *, struct pfr_kentryworkq *);
 static int pfr_table_count(struct pfr_table *, int);
 static int pfr_skip_table(struct pfr_table *, struct pfr_ktable *, int);
 static struct pfr_kentry *pfr_kentry_byidx(struct pfr_ktable *, int, int);
+static void pfr_copyout_centry(struct pfr_addr *, struct pfr_centry *);
+static int pfr_cset_load(struct pfr_ktable *, user_addr_t, int, int);
+static int pfr_cset_walk(struct pfr_ktable *, sa_family_t,
+    struct pfr_walktree *);
+static int pfr_cset_expand(struct pfr_ktable *);
+static struct pfr_centry *pfr_centry_byidx(struct pfr_ktable *, int, int);
 
 RB_PROTOTYPE_SC(static, pfr_ktablehead, pfr_ktable, pfrkt_tree,
     pfr_ktable_compare);
@@ -250,6 +260,16 @@ pfr_clr_addrs(struct pfr_table *tbl, int *ndel, int flags)
 		return (ESRCH);
 	if (kt->pfrkt_flags & PFR_TFLAG_CONST)
 		return (EPERM);
+	if (kt->pfrkt_cset != NULL) {
+		if (ndel != NULL)
+			*ndel = kt->pfrkt_cnt;
+		if (!(flags & PFR_FLAG_DUMMY)) {
+			pfr_cset_free(kt->pfrkt_cset);
+			kt->pfrkt_cset = NULL;
+			kt->pfrkt_cnt = 0;
+		}
+		return (0);
+	}
 	pfr_enqueue_addrs(kt, &workq, ndel, 0);
 
 	if (!(flags & PFR_FLAG_DUMMY)) {
@@ -284,6 +304,8 @@ pfr_add_addrs(struct pfr_table *tbl, user_addr_t _addr, int size,
 		return (ESRCH);
 	if (kt->pfrkt_flags & PFR_TFLAG_CONST)
 		return (EPERM);
+	if ((rv = pfr_cset_expand(kt)) != 0)
+		return (rv);
 	tmpkt = pfr_create_ktable(&pfr_nulltable, 0, 0);
 	if (tmpkt == NULL)
 		return (ENOMEM);
@@ -360,6 +382,8 @@ pfr_del_addrs(struct pfr_table *tbl, user_addr_t _addr, int size,
 		return (ESRCH);
 	if (kt->pfrkt_flags & PFR_TFLAG_CONST)
 		return (EPERM);
+	if ((rv = pfr_cset_expand(kt)) != 0)
+		return (rv);
 	/*
 	 * there are two algorithms to choose from here.
 	 * with:
@@ -450,6 +474,8 @@ pfr_set_addrs(struct pfr_table *tbl, user_addr_t _addr, int size,
 		return (ESRCH);
 	if (kt->pfrkt_flags & PFR_TFLAG_CONST)
 		return (EPERM);
+	if ((rv = pfr_cset_expand(kt)) != 0)
+		return (rv);
 	tmpkt = pfr_create_ktable(&pfr_nulltable, 0, 0);
 	if (tmpkt == NULL)
 		return (ENOMEM);
@@ -548,6 +574,7 @@ pfr_tst_addrs(struct pfr_table *tbl, user_addr_t addr, int size,
 {
 	struct pfr_ktable	*kt;
 	struct pfr_kentry	*p;
+	struct pfr_centry	*ce;
 	struct pfr_addr		 ad;
 	int			 i, xmatch = 0;
 
@@ -565,13 +592,24 @@ pfr_tst_addrs(struct pfr_table *tbl, user_addr_t addr, int size,
 			return (EINVAL);
 		if (ADDR_NETWORK(&ad))
 			return (EINVAL);
-		p = pfr_lookup_addr(kt, &ad, 0);
-		if (flags & PFR_FLAG_REPLACE)
-			pfr_copyout_addr(&ad, p);
-		ad.pfra_fback = (p == NULL) ? PFR_FB_NONE :
-		    (p->pfrke_not ? PFR_FB_NOTMATCH : PFR_FB_MATCH);
-		if (p != NULL && !p->pfrke_not)
-			xmatch++;
+		if (kt->pfrkt_cset != NULL) {
+			ce = pfr_cset_match(kt->pfrkt_cset,
+			    (struct pf_addr *)&ad.pfra_u, ad.pfra_af);
+			if (flags & PFR_FLAG_REPLACE)
+				pfr_copyout_centry(&ad, ce);
+			ad.pfra_fback = (ce == NULL) ? PFR_FB_NONE :
+			    (ce->pfrce_not ? PFR_FB_NOTMATCH : PFR_FB_MATCH);
+			if (ce != NULL && !ce->pfrce_not)
+				xmatch++;
+		} else {
+			p = pfr_lookup_addr(kt, &ad, 0);
+			if (flags & PFR_FLAG_REPLACE)
+				pfr_copyout_addr(&ad, p);
+			ad.pfra_fback = (p == NULL) ? PFR_FB_NONE :
+			    (p->pfrke_not ? PFR_FB_NOTMATCH : PFR_FB_MATCH);
+			if (p != NULL && !p->pfrke_not)
+				xmatch++;
+		}
 		if (COPYOUT(&ad, addr, sizeof (ad), flags))
 			return (EFAULT);
 	}
@@ -604,10 +642,15 @@ pfr_get_addrs(struct pfr_table *tbl, user_addr_t addr, int *size,
 	w.pfrw_addr = addr;
 	w.pfrw_free = kt->pfrkt_cnt;
 	w.pfrw_flags = flags;
-	rv = kt->pfrkt_ip4->rnh_walktree(kt->pfrkt_ip4, pfr_walktree, &w);
-	if (!rv)
-		rv = kt->pfrkt_ip6->rnh_walktree(kt->pfrkt_ip6,
+	if (kt->pfrkt_cset != NULL) {
+		rv = pfr_cset_walk(kt, 0, &w);
+	} else {
+		rv = kt->pfrkt_ip4->rnh_walktree(kt->pfrkt_ip4,
 		    pfr_walktree, &w);
+		if (!rv)
+			rv = kt->pfrkt_ip6->rnh_walktree(kt->pfrkt_ip6,
+			    pfr_walktree, &w);
+	}
 	if (rv)
 		return (rv);
 
@@ -647,10 +690,15 @@ pfr_get_astats(struct pfr_table *tbl, user_addr_t addr, int *size,
 	w.pfrw_astats = addr;
 	w.pfrw_free = kt->pfrkt_cnt;
 	w.pfrw_flags = flags;
-	rv = kt->pfrkt_ip4->rnh_walktree(kt->pfrkt_ip4, pfr_walktree, &w);
-	if (!rv)
-		rv = kt->pfrkt_ip6->rnh_walktree(kt->pfrkt_ip6,
+	if (kt->pfrkt_cset != NULL) {
+		rv = pfr_cset_walk(kt, 0, &w);
+	} else {
+		rv = kt->pfrkt_ip4->rnh_walktree(kt->pfrkt_ip4,
 		    pfr_walktree, &w);
+		if (!rv)
+			rv = kt->pfrkt_ip6->rnh_walktree(kt->pfrkt_ip6,
+			    pfr_walktree, &w);
+	}
 	if (!rv && (flags & PFR_FLAG_CLSTATS)) {
 		pfr_enqueue_addrs(kt, &workq, NULL, 0);
 		pfr_clstats_kentries(&workq, tzero, 0);
@@ -674,6 +722,7 @@ pfr_clr_astats(struct pfr_table *tbl, user_addr_t _addr, int size,
 	struct pfr_ktable	*kt;
 	struct pfr_kentryworkq	 workq;
 	struct pfr_kentry	*p;
+	struct pfr_centry	*ce;
 	struct pfr_addr		 ad;
 	user_addr_t		 addr = _addr;
 	int			 i, rv, xzero = 0;
@@ -692,8 +741,11 @@ pfr_clr_astats(struct pfr_table *tbl, user_addr_t _addr, int size,
 		if (pfr_validate_addr(&ad))
 			senderr(EINVAL);
 		p = pfr_lookup_addr(kt, &ad, 1);
+		/* compact entries have no counters, only report them */
+		ce = (kt->pfrkt_cset != NULL) ?
+		    pfr_cset_lookup(kt->pfrkt_cset, &ad) : NULL;
 		if (flags & PFR_FLAG_FEEDBACK) {
-			ad.pfra_fback = (p != NULL) ?
+			ad.pfra_fback = (p != NULL || ce != NULL) ?
 			    PFR_FB_CLEARED : PFR_FB_NONE;
 			if (COPYOUT(&ad, addr, sizeof (ad), flags))
 				senderr(EFAULT);
@@ -701,6 +753,8 @@ pfr_clr_astats(struct pfr_table *tbl, user_addr_t _addr, int size,
 		if (p != NULL) {
 			SLIST_INSERT_HEAD(&workq, p, pfrke_workq);
 			xzero++;
+		} else if (ce != NULL) {
+			xzero++;
 		}
 	}
 
@@ -890,6 +944,9 @@ pfr_insert_kentry(struct pfr_ktable *kt, struct pfr_addr *ad, u_int64_t tzero)
 	struct pfr_kentry	*p;
 	int			 rv;
 
+	/* compact tables are only rebuilt through pfr_ina_define() */
+	if (kt->pfrkt_cset != NULL)
+		return (EPERM);
 	p = pfr_lookup_addr(kt, ad, 1);
 	if (p != NULL)
 		return (0);
@@ -1059,6 +1116,21 @@ pfr_copyout_addr(struct pfr_addr *ad, struct pfr_kentry *ke)
 		ad->pfra_ip6addr = ke->pfrke_sa.sin6.sin6_addr;
 }
 
+static void
+pfr_copyout_centry(struct pfr_addr *ad, struct pfr_centry *ce)
+{
+	bzero(ad, sizeof (*ad));
+	if (ce == NULL)
+		return;
+	ad->pfra_af = ce->pfrce_af;
+	ad->pfra_net = ce->pfrce_net;
+	ad->pfra_not = ce->pfrce_not;
+	if (ad->pfra_af == AF_INET)
+		ad->pfra_ip4addr = ce->pfrce_addr.v4;
+	else if (ad->pfra_af == AF_INET6)
+		ad->pfra_ip6addr = ce->pfrce_addr.v6;
+}
+
 static int
 pfr_walktree(struct radix_node *rn, void *arg)
 {
@@ -1557,22 +1629,29 @@ _skip:
 		return (ENOMEM);
 	}
 	SLIST_INIT(&addrq);
-	for (i = 0; i < size; i++, addr += sizeof (ad)) {
-		if (COPYIN(addr, &ad, sizeof (ad), flags))
-			senderr(EFAULT);
-		if (pfr_validate_addr(&ad))
-			senderr(EINVAL);
-		if (pfr_lookup_addr(shadow, &ad, 1) != NULL)
-			continue;
-		p = pfr_create_kentry(&ad, 0);
-		if (p == NULL)
-			senderr(ENOMEM);
-		if (pfr_route_kentry(shadow, p)) {
-			pfr_destroy_kentry(p);
-			continue;
+	if (size >= PFR_CSET_MINADDRS) {
+		/* large bulk loads bypass the radix tree altogether */
+		if ((rv = pfr_cset_load(shadow, addr, size, flags)) != 0)
+			senderr(rv);
+		xaddr = shadow->pfrkt_cset->pcs_nent;
+	} else {
+		for (i = 0; i < size; i++, addr += sizeof (ad)) {
+			if (COPYIN(addr, &ad, sizeof (ad), flags))
+				senderr(EFAULT);
+			if (pfr_validate_addr(&ad))
+				senderr(EINVAL);
+			if (pfr_lookup_addr(shadow, &ad, 1) != NULL)
+				continue;
+			p = pfr_create_kentry(&ad, 0);
+			if (p == NULL)
+				senderr(ENOMEM);
+			if (pfr_route_kentry(shadow, p)) {
+				pfr_destroy_kentry(p);
+				continue;
+			}
+			SLIST_INSERT_HEAD(&addrq, p, pfrke_workq);
+			xaddr++;
 		}
-		SLIST_INSERT_HEAD(&addrq, p, pfrke_workq);
-		xaddr++;
 	}
 	if (!(flags & PFR_FLAG_DUMMY)) {
 		if (kt->pfrkt_shadow != NULL)
@@ -1689,7 +1768,21 @@ pfr_commit_ktable(struct pfr_ktable *kt, u_int64_t tzero)
 	if (shadow->pfrkt_cnt == NO_ADDRESSES) {
 		if (!(kt->pfrkt_flags & PFR_TFLAG_ACTIVE))
 			pfr_clstats_ktable(kt, tzero, 1);
-	} else if (kt->pfrkt_flags & PFR_TFLAG_ACTIVE) {
+	} else if (shadow->pfrkt_cset != NULL) {
+		/* compact shadow replaces whatever kt held */
+		struct pfr_kentryworkq	 addrq;
+		struct pfr_cset		*cs = kt->pfrkt_cset;
+
+		pfr_enqueue_addrs(kt, &addrq, NULL, 0);
+		pfr_remove_kentries(kt, &addrq);
+		kt->pfrkt_cset = shadow->pfrkt_cset;
+		kt->pfrkt_cnt = shadow->pfrkt_cnt;
+		shadow->pfrkt_cset = NULL;
+		if (cs != NULL)
+			pfr_cset_free(cs);
+		pfr_clstats_ktable(kt, tzero, 1);
+	} else if ((kt->pfrkt_flags & PFR_TFLAG_ACTIVE) &&
+	    kt->pfrkt_cset == NULL) {
 		/* kt might contain addresses */
 		struct pfr_kentryworkq	 addrq, addq, changeq, delq, garbageq;
 		struct pfr_kentry	*p, *q, *next;
@@ -1723,12 +1816,16 @@ pfr_commit_ktable(struct pfr_ktable *kt, u_int64_t tzero)
 		pfr_clstats_kentries(&changeq, tzero, INVERT_NEG_FLAG);
 		pfr_destroy_kentries(&garbageq);
 	} else {
-		/* kt cannot contain addresses */
+		/* kt cannot contain radix addresses */
 		SWAP(struct radix_node_head *, kt->pfrkt_ip4,
 		    shadow->pfrkt_ip4);
 		SWAP(struct radix_node_head *, kt->pfrkt_ip6,
 		    shadow->pfrkt_ip6);
 		SWAP(int, kt->pfrkt_cnt, shadow->pfrkt_cnt);
+		if (kt->pfrkt_cset != NULL) {
+			pfr_cset_free(kt->pfrkt_cset);
+			kt->pfrkt_cset = NULL;
+		}
 		pfr_clstats_ktable(kt, tzero, 1);
 	}
 	nflags = ((shadow->pfrkt_flags & PFR_TFLAG_USRMASK) |
@@ -1880,6 +1977,11 @@ pfr_setflags_ktable(struct pfr_ktable *kt, int newf)
 		pfr_ktable_cnt--;
 		return;
 	}
+	if (!(newf & PFR_TFLAG_ACTIVE) && kt->pfrkt_cset != NULL) {
+		pfr_cset_free(kt->pfrkt_cset);
+		kt->pfrkt_cset = NULL;
+		kt->pfrkt_cnt = 0;
+	}
 	if (!(newf & PFR_TFLAG_ACTIVE) && kt->pfrkt_cnt) {
 		pfr_enqueue_addrs(kt, &addrq, NULL, 0);
 		pfr_remove_kentries(kt, &addrq);
@@ -1984,6 +2086,8 @@ pfr_destroy_ktable(struct pfr_ktable *kt, int flushaddr)
 		_FREE((caddr_t)kt->pfrkt_ip4, M_RTABLE);
 	if (kt->pfrkt_ip6 != NULL)
 		_FREE((caddr_t)kt->pfrkt_ip6, M_RTABLE);
+	if (kt->pfrkt_cset != NULL)
+		pfr_cset_free(kt->pfrkt_cset);
 	if (kt->pfrkt_shadow != NULL)
 		pfr_destroy_ktable(kt->pfrkt_shadow, flushaddr);
 	if (kt->pfrkt_rs != NULL) {
@@ -2017,6 +2121,7 @@ int
 pfr_match_addr(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af)
 {
 	struct pfr_kentry	*ke = NULL;
+	struct pfr_centry	*ce;
 	int			 match;
 
 	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
@@ -2026,6 +2131,11 @@ pfr_match_addr(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af)
 	if (!(kt->pfrkt_flags & PFR_TFLAG_ACTIVE))
 		return (0);
 
+	if (kt->pfrkt_cset != NULL) {
+		ce = pfr_cset_match(kt->pfrkt_cset, a, af);
+		match = (ce && !ce->pfrce_not);
+		goto done;
+	}
 	switch (af) {
 #if INET
 	case AF_INET:
@@ -2045,6 +2155,7 @@ pfr_match_addr(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af)
 #endif /* INET6 */
 	}
 	match = (ke && !ke->pfrke_not);
+done:
 	if (match)
 		kt->pfrkt_match++;
 	else
@@ -2057,6 +2168,8 @@ pfr_update_stats(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af,
     u_int64_t len, int dir_out, int op_pass, int notrule)
 {
 	struct pfr_kentry	*ke = NULL;
+	struct pfr_centry	*ce;
+	int			 nomatch;
 
 	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
 
@@ -2065,6 +2178,12 @@ pfr_update_stats(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af,
 	if (!(kt->pfrkt_flags & PFR_TFLAG_ACTIVE))
 		return;
 
+	if (kt->pfrkt_cset != NULL) {
+		/* compact tables only keep table-level counters */
+		ce = pfr_cset_match(kt->pfrkt_cset, a, af);
+		nomatch = (ce == NULL || ce->pfrce_not);
+		goto done;
+	}
 	switch (af) {
 #if INET
 	case AF_INET:
@@ -2085,7 +2204,9 @@ pfr_update_stats(struct pfr_ktable *kt, struct pf_addr *a, sa_family_t af,
 	default:
 		;
 	}
-	if ((ke == NULL || ke->pfrke_not) != notrule) {
+	nomatch = (ke == NULL || ke->pfrke_not);
+done:
+	if (nomatch != notrule) {
 		if (op_pass != PFR_OP_PASS)
 			printf("pfr_update_stats: assertion failed.\n");
 		op_pass = PFR_OP_XPASS;
@@ -2152,10 +2273,11 @@ int
 pfr_pool_get(struct pfr_ktable *kt, int *pidx, struct pf_addr *counter,
     struct pf_addr **raddr, struct pf_addr **rmask, sa_family_t af)
 {
-	struct pfr_kentry	*ke, *ke2;
+	struct pfr_kentry	*ke = NULL, *ke2;
+	struct pfr_centry	*ce = NULL, *ce2;
 	struct pf_addr		*addr;
 	union sockaddr_union	 mask;
-	int			 idx = -1, use_counter = 0;
+	int			 idx = -1, use_counter = 0, net, same;
 
 	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
 
@@ -2179,13 +2301,24 @@ pfr_pool_get(struct pfr_ktable *kt, int *pidx, struct pf_addr *counter,
 		idx = 0;
 
 _next_block:
-	ke = pfr_kentry_byidx(kt, idx, af);
-	if (ke == NULL) {
-		kt->pfrkt_nomatch++;
-		return (1);
+	if (kt->pfrkt_cset != NULL) {
+		ce = pfr_centry_byidx(kt, idx, af);
+		if (ce == NULL) {
+			kt->pfrkt_nomatch++;
+			return (1);
+		}
+		net = ce->pfrce_net;
+		*raddr = &ce->pfrce_addr;
+	} else {
+		ke = pfr_kentry_byidx(kt, idx, af);
+		if (ke == NULL) {
+			kt->pfrkt_nomatch++;
+			return (1);
+		}
+		net = ke->pfrke_net;
+		*raddr = SUNION2PF(&ke->pfrke_sa, af);
 	}
-	pfr_prepare_network(&pfr_mask, af, ke->pfrke_net);
-	*raddr = SUNION2PF(&ke->pfrke_sa, af);
+	pfr_prepare_network(&pfr_mask, af, net);
 	*rmask = SUNION2PF(&pfr_mask, af);
 
 	if (use_counter) {
@@ -2202,7 +2335,7 @@ _next_block:
 		PF_ACPY(addr, *raddr, af);
 	}
 
-	if (!KENTRY_NETWORK(ke)) {
+	if (net >= AF_BITS(af)) {
 		/* this is a single IP address - no possible nested block */
 		PF_ACPY(counter, addr, af);
 		*pidx = idx;
@@ -2211,16 +2344,25 @@ _next_block:
 	}
 	for (;;) {
 		/* we don't want to use a nested block */
-		if (af == AF_INET)
-			ke2 = (struct pfr_kentry *)rn_match(&pfr_sin,
-			    kt->pfrkt_ip4);
-		else if (af == AF_INET6)
-			ke2 = (struct pfr_kentry *)rn_match(&pfr_sin6,
-			    kt->pfrkt_ip6);
-		else
-			return (-1); /* never happens */
-		/* no need to check KENTRY_RNF_ROOT() here */
-		if (ke2 == ke) {
+		if (ce != NULL) {
+			/* addr is within ce, so there is always a match */
+			ce2 = pfr_cset_match(kt->pfrkt_cset, addr, af);
+			same = (ce2 == ce);
+			net = ce2->pfrce_net;
+		} else {
+			if (af == AF_INET)
+				ke2 = (struct pfr_kentry *)rn_match(&pfr_sin,
+				    kt->pfrkt_ip4);
+			else if (af == AF_INET6)
+				ke2 = (struct pfr_kentry *)rn_match(&pfr_sin6,
+				    kt->pfrkt_ip6);
+			else
+				return (-1); /* never happens */
+			/* no need to check KENTRY_RNF_ROOT() here */
+			same = (ke2 == ke);
+			net = ke2->pfrke_net;
+		}
+		if (same) {
 			/* lookup return the same block - perfect */
 			PF_ACPY(counter, addr, af);
 			*pidx = idx;
@@ -2229,7 +2371,7 @@ _next_block:
 		}
 
 		/* we need to increase the counter past the nested block */
-		pfr_prepare_network(&mask, AF_INET, ke2->pfrke_net);
+		pfr_prepare_network(&mask, AF_INET, net);
 		PF_POOLMASK(addr, addr, SUNION2PF(&mask, af), &pfr_ffaddr, af);
 		PF_AINC(addr, af);
 		if (!PF_MATCHA(0, *raddr, *rmask, addr, af)) {
@@ -2284,6 +2426,10 @@ pfr_dynaddr_update(struct pfr_ktable *kt, struct pfi_dynaddr *dyn)
 
 	dyn->pfid_acnt4 = 0;
 	dyn->pfid_acnt6 = 0;
+	if (kt->pfrkt_cset != NULL) {
+		(void) pfr_cset_walk(kt, dyn->pfid_af, &w);
+		return;
+	}
 	if (!dyn->pfid_af || dyn->pfid_af == AF_INET)
 		(void) kt->pfrkt_ip4->rnh_walktree(kt->pfrkt_ip4,
 		    pfr_walktree, &w);
@@ -2291,3 +2437,177 @@ pfr_dynaddr_update(struct pfr_ktable *kt, struct pfi_dynaddr *dyn)
 		(void) kt->pfrkt_ip6->rnh_walktree(kt->pfrkt_ip6,
 		    pfr_walktree, &w);
 }
+
+/*
+ * Compact tables; the set itself is built and searched in pf_cset.c.
+ */
+static int
+pfr_cset_load(struct pfr_ktable *kt, user_addr_t addr, int size, int flags)
+{
+	struct pfr_centry	*ent;
+	struct pfr_addr		 ad;
+	struct pfr_cset		*cs;
+	u_int32_t		 i;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (size > INT_MAX / (int)sizeof (*ent))
+		return (ENOMEM);
+	ent = _MALLOC(size * sizeof (*ent), M_RTABLE, M_WAITOK | M_ZERO);
+	if (ent == NULL)
+		return (ENOMEM);
+	for (i = 0; i < (u_int32_t)size; i++, addr += sizeof (ad)) {
+		if (COPYIN(addr, &ad, sizeof (ad), flags)) {
+			_FREE(ent, M_RTABLE);
+			return (EFAULT);
+		}
+		if (pfr_validate_addr(&ad)) {
+			_FREE(ent, M_RTABLE);
+			return (EINVAL);
+		}
+		bcopy(&ad.pfra_u, &ent[i].pfrce_addr, sizeof (ad.pfra_u));
+		ent[i].pfrce_seq = i;
+		ent[i].pfrce_af = ad.pfra_af;
+		ent[i].pfrce_net = ad.pfra_net;
+		ent[i].pfrce_not = ad.pfra_not;
+	}
+	cs = pfr_cset_create(ent, size);
+	if (cs == NULL) {
+		_FREE(ent, M_RTABLE);
+		return (ENOMEM);
+	}
+	kt->pfrkt_cset = cs;
+	return (0);
+}
+
+/*
+ * The pfr_walktree() operations that make sense for a compact table,
+ * over the entries of family af (0 for both).
+ */
+static int
+pfr_cset_walk(struct pfr_ktable *kt, sa_family_t af, struct pfr_walktree *w)
+{
+	struct pfr_cset		*cs = kt->pfrkt_cset;
+	struct pfr_centry	*ce;
+	int			 flags = w->pfrw_flags;
+	u_int32_t		 i;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	for (i = 0; i < cs->pcs_nent; i++) {
+		ce = &cs->pcs_ent[i];
+		if (af != 0 && ce->pfrce_af != af)
+			continue;
+		switch (w->pfrw_op) {
+		case PFRW_GET_ADDRS:
+			if (w->pfrw_free-- > 0) {
+				struct pfr_addr ad;
+
+				pfr_copyout_centry(&ad, ce);
+				if (copyout(&ad, w->pfrw_addr, sizeof (ad)))
+					return (EFAULT);
+				w->pfrw_addr += sizeof (ad);
+			}
+			break;
+		case PFRW_GET_ASTATS:
+			if (w->pfrw_free-- > 0) {
+				struct pfr_astats as;
+
+				/* no per-address counters to report */
+				bzero(&as, sizeof (as));
+				pfr_copyout_centry(&as.pfras_a, ce);
+				as.pfras_tzero = kt->pfrkt_tzero;
+
+				if (COPYOUT(&as, w->pfrw_astats, sizeof (as),
+				    flags))
+					return (EFAULT);
+				w->pfrw_astats += sizeof (as);
+			}
+			break;
+		case PFRW_POOL_GET:
+			if (ce->pfrce_not)
+				break; /* negative entries are ignored */
+			if (!w->pfrw_cnt--) {
+				w->pfrw_centry = ce;
+				return (1); /* finish search */
+			}
+			break;
+		case PFRW_DYNADDR_UPDATE:
+			if (ce->pfrce_af == AF_INET) {
+				if (w->pfrw_dyn->pfid_acnt4++ > 0)
+					break;
+				pfr_prepare_network(&pfr_mask, AF_INET,
+				    ce->pfrce_net);
+				w->pfrw_dyn->pfid_addr4 = ce->pfrce_addr;
+				w->pfrw_dyn->pfid_mask4 = *SUNION2PF(
+				    &pfr_mask, AF_INET);
+			} else if (ce->pfrce_af == AF_INET6) {
+				if (w->pfrw_dyn->pfid_acnt6++ > 0)
+					break;
+				pfr_prepare_network(&pfr_mask, AF_INET6,
+				    ce->pfrce_net);
+				w->pfrw_dyn->pfid_addr6 = ce->pfrce_addr;
+				w->pfrw_dyn->pfid_mask6 = *SUNION2PF(
+				    &pfr_mask, AF_INET6);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return (0);
+}
+
+static struct pfr_centry *
+pfr_centry_byidx(struct pfr_ktable *kt, int idx, int af)
+{
+	struct pfr_walktree	w;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	bzero(&w, sizeof (w));
+	w.pfrw_op = PFRW_POOL_GET;
+	w.pfrw_cnt = idx;
+	(void) pfr_cset_walk(kt, af, &w);
+	return (w.pfrw_centry);
+}
+
+/*
+ * Convert a compact table back into radix entries so that it can be
+ * changed incrementally.  The table keeps its contents if this fails.
+ */
+static int
+pfr_cset_expand(struct pfr_ktable *kt)
+{
+	struct pfr_cset		*cs = kt->pfrkt_cset;
+	struct pfr_ktable	*tmpkt;
+	struct pfr_kentry	*p;
+	struct pfr_addr		 ad;
+	u_int32_t		 i;
+
+	lck_mtx_assert(pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (cs == NULL)
+		return (0);
+	tmpkt = pfr_create_ktable(&pfr_nulltable, 0, 0);
+	if (tmpkt == NULL)
+		return (ENOMEM);
+	for (i = 0; i < cs->pcs_nent; i++) {
+		pfr_copyout_centry(&ad, &cs->pcs_ent[i]);
+		p = pfr_create_kentry(&ad, 0);
+		if (p == NULL) {
+			pfr_destroy_ktable(tmpkt, 1);
+			return (ENOMEM);
+		}
+		p->pfrke_tzero = kt->pfrkt_tzero;
+		if (pfr_route_kentry(tmpkt, p))
+			pfr_destroy_kentry(p);
+	}
+	/* kt's own radix heads are empty while it holds a cset */
+	SWAP(struct radix_node_head *, kt->pfrkt_ip4, tmpkt->pfrkt_ip4);
+	SWAP(struct radix_node_head *, kt->pfrkt_ip6, tmpkt->pfrkt_ip6);
+	kt->pfrkt_cset = NULL;
+	pfr_cset_free(cs);
+	pfr_destroy_ktable(tmpkt, 0);
+	return (0);
+}
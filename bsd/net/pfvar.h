@@ -988,6 +988,11 @@ struct pf_state_key_cmp {
 
 TAILQ_HEAD(pf_statelist, pf_state);
 
+/* state key hash tables, indices into pf_state_key entry_hash/hash */
+#define	PF_SH_LAN_EXT	0
+#define	PF_SH_EXT_GWY	1
+#define	PF_SH_MAX	2
+
 struct pf_state_key {
 	struct pf_state_host lan;
 	struct pf_state_host gwy;
@@ -1002,8 +1007,9 @@ struct pf_state_key {
 	u_int32_t	 flowsrc;
 	u_int32_t	 flowhash;
 
-	RB_ENTRY(pf_state_key)	 entry_lan_ext;
-	RB_ENTRY(pf_state_key)	 entry_ext_gwy;
+	/* linkage and hash values in pf_statetbl_{lan_ext,ext_gwy} */
+	LIST_ENTRY(pf_state_key) entry_hash[PF_SH_MAX];
+	u_int32_t	 hash[PF_SH_MAX];
 	struct pf_statelist	 states;
 	u_int32_t	 refcnt;
 };
@@ -1316,6 +1322,45 @@ struct pfr_kentry {
 	u_int8_t		 pfrke_intrpool;
 };
 
+/*
+ * Compact table representation used for large bulk-loaded tables.  The
+ * prefixes are kept sorted in pcs_ent and the address space of each family
+ * is cut into intervals at every prefix boundary; each interval records the
+ * most specific prefix covering it.  A lookup is a binary search over the
+ * interval starts, narrowed for IPv4 by a direct index on the top bits.
+ * The set is immutable once built and is only replaced or freed while
+ * pf_perim_lock is held exclusive, so it may be searched without pf_lock.
+ */
+struct pfr_centry {
+	struct pf_addr		 pfrce_addr;
+	u_int32_t		 pfrce_seq;	/* load order, build only */
+	u_int8_t		 pfrce_af;
+	u_int8_t		 pfrce_net;
+	u_int8_t		 pfrce_not;
+	u_int8_t		 pfrce_pad;
+};
+
+struct pfr_cset_k6 {
+	u_int64_t		 hi;
+	u_int64_t		 lo;
+};
+
+#define	PFR_CSET_NONE		0xffffffff
+
+struct pfr_cset {
+	struct pfr_centry	*pcs_ent;	/* sorted by af, addr, net */
+	u_int32_t		 pcs_nent;
+	u_int32_t		 pcs_v4cnt;
+	u_int32_t		*pcs_v4start;	/* interval starts, host order */
+	u_int32_t		*pcs_v4ent;	/* pcs_ent index or NONE */
+	u_int32_t		*pcs_v4idx;	/* first interval per top bits */
+	u_int32_t		 pcs_v4bits;
+	u_int32_t		 pcs_v6cnt;
+	struct pfr_cset_k6	*pcs_v6start;
+	u_int32_t		*pcs_v6ent;
+	size_t			 pcs_size;	/* bytes, including pcs_ent */
+};
+
 SLIST_HEAD(pfr_ktableworkq, pfr_ktable);
 RB_HEAD(pfr_ktablehead, pfr_ktable);
 struct pfr_ktable {
@@ -1326,6 +1371,7 @@ struct pfr_ktable {
 	struct radix_node_head	*pfrkt_ip6;
 	struct pfr_ktable	*pfrkt_shadow;
 	struct pfr_ktable	*pfrkt_root;
+	struct pfr_cset		*pfrkt_cset;	/* compact addresses, if any */
 	struct pf_ruleset	*pfrkt_rs;
 	u_int64_t		 pfrkt_larg;
 	u_int32_t		 pfrkt_nflags;
@@ -1343,25 +1389,145 @@ struct pfr_ktable {
 #define pfrkt_nomatch	pfrkt_ts.pfrts_nomatch
 #define pfrkt_tzero	pfrkt_ts.pfrts_tzero
 
-RB_HEAD(pf_state_tree_lan_ext, pf_state_key);
-RB_PROTOTYPE_SC(__private_extern__, pf_state_tree_lan_ext, pf_state_key,
-    entry_lan_ext, pf_state_compare_lan_ext);
+/*
+ * State key hash table.  Keys are hashed on the fields that the
+ * corresponding pf_state_compare_{lan_ext,ext_gwy}() always compares,
+ * so keys that compare equal (including wildcard matches on the
+ * external address or port) always share a bucket.  Protected by
+ * pf_lock; resized from the purge thread as the state count changes.
+ */
+LIST_HEAD(pf_state_keyhead, pf_state_key);
 
-RB_HEAD(pf_state_tree_ext_gwy, pf_state_key);
-RB_PROTOTYPE_SC(__private_extern__, pf_state_tree_ext_gwy, pf_state_key,
-    entry_ext_gwy, pf_state_compare_ext_gwy);
+struct pf_state_hash {
+	struct pf_state_keyhead	*psh_buckets;
+	u_int32_t		 psh_nbuckets;	/* power of 2 */
+	u_int32_t		 psh_count;
+	int			 psh_which;	/* PF_SH_* */
+};
 
 RB_HEAD(pfi_ifhead, pfi_kif);
 
 /* state tables */
-extern struct pf_state_tree_lan_ext	 pf_statetbl_lan_ext;
-extern struct pf_state_tree_ext_gwy	 pf_statetbl_ext_gwy;
+extern struct pf_state_hash	 pf_statetbl_lan_ext;
+extern struct pf_state_hash	 pf_statetbl_ext_gwy;
+
+/*
+ * Compiled, read-only copy of the main filter ruleset.  It exists only
+ * while every active rule can be evaluated without pf_lock -- no state,
+ * translation, scrub or dummynet rules, anchors, tables, tags, logging or
+ * route-to -- so pf_af_hook() may filter TCP and UDP packets against it
+ * without taking pf_perim_lock or pf_lock.  Those packets run inside a
+ * reader section (pf_rulesnap_rd_enter/exit) with preemption disabled;
+ * the snapshot, its classifier and any pfi_kif are freed only after
+ * pf_rulesnap_sync() has waited out every section that could see them.
+ * Counters for those packets are kept in per-CPU slots, summed on read,
+ * cleared by moving a baseline and folded back into the rules when the
+ * snapshot is retired.
+ */
+struct pf_rulesnap_rule {
+	struct pf_rule		*psr_rule;
+	struct pfi_kif		*psr_kif;
+	struct pf_rule_addr	 psr_src;
+	struct pf_rule_addr	 psr_dst;
+	u_int32_t		 psr_skip[PF_SKIP_COUNT];
+	u_int32_t		 psr_rule_flag;
+	u_int8_t		 psr_action;
+	u_int8_t		 psr_direction;
+	u_int8_t		 psr_quick;
+	u_int8_t		 psr_ifnot;
+	sa_family_t		 psr_af;
+	u_int8_t		 psr_proto;
+	u_int8_t		 psr_type;
+	u_int8_t		 psr_code;
+	u_int8_t		 psr_flags;
+	u_int8_t		 psr_flagset;
+	u_int8_t		 psr_tos;
+};
+
+struct pf_rulesnap_ctr {
+	u_int64_t		 evaluations;
+	u_int64_t		 packets[2];
+	u_int64_t		 bytes[2];
+};
+
+struct pf_rulesnap {
+	u_int32_t		 prs_nrules;	/* not counting default rule */
+	u_int32_t		 prs_ncpu;
+	size_t			 prs_stride;	/* bytes of counters per CPU */
+	struct pf_rulesnap_rule	*prs_rules;	/* prs_nrules + 1 entries */
+	struct pf_rulecls	*prs_cls;	/* classifier, if any */
+	struct pf_rulesnap_ctr	*prs_base;	/* sums at last clear */
+	caddr_t			 prs_ctrs;	/* per-CPU, cache aligned */
+	void			*prs_ctrs_buf;
+};
+
+extern struct pf_rulesnap	*pf_rulesnap;
+
+/*
+ * Bit-vector classifier over the main filter ruleset.  Each dimension
+ * (direction, protocol, interface, source and destination address per
+ * address family, source and destination port) is split into ranges of
+ * values that no rule tells apart, and each range carries a bitmap of the
+ * rules that may match a packet in it.  ANDing the bitmaps selected by a
+ * packet gives a superset of the matching rules in rule order; those are
+ * the only rules pf_test_rule() then needs to evaluate.  Anything a
+ * dimension can't express (tables, address ranges, dynamic addresses)
+ * makes a rule match the whole dimension.  Replaced only with
+ * pf_perim_lock held exclusive, after the pf_rulesnap that refers to it
+ * (prs_cls) has been retired.
+ */
+struct pf_rulecls_key {
+	u_int64_t		 pck_hi;
+	u_int64_t		 pck_lo;
+};
+
+struct pf_rulecls_dim {
+	u_int32_t		 pcd_nranges;
+	struct pf_rulecls_key	*pcd_lo;	/* range starts, ascending */
+	u_int64_t		*pcd_bits;	/* pcd_nranges bitmaps */
+};
+
+enum {
+	PF_RULECLS_SRC_ADDR,
+	PF_RULECLS_DST_ADDR,
+	PF_RULECLS_SRC_PORT,
+	PF_RULECLS_DST_PORT,
+	PF_RULECLS_NDIMS
+};
+
+struct pf_rulecls {
+	u_int32_t		 pcl_nrules;
+	u_int32_t		 pcl_nwords;	/* 64-bit words per bitmap */
+	struct pf_rule		**pcl_rules;	/* indexed by nr */
+	u_int64_t		*pcl_dir;	/* PF_IN, PF_OUT */
+	u_int16_t		 pcl_proto_row[256];
+	u_int64_t		*pcl_proto;	/* row 0: unnamed protocols */
+	u_int32_t		 pcl_nkifs;
+	struct pfi_kif		**pcl_kifs;	/* ascending */
+	u_int64_t		*pcl_kif;	/* pcl_nkifs + 1 rows */
+	struct pf_rulecls_dim	 pcl_dim[2][PF_RULECLS_NDIMS];	/* by af */
+	size_t			 pcl_size;
+};
+
+/* rows of a pf_rulecls that a packet selects */
+struct pf_rulecls_match {
+	int			 pcm_nrows;
+	u_int64_t		*pcm_row[3 + PF_RULECLS_NDIMS];
+};
+
+extern struct pf_rulecls	*pf_rulecls;
 
 /* keep synced with pfi_kif, used in RB_FIND */
 struct pfi_kif_cmp {
 	char				 pfik_name[IFNAMSIZ];
 };
 
+/* interface counts kept per-CPU by pf_rulesnap_test() */
+struct pfi_kif_ctr {
+	u_int64_t			 pkc_packets[2][2][2];
+	u_int64_t			 pkc_bytes[2][2][2];
+};
+
 struct pfi_kif {
 	char				 pfik_name[IFNAMSIZ];
 	RB_ENTRY(pfi_kif)		 pfik_tree;
@@ -1374,8 +1540,15 @@ struct pfi_kif {
 	int				 pfik_states;
 	int				 pfik_rules;
 	TAILQ_HEAD(, pfi_dynaddr)	 pfik_dynaddrs;
+	struct pfi_kif_ctr		 pfik_base;	/* pcpu sums at clear */
+	caddr_t				 pfik_pcpu;	/* pf_rulesnap_test() */
+	void				*pfik_pcpu_buf;
 };
 
+#define	PFI_KIF_CTRS(kif, cpu)						\
+	((struct pfi_kif_ctr *)(void *)((kif)->pfik_pcpu +		\
+	    (size_t)(cpu) * pfi_kif_ctr_stride))
+
 enum pfi_kif_refs {
 	PFI_KIF_REF_NONE,
 	PFI_KIF_REF_STATE,
@@ -2195,6 +2368,18 @@ extern struct pool pf_app_state_pl;
 extern struct thread *pf_purge_thread;
 
 __private_extern__ void pfinit(void);
+__private_extern__ void pf_statetbl_init(void);
+__private_extern__ void pf_rulesnap_init(void);
+__private_extern__ void pf_rulesnap_sync(void);
+__private_extern__ void pf_rulesnap_invalidate(void);
+__private_extern__ void pf_rulesnap_update(void);
+__private_extern__ void pf_rulesnap_copyout(struct pf_rule *, struct pf_rule *);
+__private_extern__ void pf_rulesnap_clear(struct pf_rule *);
+__private_extern__ void pf_rulesnap_status(struct pf_status *);
+__private_extern__ void pf_rulecls_invalidate(void);
+__private_extern__ void pf_rulecls_update(void);
+__private_extern__ int pf_rulesnap_test(int, int, struct ifnet *,
+    struct mbuf **, int *);
 __private_extern__ void pf_purge_thread_fn(void *, wait_result_t);
 __private_extern__ void pf_purge_expired_src_nodes(void);
 __private_extern__ void pf_purge_expired_states(u_int32_t);
@@ -2323,8 +2508,16 @@ __private_extern__ int pfr_ina_commit(struct pfr_table *, u_int32_t, int *,
     int *, int);
 __private_extern__ int pfr_ina_define(struct pfr_table *, user_addr_t,
     int, int *, int *, u_int32_t, int);
+__private_extern__ struct pfr_cset *pfr_cset_create(struct pfr_centry *,
+    u_int32_t);
+__private_extern__ void pfr_cset_free(struct pfr_cset *);
+__private_extern__ struct pfr_centry *pfr_cset_match(struct pfr_cset *,
+    struct pf_addr *, sa_family_t);
+__private_extern__ struct pfr_centry *pfr_cset_lookup(struct pfr_cset *,
+    struct pfr_addr *);
 
 extern struct pfi_kif *pfi_all;
+extern size_t pfi_kif_ctr_stride;
 
 __private_extern__ void pfi_initialize(void);
 __private_extern__ struct pfi_kif *pfi_kif_get(const char *);
@@ -57,6 +57,7 @@ extern "C" {
 #define	PKTSCHEDF_QALG_ECN	0x10	/* enable ECN */
 #define	PKTSCHEDF_QALG_FLOWCTL	0x20	/* enable flow control advisories */
 #define	PKTSCHEDF_QALG_DELAYBASED	0x40	/* Delay based queueing */
+#define	PKTSCHEDF_QALG_FQ_CODEL	0x80	/* use FQ-CoDel */
 
 /* macro for timeout/untimeout */
 /* use old-style timeout/untimeout */
@@ -83,6 +83,8 @@
  */
 static int priq_enqueue_ifclassq(struct ifclassq *, struct mbuf *);
 static struct mbuf *priq_dequeue_ifclassq(struct ifclassq *, cqdq_op_t);
+static int priq_dequeue_multi_ifclassq(struct ifclassq *, u_int32_t, u_int32_t,
+    struct mbuf **, struct mbuf **, u_int32_t *, u_int32_t *);
 static int priq_request_ifclassq(struct ifclassq *, cqrq_t, void *);
 static int priq_clear_interface(struct priq_if *);
 static struct priq_class *priq_class_create(struct priq_if *, int, u_int32_t,
@@ -995,6 +997,46 @@ priq_dequeue_ifclassq(struct ifclassq *ifq, cqdq_op_t op)
 	return (priq_dequeue(ifq->ifcq_disc, op));
 }
 
+/*
+ * priq_dequeue_multi_ifclassq is a dequeue function to be registered to
+ * (*ifcq_dequeue_multi) in struct ifclass.
+ *
+ * note: dequeues packets until either limit is reached, or the scheduler
+ *	runs out of packets; the byte limit may be exceeded by the last
+ *	packet of the chain.  Returns EAGAIN if no packet was dequeued.
+ */
+static int
+priq_dequeue_multi_ifclassq(struct ifclassq *ifq, u_int32_t pkt_limit,
+    u_int32_t byte_limit, struct mbuf **head, struct mbuf **tail,
+    u_int32_t *cnt, u_int32_t *len)
+{
+	struct priq_if *pif = (struct priq_if *)ifq->ifcq_disc;
+	struct mbuf *m, *last = NULL;
+	u_int32_t i = 0, l = 0;
+
+	IFCQ_LOCK_ASSERT_HELD(ifq);
+
+	*head = NULL;
+	while (i < pkt_limit && l < byte_limit) {
+		if ((m = priq_dequeue(pif, CLASSQDQ_REMOVE)) == NULL)
+			break;
+		m->m_nextpkt = NULL;
+		if (last == NULL)
+			*head = m;
+		else
+			last->m_nextpkt = m;
+		last = m;
+		l += m_pktlen(m);
+		i++;
+	}
+
+	*tail = last;
+	*cnt = i;
+	*len = l;
+
+	return ((i != 0) ? 0 : EAGAIN);
+}
+
 static int
 priq_request_ifclassq(struct ifclassq *ifq, cqrq_t req, void *arg)
 {
@@ -1103,7 +1145,7 @@ priq_setup_ifclassq(struct ifclassq *ifq, u_int32_t flags)
 
 	err = ifclassq_attach(ifq, PKTSCHEDT_PRIQ, pif,
 	    priq_enqueue_ifclassq, priq_dequeue_ifclassq, NULL,
-	    priq_request_ifclassq);
+	    priq_dequeue_multi_ifclassq, NULL, priq_request_ifclassq);
 
 	/* cache these for faster lookup */
 	if (err == 0) {
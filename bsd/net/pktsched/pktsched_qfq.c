@@ -83,6 +83,8 @@
  */
 static int qfq_enqueue_ifclassq(struct ifclassq *, struct mbuf *);
 static struct mbuf *qfq_dequeue_ifclassq(struct ifclassq *, cqdq_op_t);
+static int qfq_dequeue_multi_ifclassq(struct ifclassq *, u_int32_t, u_int32_t,
+    struct mbuf **, struct mbuf **, u_int32_t *, u_int32_t *);
 static int qfq_request_ifclassq(struct ifclassq *, cqrq_t, void *);
 static int qfq_clear_interface(struct qfq_if *);
 static struct qfq_class *qfq_class_create(struct qfq_if *, u_int32_t,
@@ -463,12 +465,13 @@ qfq_class_create(struct qfq_if *qif, u_int32_t weight, u_int32_t qlimit,
 #endif /* CLASSQ_BLUE */
 
 	/* These are mutually exclusive */
-	if ((flags & (QFCF_RED|QFCF_RIO|QFCF_BLUE|QFCF_SFB)) &&
-	    (flags & (QFCF_RED|QFCF_RIO|QFCF_BLUE|QFCF_SFB)) != QFCF_RED &&
-	    (flags & (QFCF_RED|QFCF_RIO|QFCF_BLUE|QFCF_SFB)) != QFCF_RIO &&
-	    (flags & (QFCF_RED|QFCF_RIO|QFCF_BLUE|QFCF_SFB)) != QFCF_BLUE &&
-	    (flags & (QFCF_RED|QFCF_RIO|QFCF_BLUE|QFCF_SFB)) != QFCF_SFB) {
-		log(LOG_ERR, "%s: %s more than one RED|RIO|BLUE|SFB\n",
+	if ((flags & QFCF_QALG) &&
+	    (flags & QFCF_QALG) != QFCF_RED &&
+	    (flags & QFCF_QALG) != QFCF_RIO &&
+	    (flags & QFCF_QALG) != QFCF_BLUE &&
+	    (flags & QFCF_QALG) != QFCF_SFB &&
+	    (flags & QFCF_QALG) != QFCF_FQ_CODEL) {
+		log(LOG_ERR, "%s: %s more than one RED|RIO|BLUE|SFB|FQ_CODEL\n",
 		    if_name(QFQIF_IFP(qif)), qfq_style(qif));
 		return (NULL);
 	}
@@ -561,7 +564,7 @@ qfq_class_create(struct qfq_if *qif, u_int32_t weight, u_int32_t qlimit,
 	if (flags & QFCF_DEFAULTCLASS)
 		qif->qif_default = cl;
 
-	if (flags & (QFCF_RED|QFCF_RIO|QFCF_BLUE|QFCF_SFB)) {
+	if (flags & QFCF_QALG) {
 #if CLASSQ_RED || CLASSQ_RIO
 		u_int64_t ifbandwidth = ifnet_output_linkrate(ifp);
 		int pkttime;
@@ -573,6 +576,8 @@ qfq_class_create(struct qfq_if *qif, u_int32_t weight, u_int32_t qlimit,
 				cl->cl_qflags |= BLUEF_ECN;
 			else if (flags & QFCF_SFB)
 				cl->cl_qflags |= SFBF_ECN;
+			else if (flags & QFCF_FQ_CODEL)
+				cl->cl_qflags |= FQCF_ECN;
 			else if (flags & QFCF_RED)
 				cl->cl_qflags |= REDF_ECN;
 			else if (flags & QFCF_RIO)
@@ -635,6 +640,15 @@ qfq_class_create(struct qfq_if *qif, u_int32_t weight, u_int32_t qlimit,
 			if (cl->cl_sfb != NULL || (cl->cl_flags & QFCF_LAZY))
 				qtype(&cl->cl_q) = Q_SFB;
 		}
+		if (flags & QFCF_FQ_CODEL) {
+			if (!(cl->cl_flags & QFCF_LAZY))
+				cl->cl_fq_codel = fq_codel_alloc(ifp,
+				    cl->cl_handle, qlimit(&cl->cl_q),
+				    cl->cl_qflags);
+			if (cl->cl_fq_codel != NULL ||
+			    (cl->cl_flags & QFCF_LAZY))
+				qtype(&cl->cl_q) = Q_FQ_CODEL;
+		}
 	}
 
 	if (pktsched_verbose) {
@@ -698,6 +712,8 @@ qfq_class_destroy(struct qfq_if *qif, struct qfq_class *cl)
 #endif /* CLASSQ_BLUE */
 		if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 			sfb_destroy(cl->cl_sfb);
+		if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+			fq_codel_destroy(cl->cl_fq_codel);
 		cl->cl_qalg.ptr = NULL;
 		qtype(&cl->cl_q) = Q_DROPTAIL;
 		qstate(&cl->cl_q) = QS_RUNNING;
@@ -908,10 +924,13 @@ qfq_update_class(struct qfq_if *qif, struct qfq_group *grp,
 	if (qempty(&cl->cl_q))  {
 		qfq_front_slot_remove(grp);
 	} else {
+		struct mbuf *m;
 		u_int32_t len;
 		u_int64_t roundedS;
 
-		len = m_pktlen(qhead(&cl->cl_q));
+		/* the head may not be known (e.g. FQ-CoDel) until polled */
+		m = qfq_pollq(cl);
+		len = (m != NULL) ? m_pktlen(m) : cl->cl_lmax;
 		cl->cl_F = cl->cl_S + (u_int64_t)len * cl->cl_inv_w;
 		roundedS = qfq_round_down(cl->cl_S, grp->qfg_slot_shift);
 		if (roundedS == grp->qfg_S)
@@ -1369,6 +1388,42 @@ qfq_addq(struct qfq_class *cl, struct mbuf *m, struct pf_mtag *t)
 		}
 		if (cl->cl_sfb != NULL)
 			return (sfb_addq(cl->cl_sfb, &cl->cl_q, m, t));
+	} else if (q_is_fq_codel(&cl->cl_q)) {
+		if (cl->cl_fq_codel == NULL) {
+			struct ifnet *ifp = QFQIF_IFP(qif);
+
+			VERIFY(cl->cl_flags & QFCF_LAZY);
+			cl->cl_flags &= ~QFCF_LAZY;
+			IFCQ_CONVERT_LOCK(ifq);
+
+			cl->cl_fq_codel = fq_codel_alloc(ifp, cl->cl_handle,
+			    qlimit(&cl->cl_q), cl->cl_qflags);
+			if (cl->cl_fq_codel == NULL) {
+				/* fall back to droptail */
+				qtype(&cl->cl_q) = Q_DROPTAIL;
+				cl->cl_flags &= ~QFCF_FQ_CODEL;
+				cl->cl_qflags &= ~FQCF_ECN;
+
+				log(LOG_ERR, "%s: %s FQ-CoDel lazy allocation "
+				    "failed for qid=%d grp=%d, falling back "
+				    "to DROPTAIL\n", if_name(ifp),
+				    qfq_style(qif), cl->cl_handle,
+				    cl->cl_grp->qfg_index);
+			} else if (qif->qif_throttle != IFNET_THROTTLE_OFF) {
+				/* if there's pending throttling, set it */
+				cqrq_throttle_t tr = { 1, qif->qif_throttle };
+				int err = qfq_throttle(qif, &tr);
+
+				if (err == EALREADY)
+					err = 0;
+				if (err != 0) {
+					tr.level = IFNET_THROTTLE_OFF;
+					(void) qfq_throttle(qif, &tr);
+				}
+			}
+		}
+		if (cl->cl_fq_codel != NULL)
+			return (fq_codel_addq(cl->cl_fq_codel, &cl->cl_q, m, t));
 	} else if (qlen(&cl->cl_q) >= qlimit(&cl->cl_q)) {
 		IFCQ_CONVERT_LOCK(ifq);
 		m_freem(m);
@@ -1407,6 +1462,8 @@ qfq_getq(struct qfq_class *cl)
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		return (sfb_getq(cl->cl_sfb, &cl->cl_q));
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		return (fq_codel_getq(cl->cl_fq_codel, &cl->cl_q));
 
 	return (_getq(&cl->cl_q));
 }
@@ -1416,6 +1473,10 @@ qfq_pollq(struct qfq_class *cl)
 {
 	IFCQ_LOCK_ASSERT_HELD(cl->cl_qif->qif_ifq);
 
+	/* FQ-CoDel decides on the next packet only when asked */
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		return (fq_codel_pollq(cl->cl_fq_codel, &cl->cl_q));
+
 	return (qhead(&cl->cl_q));
 }
 
@@ -1451,6 +1512,8 @@ qfq_purgeq(struct qfq_if *qif, struct qfq_class *cl, u_int32_t flow,
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		sfb_purgeq(cl->cl_sfb, &cl->cl_q, flow, &cnt, &len);
+	else if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		fq_codel_purgeq(cl->cl_fq_codel, &cl->cl_q, flow, &cnt, &len);
 	else
 		_flushq_flow(&cl->cl_q, flow, &cnt, &len);
 
@@ -1512,6 +1575,8 @@ qfq_updateq(struct qfq_if *qif, struct qfq_class *cl, cqev_t ev)
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		return (sfb_updateq(cl->cl_sfb, ev));
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		return (fq_codel_updateq(cl->cl_fq_codel, ev));
 }
 
 int
@@ -1551,6 +1616,8 @@ qfq_get_class_stats(struct qfq_if *qif, u_int32_t qid,
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		sfb_getstats(cl->cl_sfb, &sp->sfb);
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		fq_codel_getstats(cl->cl_fq_codel, &sp->fq_codel);
 
 	return (0);
 }
@@ -1763,6 +1830,46 @@ qfq_dequeue_ifclassq(struct ifclassq *ifq, cqdq_op_t op)
 	return (qfq_dequeue(ifq->ifcq_disc, op));
 }
 
+/*
+ * qfq_dequeue_multi_ifclassq is a dequeue function to be registered to
+ * (*ifcq_dequeue_multi) in struct ifclass.
+ *
+ * note: dequeues packets until either limit is reached, or the scheduler
+ *	runs out of packets; the byte limit may be exceeded by the last
+ *	packet of the chain.  Returns EAGAIN if no packet was dequeued.
+ */
+static int
+qfq_dequeue_multi_ifclassq(struct ifclassq *ifq, u_int32_t pkt_limit,
+    u_int32_t byte_limit, struct mbuf **head, struct mbuf **tail,
+    u_int32_t *cnt, u_int32_t *len)
+{
+	struct qfq_if *qif = (struct qfq_if *)ifq->ifcq_disc;
+	struct mbuf *m, *last = NULL;
+	u_int32_t i = 0, l = 0;
+
+	IFCQ_LOCK_ASSERT_HELD(ifq);
+
+	*head = NULL;
+	while (i < pkt_limit && l < byte_limit) {
+		if ((m = qfq_dequeue(qif, CLASSQDQ_REMOVE)) == NULL)
+			break;
+		m->m_nextpkt = NULL;
+		if (last == NULL)
+			*head = m;
+		else
+			last->m_nextpkt = m;
+		last = m;
+		l += m_pktlen(m);
+		i++;
+	}
+
+	*tail = last;
+	*cnt = i;
+	*len = l;
+
+	return ((i != 0) ? 0 : EAGAIN);
+}
+
 static int
 qfq_request_ifclassq(struct ifclassq *ifq, cqrq_t req, void *arg)
 {
@@ -1816,6 +1923,8 @@ qfq_setup_ifclassq(struct ifclassq *ifq, u_int32_t flags)
 		qflags |= QFCF_BLUE;
 	if (flags & PKTSCHEDF_QALG_SFB)
 		qflags |= QFCF_SFB;
+	if (flags & PKTSCHEDF_QALG_FQ_CODEL)
+		qflags |= QFCF_FQ_CODEL;
 	if (flags & PKTSCHEDF_QALG_ECN)
 		qflags |= QFCF_ECN;
 	if (flags & PKTSCHEDF_QALG_FLOWCTL)
@@ -1872,7 +1981,7 @@ qfq_setup_ifclassq(struct ifclassq *ifq, u_int32_t flags)
 
 	err = ifclassq_attach(ifq, PKTSCHEDT_QFQ, qif,
 	    qfq_enqueue_ifclassq, qfq_dequeue_ifclassq, NULL,
-	    qfq_request_ifclassq);
+	    qfq_dequeue_multi_ifclassq, NULL, qfq_request_ifclassq);
 
 	/* cache these for faster lookup */
 	if (err == 0) {
@@ -2031,6 +2140,8 @@ qfq_resumeq(struct qfq_if *qif, struct qfq_class *cl)
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		err = sfb_suspendq(cl->cl_sfb, &cl->cl_q, FALSE);
+	else if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		err = fq_codel_suspendq(cl->cl_fq_codel, &cl->cl_q, FALSE);
 
 	if (err == 0)
 		qstate(&cl->cl_q) = QS_RUNNING;
@@ -2068,6 +2179,14 @@ qfq_suspendq(struct qfq_if *qif, struct qfq_class *cl)
 			VERIFY(cl->cl_flags & QFCF_LAZY);
 			err = ENXIO;	/* delayed throttling */
 		}
+	} else if (q_is_fq_codel(&cl->cl_q)) {
+		if (cl->cl_fq_codel != NULL) {
+			err = fq_codel_suspendq(cl->cl_fq_codel, &cl->cl_q,
+			    TRUE);
+		} else {
+			VERIFY(cl->cl_flags & QFCF_LAZY);
+			err = ENXIO;	/* delayed throttling */
+		}
 	}
 
 	if (err == 0 || err == ENXIO)
@@ -53,6 +53,9 @@
 static int tcq_enqueue_ifclassq(struct ifclassq *, struct mbuf *);
 static struct mbuf *tcq_dequeue_tc_ifclassq(struct ifclassq *,
     mbuf_svc_class_t, cqdq_op_t);
+static int tcq_dequeue_tc_multi_ifclassq(struct ifclassq *, mbuf_svc_class_t,
+    u_int32_t, u_int32_t, struct mbuf **, struct mbuf **, u_int32_t *,
+    u_int32_t *);
 static int tcq_request_ifclassq(struct ifclassq *, cqrq_t, void *);
 static int tcq_clear_interface(struct tcq_if *);
 static struct tcq_class *tcq_class_create(struct tcq_if *, int, u_int32_t,
@@ -319,12 +322,13 @@ tcq_class_create(struct tcq_if *tif, int pri, u_int32_t qlimit,
 #endif /* CLASSQ_BLUE */
 
 	/* These are mutually exclusive */
-	if ((flags & (TQCF_RED|TQCF_RIO|TQCF_BLUE|TQCF_SFB)) &&
-	    (flags & (TQCF_RED|TQCF_RIO|TQCF_BLUE|TQCF_SFB)) != TQCF_RED &&
-	    (flags & (TQCF_RED|TQCF_RIO|TQCF_BLUE|TQCF_SFB)) != TQCF_RIO &&
-	    (flags & (TQCF_RED|TQCF_RIO|TQCF_BLUE|TQCF_SFB)) != TQCF_BLUE &&
-	    (flags & (TQCF_RED|TQCF_RIO|TQCF_BLUE|TQCF_SFB)) != TQCF_SFB) {
-		log(LOG_ERR, "%s: %s more than one RED|RIO|BLUE|SFB\n",
+	if ((flags & TQCF_QALG) &&
+	    (flags & TQCF_QALG) != TQCF_RED &&
+	    (flags & TQCF_QALG) != TQCF_RIO &&
+	    (flags & TQCF_QALG) != TQCF_BLUE &&
+	    (flags & TQCF_QALG) != TQCF_SFB &&
+	    (flags & TQCF_QALG) != TQCF_FQ_CODEL) {
+		log(LOG_ERR, "%s: %s more than one RED|RIO|BLUE|SFB|FQ_CODEL\n",
 		    if_name(TCQIF_IFP(tif)), tcq_style(tif));
 		return (NULL);
 	}
@@ -350,6 +354,8 @@ tcq_class_create(struct tcq_if *tif, int pri, u_int32_t qlimit,
 #endif /* CLASSQ_BLUE */
 		if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 			sfb_destroy(cl->cl_sfb);
+		if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+			fq_codel_destroy(cl->cl_fq_codel);
 		cl->cl_qalg.ptr = NULL;
 		qtype(&cl->cl_q) = Q_DROPTAIL;
 		qstate(&cl->cl_q) = QS_RUNNING;
@@ -377,7 +383,7 @@ tcq_class_create(struct tcq_if *tif, int pri, u_int32_t qlimit,
 	cl->cl_tif = tif;
 	cl->cl_handle = qid;
 
-	if (flags & (TQCF_RED|TQCF_RIO|TQCF_BLUE|TQCF_SFB)) {
+	if (flags & TQCF_QALG) {
 #if CLASSQ_RED || CLASSQ_RIO
 		u_int64_t ifbandwidth = ifnet_output_linkrate(ifp);
 		int pkttime;
@@ -389,6 +395,8 @@ tcq_class_create(struct tcq_if *tif, int pri, u_int32_t qlimit,
 				cl->cl_qflags |= BLUEF_ECN;
 			else if (flags & TQCF_SFB)
 				cl->cl_qflags |= SFBF_ECN;
+			else if (flags & TQCF_FQ_CODEL)
+				cl->cl_qflags |= FQCF_ECN;
 			else if (flags & TQCF_RED)
 				cl->cl_qflags |= REDF_ECN;
 			else if (flags & TQCF_RIO)
@@ -451,6 +459,15 @@ tcq_class_create(struct tcq_if *tif, int pri, u_int32_t qlimit,
 			if (cl->cl_sfb != NULL || (cl->cl_flags & TQCF_LAZY))
 				qtype(&cl->cl_q) = Q_SFB;
 		}
+		if (flags & TQCF_FQ_CODEL) {
+			if (!(cl->cl_flags & TQCF_LAZY))
+				cl->cl_fq_codel = fq_codel_alloc(ifp,
+				    cl->cl_handle, qlimit(&cl->cl_q),
+				    cl->cl_qflags);
+			if (cl->cl_fq_codel != NULL ||
+			    (cl->cl_flags & TQCF_LAZY))
+				qtype(&cl->cl_q) = Q_FQ_CODEL;
+		}
 	}
 
 	if (pktsched_verbose) {
@@ -515,6 +532,8 @@ tcq_class_destroy(struct tcq_if *tif, struct tcq_class *cl)
 #endif /* CLASSQ_BLUE */
 		if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 			sfb_destroy(cl->cl_sfb);
+		if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+			fq_codel_destroy(cl->cl_fq_codel);
 		cl->cl_qalg.ptr = NULL;
 		qtype(&cl->cl_q) = Q_DROPTAIL;
 		qstate(&cl->cl_q) = QS_RUNNING;
@@ -694,6 +713,42 @@ tcq_addq(struct tcq_class *cl, struct mbuf *m, struct pf_mtag *t)
 		}
 		if (cl->cl_sfb != NULL)
 			return (sfb_addq(cl->cl_sfb, &cl->cl_q, m, t));
+	} else if (q_is_fq_codel(&cl->cl_q)) {
+		if (cl->cl_fq_codel == NULL) {
+			struct ifnet *ifp = TCQIF_IFP(tif);
+
+			VERIFY(cl->cl_flags & TQCF_LAZY);
+			cl->cl_flags &= ~TQCF_LAZY;
+			IFCQ_CONVERT_LOCK(ifq);
+
+			cl->cl_fq_codel = fq_codel_alloc(ifp, cl->cl_handle,
+			    qlimit(&cl->cl_q), cl->cl_qflags);
+			if (cl->cl_fq_codel == NULL) {
+				/* fall back to droptail */
+				qtype(&cl->cl_q) = Q_DROPTAIL;
+				cl->cl_flags &= ~TQCF_FQ_CODEL;
+				cl->cl_qflags &= ~FQCF_ECN;
+
+				log(LOG_ERR, "%s: %s FQ-CoDel lazy allocation "
+				    "failed for qid=%d pri=%d, falling back "
+				    "to DROPTAIL\n", if_name(ifp),
+				    tcq_style(tif), cl->cl_handle,
+				    cl->cl_pri);
+			} else if (tif->tif_throttle != IFNET_THROTTLE_OFF) {
+				/* if there's pending throttling, set it */
+				cqrq_throttle_t tr = { 1, tif->tif_throttle };
+				int err = tcq_throttle(tif, &tr);
+
+				if (err == EALREADY)
+					err = 0;
+				if (err != 0) {
+					tr.level = IFNET_THROTTLE_OFF;
+					(void) tcq_throttle(tif, &tr);
+				}
+			}
+		}
+		if (cl->cl_fq_codel != NULL)
+			return (fq_codel_addq(cl->cl_fq_codel, &cl->cl_q, m, t));
 	} else if (qlen(&cl->cl_q) >= qlimit(&cl->cl_q)) {
 		IFCQ_CONVERT_LOCK(ifq);
 		m_freem(m);
@@ -732,6 +787,8 @@ tcq_getq(struct tcq_class *cl)
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		return (sfb_getq(cl->cl_sfb, &cl->cl_q));
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		return (fq_codel_getq(cl->cl_fq_codel, &cl->cl_q));
 
 	return (_getq(&cl->cl_q));
 }
@@ -741,6 +798,10 @@ tcq_pollq(struct tcq_class *cl)
 {
 	IFCQ_LOCK_ASSERT_HELD(cl->cl_tif->tif_ifq);
 
+	/* FQ-CoDel decides on the next packet only when asked */
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		return (fq_codel_pollq(cl->cl_fq_codel, &cl->cl_q));
+
 	return (qhead(&cl->cl_q));
 }
 
@@ -776,6 +837,8 @@ tcq_purgeq(struct tcq_if *tif, struct tcq_class *cl, u_int32_t flow,
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		sfb_purgeq(cl->cl_sfb, &cl->cl_q, flow, &cnt, &len);
+	else if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		fq_codel_purgeq(cl->cl_fq_codel, &cl->cl_q, flow, &cnt, &len);
 	else
 		_flushq_flow(&cl->cl_q, flow, &cnt, &len);
 
@@ -828,6 +891,8 @@ tcq_updateq(struct tcq_if *tif, struct tcq_class *cl, cqev_t ev)
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		return (sfb_updateq(cl->cl_sfb, ev));
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		return (fq_codel_updateq(cl->cl_fq_codel, ev));
 }
 
 int
@@ -865,6 +930,8 @@ tcq_get_class_stats(struct tcq_if *tif, u_int32_t qid,
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		sfb_getstats(cl->cl_sfb, &sp->sfb);
+	if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		fq_codel_getstats(cl->cl_fq_codel, &sp->fq_codel);
 
 	return (0);
 }
@@ -961,6 +1028,51 @@ tcq_dequeue_tc_ifclassq(struct ifclassq *ifq, mbuf_svc_class_t sc,
 	    ifq->ifcq_disc_slots[i].cl, sc, op));
 }
 
+/*
+ * tcq_dequeue_tc_multi_ifclassq is a dequeue function to be registered to
+ * (*ifcq_dequeue_sc_multi) in struct ifclass.
+ *
+ * note: dequeues packets of the traffic class until either limit is
+ *	reached, or the class runs out of packets; the byte limit may be
+ *	exceeded by the last packet of the chain.  The class is looked up
+ *	once for the whole chain.  Returns EAGAIN if no packet was dequeued.
+ */
+static int
+tcq_dequeue_tc_multi_ifclassq(struct ifclassq *ifq, mbuf_svc_class_t sc,
+    u_int32_t pkt_limit, u_int32_t byte_limit, struct mbuf **head,
+    struct mbuf **tail, u_int32_t *cnt, u_int32_t *len)
+{
+	struct tcq_if *tif = (struct tcq_if *)ifq->ifcq_disc;
+	u_int32_t scidx = MBUF_SCIDX(sc);
+	struct tcq_class *cl;
+	struct mbuf *m, *last = NULL;
+	u_int32_t i = 0, l = 0;
+
+	IFCQ_LOCK_ASSERT_HELD(ifq);
+	VERIFY(scidx < IFCQ_SC_MAX);
+
+	*head = NULL;
+	cl = ifq->ifcq_disc_slots[scidx].cl;
+	while (cl != NULL && i < pkt_limit && l < byte_limit) {
+		if ((m = tcq_dequeue_cl(tif, cl, sc, CLASSQDQ_REMOVE)) == NULL)
+			break;
+		m->m_nextpkt = NULL;
+		if (last == NULL)
+			*head = m;
+		else
+			last->m_nextpkt = m;
+		last = m;
+		l += m_pktlen(m);
+		i++;
+	}
+
+	*tail = last;
+	*cnt = i;
+	*len = l;
+
+	return ((i != 0) ? 0 : EAGAIN);
+}
+
 static int
 tcq_request_ifclassq(struct ifclassq *ifq, cqrq_t req, void *arg)
 {
@@ -1014,6 +1126,8 @@ tcq_setup_ifclassq(struct ifclassq *ifq, u_int32_t flags)
 		qflags |= TQCF_BLUE;
 	if (flags & PKTSCHEDF_QALG_SFB)
 		qflags |= TQCF_SFB;
+	if (flags & PKTSCHEDF_QALG_FQ_CODEL)
+		qflags |= TQCF_FQ_CODEL;
 	if (flags & PKTSCHEDF_QALG_ECN)
 		qflags |= TQCF_ECN;
 	if (flags & PKTSCHEDF_QALG_FLOWCTL)
@@ -1046,7 +1160,7 @@ tcq_setup_ifclassq(struct ifclassq *ifq, u_int32_t flags)
 
 	err = ifclassq_attach(ifq, PKTSCHEDT_TCQ, tif,
 	    tcq_enqueue_ifclassq, NULL, tcq_dequeue_tc_ifclassq,
-	    tcq_request_ifclassq);
+	    NULL, tcq_dequeue_tc_multi_ifclassq, tcq_request_ifclassq);
 
 	/* cache these for faster lookup */
 	if (err == 0) {
@@ -1209,6 +1323,8 @@ tcq_resumeq(struct tcq_if *tif, struct tcq_class *cl)
 #endif /* CLASSQ_BLUE */
 	if (q_is_sfb(&cl->cl_q) && cl->cl_sfb != NULL)
 		err = sfb_suspendq(cl->cl_sfb, &cl->cl_q, FALSE);
+	else if (q_is_fq_codel(&cl->cl_q) && cl->cl_fq_codel != NULL)
+		err = fq_codel_suspendq(cl->cl_fq_codel, &cl->cl_q, FALSE);
 
 	if (err == 0)
 		qstate(&cl->cl_q) = QS_RUNNING;
@@ -1246,6 +1362,14 @@ tcq_suspendq(struct tcq_if *tif, struct tcq_class *cl)
 			VERIFY(cl->cl_flags & TQCF_LAZY);
 			err = ENXIO;	/* delayed throttling */
 		}
+	} else if (q_is_fq_codel(&cl->cl_q)) {
+		if (cl->cl_fq_codel != NULL) {
+			err = fq_codel_suspendq(cl->cl_fq_codel, &cl->cl_q,
+			    TRUE);
+		} else {
+			VERIFY(cl->cl_flags & TQCF_LAZY);
+			err = ENXIO;	/* delayed throttling */
+		}
 	}
 
 	if (err == 0 || err == ENXIO)
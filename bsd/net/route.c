@@ -84,6 +84,7 @@
 #include <netinet/in.h>
 #include <netinet/in_var.h>
 #include <netinet/ip_var.h>
+#include <netinet/in_fib.h>
 #include <netinet/ip6.h>
 
 #if INET6
@@ -129,7 +130,7 @@
  *
  * The fields of the rtentry structure are protected in the following way:
  *
- * rt_nodes[]
+ * rt_nodes[], rt_fibnh
  *
  *	- Routing table lock (rnh_lock).
  *
@@ -469,10 +470,13 @@ rt_primary_default(struct rtentry *rt, struct sockaddr *dst)
 void
 set_primary_ifscope(int af, unsigned int ifscope)
 {
-	if (af == AF_INET)
+	if (af == AF_INET) {
+		if (primary_ifscope != ifscope)
+			in_fib_invalidate();
 		primary_ifscope = ifscope;
-	else
+	} else {
 		primary6_ifscope = ifscope;
+	}
 }
 
 /*
@@ -878,6 +882,8 @@ void
 rtalloc_ign(struct route *ro, uint32_t ignore)
 {
 	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_NOTOWNED);
+	if (ro->ro_rt == NULL && in_fib_rtalloc(ro, ignore))
+		return;
 	lck_mtx_lock(rnh_lock);
 	rtalloc_ign_common_locked(ro, ignore, IFSCOPE_NONE);
 	lck_mtx_unlock(rnh_lock);
@@ -887,6 +893,9 @@ void
 rtalloc_scoped_ign(struct route *ro, uint32_t ignore, unsigned int ifscope)
 {
 	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_NOTOWNED);
+	if (ifscope == IFSCOPE_NONE && ro->ro_rt == NULL &&
+	    in_fib_rtalloc(ro, ignore))
+		return;
 	lck_mtx_lock(rnh_lock);
 	rtalloc_ign_common_locked(ro, ignore, ifscope);
 	lck_mtx_unlock(rnh_lock);
@@ -1887,6 +1896,9 @@ rtrequest_common_locked(int req, struct sockaddr *dst0,
 		if (gwrt != NULL)
 			rtfree_locked(gwrt);
 
+		if (af == AF_INET)
+			in_fib_route_change(rt);
+
 		/*
 		 * If the caller wants it, then it can have it,
 		 * but it's up to it to free the rtentry as we won't be
@@ -2210,6 +2222,9 @@ makeroute:
 			RT_UNLOCK(rt);
 		}
 
+		if (af == AF_INET)
+			in_fib_route_change(rt);
+
 		nstat_route_new_entry(rt);
 		break;
 	}
@@ -3076,6 +3091,49 @@ rt_lookup_coarse(boolean_t lookup_only, struct sockaddr *dst,
 	    rnh, IFSCOPE_NONE));
 }
 
+/*
+ * Return the route that a non-scoped rt_lookup() of an AF_INET destination
+ * would pick, without taking a reference, validating the route or altering
+ * its expiry; also return the longest prefix match that the selection
+ * started from.  This is used by the IPv4 FIB to mirror the radix tree, and
+ * must follow the IFSCOPE_NONE path of rt_lookup_common() above.
+ */
+struct rtentry *
+rt_lookup_peek(struct sockaddr *dst, struct rtentry **rt0)
+{
+	struct radix_node *rn0, *rn;
+	unsigned int ifscope;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+	VERIFY(dst->sa_family == AF_INET);
+
+	rn0 = rn = node_lookup(dst, NULL, IFSCOPE_NONE);
+	*rt0 = RT(rn0);
+	if (!ip_doscopedroute)
+		return (RT(rn));
+
+	ifscope = get_primary_ifscope(AF_INET);
+	if (rn != NULL && !(RT(rn)->rt_ifp->if_flags & IFF_LOOPBACK)) {
+		if (RT(rn)->rt_ifp->if_index != ifscope) {
+			ifscope = RT(rn)->rt_ifp->if_index;
+			rn = NULL;
+		} else if (!(RT(rn)->rt_flags & RTF_IFSCOPE)) {
+			rn = NULL;
+		}
+	}
+	if (rn == NULL)
+		rn = node_lookup(dst, NULL, ifscope);
+	if (rn == NULL || (rn0 != NULL &&
+	    ((SA_DEFAULT(rt_key(RT(rn))) && !SA_DEFAULT(rt_key(RT(rn0)))) ||
+	    (!RT_HOST(rn) && RT_HOST(rn0)))))
+		rn = rn0;
+	if (rn == NULL && (rn = node_lookup_default(AF_INET)) != NULL &&
+	    RT(rn)->rt_ifp->if_index != ifscope)
+		rn = NULL;
+
+	return (RT(rn));
+}
+
 boolean_t
 rt_validate(struct rtentry *rt)
 {
@@ -3393,6 +3451,8 @@ rtinit_locked(struct ifaddr *ifa, int cmd, int flags)
 		 */
 		RT_REMREF_LOCKED(rt);
 		RT_UNLOCK(rt);
+		if (dst->sa_family == AF_INET)
+			in_fib_route_change(rt);
 		break;
 
 	default:
@@ -3493,6 +3553,17 @@ rt_lock(struct rtentry *rt, boolean_t spin)
 		rte_lock_debug((struct rtentry_dbg *)rt);
 }
 
+boolean_t
+rt_trylock(struct rtentry *rt)
+{
+	RT_LOCK_ASSERT_NOTHELD(rt);
+	if (!lck_mtx_try_lock(&rt->rt_lock))
+		return (FALSE);
+	if (rte_debug & RTD_DEBUG)
+		rte_lock_debug((struct rtentry_dbg *)rt);
+	return (TRUE);
+}
+
 void
 rt_unlock(struct rtentry *rt)
 {
@@ -182,6 +182,7 @@ struct rtentry {
 	uint32_t rt_refcnt;		/* # held references */
 	uint32_t rt_flags;		/* up/down?, host/net */
 	uint32_t rt_genid;		/* route generation id */
+	uint32_t rt_fibnh;		/* IPv4 FIB next hop index, or 0 */
 	struct sockaddr *rt_gateway;	/* value */
 	struct ifnet *rt_ifp;		/* the answer: interface to use */
 	struct ifaddr *rt_ifa;		/* the answer: interface addr to use */
@@ -194,6 +195,7 @@ struct rtentry {
 	void (*rt_llinfo_purge)(struct rtentry *); /* llinfo purge fn */
 	void (*rt_llinfo_free)(void *); /* link level info free function */
 	void (*rt_llinfo_refresh) (struct rtentry *); /* expedite llinfo refresh */
+	void (*rt_llinfo_setexpire)(struct rtentry *); /* rt_expire changed fn */
 	struct rt_metrics rt_rmx;	/* metrics used by rx'ing protocols */
 #define	rt_use rt_rmx.rmx_pksent
 	struct rtentry *rt_gwroute;	/* implied entry for gatewayed routes */
@@ -529,6 +531,7 @@ extern struct rtentry *rt_lookup(boolean_t, struct sockaddr *,
     struct sockaddr *, struct radix_node_head *, unsigned int);
 extern struct rtentry *rt_lookup_coarse(boolean_t, struct sockaddr *,
     struct sockaddr *, struct radix_node_head *);
+extern struct rtentry *rt_lookup_peek(struct sockaddr *, struct rtentry **);
 extern void rtalloc(struct route *);
 extern void rtalloc_scoped(struct route *, unsigned int);
 extern void rtalloc_ign(struct route *, uint32_t);
@@ -565,6 +568,7 @@ extern void sin_set_ifscope(struct sockaddr *, unsigned int);
 extern unsigned int sin_get_ifscope(struct sockaddr *);
 extern unsigned int sin6_get_ifscope(struct sockaddr *);
 extern void rt_lock(struct rtentry *, boolean_t);
+extern boolean_t rt_trylock(struct rtentry *);
 extern void rt_unlock(struct rtentry *);
 extern struct sockaddr *rtm_scrub(int, int, struct sockaddr *,
     struct sockaddr *, void *, uint32_t, kauth_cred_t *);
@@ -83,6 +83,7 @@
 #include <netinet/in.h>
 #include <netinet/in_var.h>
 #include <netinet/in_arp.h>
+#include <netinet/in_fib.h>
 #include <netinet6/nd6.h>
 
 extern struct rtstat rtstat;
@@ -488,6 +489,8 @@ route_output(struct mbuf *m, struct socket *so)
 			saved_nrt->rt_genmask = info.rti_info[RTAX_GENMASK];
 			RT_REMREF_LOCKED(saved_nrt);
 			RT_UNLOCK(saved_nrt);
+			if (rt_key(saved_nrt)->sa_family == AF_INET)
+				in_fib_route_change(saved_nrt);
 		}
 		break;
 
@@ -629,6 +632,9 @@ report:
 			break;
 		}
 		RT_UNLOCK(rt);
+		if (rtm->rtm_type == RTM_CHANGE &&
+		    rt_key(rt)->sa_family == AF_INET)
+			in_fib_route_change(rt);
 		break;
 
 	default:
@@ -708,6 +714,8 @@ rt_setexpire(struct rtentry *rt, uint64_t expiry)
 	} else {
 		rt->rt_rmx.rmx_expire = 0;
 	}
+	if (rt->rt_llinfo_setexpire != NULL)
+		rt->rt_llinfo_setexpire(rt);
 }
 
 static int
@@ -63,11 +63,111 @@
 #include <kern/debug.h>
 #include <netinet/in.h>
 #include <libkern/libkern.h>
+#include <pexpert/pexpert.h>
 
 int cpu_in_cksum(struct mbuf *, int, int, uint32_t);
+int cpu_in_cksum_copy(struct mbuf *, int, int, void *, uint32_t);
 
 #define	PREDICT_FALSE(_exp)	__builtin_expect((_exp), 0)
 
+/*
+ * Block kernels for the 64-byte core of the checksum loops.  Each one
+ * returns a 64-bit value congruent, modulo 0xffff, to the sum of the
+ * native-endian 32-bit words within a span whose length is a multiple of
+ * 64 bytes; the copying variant also stores the span at dst.  They are
+ * selected by cpu_in_cksum_init() and are left NULL when disabled, in
+ * which case the portable unrolled loops below are used.
+ */
+typedef uint64_t (*in_cksum_blocks_func_t)(const uint8_t *, uint8_t *, int);
+
+static in_cksum_blocks_func_t in_cksum_blocks = NULL;
+static in_cksum_blocks_func_t in_cksum_copy_blocks = NULL;
+
+static int in_cksum_wide = 1;		/* boot-arg: in_cksum_wide=0 disables */
+
+/*
+ * Sum 64-bit words, counting the carries out of each accumulator
+ * separately so that the additions don't form a single dependency chain.
+ * Since 2^64 == 1 (mod 0xffff), every carry is worth 1, and the result
+ * stays congruent to the 32-bit word sum of what was added, with half as
+ * many loads and no partial reductions.  Only general purpose registers
+ * are used, as the kernel doesn't own the vector register file.
+ */
+#define	CKSUM_ADD64(_s, _c, _w) do {					\
+	uint64_t _v = (_w);						\
+	(_s) += _v;							\
+	(_c) += ((_s) < _v);						\
+} while (0)
+
+static uint64_t
+in_cksum_blocks_fold(uint64_t s0, uint64_t s1, uint64_t c0, uint64_t c1)
+{
+	uint64_t c = c0 + c1;
+
+	CKSUM_ADD64(s0, c, s1);
+	CKSUM_ADD64(s0, c, c);
+	/* c is tiny, so this last carry can't carry again */
+	return (s0 + (s0 < c));
+}
+
+static uint64_t
+in_cksum_blocks_wide(const uint8_t *data, uint8_t *dst, int len)
+{
+#pragma unused(dst)
+	const uint64_t *w = (const uint64_t *)(const void *)data;
+	uint64_t s0 = 0, s1 = 0, c0 = 0, c1 = 0;
+
+	for (; len > 0; len -= 64, w += 8) {
+		__builtin_prefetch(w + 16);
+		CKSUM_ADD64(s0, c0, w[0]);
+		CKSUM_ADD64(s1, c1, w[1]);
+		CKSUM_ADD64(s0, c0, w[2]);
+		CKSUM_ADD64(s1, c1, w[3]);
+		CKSUM_ADD64(s0, c0, w[4]);
+		CKSUM_ADD64(s1, c1, w[5]);
+		CKSUM_ADD64(s0, c0, w[6]);
+		CKSUM_ADD64(s1, c1, w[7]);
+	}
+	return (in_cksum_blocks_fold(s0, s1, c0, c1));
+}
+
+static uint64_t
+in_cksum_copy_blocks_wide(const uint8_t *data, uint8_t *dst, int len)
+{
+	const uint64_t *w = (const uint64_t *)(const void *)data;
+	uint64_t s0 = 0, s1 = 0, c0 = 0, c1 = 0, v;
+	int i;
+
+	for (; len > 0; len -= 64, w += 8, dst += 64) {
+		__builtin_prefetch(w + 16);
+		for (i = 0; i < 8; i += 2) {
+			v = w[i];
+			bcopy(&v, dst + i * 8, sizeof (v));
+			CKSUM_ADD64(s0, c0, v);
+			v = w[i + 1];
+			bcopy(&v, dst + i * 8 + 8, sizeof (v));
+			CKSUM_ADD64(s1, c1, v);
+		}
+	}
+	return (in_cksum_blocks_fold(s0, s1, c0, c1));
+}
+
+/*
+ * Pick the block kernels; called once during network stack
+ * initialization, before any of the checksum self-tests run.
+ */
+void
+cpu_in_cksum_init(void)
+{
+	(void) PE_parse_boot_argn("in_cksum_wide", &in_cksum_wide,
+	    sizeof (in_cksum_wide));
+	if (!in_cksum_wide)
+		return;
+
+	in_cksum_blocks = in_cksum_blocks_wide;
+	in_cksum_copy_blocks = in_cksum_copy_blocks_wide;
+}
+
 /*
  * Checksum routine for Internet Protocol family headers (Portable Version).
  *
@@ -303,6 +403,17 @@ post_initial_offset:
 			data += 2;
 			mlen -= 2;
 		}
+		if (in_cksum_blocks != NULL && mlen >= 64) {
+			uint64_t blksum;
+			int blklen = mlen & ~63;
+
+			blksum = (*in_cksum_blocks)(data, NULL, blklen);
+			/* 2^32 == 1 (mod 0xffff), so folding preserves the sum */
+			partial = (partial >> 32) + (partial & 0xffffffff);
+			partial += (blksum >> 32) + (blksum & 0xffffffff);
+			data += blklen;
+			mlen -= blklen;
+		}
 		while (mlen >= 64) {
 			__builtin_prefetch(data + 32);
 			__builtin_prefetch(data + 64);
@@ -394,3 +505,194 @@ trailing_bytes:
 	return (~final_acc & 0xffff);
 }
 #endif /* ULONG_MAX != 0xffffffffUL */
+
+#define	CKSUM_COPY32(_s, _d, _p) do {					\
+	uint32_t _w = *(const uint32_t *)(const void *)(_s);		\
+	*(uint32_t *)(void *)(_d) = _w;					\
+	(_p) += _w;							\
+} while (0)
+
+#define	CKSUM_COPY64(_s, _d, _p) do {					\
+	uint64_t _w = *(const uint64_t *)(const void *)(_s);		\
+	*(uint64_t *)(void *)(_d) = _w;					\
+	(_p) += (_w >> 32) + (_w & 0xffffffff);				\
+} while (0)
+
+#define	CKSUM_COPY128(_s, _d, _p) do {					\
+	CKSUM_COPY64((_s), (_d), (_p));					\
+	CKSUM_COPY64((_s) + 8, (_d) + 8, (_p));				\
+} while (0)
+
+/*
+ * Fused copy and checksum.
+ *
+ * Copies len bytes starting at offset off within the mbuf chain into the
+ * contiguous buffer dst, and returns the same value cpu_in_cksum() would
+ * have returned for that span.  This is meant for callers which would
+ * otherwise m_copydata() the span and then checksum it, so that the data
+ * gets pulled through the cache only once.  The destination need not be
+ * aligned.  A 64-bit accumulator is used regardless of the native word
+ * size, as this is only used on spans of data that are about to be
+ * transmitted.
+ */
+int
+cpu_in_cksum_copy(struct mbuf *m, int len, int off, void *dst0,
+    uint32_t initial_sum)
+{
+	int mlen;
+	uint64_t sum, partial;
+	unsigned int final_acc;
+	uint8_t *data, *dst = dst0;
+	boolean_t needs_swap, started_on_odd;
+
+	VERIFY(len >= 0);
+	VERIFY(off >= 0);
+
+	needs_swap = FALSE;
+	started_on_odd = FALSE;
+	sum = initial_sum;
+
+	for (;;) {
+		if (PREDICT_FALSE(m == NULL)) {
+			printf("%s: out of data\n", __func__);
+			return (-1);
+		}
+		mlen = m->m_len;
+		if (mlen > off) {
+			mlen -= off;
+			data = mtod(m, uint8_t *) + off;
+			goto post_initial_offset;
+		}
+		off -= mlen;
+		if (len == 0)
+			break;
+		m = m->m_next;
+	}
+
+	for (; len > 0; m = m->m_next) {
+		if (PREDICT_FALSE(m == NULL)) {
+			printf("%s: out of data\n", __func__);
+			return (-1);
+		}
+		mlen = m->m_len;
+		data = mtod(m, uint8_t *);
+post_initial_offset:
+		if (mlen == 0)
+			continue;
+		if (mlen > len)
+			mlen = len;
+		len -= mlen;
+
+		partial = 0;
+		if ((uintptr_t)data & 1) {
+			/* Align on word boundary */
+			started_on_odd = !started_on_odd;
+#if BYTE_ORDER == LITTLE_ENDIAN
+			partial = *data << 8;
+#else
+			partial = *data;
+#endif
+			*dst++ = *data++;
+			--mlen;
+		}
+		needs_swap = started_on_odd;
+		if ((uintptr_t)data & 2) {
+			uint16_t w;
+
+			if (mlen < 2)
+				goto trailing_bytes;
+			w = *(uint16_t *)(void *)data;
+			*(uint16_t *)(void *)dst = w;
+			partial += w;
+			data += 2;
+			dst += 2;
+			mlen -= 2;
+		}
+		if (in_cksum_copy_blocks != NULL && mlen >= 64) {
+			uint64_t blksum;
+			int blklen = mlen & ~63;
+
+			blksum = (*in_cksum_copy_blocks)(data, dst, blklen);
+			partial = (partial >> 32) + (partial & 0xffffffff);
+			partial += (blksum >> 32) + (blksum & 0xffffffff);
+			data += blklen;
+			dst += blklen;
+			mlen -= blklen;
+		}
+		while (mlen >= 64) {
+			__builtin_prefetch(data + 64);
+			CKSUM_COPY128(data, dst, partial);
+			CKSUM_COPY128(data + 16, dst + 16, partial);
+			CKSUM_COPY128(data + 32, dst + 32, partial);
+			CKSUM_COPY128(data + 48, dst + 48, partial);
+			data += 64;
+			dst += 64;
+			mlen -= 64;
+			if (PREDICT_FALSE(partial & (3ULL << 62))) {
+				if (needs_swap)
+					partial = (partial << 8) +
+					    (partial >> 56);
+				sum += (partial >> 32);
+				sum += (partial & 0xffffffff);
+				partial = 0;
+			}
+		}
+		/*
+		 * mlen is not updated below as the remaining tests
+		 * are using bit masks, which are not affected.
+		 */
+		if (mlen & 32) {
+			CKSUM_COPY128(data, dst, partial);
+			CKSUM_COPY128(data + 16, dst + 16, partial);
+			data += 32;
+			dst += 32;
+		}
+		if (mlen & 16) {
+			CKSUM_COPY128(data, dst, partial);
+			data += 16;
+			dst += 16;
+		}
+		if (mlen & 8) {
+			CKSUM_COPY64(data, dst, partial);
+			data += 8;
+			dst += 8;
+		}
+		if (mlen & 4) {
+			CKSUM_COPY32(data, dst, partial);
+			data += 4;
+			dst += 4;
+		}
+		if (mlen & 2) {
+			uint16_t w = *(uint16_t *)(void *)data;
+
+			*(uint16_t *)(void *)dst = w;
+			partial += w;
+			data += 2;
+			dst += 2;
+		}
+trailing_bytes:
+		if (mlen & 1) {
+#if BYTE_ORDER == LITTLE_ENDIAN
+			partial += *data;
+#else
+			partial += *data << 8;
+#endif
+			*dst++ = *data;
+			started_on_odd = !started_on_odd;
+		}
+
+		if (needs_swap)
+			partial = (partial << 8) + (partial >> 56);
+		sum += (partial >> 32) + (partial & 0xffffffff);
+		/*
+		 * Reduce sum to allow potential byte swap
+		 * in the next iteration without carry.
+		 */
+		sum = (sum >> 32) + (sum & 0xffffffff);
+	}
+	final_acc = (sum >> 48) + ((sum >> 32) & 0xffff) +
+	    ((sum >> 16) & 0xffff) + (sum & 0xffff);
+	final_acc = (final_acc >> 16) + (final_acc & 0xffff);
+	final_acc = (final_acc >> 16) + (final_acc & 0xffff);
+	return (~final_acc & 0xffff);
+}
@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Fragment reassembly tables; see frag_reass.h.
+ *
+ * Fragments are refused or trimmed as they are inserted so that the
+ * intervals in a queue never overlap, and every fragment lies within the
+ * datagram once its length is known.  The number of data bytes held then
+ * equals the datagram length exactly when there is no hole left.
+ *
+ * The sorted list is searched from its tail, where a fragment arriving
+ * in order goes, and otherwise from its head: stepping back through a
+ * TAILQ costs two dependent loads a fragment.  Past FRAGQ_TREE_MIN fragments the queue gets a tree as
+ * well, and keeps it until it is empty again; the list then only serves
+ * to walk the fragments in order.
+ *
+ * A table is walked once a second by its timer, one bucket at a time,
+ * to age out queues; the timer is only armed while the table is not
+ * empty.  The queue and fragment counts are updated atomically, so that
+ * they can be read without any bucket lock.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/mcache.h>
+#include <sys/protosw.h>
+#include <kern/locks.h>
+#include <kern/zalloc.h>
+#include <libkern/OSAtomic.h>
+
+#include <net/flowhash.h>
+#include <netinet/frag_reass.h>
+
+#include <dev/random/randomdev.h>
+
+#define	FRAGENT_ZONE_MAX	4096		/* maximum elements in zone */
+#define	FRAGENT_ZONE_NAME	"fragent"	/* name for zone */
+
+static struct zone *fragent_zone;
+
+static void fragtbl_timeout(void *);
+static struct fragent *fragq_lookup_le(struct fragq *, u_int32_t);
+
+static __inline int
+fragent_cmp(const struct fragent *a, const struct fragent *b)
+{
+	if (a->fe_off < b->fe_off)
+		return (-1);
+	return (a->fe_off > b->fe_off);
+}
+
+RB_GENERATE(fragent_tree, fragent, fe_link, fragent_cmp);
+
+void
+fragtbl_init(struct fragtbl *ft, const char *name, u_int32_t nbuckets,
+    int *maxqueues, void (*freef)(struct fragq *, int, struct fragq_mbufs *,
+    struct fragq_mbufs *), void (*defer)(struct fragq_mbufs *))
+{
+	u_int32_t i;
+
+	VERIFY(nbuckets > 0 && (nbuckets & (nbuckets - 1)) == 0);
+	VERIFY(freef != NULL);
+
+	if (fragent_zone == NULL) {
+		fragent_zone = zinit(sizeof (struct fragent),
+		    FRAGENT_ZONE_MAX * sizeof (struct fragent), 0,
+		    FRAGENT_ZONE_NAME);
+		if (fragent_zone == NULL)
+			panic("%s: failed allocating fragent_zone", __func__);
+		zone_change(fragent_zone, Z_EXPAND, TRUE);
+		zone_change(fragent_zone, Z_CALLERACCT, FALSE);
+	}
+
+	bzero(ft, sizeof (*ft));
+	ft->ft_name = name;
+	ft->ft_lck_grp_attr = lck_grp_attr_alloc_init();
+	ft->ft_lck_grp = lck_grp_alloc_init(name, ft->ft_lck_grp_attr);
+	ft->ft_lck_attr = lck_attr_alloc_init();
+
+	MALLOC(ft->ft_buckets, struct fragtbl_bucket *,
+	    nbuckets * sizeof (*ft->ft_buckets), M_FTABLE, M_WAITOK | M_ZERO);
+	if (ft->ft_buckets == NULL)
+		panic("%s: %s bucket allocation failed", __func__, name);
+	for (i = 0; i < nbuckets; i++) {
+		lck_mtx_init(&ft->ft_buckets[i].fb_lock, ft->ft_lck_grp,
+		    ft->ft_lck_attr);
+		TAILQ_INIT(&ft->ft_buckets[i].fb_head);
+	}
+	ft->ft_mask = nbuckets - 1;
+	ft->ft_seed = RandomULong();
+	ft->ft_maxqueues = maxqueues;
+	ft->ft_freef = freef;
+	ft->ft_defer = defer;
+}
+
+u_int32_t
+fragtbl_hash(struct fragtbl *ft, const void *key, u_int32_t len)
+{
+	return (net_flowhash(key, len, ft->ft_seed));
+}
+
+struct fragtbl_bucket *
+fragtbl_lock(struct fragtbl *ft, u_int32_t hash)
+{
+	struct fragtbl_bucket *fb = &ft->ft_buckets[hash & ft->ft_mask];
+
+	lck_mtx_lock(&fb->fb_lock);
+	return (fb);
+}
+
+void
+fragtbl_unlock(struct fragtbl_bucket *fb)
+{
+	lck_mtx_unlock(&fb->fb_lock);
+}
+
+void
+fragtbl_attach(struct fragtbl *ft, struct fragtbl_bucket *fb,
+    struct fragq *fq, u_int32_t hash, u_int8_t ttl)
+{
+	lck_mtx_assert(&fb->fb_lock, LCK_MTX_ASSERT_OWNED);
+	VERIFY(fb == &ft->ft_buckets[hash & ft->ft_mask]);
+
+	TAILQ_INIT(&fq->fq_list);
+	RB_INIT(&fq->fq_tree);
+	fq->fq_hash = hash;
+	fq->fq_nfrags = 0;
+	fq->fq_bytes = 0;
+	fq->fq_len = 0;
+	fq->fq_ttl = ttl;
+	fq->fq_flags = 0;
+	TAILQ_INSERT_HEAD(&fb->fb_head, fq, fq_link);
+	atomic_add_32(&ft->ft_nqueues, 1);
+}
+
+void
+fragtbl_detach(struct fragtbl *ft, struct fragtbl_bucket *fb,
+    struct fragq *fq)
+{
+	lck_mtx_assert(&fb->fb_lock, LCK_MTX_ASSERT_OWNED);
+
+	TAILQ_REMOVE(&fb->fb_head, fq, fq_link);
+	atomic_add_32(&ft->ft_nqueues, -1);
+}
+
+/*
+ * Make room for a new queue by freeing the oldest one on the bucket the
+ * caller holds or, if there is none, on another bucket whose lock can be
+ * taken without waiting.  Returns nonzero if a queue was freed.
+ */
+int
+fragtbl_reclaim(struct fragtbl *ft, struct fragtbl_bucket *fb,
+    struct fragq_mbufs *dfq, struct fragq_mbufs *diq)
+{
+	struct fragtbl_bucket *ofb;
+	struct fragq *fq;
+	u_int32_t i, b;
+
+	lck_mtx_assert(&fb->fb_lock, LCK_MTX_ASSERT_OWNED);
+
+	if ((fq = TAILQ_LAST(&fb->fb_head, fragq_head)) != NULL) {
+		fragtbl_detach(ft, fb, fq);
+		ft->ft_freef(fq, FRAGQ_RECLAIM, dfq, diq);
+		return (1);
+	}
+
+	b = fb - ft->ft_buckets;
+	for (i = 1; i <= ft->ft_mask; i++) {
+		ofb = &ft->ft_buckets[(b + i) & ft->ft_mask];
+		if (TAILQ_EMPTY(&ofb->fb_head) ||
+		    !lck_mtx_try_lock(&ofb->fb_lock))
+			continue;
+		if ((fq = TAILQ_LAST(&ofb->fb_head, fragq_head)) != NULL) {
+			fragtbl_detach(ft, ofb, fq);
+			ft->ft_freef(fq, FRAGQ_RECLAIM, dfq, diq);
+		}
+		lck_mtx_unlock(&ofb->fb_lock);
+		if (fq != NULL)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Free the mbufs collected while bucket locks were held, and hand the
+ * ones the protocol asked for back to it.  No bucket lock may be held.
+ */
+void
+fragtbl_finish(struct fragtbl *ft, struct fragq_mbufs *dfq,
+    struct fragq_mbufs *diq)
+{
+	if (dfq != NULL && !MBUFQ_EMPTY(dfq))
+		MBUFQ_DRAIN(dfq);
+	if (diq != NULL && !MBUFQ_EMPTY(diq)) {
+		if (ft->ft_defer != NULL)
+			ft->ft_defer(diq);
+		else
+			MBUFQ_DRAIN(diq);
+	}
+	VERIFY(dfq == NULL || MBUFQ_EMPTY(dfq));
+	VERIFY(diq == NULL || MBUFQ_EMPTY(diq));
+}
+
+/*
+ * Reassembly timer processing.
+ */
+static void
+fragtbl_timeout(void *arg)
+{
+	struct fragtbl *ft = arg;
+	struct fragtbl_bucket *fb;
+	struct fragq *fq, *tfq;
+	struct fragq_mbufs dfq, diq;
+	u_int32_t i;
+
+	MBUFQ_INIT(&dfq);	/* for deferred frees */
+	MBUFQ_INIT(&diq);	/* for the protocol, after unlocking */
+
+	/*
+	 * Update coarse-grained networking timestamp (in sec.); the idea
+	 * is to piggy-back on the timeout callout to update the counter
+	 * returnable via net_uptime().
+	 */
+	net_update_uptime();
+
+	/*
+	 * Buckets that look empty are skipped without taking their lock;
+	 * a queue added meanwhile just starts aging on the next run.
+	 */
+	for (i = 0; i <= ft->ft_mask; i++) {
+		fb = &ft->ft_buckets[i];
+		if (TAILQ_EMPTY(&fb->fb_head))
+			continue;
+		lck_mtx_lock(&fb->fb_lock);
+		TAILQ_FOREACH_SAFE(fq, &fb->fb_head, fq_link, tfq) {
+			if (--fq->fq_ttl == 0) {
+				fragtbl_detach(ft, fb, fq);
+				ft->ft_freef(fq, FRAGQ_TIMEOUT, &dfq, &diq);
+			}
+		}
+		lck_mtx_unlock(&fb->fb_lock);
+	}
+
+	/*
+	 * If we are over the maximum number of queues (due to the limit
+	 * being lowered), drain off the oldest ones to get down to it.
+	 */
+	if (*ft->ft_maxqueues >= 0) {
+		u_int32_t max = *ft->ft_maxqueues;
+
+		for (i = 0; i <= ft->ft_mask && ft->ft_nqueues > max; i++) {
+			fb = &ft->ft_buckets[i];
+			if (TAILQ_EMPTY(&fb->fb_head))
+				continue;
+			lck_mtx_lock(&fb->fb_lock);
+			while (ft->ft_nqueues > max && (fq =
+			    TAILQ_LAST(&fb->fb_head, fragq_head)) != NULL) {
+				fragtbl_detach(ft, fb, fq);
+				ft->ft_freef(fq, FRAGQ_OVERFLOW, &dfq, &diq);
+			}
+			lck_mtx_unlock(&fb->fb_lock);
+		}
+	}
+
+	/* re-arm the purge timer if there's work to do */
+	ft->ft_timeout_run = 0;
+	fragtbl_sched_timeout(ft);
+
+	fragtbl_finish(ft, &dfq, &diq);
+}
+
+void
+fragtbl_sched_timeout(struct fragtbl *ft)
+{
+	if (ft->ft_nqueues > 0 &&
+	    OSCompareAndSwap(0, 1, &ft->ft_timeout_run))
+		timeout(fragtbl_timeout, ft, hz);
+}
+
+/*
+ * Drain off all datagram fragments.
+ */
+void
+fragtbl_drain(struct fragtbl *ft)
+{
+	struct fragtbl_bucket *fb;
+	struct fragq *fq;
+	struct fragq_mbufs dfq, diq;
+	u_int32_t i;
+
+	MBUFQ_INIT(&dfq);
+	MBUFQ_INIT(&diq);
+
+	for (i = 0; i <= ft->ft_mask; i++) {
+		fb = &ft->ft_buckets[i];
+		if (TAILQ_EMPTY(&fb->fb_head))
+			continue;
+		lck_mtx_lock(&fb->fb_lock);
+		while ((fq = TAILQ_FIRST(&fb->fb_head)) != NULL) {
+			fragtbl_detach(ft, fb, fq);
+			ft->ft_freef(fq, FRAGQ_DRAIN, &dfq, &diq);
+		}
+		lck_mtx_unlock(&fb->fb_lock);
+	}
+
+	fragtbl_finish(ft, &dfq, &diq);
+}
+
+struct fragent *
+fragent_alloc(int how)
+{
+	struct fragent *fe;
+
+	fe = (how == M_WAITOK) ? zalloc(fragent_zone) :
+	    zalloc_noblock(fragent_zone);
+	if (fe != NULL)
+		bzero(fe, sizeof (*fe));
+
+	return (fe);
+}
+
+void
+fragent_free(struct fragent *fe)
+{
+	zfree(fragent_zone, fe);
+}
+
+/*
+ * Return the fragment with the highest offset not above off, if any.
+ */
+static struct fragent *
+fragq_lookup_le(struct fragq *fq, u_int32_t off)
+{
+	struct fragent *fe, *le = NULL;
+
+	if (!(fq->fq_flags & FQF_TREE)) {
+		fe = TAILQ_LAST(&fq->fq_list, fragent_list);
+		if (fe == NULL || fe->fe_off <= off)
+			return (fe);
+		TAILQ_FOREACH(fe, &fq->fq_list, fe_list) {
+			if (fe->fe_off > off)
+				break;
+			le = fe;
+		}
+		return (le);
+	}
+
+	fe = RB_ROOT(&fq->fq_tree);
+	while (fe != NULL) {
+		if (fe->fe_off <= off) {
+			le = fe;
+			fe = RB_RIGHT(fe, fe_link);
+		} else {
+			fe = RB_LEFT(fe, fe_link);
+		}
+	}
+	return (le);
+}
+
+/*
+ * Insert a fragment into a queue, whose bucket lock the caller holds.
+ *
+ * A fragment that would end past the end of the datagram, or a last
+ * fragment that disagrees with what is already known about where the
+ * datagram ends, is refused.  So is any fragment that overlaps another,
+ * unless FRAGQ_TRIM is given: then the data a preceding fragment already
+ * has is trimmed off the front of the new one (which is refused if none
+ * is left), and the new data replaces that of the fragments after it,
+ * which are trimmed or, if completely covered, removed and put on dfq.
+ * Trimming assumes the data starts at the beginning of fe_m.
+ *
+ * Returns 0 if the fragment was refused, in which case the caller still
+ * owns it; otherwise FRAGQ_INSERTED, plus FRAGQ_TRIMMED if any data was
+ * trimmed off.
+ */
+int
+fragq_insert(struct fragtbl *ft, struct fragq *fq, struct fragent *fe,
+    int flags, struct fragq_mbufs *dfq)
+{
+	struct fragent *p, *q, *nq;
+	u_int32_t end, i;
+	int ret = 0;
+
+	VERIFY(!(flags & FRAGQ_TRIM) || fe->fe_hoff == 0);
+
+	end = fe->fe_off + fe->fe_len;
+	if (fq->fq_flags & FQF_LAST) {
+		if (end > fq->fq_len ||
+		    (!(fe->fe_flags & FE_MORE) && end != fq->fq_len))
+			return (0);
+	} else if (!(fe->fe_flags & FE_MORE)) {
+		q = TAILQ_LAST(&fq->fq_list, fragent_list);
+		if (q != NULL && q->fe_off + q->fe_len > end)
+			return (0);
+	}
+
+	/*
+	 * If there is a preceding fragment, it may provide some of our
+	 * data already.
+	 */
+	p = fragq_lookup_le(fq, fe->fe_off);
+	if (p != NULL && p->fe_off + p->fe_len > fe->fe_off) {
+		i = p->fe_off + p->fe_len - fe->fe_off;
+		if (!(flags & FRAGQ_TRIM) || i >= fe->fe_len)
+			return (0);
+		m_adj(fe->fe_m, i);
+		fe->fe_off += i;
+		fe->fe_len -= i;
+		ret |= FRAGQ_TRIMMED;
+	}
+
+	/*
+	 * While we overlap succeeding fragments trim them or, if they are
+	 * completely covered, dequeue them.  A fragment trimmed this way
+	 * keeps its place in the queue, as it still starts after us and
+	 * ends before the one following it.
+	 */
+	q = (p != NULL) ? FRAGQ_NEXT(p) : FRAGQ_FIRST(fq);
+	for (; q != NULL && end > q->fe_off; q = nq) {
+		if (!(flags & FRAGQ_TRIM))
+			return (0);
+		i = end - q->fe_off;
+		if (i < q->fe_len) {
+			m_adj(q->fe_m, i);
+			q->fe_off += i;
+			q->fe_len -= i;
+			fq->fq_bytes -= i;
+			ret |= FRAGQ_TRIMMED;
+			break;
+		}
+		nq = FRAGQ_NEXT(q);
+		fragq_remove(ft, fq, q);
+		MBUFQ_ENQUEUE(dfq, q->fe_m);
+		fragent_free(q);
+	}
+
+	/* only an empty fragment can collide with another's offset */
+	if (fq->fq_flags & FQF_TREE) {
+		if (RB_INSERT(fragent_tree, &fq->fq_tree, fe) != NULL)
+			return (0);
+	} else if (p != NULL && p->fe_off == fe->fe_off) {
+		return (0);
+	}
+	if (p != NULL)
+		TAILQ_INSERT_AFTER(&fq->fq_list, p, fe, fe_list);
+	else
+		TAILQ_INSERT_HEAD(&fq->fq_list, fe, fe_list);
+	if (++fq->fq_nfrags > FRAGQ_TREE_MIN &&
+	    !(fq->fq_flags & FQF_TREE)) {
+		TAILQ_FOREACH(q, &fq->fq_list, fe_list)
+			RB_INSERT(fragent_tree, &fq->fq_tree, q);
+		fq->fq_flags |= FQF_TREE;
+	}
+	fq->fq_bytes += fe->fe_len;
+	atomic_add_32(&ft->ft_nfrags, 1);
+	if (!(fe->fe_flags & FE_MORE)) {
+		fq->fq_flags |= FQF_LAST;
+		fq->fq_len = end;
+	}
+	return (ret | FRAGQ_INSERTED);
+}
+
+/*
+ * Take a fragment off its queue; the caller frees it.
+ */
+void
+fragq_remove(struct fragtbl *ft, struct fragq *fq, struct fragent *fe)
+{
+	TAILQ_REMOVE(&fq->fq_list, fe, fe_list);
+	if (fq->fq_flags & FQF_TREE)
+		RB_REMOVE(fragent_tree, &fq->fq_tree, fe);
+	VERIFY(fq->fq_nfrags > 0 && fq->fq_bytes >= fe->fe_len);
+	if (--fq->fq_nfrags == 0)
+		fq->fq_flags &= ~FQF_TREE;
+	fq->fq_bytes -= fe->fe_len;
+	atomic_add_32(&ft->ft_nfrags, -1);
+}
+
+/*
+ * Take every fragment off a queue, putting their mbufs on dfq.
+ */
+void
+fragq_flush(struct fragtbl *ft, struct fragq *fq, struct fragq_mbufs *dfq)
+{
+	struct fragent *fe, *tfe;
+
+	FRAGQ_FOREACH_SAFE(fe, fq, tfe) {
+		fragq_remove(ft, fq, fe);
+		MBUFQ_ENQUEUE(dfq, fe->fe_m);
+		fragent_free(fe);
+	}
+	VERIFY(fq->fq_nfrags == 0 && fq->fq_bytes == 0);
+}
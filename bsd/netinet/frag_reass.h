@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef _NETINET_FRAG_REASS_H_
+#define	_NETINET_FRAG_REASS_H_
+
+#ifdef BSD_KERNEL_PRIVATE
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/mbuf.h>
+#include <kern/locks.h>
+#include <libkern/tree.h>
+
+/*
+ * Fragment reassembly tables, shared by IPv4 and IPv6.
+ *
+ * Datagrams being reassembled (fragq) are kept in a hash table keyed on
+ * whatever identifies a datagram for the protocol; each bucket has its own
+ * lock, which covers the queues on it and their fragments.  The protocol
+ * embeds a fragq at the start of its own queue structure, computes the
+ * hash with fragtbl_hash(), and does its own matching within the bucket.
+ *
+ * The fragments of a datagram (fragent) are kept on a list sorted by
+ * offset and, once there are more than FRAGQ_TREE_MIN of them, also in a
+ * red-black tree by offset; a short list is quicker to search than a
+ * tree, which only pays for itself on datagrams cut in many pieces.  The
+ * intervals in a queue never overlap: an incoming fragment is either
+ * refused or trimmed against its neighbours when it is inserted.
+ * Since the queue also keeps the number of data bytes it holds, and the
+ * datagram length once the last fragment has been seen, completeness is
+ * a comparison rather than a walk of the fragments.
+ */
+
+struct fragent {
+	TAILQ_ENTRY(fragent) fe_list;	/* on the fragq's list */
+	RB_ENTRY(fragent) fe_link;	/* in the fragq's tree, if FQF_TREE */
+	struct mbuf	*fe_m;		/* the fragment */
+	u_int32_t	fe_off;		/* offset of the data in the datagram */
+	u_int32_t	fe_len;		/* length of the data */
+	u_int32_t	fe_hoff;	/* where the data starts in fe_m */
+	u_int32_t	fe_flags;	/* see below */
+};
+
+#define	FE_MORE		0x1		/* more fragments follow this one */
+
+TAILQ_HEAD(fragent_list, fragent);
+RB_HEAD(fragent_tree, fragent);
+
+struct fragq {
+	TAILQ_ENTRY(fragq) fq_link;	/* on the hash bucket */
+	struct fragent_list fq_list;	/* fragments, by offset */
+	struct fragent_tree fq_tree;	/* the same, if FQF_TREE */
+	u_int32_t	fq_hash;
+	u_int32_t	fq_nfrags;	/* # of fragments in fq_list */
+	u_int32_t	fq_bytes;	/* data bytes in fq_list */
+	u_int32_t	fq_len;		/* datagram length, if FQF_LAST */
+	u_int8_t	fq_ttl;		/* timer ticks left */
+	u_int8_t	fq_flags;	/* see below */
+};
+
+#define	FQF_LAST	0x1		/* last fragment seen, fq_len is set */
+#define	FQF_TREE	0x2		/* fq_tree is kept as well */
+
+/* fragments a queue holds before it is also kept in a tree */
+#define	FRAGQ_TREE_MIN	128
+
+#define	FRAGQ_FIRST(fq)		TAILQ_FIRST(&(fq)->fq_list)
+#define	FRAGQ_NEXT(fe)		TAILQ_NEXT(fe, fe_list)
+#define	FRAGQ_FOREACH_SAFE(fe, fq, tfe)					\
+	TAILQ_FOREACH_SAFE(fe, &(fq)->fq_list, fe_list, tfe)
+#define	FRAGQ_COMPLETE(fq)						\
+	(((fq)->fq_flags & FQF_LAST) && (fq)->fq_bytes == (fq)->fq_len)
+
+/* fragq_insert() flags and return value */
+#define	FRAGQ_TRIM	0x1		/* trim overlaps rather than refuse */
+#define	FRAGQ_INSERTED	0x1		/* fragment is in the queue */
+#define	FRAGQ_TRIMMED	0x2		/* some data was trimmed off */
+
+struct fragtbl_bucket {
+	decl_lck_mtx_data(, fb_lock);
+	TAILQ_HEAD(fragq_head, fragq) fb_head;	/* newest first */
+};
+
+MBUFQ_HEAD(fragq_mbufs);
+
+/* why a queue is being freed, for ft_freef */
+#define	FRAGQ_TIMEOUT	1		/* timed out */
+#define	FRAGQ_OVERFLOW	2		/* over the limit on the timer */
+#define	FRAGQ_RECLAIM	3		/* over the limit, for a new queue */
+#define	FRAGQ_DRAIN	4		/* protocol drain */
+
+struct fragtbl {
+	const char	*ft_name;
+	struct fragtbl_bucket *ft_buckets;
+	u_int32_t	ft_mask;	/* # of buckets - 1 */
+	u_int32_t	ft_seed;	/* hash seed */
+	u_int32_t	ft_nqueues;	/* # of queues in the table */
+	u_int32_t	ft_nfrags;	/* # of fragments in the table */
+	u_int32_t	ft_timeout_run;	/* timer is scheduled to run */
+	int		*ft_maxqueues;	/* queue limit; negative for none */
+	/*
+	 * Free a queue that has been taken off its bucket, with the bucket
+	 * lock held.  Mbufs to be freed go on the first list, and those the
+	 * protocol wants back once the lock is dropped on the second, which
+	 * is then passed to ft_defer.
+	 */
+	void		(*ft_freef)(struct fragq *, int, struct fragq_mbufs *,
+			    struct fragq_mbufs *);
+	void		(*ft_defer)(struct fragq_mbufs *);
+	lck_grp_attr_t	*ft_lck_grp_attr;
+	lck_grp_t	*ft_lck_grp;
+	lck_attr_t	*ft_lck_attr;
+};
+
+extern void fragtbl_init(struct fragtbl *, const char *, u_int32_t, int *,
+    void (*)(struct fragq *, int, struct fragq_mbufs *, struct fragq_mbufs *),
+    void (*)(struct fragq_mbufs *));
+extern u_int32_t fragtbl_hash(struct fragtbl *, const void *, u_int32_t);
+extern struct fragtbl_bucket *fragtbl_lock(struct fragtbl *, u_int32_t);
+extern void fragtbl_unlock(struct fragtbl_bucket *);
+extern void fragtbl_attach(struct fragtbl *, struct fragtbl_bucket *,
+    struct fragq *, u_int32_t, u_int8_t);
+extern void fragtbl_detach(struct fragtbl *, struct fragtbl_bucket *,
+    struct fragq *);
+extern int fragtbl_reclaim(struct fragtbl *, struct fragtbl_bucket *,
+    struct fragq_mbufs *, struct fragq_mbufs *);
+extern void fragtbl_sched_timeout(struct fragtbl *);
+extern void fragtbl_drain(struct fragtbl *);
+extern void fragtbl_finish(struct fragtbl *, struct fragq_mbufs *,
+    struct fragq_mbufs *);
+
+extern struct fragent *fragent_alloc(int);
+extern void fragent_free(struct fragent *);
+extern int fragq_insert(struct fragtbl *, struct fragq *, struct fragent *,
+    int, struct fragq_mbufs *);
+extern void fragq_remove(struct fragtbl *, struct fragq *, struct fragent *);
+extern void fragq_flush(struct fragtbl *, struct fragq *,
+    struct fragq_mbufs *);
+
+RB_PROTOTYPE_SC(__private_extern__, fragent_tree, fragent, fe_link,
+    fragent_cmp);
+#endif /* BSD_KERNEL_PRIVATE */
+#endif /* _NETINET_FRAG_REASS_H_ */
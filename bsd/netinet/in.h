@@ -823,6 +823,7 @@ extern uint16_t in_cksum_hdr_opt(const struct ip *);
 extern uint16_t ip_cksum_hdr_dir(struct mbuf *, uint32_t, int);
 extern uint32_t in_finalize_cksum(struct mbuf *, uint32_t, uint32_t);
 extern uint16_t b_sum16(const void *buf, int len);
+extern void cpu_in_cksum_init(void);
 
 #define	in_cksum(_m, _l)			\
 	inet_cksum(_m, 0, 0, _l)
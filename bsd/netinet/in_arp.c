@@ -78,6 +78,7 @@
 #include <net/dlil.h>
 #include <net/if_types.h>
 #include <net/if_llreach.h>
+#include <net/if_nbr.h>
 #include <net/route.h>
 
 #include <netinet/if_ether.h>
@@ -108,6 +109,10 @@ static const size_t MAX_HW_LEN = 10;
  *
  *	- Routing entry lock (rt_lock)
  *
+ * la_nbr is hashed in the neighbor table of the route's interface
+ * and armed on arp_wheel for rt_expire, both also under rt_lock; see
+ * net/if_nbr.h.  Entries are only armed while they are on llinfo_arp.
+ *
  * Due to the dependency on rt_lock, llinfo_arp has the same lifetime
  * as the route entry itself.  When a route is deleted (RTM_DELETE),
  * it is simply removed from the global list but the memory is not
@@ -129,9 +134,16 @@ struct llinfo_arp {
 	u_int32_t la_maxtries;		/* retry limit */
 	uint32_t  la_flags;
 #define LLINFO_RTRFAIL_EVTSENT		0x1 /* sent an ARP event */
+	struct nbr_entry la_nbr;	/* neighbor table and expiry */
 };
 static LIST_HEAD(, llinfo_arp) llinfo_arp;
 
+#define	NBR_TO_LA(_ne)							\
+	((struct llinfo_arp *)(void *)((caddr_t)(_ne) -			\
+	offsetof(struct llinfo_arp, la_nbr)))
+
+static struct nbr_wheel arp_wheel;	/* llinfo_arp by rt_expire */
+
 static int arp_timeout_run;		/* arp_timeout is scheduled to run */
 static void arp_timeout(void *);
 static void arp_sched_timeout(struct timeval *);
@@ -147,6 +159,7 @@ static void arp_llinfo_purge(struct rtentry *);
 static void arp_llinfo_get_ri(struct rtentry *, struct rt_reach_info *);
 static void arp_llinfo_get_iflri(struct rtentry *, struct ifnet_llreach_info *);
 static void arp_llinfo_refresh(struct rtentry *);
+static void arp_llinfo_setexpire(struct rtentry *);
 
 static __inline void arp_llreach_use(struct llinfo_arp *);
 static __inline int arp_llreach_reachable(struct llinfo_arp *);
@@ -245,6 +258,7 @@ arp_init(void)
 	VERIFY(!arpinit_done);
 
 	LIST_INIT(&llinfo_arp);
+	nbr_wheel_init(&arp_wheel);
 
 	llinfo_arp_zone = zinit(sizeof (struct llinfo_arp),
 	    LLINFO_ARP_ZONE_MAX * sizeof (struct llinfo_arp), 0,
@@ -372,11 +386,29 @@ arp_llinfo_refresh(struct rtentry *rt)
 	}
 
 	if (rt->rt_expire > timenow + arp_unicast_lim) {
-		rt->rt_expire = timenow + arp_unicast_lim;
+		rt_setexpire(rt, timenow + arp_unicast_lim);
 	}
 	return;
 }
 
+/*
+ * rt_setexpire() callback; keep the entry on arp_wheel in step with
+ * rt_expire.
+ */
+static void
+arp_llinfo_setexpire(struct rtentry *rt)
+{
+	struct llinfo_arp *la = rt->rt_llinfo;
+
+	RT_LOCK_ASSERT_HELD(rt);
+
+	/* Not on llinfo_arp anymore; see RTM_DELETE in arp_rtrequest() */
+	if (la == NULL || la->la_le.le_prev == NULL)
+		return;
+
+	nbr_wheel_sched(&arp_wheel, &la->la_nbr, rt->rt_expire);
+}
+
 void
 arp_llreach_set_reachable(struct ifnet *ifp, void *addr, unsigned int alen)
 {
@@ -565,6 +597,7 @@ arptfree(struct llinfo_arp *la, void *arg)
 
 	/* ARP entry hasn't expired and we're not draining? */
 	if (!ap->draining && rt->rt_expire > net_uptime()) {
+		nbr_wheel_sched(&arp_wheel, &la->la_nbr, rt->rt_expire);
 		RT_UNLOCK(rt);
 		ap->aging++;
 		return;
@@ -582,6 +615,12 @@ arptfree(struct llinfo_arp *la, void *arg)
 				sdl->sdl_alen = 0;
 			la->la_asked = 0;
 			rt->rt_flags &= ~RTF_REJECT;
+			/*
+			 * Look at it again in a while, and delete it then
+			 * if the references are gone.
+			 */
+			nbr_wheel_sched(&arp_wheel, &la->la_nbr,
+			    net_uptime() + MAX(arpt_prune, 1));
 		}
 		RT_UNLOCK(rt);
 	} else if (!(rt->rt_flags & RTF_STATIC)) {
@@ -629,23 +668,27 @@ in_arpdrain(void *arg)
 }
 
 /*
- * Timeout routine.  Age arp_tab entries periodically.
+ * Timeout routine.  Age arp_tab entries periodically; only the entries
+ * that have expired since the last run are looked at.
  */
 static void
 arp_timeout(void *arg)
 {
 #pragma unused(arg)
-	struct llinfo_arp *la, *ola;
+	struct nbr_entry *ne;
 	struct timeval atv;
 	struct arptf_arg farg;
 
 	lck_mtx_lock(rnh_lock);
-	la = llinfo_arp.lh_first;
 	bzero(&farg, sizeof (farg));
-	while ((ola = la) != NULL) {
-		la = la->la_le.le_next;
-		arptfree(ola, &farg);
-	}
+	net_update_uptime();
+	nbr_wheel_advance(&arp_wheel, net_uptime());
+	/*
+	 * Entries taken off the wheel stay on llinfo_arp, and so are kept
+	 * around by rnh_lock; arptfree() rearms or deletes them.
+	 */
+	while ((ne = nbr_wheel_pop(&arp_wheel)) != NULL)
+		arptfree(NBR_TO_LA(ne), &farg);
 	if (arp_verbose) {
 		log(LOG_DEBUG, "%s: found %u, aging %u, sticky %u, killed %u\n",
 		    __func__, farg.found, farg.aging, farg.sticky, farg.killed);
@@ -654,7 +697,7 @@ arp_timeout(void *arg)
 	atv.tv_sec = arpt_prune;
 	/* re-arm the timer if there's work to do */
 	arp_timeout_run = 0;
-	if (farg.aging > 0)
+	if (nbr_wheel_next(&arp_wheel) != 0)
 		arp_sched_timeout(&atv);
 	else if (arp_verbose)
 		log(LOG_DEBUG, "%s: not rescheduling timer\n", __func__);
@@ -776,11 +819,23 @@ arp_rtrequest(int req, struct rtentry *rt, struct sockaddr *sa)
 		rt->rt_llinfo_purge	= arp_llinfo_purge;
 		rt->rt_llinfo_free	= arp_llinfo_free;
 		rt->rt_llinfo_refresh   = arp_llinfo_refresh;
+		rt->rt_llinfo_setexpire	= arp_llinfo_setexpire;
 		rt->rt_flags |= RTF_LLINFO;
 		la->la_rt = rt;
+		nbr_entry_init(&la->la_nbr, rt);
 		LIST_INSERT_HEAD(&llinfo_arp, la, la_le);
 		arpstat.inuse++;
 
+		/*
+		 * Hash it by address on the interface it is created on,
+		 * before a local address moves it to lo_ifp below; proxy
+		 * only entries are looked up in the radix tree.
+		 */
+		if (((struct sockaddr_inarp *)(void *)rt_key(rt))->
+		    sin_other == 0)
+			nbr_insert(rt->rt_ifp, &la->la_nbr);
+		arp_llinfo_setexpire(rt);
+
 		/* We have at least one entry; arm the timer if not already */
 		arp_sched_timeout(NULL);
 
@@ -880,6 +935,8 @@ arp_rtrequest(int req, struct rtentry *rt, struct sockaddr *sa)
 		la->la_le.le_next = NULL;
 		la->la_le.le_prev = NULL;
 		arpstat.inuse--;
+		nbr_remove(&la->la_nbr);
+		nbr_wheel_unsched(&arp_wheel, &la->la_nbr);
 
 		/*
 		 * Purge any link-layer info caching.
@@ -935,7 +992,8 @@ arp_lookup_route(const struct in_addr *addr, int create, int proxy,
 	    { sizeof (sin), AF_INET, 0, { 0 }, { 0 }, 0, 0 };
 	const char *why = NULL;
 	errno_t	error = 0;
-	route_t rt;
+	struct ifnet *ifp;
+	route_t rt = NULL;
 
 	*route = NULL;
 
@@ -949,11 +1007,22 @@ arp_lookup_route(const struct in_addr *addr, int create, int proxy,
 	if (IN_LINKLOCAL(ntohl(addr->s_addr)))
 		ifscope = IFSCOPE_NONE;
 
-	rt = rtalloc1_scoped((struct sockaddr *)&sin, create, 0, ifscope);
-	if (rt == NULL)
-		return (ENETUNREACH);
+	/*
+	 * An existing entry on the interface is found in its neighbor
+	 * table, without going through the radix tree and rnh_lock.
+	 */
+	if (!proxy && ifscope != IFSCOPE_NONE && ifscope <= if_index &&
+	    (ifp = ifindex2ifnet[ifscope]) != NULL)
+		rt = nbr_lookup(ifp, AF_INET, addr);
+
+	if (rt == NULL) {
+		rt = rtalloc1_scoped((struct sockaddr *)&sin, create, 0,
+		    ifscope);
+		if (rt == NULL)
+			return (ENETUNREACH);
 
-	RT_LOCK(rt);
+		RT_LOCK(rt);
+	}
 
 	if (rt->rt_flags & RTF_GATEWAY) {
 		why = "host is not on local network";
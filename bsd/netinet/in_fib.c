@@ -0,0 +1,841 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * IPv4 forwarding information base: a DIR-24-8 table kept alongside the
+ * AF_INET radix tree.
+ *
+ * tbl24 holds one entry per /24.  An entry is either a next hop index,
+ * used for every address in the /24, or IN_FIB_GROUP plus the index of a
+ * 256-entry tbl8 group holding one next hop index per address.  Next hop
+ * indices refer to routes in the next hop table; index 0 means the lookup
+ * has to go through the radix tree.  A route owns at most one next hop
+ * (rt_fibnh) for as long as it is in the tree, and the table holds a
+ * reference on it.
+ *
+ * The tables are modified only with rnh_lock held.  When a route changes,
+ * the address range covered by its prefix is split at the boundaries of
+ * every route inside it, each piece is resolved with rt_lookup_peek(), and
+ * the affected tbl24 entries and tbl8 groups are rewritten; tbl8 groups are
+ * never modified once published, but replaced.  Readers take no lock: they
+ * announce themselves in a per-CPU counter for the current generation,
+ * and replaced groups and next hops of deleted routes are only reused or
+ * released once every reader that could still see them has left.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/sysctl.h>
+#include <sys/socket.h>
+#include <sys/malloc.h>
+#include <sys/mcache.h>
+#include <kern/locks.h>
+#include <kern/cpu_number.h>
+#include <machine/machine_routines.h>
+#include <libkern/OSAtomic.h>
+
+#include <net/if.h>
+#include <net/route.h>
+#include <net/radix.h>
+#include <netinet/in.h>
+#include <netinet/in_var.h>
+#include <netinet/in_fib.h>
+
+#define	IN_FIB_GROUP		0x80000000	/* entry is a tbl8 group */
+#define	IN_FIB_TBL24_SIZE	(1 << 24)
+#define	IN_FIB_TBL8_SIZE	256
+#define	IN_FIB_GRP_CHUNK	256		/* tbl8 groups per chunk */
+#define	IN_FIB_GRP_MAX		(256 * IN_FIB_GRP_CHUNK)
+#define	IN_FIB_NH_CHUNK		4096		/* next hops per chunk */
+#define	IN_FIB_NH_MAX		(256 * IN_FIB_NH_CHUNK)
+
+/* routes that are looked up through the radix tree */
+#define	IN_FIB_SLOWFLAGS	(RTF_WASCLONED | RTF_LLINFO | RTF_DYNAMIC)
+
+#define	IN_FIB_TBL8(g)							\
+	(&in_fib_tbl8[(g) / IN_FIB_GRP_CHUNK]				\
+	    [((g) % IN_FIB_GRP_CHUNK) * IN_FIB_TBL8_SIZE])
+#define	IN_FIB_NH(n)							\
+	(in_fib_nh[(n) / IN_FIB_NH_CHUNK][(n) % IN_FIB_NH_CHUNK])
+#define	IN_FIB_READERS(cpu)						\
+	((volatile SInt32 *)(void *)(in_fib_pcpu +			\
+	    (size_t)(cpu) * in_fib_stride))
+
+struct in_fib_vec {
+	u_int32_t	*fv_items;
+	u_int32_t	fv_cnt;
+	u_int32_t	fv_max;
+};
+
+struct in_fib_walk_arg {
+	u_int32_t	fw_lo;
+	u_int32_t	fw_hi;
+	int		fw_error;
+	boolean_t	fw_bad;		/* non-contiguous netmask in range */
+};
+
+extern void delay(int);
+
+static int in_fib_setup(void);
+static void in_fib_teardown(void);
+static void in_fib_rebuild(void);
+static void in_fib_fail(void);
+static int in_fib_update(u_int32_t, u_int32_t);
+static int in_fib_write(u_int32_t, u_int32_t, u_int32_t);
+static int in_fib_resolve(u_int32_t, u_int32_t *);
+static int in_fib_walk(struct radix_node *, void *);
+static boolean_t in_fib_prefix(struct rtentry *, u_int32_t *, u_int32_t *);
+static int in_fib_grp_alloc(u_int32_t *);
+static int in_fib_nh_alloc(u_int32_t *);
+static void in_fib_retire(u_int32_t);
+static void in_fib_release(struct in_fib_vec *);
+static void in_fib_reclaim(void);
+static u_int32_t in_fib_readers(u_int32_t);
+static void in_fib_schedule(int);
+static void in_fib_timeout(void *);
+static int in_fib_vec_push(struct in_fib_vec *, u_int32_t);
+static void in_fib_vec_free(struct in_fib_vec *);
+static int in_fib_cmp(const void *, const void *);
+static int sysctl_in_fib_enabled SYSCTL_HANDLER_ARGS;
+
+extern void qsort(void *, size_t, size_t,
+    int (*)(const void *, const void *));
+
+int in_fib_enabled = 0;
+SYSCTL_PROC(_net_inet_ip, OID_AUTO, fib,
+	CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, &in_fib_enabled, 0,
+	sysctl_in_fib_enabled, "I",
+	"Use a DIR-24-8 table for non-scoped IPv4 route lookups");
+
+static u_int32_t in_fib_ngroups = 0;
+SYSCTL_UINT(_net_inet_ip, OID_AUTO, fib_groups, CTLFLAG_RD | CTLFLAG_LOCKED,
+	&in_fib_ngroups, 0, "Number of tbl8 groups in use");
+
+static u_int32_t in_fib_nnexthops = 0;
+SYSCTL_UINT(_net_inet_ip, OID_AUTO, fib_nexthops, CTLFLAG_RD | CTLFLAG_LOCKED,
+	&in_fib_nnexthops, 0, "Number of next hops in use");
+
+/* lookup tables; see above */
+static volatile u_int32_t *in_fib_tbl24;
+static u_int32_t *in_fib_tbl8[IN_FIB_GRP_MAX / IN_FIB_GRP_CHUNK];
+static struct rtentry **in_fib_nh[IN_FIB_NH_MAX / IN_FIB_NH_CHUNK];
+static u_int32_t in_fib_grp_hwm;	/* groups handed out so far */
+static u_int32_t in_fib_nh_hwm;		/* next hops handed out so far */
+static struct in_fib_vec in_fib_grp_free;
+static struct in_fib_vec in_fib_nh_free;
+
+/* tables match the radix tree and may be used by readers */
+static volatile int in_fib_valid = 0;
+
+/*
+ * Reader generations.  in_fib_limbo[0] collects items retired in the
+ * current generation, in_fib_limbo[1] those waiting for the readers of
+ * the previous generation to drain.
+ */
+static volatile u_int32_t in_fib_gen = 0;
+static struct in_fib_vec in_fib_limbo[2];
+static caddr_t in_fib_pcpu_buf;
+static caddr_t in_fib_pcpu;
+static u_int32_t in_fib_stride;
+static u_int32_t in_fib_ncpu;
+static int in_fib_timeout_run = 0;
+
+/* scratch space for in_fib_update() */
+static struct in_fib_vec in_fib_bounds;
+static struct in_fib_vec in_fib_nhs;
+
+void
+in_fib_init(void)
+{
+	static int in_fib_initialized = 0;
+
+	if (in_fib_initialized)
+		return;
+	in_fib_initialized = 1;
+
+	in_fib_ncpu = ml_get_max_cpus();
+	in_fib_stride = CPU_CACHE_LINE_SIZE;
+	in_fib_pcpu_buf = _MALLOC(in_fib_ncpu * in_fib_stride + in_fib_stride,
+	    M_RTABLE, M_WAITOK | M_ZERO);
+	if (in_fib_pcpu_buf == NULL)
+		panic("%s: failed allocating per-CPU reader counts", __func__);
+	in_fib_pcpu = (caddr_t)P2ROUNDUP((intptr_t)in_fib_pcpu_buf,
+	    in_fib_stride);
+}
+
+static int
+sysctl_in_fib_enabled SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int error, i;
+
+	i = in_fib_enabled;
+	error = sysctl_handle_int(oidp, &i, 0, req);
+	if (error != 0 || req->newptr == USER_ADDR_NULL)
+		return (error);
+
+	lck_mtx_lock(rnh_lock);
+	if (i != 0 && !in_fib_enabled)
+		error = in_fib_setup();
+	else if (i == 0 && in_fib_enabled)
+		in_fib_teardown();
+	lck_mtx_unlock(rnh_lock);
+
+	return (error);
+}
+
+static int
+in_fib_setup(void)
+{
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+	VERIFY(in_fib_tbl24 == NULL);
+
+	if (rt_tables[AF_INET] == NULL)
+		return (ENXIO);
+
+	in_fib_tbl24 = _MALLOC(IN_FIB_TBL24_SIZE * sizeof (u_int32_t),
+	    M_RTABLE, M_WAITOK | M_ZERO);
+	if (in_fib_tbl24 == NULL)
+		return (ENOMEM);
+	in_fib_grp_hwm = 0;
+	in_fib_nh_hwm = 1;		/* next hop 0 is reserved */
+	in_fib_enabled = 1;
+	in_fib_rebuild();
+
+	return (0);
+}
+
+static void
+in_fib_teardown(void)
+{
+	struct rtentry *rt;
+	u_int32_t i;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+
+	in_fib_enabled = 0;
+	in_fib_valid = 0;
+
+	/*
+	 * Readers check in_fib_valid after announcing themselves; once two
+	 * generations have drained, nobody can be looking at the tables.
+	 */
+	for (i = 0; i < 2; i++) {
+		OSMemoryBarrier();
+		in_fib_gen++;
+		OSMemoryBarrier();
+		while (in_fib_readers(in_fib_gen - 1) != 0)
+			delay(1);
+	}
+	in_fib_release(&in_fib_limbo[1]);
+	in_fib_release(&in_fib_limbo[0]);
+
+	for (i = 1; i < in_fib_nh_hwm; i++) {
+		if ((rt = IN_FIB_NH(i)) == NULL)
+			continue;
+		VERIFY(rt->rt_fibnh == i);
+		rt->rt_fibnh = 0;
+		rtfree_locked(rt);
+	}
+	for (i = 0; i < IN_FIB_NH_MAX / IN_FIB_NH_CHUNK; i++) {
+		if (in_fib_nh[i] != NULL) {
+			_FREE(in_fib_nh[i], M_RTABLE);
+			in_fib_nh[i] = NULL;
+		}
+	}
+	for (i = 0; i < IN_FIB_GRP_MAX / IN_FIB_GRP_CHUNK; i++) {
+		if (in_fib_tbl8[i] != NULL) {
+			_FREE(in_fib_tbl8[i], M_RTABLE);
+			in_fib_tbl8[i] = NULL;
+		}
+	}
+	_FREE((void *)in_fib_tbl24, M_RTABLE);
+	in_fib_tbl24 = NULL;
+
+	in_fib_vec_free(&in_fib_grp_free);
+	in_fib_vec_free(&in_fib_nh_free);
+	in_fib_vec_free(&in_fib_limbo[0]);
+	in_fib_vec_free(&in_fib_limbo[1]);
+	in_fib_vec_free(&in_fib_bounds);
+	in_fib_vec_free(&in_fib_nhs);
+	in_fib_grp_hwm = in_fib_nh_hwm = 0;
+	in_fib_ngroups = in_fib_nnexthops = 0;
+}
+
+/*
+ * Recompute the whole table; readers stay on the radix tree until done.
+ */
+static void
+in_fib_rebuild(void)
+{
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+	VERIFY(!in_fib_valid);
+
+	if (in_fib_update(0, 0xffffffff) != 0) {
+		in_fib_fail();
+		return;
+	}
+	OSMemoryBarrier();
+	in_fib_valid = 1;
+}
+
+/*
+ * The tables could not be brought up to date; stop using them and try
+ * again later.
+ */
+static void
+in_fib_fail(void)
+{
+	in_fib_valid = 0;
+	in_fib_schedule(hz);
+}
+
+/*
+ * The primary interface changed, which affects the result of non-scoped
+ * lookups everywhere; rebuild from scratch.  Caller holds rnh_lock.
+ */
+void
+in_fib_invalidate(void)
+{
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (!in_fib_enabled)
+		return;
+	in_fib_valid = 0;
+	in_fib_schedule(1);
+}
+
+/*
+ * An AF_INET route was added to or removed from the tree, or changed
+ * interface.  Caller holds rnh_lock and not the route's lock.
+ */
+void
+in_fib_route_change(struct rtentry *rt)
+{
+	u_int32_t lo, hi;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+	RT_LOCK_ASSERT_NOTHELD(rt);
+
+	if (!in_fib_enabled)
+		return;
+
+	if (in_fib_valid) {
+		if (!in_fib_prefix(rt, &lo, &hi)) {
+			lo = 0;
+			hi = 0xffffffff;
+		}
+		if (in_fib_update(lo, hi) != 0)
+			in_fib_fail();
+	}
+	if (!(rt->rt_nodes->rn_flags & RNF_ACTIVE) && rt->rt_fibnh != 0) {
+		in_fib_retire(rt->rt_fibnh);
+		rt->rt_fibnh = 0;
+	}
+	in_fib_reclaim();
+}
+
+/*
+ * Look up dst without rnh_lock; returns the route with a reference held,
+ * or NULL if the caller has to use the radix tree.  Routes that would
+ * be cloned (given the flags to ignore) are left to the radix path.
+ */
+struct rtentry *
+in_fib_lookup(struct in_addr dst, uint32_t ignore)
+{
+	volatile SInt32 *readers;
+	struct rtentry *rt = NULL;
+	u_int32_t a, e, g;
+
+	a = ntohl(dst.s_addr);
+again:
+	g = in_fib_gen;
+	readers = IN_FIB_READERS(cpu_number());
+	OSIncrementAtomic(&readers[g & 1]);
+	OSMemoryBarrier();
+	if (in_fib_gen != g) {
+		OSDecrementAtomic(&readers[g & 1]);
+		goto again;
+	}
+
+	if (in_fib_valid) {
+		e = in_fib_tbl24[a >> 8];
+		if (e & IN_FIB_GROUP)
+			e = IN_FIB_TBL8(e & ~IN_FIB_GROUP)[a & 0xff];
+		if (e != 0) {
+			rt = IN_FIB_NH(e);
+			RT_LOCK_SPIN(rt);
+			if ((rt->rt_flags & (RTF_UP | RTF_CONDEMNED)) ==
+			    RTF_UP && !((rt->rt_flags & ~ignore) &
+			    (RTF_CLONING | RTF_PRCLONING))) {
+				RT_ADDREF_LOCKED(rt);
+				RT_UNLOCK(rt);
+			} else {
+				RT_UNLOCK(rt);
+				rt = NULL;
+			}
+		}
+	}
+
+	OSDecrementAtomic(&readers[g & 1]);
+	return (rt);
+}
+
+/*
+ * rtalloc_ign() fast path for non-scoped IPv4 lookups; returns TRUE if
+ * ro->ro_rt has been filled in.
+ */
+boolean_t
+in_fib_rtalloc(struct route *ro, uint32_t ignore)
+{
+	struct rtentry *rt;
+
+	if (!in_fib_valid || ro->ro_dst.sa_family != AF_INET)
+		return (FALSE);
+	if ((rt = in_fib_lookup(SIN(&ro->ro_dst)->sin_addr, ignore)) == NULL)
+		return (FALSE);
+
+	RT_GENID_SYNC(rt);
+	ro->ro_rt = rt;
+	return (TRUE);
+}
+
+/*
+ * Recompute the entries for [lo, hi], which must be a prefix.
+ */
+static int
+in_fib_update(u_int32_t lo, u_int32_t hi)
+{
+	struct radix_node_head *rnh = rt_tables[AF_INET];
+	struct sockaddr_in key, mask;
+	struct in_fib_walk_arg arg;
+	u_int32_t *b, i, n;
+	int error;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+
+	in_fib_bounds.fv_cnt = 0;
+	in_fib_nhs.fv_cnt = 0;
+	if ((error = in_fib_vec_push(&in_fib_bounds, lo)) != 0)
+		return (error);
+
+	/* Collect the start of every piece with a constant result */
+	bzero(&key, sizeof (key));
+	key.sin_len = sizeof (key);
+	key.sin_family = AF_INET;
+	key.sin_addr.s_addr = htonl(lo);
+	bzero(&mask, sizeof (mask));
+	mask.sin_len = sizeof (mask);
+	mask.sin_family = AF_INET;
+	mask.sin_addr.s_addr = htonl(~(hi - lo));
+
+	bzero(&arg, sizeof (arg));
+	arg.fw_lo = lo;
+	arg.fw_hi = hi;
+	(void) rnh->rnh_walktree_from(rnh, &key, &mask, in_fib_walk, &arg);
+	if (arg.fw_error != 0)
+		return (arg.fw_error);
+
+	if (arg.fw_bad) {
+		n = 1;
+		if ((error = in_fib_vec_push(&in_fib_nhs, 0)) != 0)
+			return (error);
+	} else {
+		b = in_fib_bounds.fv_items;
+		qsort(b, in_fib_bounds.fv_cnt, sizeof (*b), in_fib_cmp);
+		for (i = 1, n = 1; i < in_fib_bounds.fv_cnt; i++) {
+			if (b[i] != b[n - 1])
+				b[n++] = b[i];
+		}
+		for (i = 0; i < n; i++) {
+			u_int32_t nh;
+
+			if ((error = in_fib_resolve(b[i], &nh)) != 0 ||
+			    (error = in_fib_vec_push(&in_fib_nhs, nh)) != 0)
+				return (error);
+		}
+	}
+
+	/* Next hops must be visible before the entries referring to them */
+	OSMemoryBarrier();
+	return (in_fib_write(lo, hi, n));
+}
+
+static int
+in_fib_walk(struct radix_node *rn, void *arg)
+{
+	struct in_fib_walk_arg *fw = arg;
+	u_int32_t lo, hi;
+
+	if (rn->rn_flags & RNF_ROOT)
+		return (0);
+	if (!in_fib_prefix((struct rtentry *)rn, &lo, &hi)) {
+		fw->fw_bad = TRUE;
+		return (0);
+	}
+	if (lo > fw->fw_lo && lo <= fw->fw_hi)
+		fw->fw_error = in_fib_vec_push(&in_fib_bounds, lo);
+	if (fw->fw_error == 0 && hi >= fw->fw_lo && hi < fw->fw_hi)
+		fw->fw_error = in_fib_vec_push(&in_fib_bounds, hi + 1);
+
+	return (fw->fw_error);
+}
+
+/*
+ * Return the address range of a route; FALSE if its netmask is not
+ * contiguous.  Netmask bytes beyond sa_len are zero.
+ */
+static boolean_t
+in_fib_prefix(struct rtentry *rt, u_int32_t *lo, u_int32_t *hi)
+{
+	struct sockaddr *sa = rt_mask(rt);
+	u_char *m;
+	u_int32_t mask, i, off;
+
+	if (sa == NULL) {
+		mask = 0xffffffff;
+	} else {
+		m = (u_char *)(void *)sa;
+		off = offsetof(struct sockaddr_in, sin_addr);
+		for (mask = 0, i = 0; i < sizeof (struct in_addr); i++) {
+			mask <<= 8;
+			if (off + i < sa->sa_len)
+				mask |= m[off + i];
+		}
+		if ((~mask & (~mask + 1)) != 0)
+			return (FALSE);
+	}
+	*lo = ntohl(SIN(rt_key(rt))->sin_addr.s_addr) & mask;
+	*hi = *lo | ~mask;
+
+	return (TRUE);
+}
+
+/*
+ * Find the next hop for destination a.
+ */
+static int
+in_fib_resolve(u_int32_t a, u_int32_t *nhp)
+{
+	struct sockaddr_in sin;
+	struct rtentry *rt, *rt0;
+	int error;
+
+	*nhp = 0;
+
+	bzero(&sin, sizeof (sin));
+	sin.sin_len = sizeof (sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(a);
+	if ((rt = rt_lookup_peek(SA(&sin), &rt0)) == NULL)
+		return (0);
+
+	/*
+	 * A cloned or ARP longest match may change interface behind our
+	 * back, and that steers the scoped selection; leave it to the tree.
+	 * These flags only change with rnh_lock held.
+	 */
+	if ((rt0 != NULL && (rt0->rt_flags & IN_FIB_SLOWFLAGS)) ||
+	    (rt->rt_flags & IN_FIB_SLOWFLAGS) ||
+	    (rt->rt_flags & (RTF_UP | RTF_CONDEMNED)) != RTF_UP)
+		return (0);
+
+	if (rt->rt_fibnh == 0) {
+		if ((error = in_fib_nh_alloc(&rt->rt_fibnh)) != 0)
+			return (error);
+		RT_ADDREF(rt);
+		IN_FIB_NH(rt->rt_fibnh) = rt;
+	}
+	*nhp = rt->rt_fibnh;
+
+	return (0);
+}
+
+/*
+ * Write the resolved pieces of [lo, hi] into the tables.
+ */
+static int
+in_fib_write(u_int32_t lo, u_int32_t hi, u_int32_t n)
+{
+	u_int32_t *start = in_fib_bounds.fv_items;
+	u_int32_t *nh = in_fib_nhs.fv_items;
+	u_int32_t blk, blo, bhi, e, old, g, i, j, k, end;
+	u_int32_t *grp;
+	int error;
+
+#define	IN_FIB_END(k)	((k) + 1 < n ? start[(k) + 1] - 1 : hi)
+
+	for (k = 0, blk = lo >> 8; ; blk++) {
+		blo = MAX(blk << 8, lo);
+		bhi = MIN((blk << 8) | 0xff, hi);
+		while (IN_FIB_END(k) < blo)
+			k++;
+
+		old = in_fib_tbl24[blk];
+		if (blo == (blk << 8) && bhi == ((blk << 8) | 0xff) &&
+		    IN_FIB_END(k) >= bhi) {
+			/* One next hop for the whole /24 */
+			e = nh[k];
+		} else {
+			if ((error = in_fib_grp_alloc(&g)) != 0)
+				return (error);
+			grp = IN_FIB_TBL8(g);
+			if (old & IN_FIB_GROUP) {
+				bcopy(IN_FIB_TBL8(old & ~IN_FIB_GROUP), grp,
+				    IN_FIB_TBL8_SIZE * sizeof (*grp));
+			} else {
+				for (i = 0; i < IN_FIB_TBL8_SIZE; i++)
+					grp[i] = old;
+			}
+			for (j = k; j < n && start[j] <= bhi; j++) {
+				end = MIN(IN_FIB_END(j), bhi) & 0xff;
+				for (i = MAX(start[j], blo) & 0xff; i <= end; i++)
+					grp[i] = nh[j];
+			}
+			for (i = 1; i < IN_FIB_TBL8_SIZE; i++) {
+				if (grp[i] != grp[0])
+					break;
+			}
+			if (i == IN_FIB_TBL8_SIZE) {
+				/* Uniform; never published, reuse at once */
+				e = grp[0];
+				if (in_fib_vec_push(&in_fib_grp_free, g) == 0)
+					in_fib_ngroups--;
+			} else {
+				OSMemoryBarrier();
+				e = IN_FIB_GROUP | g;
+			}
+		}
+
+		if (e != old) {
+			in_fib_tbl24[blk] = e;
+			if (old & IN_FIB_GROUP)
+				in_fib_retire(old);
+		}
+		if (blk == (hi >> 8))
+			break;
+	}
+#undef IN_FIB_END
+
+	return (0);
+}
+
+static int
+in_fib_grp_alloc(u_int32_t *gp)
+{
+	u_int32_t c;
+
+	if (in_fib_grp_free.fv_cnt > 0) {
+		*gp = in_fib_grp_free.fv_items[--in_fib_grp_free.fv_cnt];
+	} else {
+		if (in_fib_grp_hwm == IN_FIB_GRP_MAX)
+			return (ENOSPC);
+		c = in_fib_grp_hwm / IN_FIB_GRP_CHUNK;
+		if (in_fib_tbl8[c] == NULL) {
+			in_fib_tbl8[c] = _MALLOC(IN_FIB_GRP_CHUNK *
+			    IN_FIB_TBL8_SIZE * sizeof (u_int32_t), M_RTABLE,
+			    M_WAITOK);
+			if (in_fib_tbl8[c] == NULL)
+				return (ENOMEM);
+		}
+		*gp = in_fib_grp_hwm++;
+	}
+	in_fib_ngroups++;
+
+	return (0);
+}
+
+static int
+in_fib_nh_alloc(u_int32_t *nhp)
+{
+	u_int32_t c;
+
+	if (in_fib_nh_free.fv_cnt > 0) {
+		*nhp = in_fib_nh_free.fv_items[--in_fib_nh_free.fv_cnt];
+	} else {
+		if (in_fib_nh_hwm == IN_FIB_NH_MAX)
+			return (ENOSPC);
+		c = in_fib_nh_hwm / IN_FIB_NH_CHUNK;
+		if (in_fib_nh[c] == NULL) {
+			in_fib_nh[c] = _MALLOC(IN_FIB_NH_CHUNK *
+			    sizeof (struct rtentry *), M_RTABLE,
+			    M_WAITOK | M_ZERO);
+			if (in_fib_nh[c] == NULL)
+				return (ENOMEM);
+		}
+		*nhp = in_fib_nh_hwm++;
+	}
+	in_fib_nnexthops++;
+
+	return (0);
+}
+
+/*
+ * Queue a tbl8 group (IN_FIB_GROUP set) or a next hop for release once
+ * current readers are gone.  If that cannot be recorded, leak it rather
+ * than reuse it early.
+ */
+static void
+in_fib_retire(u_int32_t item)
+{
+	(void) in_fib_vec_push(&in_fib_limbo[0], item);
+}
+
+static void
+in_fib_release(struct in_fib_vec *v)
+{
+	struct rtentry *rt;
+	u_int32_t i, item;
+
+	for (i = 0; i < v->fv_cnt; i++) {
+		item = v->fv_items[i];
+		if (item & IN_FIB_GROUP) {
+			if (in_fib_vec_push(&in_fib_grp_free,
+			    item & ~IN_FIB_GROUP) == 0)
+				in_fib_ngroups--;
+		} else {
+			rt = IN_FIB_NH(item);
+			IN_FIB_NH(item) = NULL;
+			if (in_fib_vec_push(&in_fib_nh_free, item) == 0)
+				in_fib_nnexthops--;
+			rtfree_locked(rt);
+		}
+	}
+	v->fv_cnt = 0;
+}
+
+/*
+ * Release what the readers can no longer see, and move on to the next
+ * generation when there is more.  Items retired during generation g
+ * are released once the readers of generations g - 1 and g are gone.
+ */
+static void
+in_fib_reclaim(void)
+{
+	struct in_fib_vec v;
+
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (in_fib_limbo[1].fv_cnt > 0) {
+		if (in_fib_readers(in_fib_gen - 1) != 0)
+			goto resched;
+		in_fib_release(&in_fib_limbo[1]);
+	}
+	if (in_fib_limbo[0].fv_cnt > 0) {
+		if (in_fib_readers(in_fib_gen - 1) != 0)
+			goto resched;
+		v = in_fib_limbo[1];
+		in_fib_limbo[1] = in_fib_limbo[0];
+		in_fib_limbo[0] = v;
+		OSMemoryBarrier();
+		in_fib_gen++;
+		OSMemoryBarrier();
+		if (in_fib_readers(in_fib_gen - 1) != 0)
+			goto resched;
+		in_fib_release(&in_fib_limbo[1]);
+	}
+	return;
+
+resched:
+	in_fib_schedule(1);
+}
+
+static u_int32_t
+in_fib_readers(u_int32_t gen)
+{
+	u_int32_t cpu, n = 0;
+
+	for (cpu = 0; cpu < in_fib_ncpu; cpu++)
+		n += IN_FIB_READERS(cpu)[gen & 1];
+
+	return (n);
+}
+
+static void
+in_fib_schedule(int ticks)
+{
+	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (!in_fib_timeout_run) {
+		in_fib_timeout_run = 1;
+		timeout(in_fib_timeout, NULL, ticks);
+	}
+}
+
+static void
+in_fib_timeout(void *arg)
+{
+#pragma unused(arg)
+	lck_mtx_lock(rnh_lock);
+	in_fib_timeout_run = 0;
+	if (in_fib_enabled) {
+		if (!in_fib_valid)
+			in_fib_rebuild();
+		in_fib_reclaim();
+	}
+	lck_mtx_unlock(rnh_lock);
+}
+
+static int
+in_fib_vec_push(struct in_fib_vec *v, u_int32_t item)
+{
+	u_int32_t *items, max;
+
+	if (v->fv_cnt == v->fv_max) {
+		max = (v->fv_max == 0) ? 64 : v->fv_max * 2;
+		items = _MALLOC(max * sizeof (*items), M_RTABLE, M_WAITOK);
+		if (items == NULL)
+			return (ENOMEM);
+		if (v->fv_items != NULL) {
+			bcopy(v->fv_items, items, v->fv_cnt * sizeof (*items));
+			_FREE(v->fv_items, M_RTABLE);
+		}
+		v->fv_items = items;
+		v->fv_max = max;
+	}
+	v->fv_items[v->fv_cnt++] = item;
+
+	return (0);
+}
+
+static void
+in_fib_vec_free(struct in_fib_vec *v)
+{
+	if (v->fv_items != NULL)
+		_FREE(v->fv_items, M_RTABLE);
+	bzero(v, sizeof (*v));
+}
+
+static int
+in_fib_cmp(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+
+	return ((x > y) - (x < y));
+}
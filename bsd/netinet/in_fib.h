@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _NETINET_IN_FIB_H_
+#define	_NETINET_IN_FIB_H_
+
+#ifdef BSD_KERNEL_PRIVATE
+#include <sys/types.h>
+#include <net/route.h>
+
+/*
+ * IPv4 forwarding information base.
+ *
+ * A DIR-24-8 table that caches, for every IPv4 destination, the route a
+ * non-scoped rt_lookup() would return.  The radix tree remains the source
+ * of truth: the table is recomputed from it under rnh_lock whenever an
+ * AF_INET route is added, deleted or moved to another interface, and it
+ * is read without rnh_lock by rtalloc_ign() and rtalloc_scoped_ign().
+ * Destinations whose lookup needs the radix tree (cloned, ARP and
+ * redirect routes, non-contiguous netmasks) map to next hop 0, which
+ * sends the caller down the regular path.
+ */
+extern int in_fib_enabled;
+
+extern void in_fib_init(void);
+extern void in_fib_route_change(struct rtentry *);
+extern void in_fib_invalidate(void);
+extern struct rtentry *in_fib_lookup(struct in_addr, uint32_t);
+extern boolean_t in_fib_rtalloc(struct route *, uint32_t);
+#endif /* BSD_KERNEL_PRIVATE */
+#endif /* _NETINET_IN_FIB_H_ */
@@ -81,6 +81,8 @@
 
 #include <libkern/OSAtomic.h>
 #include <kern/locks.h>
+#include <kern/cpu_number.h>
+#include <machine/machine_routines.h>
 
 #include <machine/limits.h>
 
@@ -136,6 +138,21 @@ static boolean_t inpcb_toomany_gcreq = FALSE;
 
 static void inpcb_sched_timeout(struct timeval *);
 static void inpcb_timeout(void *);
+static void in_pcb_reclaim(struct inpcbinfo *);
+static u_int32_t in_pcb_readers(struct inpcbinfo *, u_int32_t);
+static void in_pcbhash_insert(struct inpcbinfo *, struct inpcb *);
+static void in_pcbhash_remove(struct inpcbinfo *, struct inpcb *);
+static int in_pcblookup_hash_walk(struct inpcbinfo *, struct in_addr,
+    u_short, struct in_addr, u_short, int, struct ifnet *, boolean_t,
+    struct inpcb **);
+static int in_pcblookup_pin(struct inpcbinfo *, struct inpcb *, boolean_t,
+    u_int32_t, u_int32_t, struct in_addr, u_short, struct in_addr, u_short,
+    struct inpcb **);
+static struct inpcblbgroup *in_pcblbgroup_alloc(struct inpcblbgrouphead *,
+    struct inpcb *, u_int32_t);
+static void in_pcblbgroup_retire(struct inpcbinfo *, struct inpcblbgroup *);
+static void in_pcblbgroup_remove(struct inpcb *);
+static void in_pcblbgroup_seq(struct inpcbinfo *, u_short);
 int inpcb_timeout_lazy = 10;	/* 10 seconds leeway for lazy timers */
 extern int tvtohz(struct timeval *);
 
@@ -209,6 +226,43 @@ SYSCTL_PROC(_net_inet_ip_portrange, OID_AUTO, hilast,
 extern int	udp_use_randomport;
 extern int	tcp_use_randomport;
 
+/*
+ * When set, input-path lookups walk the pcb hash without ipi_lock;
+ * writers still serialize on it, and bump a per-bucket sequence count
+ * around each change to a chain so that a reader can tell its walk was
+ * disturbed.  Off by default: an uncontended lookup is slower this way,
+ * and the gain with many readers has yet to be measured.
+ */
+int	inpcb_lockless_lookup = 0;
+SYSCTL_INT(_net_inet_ip, OID_AUTO, pcb_lockless_lookup,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &inpcb_lockless_lookup, 0,
+	"Look up pcbs on input without the pcbinfo lock");
+
+u_int32_t inpcb_lookup_retries = 0;
+SYSCTL_UINT(_net_inet_ip, OID_AUTO, pcb_lookup_retries,
+	CTLFLAG_RD | CTLFLAG_LOCKED, &inpcb_lookup_retries, 0,
+	"Lockless pcb lookups redone under the pcbinfo lock");
+
+/*
+ * When set, wildcard pcbs bound to the same address and port with
+ * SO_REUSEPORT form a load-balancing group; new flows are spread across
+ * the members by flow hash instead of all going to the first one in the
+ * chain.  Off by default, since that changes which socket gets a flow
+ * for applications that rely on the traditional SO_REUSEPORT behavior.
+ */
+int	inpcb_reuseport_lb = 0;
+SYSCTL_INT(_net_inet_ip, OID_AUTO, reuseport_lb,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &inpcb_reuseport_lb, 0,
+	"Spread flows across SO_REUSEPORT listeners");
+
+#define	INPCB_LBGROUP_MINSIZE	8	/* initial members per group */
+
+static u_int32_t inp_lbgroup_seed = 0;
+
+#define	INPCB_READERS(ipi, cpu)						\
+	((volatile SInt32 *)(void *)((ipi)->ipi_rd_pcpu +		\
+	    (size_t)(cpu) * CPU_CACHE_LINE_SIZE))
+
 /* Structs used for flowhash computation */
 struct inp_flowhash_key_addr {
 	union {
@@ -326,8 +380,10 @@ inpcb_timeout(void *arg)
 			if (INPCB_HAVE_TIMER_REQ(ipi->ipi_gc_req)) {
 				bzero(&ipi->ipi_gc_req,
 					sizeof(ipi->ipi_gc_req));
-				if (gc && ipi->ipi_gc != NULL) {
+				if (gc && ipi->ipi_gc != NULL)
 					ipi->ipi_gc(ipi);
+				if (gc) {
+					in_pcb_reclaim(ipi);
 					gccnt.intimer_lazy +=
 					    ipi->ipi_gc_req.intimer_lazy;
 					gccnt.intimer_fast +=
@@ -485,6 +541,31 @@ in_pcbinfo_attach(struct inpcbinfo *ipi)
 {
 	struct inpcbinfo *ipi0;
 
+	VERIFY(ipi->ipi_hashbase != NULL);
+	ipi->ipi_hashseq = _MALLOC((ipi->ipi_hashmask + 1) *
+	    sizeof (u_int32_t), M_PCB, M_WAITOK | M_ZERO);
+	ipi->ipi_rd_pcpu_buf = _MALLOC((ml_get_max_cpus() + 1) *
+	    CPU_CACHE_LINE_SIZE, M_PCB, M_WAITOK | M_ZERO);
+	if (ipi->ipi_hashseq == NULL || ipi->ipi_rd_pcpu_buf == NULL) {
+		panic("%s: ipi %p failed allocating lookup state\n",
+		    __func__, ipi);
+		/* NOTREACHED */
+	}
+	ipi->ipi_rd_pcpu = (caddr_t)P2ROUNDUP(
+	    (intptr_t)ipi->ipi_rd_pcpu_buf, CPU_CACHE_LINE_SIZE);
+	ipi->ipi_rd_gen = 0;
+	LIST_INIT(&ipi->ipi_limbo);
+	ipi->ipi_limbo_cnt = 0;
+
+	ipi->ipi_lbgrouphashbase = hashinit(ipi->ipi_porthashmask + 1, M_PCB,
+	    &ipi->ipi_lbgrouphashmask);
+	if (ipi->ipi_lbgrouphashbase == NULL) {
+		panic("%s: ipi %p failed allocating lbgroup hash\n",
+		    __func__, ipi);
+		/* NOTREACHED */
+	}
+	LIST_INIT(&ipi->ipi_lbglimbo);
+
 	lck_mtx_lock(&inpcb_lock);
 	TAILQ_FOREACH(ipi0, &inpcb_head, ipi_entry) {
 		if (ipi0 == ipi) {
@@ -517,6 +598,157 @@ in_pcbinfo_detach(struct inpcbinfo *ipi)
 	return (error);
 }
 
+/*
+ * Enter a lockless lookup section; returns the reader generation to
+ * hand back to in_pcb_lookup_exit().  The generation is re-read after
+ * announcing ourselves, so in_pcb_reclaim() either sees this reader or
+ * the reader sees the generation in_pcb_reclaim() moved to.
+ */
+u_int32_t
+in_pcb_lookup_enter(struct inpcbinfo *ipi)
+{
+	volatile SInt32 *readers;
+	u_int32_t g;
+
+again:
+	g = ipi->ipi_rd_gen;
+	readers = INPCB_READERS(ipi, cpu_number());
+	OSIncrementAtomic(&readers[g & 1]);
+	OSMemoryBarrier();
+	if (ipi->ipi_rd_gen != g) {
+		OSDecrementAtomic(&readers[g & 1]);
+		goto again;
+	}
+	return (g);
+}
+
+void
+in_pcb_lookup_exit(struct inpcbinfo *ipi, u_int32_t g)
+{
+	OSMemoryBarrier();
+	OSDecrementAtomic(&INPCB_READERS(ipi, cpu_number())[g & 1]);
+}
+
+static u_int32_t
+in_pcb_readers(struct inpcbinfo *ipi, u_int32_t g)
+{
+	u_int32_t cpu, ncpu, n = 0;
+
+	ncpu = ml_get_max_cpus();
+	for (cpu = 0; cpu < ncpu; cpu++)
+		n += INPCB_READERS(ipi, cpu)[g & 1];
+
+	return (n);
+}
+
+/*
+ * Sample the sequence count of a hash bucket before walking it.
+ */
+u_int32_t
+in_pcb_hashseq_begin(struct inpcbinfo *ipi, u_int32_t bucket)
+{
+	u_int32_t seq;
+
+	seq = ipi->ipi_hashseq[bucket];
+	OSMemoryBarrier();
+	return (seq);
+}
+
+/*
+ * Returns TRUE if the bucket was being changed when the walk started,
+ * or has been changed since; whatever the walk found can't be trusted.
+ */
+boolean_t
+in_pcb_hashseq_retry(struct inpcbinfo *ipi, u_int32_t bucket, u_int32_t seq)
+{
+	OSMemoryBarrier();
+	return ((seq & 1) != 0 || ipi->ipi_hashseq[bucket] != seq);
+}
+
+/*
+ * Drop a want reference taken by a lockless lookup whose result turned
+ * out to be stale.  Unlike WNT_RELEASE this doesn't take the socket
+ * lock, as the caller may be holding another socket's; if the pcb died
+ * in the meantime, leave it to the garbage collector to mark it.
+ */
+void
+in_pcb_lookup_unpin(struct inpcb *inp)
+{
+	volatile UInt32 *wantcnt = (volatile UInt32 *)&inp->inp_wantcnt;
+	UInt32 origwant;
+
+	do {
+		origwant = *wantcnt;
+		VERIFY((UInt16)origwant != 0 && (UInt16)origwant != 0xffff);
+	} while (!OSCompareAndSwap(origwant, origwant - 1, wantcnt));
+
+	if (inp->inp_state == INPCB_STATE_DEAD) {
+		if ((UInt16)(origwant - 1) == 0)
+			OSCompareAndSwap(0, 0xffff, wantcnt);
+		inpcb_gc_sched(inp->inp_pcbinfo, INPCB_TIMER_FAST);
+	}
+}
+
+/*
+ * Free pcbs parked by in_pcbdispose().  Each is stamped with the reader
+ * generation current when it was unhashed; once the generation has moved
+ * past the stamp and the readers of the previous generation are gone,
+ * every lookup still in progress started after the pcb was unhashed.
+ */
+static void
+in_pcb_reclaim(struct inpcbinfo *ipi)
+{
+	struct inpcblbgroup *grp, *tgrp;
+	struct inpcb *inp, *tinp;
+	struct socket *so;
+	u_int32_t g;
+
+	if (LIST_EMPTY(&ipi->ipi_limbo) && LIST_EMPTY(&ipi->ipi_lbglimbo))
+		return;
+
+	if (!lck_rw_try_lock_exclusive(ipi->ipi_lock)) {
+		atomic_add_32(&ipi->ipi_gc_req.intimer_fast, 1);
+		return;
+	}
+
+	g = ipi->ipi_rd_gen;
+	if (in_pcb_readers(ipi, g - 1) != 0) {
+		atomic_add_32(&ipi->ipi_gc_req.intimer_fast, 1);
+		lck_rw_done(ipi->ipi_lock);
+		return;
+	}
+
+	LIST_FOREACH_SAFE(inp, &ipi->ipi_limbo, inp_limbo, tinp) {
+		if (inp->inp_limbo_gen == g)
+			continue;
+		LIST_REMOVE(inp, inp_limbo);
+		VERIFY(ipi->ipi_limbo_cnt > 0);
+		ipi->ipi_limbo_cnt--;
+
+		so = inp->inp_limbo_so;
+		inp->inp_limbo_so = NULL;
+		if ((so->so_flags1 & SOF1_CACHED_IN_SOCK_LAYER) == 0) {
+			zfree(ipi->ipi_zone, inp);
+		}
+		sodealloc(so);
+	}
+	LIST_FOREACH_SAFE(grp, &ipi->ipi_lbglimbo, il_limbo, tgrp) {
+		if (grp->il_limbo_gen == g)
+			continue;
+		LIST_REMOVE(grp, il_limbo);
+		FREE(grp, M_PCB);
+	}
+
+	/* move on; what's left goes once this generation's readers drain */
+	if (!LIST_EMPTY(&ipi->ipi_limbo) || !LIST_EMPTY(&ipi->ipi_lbglimbo)) {
+		OSMemoryBarrier();
+		ipi->ipi_rd_gen = g + 1;
+		OSMemoryBarrier();
+		atomic_add_32(&ipi->ipi_gc_req.intimer_fast, 1);
+	}
+	lck_rw_done(ipi->ipi_lock);
+}
+
 /*
  * Allocate a PCB and associate it with the socket.
  *
@@ -1494,10 +1726,16 @@ in_pcbdispose(struct inpcb *inp)
 		 * we deallocate the structure.
 		 */
 		ROUTE_RELEASE(&inp->inp_route);
-		if ((so->so_flags1 & SOF1_CACHED_IN_SOCK_LAYER) == 0) {
-			zfree(ipi->ipi_zone, inp);
-		}
-		sodealloc(so);
+		/*
+		 * A lockless lookup may still be looking at this pcb;
+		 * in_pcb_reclaim() frees it along with the socket once
+		 * those readers are gone.
+		 */
+		inp->inp_limbo_so = so;
+		inp->inp_limbo_gen = ipi->ipi_rd_gen;
+		LIST_INSERT_HEAD(&ipi->ipi_limbo, inp, inp_limbo);
+		ipi->ipi_limbo_cnt++;
+		inpcb_gc_sched(ipi, INPCB_TIMER_FAST);
 	}
 }
 
@@ -1936,25 +2174,61 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
     struct ifnet *ifp)
 {
-	struct inpcbhead *head;
 	struct inpcb *inp;
 	u_short fport = fport_arg, lport = lport_arg;
+	u_int32_t gen;
+
+	if (inpcb_lockless_lookup) {
+		gen = in_pcb_lookup_enter(pcbinfo);
+		if (in_pcblookup_hash_walk(pcbinfo, faddr, fport, laddr,
+		    lport, wildcard, ifp, TRUE, &inp) == 0) {
+			in_pcb_lookup_exit(pcbinfo, gen);
+			return (inp);
+		}
+		in_pcb_lookup_exit(pcbinfo, gen);
+		atomic_add_32(&inpcb_lookup_retries, 1);
+	}
+
+	lck_rw_lock_shared(pcbinfo->ipi_lock);
+	(void) in_pcblookup_hash_walk(pcbinfo, faddr, fport, laddr, lport,
+	    wildcard, ifp, FALSE, &inp);
+	lck_rw_done(pcbinfo->ipi_lock);
+	return (inp);
+}
+
+/*
+ * Walk the hash chains for in_pcblookup_hash(), either with ipi_lock
+ * held or, if lockless, bracketed by in_pcb_lookup_enter/exit.  Returns
+ * EAGAIN if a lockless walk raced with a writer and has to be redone
+ * under the lock; otherwise the pcb (referenced) or NULL is in *inpp.
+ */
+static int
+in_pcblookup_hash_walk(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_short fport, struct in_addr laddr, u_short lport, int wildcard,
+    struct ifnet *ifp, boolean_t lockless, struct inpcb **inpp)
+{
+	struct inpcbhead *head;
+	struct inpcb *inp;
 	struct inpcb *local_wild = NULL;
 #if INET6
 	struct inpcb *local_wild_mapped = NULL;
+	struct socket *so;
 #endif /* INET6 */
+	struct in_addr zeroaddr;
+	struct in6_addr faddr6;
+	u_int32_t bucket, seq = 0;
 
-	/*
-	 * We may have found the pcb in the last lookup - check this first.
-	 */
-
-	lck_rw_lock_shared(pcbinfo->ipi_lock);
+	*inpp = NULL;
+	zeroaddr.s_addr = INADDR_ANY;
 
 	/*
 	 * First look for an exact match.
 	 */
-	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
-	    pcbinfo->ipi_hashmask)];
+	bucket = INP_PCBHASH(faddr.s_addr, lport, fport,
+	    pcbinfo->ipi_hashmask);
+	head = &pcbinfo->ipi_hashbase[bucket];
+	if (lockless)
+		seq = in_pcb_hashseq_begin(pcbinfo, bucket);
 	LIST_FOREACH(inp, head, inp_hash) {
 #if INET6
 		if (!(inp->inp_vflag & INP_IPV4))
@@ -1970,28 +2244,28 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 			/*
 			 * Found.
 			 */
-			if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) !=
-			    WNT_STOPUSING) {
-				lck_rw_done(pcbinfo->ipi_lock);
-				return (inp);
-			} else {
-				/* it's there but dead, say it isn't found */
-				lck_rw_done(pcbinfo->ipi_lock);
-				return (NULL);
-			}
+			return (in_pcblookup_pin(pcbinfo, inp, lockless,
+			    bucket, seq, faddr, fport, laddr, lport, inpp));
 		}
 	}
+	if (lockless && in_pcb_hashseq_retry(pcbinfo, bucket, seq))
+		return (EAGAIN);
 
 	if (!wildcard) {
 		/*
 		 * Not found.
 		 */
-		lck_rw_done(pcbinfo->ipi_lock);
-		return (NULL);
+		return (0);
 	}
 
-	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
-	    pcbinfo->ipi_hashmask)];
+	/* key for picking a member of a load-balancing group */
+	bzero(&faddr6, sizeof (faddr6));
+	faddr6.s6_addr32[3] = faddr.s_addr;
+
+	bucket = INP_PCBHASH(INADDR_ANY, lport, 0, pcbinfo->ipi_hashmask);
+	head = &pcbinfo->ipi_hashbase[bucket];
+	if (lockless)
+		seq = in_pcb_hashseq_begin(pcbinfo, bucket);
 	LIST_FOREACH(inp, head, inp_hash) {
 #if INET6
 		if (!(inp->inp_vflag & INP_IPV4))
@@ -2003,18 +2277,17 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 		if (inp->inp_faddr.s_addr == INADDR_ANY &&
 		    inp->inp_lport == lport) {
 			if (inp->inp_laddr.s_addr == laddr.s_addr) {
-				if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) !=
-				    WNT_STOPUSING) {
-					lck_rw_done(pcbinfo->ipi_lock);
-					return (inp);
-				} else {
-					/* it's dead; say it isn't found */
-					lck_rw_done(pcbinfo->ipi_lock);
-					return (NULL);
-				}
+				inp = in_pcblbgroup_select(inp, &faddr6,
+				    fport, ifp);
+				return (in_pcblookup_pin(pcbinfo, inp,
+				    lockless, bucket, seq, zeroaddr, 0,
+				    laddr, lport, inpp));
 			} else if (inp->inp_laddr.s_addr == INADDR_ANY) {
 #if INET6
-				if (SOCK_CHECK_DOM(inp->inp_socket, PF_INET6))
+				/* disposed of under a lockless walk */
+				if ((so = inp->inp_socket) == NULL)
+					continue;
+				if (SOCK_CHECK_DOM(so, PF_INET6))
 					local_wild_mapped = inp;
 				else
 #endif /* INET6 */
@@ -2025,29 +2298,53 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	if (local_wild == NULL) {
 #if INET6
 		if (local_wild_mapped != NULL) {
-			if (in_pcb_checkstate(local_wild_mapped,
-			    WNT_ACQUIRE, 0) != WNT_STOPUSING) {
-				lck_rw_done(pcbinfo->ipi_lock);
-				return (local_wild_mapped);
-			} else {
-				/* it's dead; say it isn't found */
-				lck_rw_done(pcbinfo->ipi_lock);
-				return (NULL);
-			}
+			local_wild_mapped = in_pcblbgroup_select(
+			    local_wild_mapped, &faddr6, fport, ifp);
+			return (in_pcblookup_pin(pcbinfo, local_wild_mapped,
+			    lockless, bucket, seq, zeroaddr, 0, zeroaddr,
+			    lport, inpp));
 		}
 #endif /* INET6 */
-		lck_rw_done(pcbinfo->ipi_lock);
-		return (NULL);
-	}
-	if (in_pcb_checkstate(local_wild, WNT_ACQUIRE, 0) != WNT_STOPUSING) {
-		lck_rw_done(pcbinfo->ipi_lock);
-		return (local_wild);
+		if (lockless && in_pcb_hashseq_retry(pcbinfo, bucket, seq))
+			return (EAGAIN);
+		return (0);
 	}
 	/*
-	 * It's either not found or is already dead.
+	 * It's either found, not found or is already dead.
 	 */
-	lck_rw_done(pcbinfo->ipi_lock);
-	return (NULL);
+	local_wild = in_pcblbgroup_select(local_wild, &faddr6, fport, ifp);
+	return (in_pcblookup_pin(pcbinfo, local_wild, lockless, bucket, seq,
+	    zeroaddr, 0, zeroaddr, lport, inpp));
+}
+
+/*
+ * Take a want reference on a pcb found by in_pcblookup_hash_walk().
+ * A lockless walk only counts if the bucket didn't change under it and
+ * the pcb still carries the addresses and ports it matched on; connect
+ * and disconnect rewrite those before moving the pcb to another bucket.
+ */
+static int
+in_pcblookup_pin(struct inpcbinfo *pcbinfo, struct inpcb *inp,
+    boolean_t lockless, u_int32_t bucket, u_int32_t seq,
+    struct in_addr faddr, u_short fport, struct in_addr laddr, u_short lport,
+    struct inpcb **inpp)
+{
+	if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) == WNT_STOPUSING) {
+		if (lockless && in_pcb_hashseq_retry(pcbinfo, bucket, seq))
+			return (EAGAIN);
+		/* it's there but dead, say it isn't found */
+		*inpp = NULL;
+		return (0);
+	}
+	if (lockless && (in_pcb_hashseq_retry(pcbinfo, bucket, seq) ||
+	    inp->inp_faddr.s_addr != faddr.s_addr ||
+	    inp->inp_laddr.s_addr != laddr.s_addr ||
+	    inp->inp_fport != fport || inp->inp_lport != lport)) {
+		in_pcb_lookup_unpin(inp);
+		return (EAGAIN);
+	}
+	*inpp = inp;
+	return (0);
 }
 
 /*
@@ -2062,7 +2359,6 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 int
 in_pcbinshash(struct inpcb *inp, int locked)
 {
-	struct inpcbhead *pcbhash;
 	struct inpcbporthead *pcbporthash;
 	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
 	struct inpcbport *phd;
@@ -2104,8 +2400,6 @@ in_pcbinshash(struct inpcb *inp, int locked)
 	inp->inp_hash_element = INP_PCBHASH(hashkey_faddr, inp->inp_lport,
 	    inp->inp_fport, pcbinfo->ipi_hashmask);
 
-	pcbhash = &pcbinfo->ipi_hashbase[inp->inp_hash_element];
-
 	pcbporthash = &pcbinfo->ipi_porthashbase[INP_PCBPORTHASH(inp->inp_lport,
 	    pcbinfo->ipi_porthashmask)];
 
@@ -2136,7 +2430,7 @@ in_pcbinshash(struct inpcb *inp, int locked)
 	VERIFY(!(inp->inp_flags2 & INP2_INHASHLIST));
 	inp->inp_phd = phd;
 	LIST_INSERT_HEAD(&phd->phd_pcblist, inp, inp_portlist);
-	LIST_INSERT_HEAD(pcbhash, inp, inp_hash);
+	in_pcbhash_insert(pcbinfo, inp);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 
 	if (!locked)
@@ -2159,7 +2453,6 @@ in_pcbinshash(struct inpcb *inp, int locked)
 void
 in_pcbrehash(struct inpcb *inp)
 {
-	struct inpcbhead *head;
 	u_int32_t hashkey_faddr;
 
 #if INET6
@@ -2169,17 +2462,20 @@ in_pcbrehash(struct inpcb *inp)
 #endif /* INET6 */
 		hashkey_faddr = inp->inp_faddr.s_addr;
 
-	inp->inp_hash_element = INP_PCBHASH(hashkey_faddr, inp->inp_lport,
-	    inp->inp_fport, inp->inp_pcbinfo->ipi_hashmask);
-	head = &inp->inp_pcbinfo->ipi_hashbase[inp->inp_hash_element];
+	/* a connected pcb no longer takes new flows for the group */
+	if (inp->inp_lbgroup != NULL)
+		in_pcblbgroup_remove(inp);
 
 	if (inp->inp_flags2 & INP2_INHASHLIST) {
-		LIST_REMOVE(inp, inp_hash);
+		in_pcbhash_remove(inp->inp_pcbinfo, inp);
 		inp->inp_flags2 &= ~INP2_INHASHLIST;
 	}
 
+	inp->inp_hash_element = INP_PCBHASH(hashkey_faddr, inp->inp_lport,
+	    inp->inp_fport, inp->inp_pcbinfo->ipi_hashmask);
+
 	VERIFY(!(inp->inp_flags2 & INP2_INHASHLIST));
-	LIST_INSERT_HEAD(head, inp, inp_hash);
+	in_pcbhash_insert(inp->inp_pcbinfo, inp);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 	
 #if NECP
@@ -2188,6 +2484,246 @@ in_pcbrehash(struct inpcb *inp)
 #endif /* NECP */
 }
 
+/*
+ * Link a pcb at the head of its hash chain.  Lockless readers may be
+ * walking the chain, so the pcb is fully linked before it is published,
+ * and the bucket's sequence count is odd while the chain is in flux.
+ */
+static void
+in_pcbhash_insert(struct inpcbinfo *ipi, struct inpcb *inp)
+{
+	struct inpcbhead *head = &ipi->ipi_hashbase[inp->inp_hash_element];
+	volatile u_int32_t *seq = &ipi->ipi_hashseq[inp->inp_hash_element];
+
+	(*seq)++;
+	OSMemoryBarrier();
+	inp->inp_hash.le_next = LIST_FIRST(head);
+	inp->inp_hash.le_prev = &LIST_FIRST(head);
+	if (LIST_FIRST(head) != NULL)
+		LIST_FIRST(head)->inp_hash.le_prev = &inp->inp_hash.le_next;
+	OSMemoryBarrier();
+	LIST_FIRST(head) = inp;
+	OSMemoryBarrier();
+	(*seq)++;
+}
+
+/*
+ * Unlink a pcb from its hash chain.  The pcb keeps pointing into the
+ * chain, so a reader standing on it can carry on; the bump of the
+ * sequence count tells it to redo the walk.
+ */
+static void
+in_pcbhash_remove(struct inpcbinfo *ipi, struct inpcb *inp)
+{
+	volatile u_int32_t *seq = &ipi->ipi_hashseq[inp->inp_hash_element];
+
+	(*seq)++;
+	OSMemoryBarrier();
+	LIST_REMOVE(inp, inp_hash);
+	OSMemoryBarrier();
+	(*seq)++;
+}
+
+#define	INPCB_LBGROUP_MATCH(grp, inp)					\
+	((grp)->il_lport == (inp)->inp_lport &&				\
+	(grp)->il_dom == SOCK_DOM((inp)->inp_socket) &&			\
+	(grp)->il_vflag == ((inp)->inp_vflag & (INP_IPV4 | INP_IPV6)) &&	\
+	(((inp)->inp_vflag & INP_IPV6) ?				\
+	IN6_ARE_ADDR_EQUAL(&(grp)->il_dependladdr.il6_laddr,		\
+	&(inp)->in6p_laddr) :						\
+	(grp)->il_dependladdr.il46_laddr.ia46_addr4.s_addr ==		\
+	(inp)->inp_laddr.s_addr))
+
+/*
+ * Bump the sequence count of the wildcard bucket for lport; called
+ * before and after a group change so that lockless lookups which chose
+ * a member meanwhile start over.
+ */
+static void
+in_pcblbgroup_seq(struct inpcbinfo *ipi, u_short lport)
+{
+	OSMemoryBarrier();
+	ipi->ipi_hashseq[INP_PCBHASH(INADDR_ANY, lport, 0,
+	    ipi->ipi_hashmask)]++;
+	OSMemoryBarrier();
+}
+
+static struct inpcblbgroup *
+in_pcblbgroup_alloc(struct inpcblbgrouphead *head, struct inpcb *inp,
+    u_int32_t size)
+{
+	struct inpcblbgroup *grp;
+
+	MALLOC(grp, struct inpcblbgroup *, sizeof (*grp) +
+	    (size - 1) * sizeof (struct inpcb *), M_PCB, M_WAITOK | M_ZERO);
+	if (grp == NULL)
+		return (NULL);
+
+	if (inp_lbgroup_seed == 0)
+		inp_lbgroup_seed = RandomULong();
+
+	grp->il_lport = inp->inp_lport;
+	grp->il_dom = SOCK_DOM(inp->inp_socket);
+	grp->il_vflag = inp->inp_vflag & (INP_IPV4 | INP_IPV6);
+	if (inp->inp_vflag & INP_IPV6)
+		grp->il_dependladdr.il6_laddr = inp->in6p_laddr;
+	else
+		grp->il_dependladdr.il46_laddr.ia46_addr4 = inp->inp_laddr;
+	grp->il_inpsiz = size;
+	LIST_INSERT_HEAD(head, grp, il_list);
+
+	return (grp);
+}
+
+/*
+ * Take a group off the hash; it is freed by in_pcb_reclaim() once no
+ * lockless lookup can be looking at it.
+ */
+static void
+in_pcblbgroup_retire(struct inpcbinfo *ipi, struct inpcblbgroup *grp)
+{
+	LIST_REMOVE(grp, il_list);
+	grp->il_limbo_gen = ipi->ipi_rd_gen;
+	LIST_INSERT_HEAD(&ipi->ipi_lbglimbo, grp, il_limbo);
+	inpcb_gc_sched(ipi, INPCB_TIMER_FAST);
+}
+
+/*
+ * Add a wildcard SO_REUSEPORT pcb to the load-balancing group for its
+ * local address and port, creating the group if needed.  Called once
+ * the pcb is ready to take new flows: on listen for TCP, on bind for UDP.
+ */
+void
+in_pcblbgroup_insert(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct socket *so = inp->inp_socket;
+	struct inpcblbgrouphead *head;
+	struct inpcblbgroup *grp, *ngrp;
+	u_int32_t i;
+
+	if (!inpcb_reuseport_lb || !(so->so_options & SO_REUSEPORT))
+		return;
+
+	if (!lck_rw_try_lock_exclusive(pcbinfo->ipi_lock)) {
+		socket_unlock(so, 0);
+		lck_rw_lock_exclusive(pcbinfo->ipi_lock);
+		socket_lock(so, 0);
+	}
+
+	if (inp->inp_state == INPCB_STATE_DEAD || inp->inp_lbgroup != NULL ||
+	    !(inp->inp_flags2 & INP2_INHASHLIST) || inp->inp_fport != 0)
+		goto done;
+#if INET6
+	if ((inp->inp_vflag & INP_IPV6) &&
+	    !IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_faddr))
+		goto done;
+#endif /* INET6 */
+	if (!(inp->inp_vflag & INP_IPV6) &&
+	    inp->inp_faddr.s_addr != INADDR_ANY)
+		goto done;
+
+	head = &pcbinfo->ipi_lbgrouphashbase[INP_PCBPORTHASH(inp->inp_lport,
+	    pcbinfo->ipi_lbgrouphashmask)];
+	LIST_FOREACH(grp, head, il_list) {
+		if (INPCB_LBGROUP_MATCH(grp, inp))
+			break;
+	}
+
+	in_pcblbgroup_seq(pcbinfo, inp->inp_lport);
+	if (grp == NULL) {
+		grp = in_pcblbgroup_alloc(head, inp, INPCB_LBGROUP_MINSIZE);
+	} else if (grp->il_inpcnt == grp->il_inpsiz) {
+		/* lookups may be indexing the old array; replace the group */
+		ngrp = in_pcblbgroup_alloc(head, inp, grp->il_inpsiz * 2);
+		if (ngrp != NULL) {
+			bcopy(grp->il_inp, ngrp->il_inp,
+			    grp->il_inpcnt * sizeof (struct inpcb *));
+			ngrp->il_inpcnt = grp->il_inpcnt;
+			OSMemoryBarrier();
+			for (i = 0; i < ngrp->il_inpcnt; i++)
+				ngrp->il_inp[i]->inp_lbgroup = ngrp;
+			in_pcblbgroup_retire(pcbinfo, grp);
+		}
+		grp = ngrp;
+	}
+	if (grp != NULL) {
+		grp->il_inp[grp->il_inpcnt] = inp;
+		OSMemoryBarrier();
+		grp->il_inpcnt++;
+		inp->inp_lbgroup = grp;
+	}
+	in_pcblbgroup_seq(pcbinfo, inp->inp_lport);
+done:
+	lck_rw_done(pcbinfo->ipi_lock);
+}
+
+static void
+in_pcblbgroup_remove(struct inpcb *inp)
+{
+	struct inpcbinfo *ipi = inp->inp_pcbinfo;
+	struct inpcblbgroup *grp = inp->inp_lbgroup;
+	u_int32_t i;
+
+	lck_rw_assert(ipi->ipi_lock, LCK_RW_ASSERT_EXCLUSIVE);
+
+	for (i = 0; i < grp->il_inpcnt; i++) {
+		if (grp->il_inp[i] == inp)
+			break;
+	}
+	VERIFY(i < grp->il_inpcnt);
+
+	in_pcblbgroup_seq(ipi, inp->inp_lport);
+	grp->il_inp[i] = grp->il_inp[grp->il_inpcnt - 1];
+	OSMemoryBarrier();
+	grp->il_inpcnt--;
+	inp->inp_lbgroup = NULL;
+	in_pcblbgroup_seq(ipi, inp->inp_lport);
+
+	if (grp->il_inpcnt == 0)
+		in_pcblbgroup_retire(ipi, grp);
+}
+
+/*
+ * inp is the wildcard pcb a lookup settled on; if it belongs to a
+ * load-balancing group, return the member that this flow hashes to.
+ * Members that are going away are skipped, so that a listener being
+ * restarted doesn't turn away the connections that land on it.
+ */
+struct inpcb *
+in_pcblbgroup_select(struct inpcb *inp, const struct in6_addr *faddr,
+    u_short fport, struct ifnet *ifp)
+{
+	struct inpcblbgroup *grp;
+	struct inpcb *sel;
+	struct {
+		struct in6_addr	faddr;
+		u_int16_t	fport;
+		u_int16_t	lport;
+	} key;
+	u_int32_t cnt, i, n;
+
+	if (!inpcb_reuseport_lb || (grp = inp->inp_lbgroup) == NULL ||
+	    (cnt = grp->il_inpcnt) < 2)
+		return (inp);
+	OSMemoryBarrier();
+
+	bzero(&key, sizeof (key));
+	key.faddr = *faddr;
+	key.fport = fport;
+	key.lport = inp->inp_lport;
+	i = net_flowhash(&key, sizeof (key), inp_lbgroup_seed) % cnt;
+
+	for (n = 0; n < cnt; n++, i = (i + 1) % cnt) {
+		sel = grp->il_inp[i];
+		if (sel->inp_state != INPCB_STATE_DEAD &&
+		    (UInt16)sel->inp_wantcnt != 0xffff &&
+		    !inp_restricted_recv(sel, ifp))
+			return (sel);
+	}
+	return (inp);
+}
+
 /*
  * Remove PCB from various lists.
  * Must be called pcbinfo lock is held in exclusive mode.
@@ -2207,7 +2743,9 @@ in_pcbremlists(struct inpcb *inp)
 
 		VERIFY(phd != NULL && inp->inp_lport > 0);
 
-		LIST_REMOVE(inp, inp_hash);
+		if (inp->inp_lbgroup != NULL)
+			in_pcblbgroup_remove(inp);
+		in_pcbhash_remove(inp->inp_pcbinfo, inp);
 		inp->inp_hash.le_next = NULL;
 		inp->inp_hash.le_prev = NULL;
 
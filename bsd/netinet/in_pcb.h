@@ -100,6 +100,7 @@
  */
 LIST_HEAD(inpcbhead, inpcb);
 LIST_HEAD(inpcbporthead, inpcbport);
+LIST_HEAD(inpcblbgrouphead, inpcblbgroup);
 #endif /* BSD_KERNEL_PRIVATE */
 typedef	u_quad_t	inp_gen_t;
 
@@ -207,6 +208,10 @@ struct inpcb {
 	} inp_depend6;
 
 	caddr_t inp_saved_ppcb;		/* place to save pointer while cached */
+	struct inpcblbgroup *inp_lbgroup; /* SO_REUSEPORT group, if any */
+	LIST_ENTRY(inpcb) inp_limbo;	/* on ipi_limbo once disposed */
+	struct socket *inp_limbo_so;	/* socket freed along with the pcb */
+	u_int32_t inp_limbo_gen;	/* reader generation when disposed */
 #if CONFIG_MACF_NET
 	struct label *inp_label;	/* MAC label */
 #endif
@@ -514,6 +519,28 @@ struct inpcbport {
 	u_short phd_port;
 };
 
+/*
+ * Load-balancing group of wildcard pcbs bound to the same local address
+ * and port with SO_REUSEPORT; lookups spread flows across the members.
+ * Lockless lookups may read a group while it is being changed or after
+ * it has been replaced, so retired groups go through ipi_lbglimbo.
+ */
+struct inpcblbgroup {
+	LIST_ENTRY(inpcblbgroup) il_list;	/* on ipi_lbgrouphashbase */
+	LIST_ENTRY(inpcblbgroup) il_limbo;	/* on ipi_lbglimbo */
+	u_int32_t	il_limbo_gen;		/* reader generation */
+	u_short		il_lport;		/* local port */
+	u_char		il_vflag;		/* INP_IPV4 and/or INP_IPV6 */
+	u_char		il_dom;			/* PF_INET or PF_INET6 */
+	union {
+		struct in_addr_4in6 il46_laddr;
+		struct in6_addr il6_laddr;
+	} il_dependladdr;			/* local address */
+	u_int32_t	il_inpsiz;		/* size of il_inp[] */
+	volatile u_int32_t il_inpcnt;		/* members in il_inp[] */
+	struct inpcb	*il_inp[1];		/* members */
+};
+
 struct intimercount {
 	u_int32_t intimer_lazy;	/* lazy requests for timer scheduling */
 	u_int32_t intimer_fast; /* fast requests, can be coalesced */
@@ -588,6 +615,27 @@ struct inpcbinfo {
 	struct inpcbporthead	*ipi_porthashbase;
 	u_long			ipi_porthashmask;
 
+	/*
+	 * Lockless lookups on input: per-bucket sequence counts of the
+	 * pcb hash, bumped around every change to a chain; per-CPU
+	 * counts of readers in each of the two most recent generations;
+	 * disposed pcbs waiting for those readers to drain.
+	 */
+	volatile u_int32_t	*ipi_hashseq;
+	volatile u_int32_t	ipi_rd_gen;
+	caddr_t			ipi_rd_pcpu;
+	void			*ipi_rd_pcpu_buf;
+	struct inpcbhead	ipi_limbo;
+	u_int32_t		ipi_limbo_cnt;
+
+	/*
+	 * SO_REUSEPORT load-balancing groups, hashed by local port, and
+	 * groups retired but possibly still seen by lockless lookups.
+	 */
+	struct inpcblbgrouphead	*ipi_lbgrouphashbase;
+	u_long			ipi_lbgrouphashmask;
+	struct inpcblbgrouphead	ipi_lbglimbo;
+
 	/*
 	 * Misc.
 	 */
@@ -709,6 +757,9 @@ extern int ipport_firstauto;
 extern int ipport_lastauto;
 extern int ipport_hifirstauto;
 extern int ipport_hilastauto;
+extern int inpcb_lockless_lookup;
+extern int inpcb_reuseport_lb;
+extern u_int32_t inpcb_lookup_retries;
 
 /* freshly allocated PCB, it's in use */
 #define	INPCB_STATE_INUSE	0x1
@@ -765,6 +816,15 @@ extern int in_getpeeraddr_s(struct socket *, struct sockaddr_storage *);
 extern int in_getsockaddr(struct socket *, struct sockaddr **);
 extern int in_getsockaddr_s(struct socket *, struct sockaddr_storage *);
 extern int in_pcb_checkstate(struct inpcb *, int, int);
+extern u_int32_t in_pcb_lookup_enter(struct inpcbinfo *);
+extern void in_pcb_lookup_exit(struct inpcbinfo *, u_int32_t);
+extern void in_pcb_lookup_unpin(struct inpcb *);
+extern u_int32_t in_pcb_hashseq_begin(struct inpcbinfo *, u_int32_t);
+extern boolean_t in_pcb_hashseq_retry(struct inpcbinfo *, u_int32_t,
+    u_int32_t);
+extern void in_pcblbgroup_insert(struct inpcb *);
+extern struct inpcb *in_pcblbgroup_select(struct inpcb *,
+    const struct in6_addr *, u_short, struct ifnet *);
 extern void in_pcbremlists(struct inpcb *);
 extern void inpcb_to_compat(struct inpcb *, struct inpcb_compat *);
 extern void inpcb_to_xinpcb64(struct inpcb *, struct xinpcb64 *);
@@ -217,6 +217,7 @@ static struct protosw inetsw[] = {
 	.pr_protocol =		IPPROTO_ESP,
 	.pr_flags =		PR_ATOMIC|PR_ADDR|PR_PROTOLOCK,
 	.pr_input =		esp4_input,
+	.pr_init =		esp_init,
 	.pr_usrreqs =		&nousrreqs,
 },
 #endif /* IPSEC_ESP */
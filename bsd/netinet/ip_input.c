@@ -111,6 +111,7 @@
 #include <netinet/in_systm.h>
 #include <netinet/in_var.h>
 #include <netinet/in_arp.h>
+#include <netinet/in_fib.h>
 #include <netinet/ip.h>
 #include <netinet/in_pcb.h>
 #include <netinet/ip_var.h>
@@ -151,35 +152,20 @@ decl_lck_mtx_data(, sadb_stat_mutex_data);
 lck_mtx_t	*sadb_stat_mutex = &sadb_stat_mutex_data;
 #endif /* IPSEC */
 
-MBUFQ_HEAD(fq_head);
-
-static int frag_timeout_run;		/* frag timer is scheduled to run */
-static void frag_timeout(void *);
-static void frag_sched_timeout(void);
-
 static struct ipq *ipq_alloc(int);
 static void ipq_free(struct ipq *);
 static void ipq_updateparams(void);
 static void ip_input_second_pass(struct mbuf *, struct ifnet *,
     u_int32_t, int, int, struct ip_fw_in_args *, int);
 
-decl_lck_mtx_data(static, ipqlock);
-static lck_attr_t	*ipqlock_attr;
-static lck_grp_t	*ipqlock_grp;
-static lck_grp_attr_t	*ipqlock_grp_attr;
-
 /* Packet reassembly stuff */
-#define	IPREASS_NHASH_LOG2	6
+#define	IPREASS_NHASH_LOG2	9
 #define	IPREASS_NHASH		(1 << IPREASS_NHASH_LOG2)
-#define	IPREASS_HMASK		(IPREASS_NHASH - 1)
-#define	IPREASS_HASH(x, y) \
-	(((((x) & 0xF) | ((((x) >> 8) & 0xF) << 4)) ^ (y)) & IPREASS_HMASK)
 
-/* IP fragment reassembly queues (protected by ipqlock) */
-static TAILQ_HEAD(ipqhead, ipq) ipq[IPREASS_NHASH]; /* ip reassembly queues */
+/* IP fragment reassembly queues (each bucket has its own lock) */
+static struct fragtbl ipq_table;	/* ip reassembly queues */
 static int maxnipq;			/* max packets in reass queues */
 static u_int32_t maxfragsperpacket;	/* max frags/packet in reass queues */
-static u_int32_t nipq;			/* # of packets in reass queues */
 static u_int32_t ipq_limit;		/* ipq allocation limit */
 static u_int32_t ipq_count;		/* current # of allocated ipq's */
 
@@ -224,7 +210,8 @@ SYSCTL_PROC(_net_inet_ip, OID_AUTO, maxfragpackets,
 	"I", "Maximum number of IPv4 fragment reassembly queue entries");
 
 SYSCTL_UINT(_net_inet_ip, OID_AUTO, fragpackets, CTLFLAG_RD | CTLFLAG_LOCKED,
-	&nipq, 0, "Current number of IPv4 fragment reassembly queue entries");
+	&ipq_table.ft_nqueues, 0,
+	"Current number of IPv4 fragment reassembly queue entries");
 
 SYSCTL_PROC(_net_inet_ip, OID_AUTO, maxfragsperpacket,
 	CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, &maxfragsperpacket, 0,
@@ -368,7 +355,8 @@ static void in_ifaddrhashtbl_init(void);
 static void save_rte(u_char *, struct in_addr);
 static int ip_dooptions(struct mbuf *, int, struct sockaddr_in *);
 static void ip_forward(struct mbuf *, int, struct sockaddr_in *);
-static void frag_freef(struct ipqhead *, struct ipq *);
+static void frag_freef(struct fragq *, int, struct fragq_mbufs *,
+    struct fragq_mbufs *);
 #if IPDIVERT
 #ifdef IPDIVERT_44
 static struct mbuf *ip_reass(struct mbuf *, u_int32_t *, u_int16_t *);
@@ -492,21 +480,12 @@ ip_init(struct protosw *pp, struct domain *dp)
 		}
 	}
 
-	/* IP fragment reassembly queue lock */
-	ipqlock_grp_attr  = lck_grp_attr_alloc_init();
-	ipqlock_grp = lck_grp_alloc_init("ipqlock", ipqlock_grp_attr);
-	ipqlock_attr = lck_attr_alloc_init();
-	lck_mtx_init(&ipqlock, ipqlock_grp, ipqlock_attr);
-
-	lck_mtx_lock(&ipqlock);
-	/* Initialize IP reassembly queue. */
-	for (i = 0; i < IPREASS_NHASH; i++)
-		TAILQ_INIT(&ipq[i]);
-
+	/* Initialize IP reassembly queues. */
 	maxnipq = nmbclusters / 32;
 	maxfragsperpacket = 128; /* enough for 64k in 512 byte fragments */
+	fragtbl_init(&ipq_table, "ipq", IPREASS_NHASH, &maxnipq, frag_freef,
+	    NULL);
 	ipq_updateparams();
-	lck_mtx_unlock(&ipqlock);
 
 	getmicrotime(&tv);
 	ip_id = RandomULong() ^ tv.tv_usec;
@@ -524,6 +503,7 @@ ip_init(struct protosw *pp, struct domain *dp)
 
 #endif
 	arp_init();
+	in_fib_init();
 }
 
 /*
@@ -2415,7 +2395,6 @@ bad:
 static void
 ipq_updateparams(void)
 {
-	lck_mtx_assert(&ipqlock, LCK_MTX_ASSERT_OWNED);
 	/*
 	 * -1 for unlimited allocation.
 	 */
@@ -2436,7 +2415,7 @@ ipq_updateparams(void)
 	/*
 	 * Arm the purge timer if not already and if there's work to do
 	 */
-	frag_sched_timeout();
+	fragtbl_sched_timeout(&ipq_table);
 }
 
 static int
@@ -2445,7 +2424,6 @@ sysctl_maxnipq SYSCTL_HANDLER_ARGS
 #pragma unused(arg1, arg2)
 	int error, i;
 
-	lck_mtx_lock(&ipqlock);
 	i = maxnipq;
 	error = sysctl_handle_int(oidp, &i, 0, req);
 	if (error || req->newptr == USER_ADDR_NULL)
@@ -2458,7 +2436,6 @@ sysctl_maxnipq SYSCTL_HANDLER_ARGS
 	maxnipq = i;
 	ipq_updateparams();
 done:
-	lck_mtx_unlock(&ipqlock);
 	return (error);
 }
 
@@ -2468,7 +2445,6 @@ sysctl_maxfragsperpacket SYSCTL_HANDLER_ARGS
 #pragma unused(arg1, arg2)
 	int error, i;
 
-	lck_mtx_lock(&ipqlock);
 	i = maxfragsperpacket;
 	error = sysctl_handle_int(oidp, &i, 0, req);
 	if (error || req->newptr == USER_ADDR_NULL)
@@ -2476,7 +2452,6 @@ sysctl_maxfragsperpacket SYSCTL_HANDLER_ARGS
 	maxfragsperpacket = i;
 	ipq_updateparams();	/* see if we need to arm timer */
 done:
-	lck_mtx_unlock(&ipqlock);
 	return (error);
 }
 
@@ -2504,14 +2479,16 @@ ip_reass(struct mbuf *m)
 #endif /* IPDIVERT */
 {
 	struct ip *ip;
-	struct mbuf *p, *q, *nq, *t;
+	struct mbuf *q, *t;
 	struct ipq *fp = NULL;
-	struct ipqhead *head;
-	int i, hlen, next;
+	struct fragq *fq;
+	struct fragtbl_bucket *fb;
+	struct fragent *fe = NULL, *tfe;
+	int hlen, next, ret;
 	u_int8_t ecn, ecn0;
-	uint32_t csum, csum_flags;
-	uint16_t hash;
-	struct fq_head dfq;
+	uint32_t csum, csum_flags, nfrags;
+	u_int32_t hash, key[3];
+	struct fragq_mbufs dfq;
 
 	MBUFQ_INIT(&dfq);	/* for deferred frees */
 
@@ -2520,28 +2497,27 @@ ip_reass(struct mbuf *m)
 		ipstat.ips_fragments++;
 		ipstat.ips_fragdropped++;
 		m_freem(m);
-		if (nipq > 0) {
-			lck_mtx_lock(&ipqlock);
-			frag_sched_timeout();	/* purge stale fragments */
-			lck_mtx_unlock(&ipqlock);
-		}
+		fragtbl_sched_timeout(&ipq_table);	/* purge stale fragments */
 		return (NULL);
 	}
 
 	ip = mtod(m, struct ip *);
 	hlen = IP_VHL_HL(ip->ip_vhl) << 2;
 
-	lck_mtx_lock(&ipqlock);
-
-	hash = IPREASS_HASH(ip->ip_src.s_addr, ip->ip_id);
-	head = &ipq[hash];
+	key[0] = ip->ip_src.s_addr;
+	key[1] = ip->ip_dst.s_addr;
+	key[2] = ((u_int32_t)ip->ip_id << 16) | ip->ip_p;
+	hash = fragtbl_hash(&ipq_table, key, sizeof (key));
+	fb = fragtbl_lock(&ipq_table, hash);
 
 	/*
 	 * Look for queue of fragments
 	 * of this datagram.
 	 */
-	TAILQ_FOREACH(fp, head, ipq_list) {
-		if (ip->ip_id == fp->ipq_id &&
+	TAILQ_FOREACH(fq, &fb->fb_head, fq_link) {
+		fp = (struct ipq *)fq;
+		if (fq->fq_hash == hash &&
+		    ip->ip_id == fp->ipq_id &&
 		    ip->ip_src.s_addr == fp->ipq_src.s_addr &&
 		    ip->ip_dst.s_addr == fp->ipq_dst.s_addr &&
 #if CONFIG_MACF_NET
@@ -2557,26 +2533,8 @@ ip_reass(struct mbuf *m)
 	 * Attempt to trim the number of allocated fragment queues if it
 	 * exceeds the administrative limit.
 	 */
-	if ((nipq > (unsigned)maxnipq) && (maxnipq > 0)) {
-		/*
-		 * drop something from the tail of the current queue
-		 * before proceeding further
-		 */
-		struct ipq *fq = TAILQ_LAST(head, ipqhead);
-		if (fq == NULL) {   /* gak */
-			for (i = 0; i < IPREASS_NHASH; i++) {
-				struct ipq *r = TAILQ_LAST(&ipq[i], ipqhead);
-				if (r) {
-					ipstat.ips_fragtimeout += r->ipq_nfrags;
-					frag_freef(&ipq[i], r);
-					break;
-				}
-			}
-		} else {
-			ipstat.ips_fragtimeout += fq->ipq_nfrags;
-			frag_freef(head, fq);
-		}
-	}
+	if ((ipq_table.ft_nqueues > (unsigned)maxnipq) && (maxnipq > 0))
+		(void) fragtbl_reclaim(&ipq_table, fb, &dfq, NULL);
 
 found:
 	/*
@@ -2637,14 +2595,6 @@ found:
 		 */
 		if (ip->ip_len == 0 || (ip->ip_len & 0x7) != 0) {
 			OSAddAtomic(1, &ipstat.ips_toosmall);
-			/*
-			 * Reassembly queue may have been found if previous
-			 * fragments were valid; given that this one is bad,
-			 * we need to drop it.  Make sure to set fp to NULL
-			 * if not already, since we don't want to decrement
-			 * ipq_nfrags as it doesn't include this packet.
-			 */
-			fp = NULL;
 			goto dropfrag;
 		}
 		m->m_flags |= M_FRAG;
@@ -2664,6 +2614,13 @@ found:
 	m->m_data += hlen;
 	m->m_len -= hlen;
 
+	if ((fe = fragent_alloc(M_DONTWAIT)) == NULL)
+		goto dropfrag;
+	fe->fe_m = m;
+	fe->fe_off = ip->ip_off;
+	fe->fe_len = ip->ip_len;
+	fe->fe_flags = (m->m_flags & M_FRAG) ? FE_MORE : 0;
+
 	/*
 	 * If first fragment to arrive, create a reassembly queue.
 	 */
@@ -2679,16 +2636,15 @@ found:
 		}
 		mac_ipq_label_associate(m, fp);
 #endif
-		TAILQ_INSERT_HEAD(head, fp, ipq_list);
-		nipq++;
-		fp->ipq_nfrags = 1;
-		fp->ipq_ttl = IPFRAGTTL;
+		fragtbl_attach(&ipq_table, fb, &fp->ipq_fq, hash, IPFRAGTTL);
 		fp->ipq_p = ip->ip_p;
 		fp->ipq_id = ip->ip_id;
 		fp->ipq_src = ip->ip_src;
 		fp->ipq_dst = ip->ip_dst;
-		fp->ipq_frags = m;
-		m->m_nextpkt = NULL;
+		ret = fragq_insert(&ipq_table, &fp->ipq_fq, fe, FRAGQ_TRIM,
+		    &dfq);
+		VERIFY(ret & FRAGQ_INSERTED);
+		fe = NULL;
 		/*
 		 * If the first fragment has valid checksum offload
 		 * info, the rest of fragments are eligible as well.
@@ -2716,7 +2672,6 @@ found:
 		m = NULL;	/* nothing to return */
 		goto done;
 	} else {
-		fp->ipq_nfrags++;
 #if CONFIG_MACF_NET
 		mac_ipq_label_update(m, fp);
 #endif
@@ -2729,71 +2684,35 @@ found:
 	 * if CE is set, do not lose CE.
 	 * drop if CE and not-ECT are mixed for the same packet.
 	 */
+	q = FRAGQ_FIRST(&fp->ipq_fq)->fe_m;
 	ecn = ip->ip_tos & IPTOS_ECN_MASK;
-	ecn0 = GETIP(fp->ipq_frags)->ip_tos & IPTOS_ECN_MASK;
+	ecn0 = GETIP(q)->ip_tos & IPTOS_ECN_MASK;
 	if (ecn == IPTOS_ECN_CE) {
 		if (ecn0 == IPTOS_ECN_NOTECT)
 			goto dropfrag;
 		if (ecn0 != IPTOS_ECN_CE)
-			GETIP(fp->ipq_frags)->ip_tos |= IPTOS_ECN_CE;
+			GETIP(q)->ip_tos |= IPTOS_ECN_CE;
 	}
 	if (ecn == IPTOS_ECN_NOTECT && ecn0 != IPTOS_ECN_NOTECT)
 		goto dropfrag;
 
 	/*
-	 * Find a segment which begins after this one does.
+	 * Put the fragment in its place.  Data that a preceding fragment
+	 * already has is trimmed off the new one, which is dropped if that
+	 * leaves nothing; succeeding fragments are trimmed in turn, or
+	 * dropped if the new one covers them completely.  If any data is
+	 * trimmed off, the checksum of the fragment it came from is
+	 * invalidated.
 	 */
-	for (p = NULL, q = fp->ipq_frags; q; p = q, q = q->m_nextpkt)
-		if (GETIP(q)->ip_off > ip->ip_off)
-			break;
-
-	/*
-	 * If there is a preceding segment, it may provide some of
-	 * our data already.  If so, drop the data from the incoming
-	 * segment.  If it provides all of our data, drop us, otherwise
-	 * stick new segment in the proper place.
-	 *
-	 * If some of the data is dropped from the preceding
-	 * segment, then it's checksum is invalidated.
-	 */
-	if (p) {
-		i = GETIP(p)->ip_off + GETIP(p)->ip_len - ip->ip_off;
-		if (i > 0) {
-			if (i >= ip->ip_len)
-				goto dropfrag;
-			m_adj(m, i);
-			fp->ipq_csum_flags = 0;
-			ip->ip_off += i;
-			ip->ip_len -= i;
-		}
-		m->m_nextpkt = p->m_nextpkt;
-		p->m_nextpkt = m;
-	} else {
-		m->m_nextpkt = fp->ipq_frags;
-		fp->ipq_frags = m;
-	}
-
-	/*
-	 * While we overlap succeeding segments trim them or,
-	 * if they are completely covered, dequeue them.
-	 */
-	for (; q != NULL && ip->ip_off + ip->ip_len > GETIP(q)->ip_off;
-	    q = nq) {
-		i = (ip->ip_off + ip->ip_len) - GETIP(q)->ip_off;
-		if (i < GETIP(q)->ip_len) {
-			GETIP(q)->ip_len -= i;
-			GETIP(q)->ip_off += i;
-			m_adj(q, i);
-			fp->ipq_csum_flags = 0;
-			break;
-		}
-		nq = q->m_nextpkt;
-		m->m_nextpkt = nq;
-		ipstat.ips_fragdropped++;
-		fp->ipq_nfrags--;
-		/* defer freeing until after lock is dropped */
-		MBUFQ_ENQUEUE(&dfq, q);
-	}
+	nfrags = fp->ipq_nfrags;
+	ret = fragq_insert(&ipq_table, &fp->ipq_fq, fe, FRAGQ_TRIM, &dfq);
+	if (!(ret & FRAGQ_INSERTED))
+		goto dropfrag;
+	fe = NULL;
+	/* succeeding fragments we covered completely went on dfq */
+	ipstat.ips_fragdropped += nfrags + 1 - fp->ipq_nfrags;
+	if (ret & FRAGQ_TRIMMED)
+		fp->ipq_csum_flags = 0;
 
 	/*
 	 * If this fragment contains similar checksum offload info
@@ -2832,37 +2751,27 @@ found:
 	 * only n will ever be stored. (n = maxfragsperpacket.)
 	 *
 	 */
-	next = 0;
-	for (p = NULL, q = fp->ipq_frags; q; p = q, q = q->m_nextpkt) {
-		if (GETIP(q)->ip_off != next) {
-			if (fp->ipq_nfrags > maxfragsperpacket) {
-				ipstat.ips_fragdropped += fp->ipq_nfrags;
-				frag_freef(head, fp);
-			}
-			m = NULL;	/* nothing to return */
-			goto done;
-		}
-		next += GETIP(q)->ip_len;
-	}
-	/* Make sure the last packet didn't have the IP_MF flag */
-	if (p->m_flags & M_FRAG) {
+	if (!FRAGQ_COMPLETE(&fp->ipq_fq)) {
 		if (fp->ipq_nfrags > maxfragsperpacket) {
 			ipstat.ips_fragdropped += fp->ipq_nfrags;
-			frag_freef(head, fp);
+			fragtbl_detach(&ipq_table, fb, &fp->ipq_fq);
+			frag_freef(&fp->ipq_fq, 0, &dfq, NULL);
 		}
-		m = NULL;		/* nothing to return */
+		m = NULL;	/* nothing to return */
 		goto done;
 	}
+	next = fp->ipq_fq.fq_len;
 
 	/*
 	 * Reassembly is complete.  Make sure the packet is a sane size.
 	 */
-	q = fp->ipq_frags;
+	q = FRAGQ_FIRST(&fp->ipq_fq)->fe_m;
 	ip = GETIP(q);
 	if (next + (IP_VHL_HL(ip->ip_vhl) << 2) > IP_MAXPACKET) {
 		ipstat.ips_toolong++;
 		ipstat.ips_fragdropped += fp->ipq_nfrags;
-		frag_freef(head, fp);
+		fragtbl_detach(&ipq_table, fb, &fp->ipq_fq);
+		frag_freef(&fp->ipq_fq, 0, &dfq, NULL);
 		m = NULL;		/* nothing to return */
 		goto done;
 	}
@@ -2874,13 +2783,15 @@ found:
 	t = m->m_next;
 	m->m_next = NULL;
 	m_cat(m, t);
-	nq = q->m_nextpkt;
-	q->m_nextpkt = NULL;
-	for (q = nq; q != NULL; q = nq) {
-		nq = q->m_nextpkt;
+	FRAGQ_FOREACH_SAFE(fe, &fp->ipq_fq, tfe) {
+		fragq_remove(&ipq_table, &fp->ipq_fq, fe);
+		q = fe->fe_m;
+		fragent_free(fe);
 		q->m_nextpkt = NULL;
-		m_cat(m, q);
+		if (q != m)
+			m_cat(m, q);
 	}
+	fe = NULL;
 
 	/*
 	 * Store partial hardware checksum info from the fragment queue;
@@ -2930,8 +2841,9 @@ found:
 	ip->ip_src = fp->ipq_src;
 	ip->ip_dst = fp->ipq_dst;
 
-	fp->ipq_frags = NULL;	/* return to caller as 'm' */
-	frag_freef(head, fp);
+	/* the fragments were returned to caller as 'm' */
+	fragtbl_detach(&ipq_table, fb, &fp->ipq_fq);
+	frag_freef(&fp->ipq_fq, 0, &dfq, NULL);
 	fp = NULL;
 
 	m->m_len += (IP_VHL_HL(ip->ip_vhl) << 2);
@@ -2941,24 +2853,20 @@ found:
 		m_fixhdr(m);
 	ipstat.ips_reassembled++;
 
+	fragtbl_unlock(fb);
 	/* arm the purge timer if not already and if there's work to do */
-	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
+	fragtbl_sched_timeout(&ipq_table);
 	/* perform deferred free (if needed) now that lock is dropped */
-	if (!MBUFQ_EMPTY(&dfq))
-		MBUFQ_DRAIN(&dfq);
-	VERIFY(MBUFQ_EMPTY(&dfq));
+	fragtbl_finish(&ipq_table, &dfq, NULL);
 	return (m);
 
 done:
 	VERIFY(m == NULL);
+	fragtbl_unlock(fb);
 	/* arm the purge timer if not already and if there's work to do */
-	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
+	fragtbl_sched_timeout(&ipq_table);
 	/* perform deferred free (if needed) */
-	if (!MBUFQ_EMPTY(&dfq))
-		MBUFQ_DRAIN(&dfq);
-	VERIFY(MBUFQ_EMPTY(&dfq));
+	fragtbl_finish(&ipq_table, &dfq, NULL);
 	return (NULL);
 
 dropfrag:
@@ -2967,120 +2875,43 @@ dropfrag:
 	*divcookie = 0;
 #endif /* IPDIVERT */
 	ipstat.ips_fragdropped++;
-	if (fp != NULL)
-		fp->ipq_nfrags--;
+	if (fe != NULL)
+		fragent_free(fe);
+	fragtbl_unlock(fb);
 	/* arm the purge timer if not already and if there's work to do */
-	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
+	fragtbl_sched_timeout(&ipq_table);
 	m_freem(m);
 	/* perform deferred free (if needed) */
-	if (!MBUFQ_EMPTY(&dfq))
-		MBUFQ_DRAIN(&dfq);
-	VERIFY(MBUFQ_EMPTY(&dfq));
+	fragtbl_finish(&ipq_table, &dfq, NULL);
 	return (NULL);
 #undef GETIP
 }
 
 /*
- * Free a fragment reassembly header and all
- * associated datagrams.
+ * Free a fragment reassembly header, already off its bucket, and all
+ * associated datagrams; also called by the reassembly table when the
+ * queue times out or is reclaimed, hence the statistics.
  */
 static void
-frag_freef(struct ipqhead *fhp, struct ipq *fp)
+frag_freef(struct fragq *fq, int why, struct fragq_mbufs *dfq,
+    struct fragq_mbufs *diq)
 {
-	lck_mtx_assert(&ipqlock, LCK_MTX_ASSERT_OWNED);
+#pragma unused(diq)
+	struct ipq *fp = (struct ipq *)fq;
 
-	fp->ipq_nfrags = 0;
-	if (fp->ipq_frags != NULL) {
-		m_freem_list(fp->ipq_frags);
-		fp->ipq_frags = NULL;
+	switch (why) {
+	case FRAGQ_TIMEOUT:
+	case FRAGQ_RECLAIM:
+		ipstat.ips_fragtimeout += fp->ipq_nfrags;
+		break;
+	case FRAGQ_OVERFLOW:
+	case FRAGQ_DRAIN:
+		ipstat.ips_fragdropped += fp->ipq_nfrags;
+		break;
 	}
-	TAILQ_REMOVE(fhp, fp, ipq_list);
-	nipq--;
+	fragq_flush(&ipq_table, fq, dfq);
 	ipq_free(fp);
 }
-
-/*
- * IP reassembly timer processing
- */
-static void
-frag_timeout(void *arg)
-{
-#pragma unused(arg)
-	struct ipq *fp;
-	int i;
-
-	/*
-	 * Update coarse-grained networking timestamp (in sec.); the idea
-	 * is to piggy-back on the timeout callout to update the counter
-	 * returnable via net_uptime().
-	 */
-	net_update_uptime();
-
-	lck_mtx_lock(&ipqlock);
-	for (i = 0; i < IPREASS_NHASH; i++) {
-		for (fp = TAILQ_FIRST(&ipq[i]); fp; ) {
-			struct ipq *fpp;
-
-			fpp = fp;
-			fp = TAILQ_NEXT(fp, ipq_list);
-			if (--fpp->ipq_ttl == 0) {
-				ipstat.ips_fragtimeout += fpp->ipq_nfrags;
-				frag_freef(&ipq[i], fpp);
-			}
-		}
-	}
-	/*
-	 * If we are over the maximum number of fragments
-	 * (due to the limit being lowered), drain off
-	 * enough to get down to the new limit.
-	 */
-	if (maxnipq >= 0 && nipq > (unsigned)maxnipq) {
-		for (i = 0; i < IPREASS_NHASH; i++) {
-			while (nipq > (unsigned)maxnipq &&
-			    !TAILQ_EMPTY(&ipq[i])) {
-				ipstat.ips_fragdropped +=
-				    TAILQ_FIRST(&ipq[i])->ipq_nfrags;
-				frag_freef(&ipq[i], TAILQ_FIRST(&ipq[i]));
-			}
-		}
-	}
-	/* re-arm the purge timer if there's work to do */
-	frag_timeout_run = 0;
-	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
-}
-
-static void
-frag_sched_timeout(void)
-{
-	lck_mtx_assert(&ipqlock, LCK_MTX_ASSERT_OWNED);
-
-	if (!frag_timeout_run && nipq > 0) {
-		frag_timeout_run = 1;
-		timeout(frag_timeout, NULL, hz);
-	}
-}
-
-/*
- * Drain off all datagram fragments.
- */
-static void
-frag_drain(void)
-{
-	int i;
-
-	lck_mtx_lock(&ipqlock);
-	for (i = 0; i < IPREASS_NHASH; i++) {
-		while (!TAILQ_EMPTY(&ipq[i])) {
-			ipstat.ips_fragdropped +=
-			    TAILQ_FIRST(&ipq[i])->ipq_nfrags;
-			frag_freef(&ipq[i], TAILQ_FIRST(&ipq[i]));
-		}
-	}
-	lck_mtx_unlock(&ipqlock);
-}
-
 static struct ipq *
 ipq_alloc(int how)
 {
@@ -3089,8 +2920,8 @@ ipq_alloc(int how)
 
 	/*
 	 * See comments in ipq_updateparams().  Keep the count separate
-	 * from nipq since the latter represents the elements already
-	 * in the reassembly queues.
+	 * from ipq_table.ft_nqueues since the latter represents the
+	 * elements already in the reassembly queues.
 	 */
 	if (ipq_limit > 0 && ipq_count > ipq_limit)
 		return (NULL);
@@ -3119,7 +2950,7 @@ ipq_free(struct ipq *fp)
 void
 ip_drain(void)
 {
-	frag_drain();		/* fragments */
+	fragtbl_drain(&ipq_table);	/* fragments */
 	in_rtqdrain();		/* protocol cloned routes */
 	in_arpdrain(NULL);	/* cloned routes: ARP */
 }
@@ -82,6 +82,7 @@ struct ipovly {
 };
 
 #ifdef BSD_KERNEL_PRIVATE
+#include <netinet/frag_reass.h>
 #if CONFIG_MACF_NET
 struct label;
 #endif /* CONFIG_MACF_NET */
@@ -92,16 +93,13 @@ struct label;
  * be reclaimed if memory becomes tight.
  */
 struct ipq {
-	TAILQ_ENTRY(ipq) ipq_list;	/* to other reass headers */
-	struct mbuf *ipq_frags;		/* to ip headers of fragments */
+	struct fragq ipq_fq;		/* hash linkage and fragments */
 #if CONFIG_MACF_NET
 	struct label *ipq_label;	/* MAC label */
 #endif /* CONFIG_MACF_NET */
-	u_char	ipq_ttl;		/* time for reass q to live */
 	u_char	ipq_p;			/* protocol of this fragment */
 	u_short	ipq_id;			/* sequence id for reassembly */
 	struct	in_addr ipq_src, ipq_dst;
-	u_int32_t	ipq_nfrags;	/* # frags in this packet */
 	uint32_t ipq_csum_flags;	/* checksum flags */
 	uint32_t ipq_csum;		/* partial checksum value */
 #if IPDIVERT
@@ -114,6 +112,9 @@ struct ipq {
 #endif /* IPDIVERT */
 };
 
+#define	ipq_ttl		ipq_fq.fq_ttl		/* time for reass q to live */
+#define	ipq_nfrags	ipq_fq.fq_nfrags	/* # frags in this packet */
+
 /*
  * Structure stored in mbuf in inpcb.ip_options
  * and passed to ip_output when ip options are in use.
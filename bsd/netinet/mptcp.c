@@ -180,6 +180,7 @@ SYSCTL_UINT(_net_inet_mptcp, OID_AUTO, probecnt, CTLFLAG_RW | CTLFLAG_LOCKED,
  */
 static int mptcp_validate_csum(struct tcpcb *, struct mbuf *, int);
 static uint16_t mptcp_input_csum(struct tcpcb *, struct mbuf *, int);
+static int mptcp_output_stripe(struct mptses *);
 
 /*
  * MPTCP input, called when data has been read from a subflow socket.
@@ -365,9 +366,12 @@ mptcp_output(struct mptses *mpte)
 		return (EPIPE);
 	}
 
+	if (MPTCP_SCHED(mpte)->ms_flags & MPTCP_SCHEDF_STRIPE)
+		return (mptcp_output_stripe(mpte));
+
 try_again:
 	/* get the "best" subflow to be used for transmission */
-	mpts = mptcp_get_subflow(mpte, NULL, &preferred_mpts);
+	mpts = MPTCP_SCHED(mpte)->ms_select(mpte, NULL, &preferred_mpts);
 	if (mpts == NULL) {
 		mptcplog((LOG_ERR, "MPTCP Sender: mp_so 0x%llx no subflow\n",
 		    (u_int64_t)VM_KERNEL_ADDRPERM(mp_so)),
@@ -397,7 +401,7 @@ try_again:
 
 	DTRACE_MPTCP3(output, struct mptses *, mpte, struct mptsub *, mpts,
 	    struct socket *, mp_so);
-	error = mptcp_subflow_output(mpte, mpts);
+	error = mptcp_subflow_output(mpte, mpts, 0);
 	if (error) {
 		/* can be a temporary loss of source address or other error */
 		mpts->mpts_flags |= MPTSF_FAILINGOVER;
@@ -420,7 +424,8 @@ try_again:
 		if (preferred_mpts->mpts_probesoon) {
 			if ((tcp_now - preferred_mpts->mpts_probesoon) >
 			    mptcp_probeto) {
-				(void) mptcp_subflow_output(mpte, preferred_mpts);
+				(void) mptcp_subflow_output(mpte, preferred_mpts,
+				    0);
 				if (preferred_mpts->mpts_probecnt >=
 				    MIN(mptcp_probecnt, MPTCP_PROBE_MX)) {
 					preferred_mpts->mpts_probesoon = 0;
@@ -457,6 +462,131 @@ out:
 	return (0);
 }
 
+/*
+ * MPTCP output for schedulers that spread data over several subflows.
+ *
+ * Each round asks the scheduler for a subflow and fills its send buffer
+ * with one contiguous range: first what is queued for reinjection, then
+ * new data from mpt_sndnxt.  The subflow is given the range in a single
+ * mptcp_subflow_output(); it is sent from there on the subflow's own
+ * ACK clock.  A subflow that fails to take its range is marked failing
+ * over, and whatever it still holds is queued for the others.
+ */
+static int
+mptcp_output_stripe(struct mptses *mpte)
+{
+	struct mptcb *mp_tp = mpte->mpte_mptcb;
+	struct mptcp_sched *ms = MPTCP_SCHED(mpte);
+	struct mptcp_reinject *mr = &mpte->mpte_reinject[0];
+	struct mptsub *mpts, *first = NULL;
+	u_int64_t start, end;
+	boolean_t reinject;
+	int32_t space;
+	int error, rounds;
+
+	MPTE_LOCK_ASSERT_HELD(mpte);	/* same as MP socket lock */
+
+	for (rounds = 0; rounds < 2 * mpte->mpte_numflows; rounds++) {
+		if ((mpts = ms->ms_select(mpte, NULL, NULL)) == NULL)
+			break;
+
+		MPTS_LOCK(mpts);
+		if (mpts->mpts_flags & MPTSF_MP_DEGRADED) {
+			/* plain TCP; the subflow keeps its own cursor */
+			(void) mptcp_subflow_output(mpte, mpts, 0);
+			MPTS_UNLOCK(mpts);
+			first = mpts;
+			break;
+		}
+
+		MPT_LOCK(mp_tp);
+		reinject = FALSE;
+		while (mpte->mpte_nreinject > 0) {
+			start = mr->mr_start;
+			end = mr->mr_end;
+			if (MPTCP_SEQ_LT(start, mp_tp->mpt_snduna))
+				start = mp_tp->mpt_snduna;
+			if (MPTCP_SEQ_GT(end, mp_tp->mpt_sndnxt))
+				end = mp_tp->mpt_sndnxt;
+			if (MPTCP_SEQ_LT(start, end)) {
+				reinject = TRUE;
+				break;
+			}
+			/* acknowledged meanwhile */
+			mpte->mpte_nreinject--;
+			bcopy(&mr[1], &mr[0],
+			    mpte->mpte_nreinject * sizeof (*mr));
+		}
+		if (!reinject) {
+			start = mp_tp->mpt_sndnxt;
+			end = mp_tp->mpt_sndmax;
+		}
+		MPT_UNLOCK(mp_tp);
+
+		if (!MPTCP_SEQ_LT(start, end) ||
+		    (space = mptcp_sched_space(mpts)) == 0) {
+			MPTS_UNLOCK(mpts);
+			break;
+		}
+
+		mpts->mpts_sndnxt = start;
+		error = mptcp_subflow_output(mpte, mpts,
+		    (u_int32_t)MIN(end - start, (u_int64_t)space));
+		if (error != 0) {
+			mpts->mpts_flags |= MPTSF_FAILINGOVER;
+			mpts->mpts_flags &= ~MPTSF_ACTIVE;
+			mptcp_reinject_subflow(mpte, mpts);
+			MPTS_UNLOCK(mpts);
+			mptcp_sched_stat.mss_failed++;
+			mptcplog((LOG_INFO, "MPTCP Sender: %s cid %d error %d\n",
+			    __func__, mpts->mpts_connid, error),
+			    MPTCP_SENDER_DBG, MPTCP_LOGLVL_LOG);
+			continue;
+		}
+		if (mpts->mpts_sndnxt == start) {
+			MPTS_UNLOCK(mpts);
+			break;
+		}
+		if (reinject) {
+			mptcp_sched_stat.mss_reinjected +=
+			    mpts->mpts_sndnxt - start;
+			mr->mr_start = mpts->mpts_sndnxt;
+		}
+		mptcp_sched_stat.mss_sends++;
+		mpts->mpts_probesoon = mpts->mpts_probecnt = 0;
+		MPTS_UNLOCK(mpts);
+		if (first == NULL)
+			first = mpts;
+	}
+
+	if (first == NULL) {
+		/* nothing could be sent on any subflow; try again later */
+		if (mpte->mpte_nreinject > 0)
+			mptcp_start_timer(mpte, MPTT_REXMT);
+		return (0);
+	}
+
+	/*
+	 * The subflow served first is the one marked active; it is the
+	 * one kept should the connection fall back to plain TCP.
+	 */
+	if (mpte->mpte_active_sub != first) {
+		if (mpte->mpte_active_sub != NULL) {
+			MPTS_LOCK(mpte->mpte_active_sub);
+			mpte->mpte_active_sub->mpts_flags &= ~MPTSF_ACTIVE;
+			MPTS_UNLOCK(mpte->mpte_active_sub);
+		}
+		mpte->mpte_active_sub = first;
+		tcpstat.tcps_mp_switches++;
+	}
+	MPTS_LOCK(first);
+	first->mpts_flags |= MPTSF_ACTIVE;
+	MPTS_UNLOCK(first);
+
+	/* subflow errors should not be percolated back up */
+	return (0);
+}
+
 /*
  * Return the most eligible subflow to be used for sending data.
  * This function also serves to check if any alternate subflow is available
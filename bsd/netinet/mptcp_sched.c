@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * MPTCP subflow schedulers; see mptcp_var.h.
+ *
+ * "default" is the historical policy of mptcp_get_subflow(): one active
+ * subflow, picked by priority, RTT and RTO history and symptomsd hints,
+ * with failover to another one.
+ *
+ * "lowrtt" spreads the data over every usable subflow: mptcp_output()
+ * fills the send buffer of the subflow with the lowest smoothed RTT,
+ * then that of the next lowest, and so on.  Each subflow then sends
+ * what it was given, paced by its own ACKs and under its own socket
+ * lock, so the links of a connection are driven in parallel rather
+ * than one at a time.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+#include <sys/syslog.h>
+#include <sys/sysctl.h>
+
+#include <kern/locks.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_var.h>
+#include <netinet/mptcp_var.h>
+#include <netinet/mptcp_seq.h>
+
+static int mptcp_scheduler = MPTCP_SCHED_DEFAULT;
+
+static int sysctl_mptcp_scheduler SYSCTL_HANDLER_ARGS;
+
+SYSCTL_PROC(_net_inet_mptcp, OID_AUTO, scheduler,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, &mptcp_scheduler, 0,
+    sysctl_mptcp_scheduler, "I",
+    "Subflow scheduler of new connections (0 default, 1 lowest RTT)");
+
+struct mptcp_sched_stat mptcp_sched_stat;
+
+SYSCTL_STRUCT(_net_inet_mptcp, OID_AUTO, sched_stat,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &mptcp_sched_stat, mptcp_sched_stat,
+    "Subflow scheduler statistics");
+
+static struct mptsub *mptcp_sched_lowrtt_select(struct mptses *,
+    struct mptsub *, struct mptsub **);
+
+static struct mptcp_sched mptcp_sched_default = {
+	.ms_name = "default",
+	.ms_flags = 0,
+	.ms_select = mptcp_get_subflow,
+};
+
+static struct mptcp_sched mptcp_sched_lowrtt = {
+	.ms_name = "lowrtt",
+	.ms_flags = MPTCP_SCHEDF_STRIPE,
+	.ms_select = mptcp_sched_lowrtt_select,
+};
+
+struct mptcp_sched *mptcp_sched_list[MPTCP_SCHED_COUNT];
+
+static int
+sysctl_mptcp_scheduler SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int i, err;
+
+	i = mptcp_scheduler;
+	err = sysctl_handle_int(oidp, &i, 0, req);
+	if (err != 0 || req->newptr == USER_ADDR_NULL)
+		return (err);
+
+	if (i < 0 || i >= MPTCP_SCHED_COUNT)
+		return (EINVAL);
+
+	mptcp_scheduler = i;
+	return (0);
+}
+
+void
+mptcp_sched_init(void)
+{
+	mptcp_sched_list[MPTCP_SCHED_DEFAULT] = &mptcp_sched_default;
+	mptcp_sched_list[MPTCP_SCHED_LOWRTT] = &mptcp_sched_lowrtt;
+}
+
+void
+mptcp_sched_attach(struct mptses *mpte)
+{
+	mpte->mpte_sched = mptcp_scheduler;
+	mpte->mpte_nreinject = 0;
+}
+
+/*
+ * Room left in the send buffer of a subflow, in bytes.
+ */
+int32_t
+mptcp_sched_space(struct mptsub *mpts)
+{
+	struct socket *so = mpts->mpts_socket;
+	int32_t space;
+
+	MPTS_LOCK_ASSERT_HELD(mpts);
+
+	if (so == NULL || (so->so_flags & SOF_PCBCLEARING))
+		return (0);
+
+	socket_lock(so, 1);
+	space = sbspace(&so->so_snd);
+	socket_unlock(so, 1);
+	return (MAX(space, 0));
+}
+
+/*
+ * The usable subflow with the lowest smoothed RTT that has room for at
+ * least a segment, or for whatever is left to send.  A subflow without
+ * an RTT sample yet comes after those with one.  A degraded subflow is
+ * the only one there can be, and is always returned.
+ */
+static struct mptsub *
+mptcp_sched_lowrtt_select(struct mptses *mpte, struct mptsub *ignore,
+    struct mptsub **preferred)
+{
+#pragma unused(preferred)
+	struct mptcb *mp_tp = mpte->mpte_mptcb;
+	struct mptsub *mpts, *best = NULL;
+	int32_t srtt, best_srtt = 0, space;
+	u_int64_t pending;
+	struct socket *so;
+
+	MPTE_LOCK_ASSERT_HELD(mpte);	/* same as MP socket lock */
+
+	MPT_LOCK(mp_tp);
+	pending = mp_tp->mpt_sndmax - mp_tp->mpt_sndnxt;
+	MPT_UNLOCK(mp_tp);
+
+	TAILQ_FOREACH(mpts, &mpte->mpte_subflows, mpts_entry) {
+		if (mpts == ignore)
+			continue;
+
+		MPTS_LOCK(mpts);
+		if (mpts->mpts_flags & MPTSF_MP_DEGRADED) {
+			MPTS_UNLOCK(mpts);
+			return (mpts);
+		}
+
+		if ((!(mpts->mpts_flags & MPTSF_MP_CAPABLE) &&
+		    !(mpts->mpts_flags & MPTSF_FASTJ_REQD)) ||
+		    (mpts->mpts_flags & (MPTSF_SUSPENDED |
+		    MPTSF_DISCONNECTED | MPTSF_DISCONNECTING))) {
+			MPTS_UNLOCK(mpts);
+			continue;
+		}
+
+		/*
+		 * A failing subflow is taken back once everything it
+		 * was given has been acknowledged without an RTO spike.
+		 */
+		if (mpts->mpts_flags & MPTSF_FAILINGOVER) {
+			so = mpts->mpts_socket;
+			if (so == NULL || (so->so_flags & SOF_PCBCLEARING)) {
+				MPTS_UNLOCK(mpts);
+				continue;
+			}
+			socket_lock(so, 1);
+			if (so->so_snd.sb_cc == 0 && mptcp_no_rto_spike(so)) {
+				mpts->mpts_flags &= ~MPTSF_FAILINGOVER;
+				so->so_flags &= ~SOF_MP_TRYFAILOVER;
+			}
+			socket_unlock(so, 1);
+			if (mpts->mpts_flags & MPTSF_FAILINGOVER) {
+				MPTS_UNLOCK(mpts);
+				continue;
+			}
+		}
+
+		space = mptcp_sched_space(mpts);
+		if (space == 0 || ((u_int64_t)space < pending &&
+		    (u_int32_t)space < mpts->mpts_maxseg)) {
+			MPTS_UNLOCK(mpts);
+			continue;
+		}
+
+		srtt = (mpts->mpts_srtt != 0) ? mpts->mpts_srtt : INT32_MAX;
+		if (best == NULL || srtt < best_srtt) {
+			best = mpts;
+			best_srtt = srtt;
+		}
+		MPTS_UNLOCK(mpts);
+	}
+	return (best);
+}
+
+/*
+ * Queue the DSN range [start, end) to be sent again, merging it with
+ * the ranges already queued.  When they are all in use, the range is
+ * merged with the nearest one instead; sending more than needed again
+ * is harmless, as the peer drops duplicate data by its DSN.
+ */
+void
+mptcp_reinject_add(struct mptses *mpte, u_int64_t start, u_int64_t end)
+{
+	struct mptcp_reinject *mr = mpte->mpte_reinject;
+	int i, j, n = mpte->mpte_nreinject;
+
+	MPTE_LOCK_ASSERT_HELD(mpte);
+
+	if (!MPTCP_SEQ_LT(start, end))
+		return;
+
+	/* first range ending at or after start */
+	for (i = 0; i < n && MPTCP_SEQ_LT(mr[i].mr_end, start); i++)
+		;
+	if (i == n || MPTCP_SEQ_LT(end, mr[i].mr_start)) {
+		if (n == MPTCP_REINJECT_MAX) {
+			/* merge with the neighbour */
+			if (i == n)
+				i--;
+			if (MPTCP_SEQ_LT(start, mr[i].mr_start))
+				mr[i].mr_start = start;
+			if (MPTCP_SEQ_GT(end, mr[i].mr_end))
+				mr[i].mr_end = end;
+		} else {
+			for (j = n; j > i; j--)
+				mr[j] = mr[j - 1];
+			mr[i].mr_start = start;
+			mr[i].mr_end = end;
+			n++;
+		}
+	} else {
+		/* overlaps or touches mr[i] */
+		if (MPTCP_SEQ_LT(start, mr[i].mr_start))
+			mr[i].mr_start = start;
+		if (MPTCP_SEQ_GT(end, mr[i].mr_end))
+			mr[i].mr_end = end;
+	}
+
+	/* swallow the ranges that now touch mr[i] */
+	while (i + 1 < n && MPTCP_SEQ_LEQ(mr[i + 1].mr_start, mr[i].mr_end)) {
+		if (MPTCP_SEQ_GT(mr[i + 1].mr_end, mr[i].mr_end))
+			mr[i].mr_end = mr[i + 1].mr_end;
+		for (j = i + 1; j < n - 1; j++)
+			mr[j] = mr[j + 1];
+		n--;
+	}
+	mpte->mpte_nreinject = n;
+}
+
+/*
+ * Queue for reinjection everything a subflow has been given that its
+ * peer has not acknowledged at the subflow level, in one pass over its
+ * send buffer; consecutive mappings make up a single range.
+ */
+void
+mptcp_reinject_subflow(struct mptses *mpte, struct mptsub *mpts)
+{
+	struct socket *so = mpts->mpts_socket;
+	u_int64_t start = 0, end = 0;
+	struct mbuf *m;
+
+	MPTE_LOCK_ASSERT_HELD(mpte);
+	MPTS_LOCK_ASSERT_HELD(mpts);
+
+	if (so == NULL || (mpts->mpts_flags & MPTSF_MP_DEGRADED))
+		return;
+
+	socket_lock(so, 1);
+	for (m = so->so_snd.sb_mb; m != NULL; m = m->m_next) {
+		if (!(m->m_flags & M_PKTHDR) ||
+		    !(m->m_pkthdr.pkt_flags & PKTF_MPTCP) ||
+		    m->m_pkthdr.mp_rlen == 0)
+			continue;
+		if (start != end && m->m_pkthdr.mp_dsn == end) {
+			end += m->m_pkthdr.mp_rlen;
+			continue;
+		}
+		mptcp_reinject_add(mpte, start, end);
+		start = m->m_pkthdr.mp_dsn;
+		end = start + m->m_pkthdr.mp_rlen;
+	}
+	socket_unlock(so, 1);
+	mptcp_reinject_add(mpte, start, end);
+}
@@ -444,6 +444,8 @@ mptcp_init(struct protosw *pp, struct domain *dp)
 
 	/* Set up a list of unique keys */
 	mptcp_key_pool_init();
+
+	mptcp_sched_init();
 }
 
 /*
@@ -475,6 +477,7 @@ mptcp_sescreate(struct socket *mp_so, struct mppcb *mpp)
 	TAILQ_INIT(&mpte->mpte_subflows);
 	mpte->mpte_associd = SAE_ASSOCID_ANY;
 	mpte->mpte_connid_last = SAE_CONNID_ANY;
+	mptcp_sched_attach(mpte);
 
 	lck_mtx_init(&mpte->mpte_thread_lock, mppi->mppi_lock_grp,
 	    mppi->mppi_lock_attr);
@@ -1758,13 +1761,14 @@ mptcp_subflow_wupcall(struct socket *so, void *arg, int waitf)
 /*
  * Subflow socket output.
  *
- * Called for sending data from MPTCP to the underlying subflow socket.
+ * Called for sending data from MPTCP to the underlying subflow socket,
+ * from mpts_sndnxt on; at most len bytes of it, unless len is 0.
  */
 int
-mptcp_subflow_output(struct mptses *mpte, struct mptsub *mpts)
+mptcp_subflow_output(struct mptses *mpte, struct mptsub *mpts, u_int32_t len)
 {
 	struct socket *mp_so, *so;
-	size_t sb_cc = 0, tot_sent = 0;
+	size_t sb_cc = 0, tot_sent = 0, sendlen;
 	struct mbuf *sb_mb;
 	int error = 0;
 	u_int64_t mpt_dsn = 0;
@@ -1937,8 +1941,9 @@ mptcp_subflow_output(struct mptses *mpte, struct mptsub *mpts)
 	VERIFY(mpt_mbuf && (mpt_mbuf->m_pkthdr.pkt_flags & PKTF_MPTCP));
 
 	head = tail = NULL;
+	sendlen = (len != 0) ? MIN(sb_cc, len) : sb_cc;
 
-	while (tot_sent < sb_cc) {
+	while (tot_sent < sendlen) {
 		struct mbuf *m;
 		size_t mlen;
 
@@ -1951,6 +1956,8 @@ mptcp_subflow_output(struct mptses *mpte, struct mptsub *mpts)
 			panic("%s: unexpected %lu %lu \n", __func__,
 			    mlen, sb_cc);
 		}
+		/* the last mapping is cut short to the length asked for */
+		mlen = MIN(mlen, sendlen - tot_sent);
 
 		m = m_copym_mode(mpt_mbuf, (int)off, mlen, M_DONTWAIT,
 		    M_COPYM_MUST_COPY_HDR);
@@ -2493,6 +2500,12 @@ mptcp_subflow_failover_ev(struct mptses *mpte, struct mptsub *mpts,
 	if (altpath_exists) {
 		mpts->mpts_flags |= MPTSF_FAILINGOVER;
 		mpts->mpts_flags &= ~MPTSF_ACTIVE;
+		/*
+		 * When striping, the other subflows do not rewind to
+		 * snduna; the data stuck on this one is sent again instead.
+		 */
+		if (MPTCP_SCHED(mpte)->ms_flags & MPTCP_SCHEDF_STRIPE)
+			mptcp_reinject_subflow(mpte, mpts);
 	} else {
 		mptcplog((LOG_DEBUG, "MPTCP Events %s: no alt cid = %d\n",
 		    __func__, mpts->mpts_connid),
@@ -3645,12 +3658,13 @@ mptcp_thread_dowork(struct mptses *mpte)
 
 		ret = mptcp_subflow_events(mpte, mpts, &mpsofilt_hint_mask);
 
-		if (mpts->mpts_flags & MPTSF_ACTIVE) {
+		if ((mpts->mpts_flags & MPTSF_ACTIVE) &&
+		    !(MPTCP_SCHED(mpte)->ms_flags & MPTCP_SCHEDF_STRIPE)) {
 			mptcplog((LOG_DEBUG, "MPTCP Socket: "
 			    "%s: cid %d \n", __func__,
 			    mpts->mpts_connid),
 			    MPTCP_SOCKET_DBG, MPTCP_LOGLVL_VERBOSE);
-			(void) mptcp_subflow_output(mpte, mpts);
+			(void) mptcp_subflow_output(mpte, mpts, 0);
 		}
 
 		/*
@@ -3687,6 +3701,10 @@ mptcp_thread_dowork(struct mptses *mpte)
 		MPTS_REMREF(mpts);		/* ours */
 	}
 
+	/* a striping scheduler spreads the pending data itself */
+	if (MPTCP_SCHED(mpte)->ms_flags & MPTCP_SCHEDF_STRIPE)
+		(void) mptcp_output(mpte);
+
 	if (mpsofilt_hint_mask) {
 		soevent(mp_so, mpsofilt_hint_mask);
 	}
@@ -4560,11 +4578,13 @@ void
 mptcp_output_getm_dsnmap64(struct socket *so, int off, uint32_t datalen,
     u_int64_t *dsn, u_int32_t *relseq, u_int16_t *data_len)
 {
+	struct tcpcb *tp = sototcpcb(so);
 	struct mbuf *m = so->so_snd.sb_mb;
 	struct mbuf *mnext = NULL;
 	uint32_t runlen = 0;
 	u_int64_t dsn64;
 	uint32_t contig_len = 0;
+	int moff = 0;
 
 	if (m == NULL)
 		return;
@@ -4576,7 +4596,19 @@ mptcp_output_getm_dsnmap64(struct socket *so, int off, uint32_t datalen,
 	 * but the subflow sequence mapping is contiguous. Use the subflow
 	 * sequence property to find the right mbuf and corresponding dsn
 	 * mapping.
+	 *
+	 * tcp_output looks up the mapping of every segment at least twice,
+	 * at increasing offsets; start from the mbuf found last time as
+	 * long as the head of the send buffer has not been trimmed since,
+	 * instead of walking the whole buffer each time.
 	 */
+	if (tp->t_mpdss_m != NULL && tp->t_mpdss_head == m &&
+	    tp->t_mpdss_hseq == m->m_pkthdr.mp_rseq &&
+	    off >= tp->t_mpdss_off) {
+		m = tp->t_mpdss_m;
+		moff = tp->t_mpdss_off;
+	}
+	off -= moff;
 
 	while (m) {
 		VERIFY(m->m_pkthdr.pkt_flags & PKTF_MPTCP);
@@ -4584,6 +4616,7 @@ mptcp_output_getm_dsnmap64(struct socket *so, int off, uint32_t datalen,
 
 		if ((unsigned int)off >= m->m_pkthdr.mp_rlen) {
 			off -= m->m_pkthdr.mp_rlen;
+			moff += m->m_pkthdr.mp_rlen;
 			m = m->m_next;
 		} else {
 			break;
@@ -4595,6 +4628,11 @@ mptcp_output_getm_dsnmap64(struct socket *so, int off, uint32_t datalen,
 		/* NOTREACHED */
 	}
 
+	tp->t_mpdss_head = so->so_snd.sb_mb;
+	tp->t_mpdss_hseq = so->so_snd.sb_mb->m_pkthdr.mp_rseq;
+	tp->t_mpdss_m = m;
+	tp->t_mpdss_off = moff;
+
 	dsn64 = m->m_pkthdr.mp_dsn + off;
 	*dsn = dsn64;
 	*relseq = m->m_pkthdr.mp_rseq + off;
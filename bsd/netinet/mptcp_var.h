@@ -41,6 +41,8 @@
 #include <mach/boolean.h>
 #include <netinet/mp_pcb.h>
 
+#define	MPTCP_REINJECT_MAX	8	/* reinjection ranges per session */
+
 /*
  * MPTCP Session
  *
@@ -68,6 +70,17 @@ struct mptses {
 	uint8_t	mpte_flags;			/* per mptcp session flags */
 	uint8_t	mpte_lost_aid;			/* storing lost address id */
 	uint8_t	mpte_addrid_last;		/* storing address id parm */
+	uint8_t	mpte_sched;			/* index in mptcp_sched_list */
+	/*
+	 * Data to be sent again on other subflows, as DSN ranges sorted
+	 * and merged; filled from the send buffer of a failing subflow
+	 * by schedulers that spread data over several subflows.
+	 */
+	uint8_t	mpte_nreinject;			/* ranges in use */
+	struct mptcp_reinject {
+		u_int64_t	mr_start;
+		u_int64_t	mr_end;
+	} mpte_reinject[MPTCP_REINJECT_MAX];
 };
 
 /*
@@ -75,6 +88,50 @@ struct mptses {
  */
 #define	MPTE_SND_REM_ADDR	0x01		/* Send Remove_addr option */
 
+/*
+ * Subflow schedulers.
+ *
+ * A scheduler decides which subflow mptcp_output() sends on next.  One
+ * without MPTCP_SCHEDF_STRIPE is asked once per output, and the subflow
+ * it picks sends everything not yet sent on it, as the only active
+ * subflow.  One with MPTCP_SCHEDF_STRIPE is asked again for as long as
+ * there is data left, and each subflow it picks sends as much as its
+ * send buffer has room for; data is then sent once over all subflows,
+ * and what a failing subflow still holds is queued to be reinjected.
+ * A session keeps the scheduler it was created with.
+ */
+#define	MPTCP_SCHED_DEFAULT	0	/* one active subflow, failover */
+#define	MPTCP_SCHED_LOWRTT	1	/* all subflows, lowest RTT first */
+#define	MPTCP_SCHED_COUNT	2
+
+#define	MPTCP_SCHED_NAME_MAX	16
+
+struct mptcp_sched {
+	char		ms_name[MPTCP_SCHED_NAME_MAX];
+	uint32_t	ms_flags;
+	/*
+	 * Return the subflow to send on, or NULL.  ignore is a subflow
+	 * not to return; if preferred is not NULL, it is set to the
+	 * subflow the scheduler would rather use when that is not the
+	 * one returned.
+	 */
+	struct mptsub	*(*ms_select)(struct mptses *mpte,
+			    struct mptsub *ignore, struct mptsub **preferred);
+};
+
+#define	MPTCP_SCHEDF_STRIPE	0x1	/* spreads data over subflows */
+
+struct mptcp_sched_stat {
+	u_int64_t	mss_sends;	/* ranges given to a subflow */
+	u_int64_t	mss_reinjected;	/* bytes given again to another */
+	u_int64_t	mss_failed;	/* subflows that failed to take one */
+};
+
+extern struct mptcp_sched *mptcp_sched_list[MPTCP_SCHED_COUNT];
+extern struct mptcp_sched_stat mptcp_sched_stat;
+
+#define	MPTCP_SCHED(_mpte)	(mptcp_sched_list[(_mpte)->mpte_sched])
+
 #define	mptompte(mp)	((struct mptses *)(mp)->mpp_pcbe)
 
 #define	MPTE_LOCK_ASSERT_HELD(_mpte)					\
@@ -560,7 +617,8 @@ extern int mptcp_subflow_add(struct mptses *, struct mptsub *,
     struct proc *, uint32_t);
 extern void mptcp_subflow_del(struct mptses *, struct mptsub *, boolean_t);
 extern void mptcp_subflow_remref(struct mptsub *);
-extern int mptcp_subflow_output(struct mptses *, struct mptsub *);
+extern int mptcp_subflow_output(struct mptses *, struct mptsub *,
+    u_int32_t);
 extern void mptcp_subflow_disconnect(struct mptses *, struct mptsub *,
     boolean_t);
 extern void mptcp_subflow_sopeeloff(struct mptses *, struct mptsub *,
@@ -601,6 +659,11 @@ extern void mptcp_send_dfin(struct socket *);
 extern void mptcp_act_on_txfail(struct socket *);
 extern struct mptsub *mptcp_get_subflow(struct mptses *, struct mptsub *,
     struct mptsub **);
+extern void mptcp_sched_init(void);
+extern void mptcp_sched_attach(struct mptses *);
+extern int32_t mptcp_sched_space(struct mptsub *);
+extern void mptcp_reinject_subflow(struct mptses *, struct mptsub *);
+extern void mptcp_reinject_add(struct mptses *, u_int64_t, u_int64_t);
 extern struct mptsub *mptcp_get_pending_subflow(struct mptses *,
     struct mptsub *);
 extern struct mptsub* mptcp_use_symptoms_hints(struct mptsub*,
@@ -249,6 +249,63 @@ struct tcphdr {
 #define	ECN_MODE_ENABLE		0x1	/* force enable ECN on connection */
 #define	ECN_MODE_DISABLE	0x2	/* force disable ECN on connection */
 
+#define	TCP_CC_MODE			0x211	/* congestion control algorithm */
+
+#define	CC_MODE_DEFAULT		0x0	/* system wide default */
+#define	CC_MODE_NEWRENO		0x1	/* TCP NewReno */
+#define	CC_MODE_CUBIC		0x2	/* CUBIC */
+#define	CC_MODE_BBR		0x3	/* BBR, paced and model based */
+
+/*
+ * Kernel TLS.  Once the handshake is done, user space hands the session
+ * keys of one direction to the kernel with TCP_TLS_TX or TCP_TLS_RX and
+ * from then on reads and writes plaintext: the kernel frames and seals
+ * the data written (sendfile(2) included) into TLS records, and opens
+ * the records received.  Only AES-GCM is supported.
+ *
+ * Sent records are application data unless the message carries an
+ * IPPROTO_TCP/TCP_TLS_TX control message holding another record type.
+ * When a record of another type is received, the plaintext before it
+ * is read as usual, then the read fails with ENOMSG; the record is
+ * fetched with TCP_TLS_RX_RECORD, and nothing more is opened until
+ * TCP_TLS_RX is set again, with the next keys (TLS 1.3 KeyUpdate) or
+ * with no value to resume with the current ones.  A record that fails
+ * authentication makes reads fail with EBADMSG for good.
+ */
+#define	TCP_TLS_TX			0x212	/* struct tcp_tls_crypto */
+#define	TCP_TLS_RX			0x213	/* struct tcp_tls_crypto */
+#define	TCP_TLS_RX_RECORD		0x214	/* struct tcp_tls_record */
+
+#define	TLS_VERSION_1_2		0x0303
+#define	TLS_VERSION_1_3		0x0304
+
+#define	TLS_CIPHER_AES_128_GCM	1
+#define	TLS_CIPHER_AES_256_GCM	2
+
+#define	TLS_RT_CHANGE_CIPHER_SPEC	20
+#define	TLS_RT_ALERT			21
+#define	TLS_RT_HANDSHAKE		22
+#define	TLS_RT_APPLICATION_DATA		23
+
+#define	TLS_MAX_KEYLEN		32
+#define	TLS_IVLEN		12
+#define	TLS_MAX_PLAINTEXT	16384
+
+struct tcp_tls_crypto {
+	u_int16_t	tls_version;		/* TLS_VERSION_* */
+	u_int16_t	tls_cipher;		/* TLS_CIPHER_* */
+	u_int8_t	tls_key[TLS_MAX_KEYLEN];
+	u_int8_t	tls_iv[TLS_IVLEN];	/* 1.2: salt in the first 4 */
+	u_int64_t	tls_seq __attribute__((aligned(8))); /* of the next record */
+};
+
+struct tcp_tls_record {
+	u_int8_t	tls_type;		/* TLS_RT_* */
+	u_int8_t	tls_pad;
+	u_int16_t	tls_len;		/* of the plaintext */
+	u_int8_t	tls_data[];		/* as much as fits */
+};
+
 /*
  * The TCP_INFO socket option is a private API and is subject to change
  */
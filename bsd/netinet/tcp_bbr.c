@@ -0,0 +1,723 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * BBR congestion control.
+ *
+ * Instead of reacting to packet loss, BBR builds an explicit model of the
+ * path from two measurements: the bottleneck bandwidth, taken as the
+ * windowed maximum of the delivery rate over the last ten round trips,
+ * and the round-trip propagation delay, taken as the windowed minimum of
+ * the RTT over the last ten seconds.  The sender paces at a small multiple
+ * of the estimated bandwidth and bounds the data in flight to a small
+ * multiple of the bandwidth-delay product.  Random loss on long fat
+ * paths therefore does not collapse the window, and the standing queue
+ * at the bottleneck stays short.
+ *
+ * The connection goes through four modes:
+ *	STARTUP		pace at 2/ln(2) times the bandwidth until the
+ *			bandwidth estimate stops growing by 25% per round
+ *	DRAIN		pace below the bandwidth to drain the queue built
+ *			during STARTUP
+ *	PROBE_BW	cycle the pacing gain through [5/4, 3/4, 1, ...],
+ *			one phase per min RTT, to probe for more bandwidth
+ *	PROBE_RTT	if the min RTT has not been refreshed for ten
+ *			seconds, shrink to four segments for 200ms to let
+ *			the queue drain and measure the propagation delay
+ *
+ * The delivery rate is estimated from a small ring of send samples, one
+ * recorded roughly every eighth of a window.  Each sample remembers how
+ * much data had been delivered when it was sent; when the ack covering
+ * it arrives, the data delivered since divided by the elapsed time gives
+ * the rate.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/protosw.h>
+#include <sys/socketvar.h>
+#include <sys/syslog.h>
+
+#include <net/route.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+
+#if INET6
+#include <netinet/ip6.h>
+#endif /* INET6 */
+
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_cc.h>
+#include <netinet/tcpip.h>
+#include <netinet/tcp_seq.h>
+#include <kern/clock.h>
+#include <dev/random/randomdev.h>
+#include <libkern/OSAtomic.h>
+
+static int tcp_bbr_init(struct tcpcb *tp);
+static int tcp_bbr_cleanup(struct tcpcb *tp);
+static void tcp_bbr_cwnd_init(struct tcpcb *tp);
+static void tcp_bbr_congestion_avd(struct tcpcb *tp, struct tcphdr *th);
+static void tcp_bbr_ack_rcvd(struct tcpcb *tp, struct tcphdr *th);
+static void tcp_bbr_pre_fr(struct tcpcb *tp);
+static void tcp_bbr_post_fr(struct tcpcb *tp, struct tcphdr *th);
+static void tcp_bbr_after_idle(struct tcpcb *tp);
+static void tcp_bbr_after_timeout(struct tcpcb *tp);
+static int tcp_bbr_delay_ack(struct tcpcb *tp, struct tcphdr *th);
+static void tcp_bbr_switch_cc(struct tcpcb *tp, u_int16_t old_index);
+static void tcp_bbr_data_sent(struct tcpcb *tp, u_int32_t len);
+static void tcp_bbr_data_delivered(struct tcpcb *tp, struct tcphdr *th,
+    u_int32_t delivered);
+static inline void tcp_bbr_clear_state(struct tcpcb *tp);
+
+struct tcp_cc_algo tcp_cc_bbr = {
+	.name = "bbr",
+	.init = tcp_bbr_init,
+	.cleanup = tcp_bbr_cleanup,
+	.cwnd_init = tcp_bbr_cwnd_init,
+	.congestion_avd = tcp_bbr_congestion_avd,
+	.ack_rcvd = tcp_bbr_ack_rcvd,
+	.pre_fr = tcp_bbr_pre_fr,
+	.post_fr = tcp_bbr_post_fr,
+	.after_idle = tcp_bbr_after_idle,
+	.after_timeout = tcp_bbr_after_timeout,
+	.delay_ack = tcp_bbr_delay_ack,
+	.switch_to = tcp_bbr_switch_cc,
+	.data_sent = tcp_bbr_data_sent,
+	.data_delivered = tcp_bbr_data_delivered
+};
+
+/* modes */
+#define	TCP_BBR_STARTUP		1
+#define	TCP_BBR_DRAIN		2
+#define	TCP_BBR_PROBE_BW	3
+#define	TCP_BBR_PROBE_RTT	4
+
+/* flags */
+#define	TCP_BBRF_FULL_PIPE	0x1	/* STARTUP found the bottleneck bw */
+#define	TCP_BBRF_ROUND_START	0x2	/* this ack started a new round */
+#define	TCP_BBRF_PROBE_ROUND	0x4	/* a round ended in PROBE_RTT */
+#define	TCP_BBRF_IDLE_RESTART	0x8	/* restarting after idle */
+#define	TCP_BBRF_SENT		0x10	/* tb_snd_max is valid */
+
+/* gains are in units of 1/256 */
+#define	TCP_BBR_UNIT		256
+#define	TCP_BBR_HIGH_GAIN	739	/* 2/ln(2) */
+#define	TCP_BBR_DRAIN_GAIN	89	/* ln(2)/2 */
+#define	TCP_BBR_CWND_GAIN	512
+#define	TCP_BBR_FULL_BW_THRESH	320	/* bw growth that keeps STARTUP */
+#define	TCP_BBR_FULL_BW_COUNT	3	/* rounds without that growth */
+#define	TCP_BBR_CYCLE_LEN	8
+
+static const u_int32_t tcp_bbr_pacing_gain[TCP_BBR_CYCLE_LEN] = {
+	320, 192, 256, 256, 256, 256, 256, 256
+};
+
+#define	TCP_BBR_BW_RTTS		10	/* rounds in the bw max window */
+#define	TCP_BBR_MIN_TSO_SEGS	4	/* min cwnd, in segments */
+#define	TCP_BBR_RTT_UNKNOWN	0xffffffff
+
+static int tcp_bbr_min_rtt_win = 10 * TCP_RETRANSHZ;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, bbr_min_rtt_win,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &tcp_bbr_min_rtt_win, 0,
+	"BBR min RTT filter window, in msec");
+
+static int tcp_bbr_probe_rtt_time = 200;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, bbr_probe_rtt_time,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &tcp_bbr_probe_rtt_time, 0,
+	"Time BBR spends in PROBE_RTT, in msec");
+
+static inline u_int32_t
+tcp_bbr_now_us(void)
+{
+	struct timeval now;
+
+	microuptime(&now);
+	return ((u_int32_t)(now.tv_sec * USEC_PER_SEC + now.tv_usec));
+}
+
+static inline u_int32_t
+tcp_bbr_inflight(struct tcpcb *tp, tcp_seq ack)
+{
+	if (SEQ_GT(ack, tp->snd_una))
+		return (tp->snd_max - ack);
+	return (tp->snd_max - tp->snd_una);
+}
+
+static inline u_int64_t
+tcp_bbr_max_bw(struct tcp_bbr_state *st)
+{
+	return (st->tb_bw[0]);
+}
+
+/*
+ * Bandwidth-delay product scaled by gain, or 0 if there is no model yet
+ */
+static u_int32_t
+tcp_bbr_bdp(struct tcpcb *tp, u_int32_t gain)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+	u_int64_t bdp;
+
+	if (st->tb_min_rtt_us == TCP_BBR_RTT_UNKNOWN ||
+	    tcp_bbr_max_bw(st) == 0)
+		return (0);
+	bdp = (tcp_bbr_max_bw(st) * st->tb_min_rtt_us) / USEC_PER_SEC;
+	bdp = (bdp * gain) / TCP_BBR_UNIT;
+	if (bdp > (TCP_MAXWIN << TCP_MAX_WINSHIFT))
+		bdp = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+	return ((u_int32_t)bdp);
+}
+
+/*
+ * Congestion window the model calls for: the scaled BDP plus a few
+ * segments of headroom for delayed and stretched acks
+ */
+static u_int32_t
+tcp_bbr_target_cwnd(struct tcpcb *tp, u_int32_t gain)
+{
+	u_int32_t bdp;
+
+	bdp = tcp_bbr_bdp(tp, gain);
+	if (bdp == 0)
+		return (max(tp->snd_cwnd, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg));
+	bdp += 3 * tp->t_maxseg;
+	return (max(bdp, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg));
+}
+
+/*
+ * Move the congestion window toward the target computed by the model.
+ * Until the pipe is full the window grows like slow start.
+ */
+static u_int32_t
+tcp_bbr_grow_cwnd(struct tcpcb *tp, u_int32_t cw, u_int32_t acked)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+	u_int32_t target;
+
+	target = tcp_bbr_target_cwnd(tp, st->tb_cwnd_gain);
+	if (st->tb_flags & TCP_BBRF_FULL_PIPE)
+		cw = min(cw + acked, target);
+	else if (cw < target || tcp_bbr_bdp(tp, TCP_BBR_UNIT) == 0)
+		cw += acked;
+	cw = max(cw, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg);
+	if (st->tb_mode == TCP_BBR_PROBE_RTT)
+		cw = min(cw, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg);
+	return (min(cw, TCP_MAXWIN << tp->snd_scale));
+}
+
+/*
+ * Running max of the bandwidth over TCP_BBR_BW_RTTS rounds, tracking the
+ * best, second best and third best samples in successive sub-windows
+ * (Kathleen Nichols' algorithm).
+ */
+static void
+tcp_bbr_bw_update(struct tcp_bbr_state *st, u_int64_t bw)
+{
+	u_int32_t round = st->tb_round, dt;
+
+	if (bw >= st->tb_bw[0] ||
+	    round - st->tb_bw_round[2] > TCP_BBR_BW_RTTS) {
+		st->tb_bw[0] = st->tb_bw[1] = st->tb_bw[2] = bw;
+		st->tb_bw_round[0] = st->tb_bw_round[1] =
+		    st->tb_bw_round[2] = round;
+		return;
+	}
+	if (bw >= st->tb_bw[1]) {
+		st->tb_bw[1] = st->tb_bw[2] = bw;
+		st->tb_bw_round[1] = st->tb_bw_round[2] = round;
+	} else if (bw >= st->tb_bw[2]) {
+		st->tb_bw[2] = bw;
+		st->tb_bw_round[2] = round;
+	}
+
+	dt = round - st->tb_bw_round[0];
+	if (dt > TCP_BBR_BW_RTTS) {
+		/* the best sample aged out, promote the others */
+		st->tb_bw[0] = st->tb_bw[1];
+		st->tb_bw_round[0] = st->tb_bw_round[1];
+		st->tb_bw[1] = st->tb_bw[2];
+		st->tb_bw_round[1] = st->tb_bw_round[2];
+		st->tb_bw[2] = bw;
+		st->tb_bw_round[2] = round;
+		if (round - st->tb_bw_round[0] > TCP_BBR_BW_RTTS) {
+			st->tb_bw[0] = st->tb_bw[1];
+			st->tb_bw_round[0] = st->tb_bw_round[1];
+			st->tb_bw[1] = st->tb_bw[2];
+			st->tb_bw_round[1] = st->tb_bw_round[2];
+		}
+	} else if (st->tb_bw_round[1] == st->tb_bw_round[0] &&
+	    dt > TCP_BBR_BW_RTTS / 4) {
+		st->tb_bw[1] = st->tb_bw[2] = bw;
+		st->tb_bw_round[1] = st->tb_bw_round[2] = round;
+	} else if (st->tb_bw_round[2] == st->tb_bw_round[1] &&
+	    dt > TCP_BBR_BW_RTTS / 2) {
+		st->tb_bw[2] = bw;
+		st->tb_bw_round[2] = round;
+	}
+}
+
+static void
+tcp_bbr_set_pacing_rate(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+	u_int64_t rate;
+	u_int32_t srtt;
+
+	if (tcp_bbr_max_bw(st) != 0) {
+		rate = (tcp_bbr_max_bw(st) * st->tb_pacing_gain) /
+		    TCP_BBR_UNIT;
+	} else {
+		/* no sample yet, pace the initial window over the srtt */
+		srtt = tp->t_srtt >> TCP_RTT_SHIFT;
+		if (srtt == 0)
+			return;
+		rate = ((u_int64_t)tp->snd_cwnd * TCP_RETRANSHZ) / srtt;
+		rate = (rate * TCP_BBR_HIGH_GAIN) / TCP_BBR_UNIT;
+	}
+
+	/*
+	 * Until the pipe is known to be full, never slow down: the
+	 * estimate can only be low because of too little data in flight.
+	 */
+	if ((st->tb_flags & TCP_BBRF_FULL_PIPE) || rate > tp->t_pacing_rate)
+		tp->t_pacing_rate = rate;
+}
+
+static void
+tcp_bbr_enter_probe_bw(struct tcpcb *tp, u_int32_t now_us)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+
+	st->tb_mode = TCP_BBR_PROBE_BW;
+	st->tb_cwnd_gain = TCP_BBR_CWND_GAIN;
+	/*
+	 * Start at a random phase, but not in the draining one, so that
+	 * flows sharing a bottleneck do not probe in lockstep.
+	 */
+	st->tb_cycle_index = TCP_BBR_CYCLE_LEN - 1 -
+	    (RandomULong() % (TCP_BBR_CYCLE_LEN - 1));
+	st->tb_cycle_stamp_us = now_us;
+	st->tb_pacing_gain = tcp_bbr_pacing_gain[st->tb_cycle_index];
+}
+
+static void
+tcp_bbr_update_cycle(struct tcpcb *tp, u_int32_t inflight, u_int32_t now_us)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+	u_int32_t gain, elapsed;
+	int next;
+
+	gain = st->tb_pacing_gain;
+	elapsed = now_us - st->tb_cycle_stamp_us;
+	next = (elapsed > st->tb_min_rtt_us);
+	if (gain > TCP_BBR_UNIT) {
+		/* keep probing until the extra data is in flight */
+		next = next && (IN_FASTRECOVERY(tp) ||
+		    inflight >= tcp_bbr_bdp(tp, gain));
+	} else if (gain < TCP_BBR_UNIT) {
+		/* stop draining early once the queue is gone */
+		next = next || inflight <= tcp_bbr_bdp(tp, TCP_BBR_UNIT);
+	}
+	if (!next)
+		return;
+
+	st->tb_cycle_index = (st->tb_cycle_index + 1) % TCP_BBR_CYCLE_LEN;
+	st->tb_cycle_stamp_us = now_us;
+	st->tb_pacing_gain = tcp_bbr_pacing_gain[st->tb_cycle_index];
+}
+
+/*
+ * Advance the state machine after the model was updated by an ack
+ */
+static void
+tcp_bbr_update_mode(struct tcpcb *tp, u_int32_t inflight, u_int32_t now_us,
+    int expired)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+
+	/* STARTUP ends once the bandwidth stopped growing */
+	if ((st->tb_flags & (TCP_BBRF_FULL_PIPE | TCP_BBRF_ROUND_START)) ==
+	    TCP_BBRF_ROUND_START && st->tb_app_limited == 0) {
+		if (tcp_bbr_max_bw(st) >= (st->tb_full_bw *
+		    TCP_BBR_FULL_BW_THRESH) / TCP_BBR_UNIT) {
+			st->tb_full_bw = tcp_bbr_max_bw(st);
+			st->tb_full_bw_count = 0;
+		} else if (++st->tb_full_bw_count >= TCP_BBR_FULL_BW_COUNT) {
+			st->tb_flags |= TCP_BBRF_FULL_PIPE;
+		}
+	}
+
+	if (st->tb_mode == TCP_BBR_STARTUP &&
+	    (st->tb_flags & TCP_BBRF_FULL_PIPE)) {
+		st->tb_mode = TCP_BBR_DRAIN;
+		st->tb_pacing_gain = TCP_BBR_DRAIN_GAIN;
+		st->tb_cwnd_gain = TCP_BBR_HIGH_GAIN;
+	}
+	if (st->tb_mode == TCP_BBR_DRAIN &&
+	    inflight <= tcp_bbr_bdp(tp, TCP_BBR_UNIT))
+		tcp_bbr_enter_probe_bw(tp, now_us);
+
+	if (st->tb_mode == TCP_BBR_PROBE_BW)
+		tcp_bbr_update_cycle(tp, inflight, now_us);
+
+	/*
+	 * Refresh the min RTT by briefly draining everything from the
+	 * bottleneck queue if it was not seen again for a while.
+	 */
+	if (expired && st->tb_mode != TCP_BBR_PROBE_RTT &&
+	    !(st->tb_flags & TCP_BBRF_IDLE_RESTART)) {
+		st->tb_mode = TCP_BBR_PROBE_RTT;
+		st->tb_pacing_gain = TCP_BBR_UNIT;
+		st->tb_cwnd_gain = TCP_BBR_UNIT;
+		if (!IN_FASTRECOVERY(tp))
+			st->tb_prior_cwnd = tp->snd_cwnd;
+		st->tb_probe_rtt_done = 0;
+	}
+	if (st->tb_mode == TCP_BBR_PROBE_RTT) {
+		if (st->tb_probe_rtt_done == 0 &&
+		    inflight <= TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg) {
+			st->tb_probe_rtt_done = tcp_now +
+			    tcp_bbr_probe_rtt_time;
+			if (st->tb_probe_rtt_done == 0)
+				st->tb_probe_rtt_done = 1;
+			st->tb_flags &= ~TCP_BBRF_PROBE_ROUND;
+			st->tb_next_round_delivered = st->tb_delivered;
+		} else if (st->tb_probe_rtt_done != 0) {
+			if (st->tb_flags & TCP_BBRF_ROUND_START)
+				st->tb_flags |= TCP_BBRF_PROBE_ROUND;
+			if ((st->tb_flags & TCP_BBRF_PROBE_ROUND) &&
+			    TSTMP_GEQ(tcp_now, st->tb_probe_rtt_done)) {
+				st->tb_min_rtt_stamp = tcp_now;
+				tp->snd_cwnd = max(tp->snd_cwnd,
+				    st->tb_prior_cwnd);
+				if (st->tb_flags & TCP_BBRF_FULL_PIPE) {
+					tcp_bbr_enter_probe_bw(tp, now_us);
+				} else {
+					st->tb_mode = TCP_BBR_STARTUP;
+					st->tb_pacing_gain = TCP_BBR_HIGH_GAIN;
+					st->tb_cwnd_gain = TCP_BBR_HIGH_GAIN;
+				}
+			}
+		}
+	}
+	st->tb_flags &= ~TCP_BBRF_IDLE_RESTART;
+}
+
+static int
+tcp_bbr_init(struct tcpcb *tp)
+{
+	OSIncrementAtomic((volatile SInt32 *)&tcp_cc_bbr.num_sockets);
+
+	VERIFY(tp->t_ccstate != NULL);
+	tcp_bbr_clear_state(tp);
+	return (0);
+}
+
+static int
+tcp_bbr_cleanup(struct tcpcb *tp)
+{
+	OSDecrementAtomic((volatile SInt32 *)&tcp_cc_bbr.num_sockets);
+	tp->t_pacing_rate = 0;
+	tp->t_timer[TCPT_PACE] = 0;
+	return (0);
+}
+
+static void
+tcp_bbr_cwnd_init(struct tcpcb *tp)
+{
+	tcp_cc_cwnd_init_or_reset(tp);
+	tp->t_bytes_acked = 0;
+	/* BBR does not use ssthresh to leave slow start */
+	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+}
+
+/*
+ * Record a send sample for the delivery rate estimator
+ */
+static void
+tcp_bbr_data_sent(struct tcpcb *tp, u_int32_t len)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+	struct tcp_bbr_sample *bs;
+	struct socket *so = tp->t_inpcb->inp_socket;
+	u_int32_t now_us, inflight, gap, i;
+
+	now_us = tcp_bbr_now_us();
+	inflight = tp->snd_max - tp->snd_una;
+	if (inflight <= len) {
+		/* restarting from idle, the intervals start now */
+		st->tb_first_sent_us = now_us;
+		st->tb_delivered_us = now_us;
+	}
+
+	/*
+	 * Samples taken while the application does not keep the window
+	 * full underestimate the path, remember until when that lasts.
+	 */
+	if (so->so_snd.sb_cc <= inflight && inflight < tp->snd_cwnd)
+		st->tb_app_limited = max(st->tb_delivered + inflight, 1);
+
+	/*
+	 * Only new data starts a sample; a retransmission could start one
+	 * for data that was already selectively acknowledged.
+	 */
+	if ((st->tb_flags & TCP_BBRF_SENT) &&
+	    SEQ_LEQ(tp->snd_max, st->tb_snd_max))
+		return;
+	st->tb_snd_max = tp->snd_max;
+	st->tb_flags |= TCP_BBRF_SENT;
+	if (st->tb_nsamples > 0) {
+		i = (st->tb_sample_head + st->tb_nsamples - 1) %
+		    TCP_BBR_NSAMPLES;
+		gap = max(tp->snd_cwnd / TCP_BBR_NSAMPLES, tp->t_maxseg);
+		if (SEQ_LT(tp->snd_max, st->tb_samples[i].bs_end_seq + gap) ||
+		    st->tb_nsamples == TCP_BBR_NSAMPLES)
+			return;
+	}
+	i = (st->tb_sample_head + st->tb_nsamples) % TCP_BBR_NSAMPLES;
+	bs = &st->tb_samples[i];
+	bs->bs_end_seq = tp->snd_max;
+	bs->bs_sent_us = now_us;
+	bs->bs_delivered = st->tb_delivered;
+	bs->bs_delivered_us = st->tb_delivered_us;
+	bs->bs_first_sent_us = st->tb_first_sent_us;
+	bs->bs_app_limited = (st->tb_app_limited != 0);
+	st->tb_nsamples++;
+}
+
+/*
+ * Update the path model from an ack that delivered data
+ */
+static void
+tcp_bbr_data_delivered(struct tcpcb *tp, struct tcphdr *th,
+    u_int32_t delivered)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+	struct tcp_bbr_sample *bs = NULL;
+	tcp_seq highest;
+	u_int32_t now_us, interval, rtt;
+	u_int64_t bw;
+	int expired;
+
+	now_us = tcp_bbr_now_us();
+	st->tb_delivered += delivered;
+	st->tb_delivered_us = now_us;
+	st->tb_flags &= ~TCP_BBRF_ROUND_START;
+	if (st->tb_app_limited != 0 &&
+	    SEQ_GT(st->tb_delivered, st->tb_app_limited))
+		st->tb_app_limited = 0;
+
+	highest = th->th_ack;
+	if (!TAILQ_EMPTY(&tp->snd_holes) && SEQ_GT(tp->snd_fack, highest))
+		highest = tp->snd_fack;
+
+	/* the newest sample covered by this ack gives the freshest rate */
+	while (st->tb_nsamples > 0 &&
+	    SEQ_LEQ(st->tb_samples[st->tb_sample_head].bs_end_seq, highest)) {
+		bs = &st->tb_samples[st->tb_sample_head];
+		st->tb_sample_head = (st->tb_sample_head + 1) %
+		    TCP_BBR_NSAMPLES;
+		st->tb_nsamples--;
+	}
+
+	expired = TSTMP_GT(tcp_now,
+	    st->tb_min_rtt_stamp + tcp_bbr_min_rtt_win);
+	if (bs != NULL) {
+		st->tb_first_sent_us = bs->bs_sent_us;
+
+		if (SEQ_GEQ(bs->bs_delivered, st->tb_next_round_delivered)) {
+			st->tb_next_round_delivered = st->tb_delivered;
+			st->tb_round++;
+			st->tb_flags |= TCP_BBRF_ROUND_START;
+		}
+
+		rtt = now_us - bs->bs_sent_us;
+		if (rtt < st->tb_min_rtt_us || expired) {
+			st->tb_min_rtt_us = max(rtt, 1);
+			st->tb_min_rtt_stamp = tcp_now;
+		}
+
+		/*
+		 * Use the longer of the send and ack intervals so that ack
+		 * compression cannot inflate the estimate.
+		 */
+		interval = max(bs->bs_sent_us - bs->bs_first_sent_us,
+		    now_us - bs->bs_delivered_us);
+		if (interval >= st->tb_min_rtt_us && interval > 0) {
+			bw = ((u_int64_t)(st->tb_delivered - bs->bs_delivered) *
+			    USEC_PER_SEC) / interval;
+			if (!bs->bs_app_limited || bw >= tcp_bbr_max_bw(st))
+				tcp_bbr_bw_update(st, bw);
+		}
+	}
+
+	tcp_bbr_update_mode(tp, tcp_bbr_inflight(tp, th->th_ack), now_us,
+	    expired);
+	tcp_bbr_set_pacing_rate(tp);
+
+	/*
+	 * The recovery code bounds the data in flight by ssthresh and
+	 * does not call the other hooks; keep it in line with the model
+	 * so that random loss does not hold the connection back.
+	 */
+	if (IN_FASTRECOVERY(tp))
+		tp->snd_ssthresh = tcp_bbr_grow_cwnd(tp, tp->snd_ssthresh,
+		    delivered);
+}
+
+static void
+tcp_bbr_set_cwnd(struct tcpcb *tp, struct tcphdr *th)
+{
+	tp->snd_cwnd = tcp_bbr_grow_cwnd(tp, tp->snd_cwnd, BYTES_ACKED(th, tp));
+}
+
+static void
+tcp_bbr_congestion_avd(struct tcpcb *tp, struct tcphdr *th)
+{
+	tcp_bbr_set_cwnd(tp, th);
+}
+
+static void
+tcp_bbr_ack_rcvd(struct tcpcb *tp, struct tcphdr *th)
+{
+	tcp_bbr_set_cwnd(tp, th);
+}
+
+/*
+ * Loss is not a congestion signal for BBR.  Remember the window so it
+ * can be restored after recovery, and let the recovery code work with a
+ * threshold no smaller than the current model of the pipe.
+ */
+static void
+tcp_bbr_pre_fr(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+	u_int32_t win;
+
+	st->tb_prior_cwnd = tp->snd_cwnd;
+	win = min(tcp_bbr_target_cwnd(tp, TCP_BBR_UNIT), tp->snd_cwnd);
+	win = max(win, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg);
+	tp->snd_ssthresh = win;
+	tcp_cc_resize_sndbuf(tp);
+}
+
+static void
+tcp_bbr_post_fr(struct tcpcb *tp, struct tcphdr *th)
+{
+#pragma unused(th)
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+
+	tp->snd_cwnd = max(tp->snd_ssthresh, st->tb_prior_cwnd);
+}
+
+/*
+ * The model stays valid across idle periods; pacing keeps the restart
+ * from being a line rate burst.  Only reset if there is no model yet.
+ */
+static void
+tcp_bbr_after_idle(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+
+	if (tcp_bbr_max_bw(st) == 0) {
+		tcp_bbr_cwnd_init(tp);
+		return;
+	}
+	st->tb_flags |= TCP_BBRF_IDLE_RESTART;
+	if (st->tb_mode == TCP_BBR_PROBE_BW) {
+		st->tb_pacing_gain = TCP_BBR_UNIT;
+		tcp_bbr_set_pacing_rate(tp);
+	}
+}
+
+static void
+tcp_bbr_after_timeout(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+
+	/*
+	 * Avoid adjusting congestion window due to SYN retransmissions.
+	 * If more than one byte (SYN) is outstanding then it is still
+	 * needed to adjust the window.
+	 */
+	if (tp->t_state < TCPS_ESTABLISHED &&
+	    ((int)(tp->snd_max - tp->snd_una) <= 1))
+		return;
+
+	if (!IN_FASTRECOVERY(tp))
+		tcp_bbr_pre_fr(tp);
+
+	/* the samples in flight were lost with the data */
+	st->tb_nsamples = 0;
+
+	tp->snd_cwnd = tp->t_maxseg;
+}
+
+static int
+tcp_bbr_delay_ack(struct tcpcb *tp, struct tcphdr *th)
+{
+	return (tcp_cc_delay_ack(tp, th));
+}
+
+/*
+ * Start with a fresh model when switching from another algorithm; the
+ * window is kept so that the switch does not stall the connection.
+ */
+static void
+tcp_bbr_switch_cc(struct tcpcb *tp, u_int16_t old_cc_index)
+{
+#pragma unused(old_cc_index)
+	tcp_bbr_clear_state(tp);
+	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+
+	OSIncrementAtomic((volatile SInt32 *)&tcp_cc_bbr.num_sockets);
+}
+
+static inline void
+tcp_bbr_clear_state(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->t_ccstate->bbr_state;
+
+	bzero(st, sizeof (*st));
+	st->tb_mode = TCP_BBR_STARTUP;
+	st->tb_pacing_gain = TCP_BBR_HIGH_GAIN;
+	st->tb_cwnd_gain = TCP_BBR_HIGH_GAIN;
+	st->tb_min_rtt_us = TCP_BBR_RTT_UNKNOWN;
+	st->tb_min_rtt_stamp = tcp_now;
+	st->tb_delivered_us = st->tb_first_sent_us = tcp_bbr_now_us();
+	tp->t_pacing_rate = 0;
+	tp->t_pacing_credit = 0;
+	tp->t_pacing_ts = 0;
+}
@@ -89,11 +89,21 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, cubic_sockets,
 	CTLFLAG_RD | CTLFLAG_LOCKED,&tcp_cc_cubic.num_sockets, 
 	0, "Number of sockets using cubic");
 
+extern struct tcp_cc_algo tcp_cc_bbr;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, bbr_sockets,
+	CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_cc_bbr.num_sockets,
+	0, "Number of sockets using bbr");
+
 int tcp_use_newreno = 0;
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, use_newreno,
 	CTLFLAG_RW | CTLFLAG_LOCKED, &tcp_use_newreno, 0, 
 	"Use TCP NewReno by default");
 
+int tcp_use_bbr = 0;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, use_bbr,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &tcp_use_bbr, 0,
+	"Use BBR by default");
+
 static int tcp_check_cwnd_nonvalidated = 1;
 #if (DEBUG || DEVELOPMENT)
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, cwnd_nonvalidated,
@@ -136,6 +146,7 @@ tcp_cc_init(void)
 	tcp_cc_algo_list[TCP_CC_ALGO_NEWRENO_INDEX] = &tcp_cc_newreno;
 	tcp_cc_algo_list[TCP_CC_ALGO_BACKGROUND_INDEX] = &tcp_cc_ledbat;
 	tcp_cc_algo_list[TCP_CC_ALGO_CUBIC_INDEX] = &tcp_cc_cubic;
+	tcp_cc_algo_list[TCP_CC_ALGO_BBR_INDEX] = &tcp_cc_bbr;
 
 	tcp_cc_control_register();
 }
@@ -372,7 +383,8 @@ tcp_cc_delay_ack(struct tcpcb *tp, struct tcphdr *th)
 void
 tcp_cc_allocate_state(struct tcpcb *tp)
 {
-	if (tp->tcp_cc_index == TCP_CC_ALGO_CUBIC_INDEX &&
+	if ((tp->tcp_cc_index == TCP_CC_ALGO_CUBIC_INDEX ||
+		tp->tcp_cc_index == TCP_CC_ALGO_BBR_INDEX) &&
 		tp->t_ccstate == NULL) {
 		tp->t_ccstate = (struct tcp_ccstate *)zalloc(tcp_cc_zone);
 
@@ -388,6 +400,31 @@ tcp_cc_allocate_state(struct tcpcb *tp)
 	}
 }
 
+/*
+ * Congestion control algorithm for a foreground connection: the one
+ * chosen with the TCP_CC_MODE socket option, otherwise the system wide
+ * default.
+ */
+u_int16_t
+tcp_cc_foreground_index(struct tcpcb *tp)
+{
+	switch (tp->t_cc_mode) {
+	case CC_MODE_NEWRENO:
+		return (TCP_CC_ALGO_NEWRENO_INDEX);
+	case CC_MODE_CUBIC:
+		return (TCP_CC_ALGO_CUBIC_INDEX);
+	case CC_MODE_BBR:
+		return (TCP_CC_ALGO_BBR_INDEX);
+	default:
+		break;
+	}
+	if (tcp_use_bbr)
+		return (TCP_CC_ALGO_BBR_INDEX);
+	if (tcp_use_newreno)
+		return (TCP_CC_ALGO_NEWRENO_INDEX);
+	return (TCP_CC_ALGO_CUBIC_INDEX);
+}
+
 /*
  * If stretch ack was disabled automatically on long standing connections, 
  * re-evaluate the situation after 15 minutes to enable it.
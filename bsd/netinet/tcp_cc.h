@@ -70,7 +70,8 @@
 #define	TCP_CC_ALGO_NEWRENO_INDEX	1
 #define	TCP_CC_ALGO_BACKGROUND_INDEX	2 /* CC for background transport */
 #define	TCP_CC_ALGO_CUBIC_INDEX		3 /* default CC algorithm */
-#define	TCP_CC_ALGO_COUNT		4 /* Count of CC algorithms */
+#define	TCP_CC_ALGO_BBR_INDEX		4 /* model based, paced CC algorithm */
+#define	TCP_CC_ALGO_COUNT		5 /* Count of CC algorithms */
 
 #define TCP_CA_NAME_MAX 16		/* Maximum characters in the name of a CC algorithm */
 
@@ -124,6 +125,16 @@ struct tcp_cc_algo {
 	/* Switch a connection to this CC algorithm after sending some packets */
 	void (*switch_to)(struct tcpcb *tp, uint16_t old_cc_index); 
 
+	/* called after a segment carrying len bytes of data is sent */
+	void (*data_sent)(struct tcpcb *tp, uint32_t len);
+
+	/*
+	 * called on every ack that delivers data, cumulatively or by
+	 * SACK, before any other ack processing hook
+	 */
+	void (*data_delivered)(struct tcpcb *tp, struct tcphdr *th,
+	    uint32_t delivered);
+
 } __attribute__((aligned(4)));
 
 extern struct zone *tcp_cc_zone; 
@@ -150,6 +161,7 @@ extern void tcp_cc_after_idle_stretchack(struct tcpcb *tp);
 extern uint32_t tcp_cc_is_cwnd_nonvalidated(struct tcpcb *tp);
 extern void tcp_cc_adjust_nonvalidated_cwnd(struct tcpcb *tp);
 extern u_int32_t tcp_get_max_pipeack(struct tcpcb *tp);
+extern u_int16_t tcp_cc_foreground_index(struct tcpcb *tp);
 extern void tcp_clear_pipeack_state(struct tcpcb *tp);
 
 #endif /* KERNEL */
@@ -2789,6 +2789,9 @@ findpcb:
 				 * calculations in this function
 				 * assume that snd_una is not updated yet. 
 				 */
+				if (CC_ALGO(tp)->data_delivered != NULL)
+					CC_ALGO(tp)->data_delivered(tp, th,
+					    acked);
 				if (CC_ALGO(tp)->congestion_avd != NULL)
 					CC_ALGO(tp)->congestion_avd(tp, th);
 				tcp_ccdbg_trace(tp, th, TCP_CC_INSEQ_ACK_RCVD);
@@ -3946,6 +3949,17 @@ trimthenstep6:
 		    (to.to_nsacks > 0 || !TAILQ_EMPTY(&tp->snd_holes)))
 			tcp_sack_doack(tp, &to, th, &sack_bytes_acked);
 
+		/*
+		 * Let the congestion control algorithm account for the
+		 * data newly delivered to the receiver, whether it was
+		 * cumulatively acknowledged or selectively acknowledged.
+		 */
+		if (CC_ALGO(tp)->data_delivered != NULL &&
+		    (SEQ_GT(th->th_ack, tp->snd_una) || sack_bytes_acked > 0))
+			CC_ALGO(tp)->data_delivered(tp, th,
+			    (sack_bytes_acked > 0) ? sack_bytes_acked :
+			    BYTES_ACKED(th, tp));
+
 #if MPTCP
 		if ((tp->t_mpuna) && (SEQ_GEQ(th->th_ack, tp->t_mpuna))) {
 			if (tp->t_mpflags & TMPF_PREESTABLISHED) {
@@ -5967,10 +5981,9 @@ tcp_set_background_cc(struct socket *so)
 void
 tcp_set_foreground_cc(struct socket *so)
 {
-	if (tcp_use_newreno)
-		tcp_set_new_cc(so, TCP_CC_ALGO_NEWRENO_INDEX);
-	else
-		tcp_set_new_cc(so, TCP_CC_ALGO_CUBIC_INDEX);
+	struct tcpcb *tp = intotcpcb(sotoinpcb(so));
+
+	tcp_set_new_cc(so, tcp_cc_foreground_index(tp));
 }
 
 static void
@@ -80,6 +80,8 @@
 #include <sys/socket.h>
 #include <sys/socketvar.h>
 
+#include <kern/clock.h>
+
 #include <net/route.h>
 #include <net/ntstat.h>
 #include <net/if_var.h>
@@ -284,6 +286,20 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, enable_tlp,
 	CTLFLAG_RW | CTLFLAG_LOCKED,
 	&tcp_enable_tlp, 1, "Enable Tail loss probe");
 
+/*
+ * Paced connections may send a burst of up to this much time worth of
+ * data at the pacing rate, but never less than two segments.
+ */
+int tcp_pacing_burst = 1000;	/* usec */
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, pacing_burst,
+	CTLFLAG_RW | CTLFLAG_LOCKED,
+	&tcp_pacing_burst, 0, "Largest paced burst, in usec");
+
+static int32_t tcp_pacing_delayed = 0;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, pacing_delayed,
+	CTLFLAG_RD | CTLFLAG_LOCKED,
+	&tcp_pacing_delayed, 0, "Number of times output was held by pacing");
+
 static int32_t packchain_newlist = 0;
 static int32_t packchain_looped = 0;
 static int32_t packchain_sent = 0;
@@ -307,6 +323,7 @@ static int tcp_ip_output(struct socket *, struct tcpcb *, struct mbuf *, int,
     struct mbuf *, int, int, int32_t, boolean_t);
 static struct mbuf* tcp_send_lroacks(struct tcpcb *tp, struct mbuf *m, struct tcphdr *th);
 static int tcp_recv_throttle(struct tcpcb *tp);
+static int32_t tcp_pacing_limit(struct tcpcb *tp, int32_t len);
 
 static int32_t tcp_tfo_check(struct tcpcb *tp, int32_t len)
 {
@@ -531,7 +548,7 @@ tcp_output(struct tcpcb *tp)
 	struct tcphdr *th;
 	u_char opt[TCP_MAXOLEN];
 	unsigned ipoptlen, optlen, hdrlen;
-	int idle, sendalot, lost = 0;
+	int idle, sendalot, lost = 0, paced = 0;
 	int i, sack_rxmit;
 	int tso = 0;
 	int sack_bytes_rxmt;
@@ -565,6 +582,8 @@ tcp_output(struct tcpcb *tp)
 	boolean_t wifi = FALSE;
 	boolean_t wired = FALSE;
 	boolean_t sack_rescue_rxt = FALSE;
+	boolean_t payload_sum_valid = FALSE;
+	uint16_t payload_sum = 0;
 
 	/*
 	 * Determine length of data that should be transmitted,
@@ -756,6 +775,7 @@ again:
 	if (SACK_ENABLED(tp) && SEQ_LT(tp->snd_nxt, tp->snd_max))
 		tcp_sack_adjust(tp);
 	sendalot = 0;
+	paced = 0;
 	off = tp->snd_nxt - tp->snd_una;
 	sendwin = min(tp->snd_wnd, tp->snd_cwnd);
 
@@ -1215,6 +1235,25 @@ after_sack_rexmit:
 		}
 	}
 
+	/*
+	 * Hold back new data beyond what the pacing rate set by the
+	 * congestion control algorithm allows.  Retransmissions, probes
+	 * and forced sends go out right away.
+	 */
+	if (len > 0 && tp->t_pacing_rate != 0 && !sack_rxmit &&
+	    SEQ_GEQ(tp->snd_nxt, tp->snd_max) &&
+	    !(tp->t_flagsext & (TF_FORCE | TF_SENT_TLPROBE))) {
+		int32_t plen = tcp_pacing_limit(tp, len);
+
+		if (plen < len) {
+			len = plen;
+			sendalot = 0;
+			paced = 1;
+			if (len <= tp->t_maxseg)
+				tso = 0;
+		}
+	}
+
 	if (sack_rxmit) {
 		if (SEQ_LT(p->rxmit + len, tp->snd_una + so->so_snd.sb_cc))
 			flags &= ~TH_FIN;
@@ -1380,7 +1419,7 @@ after_sack_rexmit:
 	 * otherwise force out a byte.
 	 */
 	if (so->so_snd.sb_cc && tp->t_timer[TCPT_REXMT] == 0 &&
-	    tp->t_timer[TCPT_PERSIST] == 0) {
+	    tp->t_timer[TCPT_PERSIST] == 0 && !paced) {
 		tp->t_rxtshift = 0;
 		tp->t_rxtstart = 0;
 		tcp_setpersist(tp);
@@ -1844,6 +1883,7 @@ send:
 	 * be transmitted, and initialize the header from
 	 * the template for sends on this connection.
 	 */
+	payload_sum_valid = FALSE;
 	if (len) {
 		tp->t_pmtud_lastseg_size = len + optlen + ipoptlen;
 		if ((tp->t_flagsext & TF_FORCE) && len == 1)
@@ -1926,8 +1966,23 @@ send:
 				error = 0; /* should we return an error? */
 				goto out;
 			}
-			m_copydata(so->so_snd.sb_mb, off, (int) len,
-			    mtod(m, caddr_t) + hdrlen);
+			/*
+			 * If the last interface used by this connection
+			 * can't checksum TCP, the payload is going to be
+			 * summed in software anyway; do it while copying.
+			 */
+			if (!tso && inp->inp_last_outifp != NULL &&
+			    !(inp->inp_last_outifp->if_hwassist &
+			    (isipv6 ? IF_HWASSIST_CSUM_TCPIPV6 :
+			    IF_HWASSIST_CSUM_TCP))) {
+				payload_sum = m_copydata_sum16(
+				    so->so_snd.sb_mb, off, (int) len,
+				    mtod(m, caddr_t) + hdrlen);
+				payload_sum_valid = TRUE;
+			} else {
+				m_copydata(so->so_snd.sb_mb, off, (int) len,
+				    mtod(m, caddr_t) + hdrlen);
+			}
 			m->m_len += len;
 		} else {
 			uint32_t copymode;
@@ -2199,6 +2254,20 @@ send:
 				htons((u_short)(optlen + len)));
 	}
 
+	/*
+	 * The payload was summed while it was copied in; finish the
+	 * checksum here rather than having it computed again later.
+	 * th_sum holds the pseudo header sum at this point.
+	 */
+	if (payload_sum_valid) {
+		th->th_sum = ~in_addword(b_sum16(th, sizeof (*th) + optlen),
+		    payload_sum) & 0xffff;
+		m->m_pkthdr.csum_flags = 0;
+		m->m_pkthdr.csum_data = 0;
+		tcpstat.tcps_snd_swcsum++;
+		tcpstat.tcps_snd_swcsum_bytes += sizeof (*th) + optlen + len;
+	}
+
 	/*
 	 * Enable TSO and specify the size of the segments.
 	 * The TCP pseudo header checksum is always provided.
@@ -2344,6 +2413,9 @@ timer:
 			tp->snd_max = tp->snd_nxt + len;
 	}
 
+	if (len > 0 && CC_ALGO(tp)->data_sent != NULL)
+		CC_ALGO(tp)->data_sent(tp, len);
+
 #if TCPDEBUG
 	/*
 	 * Trace.
@@ -3094,3 +3166,51 @@ tcp_recv_throttle (struct tcpcb *tp)
 	
 	return (0);
 }
+
+/*
+ * Limit the amount of new data that may be sent right now to what the
+ * connection's pacing rate allows.  Credit accrues at t_pacing_rate
+ * bytes per second and is capped at a small burst; when no full segment
+ * is available, the pacing timer is armed to resume output later.
+ */
+static int32_t
+tcp_pacing_limit(struct tcpcb *tp, int32_t len)
+{
+	struct timeval now;
+	u_int64_t now_us, elapsed, burst, credit;
+	u_int32_t wait_ms;
+
+	microuptime(&now);
+	now_us = (u_int64_t)now.tv_sec * USEC_PER_SEC + now.tv_usec;
+
+	burst = (tp->t_pacing_rate * tcp_pacing_burst) / USEC_PER_SEC;
+	if (burst < 2 * tp->t_maxseg)
+		burst = 2 * tp->t_maxseg;
+
+	credit = tp->t_pacing_credit;
+	if (tp->t_pacing_ts != 0 && now_us > tp->t_pacing_ts) {
+		elapsed = now_us - tp->t_pacing_ts;
+		if (elapsed > USEC_PER_SEC)
+			elapsed = USEC_PER_SEC;
+		credit += (tp->t_pacing_rate * elapsed) / USEC_PER_SEC;
+	} else if (tp->t_pacing_ts == 0) {
+		credit = burst;
+	}
+	tp->t_pacing_ts = now_us;
+	if (credit > burst)
+		credit = burst;
+
+	if (credit < (u_int64_t)len) {
+		len = (int32_t)(credit / tp->t_maxseg) * tp->t_maxseg;
+		if (len == 0) {
+			wait_ms = (u_int32_t)(((tp->t_maxseg - credit) *
+			    TCP_RETRANSHZ) / tp->t_pacing_rate) + 1;
+			if (tp->t_timer[TCPT_PACE] == 0)
+				tp->t_timer[TCPT_PACE] =
+				    OFFSET_FROM_START(tp, wait_ms);
+			tcp_pacing_delayed++;
+		}
+	}
+	tp->t_pacing_credit = (u_int32_t)(credit - len);
+	return (len);
+}
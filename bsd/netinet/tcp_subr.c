@@ -118,6 +118,7 @@
 #include <netinet/tcp_var.h>
 #include <netinet/tcp_cc.h>
 #include <netinet/tcp_cache.h>
+#include <netinet/tcp_tls.h>
 #include <kern/thread_call.h>
 
 #if INET6
@@ -456,6 +457,7 @@ tcp_init(struct protosw *pp, struct domain *dp)
 	static int tcp_initialized = 0;
 	vm_size_t       str_size;
 	struct inpcbinfo *pcbinfo;
+	int i, j;
 
 	VERIFY((pp->pr_flags & (PR_INITIALIZED|PR_ATTACHED)) == PR_ATTACHED);
 
@@ -582,7 +584,12 @@ tcp_init(struct protosw *pp, struct domain *dp)
 	TAILQ_INIT(&tcp_tw_tailq);
 
 	bzero(&tcp_timer_list, sizeof(tcp_timer_list));
-	LIST_INIT(&tcp_timer_list.lhead);
+	for (i = 0; i < TCP_WHEEL_LEVELS; i++) {
+		for (j = 0; j < TCP_WHEEL_SIZE; j++)
+			LIST_INIT(&tcp_timer_list.wheel[i][j]);
+	}
+	LIST_INIT(&tcp_timer_list.expired);
+	tcp_timer_list.wheel_time = tcp_now;
 	/*
 	 * allocate lock group attribute, group and attribute for the tcp timer list
 	 */
@@ -1037,11 +1044,7 @@ tcp_newtcpcb(inp)
 	tp->t_rttmin = tcp_TCPTV_MIN;
 	tp->t_rxtcur = TCPTV_RTOBASE;
 
-	if (tcp_use_newreno)
-		/* use newreno by default */
-		tp->tcp_cc_index = TCP_CC_ALGO_NEWRENO_INDEX;
-	else
-		tp->tcp_cc_index = TCP_CC_ALGO_CUBIC_INDEX;
+	tp->tcp_cc_index = tcp_cc_foreground_index(tp);
 
 	tcp_cc_allocate_state(tp);
 
@@ -1494,6 +1497,7 @@ no_valid_rt:
 	if (tp->t_bwmeas != NULL) {
 		tcp_bwmeas_free(tp);
 	}
+	tcp_tls_free(tp);
 	tcp_rxtseg_clean(tp);
 	/* Free the packet list */
 	if (tp->t_pktlist_head != NULL)
@@ -2976,6 +2980,8 @@ tcp_sbspace(struct tcpcb *tp)
 	/* Compensate for data being processed by content filters */
 	pending = cfil_sock_data_space(sb);
 #endif /* CONTENT_FILTER */
+	/* Ciphertext waiting for the rest of its TLS record */
+	pending += tcp_tls_rx_pending(tp);
 	if (pending > space)
 		space = 0;
 	else
@@ -74,8 +74,10 @@
 #include <sys/mcache.h>
 #include <sys/queue.h>
 #include <kern/locks.h>
+#include <kern/clock.h>
 #include <kern/cpu_number.h>	/* before tcp_seq.h, for tcp_random18() */
 #include <mach/boolean.h>
+#include <mach/mach_time.h>
 
 #include <net/route.h>
 #include <net/if_var.h>
@@ -243,6 +245,36 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, tcp_resched_timerlist,
     CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_resched_timerlist, 0, 
     "Number of times timer list was rescheduled as part of processing a packet");
 
+static u_int64_t tcp_timer_runs = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, tcp_timer_runs,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_runs,
+    "Number of times the timer list was run");
+
+static u_int64_t tcp_timer_run_time = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, tcp_timer_run_time,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_run_time,
+    "Time spent running the timer list, in nsec");
+
+static u_int64_t tcp_timer_run_maxtime = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, tcp_timer_run_maxtime,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_run_maxtime,
+    "Longest single run of the timer list, in nsec");
+
+static u_int64_t tcp_timer_entries_run = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, tcp_timer_entries_run,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_entries_run,
+    "Number of timer entries taken off the wheel by the timer list");
+
+static u_int64_t tcp_timer_wheel_cascaded = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, tcp_timer_wheel_cascaded,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_cascaded,
+    "Number of timer entries cascaded to a lower level of the wheel");
+
+static u_int64_t tcp_timer_wheel_moved = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, tcp_timer_wheel_moved,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_moved,
+    "Number of timer entries moved to an earlier slot of the wheel");
+
 int	tcp_pmtud_black_hole_detect = 1 ;
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, pmtud_blackhole_detection,
     CTLFLAG_RW | CTLFLAG_LOCKED, &tcp_pmtud_black_hole_detect, 0,
@@ -289,6 +321,12 @@ static u_int32_t tcp_run_conn_timer(struct tcpcb *tp, u_int16_t *mode,
     u_int16_t probe_if_index);
 static void tcp_sched_timers(struct tcpcb *tp);
 static inline void tcp_set_lotimer_index(struct tcpcb *);
+static void tcp_timer_wheel_insert(struct tcptimerlist *,
+    struct tcptimerentry *);
+static void tcp_timer_wheel_unlink(struct tcptimerlist *,
+    struct tcptimerentry *);
+static void tcp_timer_wheel_advance(struct tcptimerlist *);
+static uint32_t tcp_timer_wheel_next(struct tcptimerlist *);
 __private_extern__ void tcp_remove_from_time_wait(struct inpcb *inp);
 __private_extern__ void tcp_report_stats(void);
 
@@ -1328,6 +1366,13 @@ fc_output:
 		tp->t_tlphighrxt = tp->snd_nxt;
 		break;
 	}
+	case TCPT_PACE:
+		/*
+		 * Enough pacing credit has accrued to send another
+		 * segment held back by tcp_output.
+		 */
+		(void) tcp_output(tp);
+		break;
 	case TCPT_DELAYFR:
 		tp->t_flagsext &= ~TF_DELAY_RECOVERY;
 
@@ -1393,10 +1438,7 @@ tcp_remove_timer(struct tcpcb *tp)
 		return;
 	}
 	
-	if (listp->next_te != NULL && listp->next_te == &tp->tentry)
-		listp->next_te = LIST_NEXT(&tp->tentry, le);
-
-	LIST_REMOVE(&tp->tentry, le);
+	tcp_timer_wheel_unlink(listp, &tp->tentry);
 	tp->t_flags &= ~(TF_TIMER_ONLIST);
 
 	listp->entries--;
@@ -1406,6 +1448,190 @@ tcp_remove_timer(struct tcpcb *tp)
 	lck_mtx_unlock(listp->mtx);
 }
 
+/*
+ * Put a timer entry on the wheel slot for its deadline.  The slot is
+ * picked relative to the next tick the wheel will process, so an entry
+ * that is already due lands in the slot processed by the next run.
+ */
+static void
+tcp_timer_wheel_insert(struct tcptimerlist *listp, struct tcptimerentry *te)
+{
+	uint32_t runtime, level, slot, i;
+	int32_t delta;
+
+	lck_mtx_assert(listp->mtx, LCK_MTX_ASSERT_OWNED);
+
+	runtime = (te->index < TCPT_NONE) ? te->runtime : listp->wheel_time;
+	delta = (int32_t)(runtime - listp->wheel_time);
+	if (delta < 0) {
+		runtime = listp->wheel_time;
+		delta = 0;
+	}
+
+	for (level = 0; level < TCP_WHEEL_LEVELS - 1; level++) {
+		if ((uint32_t)delta < (1U << ((level + 1) * TCP_WHEEL_BITS)))
+			break;
+	}
+	slot = (runtime >> (level * TCP_WHEEL_BITS)) & TCP_WHEEL_MASK;
+
+	LIST_INSERT_HEAD(&listp->wheel[level][slot], te, le);
+	te->wheel_slot = (level << TCP_WHEEL_BITS) | slot;
+	te->wheel_runtime = runtime;
+	te->wheel_mode = te->mode;
+
+	listp->level_entries[level]++;
+	for (i = 0; i < TCP_TIMERLIST_NMODES; i++) {
+		if (te->wheel_mode & (1 << i))
+			listp->mode_entries[i]++;
+	}
+}
+
+/*
+ * Take a timer entry off the wheel or off the list of entries that
+ * are being run.
+ */
+static void
+tcp_timer_wheel_unlink(struct tcptimerlist *listp, struct tcptimerentry *te)
+{
+	uint32_t level, i;
+
+	lck_mtx_assert(listp->mtx, LCK_MTX_ASSERT_OWNED);
+
+	LIST_REMOVE(te, le);
+	if (te->wheel_slot == TCP_WHEEL_EXPIRED)
+		return;
+
+	level = te->wheel_slot >> TCP_WHEEL_BITS;
+	VERIFY(level < TCP_WHEEL_LEVELS && listp->level_entries[level] > 0);
+	listp->level_entries[level]--;
+	for (i = 0; i < TCP_TIMERLIST_NMODES; i++) {
+		if (te->wheel_mode & (1 << i)) {
+			VERIFY(listp->mode_entries[i] > 0);
+			listp->mode_entries[i]--;
+		}
+	}
+	te->wheel_slot = TCP_WHEEL_EXPIRED;
+}
+
+/*
+ * Advance the wheel up to the current tcp clock, moving every entry
+ * whose slot has come due to the expired list.  Higher levels are
+ * cascaded lazily, one slot at a time, when the level below wraps;
+ * an entry whose deadline was pushed out meanwhile simply lands in a
+ * later slot.  Stretches of time with nothing on the lower levels are
+ * skipped without visiting their slots.
+ */
+static void
+tcp_timer_wheel_advance(struct tcptimerlist *listp)
+{
+	struct timerlisthead *head;
+	struct tcptimerentry *te;
+	uint32_t level, span, next;
+
+	lck_mtx_assert(listp->mtx, LCK_MTX_ASSERT_OWNED);
+
+	while (TSTMP_GEQ(tcp_now, listp->wheel_time)) {
+		if (listp->entries == 0) {
+			listp->wheel_time = tcp_now + 1;
+			break;
+		}
+
+		/* cascade the next slot of each level that wrapped */
+		for (level = 1; level < TCP_WHEEL_LEVELS; level++) {
+			uint32_t shift = level * TCP_WHEEL_BITS;
+
+			if ((listp->wheel_time &
+			    ((1U << shift) - 1)) != 0)
+				break;
+			head = &listp->wheel[level][(listp->wheel_time >>
+			    shift) & TCP_WHEEL_MASK];
+			while ((te = LIST_FIRST(head)) != NULL) {
+				tcp_timer_wheel_unlink(listp, te);
+				tcp_timer_wheel_insert(listp, te);
+				tcp_timer_wheel_cascaded++;
+			}
+		}
+
+		if (listp->level_entries[0] == 0) {
+			/*
+			 * Jump to the next tick at which a level holding
+			 * entries gets cascaded.
+			 */
+			span = TCP_WHEEL_SIZE;
+			for (level = 1; level < TCP_WHEEL_LEVELS - 1 &&
+			    listp->level_entries[level] == 0; level++)
+				span <<= TCP_WHEEL_BITS;
+			next = (listp->wheel_time | (span - 1)) + 1;
+			if (TSTMP_GT(next, tcp_now + 1))
+				next = tcp_now + 1;
+			listp->wheel_time = next;
+			continue;
+		}
+
+		head = &listp->wheel[0][listp->wheel_time & TCP_WHEEL_MASK];
+		while ((te = LIST_FIRST(head)) != NULL) {
+			tcp_timer_wheel_unlink(listp, te);
+			LIST_INSERT_HEAD(&listp->expired, te, le);
+			tcp_timer_entries_run++;
+		}
+		listp->wheel_time++;
+	}
+}
+
+/*
+ * Return the offset from the tcp clock of the next tick at which the
+ * wheel has work to do, either an occupied level 0 slot or a higher
+ * level slot that needs to be cascaded.  This may be earlier than the
+ * earliest deadline, never later.
+ */
+static uint32_t
+tcp_timer_wheel_next(struct tcptimerlist *listp)
+{
+	uint32_t level, shift, base, k, when, next = 0;
+	boolean_t found = FALSE;
+
+	lck_mtx_assert(listp->mtx, LCK_MTX_ASSERT_OWNED);
+
+	for (k = 0; listp->level_entries[0] > 0 && k < TCP_WHEEL_SIZE; k++) {
+		when = listp->wheel_time + k;
+		if (!LIST_EMPTY(&listp->wheel[0][when & TCP_WHEEL_MASK])) {
+			next = when;
+			found = TRUE;
+			break;
+		}
+	}
+
+	for (level = 1; level < TCP_WHEEL_LEVELS; level++) {
+		if (listp->level_entries[level] == 0)
+			continue;
+		shift = level * TCP_WHEEL_BITS;
+		base = listp->wheel_time >> shift;
+		/*
+		 * The slot at the current index is cascaded now if the
+		 * wheel sits on its boundary, otherwise one revolution
+		 * from now.
+		 */
+		k = ((listp->wheel_time & ((1U << shift) - 1)) == 0) ? 0 : 1;
+		for (; k <= TCP_WHEEL_SIZE; k++) {
+			if (LIST_EMPTY(&listp->wheel[level][(base + k) &
+			    TCP_WHEEL_MASK]))
+				continue;
+			when = (base + k) << shift;
+			if (!found || TSTMP_LT(when, next)) {
+				next = when;
+				found = TRUE;
+			}
+			break;
+		}
+	}
+
+	if (!found)
+		return (TCP_TIMERLIST_MAX_OFFSET);
+	if (TSTMP_LEQ(next, tcp_now))
+		return (1);
+	return (timer_diff(next, 0, tcp_now, 0));
+}
+
 /*
  * Function to check if the timerlist needs to be rescheduled to run
  * the timer entry correctly. Basically, this is to check if we can avoid
@@ -1616,34 +1842,42 @@ done:
 void
 tcp_run_timerlist(void * arg1, void * arg2) {
 #pragma unused(arg1, arg2)
-	struct tcptimerentry *te, *next_te;
+	struct tcptimerentry *te;
 	struct tcptimerlist *listp = &tcp_timer_list;
 	struct tcpcb *tp;
 	uint32_t next_timer = 0; /* offset of the next timer on the list */
 	u_int16_t te_mode = 0;	/* modes of all active timers in a tcpcb */
 	u_int16_t list_mode = 0; /* cumulative of modes of all tcpcbs */
 	uint32_t active_count = 0;
+	uint64_t start_time, run_time;
+	uint32_t i;
+
+	start_time = mach_absolute_time();
 
 	calculate_tcp_clock();
 
 	lck_mtx_lock(listp->mtx);
 
 	listp->running = TRUE;
-	
-	LIST_FOREACH_SAFE(te, &listp->lhead, le, next_te) {
-		uint32_t offset = 0;
+
+	/* Collect the entries that are due from the wheel */
+	tcp_timer_wheel_advance(listp);
+
+	while ((te = LIST_FIRST(&listp->expired)) != NULL) {
 		uint32_t runtime = te->runtime;
+
+		tp = TIMERENTRY_TO_TP(te);
+
+		/*
+		 * The deadline was pushed out after the entry was put on
+		 * the wheel; just move it to the slot for the new one.
+		 */
 		if (te->index < TCPT_NONE && TSTMP_GT(runtime, tcp_now)) {
-			offset = timer_diff(runtime, 0, tcp_now, 0);
-			if (next_timer == 0 || offset < next_timer) {
-				next_timer = offset;
-			}
-			list_mode |= te->mode;
+			LIST_REMOVE(te, le);
+			tcp_timer_wheel_insert(listp, te);
 			continue;
 		}
 
-		tp = TIMERENTRY_TO_TP(te);
-
 		/*
 		 * Acquire an inp wantcnt on the inpcb so that the socket
 		 * won't get detached even if tcp_close is called
@@ -1657,48 +1891,46 @@ tcp_run_timerlist(void * arg1, void * arg2) {
 			 * protected by the timer list lock, we can 
 			 * do it here without the socket lock.
 			 */
-			if (TIMER_IS_ON_LIST(tp)) {
-				tp->t_flags &= ~(TF_TIMER_ONLIST);
-				LIST_REMOVE(&tp->tentry, le);
-				listp->entries--;
+			tp->t_flags &= ~(TF_TIMER_ONLIST);
+			LIST_REMOVE(te, le);
+			listp->entries--;
 
-				tp->tentry.le.le_next = NULL;
-				tp->tentry.le.le_prev = NULL;
-			}
+			te->le.le_next = NULL;
+			te->le.le_prev = NULL;
 			continue;
 		}
 		active_count++;
 
-		/*
-		 * Store the next timerentry pointer before releasing the
-		 * list lock. If that entry has to be removed when we
-		 * release the lock, this pointer will be updated to the
-		 * element after that.
-		 */
-		listp->next_te = next_te; 
-
-		VERIFY_NEXT_LINK(&tp->tentry, le);
-		VERIFY_PREV_LINK(&tp->tentry, le);
+		VERIFY_NEXT_LINK(te, le);
+		VERIFY_PREV_LINK(te, le);
 
 		lck_mtx_unlock(listp->mtx);
 
-		offset = tcp_run_conn_timer(tp, &te_mode,
+		(void) tcp_run_conn_timer(tp, &te_mode,
 		    listp->probe_if_index);
-		
-		lck_mtx_lock(listp->mtx);
 
-		next_te = listp->next_te;
-		listp->next_te = NULL;
-
-		if (offset > 0 && te_mode != 0) {
-			list_mode |= te_mode;
+		lck_mtx_lock(listp->mtx);
 
-			if (next_timer == 0 || offset < next_timer)
-				next_timer = offset;
+		/*
+		 * Unless the connection took itself off the list while
+		 * its timers ran, put it back on the wheel for the next
+		 * deadline.  Nothing else is added to the expired list
+		 * while it is being run, so the entry is still alive if
+		 * it is still at the head; tp itself may be gone.
+		 */
+		if (LIST_FIRST(&listp->expired) == te) {
+			LIST_REMOVE(te, le);
+			tcp_timer_wheel_insert(listp, te);
 		}
 	}
 
-	if (!LIST_EMPTY(&listp->lhead)) {
+	for (i = 0; i < TCP_TIMERLIST_NMODES; i++) {
+		if (listp->mode_entries[i] > 0)
+			list_mode |= (1 << i);
+	}
+	next_timer = tcp_timer_wheel_next(listp);
+
+	if (listp->entries > 0) {
 		u_int16_t next_mode = 0;
 		if ((list_mode & TCP_TIMERLIST_10MS_MODE) ||
 			(listp->pref_mode & TCP_TIMERLIST_10MS_MODE))
@@ -1752,6 +1984,13 @@ tcp_run_timerlist(void * arg1, void * arg2) {
 	listp->probe_if_index = 0;
 
 	lck_mtx_unlock(listp->mtx);
+
+	run_time = mach_absolute_time() - start_time;
+	absolutetime_to_nanoseconds(run_time, &run_time);
+	tcp_timer_runs++;
+	tcp_timer_run_time += run_time;
+	if (run_time > tcp_timer_run_maxtime)
+		tcp_timer_run_maxtime = run_time;
 }
 
 /*
@@ -1798,7 +2037,7 @@ tcp_sched_timers(struct tcpcb *tp)
 			list_locked = TRUE;
 		}
 
-		LIST_INSERT_HEAD(&listp->lhead, te, le);
+		tcp_timer_wheel_insert(listp, te);
 		tp->t_flags |= TF_TIMER_ONLIST;
 
 		listp->entries++;
@@ -1808,6 +2047,25 @@ tcp_sched_timers(struct tcpcb *tp)
 		/* if the list is not scheduled, just schedule it */
 		if (!listp->scheduled)
 			goto schedule;
+	} else if (te->wheel_slot == TCP_WHEEL_EXPIRED ||
+	    TSTMP_LT(te->runtime, te->wheel_runtime) ||
+	    (mode & ~te->wheel_mode) != 0) {
+		/*
+		 * A later deadline is picked up lazily when the entry's
+		 * slot comes due, but an earlier one or a faster mode
+		 * needs the entry moved now.  Entries that the timer list
+		 * is running are put back on the wheel by it.
+		 */
+		if (!list_locked) {
+			lck_mtx_lock(listp->mtx);
+			list_locked = TRUE;
+		}
+		if (TIMER_IS_ON_LIST(tp) &&
+		    te->wheel_slot != TCP_WHEEL_EXPIRED) {
+			tcp_timer_wheel_unlink(listp, te);
+			tcp_timer_wheel_insert(listp, te);
+			tcp_timer_wheel_moved++;
+		}
 	}
 
 
@@ -126,17 +126,18 @@
 #ifdef BSD_KERNEL_PRIVATE
 
 #define	TCPT_PTO	0	/* Probe timeout */
-#define	TCPT_DELAYFR	1	/* Delay recovery if there is reordering */
-#define	TCPT_REXMT	2	/* retransmit */
-#define	TCPT_DELACK	3	/* delayed ack */
-#define	TCPT_PERSIST	4	/* retransmit persistence */
-#define	TCPT_KEEP	5	/* keep alive */
-#define	TCPT_2MSL	6	/* 2*msl quiet time timer */
+#define	TCPT_PACE	1	/* resume paced output */
+#define	TCPT_DELAYFR	2	/* Delay recovery if there is reordering */
+#define	TCPT_REXMT	3	/* retransmit */
+#define	TCPT_DELACK	4	/* delayed ack */
+#define	TCPT_PERSIST	5	/* retransmit persistence */
+#define	TCPT_KEEP	6	/* keep alive */
+#define	TCPT_2MSL	7	/* 2*msl quiet time timer */
 #if MPTCP
-#define TCPT_JACK_RXMT	7	/* retransmit timer for join ack */
-#define TCPT_MAX	7
+#define TCPT_JACK_RXMT	8	/* retransmit timer for join ack */
+#define TCPT_MAX	8
 #else /* MPTCP */
-#define	TCPT_MAX	6
+#define	TCPT_MAX	7
 #endif /* !MPTCP */
 
 #define	TCPT_NONE	(TCPT_MAX + 1)	
@@ -222,7 +223,8 @@ static char *tcptimers[] =
  * Rexmt and delayed ack timers are considered as fast timers which run 
  * in the order of 100ms.
  *
- * Probe timeout is a quick timer which will run in the order of 10ms.
+ * Probe timeout and the pacing timer are quick timers which will run in
+ * the order of 10ms.
  */
 #define	IS_TIMER_HZ_500MS(i)	((i) >= TCPT_PERSIST)
 #define	IS_TIMER_HZ_100MS(i)	((i) >= TCPT_REXMT && (i) < TCPT_PERSIST) 
@@ -236,12 +238,36 @@ struct tcptimerentry {
 	uint16_t index;		/* index of lowest timer that needs to run first */
 	uint16_t mode;		/* Bit-wise OR of timers that are active */
 	uint32_t runtime;	/* deadline at which the first timer has to fire */
+	uint32_t wheel_runtime;	/* deadline used to pick the wheel slot */
+	uint16_t wheel_slot;	/* level and slot on the wheel */
+	uint16_t wheel_mode;	/* modes accounted in the list mode counts */
 };
 
 LIST_HEAD(timerlisthead, tcptimerentry);
 
+/*
+ * Timer entries are kept on a hierarchical timing wheel indexed by the
+ * tcp clock.  Level 0 has one slot per tick; each higher level has one
+ * slot per full revolution of the level below it.  Entries in higher
+ * levels are cascaded down only when the lower level wraps around, so
+ * arming, moving and removing an entry are all constant time and a run
+ * of the timer list touches only the entries that are due.
+ */
+#define	TCP_WHEEL_BITS		8
+#define	TCP_WHEEL_SIZE		(1 << TCP_WHEEL_BITS)
+#define	TCP_WHEEL_MASK		(TCP_WHEEL_SIZE - 1)
+#define	TCP_WHEEL_LEVELS	4
+#define	TCP_WHEEL_EXPIRED	0xffff	/* wheel_slot of an entry being run */
+
+#define	TCP_TIMERLIST_NMODES	3
+
 struct tcptimerlist {
-	struct timerlisthead lhead;	/* head of the list */
+	/* timing wheel, and the entries taken off it by the current run */
+	struct timerlisthead wheel[TCP_WHEEL_LEVELS][TCP_WHEEL_SIZE];
+	struct timerlisthead expired;
+	uint32_t wheel_time;	/* next tcp clock tick the wheel processes */
+	uint32_t level_entries[TCP_WHEEL_LEVELS]; /* entries on each level */
+	uint32_t mode_entries[TCP_TIMERLIST_NMODES]; /* entries per mode */
 	lck_mtx_t *mtx;		/* lock to protect the list */
 	lck_attr_t *mtx_attr;	/* mutex attributes */
 	lck_grp_t *mtx_grp;	/* mutex group definition */
@@ -261,7 +287,6 @@ struct tcptimerlist {
 	uint32_t pref_mode;	/* Preferred mode set by a connection */
 	uint32_t pref_offset;	/* Preferred offset set by a connection */
 	uint32_t idleruns;	/* Number of times the list has been idle in fast mode */
-	struct tcptimerentry *next_te;	/* next timer entry pointer to process */
 	u_int16_t probe_if_index; /* Interface index that needs to send probes */
 
 };
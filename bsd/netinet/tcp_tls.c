@@ -0,0 +1,718 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Kernel TLS record layer; see tcp_tls.h.
+ *
+ * A record is sealed as in RFC 5288 (TLS 1.2, explicit nonce equal to
+ * the sequence number) or RFC 8446 (TLS 1.3, no padding).  The record
+ * layer version is always 0x0303.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+#include <sys/sysctl.h>
+
+#include <libkern/crypto/aes.h>
+
+#include <netinet/in.h>
+#include <netinet/in_pcb.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_tls.h>
+
+#define	TLS_HDRLEN		5
+#define	TLS_NONCELEN		8	/* explicit nonce of TLS 1.2 */
+#define	TLS_TAGLEN		16
+#define	TLS_AADLEN		13
+#define	TLS_CTX_ALIGN		16
+/* plaintext, content type and padding (1.3) or expansion (1.2), tag */
+#define	TLS_MAX_CIPHERTEXT	(TLS_MAX_PLAINTEXT + 256)
+
+typedef aes_rval (*tcp_tls_crypt_t)(const unsigned char *, unsigned int,
+    unsigned char *, ccgcm_ctx *);
+
+struct tcp_tls_stat tcp_tls_stat;
+
+SYSCTL_STRUCT(_net_inet_tcp, OID_AUTO, tls_stat,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_tls_stat, tcp_tls_stat,
+    "Kernel TLS statistics");
+
+static int tcp_tls_alloc(const struct tcp_tls_crypto *, int,
+    struct tcp_tls **);
+static void tcp_tls_destroy(struct tcp_tls *);
+static int tcp_tls_seal(struct tcp_tls *, struct mbuf **, int, u_int8_t);
+static int tcp_tls_open(struct tcp_tls *, struct mbuf *, const u_int8_t *,
+    int, u_int8_t *);
+static int tcp_tls_rx_drain(struct socket *, struct tcp_tls *);
+
+static void
+tcp_tls_be64(u_int8_t *p, u_int64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (u_int8_t)(v >> (56 - 8 * i));
+}
+
+static void
+tcp_tls_nonce(struct tcp_tls *tt, u_int8_t *nonce)
+{
+	u_int8_t seq[8];
+	int i;
+
+	tcp_tls_be64(seq, tt->tt_seq);
+	bcopy(tt->tt_iv, nonce, TLS_IVLEN);
+	if (tt->tt_version == TLS_VERSION_1_2) {
+		/* salt, then the explicit nonce */
+		bcopy(seq, &nonce[TLS_IVLEN - 8], 8);
+	} else {
+		for (i = 0; i < 8; i++)
+			nonce[TLS_IVLEN - 8 + i] ^= seq[i];
+	}
+}
+
+/*
+ * The data can be transformed in place unless it shares a cluster with
+ * another mbuf, or lives in an external buffer that is not one of the
+ * mbuf allocator's own clusters; see m_mclwritable().
+ */
+static int
+tcp_tls_writable(struct mbuf *m)
+{
+	for (; m != NULL; m = m->m_next) {
+		if (!m_mclwritable(m))
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * Run len bytes of the chain from off through the GCM context in place;
+ * the mode keeps partial blocks itself, so mbufs of any length will do.
+ */
+static int
+tcp_tls_crypt(struct mbuf *m, int off, int len, tcp_tls_crypt_t crypt,
+    ccgcm_ctx *ctx)
+{
+	u_int8_t *p;
+	int n;
+
+	for (; m != NULL && len > 0; m = m->m_next) {
+		if (off >= m->m_len) {
+			off -= m->m_len;
+			continue;
+		}
+		n = MIN(m->m_len - off, len);
+		p = mtod(m, u_int8_t *) + off;
+		if (crypt(p, n, p, ctx) != aes_good)
+			return (EINVAL);
+		len -= n;
+		off = 0;
+	}
+	return (len == 0 ? 0 : EINVAL);
+}
+
+static int
+tcp_tls_append(struct mbuf *m, const u_int8_t *cp, int len)
+{
+	struct mbuf *n;
+
+	m = m_last(m);
+	if (M_TRAILINGSPACE(m) < len) {
+		if ((n = m_get(M_DONTWAIT, MT_DATA)) == NULL)
+			return (ENOBUFS);
+		m->m_next = n;
+		m = n;
+	}
+	bcopy(cp, mtod(m, u_int8_t *) + m->m_len, len);
+	m->m_len += len;
+	return (0);
+}
+
+static int
+tcp_tls_alloc(const struct tcp_tls_crypto *tc, int dir, struct tcp_tls **ttp)
+{
+	struct tcp_tls *tt;
+	unsigned int ctxlen;
+	aes_rval rc;
+	int keylen;
+
+	if (tc->tls_version != TLS_VERSION_1_2 &&
+	    tc->tls_version != TLS_VERSION_1_3)
+		return (EINVAL);
+	switch (tc->tls_cipher) {
+	case TLS_CIPHER_AES_128_GCM:
+		keylen = 16;
+		break;
+	case TLS_CIPHER_AES_256_GCM:
+		keylen = 32;
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	ctxlen = (dir == TCP_TLS_TX) ? aes_encrypt_get_ctx_size_gcm() :
+	    aes_decrypt_get_ctx_size_gcm();
+	if (ctxlen == 0)
+		return (EOPNOTSUPP);	/* no GCM from corecrypto */
+
+	tt = _MALLOC(sizeof (*tt) + ctxlen + TLS_CTX_ALIGN, M_TEMP,
+	    M_WAITOK | M_ZERO);
+	if (tt == NULL)
+		return (ENOMEM);
+	tt->tt_ctx = (void *)P2ROUNDUP((uintptr_t)tt->tt_ctxbuf, TLS_CTX_ALIGN);
+	tt->tt_ctxlen = ctxlen;
+	if (dir == TCP_TLS_TX)
+		rc = aes_encrypt_key_gcm(tc->tls_key, keylen, tt->tt_ctx);
+	else
+		rc = aes_decrypt_key_gcm(tc->tls_key, keylen, tt->tt_ctx);
+	if (rc != aes_good) {
+		tcp_tls_destroy(tt);
+		return (EINVAL);
+	}
+	tt->tt_version = tc->tls_version;
+	bcopy(tc->tls_iv, tt->tt_iv, TLS_IVLEN);
+	tt->tt_seq = tc->tls_seq;
+	*ttp = tt;
+	return (0);
+}
+
+static void
+tcp_tls_destroy(struct tcp_tls *tt)
+{
+	m_freem(tt->tt_rxq);
+	m_freem(tt->tt_rec);
+	/* the key schedule and IV */
+	bzero(tt->tt_ctx, tt->tt_ctxlen);
+	bzero(tt->tt_iv, TLS_IVLEN);
+	_FREE(tt, M_TEMP);
+}
+
+void
+tcp_tls_free(struct tcpcb *tp)
+{
+	if (tp->t_tls_tx != NULL) {
+		tcp_tls_destroy(tp->t_tls_tx);
+		tp->t_tls_tx = NULL;
+	}
+	if (tp->t_tls_rx != NULL) {
+		tcp_tls_destroy(tp->t_tls_rx);
+		tp->t_tls_rx = NULL;
+		tp->t_inpcb->inp_socket->so_flags1 &= ~SOF1_TLS_RX;
+	}
+}
+
+/*
+ * Seal the plen bytes of *mp into one record, in place, adding the
+ * header in front and the tag (TLS 1.3: content type, then tag) behind.
+ */
+static int
+tcp_tls_seal(struct tcp_tls *tt, struct mbuf **mp, int plen, u_int8_t type)
+{
+	u_int8_t nonce[TLS_IVLEN], aad[TLS_AADLEN];
+	u_int8_t hdr[TLS_HDRLEN + TLS_NONCELEN], trailer[1 + TLS_TAGLEN];
+	struct mbuf *m = *mp;
+	ccgcm_ctx *ctx = tt->tt_ctx;
+	int hlen, alen, tlen = 0, reclen, error;
+
+	tcp_tls_nonce(tt, nonce);
+	if (tt->tt_version == TLS_VERSION_1_2) {
+		hlen = TLS_HDRLEN + TLS_NONCELEN;
+		reclen = TLS_NONCELEN + plen + TLS_TAGLEN;
+		hdr[0] = type;
+		bcopy(&nonce[TLS_IVLEN - TLS_NONCELEN], &hdr[TLS_HDRLEN],
+		    TLS_NONCELEN);
+		/* seq_num, type, version, length */
+		tcp_tls_be64(aad, tt->tt_seq);
+		aad[8] = type;
+		aad[9] = aad[10] = 0x03;
+		aad[11] = (u_int8_t)(plen >> 8);
+		aad[12] = (u_int8_t)plen;
+		alen = TLS_AADLEN;
+	} else {
+		hlen = TLS_HDRLEN;
+		reclen = plen + 1 + TLS_TAGLEN;
+		hdr[0] = TLS_RT_APPLICATION_DATA;
+		alen = TLS_HDRLEN;
+	}
+	hdr[1] = hdr[2] = 0x03;
+	hdr[3] = (u_int8_t)(reclen >> 8);
+	hdr[4] = (u_int8_t)reclen;
+	if (tt->tt_version != TLS_VERSION_1_2)
+		bcopy(hdr, aad, TLS_HDRLEN);
+
+	if (aes_encrypt_set_iv_gcm(nonce, TLS_IVLEN, ctx) != aes_good ||
+	    aes_encrypt_aad_gcm(aad, alen, ctx) != aes_good ||
+	    tcp_tls_crypt(m, 0, plen, aes_encrypt_gcm, ctx) != 0)
+		return (EINVAL);
+	if (tt->tt_version != TLS_VERSION_1_2) {
+		trailer[tlen] = type;
+		if (aes_encrypt_gcm(&trailer[tlen], 1, &trailer[tlen],
+		    ctx) != aes_good)
+			return (EINVAL);
+		tlen++;
+	}
+	if (aes_encrypt_finalize_gcm(&trailer[tlen], TLS_TAGLEN,
+	    ctx) != aes_good)
+		return (EINVAL);
+	tlen += TLS_TAGLEN;
+
+	if ((error = tcp_tls_append(m, trailer, tlen)) != 0)
+		return (error);
+	M_PREPEND(m, hlen, M_DONTWAIT, 0);
+	*mp = m;
+	if (m == NULL)
+		return (ENOBUFS);
+	bcopy(hdr, mtod(m, u_int8_t *), hlen);
+	tt->tt_seq++;
+	return (0);
+}
+
+/*
+ * Turn the data of one pru_send into records.  On failure nothing is
+ * left to send, and the sequence numbers used are given back: no record
+ * sealed with them has left the host.
+ */
+int
+tcp_tls_output(struct tcpcb *tp, struct mbuf **mp, u_int8_t type)
+{
+	struct tcp_tls *tt = tp->t_tls_tx;
+	struct mbuf *m = *mp, *n, *top = NULL, **tail = &top;
+	u_int64_t seq = tt->tt_seq, nrec = 0, bytes = 0;
+	int len, plen, error = 0;
+
+	*mp = NULL;
+	if (m == NULL)
+		return (0);
+	if ((len = m_length(m)) == 0) {
+		m_freem(m);
+		return (0);
+	}
+	if (!tcp_tls_writable(m)) {
+		n = m_dup(m, M_DONTWAIT);
+		m_freem(m);
+		if ((m = n) == NULL) {
+			tcp_tls_stat.tts_nomem++;
+			return (ENOBUFS);
+		}
+	}
+
+	while (m != NULL) {
+		plen = MIN(len, TLS_MAX_PLAINTEXT);
+		n = NULL;
+		if (plen < len && (n = m_split(m, plen, M_DONTWAIT)) == NULL) {
+			error = ENOBUFS;
+			break;
+		}
+		if ((error = tcp_tls_seal(tt, &m, plen, type)) != 0) {
+			m_freem(n);
+			break;
+		}
+		*tail = m;
+		tail = &m_last(m)->m_next;
+		nrec++;
+		bytes += plen;
+		m = n;
+		len -= plen;
+	}
+	if (error != 0) {
+		m_freem(m);
+		m_freem(top);
+		tt->tt_seq = seq;
+		if (error == ENOBUFS)
+			tcp_tls_stat.tts_nomem++;
+		return (error);
+	}
+
+	if (top->m_flags & M_PKTHDR)
+		top->m_pkthdr.len = m_length(top);
+	tcp_tls_stat.tts_tx_records += nrec;
+	tcp_tls_stat.tts_tx_bytes += bytes;
+	*mp = top;
+	return (0);
+}
+
+/*
+ * Record type of a message, from its IPPROTO_TCP/TCP_TLS_TX control
+ * message.
+ */
+int
+tcp_tls_get_record_type(struct mbuf *control, u_int8_t *typep)
+{
+	struct cmsghdr *cm;
+
+	for (cm = M_FIRST_CMSGHDR(control); cm != NULL;
+	    cm = M_NXT_CMSGHDR(control, cm)) {
+		if (cm->cmsg_len < sizeof (struct cmsghdr) ||
+		    cm->cmsg_len > control->m_len)
+			return (EINVAL);
+		if (cm->cmsg_level != IPPROTO_TCP ||
+		    cm->cmsg_type != TCP_TLS_TX ||
+		    cm->cmsg_len != CMSG_LEN(sizeof (u_int8_t)))
+			return (EINVAL);
+		*typep = *(u_int8_t *)(void *)CMSG_DATA(cm);
+		if (*typep < TLS_RT_CHANGE_CIPHER_SPEC ||
+		    *typep > TLS_RT_APPLICATION_DATA)
+			return (EINVAL);
+	}
+	return (0);
+}
+
+/*
+ * Authenticate and decrypt a record in place, leaving only its
+ * plaintext in m.
+ */
+static int
+tcp_tls_open(struct tcp_tls *tt, struct mbuf *m, const u_int8_t *hdr,
+    int reclen, u_int8_t *typep)
+{
+	u_int8_t nonce[TLS_IVLEN], aad[TLS_AADLEN];
+	u_int8_t tag[TLS_TAGLEN], rtag[TLS_TAGLEN], diff, *p;
+	ccgcm_ctx *ctx = tt->tt_ctx;
+	int hlen, clen, alen, off, last, i;
+	struct mbuf *n;
+
+	if (tt->tt_version == TLS_VERSION_1_2) {
+		if (reclen < TLS_NONCELEN + TLS_TAGLEN)
+			return (EBADMSG);
+		hlen = TLS_HDRLEN + TLS_NONCELEN;
+		clen = reclen - TLS_NONCELEN - TLS_TAGLEN;
+		bcopy(tt->tt_iv, nonce, TLS_IVLEN - TLS_NONCELEN);
+		m_copydata(m, TLS_HDRLEN, TLS_NONCELEN,
+		    (caddr_t)&nonce[TLS_IVLEN - TLS_NONCELEN]);
+		tcp_tls_be64(aad, tt->tt_seq);
+		aad[8] = hdr[0];
+		aad[9] = hdr[1];
+		aad[10] = hdr[2];
+		aad[11] = (u_int8_t)(clen >> 8);
+		aad[12] = (u_int8_t)clen;
+		alen = TLS_AADLEN;
+	} else {
+		if (reclen < 1 + TLS_TAGLEN ||
+		    hdr[0] != TLS_RT_APPLICATION_DATA)
+			return (EBADMSG);
+		hlen = TLS_HDRLEN;
+		clen = reclen - TLS_TAGLEN;
+		tcp_tls_nonce(tt, nonce);
+		bcopy(hdr, aad, TLS_HDRLEN);
+		alen = TLS_HDRLEN;
+	}
+
+	if (aes_decrypt_set_iv_gcm(nonce, TLS_IVLEN, ctx) != aes_good ||
+	    aes_decrypt_aad_gcm(aad, alen, ctx) != aes_good ||
+	    tcp_tls_crypt(m, hlen, clen, aes_decrypt_gcm, ctx) != 0 ||
+	    aes_decrypt_finalize_gcm(tag, TLS_TAGLEN, ctx) != aes_good)
+		return (EBADMSG);
+	m_copydata(m, hlen + clen, TLS_TAGLEN, (caddr_t)rtag);
+	for (diff = 0, i = 0; i < TLS_TAGLEN; i++)
+		diff |= tag[i] ^ rtag[i];
+	if (diff != 0)
+		return (EBADMSG);
+
+	tt->tt_seq++;
+	m_adj(m, hlen);
+	m_adj(m, -TLS_TAGLEN);
+	if (tt->tt_version == TLS_VERSION_1_2) {
+		*typep = hdr[0];
+		return (0);
+	}
+
+	/* the content type is the last byte that is not zero padding */
+	last = -1;
+	for (off = 0, n = m; n != NULL; off += n->m_len, n = n->m_next) {
+		p = mtod(n, u_int8_t *);
+		for (i = n->m_len - 1; i >= 0 && p[i] == 0; i--)
+			;
+		if (i >= 0) {
+			last = off + i;
+			*typep = p[i];
+		}
+	}
+	if (last < 0)
+		return (EBADMSG);
+	m_adj(m, -(clen - last));
+	return (0);
+}
+
+/*
+ * Open every whole record queued, until one is not application data or
+ * fails.  Returns whether the reader should be woken up.
+ */
+static int
+tcp_tls_rx_drain(struct socket *so, struct tcp_tls *tt)
+{
+	u_int8_t hdr[TLS_HDRLEN], type;
+	struct mbuf *rec;
+	int reclen, wakeup = 0, error;
+
+	while (!(tt->tt_flags & (TLSF_PAUSED | TLSF_FAILED)) &&
+	    tt->tt_rxlen >= TLS_HDRLEN) {
+		m_copydata(tt->tt_rxq, 0, TLS_HDRLEN, (caddr_t)hdr);
+		reclen = (hdr[3] << 8) | hdr[4];
+		if (hdr[1] != 0x03 || reclen > TLS_MAX_CIPHERTEXT) {
+			error = EBADMSG;
+			goto fail;
+		}
+		if (tt->tt_rxlen < (u_int32_t)(TLS_HDRLEN + reclen))
+			break;
+
+		rec = tt->tt_rxq;
+		if (rec->m_flags & M_PKTHDR)
+			rec->m_pkthdr.len = tt->tt_rxlen;
+		if (tt->tt_rxlen == (u_int32_t)(TLS_HDRLEN + reclen)) {
+			tt->tt_rxq = tt->tt_rxtail = NULL;
+		} else {
+			tt->tt_rxq = m_split(rec, TLS_HDRLEN + reclen,
+			    M_DONTWAIT);
+			if (tt->tt_rxq == NULL) {
+				tt->tt_rxq = rec;
+				tcp_tls_stat.tts_nomem++;
+				error = ENOBUFS;
+				goto fail;
+			}
+			(void) m_length2(tt->tt_rxq, &tt->tt_rxtail);
+		}
+		tt->tt_rxlen -= TLS_HDRLEN + reclen;
+
+		if (tcp_tls_open(tt, rec, hdr, reclen, &type) != 0) {
+			m_freem(rec);
+			tcp_tls_stat.tts_rx_bad++;
+			error = EBADMSG;
+			goto fail;
+		}
+		tcp_tls_stat.tts_rx_records++;
+		if (type != TLS_RT_APPLICATION_DATA) {
+			/* hold it, and everything after it */
+			tcp_tls_stat.tts_rx_ctl++;
+			tt->tt_rec = rec;
+			tt->tt_rectype = type;
+			tt->tt_flags |= TLSF_PAUSED;
+			so->so_error = ENOMSG;
+			wakeup = 1;
+			break;
+		}
+		if ((reclen = m_length(rec)) == 0) {
+			m_freem(rec);
+			continue;
+		}
+		tcp_tls_stat.tts_rx_bytes += reclen;
+		if (sbappendstream(&so->so_rcv, rec))
+			wakeup = 1;
+	}
+	return (wakeup);
+
+fail:
+	/* the stream cannot be framed any more */
+	tt->tt_flags |= TLSF_FAILED;
+	m_freem(tt->tt_rxq);
+	tt->tt_rxq = tt->tt_rxtail = NULL;
+	tt->tt_rxlen = 0;
+	so->so_error = error;
+	return (1);
+}
+
+/*
+ * In-sequence data received, from sbappendstream_rcvdemux().
+ */
+int
+tcp_tls_input(struct socket *so, struct mbuf *m)
+{
+	struct tcp_tls *tt = sototcpcb(so)->t_tls_rx;
+	struct mbuf *n, *last;
+	u_int32_t len;
+
+	if (tt == NULL)
+		return (sbappendstream(&so->so_rcv, m));
+	if (tt->tt_flags & TLSF_FAILED) {
+		m_freem(m);
+		return (0);
+	}
+	if (!tcp_tls_writable(m)) {
+		/* e.g. the send buffer of a loopback peer */
+		n = m_dup(m, M_DONTWAIT);
+		m_freem(m);
+		if ((m = n) == NULL) {
+			tcp_tls_stat.tts_nomem++;
+			tt->tt_flags |= TLSF_FAILED;
+			so->so_error = ENOBUFS;
+			return (1);
+		}
+		tcp_tls_stat.tts_rx_copies++;
+	}
+
+	len = m_length2(m, &last);
+	if (tt->tt_rxq == NULL)
+		tt->tt_rxq = m;
+	else
+		tt->tt_rxtail->m_next = m;
+	tt->tt_rxtail = last;
+	tt->tt_rxlen += len;
+	return (tcp_tls_rx_drain(so, tt));
+}
+
+/* bytes received but not yet in the receive buffer, for tcp_sbspace() */
+int32_t
+tcp_tls_rx_pending(struct tcpcb *tp)
+{
+	return ((tp->t_tls_rx != NULL) ? (int32_t)tp->t_tls_rx->tt_rxlen : 0);
+}
+
+static void
+tcp_tls_rx_resume(struct socket *so, struct tcp_tls *tt)
+{
+	m_freem(tt->tt_rec);
+	tt->tt_rec = NULL;
+	tt->tt_rectype = 0;
+	tt->tt_flags &= ~TLSF_PAUSED;
+	if (so->so_error == ENOMSG)
+		so->so_error = 0;
+	if (tcp_tls_rx_drain(so, tt))
+		sorwakeup(so);
+}
+
+int
+tcp_tls_setopt(struct tcpcb *tp, struct sockopt *sopt)
+{
+	struct socket *so = tp->t_inpcb->inp_socket;
+	struct tcp_tls_crypto tc;
+	struct tcp_tls *tt, *ott;
+	struct mbuf *m = NULL;
+	int error;
+
+	if (sopt->sopt_name == TCP_TLS_RX_RECORD)
+		return (EINVAL);
+	if (so->so_flags & (SOF_MP_SUBFLOW | SOF_MPTCP_TRUE | SOF_ENABLE_MSGS))
+		return (EOPNOTSUPP);
+
+	ott = (sopt->sopt_name == TCP_TLS_TX) ? tp->t_tls_tx : tp->t_tls_rx;
+	if (ott != NULL && (ott->tt_flags & TLSF_FAILED))
+		return (EBADMSG);
+	if (sopt->sopt_name == TCP_TLS_RX && sopt->sopt_valsize == 0) {
+		/* resume with the current keys */
+		if (ott == NULL)
+			return (EINVAL);
+		tcp_tls_rx_resume(so, ott);
+		return (0);
+	}
+
+	if ((error = sooptcopyin(sopt, &tc, sizeof (tc), sizeof (tc))) != 0)
+		return (error);
+	error = tcp_tls_alloc(&tc, sopt->sopt_name, &tt);
+	bzero(&tc, sizeof (tc));
+	if (error != 0)
+		return (error);
+
+	if (sopt->sopt_name == TCP_TLS_TX) {
+		/* records from now on use the new keys */
+		if (ott != NULL)
+			tcp_tls_destroy(ott);
+		tp->t_tls_tx = tt;
+		return (0);
+	}
+
+	if (ott != NULL) {
+		/* the ciphertext queued so far is under the new keys */
+		tt->tt_rxq = ott->tt_rxq;
+		tt->tt_rxtail = ott->tt_rxtail;
+		tt->tt_rxlen = ott->tt_rxlen;
+		ott->tt_rxq = NULL;
+		tcp_tls_destroy(ott);
+		tp->t_tls_rx = tt;
+		tcp_tls_rx_resume(so, tt);
+		return (0);
+	}
+
+	/* the first records may have been received already */
+	if (so->so_rcv.sb_cc > 0) {
+		m = m_copym(so->so_rcv.sb_mb, 0, M_COPYALL, M_DONTWAIT);
+		if (m == NULL) {
+			tcp_tls_destroy(tt);
+			return (ENOBUFS);
+		}
+		sbdrop(&so->so_rcv, so->so_rcv.sb_cc);
+	}
+	tp->t_tls_rx = tt;
+	so->so_flags1 |= SOF1_TLS_RX;
+	if (m != NULL && tcp_tls_input(so, m))
+		sorwakeup(so);
+	return (0);
+}
+
+int
+tcp_tls_getopt(struct tcpcb *tp, struct sockopt *sopt)
+{
+	struct socket *so = tp->t_inpcb->inp_socket;
+	struct tcp_tls *tt = tp->t_tls_rx;
+	struct tcp_tls_record *tr;
+	size_t len;
+	int error, optval;
+
+	switch (sopt->sopt_name) {
+	case TCP_TLS_TX:
+		optval = (tp->t_tls_tx != NULL);
+		break;
+	case TCP_TLS_RX:
+		optval = (tt != NULL);
+		break;
+	case TCP_TLS_RX_RECORD:
+		if (tt == NULL || !(tt->tt_flags & TLSF_PAUSED) ||
+		    tt->tt_rectype == 0)
+			return (ENOMSG);
+		len = (tt->tt_rec != NULL) ? m_length(tt->tt_rec) : 0;
+		if (sopt->sopt_valsize < sizeof (*tr) + len)
+			return (EMSGSIZE);
+		tr = _MALLOC(sizeof (*tr) + len, M_TEMP, M_WAITOK);
+		if (tr == NULL)
+			return (ENOMEM);
+		tr->tls_type = tt->tt_rectype;
+		tr->tls_pad = 0;
+		tr->tls_len = (u_int16_t)len;
+		if (len > 0)
+			m_copydata(tt->tt_rec, 0, len, (caddr_t)tr->tls_data);
+		error = sooptcopyout(sopt, tr, sizeof (*tr) + len);
+		_FREE(tr, M_TEMP);
+		if (error == 0) {
+			m_freem(tt->tt_rec);
+			tt->tt_rec = NULL;
+			tt->tt_rectype = 0;
+			if (so->so_error == ENOMSG)
+				so->so_error = 0;
+		}
+		return (error);
+	default:
+		return (ENOPROTOOPT);
+	}
+	return (sooptcopyout(sopt, &optval, sizeof (optval)));
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Kernel TLS record layer on TCP sockets; see TCP_TLS_TX in tcp.h.
+ *
+ * Sending, each pru_send chain is cut into records of at most
+ * TLS_MAX_PLAINTEXT bytes, which are sealed in place and framed before
+ * they are appended to the send buffer.  The data comes from sosend()
+ * or sendfile(), which both copy it into mbufs of their own, so it is
+ * encrypted without another copy.
+ *
+ * Receiving, in-sequence data is queued until a whole record is there;
+ * the record is opened in place, and its plaintext appended to the
+ * receive buffer.  Data in clusters shared with someone else, such as
+ * the send buffer of a loopback peer, is copied first.
+ */
+
+#ifndef _NETINET_TCP_TLS_H_
+#define _NETINET_TCP_TLS_H_
+#include <sys/appleapiopts.h>
+
+#ifdef BSD_KERNEL_PRIVATE
+#include <netinet/tcp.h>
+
+struct tcp_tls_stat {
+	u_int64_t	tts_tx_records;		/* records sealed */
+	u_int64_t	tts_tx_bytes;		/* plaintext sealed */
+	u_int64_t	tts_rx_records;		/* records opened */
+	u_int64_t	tts_rx_bytes;		/* plaintext opened */
+	u_int64_t	tts_rx_copies;		/* shared data copied to open */
+	u_int64_t	tts_rx_ctl;		/* records not application data */
+	u_int64_t	tts_rx_bad;		/* records failing authentication */
+	u_int64_t	tts_nomem;		/* out of mbufs */
+};
+
+#define	TLSF_PAUSED	0x1	/* a record awaits TCP_TLS_RX_RECORD */
+#define	TLSF_FAILED	0x2	/* a record did not authenticate */
+
+struct tcp_tls {
+	u_int16_t	tt_version;
+	u_int16_t	tt_flags;
+	u_int8_t	tt_iv[TLS_IVLEN];
+	u_int64_t	tt_seq;		/* of the next record */
+	/* receive side */
+	struct mbuf	*tt_rxq;	/* ciphertext, not a whole record yet */
+	struct mbuf	*tt_rxtail;
+	u_int32_t	tt_rxlen;
+	u_int8_t	tt_rectype;	/* of tt_rec, 0 once fetched */
+	struct mbuf	*tt_rec;	/* plaintext of a non data record */
+	void		*tt_ctx;	/* ccgcm_ctx, in tt_ctxbuf */
+	u_int32_t	tt_ctxlen;
+	u_int8_t	tt_ctxbuf[0];
+};
+
+struct tcpcb;
+struct sockopt;
+
+extern struct tcp_tls_stat tcp_tls_stat;
+
+extern int tcp_tls_setopt(struct tcpcb *, struct sockopt *);
+extern int tcp_tls_getopt(struct tcpcb *, struct sockopt *);
+extern int tcp_tls_get_record_type(struct mbuf *, u_int8_t *);
+extern int tcp_tls_output(struct tcpcb *, struct mbuf **, u_int8_t);
+extern int tcp_tls_input(struct socket *, struct mbuf *);
+extern int32_t tcp_tls_rx_pending(struct tcpcb *);
+extern void tcp_tls_free(struct tcpcb *);
+#endif /* BSD_KERNEL_PRIVATE */
+
+#endif /* _NETINET_TCP_TLS_H_ */
@@ -100,6 +100,8 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
+#include <netinet/tcp_tls.h>
 #include <netinet/tcpip.h>
 #include <mach/sdt.h>
 #if TCPDEBUG
@@ -371,8 +373,10 @@ tcp_usr_listen(struct socket *so, struct proc *p)
 	COMMON_START();
 	if (inp->inp_lport == 0)
 		error = in_pcbbind(inp, NULL, p);
-	if (error == 0)
+	if (error == 0) {
 		tp->t_state = TCPS_LISTEN;
+		in_pcblbgroup_insert(inp);
+	}
 	COMMON_END(PRU_LISTEN);
 }
 
@@ -391,8 +395,10 @@ tcp6_usr_listen(struct socket *so, struct proc *p)
 			inp->inp_vflag |= INP_IPV4;
 		error = in6_pcbbind(inp, NULL, p);
 	}
-	if (error == 0)
+	if (error == 0) {
 		tp->t_state = TCPS_LISTEN;
+		in_pcblbgroup_insert(inp);
+	}
 	COMMON_END(PRU_LISTEN);
 }
 #endif /* INET6 */
@@ -993,6 +999,7 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 	struct inpcb *inp = sotoinpcb(so);
 	struct tcpcb *tp;
 	uint32_t msgpri = MSG_PRI_DEFAULT;
+	u_int8_t tlstype = TLS_RT_APPLICATION_DATA;
 #if INET6
 	int isipv6;
 #endif
@@ -1045,6 +1052,17 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 			}
 			m_freem(control);
 			control = NULL;
+		} else if (tp->t_tls_tx != NULL && control->m_len) {
+			/* TLS record type of the message */
+			error = tcp_tls_get_record_type(control, &tlstype);
+			m_freem(control);
+			control = NULL;
+			if (error) {
+				if (m != NULL)
+					m_freem(m);
+				m = NULL;
+				goto out;
+			}
 		} else if (control->m_len) {
 			/* 
 			 * if not unordered, TCP should not have 
@@ -1069,6 +1087,13 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 	VERIFY(!(so->so_flags & SOF_MP_SUBFLOW) ||
 	    (so->so_snd.sb_flags & SB_NOCOMPRESS));
 
+	/* Kernel TLS: send records sealed in place instead of the data */
+	if (tp->t_tls_tx != NULL && m != NULL) {
+		error = tcp_tls_output(tp, &m, tlstype);
+		if (error)
+			goto out;
+	}
+
 	if(!(flags & PRUS_OOB) || (so->so_flags1 & SOF1_PRECONNECT_DATA)) {
 		/* Call msg send if message delivery is enabled */
 		if (so->so_flags & SOF_ENABLE_MSGS)
@@ -2317,6 +2342,25 @@ tcp_ctloutput(so, sopt)
 				error = EINVAL;
 			}
 			break;
+		case TCP_CC_MODE:
+			error = sooptcopyin(sopt, &optval, sizeof optval,
+					    sizeof optval);
+			if (error)
+				break;
+			if (optval < CC_MODE_DEFAULT || optval > CC_MODE_BBR) {
+				error = EINVAL;
+				break;
+			}
+			tp->t_cc_mode = optval;
+			/* background sockets keep using background CC */
+			if (tp->tcp_cc_index != TCP_CC_ALGO_BACKGROUND_INDEX)
+				tcp_set_foreground_cc(so);
+			break;
+		case TCP_TLS_TX:
+		case TCP_TLS_RX:
+		case TCP_TLS_RX_RECORD:
+			error = tcp_tls_setopt(tp, sopt);
+			break;
 		case SO_FLUSH:
 			if ((error = sooptcopyin(sopt, &optval, sizeof (optval),
 			    sizeof (optval))) != 0)
@@ -2379,6 +2423,9 @@ tcp_ctloutput(so, sopt)
 			else
 				optval = ECN_MODE_DEFAULT;
 			break;
+		case TCP_CC_MODE:
+			optval = tp->t_cc_mode;
+			break;
 		case TCP_CONNECTIONTIMEOUT:
 			optval = tp->t_keepinit / TCP_RETRANSHZ;
 			break;
@@ -2472,6 +2519,11 @@ tcp_ctloutput(so, sopt)
 		case TCP_ADAPTIVE_WRITE_TIMEOUT:
 			optval = tp->t_adaptive_wtimo;
 			break;
+		case TCP_TLS_TX:
+		case TCP_TLS_RX:
+		case TCP_TLS_RX_RECORD:
+			error = tcp_tls_getopt(tp, sopt);
+			goto done;
 		case SO_TRAFFIC_MGT_BACKGROUND:
 			optval = (so->so_traffic_mgt_flags &
 			    TRAFFIC_MGT_SO_BACKGROUND) ? 1 : 0;
@@ -217,6 +217,8 @@ struct mpt_dsn_map {
 };
 #define tcp6cb		tcpcb  /* for KAME src sync over BSD*'s */
 
+#define	TCP_BBR_NSAMPLES	8	/* BBR delivery rate samples in flight */
+
 struct tcp_ccstate {
 	union {
 		struct tcp_cubic_state {
@@ -239,8 +241,44 @@ struct tcp_ccstate {
 #define cub_target_win __u__._cubic_state_.tc_target_win
 #define cub_avg_lastmax __u__._cubic_state_.tc_avg_lastmax
 #define cub_mean_dev __u__._cubic_state_.tc_mean_deviation
+		struct tcp_bbr_state {
+			u_int32_t tb_mode;	/* TCP_BBR_STARTUP, ... */
+			u_int32_t tb_flags;	/* TCP_BBRF_* */
+			/* delivery rate estimation */
+			u_int32_t tb_delivered;	/* bytes delivered so far */
+			u_int32_t tb_delivered_us; /* time of last delivery */
+			u_int32_t tb_first_sent_us; /* send time of last sample */
+			u_int32_t tb_app_limited; /* delivered at app limit end */
+			u_int32_t tb_sample_head; /* oldest send sample */
+			u_int32_t tb_nsamples;	/* send samples in the ring */
+			tcp_seq	tb_snd_max;	/* snd_max at last send */
+			struct tcp_bbr_sample {
+				tcp_seq	bs_end_seq;	/* snd_max after send */
+				u_int32_t bs_sent_us;	/* time of send */
+				u_int32_t bs_delivered;	/* delivered at send */
+				u_int32_t bs_delivered_us; /* delivery time then */
+				u_int32_t bs_first_sent_us; /* first send then */
+				u_int32_t bs_app_limited; /* sent app limited */
+			} tb_samples[TCP_BBR_NSAMPLES];
+			/* path model */
+			u_int64_t tb_bw[3];	/* windowed max of bw, bytes/s */
+			u_int32_t tb_bw_round[3]; /* round of each bw sample */
+			u_int32_t tb_round;	/* round trips counted */
+			u_int32_t tb_next_round_delivered;
+			u_int32_t tb_min_rtt_us; /* windowed min of rtt */
+			u_int32_t tb_min_rtt_stamp; /* tcp_now at min_rtt */
+			u_int32_t tb_probe_rtt_done; /* tcp_now to leave PROBE_RTT */
+			u_int32_t tb_cycle_index; /* PROBE_BW gain cycle phase */
+			u_int32_t tb_cycle_stamp_us; /* start of the phase */
+			u_int64_t tb_full_bw;	/* bw at last STARTUP growth */
+			u_int32_t tb_full_bw_count; /* rounds without growth */
+			u_int32_t tb_prior_cwnd; /* cwnd before recovery/PROBE_RTT */
+			u_int32_t tb_pacing_gain; /* in units of 1/256 */
+			u_int32_t tb_cwnd_gain;	/* in units of 1/256 */
+		} _bbr_state_;
 	} __u__;
 };
+#define	bbr_state __u__._bbr_state_
 
 /*
  * Tcp control block, one per tcp; fields:
@@ -514,6 +552,9 @@ struct tcpcb {
 	u_int32_t	t_pipeack;
 	u_int32_t	t_lossflightsize;
 
+	struct tcp_tls	*t_tls_tx;		/* kernel TLS, sending */
+	struct tcp_tls	*t_tls_rx;		/* kernel TLS, receiving */
+
 #if MPTCP
 	u_int32_t	t_mpflags;		/* flags for multipath TCP */
 
@@ -549,6 +590,11 @@ struct tcpcb {
 	u_int8_t		t_local_aid;	/* Addr Id for authentication */
 	u_int8_t		t_rem_aid;	/* Addr ID of another subflow */
 	u_int8_t		t_mprxtshift;	/* join retransmission */
+	/* last DSS mapping lookup in so_snd, see mptcp_output_getm_dsnmap64 */
+	struct mbuf		*t_mpdss_head;	/* sb_mb at the time */
+	u_int32_t		t_mpdss_hseq;	/* its mp_rseq */
+	struct mbuf		*t_mpdss_m;	/* mbuf found */
+	int			t_mpdss_off;	/* its offset from sb_mb */
 #endif /* MPTCP */
 
 #define	TFO_F_OFFER_COOKIE	0x01 /* We will offer a cookie */
@@ -606,6 +652,12 @@ struct tcpcb {
 	u_int32_t	t_reordered_pkts;	/* packets reorderd */
 	u_int32_t	t_dsack_sent;		/* Sent DSACK notification */
 	u_int32_t	t_dsack_recvd;		/* Received a valid DSACK option */
+
+	/* Pacing, driven by the congestion control algorithm */
+	u_int64_t	t_pacing_rate;		/* bytes per second, 0 if not paced */
+	u_int64_t	t_pacing_ts;		/* last credit update, in usec */
+	u_int32_t	t_pacing_credit;	/* bytes that can be sent now */
+	u_int8_t	t_cc_mode;		/* CC_MODE_* set by TCP_CC_MODE */
 };
 
 #define IN_FASTRECOVERY(tp)	(tp->t_flags & TF_FASTRECOVERY)
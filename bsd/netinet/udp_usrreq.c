@@ -1887,6 +1887,8 @@ udp_bind(struct socket *so, struct sockaddr *nam, struct proc *p)
 	if (inp == NULL)
 		return (EINVAL);
 	error = in_pcbbind(inp, nam, p);
+	if (error == 0)
+		in_pcblbgroup_insert(inp);
 	return (error);
 }
 
@@ -97,6 +97,8 @@ struct esptail {
 
 #ifdef BSD_KERNEL_PRIVATE
 struct secasvar;
+struct protosw;
+struct domain;
 
 struct esp_algorithm {
 	size_t padbound;	/* pad boundary, in byte */
@@ -128,12 +130,15 @@ extern int esp_max_ivlen(void);
 
 /* crypt routines */
 extern int esp4_output(struct mbuf *, struct secasvar *);
+extern int esp4_output_async(struct mbuf *, struct secasvar *,
+	void (*)(struct mbuf *, struct secasvar *, void *), void *);
 extern void esp4_input(struct mbuf *, int off);
 extern size_t esp_hdrsiz(struct ipsecrequest *);
 
 extern int esp_schedule(const struct esp_algorithm *, struct secasvar *);
 extern int esp_auth(struct mbuf *, size_t, size_t,
 	struct secasvar *, u_char *);
+extern void esp_init(struct protosw *, struct domain *);
 #endif /* BSD_KERNEL_PRIVATE */
 
 #endif /* _NETINET6_ESP_H_ */
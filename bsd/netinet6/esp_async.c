@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/sysctl.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/queue.h>
+#include <kern/locks.h>
+#include <kern/thread.h>
+#include <kern/zalloc.h>
+#include <machine/machine_routines.h>
+#include <libkern/OSAtomic.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet6/ipsec.h>
+#include <netinet6/esp.h>
+#include <netinet6/esp_async.h>
+#include <netkey/key.h>
+#include <netkey/keydb.h>
+
+#include <net/net_osdep.h>
+
+#define	ESP_ASYNC_MAXWORKERS	32
+#define	ESP_ASYNC_NSHADOW	4	/* cipher state copies per worker */
+#define	ESP_ASYNC_MAXIVLEN	16
+#define	ESP_ASYNC_IDLE		2	/* seconds before copies are let go */
+
+#define	ESP_ASYNC_JOB_ZONE_MAX	4096
+#define	ESP_ASYNC_JOB_ZONE_NAME	"esp_async_job"
+
+#define	EJF_RESERVED	0x1	/* holds a ticket */
+
+/*
+ * Per-SA reordering state, hanging off secasvar->async.  Tickets
+ * eo_head up to eo_next are in flight; a finished job parks in its
+ * ring slot until every job before it has been passed on.
+ */
+struct esp_async_order {
+	decl_lck_mtx_data(, eo_lock);
+	u_int32_t	eo_next;	/* next ticket to hand out */
+	u_int32_t	eo_head;	/* next ticket to pass on */
+	int		eo_draining;	/* someone is passing jobs on */
+	struct esp_async_job *eo_ring[ESP_ASYNC_WINDOW];
+};
+
+struct esp_async_shadow {
+	struct secasvar	*es_orig;	/* referenced, NULL if unused */
+	u_int64_t	es_used;
+	struct secasvar	es_sav;
+	u_int8_t	es_iv[ESP_ASYNC_MAXIVLEN];
+};
+
+struct esp_async_worker {
+	decl_lck_mtx_data(, ew_lock);
+	TAILQ_HEAD(, esp_async_job) ew_queue;
+	int		ew_sleeping;
+	thread_t	ew_thread;
+	/* only touched by the worker thread */
+	u_int64_t	ew_clock;
+	int		ew_nshadow;
+	struct esp_async_shadow ew_shadow[ESP_ASYNC_NSHADOW];
+};
+
+static struct esp_async_worker *esp_async_worker[ESP_ASYNC_MAXWORKERS];
+static int esp_async_maxworkers;
+static int esp_async_nworkers;		/* started, never goes down */
+static volatile int esp_async_workers;	/* in use */
+static volatile UInt32 esp_async_rr;
+
+static lck_grp_t *esp_async_grp;
+static lck_attr_t *esp_async_attr;
+decl_lck_mtx_data(static, esp_async_lock);
+static struct zone *esp_async_job_zone;
+
+struct esp_async_stat esp_async_stat;
+
+static int sysctl_esp_async_workers SYSCTL_HANDLER_ARGS;
+static int esp_async_start_worker(void);
+static void esp_async_worker_func(void *, wait_result_t);
+static void esp_async_run(struct esp_async_worker *, struct esp_async_job *);
+static struct secasvar *esp_async_shadow_get(struct esp_async_worker *,
+    struct secasvar *);
+static void esp_async_shadow_release(struct esp_async_worker *,
+    struct esp_async_shadow *);
+static void esp_async_complete(struct esp_async_job *);
+static void esp_async_finish(struct esp_async_job *);
+
+SYSCTL_DECL(_net_inet_ipsec);
+SYSCTL_PROC(_net_inet_ipsec, OID_AUTO, esp_async_workers,
+	CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, 0, 0,
+	sysctl_esp_async_workers, "I", "ESP crypto worker threads, 0 for inline");
+SYSCTL_STRUCT(_net_inet_ipsec, OID_AUTO, esp_async_stats,
+	CTLFLAG_RD | CTLFLAG_LOCKED, &esp_async_stat, esp_async_stat, "");
+
+void
+esp_async_init(void)
+{
+	static int esp_async_initialized = 0;
+	lck_grp_attr_t *grp_attr;
+
+	if (esp_async_initialized)
+		return;
+	esp_async_initialized = 1;
+
+	grp_attr = lck_grp_attr_alloc_init();
+	esp_async_grp = lck_grp_alloc_init("esp_async", grp_attr);
+	lck_grp_attr_free(grp_attr);
+	esp_async_attr = lck_attr_alloc_init();
+	lck_mtx_init(&esp_async_lock, esp_async_grp, esp_async_attr);
+
+	esp_async_job_zone = zinit(sizeof (struct esp_async_job),
+	    ESP_ASYNC_JOB_ZONE_MAX * sizeof (struct esp_async_job), 0,
+	    ESP_ASYNC_JOB_ZONE_NAME);
+	if (esp_async_job_zone == NULL) {
+		panic("%s: failed allocating %s", __func__,
+		    ESP_ASYNC_JOB_ZONE_NAME);
+		/* NOTREACHED */
+	}
+	zone_change(esp_async_job_zone, Z_EXPAND, TRUE);
+	zone_change(esp_async_job_zone, Z_CALLERACCT, FALSE);
+
+	esp_async_maxworkers = MIN(ml_get_max_cpus(), ESP_ASYNC_MAXWORKERS);
+}
+
+/*
+ * Workers are started on demand and stay around; lowering the count
+ * only stops new jobs from going to the extra ones.
+ */
+static int
+sysctl_esp_async_workers SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int error, val = esp_async_workers;
+
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == USER_ADDR_NULL)
+		return (error);
+	if (val < 0)
+		return (EINVAL);
+	if (val > esp_async_maxworkers)
+		val = esp_async_maxworkers;
+
+	lck_mtx_lock(&esp_async_lock);
+	while (esp_async_nworkers < val) {
+		if ((error = esp_async_start_worker()) != 0)
+			break;
+	}
+	esp_async_workers = MIN(val, esp_async_nworkers);
+	lck_mtx_unlock(&esp_async_lock);
+
+	return (error);
+}
+
+static int
+esp_async_start_worker(void)
+{
+	struct esp_async_worker *w;
+
+	lck_mtx_assert(&esp_async_lock, LCK_MTX_ASSERT_OWNED);
+
+	w = _MALLOC(sizeof (*w), M_SECA, M_WAITOK | M_ZERO);
+	if (w == NULL)
+		return (ENOMEM);
+	lck_mtx_init(&w->ew_lock, esp_async_grp, esp_async_attr);
+	TAILQ_INIT(&w->ew_queue);
+	if (kernel_thread_start((thread_continue_t)esp_async_worker_func, w,
+	    &w->ew_thread) != KERN_SUCCESS) {
+		lck_mtx_destroy(&w->ew_lock, esp_async_grp);
+		FREE(w, M_SECA);
+		return (ENOMEM);
+	}
+	/* for the extra refcnt from kernel_thread_start() */
+	thread_deallocate(w->ew_thread);
+
+	esp_async_worker[esp_async_nworkers] = w;
+	OSMemoryBarrier();
+	esp_async_nworkers++;
+	return (0);
+}
+
+int
+esp_async_enabled(void)
+{
+	return (esp_async_workers > 0);
+}
+
+struct esp_async_job *
+esp_async_job_alloc(void)
+{
+	struct esp_async_job *job;
+
+	job = zalloc_noblock(esp_async_job_zone);
+	if (job == NULL) {
+		OSIncrementAtomic64((volatile SInt64 *)&esp_async_stat.eas_nomem);
+		return (NULL);
+	}
+	bzero(job, sizeof (*job));
+	return (job);
+}
+
+/*
+ * Take the next ticket of the SA for the job, which must already hold
+ * its reference on the SA.  From here on the job must be either
+ * submitted or aborted, or the SA's later jobs will never be passed on.
+ */
+int
+esp_async_reserve(struct secasvar *sav, struct esp_async_job *job)
+{
+	struct esp_async_order *eo, *neo;
+
+	if ((eo = sav->async) == NULL) {
+		neo = _MALLOC(sizeof (*neo), M_SECA, M_NOWAIT | M_ZERO);
+		if (neo == NULL) {
+			OSIncrementAtomic64(
+			    (volatile SInt64 *)&esp_async_stat.eas_nomem);
+			return (ENOBUFS);
+		}
+		lck_mtx_init(&neo->eo_lock, esp_async_grp, esp_async_attr);
+		if (OSCompareAndSwapPtr(NULL, neo, (void * volatile *)&sav->async)) {
+			eo = neo;
+		} else {
+			esp_async_order_free(neo);
+			eo = sav->async;
+		}
+	}
+
+	lck_mtx_lock(&eo->eo_lock);
+	if (eo->eo_next - eo->eo_head >= ESP_ASYNC_WINDOW) {
+		lck_mtx_unlock(&eo->eo_lock);
+		OSIncrementAtomic64((volatile SInt64 *)&esp_async_stat.eas_window);
+		return (ENOBUFS);
+	}
+	job->ej_ticket = eo->eo_next++;
+	job->ej_flags |= EJF_RESERVED;
+	lck_mtx_unlock(&eo->eo_lock);
+
+	return (0);
+}
+
+void
+esp_async_submit(struct esp_async_job *job)
+{
+	struct esp_async_worker *w;
+	int n, wake;
+
+	VERIFY(job->ej_flags & EJF_RESERVED);
+
+	/* workers may have been turned off since the ticket was taken */
+	if ((n = esp_async_workers) == 0)
+		n = esp_async_nworkers;
+	w = esp_async_worker[(OSIncrementAtomic((volatile SInt32 *)&esp_async_rr) &
+	    0x7fffffff) % n];
+
+	lck_mtx_lock(&w->ew_lock);
+	TAILQ_INSERT_TAIL(&w->ew_queue, job, ej_link);
+	wake = w->ew_sleeping;
+	lck_mtx_unlock(&w->ew_lock);
+	if (wake)
+		wakeup_one((caddr_t)&w->ew_queue);
+
+	OSIncrementAtomic64((volatile SInt64 *)&esp_async_stat.eas_jobs);
+}
+
+/*
+ * Give up on a job that was not submitted; the caller has dealt with
+ * its mbuf.  Returns nonzero if the job held a ticket, in which case
+ * its completion routine still runs in turn, without a packet.
+ */
+int
+esp_async_abort(struct esp_async_job *job)
+{
+	job->ej_m = NULL;
+	if (job->ej_flags & EJF_RESERVED) {
+		esp_async_complete(job);
+		return (1);
+	}
+	if (job->ej_sav != NULL)
+		key_freesav(job->ej_sav, KEY_SADB_UNLOCKED);
+	zfree(esp_async_job_zone, job);
+	return (0);
+}
+
+/* called from key_delsav(), when the SA has no jobs left */
+void
+esp_async_order_free(struct esp_async_order *eo)
+{
+	VERIFY(eo->eo_next == eo->eo_head && !eo->eo_draining);
+	lck_mtx_destroy(&eo->eo_lock, esp_async_grp);
+	FREE(eo, M_SECA);
+}
+
+static void
+esp_async_worker_func(void *arg, wait_result_t wres)
+{
+#pragma unused(wres)
+	struct esp_async_worker *w = arg;
+	struct esp_async_job *job;
+	struct timespec ts;
+	int i, error;
+
+	lck_mtx_lock(&w->ew_lock);
+	for (;;) {
+		while ((job = TAILQ_FIRST(&w->ew_queue)) == NULL) {
+			ts.tv_sec = ESP_ASYNC_IDLE;
+			ts.tv_nsec = 0;
+			w->ew_sleeping = 1;
+			error = msleep(&w->ew_queue, &w->ew_lock, (PZERO - 1),
+			    "esp_async", w->ew_nshadow > 0 ? &ts : NULL);
+			w->ew_sleeping = 0;
+			if (error != EWOULDBLOCK || !TAILQ_EMPTY(&w->ew_queue))
+				continue;
+
+			/* idle for a while; don't keep SAs from going away */
+			lck_mtx_unlock(&w->ew_lock);
+			for (i = 0; i < ESP_ASYNC_NSHADOW; i++)
+				esp_async_shadow_release(w, &w->ew_shadow[i]);
+			lck_mtx_lock(&w->ew_lock);
+		}
+		TAILQ_REMOVE(&w->ew_queue, job, ej_link);
+		lck_mtx_unlock(&w->ew_lock);
+
+		esp_async_run(w, job);
+
+		lck_mtx_lock(&w->ew_lock);
+	}
+	/* NOTREACHED */
+}
+
+static void
+esp_async_run(struct esp_async_worker *w, struct esp_async_job *job)
+{
+	struct secasvar *csav;
+
+	if (job->ej_m != NULL) {
+		csav = esp_async_shadow_get(w, job->ej_sav);
+		if (csav == NULL) {
+			m_freem(job->ej_m);
+			job->ej_m = NULL;
+		} else if ((*job->ej_crypt)(job, csav) != 0) {
+			VERIFY(job->ej_m == NULL);
+		}
+		if (job->ej_m == NULL)
+			OSIncrementAtomic64(
+			    (volatile SInt64 *)&esp_async_stat.eas_crypt);
+	}
+	esp_async_complete(job);
+}
+
+/*
+ * Find or make this worker's copy of the SA's cipher state.  The copy
+ * shares everything with the SA but the key schedule and the IV, and
+ * holds a reference on the SA until it is let go.
+ */
+static struct secasvar *
+esp_async_shadow_get(struct esp_async_worker *w, struct secasvar *sav)
+{
+	struct esp_async_shadow *es, *victim = NULL;
+	const struct esp_algorithm *algo;
+	int i;
+
+	w->ew_clock++;
+	for (i = 0; i < ESP_ASYNC_NSHADOW; i++) {
+		es = &w->ew_shadow[i];
+		if (es->es_orig == sav) {
+			es->es_used = w->ew_clock;
+			return (&es->es_sav);
+		}
+		if (victim == NULL || es->es_used < victim->es_used)
+			victim = es;
+	}
+	es = victim;
+	esp_async_shadow_release(w, es);
+
+	if (sav->ivlen < 0 || sav->ivlen > ESP_ASYNC_MAXIVLEN)
+		return (NULL);
+	if ((algo = esp_algorithm_lookup(sav->alg_enc)) == NULL)
+		return (NULL);
+
+	bcopy(sav, &es->es_sav, sizeof (es->es_sav));
+	es->es_sav.sched = NULL;
+	es->es_sav.schedlen = 0;
+	es->es_sav.iv = (caddr_t)es->es_iv;
+	if (sav->ivlen > 0)
+		key_randomfill(es->es_iv, sav->ivlen);
+	if (esp_schedule(algo, &es->es_sav) != 0) {
+		bzero(&es->es_sav, sizeof (es->es_sav));
+		return (NULL);
+	}
+
+	KEY_SAV_ADDREF(sav);
+	es->es_orig = sav;
+	es->es_used = w->ew_clock;
+	w->ew_nshadow++;
+	OSIncrementAtomic64((volatile SInt64 *)&esp_async_stat.eas_shadow);
+
+	return (&es->es_sav);
+}
+
+static void
+esp_async_shadow_release(struct esp_async_worker *w,
+    struct esp_async_shadow *es)
+{
+	struct secasvar *sav;
+
+	if ((sav = es->es_orig) == NULL)
+		return;
+	if (es->es_sav.sched != NULL) {
+		bzero(es->es_sav.sched, es->es_sav.schedlen);
+		FREE(es->es_sav.sched, M_SECA);
+	}
+	bzero(&es->es_sav, sizeof (es->es_sav));
+	bzero(es->es_iv, sizeof (es->es_iv));
+	es->es_orig = NULL;
+	es->es_used = 0;
+	w->ew_nshadow--;
+	key_freesav(sav, KEY_SADB_UNLOCKED);
+}
+
+/*
+ * Park the job in its ring slot.  Unless another thread is already at
+ * it, pass on finished jobs from the head of the ring until reaching
+ * one that is still being worked on; whoever finishes that one takes
+ * over.
+ */
+static void
+esp_async_complete(struct esp_async_job *job)
+{
+	struct secasvar *sav = job->ej_sav;
+	struct esp_async_order *eo = sav->async;
+
+	lck_mtx_lock(&eo->eo_lock);
+	VERIFY(eo->eo_ring[job->ej_ticket % ESP_ASYNC_WINDOW] == NULL);
+	eo->eo_ring[job->ej_ticket % ESP_ASYNC_WINDOW] = job;
+	if (eo->eo_draining) {
+		lck_mtx_unlock(&eo->eo_lock);
+		return;
+	}
+	eo->eo_draining = 1;
+	/* the jobs' references may be the last ones */
+	KEY_SAV_ADDREF(sav);
+
+	while ((job = eo->eo_ring[eo->eo_head % ESP_ASYNC_WINDOW]) != NULL) {
+		eo->eo_ring[eo->eo_head % ESP_ASYNC_WINDOW] = NULL;
+		eo->eo_head++;
+		lck_mtx_unlock(&eo->eo_lock);
+
+		esp_async_finish(job);
+
+		lck_mtx_lock(&eo->eo_lock);
+	}
+	eo->eo_draining = 0;
+	lck_mtx_unlock(&eo->eo_lock);
+
+	key_freesav(sav, KEY_SADB_UNLOCKED);
+}
+
+static void
+esp_async_finish(struct esp_async_job *job)
+{
+	(*job->ej_done)(job);
+	key_freesav(job->ej_sav, KEY_SADB_UNLOCKED);
+	zfree(esp_async_job_zone, job);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Asynchronous ESP crypto.
+ *
+ * Packets of one SA are handed round-robin to a pool of crypto worker
+ * threads, so that a single busy tunnel is not limited to the crypto
+ * rate of the thread that sends or receives it.  Every job takes a
+ * ticket from its SA when it is queued; the workers finish jobs in any
+ * order, but the jobs are passed on (ip_output, or the rest of ESP
+ * input) strictly in ticket order.  On output the ticket is taken
+ * together with the ESP sequence number, so packets leave in sequence.
+ *
+ * Each worker keeps private copies of the cipher state (key schedule,
+ * IV) of the SAs it has recently served, since that state is not safe
+ * to share between concurrent encryptions.  Everything else, such as
+ * the replay window, lifetimes and statistics, is taken from the SA
+ * itself.
+ */
+
+#ifndef _NETINET6_ESP_ASYNC_H_
+#define _NETINET6_ESP_ASYNC_H_
+#include <sys/appleapiopts.h>
+
+#ifdef BSD_KERNEL_PRIVATE
+#include <sys/queue.h>
+#include <netinet6/ah.h>
+#include <netinet6/ipsec.h>
+
+/* most jobs of one SA in flight; more are dropped */
+#define	ESP_ASYNC_WINDOW	256
+
+struct esp_async_stat {
+	u_int64_t	eas_jobs;	/* jobs handed to the workers */
+	u_int64_t	eas_window;	/* dropped, too many in flight */
+	u_int64_t	eas_nomem;	/* dropped, no memory for the job */
+	u_int64_t	eas_crypt;	/* failed on the worker */
+	u_int64_t	eas_shadow;	/* cipher state copies made */
+};
+
+struct esp_output_args {
+	int		eo_af;
+	const struct esp_algorithm *eo_algo;
+	size_t		eo_espoff;	/* offset of the ESP header */
+	size_t		eo_cryptlen;	/* payload, padding and trailer */
+	size_t		eo_esphlen;	/* [UDP] ESP header and IV */
+	int		eo_ivlen;
+	struct udphdr	*eo_udp;	/* UDP encapsulation header or NULL */
+	ipsec_output_done_t eo_done;	/* where the packet goes afterwards */
+	void		*eo_done_arg;
+};
+
+#define	ESP_IN_AUTH	0x1	/* verify the HMAC */
+#define	ESP_IN_AEAD	0x2	/* ICV is checked by finalizedecrypt */
+#define	ESP_IN_REPLAY	0x4	/* update the replay window */
+
+struct esp_input_args {
+	int		ei_off;		/* offset of the ESP header */
+	int		ei_flags;
+	u_int32_t	ei_spi;
+	u_int32_t	ei_seq;
+	const struct esp_algorithm *ei_algo;
+	int		ei_ivlen;
+	size_t		ei_hlen;	/* IP header length */
+	size_t		ei_esplen;	/* ESP header length */
+	size_t		ei_icvlen;
+	u_char		ei_icv[AH_MAXSUMSIZE] __attribute__((aligned(4)));
+};
+
+struct esp_async_job {
+	TAILQ_ENTRY(esp_async_job) ej_link;
+	struct secasvar	*ej_sav;	/* referenced */
+	struct mbuf	*ej_m;		/* NULL once dropped */
+	u_int32_t	ej_ticket;
+	int		ej_flags;
+	/*
+	 * ej_crypt runs on a worker, with the worker's copy of the SA's
+	 * cipher state; on failure it frees ej_m and clears it.  ej_done
+	 * runs in ticket order and takes care of ej_m, which may be NULL.
+	 */
+	int		(*ej_crypt)(struct esp_async_job *, struct secasvar *);
+	void		(*ej_done)(struct esp_async_job *);
+	union {
+		struct esp_output_args	out;
+		struct esp_input_args	in;
+	} ej_args;
+};
+
+struct esp_async_order;
+
+extern struct esp_async_stat esp_async_stat;
+
+extern void esp_async_init(void);
+extern int esp_async_enabled(void);
+extern struct esp_async_job *esp_async_job_alloc(void);
+extern int esp_async_reserve(struct secasvar *, struct esp_async_job *);
+extern void esp_async_submit(struct esp_async_job *);
+extern int esp_async_abort(struct esp_async_job *);
+extern void esp_async_order_free(struct esp_async_order *);
+#endif /* BSD_KERNEL_PRIVATE */
+
+#endif /* _NETINET6_ESP_ASYNC_H_ */
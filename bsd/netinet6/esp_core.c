@@ -98,6 +98,7 @@
 #include <netinet6/esp6.h>
 #endif
 #include <netinet6/esp_rijndael.h>
+#include <netinet6/esp_async.h>
 #include <net/pfkeyv2.h>
 #include <netkey/keydb.h>
 #include <netkey/key.h>
@@ -228,6 +229,15 @@ esp_max_ivlen()
 	return ivlen;
 }
 
+void
+esp_init(struct protosw *pp, struct domain *dp)
+{
+#pragma unused(dp)
+	VERIFY((pp->pr_flags & (PR_INITIALIZED|PR_ATTACHED)) == PR_ATTACHED);
+
+	esp_async_init();
+}
+
 int
 esp_schedule(algo, sav)
 	const struct esp_algorithm *algo;
@@ -110,6 +110,7 @@
 #include <netinet6/ah6.h>
 #endif
 #include <netinet6/esp.h>
+#include <netinet6/esp_async.h>
 #if INET6
 #include <netinet6/esp6.h>
 #endif
@@ -173,139 +174,33 @@ esp6_input_strip_udp_encap (struct mbuf *m, int ip6hlen)
 	return ip6;
 }
 
-void
-esp4_input(m, off)
-	struct mbuf *m;
-	int off;
+/*
+ * Check the ICV and decrypt: the crypto part of esp4_input(), run
+ * either inline or by an async crypto worker.  sav supplies the cipher
+ * state, and is the worker's copy of the SA in the latter case.  On
+ * failure the packet is freed and *mp cleared.
+ */
+static int
+esp4_input_decrypt(struct mbuf **mp, struct secasvar *sav,
+    struct esp_input_args *args)
 {
-	struct ip *ip;
-#if INET6
-	struct ip6_hdr *ip6;
-#endif /* INET6 */
-	struct esp *esp;
+	struct mbuf *m = *mp;
+	struct ip *ip = mtod(m, struct ip *);
 	struct esptail esptail;
-	u_int32_t spi;
-	u_int32_t seq;
-	struct secasvar *sav = NULL;
-	size_t taillen;
-	u_int16_t nxt;
-	const struct esp_algorithm *algo;
-	int ivlen;
-	size_t hlen;
+	const struct esp_algorithm *algo = args->ei_algo;
+	u_int32_t spi = args->ei_spi;
+	int off = args->ei_off;
+	int ivlen = args->ei_ivlen;
 	size_t esplen;
-	sa_family_t	ifamily;
-
-	KERNEL_DEBUG(DBG_FNC_ESPIN | DBG_FUNC_START, 0,0,0,0,0);
-	/* sanity check for alignment. */
-	if (off % 4 != 0 || m->m_pkthdr.len % 4 != 0) {
-		ipseclog((LOG_ERR, "IPv4 ESP input: packet alignment problem "
-			"(off=%d, pktlen=%d)\n", off, m->m_pkthdr.len));
-		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
-		goto bad;
-	}
-
-	if (m->m_len < off + ESPMAXLEN) {
-		m = m_pullup(m, off + ESPMAXLEN);
-		if (!m) {
-			ipseclog((LOG_DEBUG,
-			    "IPv4 ESP input: can't pullup in esp4_input\n"));
-			IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
-			goto bad;
-		}
-	}
-
-	/* Expect 32-bit aligned data pointer on strict-align platforms */
-	MBUF_STRICT_DATA_ALIGNMENT_CHECK_32(m);
-
-	ip = mtod(m, struct ip *);
-	// expect udp-encap and esp packets only
-	if (ip->ip_p != IPPROTO_ESP &&
-	    !(ip->ip_p == IPPROTO_UDP && off >= sizeof(struct udphdr))) {
-		ipseclog((LOG_DEBUG,
-			  "IPv4 ESP input: invalid protocol type\n"));
-		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
-		goto bad;
-	}
-	esp = (struct esp *)(void *)(((u_int8_t *)ip) + off);
-#ifdef _IP_VHL
-	hlen = IP_VHL_HL(ip->ip_vhl) << 2;
-#else
-	hlen = ip->ip_hl << 2;
-#endif
-
-	/* find the sassoc. */
-	spi = esp->esp_spi;
-
-	if ((sav = key_allocsa(AF_INET,
-	                      (caddr_t)&ip->ip_src, (caddr_t)&ip->ip_dst,
-	                      IPPROTO_ESP, spi)) == 0) {
-		ipseclog((LOG_WARNING,
-		    "IPv4 ESP input: no key association found for spi %u\n",
-		    (u_int32_t)ntohl(spi)));
-		IPSEC_STAT_INCREMENT(ipsecstat.in_nosa);
-		goto bad;
-	}
-	KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
-	    printf("DP esp4_input called to allocate SA:0x%llx\n",
-	    (uint64_t)VM_KERNEL_ADDRPERM(sav)));
-	if (sav->state != SADB_SASTATE_MATURE
-	 && sav->state != SADB_SASTATE_DYING) {
-		ipseclog((LOG_DEBUG,
-		    "IPv4 ESP input: non-mature/dying SA found for spi %u\n",
-		    (u_int32_t)ntohl(spi)));
-		IPSEC_STAT_INCREMENT(ipsecstat.in_badspi);
-		goto bad;
-	}
-	algo = esp_algorithm_lookup(sav->alg_enc);
-	if (!algo) {
-		ipseclog((LOG_DEBUG, "IPv4 ESP input: "
-		    "unsupported encryption algorithm for spi %u\n",
-		    (u_int32_t)ntohl(spi)));
-		IPSEC_STAT_INCREMENT(ipsecstat.in_badspi);
-		goto bad;
-	}
-
-	/* check if we have proper ivlen information */
-	ivlen = sav->ivlen;
-	if (ivlen < 0) {
-		ipseclog((LOG_ERR, "inproper ivlen in IPv4 ESP input: %s %s\n",
-		    ipsec4_logpacketstr(ip, spi), ipsec_logsastr(sav)));
-		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
-		goto bad;
-	}
-
-	seq = ntohl(((struct newesp *)esp)->esp_seq);
-
-	/* Save ICV from packet for verification later */
 	size_t siz = 0;
-	unsigned char saved_icv[AH_MAXSUMSIZE];
-	if (algo->finalizedecrypt) {
-		siz = algo->icvlen;
-		m_copydata(m, m->m_pkthdr.len - siz, siz, (caddr_t) saved_icv);
+
+	if (args->ei_flags & ESP_IN_AEAD) {
+		siz = args->ei_icvlen;
 		goto delay_icv;
 	}
-
-	if (!((sav->flags & SADB_X_EXT_OLD) == 0 && sav->replay
-	 && (sav->alg_auth && sav->key_auth)))
-		goto noreplaycheck;
-
-	if (sav->alg_auth == SADB_X_AALG_NULL ||
-	    sav->alg_auth == SADB_AALG_NONE)
+	if ((args->ei_flags & ESP_IN_AUTH) == 0)
 		goto noreplaycheck;
 
-	/*
-	 * check for sequence number.
-	 */
-	if (ipsec_chkreplay(seq, sav))
-		; /*okey*/
-	else {
-		IPSEC_STAT_INCREMENT(ipsecstat.in_espreplay);
-		ipseclog((LOG_WARNING,
-		    "replay packet in IPv4 ESP input: %s %s\n",
-		    ipsec4_logpacketstr(ip, spi), ipsec_logsastr(sav)));
-		goto bad;
-	}
-
 	/* check ICV */
     {
 	u_char sum0[AH_MAXSUMSIZE] __attribute__((aligned(4)));
@@ -313,8 +208,10 @@ esp4_input(m, off)
 	const struct ah_algorithm *sumalgo;
 
 	sumalgo = ah_algorithm_lookup(sav->alg_auth);
-	if (!sumalgo)
+	if (!sumalgo) {
+		args->ei_flags &= ~ESP_IN_REPLAY;
 		goto noreplaycheck;
+	}
 	siz = (((*sumalgo->sumsiz)(sav) + 3) & ~(4 - 1));
 	if (m->m_pkthdr.len < off + ESPMAXLEN + siz) {
 		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
@@ -358,16 +255,6 @@ delay_icv:
 	IPSEC_STAT_INCREMENT(ipsecstat.in_espauthsucc);
     }
 
-	/*
-	 * update sequence number.
-	 */
-	if ((sav->flags & SADB_X_EXT_OLD) == 0 && sav->replay) {
-		if (ipsec_updatereplay(seq, sav)) {
-			IPSEC_STAT_INCREMENT(ipsecstat.in_espreplay);
-			goto bad;
-		}
-	}
-
 noreplaycheck:
 
 	/* process main esp header. */
@@ -381,6 +268,7 @@ noreplaycheck:
 		else
 			esplen = sizeof(struct newesp);
 	}
+	args->ei_esplen = esplen;
 
 	if (m->m_pkthdr.len < off + esplen + ivlen + sizeof(esptail)) {
 		ipseclog((LOG_WARNING,
@@ -436,7 +324,7 @@ noreplaycheck:
 		KERNEL_DEBUG(DBG_FNC_DECRYPT | DBG_FUNC_END, 1,0,0,0,0);
 		goto bad;
 	    }	  
-	    if (memcmp(saved_icv, tag, algo->icvlen)) {
+	    if (memcmp(args->ei_icv, tag, algo->icvlen)) {
 		ipseclog((LOG_ERR, "packet decryption ICV mismatch\n"));
 		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
 		KERNEL_DEBUG(DBG_FNC_DECRYPT | DBG_FUNC_END, 1,0,0,0,0);
@@ -444,6 +332,54 @@ noreplaycheck:
 	    }
 	}
 
+	*mp = m;
+	return (0);
+
+bad:
+	if (m)
+		m_freem(m);
+	*mp = NULL;
+	return (EINVAL);
+}
+
+/*
+ * The rest of esp4_input(), run in arrival order once the packet has
+ * been decrypted: advance the replay window, strip the trailer and
+ * pass the packet on.  Consumes the packet but not the reference on
+ * the SA.
+ */
+static void
+esp4_input_finish(struct mbuf *m, struct secasvar *sav,
+    struct esp_input_args *args)
+{
+	struct ip *ip;
+#if INET6
+	struct ip6_hdr *ip6;
+#endif /* INET6 */
+	struct esptail esptail;
+	u_int32_t spi = args->ei_spi;
+	u_int32_t seq = args->ei_seq;
+	size_t taillen;
+	u_int16_t nxt;
+	int off = args->ei_off;
+	int ivlen = args->ei_ivlen;
+	size_t hlen = args->ei_hlen;
+	size_t esplen = args->ei_esplen;
+	sa_family_t	ifamily;
+
+	/*
+	 * update sequence number, now that the packet is known to be
+	 * genuine.
+	 */
+	if (args->ei_flags & ESP_IN_REPLAY) {
+		if (ipsec_updatereplay(seq, sav)) {
+			IPSEC_STAT_INCREMENT(ipsecstat.in_espreplay);
+			goto bad;
+		}
+	}
+
+	ip = mtod(m, struct ip *);
+
 	/*
 	 * find the trailer of the ESP.
 	 */
@@ -495,7 +431,6 @@ noreplaycheck:
 			}
 		}
 		ip = esp4_input_strip_udp_encap(m, off);
-		esp = (struct esp *)(void *)(((u_int8_t *)ip) + off);
 	}
 
 	if (sav->utun_is_keepalive_fn) {
@@ -780,15 +715,202 @@ noreplaycheck:
 	}
 
 done:
-	if (sav) {
-		KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
-		    printf("DP esp4_input call free SA:0x%llx\n",
-		    (uint64_t)VM_KERNEL_ADDRPERM(sav)));
-		key_freesav(sav, KEY_SADB_UNLOCKED);
-	}
 	IPSEC_STAT_INCREMENT(ipsecstat.in_success);
 	return;
 
+bad:
+	if (m)
+		m_freem(m);
+	KERNEL_DEBUG(DBG_FNC_ESPIN | DBG_FUNC_END, 4,0,0,0,0);
+}
+
+static int
+esp4_input_crypt(struct esp_async_job *job, struct secasvar *cryptsav)
+{
+	return (esp4_input_decrypt(&job->ej_m, cryptsav, &job->ej_args.in));
+}
+
+static void
+esp4_input_done(struct esp_async_job *job)
+{
+	if (job->ej_m != NULL)
+		esp4_input_finish(job->ej_m, job->ej_sav, &job->ej_args.in);
+}
+
+void
+esp4_input(m, off)
+	struct mbuf *m;
+	int off;
+{
+	struct ip *ip;
+	struct esp *esp;
+	u_int32_t spi;
+	u_int32_t seq;
+	struct secasvar *sav = NULL;
+	const struct esp_algorithm *algo;
+	int ivlen;
+	size_t hlen;
+	struct esp_input_args args;
+
+	KERNEL_DEBUG(DBG_FNC_ESPIN | DBG_FUNC_START, 0,0,0,0,0);
+	/* sanity check for alignment. */
+	if (off % 4 != 0 || m->m_pkthdr.len % 4 != 0) {
+		ipseclog((LOG_ERR, "IPv4 ESP input: packet alignment problem "
+			"(off=%d, pktlen=%d)\n", off, m->m_pkthdr.len));
+		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
+		goto bad;
+	}
+
+	if (m->m_len < off + ESPMAXLEN) {
+		m = m_pullup(m, off + ESPMAXLEN);
+		if (!m) {
+			ipseclog((LOG_DEBUG,
+			    "IPv4 ESP input: can't pullup in esp4_input\n"));
+			IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
+			goto bad;
+		}
+	}
+
+	/* Expect 32-bit aligned data pointer on strict-align platforms */
+	MBUF_STRICT_DATA_ALIGNMENT_CHECK_32(m);
+
+	ip = mtod(m, struct ip *);
+	// expect udp-encap and esp packets only
+	if (ip->ip_p != IPPROTO_ESP &&
+	    !(ip->ip_p == IPPROTO_UDP && off >= sizeof(struct udphdr))) {
+		ipseclog((LOG_DEBUG,
+			  "IPv4 ESP input: invalid protocol type\n"));
+		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
+		goto bad;
+	}
+	esp = (struct esp *)(void *)(((u_int8_t *)ip) + off);
+#ifdef _IP_VHL
+	hlen = IP_VHL_HL(ip->ip_vhl) << 2;
+#else
+	hlen = ip->ip_hl << 2;
+#endif
+
+	/* find the sassoc. */
+	spi = esp->esp_spi;
+
+	if ((sav = key_allocsa(AF_INET,
+	                      (caddr_t)&ip->ip_src, (caddr_t)&ip->ip_dst,
+	                      IPPROTO_ESP, spi)) == 0) {
+		ipseclog((LOG_WARNING,
+		    "IPv4 ESP input: no key association found for spi %u\n",
+		    (u_int32_t)ntohl(spi)));
+		IPSEC_STAT_INCREMENT(ipsecstat.in_nosa);
+		goto bad;
+	}
+	KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
+	    printf("DP esp4_input called to allocate SA:0x%llx\n",
+	    (uint64_t)VM_KERNEL_ADDRPERM(sav)));
+	if (sav->state != SADB_SASTATE_MATURE
+	 && sav->state != SADB_SASTATE_DYING) {
+		ipseclog((LOG_DEBUG,
+		    "IPv4 ESP input: non-mature/dying SA found for spi %u\n",
+		    (u_int32_t)ntohl(spi)));
+		IPSEC_STAT_INCREMENT(ipsecstat.in_badspi);
+		goto bad;
+	}
+	algo = esp_algorithm_lookup(sav->alg_enc);
+	if (!algo) {
+		ipseclog((LOG_DEBUG, "IPv4 ESP input: "
+		    "unsupported encryption algorithm for spi %u\n",
+		    (u_int32_t)ntohl(spi)));
+		IPSEC_STAT_INCREMENT(ipsecstat.in_badspi);
+		goto bad;
+	}
+
+	/* check if we have proper ivlen information */
+	ivlen = sav->ivlen;
+	if (ivlen < 0) {
+		ipseclog((LOG_ERR, "inproper ivlen in IPv4 ESP input: %s %s\n",
+		    ipsec4_logpacketstr(ip, spi), ipsec_logsastr(sav)));
+		IPSEC_STAT_INCREMENT(ipsecstat.in_inval);
+		goto bad;
+	}
+
+	seq = ntohl(((struct newesp *)esp)->esp_seq);
+
+	bzero(&args, sizeof(args));
+	args.ei_off = off;
+	args.ei_spi = spi;
+	args.ei_seq = seq;
+	args.ei_algo = algo;
+	args.ei_ivlen = ivlen;
+	args.ei_hlen = hlen;
+
+	/* Save ICV from packet for verification later */
+	if (algo->finalizedecrypt) {
+		args.ei_icvlen = algo->icvlen;
+		m_copydata(m, m->m_pkthdr.len - args.ei_icvlen,
+		    args.ei_icvlen, (caddr_t)args.ei_icv);
+		args.ei_flags |= ESP_IN_AEAD;
+		if ((sav->flags & SADB_X_EXT_OLD) == 0 && sav->replay)
+			args.ei_flags |= ESP_IN_REPLAY;
+		goto noreplaycheck;
+	}
+
+	if (!((sav->flags & SADB_X_EXT_OLD) == 0 && sav->replay
+	 && (sav->alg_auth && sav->key_auth)))
+		goto noreplaycheck;
+
+	if (sav->alg_auth == SADB_X_AALG_NULL ||
+	    sav->alg_auth == SADB_AALG_NONE)
+		goto noreplaycheck;
+
+	/*
+	 * check for sequence number.
+	 */
+	if (ipsec_chkreplay(seq, sav))
+		; /*okey*/
+	else {
+		IPSEC_STAT_INCREMENT(ipsecstat.in_espreplay);
+		ipseclog((LOG_WARNING,
+		    "replay packet in IPv4 ESP input: %s %s\n",
+		    ipsec4_logpacketstr(ip, spi), ipsec_logsastr(sav)));
+		goto bad;
+	}
+	args.ei_flags |= ESP_IN_AUTH | ESP_IN_REPLAY;
+
+noreplaycheck:
+	/*
+	 * Leave the crypto to the async workers if they are about; the
+	 * job's ticket has the packet finished in arrival order.
+	 */
+	if (esp_async_enabled()) {
+		struct esp_async_job *job;
+
+		if ((job = esp_async_job_alloc()) == NULL) {
+			IPSEC_STAT_INCREMENT(ipsecstat.in_nomem);
+			goto bad;
+		}
+		job->ej_sav = sav;	/* takes our reference */
+		job->ej_crypt = esp4_input_crypt;
+		job->ej_done = esp4_input_done;
+		job->ej_args.in = args;
+		if (esp_async_reserve(sav, job) != 0) {
+			IPSEC_STAT_INCREMENT(ipsecstat.in_nomem);
+			(void) esp_async_abort(job);
+			sav = NULL;
+			goto bad;
+		}
+		job->ej_m = m;
+		esp_async_submit(job);
+		return;
+	}
+
+	if (esp4_input_decrypt(&m, sav, &args) != 0)
+		goto bad;
+	esp4_input_finish(m, sav, &args);
+
+	KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
+	    printf("DP esp4_input call free SA:0x%llx\n",
+	    (uint64_t)VM_KERNEL_ADDRPERM(sav)));
+	key_freesav(sav, KEY_SADB_UNLOCKED);
+	return;
+
 bad:
 	if (sav) {
 		KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
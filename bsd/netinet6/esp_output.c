@@ -101,6 +101,7 @@
 #include <netinet6/ah6.h>
 #endif
 #include <netinet6/esp.h>
+#include <netinet6/esp_async.h>
 #if INET6
 #include <netinet6/esp6.h>
 #endif
@@ -116,7 +117,11 @@
 #define DBG_FNC_ENCRYPT		NETDBG_CODE(DBG_NETIPSEC, (5 << 8))
 
 static int esp_output(struct mbuf *, u_char *, struct mbuf *,
-	int, struct secasvar *sav);
+	int, struct secasvar *sav, ipsec_output_done_t, void *);
+static int esp_output_encrypt(struct mbuf *, struct secasvar *,
+	struct secasvar *, struct esp_output_args *);
+static int esp_output_crypt(struct esp_async_job *, struct secasvar *);
+static void esp_output_done(struct esp_async_job *);
 
 extern int	esp_udp_encap_port;
 extern u_int32_t natt_now;
@@ -230,12 +235,14 @@ estimate:
  *	<-----------------> espoff
  */
 static int
-esp_output(m, nexthdrp, md, af, sav)
+esp_output(m, nexthdrp, md, af, sav, done, done_arg)
 	struct mbuf *m;
 	u_char *nexthdrp;
 	struct mbuf *md;
 	int af;
 	struct secasvar *sav;
+	ipsec_output_done_t done;
+	void *done_arg;
 {
 	struct mbuf *n;
 	struct mbuf *mprev;
@@ -253,6 +260,8 @@ esp_output(m, nexthdrp, md, af, sav)
 	int error = 0;
 	struct ipsecstat *stat;
 	struct udphdr *udp = NULL;
+	struct esp_async_job *job = NULL;
+	struct esp_output_args oargs, *args;
 	int	udp_encapsulate = (sav->flags & SADB_X_EXT_NATT && (af == AF_INET || af == AF_INET6) &&
 			(esp_udp_encap_port & 0xFFFF) != 0);
 
@@ -513,7 +522,32 @@ esp_output(m, nexthdrp, md, af, sav)
 				return EINVAL;
 			}
 		}
+		/*
+		 * With somewhere to send the packet afterwards, the crypto
+		 * is left to the async workers.  The job's ticket is taken
+		 * along with the sequence number, so that the packets go
+		 * out in sequence order.
+		 */
+		if (done != NULL && esp_async_enabled()) {
+			if ((job = esp_async_job_alloc()) == NULL) {
+				m_freem(m);
+				error = ENOBUFS;
+				goto fail;
+			}
+			KEY_SAV_ADDREF(sav);
+			job->ej_sav = sav;
+			job->ej_crypt = esp_output_crypt;
+			job->ej_done = esp_output_done;
+			job->ej_args.out.eo_done = done;
+			job->ej_args.out.eo_done_arg = done_arg;
+		}
 		lck_mtx_lock(sadb_mutex);
+		if (job != NULL && esp_async_reserve(sav, job) != 0) {
+			lck_mtx_unlock(sadb_mutex);
+			m_freem(m);
+			error = ENOBUFS;
+			goto fail;
+		}
 		sav->replay->count++;
 		lck_mtx_unlock(sadb_mutex);
 		/*
@@ -686,10 +720,68 @@ esp_output(m, nexthdrp, md, af, sav)
 	}
     }
 
+	args = (job != NULL) ? &job->ej_args.out : &oargs;
+	args->eo_af = af;
+	args->eo_algo = algo;
+	args->eo_espoff = espoff;
+	args->eo_cryptlen = plen + extendsiz;
+	args->eo_esphlen = esphlen;
+	args->eo_ivlen = ivlen;
+	args->eo_udp = udp_encapsulate ? udp : NULL;
+	if (job == NULL)
+		return (esp_output_encrypt(m, sav, sav, args));
+
+	/* the worker traces the end of it */
+	job->ej_m = m;
+	esp_async_submit(job);
+	return (EJUSTRETURN);
+
+fail:
+	/* once it holds a ticket, the job reports the drop in turn */
+	if (job != NULL && esp_async_abort(job))
+		error = EJUSTRETURN;
+	KERNEL_DEBUG(DBG_FNC_ESPOUT | DBG_FUNC_END, 7,error,0,0,0);
+	return error;
+}
+
+/*
+ * Encrypt the packet readied by esp_output() and append the ICV.
+ * cryptsav supplies the cipher state: the SA itself, or an async
+ * worker's copy of it.  The packet is freed on failure.
+ */
+static int
+esp_output_encrypt(m, sav, cryptsav, args)
+	struct mbuf *m;
+	struct secasvar *sav;
+	struct secasvar *cryptsav;
+	struct esp_output_args *args;
+{
+	const struct esp_algorithm *algo = args->eo_algo;
+	size_t espoff = args->eo_espoff;
+	struct udphdr *udp = args->eo_udp;
+	int af = args->eo_af;
+	int afnumber;
+	struct ipsecstat *stat;
+	struct mbuf *n;
+	int error = 0;
+
+	switch (af) {
+#if INET6
+	case AF_INET6:
+		afnumber = 6;
+		stat = &ipsec6stat;
+		break;
+#endif
+	default:
+		afnumber = 4;
+		stat = &ipsecstat;
+		break;
+	}
+
 	/*
 	 * pre-compute and cache intermediate key
 	 */
-	error = esp_schedule(algo, sav);
+	error = esp_schedule(algo, cryptsav);
 	if (error) {
 		m_freem(m);
 		IPSEC_STAT_INCREMENT(stat->out_inval);
@@ -703,7 +795,8 @@ esp_output(m, nexthdrp, md, af, sav)
 	if (!algo->encrypt)
 		panic("internal error: no encrypt function");
 	KERNEL_DEBUG(DBG_FNC_ENCRYPT | DBG_FUNC_START, 0,0,0,0,0);
-	if ((*algo->encrypt)(m, espoff, plen + extendsiz, sav, algo, ivlen)) {
+	if ((*algo->encrypt)(m, espoff, args->eo_cryptlen, cryptsav, algo,
+	    args->eo_ivlen)) {
 		/* m is already freed */
 		ipseclog((LOG_ERR, "packet encryption failure\n"));
 		IPSEC_STAT_INCREMENT(stat->out_inval);
@@ -721,8 +814,9 @@ esp_output(m, nexthdrp, md, af, sav)
 
         if (algo->finalizeencrypt) {
 		siz = algo->icvlen;
-		if ((*algo->finalizeencrypt)(sav, authbuf, siz)) {
+		if ((*algo->finalizeencrypt)(cryptsav, authbuf, siz)) {
 		        ipseclog((LOG_ERR, "packet encryption ICV failure\n"));
+			m_freem(m);
 			IPSEC_STAT_INCREMENT(stat->out_inval);
 			error = EINVAL;
 			KERNEL_DEBUG(DBG_FNC_ENCRYPT | DBG_FUNC_END, 1,error,0,0,0);
@@ -748,7 +842,8 @@ esp_output(m, nexthdrp, md, af, sav)
 		if (AH_MAXSUMSIZE < siz)
 			panic("assertion failed for AH_MAXSUMSIZE");
 	
-		if (esp_auth(m, espoff, m->m_pkthdr.len - espoff, sav, authbuf)) {
+		if (esp_auth(m, espoff, m->m_pkthdr.len - espoff, cryptsav,
+		    authbuf)) {
 			ipseclog((LOG_ERR, "ESP checksum generation failure\n"));
 			m_freem(m);
 			error = EINVAL;
@@ -815,7 +910,7 @@ esp_output(m, nexthdrp, md, af, sav)
 		}
     }
     
-	if (udp_encapsulate) {
+	if (udp != NULL) {
 		struct ip *ip;
 		struct ip6_hdr *ip6;
 
@@ -826,7 +921,8 @@ esp_output(m, nexthdrp, md, af, sav)
 		    break;
 		case AF_INET6:
 		    ip6 = mtod(m, struct ip6_hdr *);
-		    udp->uh_ulen = htons(plen + siz + extendsiz + esphlen);
+		    udp->uh_ulen = htons(args->eo_cryptlen + siz +
+			args->eo_esphlen);
 		    udp->uh_sum = in6_pseudo(&ip6->ip6_src, &ip6->ip6_dst, htonl(ntohs(udp->uh_ulen) + IPPROTO_UDP));
 		    m->m_pkthdr.csum_flags = CSUM_UDPIPV6;
 		    m->m_pkthdr.csum_data = offsetof(struct udphdr, uh_sum);
@@ -856,6 +952,26 @@ fail:
 #endif
 }
 
+static int
+esp_output_crypt(struct esp_async_job *job, struct secasvar *cryptsav)
+{
+	int error;
+
+	error = esp_output_encrypt(job->ej_m, job->ej_sav, cryptsav,
+	    &job->ej_args.out);
+	if (error != 0)
+		job->ej_m = NULL;
+	return (error);
+}
+
+static void
+esp_output_done(struct esp_async_job *job)
+{
+	struct esp_output_args *args = &job->ej_args.out;
+
+	(*args->eo_done)(job->ej_m, job->ej_sav, args->eo_done_arg);
+}
+
 #if INET
 int
 esp4_output(m, sav)
@@ -870,7 +986,31 @@ esp4_output(m, sav)
 	}
 	ip = mtod(m, struct ip *);
 	/* XXX assumes that m->m_next points to payload */
-	return esp_output(m, &ip->ip_p, m->m_next, AF_INET, sav);
+	return esp_output(m, &ip->ip_p, m->m_next, AF_INET, sav, NULL, NULL);
+}
+
+/*
+ * Like esp4_output(), but when the async crypto workers are in use the
+ * packet may be queued to them, in which case EJUSTRETURN is returned
+ * and the packet is later handed to done(), or NULL if it was dropped.
+ */
+int
+esp4_output_async(m, sav, done, done_arg)
+	struct mbuf *m;
+	struct secasvar *sav;
+	ipsec_output_done_t done;
+	void *done_arg;
+{
+	struct ip *ip;
+	if (m->m_len < sizeof(struct ip)) {
+		ipseclog((LOG_DEBUG, "esp4_output: first mbuf too short\n"));
+		m_freem(m);
+		return EINVAL;
+	}
+	ip = mtod(m, struct ip *);
+	/* XXX assumes that m->m_next points to payload */
+	return esp_output(m, &ip->ip_p, m->m_next, AF_INET, sav, done,
+	    done_arg);
 }
 #endif /*INET*/
 
@@ -887,6 +1027,6 @@ esp6_output(m, nexthdrp, md, sav)
 		m_freem(m);
 		return EINVAL;
 	}
-	return esp_output(m, nexthdrp, md, AF_INET6, sav);
+	return esp_output(m, nexthdrp, md, AF_INET6, sav, NULL, NULL);
 }
 #endif /*INET6*/
@@ -65,6 +65,7 @@
 #include <sys/syslog.h>
 #include <sys/mbuf.h>
 #include <sys/mcache.h>
+#include <sys/sysctl.h>
 
 #include <kern/locks.h>
 
@@ -95,6 +96,25 @@ typedef struct {
         ccgcm_ctx ctxt[0];
 } aes_gcm_ctx;
 
+typedef aes_rval (*esp_gcm_crypt_t)(const unsigned char *, unsigned int,
+    unsigned char *, ccgcm_ctx *);
+
+/* transform the payload where it sits when the mbufs allow it */
+static int esp_aes_inplace = 1;
+SYSCTL_DECL(_net_inet_ipsec);
+SYSCTL_INT(_net_inet_ipsec, OID_AUTO, esp_aes_inplace,
+	CTLFLAG_RW | CTLFLAG_LOCKED, &esp_aes_inplace, 0, "");
+
+static int esp_aes_writable(struct mbuf *, size_t);
+static struct mbuf *esp_aes_seek(struct mbuf *, size_t, int *);
+static void esp_aes_scatter(struct mbuf *, int, const u_int8_t *);
+static void esp_cbc_decrypt_aes_inplace(struct mbuf *, size_t, u_int8_t *,
+    aes_decrypt_ctx *);
+static void esp_cbc_encrypt_aes_inplace(struct mbuf *, size_t,
+    const u_int8_t *, aes_encrypt_ctx *);
+static int esp_gcm_crypt_aes_inplace(struct mbuf *, size_t, esp_gcm_crypt_t,
+    ccgcm_ctx *);
+
 int
 esp_aes_schedlen(
 	__unused const struct esp_algorithm *algo)
@@ -119,6 +139,175 @@ esp_aes_schedule(
 }
 
 
+/*
+ * The payload can be transformed in place only if none of the mbufs it
+ * lives in shares its cluster with another mbuf (a socket buffer, bpf,
+ * a retransmit copy) or has an external buffer owned by someone else;
+ * this is the same test ipsec_copypkt() uses to decide what to copy.
+ */
+static int
+esp_aes_writable(struct mbuf *m, size_t bodyoff)
+{
+	size_t soff = 0;
+
+	if (!esp_aes_inplace)
+		return (0);
+
+	for (; m != NULL; soff += m->m_len, m = m->m_next) {
+		if (soff + m->m_len <= bodyoff)
+			continue;
+		if ((m->m_flags & M_EXT) &&
+		    (m->m_ext.ext_free != NULL || m_mclhasreference(m)))
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * Return the mbuf holding byte bodyoff of the chain, and its offset in
+ * that mbuf in *snp; empty mbufs are skipped.
+ */
+static struct mbuf *
+esp_aes_seek(struct mbuf *m, size_t bodyoff, int *snp)
+{
+	size_t sn = bodyoff;
+
+	while (m != NULL && sn >= (size_t)m->m_len) {
+		sn -= m->m_len;
+		m = m->m_next;
+	}
+	*snp = (int)sn;
+	return (m);
+}
+
+/*
+ * Store one block that straddles mbufs back into the chain, starting
+ * at offset sn of s.  The inverse of m_copydata() for the one case the
+ * in-place paths need, without m_copyback()'s chain extension logic.
+ */
+static void
+esp_aes_scatter(struct mbuf *s, int sn, const u_int8_t *blk)
+{
+	int i, n;
+
+	for (i = 0; i < AES_BLOCKLEN; i += n) {
+		while (sn >= s->m_len) {
+			sn -= s->m_len;
+			s = s->m_next;
+		}
+		n = min(s->m_len - sn, AES_BLOCKLEN - i);
+		bcopy(blk + i, mtod(s, u_int8_t *) + sn, n);
+		sn += n;
+	}
+}
+
+/*
+ * In-place CBC: each run of whole blocks in an mbuf goes to the cipher
+ * in a single call, reading and writing the mbuf's own data, with the
+ * chaining value carried from one call to the next.  Only a block that
+ * spans mbufs is gathered into sbuf and scattered back.  The caller
+ * has checked that the payload is a multiple of the block size.
+ */
+static void
+esp_cbc_decrypt_aes_inplace(struct mbuf *m, size_t bodyoff, u_int8_t *iv,
+    aes_decrypt_ctx *ctx)
+{
+	u_int8_t sbuf[AES_BLOCKLEN] __attribute__((aligned(4)));
+	u_int8_t niv[AES_BLOCKLEN] __attribute__((aligned(4)));
+	struct mbuf *s;
+	u_int8_t *sp;
+	int sn, len;
+
+	s = esp_aes_seek(m, bodyoff, &sn);
+	while (s != NULL) {
+		len = s->m_len - sn;
+		if (len >= AES_BLOCKLEN) {
+			sp = mtod(s, u_int8_t *) + sn;
+			len -= len % AES_BLOCKLEN;
+			/* last ciphertext block chains into the next run */
+			bcopy(sp + len - AES_BLOCKLEN, niv, AES_BLOCKLEN);
+			aes_decrypt_cbc(sp, iv, len >> 4, sp, ctx);
+		} else {
+			len = AES_BLOCKLEN;
+			m_copydata(s, sn, AES_BLOCKLEN, (caddr_t)sbuf);
+			bcopy(sbuf, niv, AES_BLOCKLEN);
+			aes_decrypt_cbc(sbuf, iv, 1, sbuf, ctx);
+			esp_aes_scatter(s, sn, sbuf);
+		}
+		bcopy(niv, iv, AES_BLOCKLEN);
+
+		sn += len;
+		while (s != NULL && sn >= s->m_len) {
+			sn -= s->m_len;
+			s = s->m_next;
+		}
+	}
+
+	bzero(sbuf, sizeof (sbuf));
+	bzero(niv, sizeof (niv));
+}
+
+static void
+esp_cbc_encrypt_aes_inplace(struct mbuf *m, size_t bodyoff,
+    const u_int8_t *ivp, aes_encrypt_ctx *ctx)
+{
+	u_int8_t sbuf[AES_BLOCKLEN] __attribute__((aligned(4)));
+	u_int8_t iv[AES_BLOCKLEN] __attribute__((aligned(4)));
+	struct mbuf *s;
+	u_int8_t *sp;
+	int sn, len;
+
+	bcopy(ivp, iv, AES_BLOCKLEN);
+	s = esp_aes_seek(m, bodyoff, &sn);
+	while (s != NULL) {
+		len = s->m_len - sn;
+		if (len >= AES_BLOCKLEN) {
+			sp = mtod(s, u_int8_t *) + sn;
+			len -= len % AES_BLOCKLEN;
+			aes_encrypt_cbc(sp, iv, len >> 4, sp, ctx);
+			bcopy(sp + len - AES_BLOCKLEN, iv, AES_BLOCKLEN);
+		} else {
+			len = AES_BLOCKLEN;
+			m_copydata(s, sn, AES_BLOCKLEN, (caddr_t)sbuf);
+			aes_encrypt_cbc(sbuf, iv, 1, sbuf, ctx);
+			bcopy(sbuf, iv, AES_BLOCKLEN);
+			esp_aes_scatter(s, sn, sbuf);
+		}
+
+		sn += len;
+		while (s != NULL && sn >= s->m_len) {
+			sn -= s->m_len;
+			s = s->m_next;
+		}
+	}
+
+	bzero(sbuf, sizeof (sbuf));
+}
+
+/*
+ * In-place GCM.  The mode is a stream cipher plus GHASH and keeps any
+ * partial block in its context, so every mbuf's share of the payload
+ * is handed over as is, whatever its length.
+ */
+static int
+esp_gcm_crypt_aes_inplace(struct mbuf *m, size_t bodyoff,
+    esp_gcm_crypt_t crypt, ccgcm_ctx *ctx)
+{
+	struct mbuf *s;
+	u_int8_t *sp;
+	int sn;
+
+	for (s = esp_aes_seek(m, bodyoff, &sn); s != NULL;
+	    s = s->m_next, sn = 0) {
+		if (s->m_len == sn)
+			continue;
+		sp = mtod(s, u_int8_t *) + sn;
+		if (crypt(sp, s->m_len - sn, sp, ctx))
+			return (EINVAL);
+	}
+	return (0);
+}
+
 /* The following 2 functions decrypt or encrypt the contents of
  * the mbuf chain passed in keeping the IP and ESP header's in place,
  * along with the IV.
@@ -200,6 +389,13 @@ esp_cbc_decrypt_aes(m, off, sav, algo, ivlen)
 	/* grab iv */
 	m_copydata(m, ivoff, ivlen, (caddr_t) iv);
 
+	if (esp_aes_writable(m, bodyoff)) {
+		esp_cbc_decrypt_aes_inplace(m, bodyoff, iv,
+		    (aes_decrypt_ctx*)(&(((aes_ctx*)sav->sched)->decrypt)));
+		bzero(iv, sizeof(iv));
+		return 0;
+	}
+
 	s = m;
 	soff = sn = dn = 0;
 	d = d0 = dp = NULL;
@@ -395,6 +591,13 @@ esp_cbc_encrypt_aes(
 		return EINVAL;
 	}
 
+	if (esp_aes_writable(m, bodyoff)) {
+		esp_cbc_encrypt_aes_inplace(m, bodyoff, ivp,
+		    (aes_encrypt_ctx*)(&(((aes_ctx*)sav->sched)->encrypt)));
+		key_sa_stir_iv(sav);
+		return 0;
+	}
+
 	s = m;
 	soff = sn = dn = 0;
 	d = d0 = dp = NULL;
@@ -660,6 +863,17 @@ esp_gcm_encrypt_aes(
 		}
 	}
 
+	if (esp_aes_writable(m, bodyoff)) {
+		if (esp_gcm_crypt_aes_inplace(m, bodyoff, aes_encrypt_gcm,
+		    ctx->encrypt)) {
+		        ipseclog((LOG_ERR, "%s: failed to encrypt\n", __FUNCTION__));
+			m_freem(m);
+			return EINVAL;
+		}
+		key_sa_stir_iv(sav);
+		return 0;
+	}
+
 	s = m;
 	soff = sn = dn = 0;
 	d = d0 = dp = NULL;
@@ -688,7 +902,7 @@ esp_gcm_encrypt_aes(
 		len = s->m_len - sn;
 
 		/* destination */
-		if (!d || (dn + len > d->m_len)) {
+		if (!d || dn >= d->m_len) {
 			if (d)
 				dp = d;
 			MGET(d, M_DONTWAIT, MT_DATA);
@@ -859,6 +1073,17 @@ esp_gcm_decrypt_aes(m, off, sav, algo, ivlen)
 		}
 	}
 
+	if (esp_aes_writable(m, bodyoff)) {
+		bzero(iv, sizeof(iv));
+		if (esp_gcm_crypt_aes_inplace(m, bodyoff, aes_decrypt_gcm,
+		    ctx->decrypt)) {
+		        ipseclog((LOG_ERR, "%s: failed to decrypt\n", __FUNCTION__));
+			m_freem(m);
+			return EINVAL;
+		}
+		return 0;
+	}
+
 	s = m;
 	soff = sn = dn = 0;
 	d = d0 = dp = NULL;
@@ -887,7 +1112,7 @@ esp_gcm_decrypt_aes(m, off, sav, algo, ivlen)
 		len = s->m_len - sn;
 
 		/* destination */
-		if (!d || (dn + len > d->m_len)) {
+		if (!d || dn >= d->m_len) {
 			if (d)
 				dp = d;
 			MGET(d, M_DONTWAIT, MT_DATA);
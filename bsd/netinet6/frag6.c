@@ -91,46 +91,33 @@
  */
 #define IN6_IFSTAT_STRICT
 
-MBUFQ_HEAD(fq6_head);
-
 static void frag6_save_context(struct mbuf *, int);
 static void frag6_scrub_context(struct mbuf *);
 static int frag6_restore_context(struct mbuf *);
 
-static void frag6_icmp6_paramprob_error(struct fq6_head *);
-static void frag6_icmp6_timeex_error(struct fq6_head *);
-
-static void frag6_enq(struct ip6asfrag *, struct ip6asfrag *);
-static void frag6_deq(struct ip6asfrag *);
-static void frag6_insque(struct ip6q *, struct ip6q *);
-static void frag6_remque(struct ip6q *);
-static void frag6_freef(struct ip6q *, struct fq6_head *, struct fq6_head *);
+static void frag6_icmp6_paramprob_error(struct fragq_mbufs *);
+static void frag6_icmp6_timeex_error(struct fragq_mbufs *);
 
-static int frag6_timeout_run;		/* frag6 timer is scheduled to run */
-static void frag6_timeout(void *);
-static void frag6_sched_timeout(void);
+static void frag6_freef(struct fragq *, int, struct fragq_mbufs *,
+    struct fragq_mbufs *);
 
 static struct ip6q *ip6q_alloc(int);
 static void ip6q_free(struct ip6q *);
 static void ip6q_updateparams(void);
-static struct ip6asfrag *ip6af_alloc(int);
-static void ip6af_free(struct ip6asfrag *);
+static struct fragent *ip6af_alloc(int);
+static void ip6af_free(struct fragent *);
 
-decl_lck_mtx_data(static, ip6qlock);
-static lck_attr_t	*ip6qlock_attr;
-static lck_grp_t	*ip6qlock_grp;
-static lck_grp_attr_t	*ip6qlock_grp_attr;
+#define	IP6REASS_NHASH_LOG2	9
+#define	IP6REASS_NHASH		(1 << IP6REASS_NHASH_LOG2)
 
-/* IPv6 fragment reassembly queues (protected by ip6qlock) */
-static struct ip6q ip6q;		/* ip6 reassembly queues */
+/* IPv6 fragment reassembly queues (each bucket has its own lock) */
+static struct fragtbl ip6q_table;	/* ip6 reassembly queues */
 static int ip6_maxfragpackets;		/* max packets in reass queues */
-static u_int32_t frag6_nfragpackets;	/* # of packets in reass queues */
 static int ip6_maxfrags;		/* max fragments in reass queues */
-static u_int32_t frag6_nfrags;		/* # of fragments in reass queues */
 static u_int32_t ip6q_limit;		/* ip6q allocation limit */
 static u_int32_t ip6q_count;		/* current # of allocated ip6q's */
-static u_int32_t ip6af_limit;		/* ip6asfrag allocation limit */
-static u_int32_t ip6af_count;		/* current # of allocated ip6asfrag's */
+static u_int32_t ip6af_limit;		/* fragment allocation limit */
+static u_int32_t ip6af_count;		/* current # of allocated fragments */
 
 static int sysctl_maxfragpackets SYSCTL_HANDLER_ARGS;
 static int sysctl_maxfrags SYSCTL_HANDLER_ARGS;
@@ -143,7 +130,7 @@ SYSCTL_PROC(_net_inet6_ip6, IPV6CTL_MAXFRAGPACKETS, maxfragpackets,
     "Maximum number of IPv6 fragment reassembly queue entries");
 
 SYSCTL_UINT(_net_inet6_ip6, OID_AUTO, fragpackets,
-    CTLFLAG_RD | CTLFLAG_LOCKED, &frag6_nfragpackets, 0,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &ip6q_table.ft_nqueues, 0,
     "Current number of IPv6 fragment reassembly queue entries");
 
 SYSCTL_PROC(_net_inet6_ip6, IPV6CTL_MAXFRAGS, maxfrags,
@@ -158,24 +145,15 @@ frag6_init(void)
 {
 	/* ip6q_alloc() uses mbufs for IPv6 fragment queue structures */
 	_CASSERT(sizeof (struct ip6q) <= _MLEN);
-	/* ip6af_alloc() uses mbufs for IPv6 fragment queue structures */
-	_CASSERT(sizeof (struct ip6asfrag) <= _MLEN);
-
-	/* IPv6 fragment reassembly queue lock */
-	ip6qlock_grp_attr  = lck_grp_attr_alloc_init();
-	ip6qlock_grp = lck_grp_alloc_init("ip6qlock", ip6qlock_grp_attr);
-	ip6qlock_attr = lck_attr_alloc_init();
-	lck_mtx_init(&ip6qlock, ip6qlock_grp, ip6qlock_attr);
-
-	lck_mtx_lock(&ip6qlock);
-	/* Initialize IPv6 reassembly queue. */
-	ip6q.ip6q_next = ip6q.ip6q_prev = &ip6q;
 
 	/* same limits as IPv4 */
 	ip6_maxfragpackets = nmbclusters / 32;
 	ip6_maxfrags = ip6_maxfragpackets * 2;
+
+	/* Initialize IPv6 reassembly queues. */
+	fragtbl_init(&ip6q_table, "ip6q", IP6REASS_NHASH, &ip6_maxfragpackets,
+	    frag6_freef, frag6_icmp6_timeex_error);
 	ip6q_updateparams();
-	lck_mtx_unlock(&ip6qlock);
 }
 
 static void
@@ -198,14 +176,12 @@ frag6_restore_context(struct mbuf *m)
 
 /*
  * Send any deferred ICMP param problem error messages; caller must not be
- * holding ip6qlock and is expected to have saved the per-packet parameter
- * value via frag6_save_context().
+ * holding a reassembly bucket lock and is expected to have saved the
+ * per-packet parameter value via frag6_save_context().
  */
 static void
-frag6_icmp6_paramprob_error(struct fq6_head *diq6)
+frag6_icmp6_paramprob_error(struct fragq_mbufs *diq6)
 {
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_NOTOWNED);
-
 	if (!MBUFQ_EMPTY(diq6)) {
 		struct mbuf *merr, *merr_tmp;
 		int param;
@@ -222,13 +198,11 @@ frag6_icmp6_paramprob_error(struct fq6_head *diq6)
 
 /*
  * Send any deferred ICMP time exceeded error messages;
- * caller must not be holding ip6qlock.
+ * caller must not be holding a reassembly bucket lock.
  */
 static void
-frag6_icmp6_timeex_error(struct fq6_head *diq6)
+frag6_icmp6_timeex_error(struct fragq_mbufs *diq6)
 {
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_NOTOWNED);
-
 	if (!MBUFQ_EMPTY(diq6)) {
 		struct mbuf *m, *m_tmp;
 		MBUFQ_FOREACH_SAFE(m, diq6, m_tmp) {
@@ -280,14 +254,17 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	struct ip6_hdr *ip6;
 	struct ip6_frag *ip6f;
 	struct ip6q *q6;
-	struct ip6asfrag *af6, *ip6af, *af6dwn;
-	int offset = *offp, nxt, i, next;
+	struct fragq *fq;
+	struct fragtbl_bucket *fb = NULL;
+	struct fragent *fe, *tfe;
+	int offset = *offp, nxt, next;
 	int first_frag = 0;
 	int fragoff, frgpartlen;	/* must be larger than u_int16_t */
 	struct ifnet *dstifp = NULL;
 	u_int8_t ecn, ecn0;
 	uint32_t csum, csum_flags;
-	struct fq6_head diq6;
+	u_int32_t hash, key[9];
+	struct fragq_mbufs diq6;
 	int locked = 0;
 
 	VERIFY(m->m_flags & M_PKTHDR);
@@ -406,16 +383,27 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	ip6stat.ip6s_fragments++;
 	in6_ifstat_inc(dstifp, ifs6_reass_reqd);
 
-	lck_mtx_lock(&ip6qlock);
+	bcopy(&ip6->ip6_src, &key[0], sizeof (struct in6_addr));
+	bcopy(&ip6->ip6_dst, &key[4], sizeof (struct in6_addr));
+	key[8] = ip6f->ip6f_ident;
+	hash = fragtbl_hash(&ip6q_table, key, sizeof (key));
+	fb = fragtbl_lock(&ip6q_table, hash);
 	locked = 1;
 
-	for (q6 = ip6q.ip6q_next; q6 != &ip6q; q6 = q6->ip6q_next)
-		if (ip6f->ip6f_ident == q6->ip6q_ident &&
-		    IN6_ARE_ADDR_EQUAL(&ip6->ip6_src, &q6->ip6q_src) &&
-		    IN6_ARE_ADDR_EQUAL(&ip6->ip6_dst, &q6->ip6q_dst))
+	q6 = NULL;
+	TAILQ_FOREACH(fq, &fb->fb_head, fq_link) {
+		struct ip6q *q = (struct ip6q *)fq;
+
+		if (fq->fq_hash == hash &&
+		    ip6f->ip6f_ident == q->ip6q_ident &&
+		    IN6_ARE_ADDR_EQUAL(&ip6->ip6_src, &q->ip6q_src) &&
+		    IN6_ARE_ADDR_EQUAL(&ip6->ip6_dst, &q->ip6q_dst)) {
+			q6 = q;
 			break;
+		}
+	}
 
-	if (q6 == &ip6q) {
+	if (q6 == NULL) {
 		/*
 		 * the first fragment to arrive, create a reassembly queue.
 		 */
@@ -425,24 +413,20 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 		if (q6 == NULL)
 			goto dropfrag;
 
-		frag6_insque(q6, &ip6q);
-		frag6_nfragpackets++;
+		fragtbl_attach(&ip6q_table, fb, &q6->ip6q_fq, hash,
+		    IPV6_FRAGTTL);
 
 		/* ip6q_nxt will be filled afterwards, from 1st fragment */
-		q6->ip6q_down	= q6->ip6q_up = (struct ip6asfrag *)q6;
 #ifdef notyet
 		q6->ip6q_nxtp	= (u_char *)nxtp;
 #endif
 		q6->ip6q_ident	= ip6f->ip6f_ident;
-		q6->ip6q_ttl	= IPV6_FRAGTTL;
 		q6->ip6q_src	= ip6->ip6_src;
 		q6->ip6q_dst	= ip6->ip6_dst;
 		q6->ip6q_ecn	=
 		    (ntohl(ip6->ip6_flow) >> 20) & IPTOS_ECN_MASK;
 		q6->ip6q_unfrglen = -1;	/* The 1st fragment has not arrived. */
 
-		q6->ip6q_nfrag = 0;
-
 		/*
 		 * If the first fragment has valid checksum offload
 		 * info, the rest of fragments are eligible as well.
@@ -473,7 +457,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	if (q6->ip6q_unfrglen >= 0) {
 		/* The 1st fragment has already arrived. */
 		if (q6->ip6q_unfrglen + fragoff + frgpartlen > IPV6_MAXPACKET) {
-			lck_mtx_unlock(&ip6qlock);
+			fragtbl_unlock(fb);
 			locked = 0;
 			icmp6_error(m, ICMP6_PARAM_PROB, ICMP6_PARAMPROB_HEADER,
 			    offset - sizeof(struct ip6_frag) +
@@ -482,7 +466,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 			goto done;
 		}
 	} else if (fragoff + frgpartlen > IPV6_MAXPACKET) {
-		lck_mtx_unlock(&ip6qlock);
+		fragtbl_unlock(fb);
 		locked = 0;
 		icmp6_error(m, ICMP6_PARAM_PROB, ICMP6_PARAMPROB_HEADER,
 		    offset - sizeof(struct ip6_frag) +
@@ -495,19 +479,16 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	 * fragment already stored in the reassembly queue.
 	 */
 	if (fragoff == 0) {
-		for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
-		     af6 = af6dwn) {
-			af6dwn = af6->ip6af_down;
-
-			if (q6->ip6q_unfrglen + af6->ip6af_off + af6->ip6af_frglen >
+		FRAGQ_FOREACH_SAFE(fe, &q6->ip6q_fq, tfe) {
+			if (q6->ip6q_unfrglen + fe->fe_off + fe->fe_len >
 			    IPV6_MAXPACKET) {
-				struct mbuf *merr = IP6_REASS_MBUF(af6);
+				struct mbuf *merr = fe->fe_m;
 				struct ip6_hdr *ip6err;
-				int erroff = af6->ip6af_offset;
+				int erroff = fe->fe_hoff;
 
 				/* dequeue the fragment. */
-				frag6_deq(af6);
-				ip6af_free(af6);
+				fragq_remove(&ip6q_table, &q6->ip6q_fq, fe);
+				ip6af_free(fe);
 
 				/* adjust pointer. */
 				ip6err = mtod(merr, struct ip6_hdr *);
@@ -528,188 +509,97 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 		}
 	}
 
-	ip6af = ip6af_alloc(M_DONTWAIT);
-	if (ip6af == NULL)
+	fe = ip6af_alloc(M_DONTWAIT);
+	if (fe == NULL)
 		goto dropfrag;
 
-	ip6af->ip6af_mff = ip6f->ip6f_offlg & IP6F_MORE_FRAG;
-	ip6af->ip6af_off = fragoff;
-	ip6af->ip6af_frglen = frgpartlen;
-	ip6af->ip6af_offset = offset;
-	IP6_REASS_MBUF(ip6af) = m;
-
-	if (first_frag) {
-		af6 = (struct ip6asfrag *)q6;
-		goto insert;
-	}
+	fe->fe_m = m;
+	fe->fe_off = fragoff;
+	fe->fe_len = frgpartlen;
+	fe->fe_hoff = offset;
+	if (ip6f->ip6f_offlg & IP6F_MORE_FRAG)
+		fe->fe_flags |= FE_MORE;
 
-	/*
-	 * Handle ECN by comparing this segment with the first one;
-	 * if CE is set, do not lose CE.
-	 * drop if CE and not-ECT are mixed for the same packet.
-	 */
-	ecn = (ntohl(ip6->ip6_flow) >> 20) & IPTOS_ECN_MASK;
-	ecn0 = q6->ip6q_ecn;
-	if (ecn == IPTOS_ECN_CE) {
-		if (ecn0 == IPTOS_ECN_NOTECT) {
-			ip6af_free(ip6af);
+	if (!first_frag) {
+		/*
+		 * Handle ECN by comparing this segment with the first one;
+		 * if CE is set, do not lose CE.
+		 * drop if CE and not-ECT are mixed for the same packet.
+		 */
+		ecn = (ntohl(ip6->ip6_flow) >> 20) & IPTOS_ECN_MASK;
+		ecn0 = q6->ip6q_ecn;
+		if (ecn == IPTOS_ECN_CE) {
+			if (ecn0 == IPTOS_ECN_NOTECT) {
+				ip6af_free(fe);
+				goto dropfrag;
+			}
+			if (ecn0 != IPTOS_ECN_CE)
+				q6->ip6q_ecn = IPTOS_ECN_CE;
+		}
+		if (ecn == IPTOS_ECN_NOTECT && ecn0 != IPTOS_ECN_NOTECT) {
+			ip6af_free(fe);
 			goto dropfrag;
 		}
-		if (ecn0 != IPTOS_ECN_CE)
-			q6->ip6q_ecn = IPTOS_ECN_CE;
-	}
-	if (ecn == IPTOS_ECN_NOTECT && ecn0 != IPTOS_ECN_NOTECT) {
-		ip6af_free(ip6af);
-		goto dropfrag;
 	}
 
 	/*
-	 * Find a segment which begins after this one does.
-	 */
-	for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
-	     af6 = af6->ip6af_down)
-		if (af6->ip6af_off > ip6af->ip6af_off)
-			break;
-
-#if 0
-	/*
-	 * If there is a preceding segment, it may provide some of
-	 * our data already.  If so, drop the data from the incoming
-	 * segment.  If it provides all of our data, drop us.
+	 * Stick new segment in its place.
 	 *
-	 * If some of the data is dropped from the preceding
-	 * segment, then it's checksum is invalidated.
-	 */
-	if (af6->ip6af_up != (struct ip6asfrag *)q6) {
-		i = af6->ip6af_up->ip6af_off + af6->ip6af_up->ip6af_frglen
-			- ip6af->ip6af_off;
-		if (i > 0) {
-			if (i >= ip6af->ip6af_frglen)
-				goto dropfrag;
-			m_adj(IP6_REASS_MBUF(ip6af), i);
-			q6->ip6q_csum_flags = 0;
-			ip6af->ip6af_off += i;
-			ip6af->ip6af_frglen -= i;
-		}
-	}
-
-	/*
-	 * While we overlap succeeding segments trim them or,
-	 * if they are completely covered, dequeue them.
-	 */
-	while (af6 != (struct ip6asfrag *)q6 &&
-	       ip6af->ip6af_off + ip6af->ip6af_frglen > af6->ip6af_off) {
-		i = (ip6af->ip6af_off + ip6af->ip6af_frglen) - af6->ip6af_off;
-		if (i < af6->ip6af_frglen) {
-			af6->ip6af_frglen -= i;
-			af6->ip6af_off += i;
-			m_adj(IP6_REASS_MBUF(af6), i);
-			q6->ip6q_csum_flags = 0;
-			break;
-		}
-		af6 = af6->ip6af_down;
-		m_freem(IP6_REASS_MBUF(af6->ip6af_up));
-		frag6_deq(af6->ip6af_up);
-	}
-#else
-	/*
-	 * If the incoming framgent overlaps some existing fragments in
+	 * If the incoming fragment overlaps some existing fragments in
 	 * the reassembly queue, drop it, since it is dangerous to override
 	 * existing fragments from a security point of view.
 	 * We don't know which fragment is the bad guy - here we trust
 	 * fragment that came in earlier, with no real reason.
-	 *
-	 * Note: due to changes after disabling this part, mbuf passed to
-	 * m_adj() below now does not meet the requirement.
 	 */
-	if (af6->ip6af_up != (struct ip6asfrag *)q6) {
-		i = af6->ip6af_up->ip6af_off + af6->ip6af_up->ip6af_frglen
-			- ip6af->ip6af_off;
-		if (i > 0) {
-#if 0				/* suppress the noisy log */
-			log(LOG_ERR, "%d bytes of a fragment from %s "
-			    "overlaps the previous fragment\n",
-			    i, ip6_sprintf(&q6->ip6q_src));
-#endif
-			ip6af_free(ip6af);
-			goto dropfrag;
-		}
-	}
-	if (af6 != (struct ip6asfrag *)q6) {
-		i = (ip6af->ip6af_off + ip6af->ip6af_frglen) - af6->ip6af_off;
-		if (i > 0) {
-#if 0				/* suppress the noisy log */
-			log(LOG_ERR, "%d bytes of a fragment from %s "
-			    "overlaps the succeeding fragment",
-			    i, ip6_sprintf(&q6->ip6q_src));
-#endif
-			ip6af_free(ip6af);
-			goto dropfrag;
-		}
+	if (!(fragq_insert(&ip6q_table, &q6->ip6q_fq, fe, 0, NULL) &
+	    FRAGQ_INSERTED)) {
+		ip6af_free(fe);
+		goto dropfrag;
 	}
-#endif
 
 	/*
 	 * If this fragment contains similar checksum offload info
 	 * as that of the existing ones, accumulate checksum.  Otherwise,
 	 * invalidate checksum offload info for the entire datagram.
 	 */
-	if (csum_flags != 0 && csum_flags == q6->ip6q_csum_flags)
-		q6->ip6q_csum += csum;
-	else if (q6->ip6q_csum_flags != 0)
-		q6->ip6q_csum_flags = 0;
-
-insert:
+	if (!first_frag) {
+		if (csum_flags != 0 && csum_flags == q6->ip6q_csum_flags)
+			q6->ip6q_csum += csum;
+		else if (q6->ip6q_csum_flags != 0)
+			q6->ip6q_csum_flags = 0;
+	}
 
 	/*
-	 * Stick new segment in its place;
-	 * check for complete reassembly.
-	 * Move to front of packet queue, as we are
-	 * the most recently active fragmented packet.
+	 * Check for complete reassembly.
 	 */
-	frag6_enq(ip6af, af6->ip6af_up);
-	frag6_nfrags++;
-	q6->ip6q_nfrag++;
-#if 0 /* xxx */
-	if (q6 != ip6q.ip6q_next) {
-		frag6_remque(q6);
-		frag6_insque(q6, &ip6q);
-	}
-#endif
-	next = 0;
-	for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
-	     af6 = af6->ip6af_down) {
-		if (af6->ip6af_off != next) {
-			lck_mtx_unlock(&ip6qlock);
-			locked = 0;
-			m = NULL;
-			goto done;
-		}
-		next += af6->ip6af_frglen;
-	}
-	if (af6->ip6af_up->ip6af_mff) {
-		lck_mtx_unlock(&ip6qlock);
+	if (!FRAGQ_COMPLETE(&q6->ip6q_fq)) {
+		fragtbl_unlock(fb);
 		locked = 0;
 		m = NULL;
 		goto done;
 	}
+	next = q6->ip6q_fq.fq_len;
 
 	/*
 	 * Reassembly is complete; concatenate fragments.
 	 */
-	ip6af = q6->ip6q_down;
-	t = m = IP6_REASS_MBUF(ip6af);
-	af6 = ip6af->ip6af_down;
-	frag6_deq(ip6af);
-	while (af6 != (struct ip6asfrag *)q6) {
-		af6dwn = af6->ip6af_down;
-		frag6_deq(af6);
-		while (t->m_next)
-			t = t->m_next;
-		t->m_next = IP6_REASS_MBUF(af6);
-		m_adj(t->m_next, af6->ip6af_offset);
-		ip6af_free(af6);
-		af6 = af6dwn;
+	m = t = NULL;
+	FRAGQ_FOREACH_SAFE(fe, &q6->ip6q_fq, tfe) {
+		fragq_remove(&ip6q_table, &q6->ip6q_fq, fe);
+		if (m == NULL) {
+			t = m = fe->fe_m;
+			/*
+			 * adjust offset to point where the original next
+			 * header starts
+			 */
+			offset = fe->fe_hoff - sizeof(struct ip6_frag);
+		} else {
+			while (t->m_next)
+				t = t->m_next;
+			t->m_next = fe->fe_m;
+			m_adj(t->m_next, fe->fe_hoff);
+		}
+		ip6af_free(fe);
 	}
 
 	/*
@@ -733,9 +623,6 @@ insert:
 		m->m_pkthdr.csum_flags = CSUM_DATA_VALID | CSUM_PSEUDO_HDR;
 	}
 
-	/* adjust offset to point where the original next header starts */
-	offset = ip6af->ip6af_offset - sizeof(struct ip6_frag);
-	ip6af_free(ip6af);
 	ip6 = mtod(m, struct ip6_hdr *);
 	ip6->ip6_plen = htons((u_short)next + offset - sizeof(struct ip6_hdr));
 	ip6->ip6_src = q6->ip6q_src;
@@ -758,9 +645,7 @@ insert:
 	} else {
 		/* this comes with no copy if the boundary is on cluster */
 		if ((t = m_split(m, offset, M_DONTWAIT)) == NULL) {
-			frag6_remque(q6);
-			frag6_nfragpackets--;
-			frag6_nfrags -= q6->ip6q_nfrag;
+			fragtbl_detach(&ip6q_table, fb, &q6->ip6q_fq);
 			ip6q_free(q6);
 			goto dropfrag;
 		}
@@ -776,9 +661,7 @@ insert:
 		*prvnxtp = nxt;
 	}
 
-	frag6_remque(q6);
-	frag6_nfragpackets--;
-	frag6_nfrags -= q6->ip6q_nfrag;
+	fragtbl_detach(&ip6q_table, fb, &q6->ip6q_fq);
 	ip6q_free(q6);
 
 	if (m->m_flags & M_PKTHDR)	/* Isn't it always true? */
@@ -792,9 +675,9 @@ insert:
 	*mp = m;
 	*offp = offset;
 
+	fragtbl_unlock(fb);
 	/* arm the purge timer if not already and if there's work to do */
-	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
+	fragtbl_sched_timeout(&ip6q_table);
 	in6_ifstat_inc(dstifp, ifs6_reass_ok);
 	frag6_icmp6_paramprob_error(&diq6);
 	VERIFY(MBUFQ_EMPTY(&diq6));
@@ -802,26 +685,19 @@ insert:
 
 done:
 	VERIFY(m == NULL);
-	if (!locked) {
-		if (frag6_nfragpackets == 0) {
-			frag6_icmp6_paramprob_error(&diq6);
-			VERIFY(MBUFQ_EMPTY(&diq6));
-			return (IPPROTO_DONE);
-		}
-		lck_mtx_lock(&ip6qlock);
-	}
+	if (locked)
+		fragtbl_unlock(fb);
 	/* arm the purge timer if not already and if there's work to do */
-	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
+	fragtbl_sched_timeout(&ip6q_table);
 	frag6_icmp6_paramprob_error(&diq6);
 	VERIFY(MBUFQ_EMPTY(&diq6));
 	return (IPPROTO_DONE);
 
 dropfrag:
 	ip6stat.ip6s_fragdropped++;
+	fragtbl_unlock(fb);
 	/* arm the purge timer if not already and if there's work to do */
-	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
+	fragtbl_sched_timeout(&ip6q_table);
 	in6_ifstat_inc(dstifp, ifs6_reass_fail);
 	m_freem(m);
 	frag6_icmp6_paramprob_error(&diq6);
@@ -830,28 +706,41 @@ dropfrag:
 }
 
 /*
- * Free a fragment reassembly header and all
- * associated datagrams.
+ * Free a fragment reassembly header, already off its bucket, and all
+ * associated datagrams; called by the reassembly table when the queue
+ * times out or is drained.
  */
-void
-frag6_freef(struct ip6q *q6, struct fq6_head *dfq6, struct fq6_head *diq6)
+static void
+frag6_freef(struct fragq *fq, int why, struct fragq_mbufs *dfq6,
+    struct fragq_mbufs *diq6)
 {
-	struct ip6asfrag *af6, *down6;
-
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_OWNED);
+	struct ip6q *q6 = (struct ip6q *)fq;
+	struct fragent *fe, *tfe;
+
+	switch (why) {
+	case FRAGQ_TIMEOUT:
+		ip6stat.ip6s_fragtimeout++;
+		break;
+	case FRAGQ_OVERFLOW:
+	case FRAGQ_RECLAIM:
+		ip6stat.ip6s_fragoverflow++;
+		break;
+	case FRAGQ_DRAIN:
+		ip6stat.ip6s_fragdropped++;
+		break;
+	}
+	/* XXX in6_ifstat_inc(ifp, ifs6_reass_fail) */
 
-	for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
-	     af6 = down6) {
-		struct mbuf *m = IP6_REASS_MBUF(af6);
+	FRAGQ_FOREACH_SAFE(fe, fq, tfe) {
+		struct mbuf *m = fe->fe_m;
 
-		down6 = af6->ip6af_down;
-		frag6_deq(af6);
+		fragq_remove(&ip6q_table, fq, fe);
 
 		/*
 		 * Return ICMP time exceeded error for the 1st fragment.
 		 * Just free other fragments.
 		 */
-		if (af6->ip6af_off == 0) {
+		if (fe->fe_off == 0) {
 			struct ip6_hdr *ip6;
 
 			/* adjust pointer */
@@ -865,162 +754,18 @@ frag6_freef(struct ip6q *q6, struct fq6_head *dfq6, struct fq6_head *diq6)
 		} else {
 			MBUFQ_ENQUEUE(dfq6, m);
 		}
-		ip6af_free(af6);
-
+		ip6af_free(fe);
 	}
-	frag6_remque(q6);
-	frag6_nfragpackets--;
-	frag6_nfrags -= q6->ip6q_nfrag;
 	ip6q_free(q6);
 }
 
-/*
- * Put an ip fragment on a reassembly chain.
- * Like insque, but pointers in middle of structure.
- */
-void
-frag6_enq(struct ip6asfrag *af6, struct ip6asfrag *up6)
-{
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
-	af6->ip6af_up = up6;
-	af6->ip6af_down = up6->ip6af_down;
-	up6->ip6af_down->ip6af_up = af6;
-	up6->ip6af_down = af6;
-}
-
-/*
- * To frag6_enq as remque is to insque.
- */
-void
-frag6_deq(struct ip6asfrag *af6)
-{
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
-	af6->ip6af_up->ip6af_down = af6->ip6af_down;
-	af6->ip6af_down->ip6af_up = af6->ip6af_up;
-}
-
-void
-frag6_insque(struct ip6q *new, struct ip6q *old)
-{
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
-	new->ip6q_prev = old;
-	new->ip6q_next = old->ip6q_next;
-	old->ip6q_next->ip6q_prev= new;
-	old->ip6q_next = new;
-}
-
-void
-frag6_remque(struct ip6q *p6)
-{
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
-	p6->ip6q_prev->ip6q_next = p6->ip6q_next;
-	p6->ip6q_next->ip6q_prev = p6->ip6q_prev;
-}
-
-/*
- * IPv6 reassembling timer processing;
- * if a timer expires on a reassembly
- * queue, discard it.
- */
-static void
-frag6_timeout(void *arg)
-{
-#pragma unused(arg)
-	struct fq6_head dfq6, diq6;
-	struct ip6q *q6;
-
-	MBUFQ_INIT(&dfq6);	/* for deferred frees */
-	MBUFQ_INIT(&diq6);	/* for deferred ICMP time exceeded errors */
-
-	/*
-	 * Update coarse-grained networking timestamp (in sec.); the idea
-	 * is to piggy-back on the timeout callout to update the counter
-	 * returnable via net_uptime().
-	 */
-	net_update_uptime();
-
-	lck_mtx_lock(&ip6qlock);
-	q6 = ip6q.ip6q_next;
-	if (q6)
-		while (q6 != &ip6q) {
-			--q6->ip6q_ttl;
-			q6 = q6->ip6q_next;
-			if (q6->ip6q_prev->ip6q_ttl == 0) {
-				ip6stat.ip6s_fragtimeout++;
-				/* XXX in6_ifstat_inc(ifp, ifs6_reass_fail) */
-				frag6_freef(q6->ip6q_prev, &dfq6, &diq6);
-			}
-		}
-	/*
-	 * If we are over the maximum number of fragments
-	 * (due to the limit being lowered), drain off
-	 * enough to get down to the new limit.
-	 */
-	if (ip6_maxfragpackets >= 0) {
-		while (frag6_nfragpackets > (unsigned)ip6_maxfragpackets &&
-		    ip6q.ip6q_prev) {
-			ip6stat.ip6s_fragoverflow++;
-			/* XXX in6_ifstat_inc(ifp, ifs6_reass_fail) */
-			frag6_freef(ip6q.ip6q_prev, &dfq6, &diq6);
-		}
-	}
-	/* re-arm the purge timer if there's work to do */
-	frag6_timeout_run = 0;
-	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
-
-	/* free fragments that need to be freed */
-	if (!MBUFQ_EMPTY(&dfq6))
-		MBUFQ_DRAIN(&dfq6);
-
-	frag6_icmp6_timeex_error(&diq6);
-
-	VERIFY(MBUFQ_EMPTY(&dfq6));
-	VERIFY(MBUFQ_EMPTY(&diq6));
-}
-
-static void
-frag6_sched_timeout(void)
-{
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
-	if (!frag6_timeout_run && frag6_nfragpackets > 0) {
-		frag6_timeout_run = 1;
-		timeout(frag6_timeout, NULL, hz);
-	}
-}
-
 /*
  * Drain off all datagram fragments.
  */
 void
 frag6_drain(void)
 {
-	struct fq6_head dfq6, diq6;
-
-	MBUFQ_INIT(&dfq6);	/* for deferred frees */
-	MBUFQ_INIT(&diq6);	/* for deferred ICMP time exceeded errors */
-
-	lck_mtx_lock(&ip6qlock);
-	while (ip6q.ip6q_next != &ip6q) {
-		ip6stat.ip6s_fragdropped++;
-		/* XXX in6_ifstat_inc(ifp, ifs6_reass_fail) */
-		frag6_freef(ip6q.ip6q_next, &dfq6, &diq6);
-	}
-	lck_mtx_unlock(&ip6qlock);
-
-	/* free fragments that need to be freed */
-	if (!MBUFQ_EMPTY(&dfq6))
-		MBUFQ_DRAIN(&dfq6);
-
-	frag6_icmp6_timeex_error(&diq6);
-
-	VERIFY(MBUFQ_EMPTY(&dfq6));
-	VERIFY(MBUFQ_EMPTY(&diq6));
+	fragtbl_drain(&ip6q_table);
 }
 
 static struct ip6q *
@@ -1031,7 +776,7 @@ ip6q_alloc(int how)
 
 	/*
 	 * See comments in ip6q_updateparams().  Keep the count separate
-	 * from frag6_nfragpackets since the latter represents the elements
+	 * from ip6q_table.ft_nqueues since the latter represents the elements
 	 * already in the reassembly queues.
 	 */
 	if (ip6q_limit > 0 && ip6q_count > ip6q_limit)
@@ -1055,42 +800,35 @@ ip6q_free(struct ip6q *q6)
 	atomic_add_32(&ip6q_count, -1);
 }
 
-static struct ip6asfrag *
+static struct fragent *
 ip6af_alloc(int how)
 {
-	struct mbuf *t;
-	struct ip6asfrag *af6;
+	struct fragent *fe;
 
 	/*
 	 * See comments in ip6q_updateparams().  Keep the count separate
-	 * from frag6_nfrags since the latter represents the elements
-	 * already in the reassembly queues.
+	 * from ip6q_table.ft_nfrags since the latter represents the
+	 * elements already in the reassembly queues.
 	 */
 	if (ip6af_limit > 0 && ip6af_count > ip6af_limit)
 		return (NULL);
 
-	t = m_get(how, MT_FTABLE);
-	if (t != NULL) {
+	fe = fragent_alloc(how);
+	if (fe != NULL)
 		atomic_add_32(&ip6af_count, 1);
-		af6 = mtod(t, struct ip6asfrag *);
-		bzero(af6, sizeof (*af6));
-	} else {
-		af6 = NULL;
-	}
-	return (af6);
+	return (fe);
 }
 
 static void
-ip6af_free(struct ip6asfrag *af6)
+ip6af_free(struct fragent *fe)
 {
-	(void) m_free(dtom(af6));
+	fragent_free(fe);
 	atomic_add_32(&ip6af_count, -1);
 }
 
 static void
 ip6q_updateparams(void)
 {
-	lck_mtx_assert(&ip6qlock, LCK_MTX_ASSERT_OWNED);
 	/*
 	 * -1 for unlimited allocation.
 	 */
@@ -1117,7 +855,7 @@ ip6q_updateparams(void)
 	/*
 	 * Arm the purge timer if not already and if there's work to do
 	 */
-	frag6_sched_timeout();
+	fragtbl_sched_timeout(&ip6q_table);
 }
 
 static int
@@ -1126,7 +864,6 @@ sysctl_maxfragpackets SYSCTL_HANDLER_ARGS
 #pragma unused(arg1, arg2)
 	int error, i;
 
-	lck_mtx_lock(&ip6qlock);
 	i = ip6_maxfragpackets;
 	error = sysctl_handle_int(oidp, &i, 0, req);
 	if (error || req->newptr == USER_ADDR_NULL)
@@ -1139,7 +876,6 @@ sysctl_maxfragpackets SYSCTL_HANDLER_ARGS
 	ip6_maxfragpackets = i;
 	ip6q_updateparams();
 done:
-	lck_mtx_unlock(&ip6qlock);
 	return (error);
 }
 
@@ -1149,7 +885,6 @@ sysctl_maxfrags SYSCTL_HANDLER_ARGS
 #pragma unused(arg1, arg2)
 	int error, i;
 
-	lck_mtx_lock(&ip6qlock);
 	i = ip6_maxfrags;
 	error = sysctl_handle_int(oidp, &i, 0, req);
 	if (error || req->newptr == USER_ADDR_NULL)
@@ -1162,6 +897,5 @@ sysctl_maxfrags SYSCTL_HANDLER_ARGS
 	ip6_maxfrags= i;
 	ip6q_updateparams();	/* see if we need to arm timer */
 done:
-	lck_mtx_unlock(&ip6qlock);
 	return (error);
 }
@@ -104,6 +104,7 @@
 #include <sys/proc.h>
 #include <sys/kauth.h>
 #include <sys/priv.h>
+#include <sys/mcache.h>
 
 #include <net/if.h>
 #include <net/if_types.h>
@@ -141,6 +142,13 @@
 #include <net/necp.h>
 #endif /* NECP */
 
+static int in6_pcblookup_hash_walk(struct inpcbinfo *, struct in6_addr *,
+    u_short, struct in6_addr *, u_short, int, struct ifnet *, boolean_t,
+    struct inpcb **);
+static int in6_pcblookup_pin(struct inpcbinfo *, struct inpcb *, boolean_t,
+    u_int32_t, u_int32_t, const struct in6_addr *, u_short,
+    const struct in6_addr *, u_short, struct inpcb **);
+
 /*
  * in6_pcblookup_local_and_cleanup does everything
  * in6_pcblookup_local does but it checks for a socket
@@ -1196,17 +1204,52 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
     u_int fport_arg, struct in6_addr *laddr, u_int lport_arg, int wildcard,
     struct ifnet *ifp)
 {
-	struct inpcbhead *head;
 	struct inpcb *inp;
 	u_short fport = fport_arg, lport = lport_arg;
+	u_int32_t gen;
+
+	if (inpcb_lockless_lookup) {
+		gen = in_pcb_lookup_enter(pcbinfo);
+		if (in6_pcblookup_hash_walk(pcbinfo, faddr, fport, laddr,
+		    lport, wildcard, ifp, TRUE, &inp) == 0) {
+			in_pcb_lookup_exit(pcbinfo, gen);
+			return (inp);
+		}
+		in_pcb_lookup_exit(pcbinfo, gen);
+		atomic_add_32(&inpcb_lookup_retries, 1);
+	}
 
 	lck_rw_lock_shared(pcbinfo->ipi_lock);
+	(void) in6_pcblookup_hash_walk(pcbinfo, faddr, fport, laddr, lport,
+	    wildcard, ifp, FALSE, &inp);
+	lck_rw_done(pcbinfo->ipi_lock);
+	return (inp);
+}
+
+/*
+ * IPv6 counterpart of in_pcblookup_hash_walk(); returns EAGAIN if a
+ * lockless walk has to be redone under ipi_lock.
+ */
+static int
+in6_pcblookup_hash_walk(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
+    u_short fport, struct in6_addr *laddr, u_short lport, int wildcard,
+    struct ifnet *ifp, boolean_t lockless, struct inpcb **inpp)
+{
+	struct inpcbhead *head;
+	struct inpcb *inp;
+	struct inpcb *local_wild = NULL;
+	u_int32_t bucket, seq = 0;
+
+	*inpp = NULL;
 
 	/*
 	 * First look for an exact match.
 	 */
-	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr->s6_addr32[3] /* XXX */,
-	    lport, fport, pcbinfo->ipi_hashmask)];
+	bucket = INP_PCBHASH(faddr->s6_addr32[3] /* XXX */, lport, fport,
+	    pcbinfo->ipi_hashmask);
+	head = &pcbinfo->ipi_hashbase[bucket];
+	if (lockless)
+		seq = in_pcb_hashseq_begin(pcbinfo, bucket);
 	LIST_FOREACH(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV6))
 			continue;
@@ -1221,63 +1264,82 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 			/*
 			 * Found. Check if pcb is still valid
 			 */
-			if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) !=
-			    WNT_STOPUSING) {
-				lck_rw_done(pcbinfo->ipi_lock);
-				return (inp);
-			} else {
-				/* it's there but dead, say it isn't found */
-				lck_rw_done(pcbinfo->ipi_lock);
-				return (NULL);
-			}
+			return (in6_pcblookup_pin(pcbinfo, inp, lockless,
+			    bucket, seq, faddr, fport, laddr, lport, inpp));
 		}
 	}
-	if (wildcard) {
-		struct inpcb *local_wild = NULL;
+	if (lockless && in_pcb_hashseq_retry(pcbinfo, bucket, seq))
+		return (EAGAIN);
 
-		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
-		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
-			if (!(inp->inp_vflag & INP_IPV6))
-				continue;
+	if (!wildcard) {
+		/*
+		 * Not found.
+		 */
+		return (0);
+	}
 
-			if (inp_restricted_recv(inp, ifp))
-				continue;
+	bucket = INP_PCBHASH(INADDR_ANY, lport, 0, pcbinfo->ipi_hashmask);
+	head = &pcbinfo->ipi_hashbase[bucket];
+	if (lockless)
+		seq = in_pcb_hashseq_begin(pcbinfo, bucket);
+	LIST_FOREACH(inp, head, inp_hash) {
+		if (!(inp->inp_vflag & INP_IPV6))
+			continue;
 
-			if (IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_faddr) &&
-			    inp->inp_lport == lport) {
-				if (IN6_ARE_ADDR_EQUAL(&inp->in6p_laddr,
-				    laddr)) {
-					if (in_pcb_checkstate(inp, WNT_ACQUIRE,
-					    0) != WNT_STOPUSING) {
-						lck_rw_done(pcbinfo->ipi_lock);
-						return (inp);
-					} else {
-						/* dead; say it isn't found */
-						lck_rw_done(pcbinfo->ipi_lock);
-						return (NULL);
-					}
-				} else if (IN6_IS_ADDR_UNSPECIFIED(
-				    &inp->in6p_laddr)) {
-					local_wild = inp;
-				}
+		if (inp_restricted_recv(inp, ifp))
+			continue;
+
+		if (IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_faddr) &&
+		    inp->inp_lport == lport) {
+			if (IN6_ARE_ADDR_EQUAL(&inp->in6p_laddr, laddr)) {
+				inp = in_pcblbgroup_select(inp, faddr, fport,
+				    ifp);
+				return (in6_pcblookup_pin(pcbinfo, inp,
+				    lockless, bucket, seq, &in6addr_any, 0,
+				    laddr, lport, inpp));
+			} else if (IN6_IS_ADDR_UNSPECIFIED(
+			    &inp->in6p_laddr)) {
+				local_wild = inp;
 			}
 		}
-		if (local_wild && in_pcb_checkstate(local_wild,
-		    WNT_ACQUIRE, 0) != WNT_STOPUSING) {
-			lck_rw_done(pcbinfo->ipi_lock);
-			return (local_wild);
-		} else {
-			lck_rw_done(pcbinfo->ipi_lock);
-			return (NULL);
-		}
 	}
+	if (local_wild != NULL) {
+		local_wild = in_pcblbgroup_select(local_wild, faddr, fport,
+		    ifp);
+		return (in6_pcblookup_pin(pcbinfo, local_wild, lockless,
+		    bucket, seq, &in6addr_any, 0, &in6addr_any, lport, inpp));
+	}
+	if (lockless && in_pcb_hashseq_retry(pcbinfo, bucket, seq))
+		return (EAGAIN);
+	return (0);
+}
 
-	/*
-	 * Not found.
-	 */
-	lck_rw_done(pcbinfo->ipi_lock);
-	return (NULL);
+/*
+ * Reference a pcb found by in6_pcblookup_hash_walk(); a lockless walk is
+ * validated the same way as in in_pcblookup_pin().
+ */
+static int
+in6_pcblookup_pin(struct inpcbinfo *pcbinfo, struct inpcb *inp,
+    boolean_t lockless, u_int32_t bucket, u_int32_t seq,
+    const struct in6_addr *faddr, u_short fport, const struct in6_addr *laddr,
+    u_short lport, struct inpcb **inpp)
+{
+	if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) == WNT_STOPUSING) {
+		if (lockless && in_pcb_hashseq_retry(pcbinfo, bucket, seq))
+			return (EAGAIN);
+		/* it's there but dead, say it isn't found */
+		*inpp = NULL;
+		return (0);
+	}
+	if (lockless && (in_pcb_hashseq_retry(pcbinfo, bucket, seq) ||
+	    !IN6_ARE_ADDR_EQUAL(&inp->in6p_faddr, faddr) ||
+	    !IN6_ARE_ADDR_EQUAL(&inp->in6p_laddr, laddr) ||
+	    inp->inp_fport != fport || inp->inp_lport != lport)) {
+		in_pcb_lookup_unpin(inp);
+		return (EAGAIN);
+	}
+	*inpp = inp;
+	return (0);
 }
 
 void
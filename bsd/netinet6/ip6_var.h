@@ -96,41 +96,30 @@
 
 #ifdef BSD_KERNEL_PRIVATE
 #include <net/ethernet.h>
+#include <netinet/frag_reass.h>
 
 /*
  * IP6 reassembly queue structure.  Each fragment
  * being reassembled is attached to one of these structures.
+ * The fragments (struct fragent) keep the offset in the mbuf
+ * to the next header in fe_hoff.
  */
 struct	ip6q {
-	struct ip6asfrag *ip6q_down;
-	struct ip6asfrag *ip6q_up;
+	struct fragq	ip6q_fq;	/* hash linkage and fragments */
 	u_int32_t	ip6q_ident;
 	u_int8_t	ip6q_nxt;
 	u_int8_t	ip6q_ecn;
-	u_int8_t	ip6q_ttl;
 	struct in6_addr ip6q_src, ip6q_dst;
-	struct ip6q	*ip6q_next;
-	struct ip6q	*ip6q_prev;
 	int		ip6q_unfrglen;	/* len of unfragmentable part */
 #ifdef notyet
 	u_char	*ip6q_nxtp;
 #endif
-	int		ip6q_nfrag;	/* # of fragments */
 	uint32_t	ip6q_csum_flags; /* checksum flags */
 	uint32_t	ip6q_csum;	/* partial checksum value */
 };
 
-struct	ip6asfrag {
-	struct ip6asfrag *ip6af_down;
-	struct ip6asfrag *ip6af_up;
-	struct mbuf	*ip6af_m;
-	int		ip6af_offset;	/* offset in ip6af_m to next header */
-	int		ip6af_frglen;	/* fragmentable part length */
-	int		ip6af_off;	/* fragment offset */
-	u_int16_t	ip6af_mff;	/* more fragment bit in frag off */
-};
-
-#define	IP6_REASS_MBUF(ip6af) (*(struct mbuf **)&((ip6af)->ip6af_m))
+#define	ip6q_ttl	ip6q_fq.fq_ttl
+#define	ip6q_nfrag	ip6q_fq.fq_nfrags	/* # of fragments */
 
 struct	ip6_moptions {
 	decl_lck_mtx_data(, im6o_lock);
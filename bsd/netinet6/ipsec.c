@@ -384,9 +384,7 @@ ipsec4_getpolicybysock(struct mbuf *m,
 		if (pcbsp->priv) {
 			switch (currsp->policy) {
 				case IPSEC_POLICY_BYPASS:
-					lck_mtx_lock(sadb_mutex);
-					currsp->refcnt++;
-					lck_mtx_unlock(sadb_mutex);
+					KEY_SP_ADDREF(currsp);
 					*error = 0;
 					KERNEL_DEBUG(DBG_FNC_GETPOL_SOCK | DBG_FUNC_END, 2,*error,0,0,0);
 					return currsp;
@@ -415,16 +413,14 @@ ipsec4_getpolicybysock(struct mbuf *m,
 								  ip4_def_policy.policy, IPSEC_POLICY_NONE));
 						ip4_def_policy.policy = IPSEC_POLICY_NONE;
 					}
-					ip4_def_policy.refcnt++;
+					KEY_SP_ADDREF(&ip4_def_policy);
 					lck_mtx_unlock(sadb_mutex);
 					*error = 0;
 					KERNEL_DEBUG(DBG_FNC_GETPOL_SOCK | DBG_FUNC_END, 4,*error,0,0,0);
 					return &ip4_def_policy;
 					
 				case IPSEC_POLICY_IPSEC:
-					lck_mtx_lock(sadb_mutex);
-					currsp->refcnt++;
-					lck_mtx_unlock(sadb_mutex);
+					KEY_SP_ADDREF(currsp);
 					*error = 0;
 					KERNEL_DEBUG(DBG_FNC_GETPOL_SOCK | DBG_FUNC_END, 5,*error,0,0,0);
 					return currsp;
@@ -473,16 +469,14 @@ ipsec4_getpolicybysock(struct mbuf *m,
 						  ip4_def_policy.policy, IPSEC_POLICY_NONE));
 				ip4_def_policy.policy = IPSEC_POLICY_NONE;
 			}
-			ip4_def_policy.refcnt++;
+			KEY_SP_ADDREF(&ip4_def_policy);
 			lck_mtx_unlock(sadb_mutex);
 			*error = 0;
 			KERNEL_DEBUG(DBG_FNC_GETPOL_SOCK | DBG_FUNC_END, 9,*error,0,0,0);
 			return &ip4_def_policy;
 			
 		case IPSEC_POLICY_IPSEC:
-			lck_mtx_lock(sadb_mutex);
-			currsp->refcnt++;
-			lck_mtx_unlock(sadb_mutex);
+			KEY_SP_ADDREF(currsp);
 			*error = 0;
 			KERNEL_DEBUG(DBG_FNC_GETPOL_SOCK | DBG_FUNC_END, 10,*error,0,0,0);
 			return currsp;
@@ -561,7 +555,7 @@ ipsec4_getpolicybyaddr(struct mbuf *m,
 			IPSEC_POLICY_NONE));
 		ip4_def_policy.policy = IPSEC_POLICY_NONE;
 	}
-	ip4_def_policy.refcnt++;
+	KEY_SP_ADDREF(&ip4_def_policy);
 	lck_mtx_unlock(sadb_mutex);
 	*error = 0;
 	KERNEL_DEBUG(DBG_FNC_GETPOL_ADDR | DBG_FUNC_END, 3,*error,0,0,0);
@@ -695,9 +689,7 @@ ipsec6_getpolicybysock(struct mbuf *m,
 		if (pcbsp->priv) {
 			switch (currsp->policy) {
 				case IPSEC_POLICY_BYPASS:
-					lck_mtx_lock(sadb_mutex);
-					currsp->refcnt++;
-					lck_mtx_unlock(sadb_mutex);
+					KEY_SP_ADDREF(currsp);
 					*error = 0;
 					return currsp;
 					
@@ -724,15 +716,13 @@ ipsec6_getpolicybysock(struct mbuf *m,
 								  ip6_def_policy.policy, IPSEC_POLICY_NONE));
 						ip6_def_policy.policy = IPSEC_POLICY_NONE;
 					}
-					ip6_def_policy.refcnt++;
+					KEY_SP_ADDREF(&ip6_def_policy);
 					lck_mtx_unlock(sadb_mutex);
 					*error = 0;
 					return &ip6_def_policy;
 					
 				case IPSEC_POLICY_IPSEC:
-					lck_mtx_lock(sadb_mutex);
-					currsp->refcnt++;
-					lck_mtx_unlock(sadb_mutex);
+					KEY_SP_ADDREF(currsp);
 					*error = 0;
 					return currsp;
 					
@@ -777,15 +767,13 @@ ipsec6_getpolicybysock(struct mbuf *m,
 						  ip6_def_policy.policy, IPSEC_POLICY_NONE));
 				ip6_def_policy.policy = IPSEC_POLICY_NONE;
 			}
-			ip6_def_policy.refcnt++;
+			KEY_SP_ADDREF(&ip6_def_policy);
 			lck_mtx_unlock(sadb_mutex);
 			*error = 0;
 			return &ip6_def_policy;
 			
 		case IPSEC_POLICY_IPSEC:
-			lck_mtx_lock(sadb_mutex);
-			currsp->refcnt++;
-			lck_mtx_unlock(sadb_mutex);
+			KEY_SP_ADDREF(currsp);
 			*error = 0;
 			return currsp;
 			
@@ -862,7 +850,7 @@ ipsec6_getpolicybyaddr(struct mbuf *m,
 		    ip6_def_policy.policy, IPSEC_POLICY_NONE));
 		ip6_def_policy.policy = IPSEC_POLICY_NONE;
 	}
-	ip6_def_policy.refcnt++;
+	KEY_SP_ADDREF(&ip6_def_policy);
 	lck_mtx_unlock(sadb_mutex);
 	*error = 0;
 	return &ip6_def_policy;
@@ -3416,7 +3404,13 @@ ipsec4_output_internal(struct ipsec_output_state *state, struct secasvar *sav)
 	switch (sav->sah->saidx.proto) {
 	case IPPROTO_ESP:
 #if IPSEC_ESP
-		if ((error = esp4_output(state->m, sav)) != 0) {
+		if (state->done != NULL)
+			error = esp4_output_async(state->m, sav, state->done,
+			    state->done_arg);
+		else
+			error = esp4_output(state->m, sav);
+		if (error != 0) {
+			/* EJUSTRETURN: handed to state->done later */
 			state->m = NULL;
 			goto bad;
 		}
@@ -86,6 +86,9 @@ struct secpolicyindex {
 /* Security Policy Data Base */
 struct secpolicy {
 	LIST_ENTRY(secpolicy) chain;
+	LIST_ENTRY(secpolicy) idxchain;	/* SPD hash bucket or wildcard list */
+	u_int64_t order;		/* position in the SPD, for lookups */
+	u_int8_t hashed;		/* on a hash bucket, not wildcard list */
 
 	int refcnt;			/* reference count */
 	struct secpolicyindex spidx;	/* selector */
@@ -293,12 +296,20 @@ struct ipsecstat {
 #define IPSEC_IS_P2ALIGNED(p)        1
 #define IPSEC_GET_P2UNALIGNED_OFS(p) 0
 
+/*
+ * Takes a packet whose ESP processing finished asynchronously, or NULL
+ * if it was dropped on the way.
+ */
+typedef void (*ipsec_output_done_t)(struct mbuf *, struct secasvar *, void *);
+
 struct ipsec_output_state {
 	int tunneled;
 	struct mbuf *m;
 	struct route ro;
 	struct sockaddr *dst;
 	u_int outgoing_if;
+	ipsec_output_done_t done;	/* non-NULL: ESP may finish later */
+	void *done_arg;
 };
 
 struct ipsec_history {
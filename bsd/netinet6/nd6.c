@@ -158,6 +158,10 @@ static int nd6_inuse, nd6_allocated;
  *
  *	- Routing entry lock (rt_lock)
  *
+ * ln_nbr is hashed in the neighbor table of the route's interface
+ * and armed on nd6_wheel for ln_expire, both also under rt_lock; see
+ * net/if_nbr.h.  Entries are only armed while they are on llinfo_nd6.
+ *
  * Due to the dependency on rt_lock, llinfo_nd6 has the same lifetime
  * as the route entry itself.  When a route is deleted (RTM_DELETE),
  * it is simply removed from the global list but the memory is not
@@ -168,6 +172,12 @@ struct llinfo_nd6 llinfo_nd6 = {
 	.ln_prev = &llinfo_nd6,
 };
 
+#define	NBR_TO_LN(_ne)							\
+	((struct llinfo_nd6 *)(void *)((caddr_t)(_ne) -			\
+	offsetof(struct llinfo_nd6, ln_nbr)))
+
+static struct nbr_wheel nd6_wheel;	/* llinfo_nd6 by ln_expire */
+
 static lck_grp_attr_t	*nd_if_lock_grp_attr = NULL;
 static lck_grp_t	*nd_if_lock_grp = NULL;
 static lck_attr_t	*nd_if_lock_attr = NULL;
@@ -284,6 +294,8 @@ nd6_init(void)
 	/* initialization of the default router list */
 	TAILQ_INIT(&nd_defrouter);
 
+	nbr_wheel_init(&nd6_wheel);
+
 	nd_if_lock_grp_attr = lck_grp_attr_alloc_init();
 	nd_if_lock_grp = lck_grp_alloc_init("nd_if_lock", nd_if_lock_grp_attr);
 	nd_if_lock_attr = lck_attr_alloc_init();
@@ -422,7 +434,7 @@ nd6_llinfo_refresh(struct rtentry *rt)
 	if ((ln->ln_state > ND6_LLINFO_INCOMPLETE) &&
 	    (ln->ln_state < ND6_LLINFO_PROBE)) {
 		if (ln->ln_expire > timenow) {
-			ln->ln_expire = timenow;
+			ln_setexpire(ln, timenow);
 			ln->ln_state = ND6_LLINFO_PROBE;
 		}
 	}
@@ -433,6 +445,9 @@ void
 ln_setexpire(struct llinfo_nd6 *ln, uint64_t expiry)
 {
 	ln->ln_expire = expiry;
+	/* nd6_service() only looks at entries on llinfo_nd6 */
+	if (ln->ln_flags & ND6_LNF_IN_USE)
+		nbr_wheel_sched(&nd6_wheel, &ln->ln_nbr, expiry);
 }
 
 static uint64_t
@@ -722,11 +737,12 @@ nd6_service(void *arg)
 {
 	struct nd6svc_arg *ap = arg;
 	struct llinfo_nd6 *ln;
+	struct nbr_entry *ne;
 	struct nd_defrouter *dr;
 	struct nd_prefix *pr;
 	struct ifnet *ifp = NULL;
 	struct in6_ifaddr *ia6, *nia6;
-	uint64_t timenow;
+	uint64_t timenow, next;
 	bool send_nc_failure_kev = false;
 
 	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
@@ -749,6 +765,35 @@ nd6_service(void *arg)
 
 	net_update_uptime();
 	timenow = net_uptime();
+
+	if (ap->draining) {
+		/*
+		 * If we are draining, immediately purge non-static
+		 * entries without oustanding route refcnt.
+		 */
+		for (ln = llinfo_nd6.ln_next; ln != &llinfo_nd6;
+		    ln = ln->ln_next) {
+			struct rtentry *rt = ln->ln_rt;
+
+			RT_LOCK(rt);
+			if (ln->ln_expire != 0 &&
+			    !(rt->rt_flags & RTF_STATIC) &&
+			    rt->rt_refcnt == 0) {
+				if (ln->ln_state > ND6_LLINFO_INCOMPLETE)
+					ln->ln_state = ND6_LLINFO_STALE;
+				else
+					ln->ln_state = ND6_LLINFO_PURGE;
+				ln_setexpire(ln, timenow);
+			}
+			RT_UNLOCK(rt);
+		}
+	}
+	/*
+	 * Take the entries that are due off the wheel.  When draining,
+	 * those just armed for now may have gone on the next second's
+	 * slot, so take that one as well.
+	 */
+	nbr_wheel_advance(&nd6_wheel, ap->draining ? timenow + 1 : timenow);
 again:
 	/*
 	 * send_nc_failure_kev gets set when default router's IPv6 address
@@ -795,38 +840,29 @@ again:
 	send_nc_failure_kev = false;
 	ifp = NULL;
 	/*
-	 * The global list llinfo_nd6 is modified by nd6_request() and is
-	 * therefore protected by rnh_lock.  For obvious reasons, we cannot
-	 * hold rnh_lock across calls that might lead to code paths which
-	 * attempt to acquire rnh_lock, else we deadlock.  Hence for such
-	 * cases we drop rt_lock and rnh_lock, make the calls, and repeat the
-	 * loop.  To ensure that we don't process the same entry more than
-	 * once in a single timeout, we mark the "already-seen" entries with
-	 * ND6_LNF_TIMER_SKIP flag.  At the end of the loop, we do a second
-	 * pass thru the entries and clear the flag so they can be processed
-	 * during the next timeout.
+	 * Only the entries that are due are looked at; they have been
+	 * taken off nd6_wheel, but stay on the global list llinfo_nd6,
+	 * which is modified by nd6_request() and is therefore protected
+	 * by rnh_lock.  For obvious reasons, we cannot hold rnh_lock
+	 * across calls that might lead to code paths which attempt to
+	 * acquire rnh_lock, else we deadlock.  Hence for such cases we
+	 * drop rt_lock and rnh_lock, make the calls, and carry on with the
+	 * next due entry.  An entry that gets rearmed in the meantime for
+	 * now or earlier goes on the next second's slot, so we don't
+	 * process the same entry more than once in a single timeout.
 	 */
 	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
 
-	ln = llinfo_nd6.ln_next;
-	while (ln != NULL && ln != &llinfo_nd6) {
+	while ((ne = nbr_wheel_pop(&nd6_wheel)) != NULL) {
 		struct rtentry *rt;
 		struct sockaddr_in6 *dst;
-		struct llinfo_nd6 *next;
 		u_int32_t retrans, flags;
 		struct nd_ifinfo *ndi = NULL;
 
-		/* ln_next/prev/rt is protected by rnh_lock */
-		next = ln->ln_next;
+		/* ln_rt is protected by rnh_lock */
+		ln = NBR_TO_LN(ne);
 		rt = ln->ln_rt;
 		RT_LOCK(rt);
-
-		/* We've seen this already; skip it */
-		if (ln->ln_flags & ND6_LNF_TIMER_SKIP) {
-			RT_UNLOCK(rt);
-			ln = next;
-			continue;
-		}
 		ap->found++;
 
 		/* rt->rt_ifp should never be NULL */
@@ -851,40 +887,16 @@ again:
 			/* NOTREACHED */
 		}
 
-		/* Set the flag in case we jump to "again" */
-		ln->ln_flags |= ND6_LNF_TIMER_SKIP;
-
-		if (ln->ln_expire == 0 || (rt->rt_flags & RTF_STATIC)) {
+		if (ln->ln_expire == 0 || (rt->rt_flags & RTF_STATIC))
 			ap->sticky++;
-		} else if (ap->draining && (rt->rt_refcnt == 0)) {
-			/*
-			 * If we are draining, immediately purge non-static
-			 * entries without oustanding route refcnt.
-			 */
-			if (ln->ln_state > ND6_LLINFO_INCOMPLETE)
-				ln->ln_state = ND6_LLINFO_STALE;
-			else
-				ln->ln_state = ND6_LLINFO_PURGE;
-			ln_setexpire(ln, timenow);
-		}
 
 		/*
-		 * If the entry has not expired, skip it.  Take note on the
-		 * state, as entries that are in the STALE state are simply
-		 * waiting to be garbage collected, in which case we can
-		 * relax the callout scheduling (use nd6_prune_lazy).
+		 * If the entry has not expired, which only happens when
+		 * draining, put it back.
 		 */
 		if (ln->ln_expire > timenow) {
-			switch (ln->ln_state) {
-			case ND6_LLINFO_STALE:
-				ap->aging_lazy++;
-				break;
-			default:
-				ap->aging++;
-				break;
-			}
+			ln_setexpire(ln, ln->ln_expire);
 			RT_UNLOCK(rt);
-			ln = next;
 			continue;
 		}
 
@@ -1022,21 +1034,19 @@ again:
 			RT_UNLOCK(rt);
 			break;
 		}
-		ln = next;
 	}
 	lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
 
-	/* Now clear the flag from all entries */
-	ln = llinfo_nd6.ln_next;
-	while (ln != NULL && ln != &llinfo_nd6) {
-		struct rtentry *rt = ln->ln_rt;
-		struct llinfo_nd6 *next = ln->ln_next;
-
-		RT_LOCK_SPIN(rt);
-		if (ln->ln_flags & ND6_LNF_TIMER_SKIP)
-			ln->ln_flags &= ~ND6_LNF_TIMER_SKIP;
-		RT_UNLOCK(rt);
-		ln = next;
+	/*
+	 * Entries that are not due soon can do with the lazy timer; this
+	 * also covers those waiting in the STALE state to be garbage
+	 * collected.
+	 */
+	if ((next = nbr_wheel_next(&nd6_wheel)) != 0) {
+		if (next <= timenow + nd6_prune_lazy)
+			ap->aging++;
+		else
+			ap->aging_lazy++;
 	}
 	lck_mtx_unlock(rnh_lock);
 
@@ -1664,6 +1674,15 @@ nd6_lookup(struct in6_addr *addr6, int create, struct ifnet *ifp, int rt_locked)
 	sin6.sin6_family = AF_INET6;
 	sin6.sin6_addr = *addr6;
 
+	/*
+	 * Try the interface's neighbor table first; it returns the
+	 * route locked and referenced, same as below, and misses when
+	 * the entry does not exist or is busy.
+	 */
+	if (ifp != NULL &&
+	    (rt = nbr_lookup(ifp, AF_INET6, addr6)) != NULL)
+		goto validate;
+
 	ifscope = (ifp != NULL) ? ifp->if_index : IFSCOPE_NONE;
 	if (rt_locked) {
 		lck_mtx_assert(rnh_lock, LCK_MTX_ASSERT_OWNED);
@@ -1743,6 +1762,7 @@ nd6_lookup(struct in6_addr *addr6, int create, struct ifnet *ifp, int rt_locked)
 			return (NULL);
 		}
 	}
+validate:
 	RT_LOCK_ASSERT_HELD(rt);
 	/*
 	 * Validation for the entry.
@@ -2186,6 +2206,7 @@ nd6_rtrequest(int req, struct rtentry *rt, struct sockaddr *sa)
 		rt->rt_llinfo_refresh   = nd6_llinfo_refresh;
 		rt->rt_flags |= RTF_LLINFO;
 		ln->ln_rt = rt;
+		nbr_entry_init(&ln->ln_nbr, rt);
 		/* this is required for "ndp" command. - shin */
 		if (req == RTM_ADD) {
 			/*
@@ -2208,6 +2229,14 @@ nd6_rtrequest(int req, struct rtentry *rt, struct sockaddr *sa)
 		LN_INSERTHEAD(ln);
 		nd6_inuse++;
 
+		/*
+		 * Hash it by address on the interface it is created on,
+		 * before a local address moves it to lo_ifp below, and
+		 * arm it for the expiry set above.
+		 */
+		nbr_insert(ifp, &ln->ln_nbr);
+		ln_setexpire(ln, ln->ln_expire);
+
 		/* We have at least one entry; arm the timer if not already */
 		nd6_sched_timeout(NULL, NULL);
 
@@ -2359,6 +2388,8 @@ nd6_rtrequest(int req, struct rtentry *rt, struct sockaddr *sa)
 		 */
 		if (ln->ln_flags & ND6_LNF_IN_USE)
 			LN_DEQUEUE(ln);
+		nbr_remove(&ln->ln_nbr);
+		nbr_wheel_unsched(&nd6_wheel, &ln->ln_nbr);
 
 		/*
 		 * Purge any link-layer info caching.
@@ -3572,7 +3603,7 @@ lookup:
 		lck_mtx_unlock(rnh_lock);
 	} else {
 		if(ln->ln_state == ND6_LLINFO_INCOMPLETE) {
-			ln->ln_expire = timenow;
+			ln_setexpire(ln, timenow);
 		}
 		RT_UNLOCK(rt);
 	}
@@ -67,6 +67,7 @@
 
 #ifdef BSD_KERNEL_PRIVATE
 #include <net/flowadv.h>
+#include <net/if_nbr.h>
 #include <kern/locks.h>
 #include <sys/tree.h>
 #include <netinet6/nd6_var.h>
@@ -90,10 +91,10 @@ struct	llinfo_nd6 {
 	u_int64_t ln_expire;	/* lifetime for NDP state transition */
 	u_int64_t ln_lastused;	/* last used timestamp */
 	struct	if_llreach *ln_llreach;	/* link-layer reachability record */
+	struct	nbr_entry ln_nbr;	/* neighbor table and expiry */
 };
 
 /* Values for ln_flags */
-#define	ND6_LNF_TIMER_SKIP	0x1	/* modified by nd6_timer() */
 #define	ND6_LNF_IN_USE		0x2	/* currently in llinfo_nd6 list */
 #endif /* BSD_KERNEL_PRIVATE */
 
@@ -764,11 +764,15 @@ udp6_bind(struct socket *so, struct sockaddr *nam, struct proc *p)
 			inp->inp_vflag |= INP_IPV4;
 			inp->inp_vflag &= ~INP_IPV6;
 			error = in_pcbbind(inp, (struct sockaddr *)&sin, p);
+			if (error == 0)
+				in_pcblbgroup_insert(inp);
 			return (error);
 		}
 	}
 
 	error = in6_pcbbind(inp, nam, p);
+	if (error == 0)
+		in_pcblbgroup_insert(inp);
 	return (error);
 }
 
@@ -115,6 +115,7 @@
 #endif
 #if IPSEC_ESP
 #include <netinet6/esp.h>
+#include <netinet6/esp_async.h>
 #if INET6
 #include <netinet6/esp6.h>
 #endif
@@ -179,10 +180,38 @@ static LIST_HEAD(_sahtree, secashead) sahtree;			/* SAD */
 static LIST_HEAD(_regtree, secreg) regtree[SADB_SATYPE_MAX + 1];
 /* registed list */
 
-#define SPIHASHSIZE	128
+#define SPIHASHSIZE	1024
 #define	SPIHASH(x)	(((x) ^ ((x) >> 16)) % SPIHASHSIZE)
 static LIST_HEAD(_spihash, secasvar) spihash[SPIHASHSIZE];
 
+/* SA heads by protocol and destination, for outbound SA selection */
+#define	SAHHASHSIZE	1024
+static LIST_HEAD(_sahhash, secashead) sahhash[SAHHASHSIZE];
+
+/*
+ * SPD entries whose destination selector is an address prefix are
+ * hashed by that prefix; a lookup probes one bucket per prefix length
+ * in use.  The rest (address ranges, odd families) stay on a wildcard
+ * list.  sp->order preserves the first-match semantics of sptree.
+ */
+#define	SPHASHSIZE	1024
+#define	SPORDER_GENERATE	(1ULL << 63)
+static LIST_HEAD(_sphash, secpolicy) sphash[IPSEC_DIR_MAX][SPHASHSIZE];
+static LIST_HEAD(_spwild, secpolicy) spwild[IPSEC_DIR_MAX];
+static u_int32_t sphash_plens[IPSEC_DIR_MAX][2][5];	/* prefd in use */
+static u_int32_t sphash_plencnt[IPSEC_DIR_MAX][2][129];
+static u_int64_t sp_order = 0;
+
+/*
+ * sadb_index_lock protects spihash, sahhash, the SPD index and the SA
+ * state chains from the data path, which walks them with the lock held
+ * shared instead of taking sadb_mutex.  They are changed with sadb_mutex
+ * held and this lock held exclusive, so sadb_mutex alone is enough to
+ * read them.
+ */
+decl_lck_rw_data(static, sadb_index_lock_data);
+static lck_rw_t *sadb_index_lock = &sadb_index_lock_data;
+
 #ifndef IPSEC_NONBLOCK_ACQUIRE
 static LIST_HEAD(_acqtree, secacq) acqtree;		/* acquiring list */
 #endif
@@ -445,7 +474,16 @@ struct sadb_msghdr {
 };
 
 static struct secpolicy *__key_getspbyid(u_int32_t id);
-static struct secasvar *key_do_allocsa_policy(struct secashead *, u_int, u_int16_t);
+static struct secasvar *key_do_allocsa_policy(struct secashead *, u_int, u_int16_t, int *);
+static struct secasvar *key_allocsa_policy_search(struct secasindex *, u_int16_t, int *);
+static int key_allocsp_match(struct secpolicy *, struct secpolicyindex *);
+static int key_spindex_af(struct sockaddr_storage *);
+static u_int32_t key_sphash(struct sockaddr_storage *, u_int8_t);
+static void key_spindex_insert(struct secpolicy *);
+static void key_spindex_remove(struct secpolicy *);
+static u_int32_t key_sahhash(struct secasindex *);
+static struct secashead *key_sahhash_lookup(struct secasindex *, int);
+static int key_release_unlocked(int *);
 static int key_do_get_translated_port(struct secashead *, struct secasvar *, u_int);
 static void key_delsp(struct secpolicy *);
 static struct secpolicy *key_getsp(struct secpolicyindex *);
@@ -628,15 +666,24 @@ key_init(struct protosw *pp, struct domain *dp)
 	
 	lck_mtx_init(pfkey_stat_mutex, pfkey_stat_mutex_grp, pfkey_stat_mutex_attr);
 	
+	lck_rw_init(sadb_index_lock, sadb_mutex_grp, sadb_mutex_attr);
+
 	for (i = 0; i < SPIHASHSIZE; i++)
 		LIST_INIT(&spihash[i]);
+	for (i = 0; i < SAHHASHSIZE; i++)
+		LIST_INIT(&sahhash[i]);
 	
 	raw_init(pp, dp);
 	
 	bzero((caddr_t)&key_cb, sizeof(key_cb));
 
 	for (i = 0; i < IPSEC_DIR_MAX; i++) {
+		int j;
+
 		LIST_INIT(&sptree[i]);
+		LIST_INIT(&spwild[i]);
+		for (j = 0; j < SPHASHSIZE; j++)
+			LIST_INIT(&sphash[i][j]);
 	}
 	ipsec_policy_count = 0;
 	
@@ -655,11 +702,11 @@ key_init(struct protosw *pp, struct domain *dp)
 	/* system default */
 #if INET
 	ip4_def_policy.policy = IPSEC_POLICY_NONE;
-	ip4_def_policy.refcnt++;	/*never reclaim this*/
+	KEY_SP_ADDREF(&ip4_def_policy);	/*never reclaim this*/
 #endif
 #if INET6
 	ip6_def_policy.policy = IPSEC_POLICY_NONE;
-	ip6_def_policy.refcnt++;	/*never reclaim this*/
+	KEY_SP_ADDREF(&ip6_def_policy);	/*never reclaim this*/
 #endif
 	
 	key_timehandler_running = 0;
@@ -699,8 +746,10 @@ key_allocsp(
 			struct secpolicyindex *spidx,
 			u_int dir)
 {
-	struct secpolicy *sp;
+	struct secpolicy *sp, *match;
 	struct timeval tv;
+	u_int32_t plens;
+	int af, i, plen;
 	
 	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_NOTOWNED);
 	/* sanity check */
@@ -721,45 +770,206 @@ key_allocsp(
 			 printf("*** objects\n");
 			 kdebug_secpolicyindex(spidx));
 	
-	lck_mtx_lock(sadb_mutex);
-	LIST_FOREACH(sp, &sptree[dir], chain) {
-		KEYDEBUG(KEYDEBUG_IPSEC_DATA,
-				 printf("*** in SPD\n");
-				 kdebug_secpolicyindex(&sp->spidx));
-		
-		if (sp->state == IPSEC_SPSTATE_DEAD)
-			continue;
-		
-		/* If the policy is disabled, skip */
-		if (sp->disabled > 0)
-			continue;
-        
-        /* If the incoming spidx specifies bound if,
-         ignore unbound policies*/
-        if (spidx->internal_if != NULL
-            && (sp->spidx.internal_if == NULL || sp->ipsec_if == NULL))
-            continue;
-        
-		if (key_cmpspidx_withmask(&sp->spidx, spidx))
-			goto found;
+	/*
+	 * The first match in SPD order wins: the first one on the
+	 * wildcard list, unless a hashed entry comes before it.
+	 */
+	match = NULL;
+	lck_rw_lock_shared(sadb_index_lock);
+	LIST_FOREACH(sp, &spwild[dir], idxchain) {
+		if (key_allocsp_match(sp, spidx)) {
+			match = sp;
+			break;
+		}
+	}
+	if ((af = key_spindex_af(&spidx->dst)) >= 0) {
+		for (i = 0; i < _ARRAYLEN(sphash_plens[dir][af]); i++) {
+			plens = sphash_plens[dir][af][i];
+			while (plens != 0) {
+				plen = (i << 5) + ffs(plens) - 1;
+				plens &= plens - 1;
+				LIST_FOREACH(sp, &sphash[dir][key_sphash(&spidx->dst,
+				    plen)], idxchain) {
+					if (sp->spidx.prefd != plen ||
+					    (match != NULL && sp->order > match->order))
+						continue;
+					if (key_allocsp_match(sp, spidx))
+						match = sp;
+				}
+			}
+		}
+	}
+	if (match == NULL) {
+		lck_rw_done(sadb_index_lock);
+		return NULL;
 	}
-	lck_mtx_unlock(sadb_mutex);
-	return NULL;
-	
-found:
 	
 	/* found a SPD entry */
 	microtime(&tv);
-	sp->lastused = tv.tv_sec;
-	sp->refcnt++;
-	lck_mtx_unlock(sadb_mutex);
+	match->lastused = tv.tv_sec;
+	KEY_SP_ADDREF(match);
+	lck_rw_done(sadb_index_lock);
 	
 	/* sanity check */
-	KEY_CHKSPDIR(sp->spidx.dir, dir, "key_allocsp");
+	KEY_CHKSPDIR(match->spidx.dir, dir, "key_allocsp");
 	KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
 	    printf("DP key_allocsp cause refcnt++:%d SP:0x%llx\n",
-	    sp->refcnt, (uint64_t)VM_KERNEL_ADDRPERM(sp)));
-	return sp;
+	    match->refcnt, (uint64_t)VM_KERNEL_ADDRPERM(match)));
+	return match;
+}
+
+/*
+ * whether the SPD entry sp applies to a packet with selector spidx.
+ */
+static int
+key_allocsp_match(
+				  struct secpolicy *sp,
+				  struct secpolicyindex *spidx)
+{
+	KEYDEBUG(KEYDEBUG_IPSEC_DATA,
+			 printf("*** in SPD\n");
+			 kdebug_secpolicyindex(&sp->spidx));
+	
+	if (sp->state == IPSEC_SPSTATE_DEAD)
+		return 0;
+	
+	/* If the policy is disabled, skip */
+	if (sp->disabled > 0)
+		return 0;
+	
+	/* If the incoming spidx specifies bound if,
+	 ignore unbound policies*/
+	if (spidx->internal_if != NULL
+	    && (sp->spidx.internal_if == NULL || sp->ipsec_if == NULL))
+		return 0;
+	
+	return key_cmpspidx_withmask(&sp->spidx, spidx);
+}
+
+/*
+ * SPD index.  Entries are hashed on their destination address masked
+ * to prefd, so a packet can only match entries in the bucket its own
+ * destination hashes to under the same prefix length.
+ */
+/* spread every input bit over the bucket index */
+static inline u_int32_t
+key_hashmix(u_int32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static int
+key_spindex_af(
+			   struct sockaddr_storage *ss)
+{
+	switch (ss->ss_family) {
+		case AF_INET:
+			return 0;
+		case AF_INET6:
+			return 1;
+		default:
+			return -1;
+	}
+}
+
+static u_int32_t
+key_sphash(
+		   struct sockaddr_storage *ss,
+		   u_int8_t plen)
+{
+	u_int32_t h, w;
+	int i, bits;
+	
+	h = plen;
+	switch (ss->ss_family) {
+		case AF_INET:
+			w = ntohl(satosin(ss)->sin_addr.s_addr);
+			if (plen == 0)
+				w = 0;
+			else if (plen < 32)
+				w &= 0xffffffff << (32 - plen);
+			h = key_hashmix(h ^ w);
+			break;
+		case AF_INET6:
+			for (i = 0; i < 4; i++) {
+				w = ntohl(satosin6(ss)->sin6_addr.s6_addr32[i]);
+				bits = plen - (i << 5);
+				if (bits <= 0)
+					w = 0;
+				else if (bits < 32)
+					w &= 0xffffffff << (32 - bits);
+				h = key_hashmix(h ^ w);
+			}
+			break;
+		default:
+			break;
+	}
+	return (h % SPHASHSIZE);
+}
+
+static void
+key_spindex_insert(
+				   struct secpolicy *sp)
+{
+	struct secpolicyindex *spidx = &sp->spidx;
+	struct secpolicy *tmpsp, *prev;
+	int af;
+	
+	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
+	lck_rw_assert(sadb_index_lock, LCK_RW_ASSERT_EXCLUSIVE);
+	
+	/* generate policies sort after all others; see key_spdadd() */
+	sp->order = ++sp_order;
+	if (sp->policy == IPSEC_POLICY_GENERATE)
+		sp->order |= SPORDER_GENERATE;
+	
+	af = key_spindex_af(&spidx->dst);
+	if (af >= 0 && spidx->dst_range.start.ss_len == 0 &&
+	    spidx->prefd <= (af == 0 ? 32 : 128)) {
+		sp->hashed = 1;
+		LIST_INSERT_HEAD(&sphash[spidx->dir][key_sphash(&spidx->dst,
+		    spidx->prefd)], sp, idxchain);
+		if (sphash_plencnt[spidx->dir][af][spidx->prefd]++ == 0)
+			sphash_plens[spidx->dir][af][spidx->prefd >> 5] |=
+			    1 << (spidx->prefd & 31);
+		return;
+	}
+	
+	sp->hashed = 0;
+	prev = NULL;
+	LIST_FOREACH(tmpsp, &spwild[spidx->dir], idxchain) {
+		if (tmpsp->order > sp->order)
+			break;
+		prev = tmpsp;
+	}
+	if (prev != NULL)
+		LIST_INSERT_AFTER(prev, sp, idxchain);
+	else
+		LIST_INSERT_HEAD(&spwild[spidx->dir], sp, idxchain);
+}
+
+static void
+key_spindex_remove(
+				   struct secpolicy *sp)
+{
+	struct secpolicyindex *spidx = &sp->spidx;
+	int af;
+	
+	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
+	lck_rw_assert(sadb_index_lock, LCK_RW_ASSERT_EXCLUSIVE);
+	
+	LIST_REMOVE(sp, idxchain);
+	if (sp->hashed) {
+		af = key_spindex_af(&spidx->dst);
+		if (--sphash_plencnt[spidx->dir][af][spidx->prefd] == 0)
+			sphash_plens[spidx->dir][af][spidx->prefd >> 5] &=
+			    ~(1 << (spidx->prefd & 31));
+	}
 }
 
 /*
@@ -832,7 +1042,7 @@ key_gettunnel(
 found:
 	microtime(&tv);
 	sp->lastused = tv.tv_sec;
-	sp->refcnt++;
+	KEY_SP_ADDREF(sp);
 	lck_mtx_unlock(sadb_mutex);
 	return sp;
 }
@@ -875,7 +1085,7 @@ struct secasvar *key_alloc_outbound_sav_for_interface(ifnet_t interface, int fam
 			
 			for (stateidx = 0; stateidx < arraysize; stateidx++) {
 				state = saorder_state_valid[stateidx];
-				sav = key_do_allocsa_policy(sah, state, dstport);
+				sav = key_do_allocsa_policy(sah, state, dstport, NULL);
 				if (sav != NULL) {
 					lck_mtx_unlock(sadb_mutex);
 					return sav;
@@ -969,28 +1179,55 @@ u_int32_t sah_search_count = 0;
 struct secasvar *
 key_allocsa_policy(
 				   struct secasindex *saidx)
+{
+	struct secasvar *sav;
+	u_int16_t	dstport;
+	int stale = 0;
+	
+	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_NOTOWNED);
+	
+	dstport = ((struct sockaddr_in *)&saidx->dst)->sin_port;
+	
+	/*
+	 * Try without sadb_mutex first.  Superseded SAs can only be
+	 * deleted with the mutex held, so if the search comes across one
+	 * do it again on the locked path.
+	 */
+	lck_rw_lock_shared(sadb_index_lock);
+	sav = key_allocsa_policy_search(saidx, dstport, &stale);
+	lck_rw_done(sadb_index_lock);
+	if (!stale)
+		return sav;
+	if (sav != NULL)
+		key_freesav(sav, KEY_SADB_UNLOCKED);
+	
+	lck_mtx_lock(sadb_mutex);
+	sav = key_allocsa_policy_search(saidx, dstport, NULL);
+	lck_mtx_unlock(sadb_mutex);
+	return sav;
+}
+
+/*
+ * the body of key_allocsa_policy(), with either sadb_mutex or
+ * sadb_index_lock held.  stalep is NULL with the mutex held; otherwise
+ * it is set if an SA should have been deleted.
+ */
+static struct secasvar *
+key_allocsa_policy_search(
+						  struct secasindex *saidx,
+						  u_int16_t dstport,
+						  int *stalep)
 {
 	struct secashead *sah;
 	struct secasvar *sav;
 	u_int stateidx, state;
 	const u_int *saorder_state_valid;
 	int arraysize;
-	struct sockaddr_in *sin;
-	u_int16_t	dstport;
 	
-	lck_mtx_lock(sadb_mutex);
 	sah_search_calls++;
-	LIST_FOREACH(sah, &sahtree, chain) {
-		sah_search_count++;
-		if (sah->state == SADB_SASTATE_DEAD)
-			continue;
-		if (key_cmpsaidx(&sah->saidx, saidx, CMP_MODE | CMP_REQID))
-			goto found;
-	}
-	lck_mtx_unlock(sadb_mutex);
-	return NULL;
-	
-found:
+	sah = key_sahhash_lookup(saidx, CMP_MODE | CMP_REQID);
+	if (sah == NULL)
+		return NULL;
 	
 	/*
 	 * search a valid state list for outbound packet.
@@ -1004,23 +1241,17 @@ found:
 		arraysize = _ARRAYLEN(saorder_state_valid_prefer_new);
 	}
 	
-	
-	sin = (struct sockaddr_in *)&saidx->dst;
-	dstport = sin->sin_port;
 	if (saidx->mode == IPSEC_MODE_TRANSPORT)
-		sin->sin_port = IPSEC_PORT_ANY;
+		((struct sockaddr_in *)&saidx->dst)->sin_port = IPSEC_PORT_ANY;
 	
 	for (stateidx = 0; stateidx < arraysize; stateidx++) {
 		
 		state = saorder_state_valid[stateidx];
 		
-		sav = key_do_allocsa_policy(sah, state, dstport);
-		if (sav != NULL) {
-			lck_mtx_unlock(sadb_mutex);
+		sav = key_do_allocsa_policy(sah, state, dstport, stalep);
+		if (sav != NULL)
 			return sav;
-		}
 	}
-	lck_mtx_unlock(sadb_mutex);
 	return NULL;
 }
 
@@ -1096,11 +1327,13 @@ static struct secasvar *
 key_do_allocsa_policy(
 					  struct secashead *sah,
 					  u_int state,
-					  u_int16_t dstport)
+					  u_int16_t dstport,
+					  int *stalep)
 {
 	struct secasvar *sav, *nextsav, *candidate, *natt_candidate, *no_natt_candidate, *d;
 	
-	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
+	if (stalep == NULL)
+		lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
 	
 	/* initialize */
 	candidate = NULL;
@@ -1180,7 +1413,10 @@ key_do_allocsa_policy(
 		 * permanent.
 		 */
 		if (d->lft_c->sadb_lifetime_addtime != 0) {
-			key_send_delete(d);
+			if (stalep != NULL)
+				*stalep = 1;
+			else
+				key_send_delete(d);
 		}
 	}
 	
@@ -1198,7 +1434,7 @@ key_do_allocsa_policy(
 		candidate = no_natt_candidate;
 	
 	if (candidate) {
-		candidate->refcnt++;
+		KEY_SAV_ADDREF(candidate);
 		KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
 		    printf("DP allocsa_policy cause "
 		    "refcnt++:%d SA:0x%llx\n", candidate->refcnt,
@@ -1267,7 +1503,7 @@ key_allocsa(
 	 */
 	match = NULL;
 	matchidx = arraysize;
-	lck_mtx_lock(sadb_mutex);
+	lck_rw_lock_shared(sadb_index_lock);
 	LIST_FOREACH(sav, &spihash[SPIHASH(spi)], spihash) {
 		if (sav->spi != spi)
 			continue;
@@ -1366,12 +1602,12 @@ key_allocsa(
 		goto found;
 	
 	/* not found */
-	lck_mtx_unlock(sadb_mutex);
+	lck_rw_done(sadb_index_lock);
 	return NULL;
 	
 found:
-	match->refcnt++;
-	lck_mtx_unlock(sadb_mutex);
+	KEY_SAV_ADDREF(match);
+	lck_rw_done(sadb_index_lock);
 	KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
 	    printf("DP allocsa cause refcnt++:%d SA:0x%llx\n",
 	    match->refcnt, (uint64_t)VM_KERNEL_ADDRPERM(match)));
@@ -1397,16 +1633,11 @@ key_natt_get_translated_port(
 	bcopy(&outsav->sah->saidx.dst, &saidx.src, sizeof(struct sockaddr_in));
 	
 	lck_mtx_lock(sadb_mutex);
-	LIST_FOREACH(sah, &sahtree, chain) {
-		if (sah->state == SADB_SASTATE_DEAD)
-			continue;
-		if (key_cmpsaidx(&sah->saidx, &saidx, CMP_MODE))
-			goto found;
+	if ((sah = key_sahhash_lookup(&saidx, CMP_MODE)) == NULL) {
+		lck_mtx_unlock(sadb_mutex);
+		return 0;
 	}
-	lck_mtx_unlock(sadb_mutex);
-	return 0;
 	
-found:
 	/*
 	 * Found sah - now go thru list of SAs and find
 	 * matching remote ike port.  If found - set
@@ -1511,11 +1742,17 @@ key_freesp(
 	if (sp == NULL)
 		panic("key_freesp: NULL pointer is passed.\n");
 	
-	if (!locked)
+	if (!locked) {
+		if (key_release_unlocked(&sp->refcnt)) {
+			KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
+			    printf("DP freesp cause refcnt--:%d SP:0x%llx\n",
+			    sp->refcnt, (uint64_t)VM_KERNEL_ADDRPERM(sp)));
+			return;
+		}
 		lck_mtx_lock(sadb_mutex);
-	else
+	} else
 		lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
-	sp->refcnt--;
+	OSDecrementAtomic((volatile SInt32 *)&sp->refcnt);
 	KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
 	    printf("DP freesp cause refcnt--:%d SP:0x%llx\n",
 	    sp->refcnt, (uint64_t)VM_KERNEL_ADDRPERM(sp)));
@@ -1542,11 +1779,19 @@ key_freesav(
 	if (sav == NULL)
 		panic("key_freesav: NULL pointer is passed.\n");
 	
-	if (!locked)
+	if (!locked) {
+		if (key_release_unlocked(&sav->refcnt)) {
+			KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
+			    printf("DP freesav cause refcnt--:%d SA:0x%llx "
+			    "SPI %u\n", sav->refcnt,
+			    (uint64_t)VM_KERNEL_ADDRPERM(sav),
+			    (u_int32_t)ntohl(sav->spi)));
+			return;
+		}
 		lck_mtx_lock(sadb_mutex);
-	else
+	} else
 		lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
-	sav->refcnt--;
+	OSDecrementAtomic((volatile SInt32 *)&sav->refcnt);
 	KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
 	    printf("DP freesav cause refcnt--:%d SA:0x%llx SPI %u\n",
 	    sav->refcnt, (uint64_t)VM_KERNEL_ADDRPERM(sav),
@@ -1559,6 +1804,26 @@ key_freesav(
 	return;
 }
 
+/*
+ * Drop a reference without sadb_mutex, unless it is the last one.  The
+ * last one has to go under the mutex, where key_delsp()/key_delsav()
+ * unlink and free the entry; code holding the mutex may still take
+ * references to dead entries.  Returns 1 if the reference was dropped.
+ */
+static int
+key_release_unlocked(
+					 int *refcnt)
+{
+	SInt32 old;
+	
+	do {
+		old = *(volatile int *)refcnt;
+		if (old <= 1)
+			return 0;
+	} while (!OSCompareAndSwap(old, old - 1, (volatile UInt32 *)refcnt));
+	return 1;
+}
+
 /* %%% SPD management */
 /*
  * free security policy entry.
@@ -1579,10 +1844,18 @@ key_delsp(
 		return; /* can't free */
 	
 	/* remove from SP index */
+	lck_rw_lock_exclusive(sadb_index_lock);
+	if (sp->refcnt > 0) {
+		/* a lookup got to it before it was unlinked */
+		lck_rw_done(sadb_index_lock);
+		return;
+	}
 	if (__LIST_CHAINED(sp)) {
 		LIST_REMOVE(sp, chain);
+		key_spindex_remove(sp);
 		ipsec_policy_count--;
 	}
+	lck_rw_done(sadb_index_lock);
 	
     if (sp->spidx.internal_if) {
         ifnet_release(sp->spidx.internal_if);
@@ -1634,7 +1907,7 @@ key_getsp(
 		if (sp->state == IPSEC_SPSTATE_DEAD)
 			continue;
 		if (key_cmpspidx_exactly(spidx, &sp->spidx)) {
-			sp->refcnt++;
+			KEY_SP_ADDREF(sp);
 			return sp;
 		}
 	}
@@ -1673,7 +1946,7 @@ __key_getspbyid(u_int32_t id)
 		if (sp->state == IPSEC_SPSTATE_DEAD)
 			continue;
 		if (sp->id == id) {
-			sp->refcnt++;
+			KEY_SP_ADDREF(sp);
 			return sp;
 		}
 	}
@@ -1682,7 +1955,7 @@ __key_getspbyid(u_int32_t id)
 		if (sp->state == IPSEC_SPSTATE_DEAD)
 			continue;
 		if (sp->id == id) {
-			sp->refcnt++;
+			KEY_SP_ADDREF(sp);
 			return sp;
 		}
 	}
@@ -2400,6 +2673,7 @@ key_spdadd(
 	newsp->refcnt = 1;	/* do not reclaim until I say I do */
 	newsp->state = IPSEC_SPSTATE_ALIVE;
 	lck_mtx_lock(sadb_mutex);
+	lck_rw_lock_exclusive(sadb_index_lock);
 	/*
 	 * policies of type generate should be at the end of the SPD
 	 * because they function as default discard policies
@@ -2419,6 +2693,8 @@ key_spdadd(
 			LIST_INSERT_TAIL(&sptree[newsp->spidx.dir], newsp, secpolicy, chain);
 		key_start_timehandler();
 	}
+	key_spindex_insert(newsp);
+	lck_rw_done(sadb_index_lock);
 	
 	ipsec_policy_count++;
 	/* Turn off the ipsec bypass */
@@ -3124,7 +3400,7 @@ key_spddump(
 			if (cnt == bufcount)
 				break;		/* buffer full */
 			*sp_ptr++ = sp;
-			sp->refcnt++;
+			KEY_SP_ADDREF(sp);
 			cnt++;
 		}
 	}
@@ -3496,7 +3772,11 @@ key_newsah(struct secasindex *saidx,
 	newsah->dir = dir;
 	/* add to saidxtree */
 	newsah->state = SADB_SASTATE_MATURE;
+	lck_rw_lock_exclusive(sadb_index_lock);
 	LIST_INSERT_HEAD(&sahtree, newsah, chain);
+	LIST_INSERT_HEAD(&sahhash[key_sahhash(&newsah->saidx)], newsah,
+	    addrhash);
+	lck_rw_done(sadb_index_lock);
 	key_start_timehandler();
 
 	return(newsah);
@@ -3568,8 +3848,12 @@ key_delsah(
     }
 	
 	/* remove from tree of SA index */
-	if (__LIST_CHAINED(sah))
+	lck_rw_lock_exclusive(sadb_index_lock);
+	if (__LIST_CHAINED(sah)) {
 		LIST_REMOVE(sah, chain);
+		LIST_REMOVE(sah, addrhash);
+	}
+	lck_rw_done(sadb_index_lock);
 	
 	KFREE(sah);
 	
@@ -3727,8 +4011,10 @@ key_newsav(
 	newsav->sah = sah;
 	newsav->refcnt = 1;
 	newsav->state = SADB_SASTATE_LARVAL;
+	lck_rw_lock_exclusive(sadb_index_lock);
 	LIST_INSERT_TAIL(&sah->savtree[SADB_SASTATE_LARVAL], newsav,
 					 secasvar, chain);
+	lck_rw_done(sadb_index_lock);
 	ipsec_sav_count++;
 	
 	return newsav;
@@ -3823,6 +4109,7 @@ key_newsav2(struct secashead     *sah,
 	/* add to satree */
 	newsav->sah = sah;
 	newsav->refcnt = 1;
+	lck_rw_lock_exclusive(sadb_index_lock);
 	if (spi && key_auth && key_auth_len && key_enc && key_enc_len) {
 		newsav->state = SADB_SASTATE_MATURE;
 		LIST_INSERT_TAIL(&sah->savtree[SADB_SASTATE_MATURE], newsav,
@@ -3832,6 +4119,7 @@ key_newsav2(struct secashead     *sah,
 		LIST_INSERT_TAIL(&sah->savtree[SADB_SASTATE_LARVAL], newsav,
 						 secasvar, chain);
 	}
+	lck_rw_done(sadb_index_lock);
 	ipsec_sav_count++;
 	
 	return newsav;
@@ -3846,11 +4134,13 @@ key_migratesav(struct secasvar *sav,
 	}
 	
 	/* remove from SA header */
+	lck_rw_lock_exclusive(sadb_index_lock);
 	if (__LIST_CHAINED(sav))
 		LIST_REMOVE(sav, chain);
 	
 	sav->sah = newsah;
 	LIST_INSERT_TAIL(&newsah->savtree[SADB_SASTATE_MATURE], sav, secasvar, chain);
+	lck_rw_done(sadb_index_lock);
 	return 0;
 }
 
@@ -3872,12 +4162,14 @@ key_delsav(
 		return;		/* can't free */
 	
 	/* remove from SA header */
+	lck_rw_lock_exclusive(sadb_index_lock);
 	if (__LIST_CHAINED(sav))
 		LIST_REMOVE(sav, chain);
 	ipsec_sav_count--;
 	
 	if (sav->spihash.le_prev || sav->spihash.le_next)
 		LIST_REMOVE(sav, spihash);
+	lck_rw_done(sadb_index_lock);
 	
 	if (sav->key_auth != NULL) {
 		bzero(_KEYBUF(sav->key_auth), _KEYLEN(sav->key_auth));
@@ -3914,6 +4206,12 @@ key_delsav(
 		KFREE(sav->iv);
 		sav->iv = NULL;
 	}
+#if IPSEC_ESP
+	if (sav->async != NULL) {
+		esp_async_order_free(sav->async);
+		sav->async = NULL;
+	}
+#endif
 	
 	KFREE(sav);
 	
@@ -3929,14 +4227,51 @@ key_delsav(
 static struct secashead *
 key_getsah(struct secasindex *saidx)
 {
-	struct secashead *sah;
-	
 	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
 	
-	LIST_FOREACH(sah, &sahtree, chain) {
+	return key_sahhash_lookup(saidx, CMP_REQID);
+}
+
+/*
+ * SA heads are hashed by protocol and destination address, which every
+ * key_cmpsaidx() mode compares exactly; a bucket keeps sahtree order.
+ */
+static u_int32_t
+key_sahhash(struct secasindex *saidx)
+{
+	u_int32_t h;
+	int i;
+	
+	h = saidx->proto;
+	switch (saidx->dst.ss_family) {
+		case AF_INET:
+			h ^= ((struct sockaddr_in *)&saidx->dst)->sin_addr.s_addr;
+			break;
+		case AF_INET6:
+			for (i = 0; i < 4; i++)
+				h ^= ((struct sockaddr_in6 *)&saidx->dst)->
+				    sin6_addr.s6_addr32[i];
+			break;
+		default:
+			break;
+	}
+	return (key_hashmix(h) % SAHHASHSIZE);
+}
+
+/*
+ * first live SA head matching saidx, in sahtree order.  Needs sadb_mutex
+ * or sadb_index_lock.
+ */
+static struct secashead *
+key_sahhash_lookup(struct secasindex *saidx, int flag)
+{
+	struct secashead *sah;
+	
+	LIST_FOREACH(sah, &sahhash[key_sahhash(saidx)], addrhash) {
+		sah_search_count++;
 		if (sah->state == SADB_SASTATE_DEAD)
 			continue;
-		if (key_cmpsaidx(&sah->saidx, saidx, CMP_REQID))
+		if (key_cmpsaidx(&sah->saidx, saidx, flag))
 			return sah;
 	}
 	
@@ -4004,10 +4339,12 @@ key_setspi(
 		   u_int32_t spi)
 {
 	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
+	lck_rw_lock_exclusive(sadb_index_lock);
 	sav->spi = spi;
 	if (sav->spihash.le_prev || sav->spihash.le_next)
 		LIST_REMOVE(sav, spihash);
 	LIST_INSERT_HEAD(&spihash[SPIHASH(spi)], sav, spihash);
+	lck_rw_done(sadb_index_lock);
 }
 
 
@@ -5898,7 +6235,7 @@ key_timehandler(void)
 							&& tv.tv_sec - sp->lastused > sp->validtime)) {
 							//key_spdexpire(sp);
 							sp->state = IPSEC_SPSTATE_DEAD;
-							sp->refcnt++;
+							KEY_SP_ADDREF(sp);
 							*spptr++ = sp;
 							spcount++;
 						}
@@ -5984,7 +6321,7 @@ key_timehandler(void)
 				sav = LIST_FIRST(&sah->savtree[SADB_SASTATE_MATURE]);	//%%% should we check dying list if this is empty???
 				if (sav && (natt_keepalive_interval || sav->natt_interval) &&
 					(sav->flags & (SADB_X_EXT_NATT_KEEPALIVE | SADB_X_EXT_ESP_KEEPALIVE)) != 0) {
-					sav->refcnt++;
+					KEY_SAV_ADDREF(sav);
 					*savkaptr++ = sav;
 					savkacount++;
 				}
@@ -6027,7 +6364,7 @@ key_timehandler(void)
 						sav = NULL;
 					} else if (savexbuf && savexcount < savbufcount) {
 						key_sa_chgstate(sav, SADB_SASTATE_DYING);
-						sav->refcnt++;
+						KEY_SAV_ADDREF(sav);
 						*savexptr++ = sav;
 						savexcount++;
 					}
@@ -6050,7 +6387,7 @@ key_timehandler(void)
 					 */
 					//key_expire(sav);
 					key_sa_chgstate(sav, SADB_SASTATE_DYING);
-					sav->refcnt++;
+					KEY_SAV_ADDREF(sav);
 					*savexptr++ = sav;
 					savexcount++;
 				}
@@ -6102,7 +6439,7 @@ key_timehandler(void)
 					 * expire message.
 					 */
 					//key_expire(sav);
-					sav->refcnt++;
+					KEY_SAV_ADDREF(sav);
 					*savexptr++ = sav;
 					savexcount++;
 				}
@@ -7140,7 +7477,7 @@ key_getsavbyseq(
 		KEY_CHKSASTATE(state, sav->state, "key_getsabyseq");
 		
 		if (sav->seq == seq) {
-			sav->refcnt++;
+			KEY_SAV_ADDREF(sav);
 			KEYDEBUG(KEYDEBUG_IPSEC_STAMP,
 			    printf("DP key_getsavbyseq cause "
 			    "refcnt++:%d SA:0x%llx\n", sav->refcnt,
@@ -9051,7 +9388,7 @@ key_dump(
 					break;		/* out of buffer space */
 				elem_ptr->sav = sav;
 				elem_ptr->satype = satype;
-				sav->refcnt++;
+				KEY_SAV_ADDREF(sav);
 				elem_ptr++;
 				cnt++;
 			}
@@ -9853,12 +10190,13 @@ key_sa_chgstate(
 	
 	lck_mtx_assert(sadb_mutex, LCK_MTX_ASSERT_OWNED);
 	
+	lck_rw_lock_exclusive(sadb_index_lock);
 	if (__LIST_CHAINED(sav))
 		LIST_REMOVE(sav, chain);
 	
 	sav->state = state;
 	LIST_INSERT_HEAD(&sav->sah->savtree[state], sav, chain);
-	
+	lck_rw_done(sadb_index_lock);
 }
 
 void
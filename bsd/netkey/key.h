@@ -35,9 +35,18 @@
 
 #ifdef BSD_KERNEL_PRIVATE
 
+#include <libkern/OSAtomic.h>
+
 #define KEY_SADB_UNLOCKED	0
 #define KEY_SADB_LOCKED		1
 
+/*
+ * References may be taken without sadb_mutex held; the matching
+ * key_freesp()/key_freesav() only takes the mutex for the last one.
+ */
+#define	KEY_SP_ADDREF(sp)	OSIncrementAtomic((volatile SInt32 *)&(sp)->refcnt)
+#define	KEY_SAV_ADDREF(sav)	OSIncrementAtomic((volatile SInt32 *)&(sav)->refcnt)
+
 extern struct key_cb key_cb;
 
 struct secpolicy;
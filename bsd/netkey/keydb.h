@@ -53,6 +53,7 @@ struct secasindex {
 /* Security Association Data Base */
 struct secashead {
 	LIST_ENTRY(secashead) chain;
+	LIST_ENTRY(secashead) addrhash;	/* sahhash, by proto and dst */
 
 	struct secasindex saidx;
 
@@ -120,6 +121,8 @@ struct secasvar {
 	void              *utun_pcb;
 	utun_is_keepalive_func    utun_is_keepalive_fn;
 	utun_input_func    utun_in_fn;
+
+	struct esp_async_order *async;	/* ordering of async crypto jobs */
 };
 
 /* replay prevention */
@@ -1644,6 +1644,46 @@ extern errno_t mbuf_get_driver_scratch(mbuf_t m, u_int8_t **area,
  */
 extern errno_t mbuf_get_unsent_data_bytes(const mbuf_t m,
     u_int32_t *unsent_data);
+
+/*!
+	@function mbuf_allocpacket_array
+	@discussion Allocate a batch of packets for a driver receive ring.
+		Each packet is a single mbuf with the packet header flag set
+		and a cluster of bufsize bytes attached; its length and the
+		packet header length are preset to bufsize so that the buffer
+		can be posted to the hardware as is.  All of the mbufs and
+		clusters are obtained from the allocator in a single pass,
+		which is considerably cheaper than calling mbuf_getpacket()
+		or mbuf_allocpacket() once per ring slot.  The allocation is
+		not all-or-nothing; fewer packets than requested may be
+		returned when buffers are scarce.
+	@param how Blocking or non-blocking.  Even when blocking, this
+		will not wait for the entire request to be satisfied.
+	@param bufsize Size of the cluster attached to each packet; must be
+		one of MCLBYTES, MBIGCLBYTES or M16KCLBYTES (the latter only
+		if jumbo clusters are configured).
+	@param array Array of at least *count entries, filled in with the
+		allocated packets starting at index 0.
+	@param count On input, the number of packets requested.  On output,
+		the number of packets placed in the array.
+	@result 0 upon success (at least one packet allocated) or the
+		following error code:
+		EINVAL - Invalid parameter
+		ENOMEM - No packets could be allocated
+ */
+extern errno_t mbuf_allocpacket_array(mbuf_how_t how, size_t bufsize,
+    mbuf_t *array, unsigned int *count);
+
+/*!
+	@function mbuf_freem_array
+	@discussion Free the packets (including any chained mbufs) held in
+		an array in a single pass.  NULL entries are skipped, and
+		every entry is set to NULL upon return.
+	@param array Array of packets to free.
+	@param count Number of entries in the array.
+	@result The number of packets freed.
+ */
+extern unsigned int mbuf_freem_array(mbuf_t *array, unsigned int count);
 #endif /* KERNEL_PRIVATE */
 
 #ifdef XNU_KERNEL_PRIVATE
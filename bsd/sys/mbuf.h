@@ -90,9 +90,9 @@
 /*
  * Mbufs are of a single size, MSIZE (machine/param.h), which
  * includes overhead.  An mbuf may add a single "mbuf cluster" of size
- * MCLBYTES/MBIGCLBYTES/M16KCLBYTES (also in machine/param.h), which has
- * no additional overhead and is used instead of the internal data area;
- * this is done when at least MINCLSIZE of data must be stored.
+ * MCLBYTES/MBIGCLBYTES/M16KCLBYTES/M64KCLBYTES (also in machine/param.h),
+ * which has no additional overhead and is used instead of the internal data
+ * area; this is done when at least MINCLSIZE of data must be stored.
  */
 
 /*
@@ -118,6 +118,9 @@
 #define	NCLPJCLSHIFT	(M16KCLSHIFT - MCLSHIFT)
 #define	NCLPJCL		(1 << NCLPJCLSHIFT)	/* # of cl per jumbo cl */
 
+#define	NCLPJ64CLSHIFT	(M64KCLSHIFT - MCLSHIFT)
+#define	NCLPJ64CL	(1 << NCLPJ64CLSHIFT)	/* # of cl per 64KB jumbo cl */
+
 #define	NCLPBGSHIFT	(MBIGCLSHIFT - MCLSHIFT)
 #define	NCLPBG		(1 << NCLPBGSHIFT)	/* # of cl per big cl */
 
@@ -678,6 +681,14 @@ union m16kcluster {
 	char			m16kcl_buf[M16KCLBYTES];
 };
 
+/*
+ * Mbuf 64KB jumbo cluster
+ */
+union m64kcluster {
+	union m64kcluster	*m64kcl_next;
+	char			m64kcl_buf[M64KCLBYTES];
+};
+
 #define	MCLHASREFERENCE(m)	m_mclhasreference(m)
 
 /*
@@ -803,7 +814,8 @@ do {									\
 do {									\
 	if (!(m->m_flags & MBUF_PKTHDR) ||				\
 	    m->m_len < 0 ||						\
-	    m->m_len > ((njcl > 0) ? njclbytes : MBIGCLBYTES) ||	\
+	    m->m_len > ((nj64cl > 0) ? M64KCLBYTES :			\
+	    ((njcl > 0) ? njclbytes : MBIGCLBYTES)) ||			\
 	    m->m_type == MT_FREE ||					\
 	    ((m->m_flags & M_EXT) != 0 && m->m_ext.ext_buf == NULL)) {	\
 		panic_plain("Failed mbuf validity check: mbuf %p len %d "  \
@@ -1068,6 +1080,43 @@ struct mleak_table {
 	/* Times mleak_log returned false because couldn't acquire the lock */
 	u_int64_t total_conflicts;
 };
+
+/*
+ * Driver receive ring refill benchmark (kern.ipc.mb_refill_bench, DEBUG
+ * and DEVELOPMENT kernels only).  Each round refills a ring of mrb_ringsize
+ * packets and then frees them, once with one m_allocpacket_internal()/
+ * m_freem() per packet, as mbuf_allocpacket() does for drivers, and once
+ * with m_getpackets_array()/m_freem_array().
+ */
+struct mb_refill_bench {
+	u_int32_t	mrb_ringsize;	/* in: packets per refill */
+	u_int32_t	mrb_rounds;	/* in: refill/drain rounds */
+	u_int32_t	mrb_bufsize;	/* in: cluster size */
+	u_int32_t	mrb_pad;
+	u_int64_t	mrb_packets;	/* out: packets allocated per method */
+	u_int64_t	mrb_single_ns;	/* out: time taken one at a time */
+	u_int64_t	mrb_bulk_ns;	/* out: time taken in batches */
+};
+
+/*
+ * 64KB cluster exercise (kern.ipc.mb_jcl64k_test, DEBUG and DEVELOPMENT
+ * kernels only; ENOTSUP unless the mbuf_jcl64k boot-arg set up the pool).
+ * Each round allocates and frees mjt_count bare MC_64KCL clusters, then
+ * as many MC_MBUF_64KCL packets; the caches are then purged and m_drain()
+ * called, and the size of the 64KB cluster pool is reported throughout.
+ */
+struct mb_jcl64k_test {
+	u_int32_t	mjt_count;	/* in: clusters per round */
+	u_int32_t	mjt_rounds;	/* in: alloc/free rounds */
+	u_int64_t	mjt_raw;	/* out: bare clusters allocated */
+	u_int64_t	mjt_composite;	/* out: mbuf+cluster allocated */
+	u_int64_t	mjt_raw_ns;	/* out: time taken for bare clusters */
+	u_int64_t	mjt_composite_ns; /* out: time taken for composites */
+	u_int32_t	mjt_total_before; /* out: pool size at start */
+	u_int32_t	mjt_total_peak;	/* out: pool size, all allocated */
+	u_int32_t	mjt_total_after; /* out: pool size after drain */
+	u_int32_t	mjt_drained;	/* out: m_drain() did run */
+};
 #endif /* PRIVATE */
 
 #ifdef KERNEL_PRIVATE
@@ -1246,6 +1295,7 @@ extern unsigned char *embutl;	/* end VA of mbuf pool */
 extern unsigned int nmbclusters;	/* number of mapped clusters */
 extern int njcl;		/* # of jumbo clusters  */
 extern int njclbytes;	/* size of a jumbo cluster */
+extern int nj64cl;		/* # of 64KB jumbo clusters */
 extern int max_hdr;		/* largest link+protocol header */
 extern int max_datalen;	/* MHLEN - max_hdr */
 
@@ -1265,6 +1315,9 @@ __private_extern__ struct mbuf *m_mbigget(struct mbuf *, int);
 __private_extern__ caddr_t m_16kalloc(int);
 __private_extern__ void m_16kfree(caddr_t, u_int, caddr_t);
 __private_extern__ struct mbuf *m_m16kget(struct mbuf *, int);
+__private_extern__ caddr_t m_64kalloc(int);
+__private_extern__ void m_64kfree(caddr_t, u_int, caddr_t);
+__private_extern__ struct mbuf *m_m64kget(struct mbuf *, int);
 __private_extern__ int m_reinit(struct mbuf *, int);
 __private_extern__ struct mbuf *m_free(struct mbuf *);
 __private_extern__ struct mbuf *m_getclr(int, int);
@@ -1288,6 +1341,7 @@ __private_extern__ struct mbuf *m_pulldown(struct mbuf *, int, int, int *);
 __private_extern__ struct mbuf *m_getcl(int, int, int);
 __private_extern__ caddr_t m_mclalloc(int);
 __private_extern__ int m_mclhasreference(struct mbuf *);
+__private_extern__ int m_mclwritable(struct mbuf *);
 __private_extern__ void m_copy_pkthdr(struct mbuf *, struct mbuf *);
 __private_extern__ void m_copy_pftag(struct mbuf *, struct mbuf *);
 __private_extern__ void m_copy_classifier(struct mbuf *, struct mbuf *);
@@ -1316,6 +1370,9 @@ __private_extern__ struct mbuf *m_getpackets_internal(unsigned int *, int,
     int, int, size_t);
 __private_extern__ struct mbuf *m_allocpacket_internal(unsigned int *, size_t,
     unsigned int *, int, int, size_t);
+__private_extern__ unsigned int m_getpackets_array(struct mbuf **,
+    unsigned int, int, size_t);
+__private_extern__ unsigned int m_freem_array(struct mbuf **, unsigned int);
 
 __private_extern__ void m_drain(void);
 
@@ -1406,6 +1463,8 @@ __private_extern__ mbuf_traffic_class_t m_get_traffic_class(struct mbuf *);
 __private_extern__ u_int16_t m_adj_sum16(struct mbuf *, u_int32_t,
     u_int32_t, u_int32_t);
 __private_extern__ u_int16_t m_sum16(struct mbuf *, u_int32_t, u_int32_t);
+__private_extern__ u_int16_t m_copydata_sum16(struct mbuf *, u_int32_t,
+    u_int32_t, void *);
 
 __END_DECLS
 #endif /* XNU_KERNEL_PRIVATE */
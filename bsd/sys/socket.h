@@ -1232,8 +1232,11 @@ extern int socket_delegate(int, int, int, pid_t);
  * recvmsg_x() is a system call similar to recvmsg(2) to receive
  * several datagrams at once in the array of message headers "msgp".
  *
- * recvmsg_x() can be used only with protocols handlers that have been specially
- * modified to support sending and receiving several datagrams at once.
+ * recvmsg_x() is most efficient with protocols handlers that have been
+ * specially modified to support sending and receiving several datagrams at
+ * once.  On stream sockets the buffers of consecutive messages that do not
+ * ask for an address or ancillary data are filled in order by a single
+ * receive, as if by readv(2); only the first receive may block.
  * 
  * The size of the array "msgp" is given by the argument "cnt".
  *
@@ -1264,8 +1267,10 @@ ssize_t recvmsg_x(int s, const struct msghdr_x *msgp, u_int cnt, int flags);
  * sendmsg_x() is a system call similar to send(2) to send
  * several datagrams at once in the array of message headers "msgp".
  *
- * sendmsg_x() can be used only with protocols handlers that have been specially
- * modified to support sending and receiving several datagrams at once.
+ * sendmsg_x() is most efficient with protocols handlers that have been
+ * specially modified to support sending and receiving several datagrams at
+ * once.  On stream sockets consecutive messages without an address,
+ * ancillary data or flags are sent with a single send, as if by writev(2).
  * 
  * The size of the array "msgp" is given by the argument "cnt".
  *
@@ -1279,11 +1284,12 @@ ssize_t recvmsg_x(int s, const struct msghdr_x *msgp, u_int cnt, int flags);
  * sendmsg_x() fails with EMSGSIZE if the sum of the length of the datagrams
  * is greater than the high water mark.
  *
- * Address and ancillary data are not supported so the following fields
- * must be set to zero on input:
- *   "msg_name", "msg_namelen", "msg_control" and "msg_controllen".
+ * Messages with an address or ancillary data ("msg_name", "msg_control")
+ * are sent one at a time, as by sendmsg(2).
  *
- * The field "msg_flags" and "msg_datalen" must be set to zero on input. 
+ * The field "msg_flags" may hold MSG_OOB, MSG_DONTROUTE or MSG_EOR to apply
+ * to that message only.  The field "msg_datalen" must be set to zero on
+ * input.
  *
  * sendmsg_x() returns the number of datagrams that have been sent,
  * or -1 if an error occurred. 
@@ -334,8 +334,18 @@ struct socket {
 #define	SOF1_EXTEND_BK_IDLE_INPROG	0x00000080 /* socket */
 #define	SOF1_CACHED_IN_SOCK_LAYER	0x00000100 /* bundled with inpcb and
 						      tcpcb */
+#define	SOF1_TLS_RX		0x00000200 /* kernel TLS opens records */
 
 	u_int64_t	so_extended_bk_start;
+
+	/*
+	 * Snapshots of the so_rcv and so_snd byte counts, republished
+	 * with the socket lock held whenever they change, so that the
+	 * readiness checks in the kevent filters can be made without
+	 * taking the socket lock; see sbsnap_update().
+	 */
+	u_int64_t	so_rcv_snap;
+	u_int64_t	so_snd_snap;
 };
 
 /* Control message accessor in mbufs */
@@ -640,6 +650,16 @@ struct sf_buf {
 		    (sb)->sb_mb, (sb)->sb_cc);				\
 } while(0)
 
+/*
+ * Accessors for a socket buffer snapshot (so_rcv_snap/so_snd_snap).  The
+ * low 32 bits hold sb_cc; the high 32 bits hold sb_ctl for the receive
+ * buffer and sb_mbcnt for the send buffer, i.e. the other count each
+ * side needs to go along with sb_cc.  Both are read with a single load.
+ */
+#define	SBSNAP_READ(snapp)	(*(volatile u_int64_t *)(snapp))
+#define	SBSNAP_CC(snap)		((u_int32_t)(snap))
+#define	SBSNAP_AUX(snap)	((u_int32_t)((snap) >> 32))
+
 #define	SODEFUNCTLOG(x)		do { if (sodefunctlog) printf x; } while (0)
 #define	SOTHROTTLELOG(x)	do { if (sothrottlelog) printf x; } while (0)
 
@@ -678,6 +698,8 @@ extern so_gen_t so_gencnt;
 extern int socket_debug;
 extern int sosendjcl;
 extern int sosendjcl_ignore_capab;
+extern int sosendjcl64k;
+extern int so_filt_nolock;
 extern int sodefunctlog;
 extern int sothrottlelog;
 extern int sorestrictrecv;
@@ -800,6 +822,8 @@ extern int sb_notify(struct sockbuf *sb);
 extern void sballoc(struct sockbuf *sb, struct mbuf *m);
 extern void sbfree(struct sockbuf *sb, struct mbuf *m);
 extern void sbfree_chunk(struct sockbuf *sb, struct mbuf *m);
+extern void sbsnap_update(struct sockbuf *sb);
+extern int sbspace_nolock(struct sockbuf *sb);
 
 /*
  * Flags to sblock().
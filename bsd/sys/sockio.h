@@ -274,6 +274,9 @@
 
 #define	SIOCGECNMODE		_IOWR('i', 176, struct ifreq)
 #define	SIOCSECNMODE		_IOW('i', 177, struct ifreq)
+
+#define	SIOCGIFQALG		_IOWR('i', 178, struct ifreq) /* get queue algorithm */
+#define	SIOCSIFQALG		_IOW('i', 179, struct ifreq) /* set queue algorithm */
 #endif /* PRIVATE */
 
 #endif /* !_SYS_SOCKIO_H_ */
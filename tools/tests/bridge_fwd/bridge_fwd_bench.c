@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Forwarding rate of a model of if_bridge with synthetic member
+ * interfaces, for the two ways bsd/net/if_bridge.c forwards a unicast
+ * frame to a known host:
+ *
+ *   locked	the frame goes through bridge_input() and bridge_forward()
+ *		with the bridge lock held: the member checks, learning of
+ *		the source (its age stored on every frame) and the lookup
+ *		of the destination
+ *   fast	bridge_forward_fast(): the same checks and lookups with no
+ *		lock, validated against the route hash sequence count, from
+ *		within a per-CPU reader section; the source's age is stored
+ *		only when it changes
+ *
+ * Each input thread sends frames between random hosts behind different
+ * members; a member's output is a counter under its own lock, standing
+ * in for its send queue.  A writer thread keeps adding and removing
+ * hosts the whole time, as learning and aging do, and removed nodes
+ * are poisoned once freed, so a lookup that touched one is caught.
+ * Fails if a frame is sent to the wrong member or goes missing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#define	NMEMBERS	32		/* tens of guests */
+#define	NHOSTS		4		/* hosts behind each member */
+#define	NBUCKETS	64
+#define	NFRAMES		(1 << 16)	/* per input thread, repeated */
+#define	MAX_THREADS	8
+#define	RUN_SECONDS	1
+#define	TIMEOUT		1200		/* BRIDGE_RTABLE_TIMEOUT */
+#define	CACHE_LINE	64
+
+#define	barrier()	__sync_synchronize()
+
+struct member {
+	pthread_mutex_t	lock;		/* send queue */
+	uint64_t	sent;
+	uint8_t		lladdr[6];
+	int		private;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct rtnode {
+	LIST_ENTRY(rtnode) hash;
+	LIST_ENTRY(rtnode) limbo;
+	struct member	*dst;
+	unsigned long	expire;
+	uint32_t	gen;
+	uint8_t		addr[6];
+};
+
+struct frame {
+	uint8_t		dhost[6], shost[6];
+	struct member	*src, *dst;
+};
+
+LIST_HEAD(rtlist, rtnode);
+
+static struct member members[NMEMBERS];
+static struct rtlist rthash[NBUCKETS];
+static pthread_mutex_t sc_mtx = PTHREAD_MUTEX_INITIALIZER;
+static volatile uint32_t rtseq;
+static volatile uint32_t rd_gen;
+static struct rtlist limbo;
+static struct {
+	volatile int32_t n[2];
+} __attribute__((aligned(CACHE_LINE))) readers[MAX_THREADS];
+
+static volatile unsigned long uptime;
+static volatile int stop;
+static int fast;
+static uint64_t misdelivered, retries, churn;
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static uint32_t
+rthash_of(const uint8_t *a)
+{
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		h = (h ^ a[i]) * 16777619U;
+	return (h % NBUCKETS);
+}
+
+static void
+host_addr(uint8_t *a, uint32_t member, uint32_t host)
+{
+	a[0] = 0x02;
+	a[1] = 0;
+	a[2] = host >> 8;
+	a[3] = host;
+	a[4] = member >> 8;
+	a[5] = member;
+}
+
+/* bridge_rtnode_lookup(); chains are sorted, descending */
+static struct rtnode *
+rtlookup(const uint8_t *a)
+{
+	struct rtnode *brt;
+	int d;
+
+	LIST_FOREACH(brt, &rthash[rthash_of(a)], hash) {
+		d = memcmp(a, brt->addr, 6);
+		if (d == 0)
+			return (brt);
+		if (d > 0)
+			return (NULL);
+	}
+	return (NULL);
+}
+
+/* bridge_rtnode_hash() and bridge_rtnode_publish(), lock held */
+static void
+rtinsert(struct rtnode *brt)
+{
+	struct rtnode **prevp, *next;
+
+	rtseq++;
+	barrier();
+	prevp = &LIST_FIRST(&rthash[rthash_of(brt->addr)]);
+	while ((next = *prevp) != NULL && memcmp(brt->addr, next->addr, 6) < 0)
+		prevp = &LIST_NEXT(next, hash);
+	brt->hash.le_next = next;
+	brt->hash.le_prev = prevp;
+	if (next != NULL)
+		next->hash.le_prev = &brt->hash.le_next;
+	barrier();
+	*prevp = brt;
+	barrier();
+	rtseq++;
+}
+
+static uint32_t
+rd_count(uint32_t g)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < MAX_THREADS; i++)
+		n += readers[i].n[g & 1];
+	return (n);
+}
+
+/* bridge_rtnode_destroy() and bridge_rtreclaim(), lock held */
+static void
+rtremove(struct rtnode *brt)
+{
+	struct rtnode *n, *tn;
+	uint32_t g;
+
+	rtseq++;
+	barrier();
+	LIST_REMOVE(brt, hash);
+	barrier();
+	rtseq++;
+	brt->gen = rd_gen;
+	LIST_INSERT_HEAD(&limbo, brt, limbo);
+
+	g = rd_gen;
+	if (rd_count(g - 1) != 0)
+		return;
+	for (n = LIST_FIRST(&limbo); n != NULL; n = tn) {
+		tn = LIST_NEXT(n, limbo);
+		if (n->gen == g)
+			continue;
+		LIST_REMOVE(n, limbo);
+		memset(n, 0xa5, sizeof (*n));
+		free(n);
+	}
+	if (!LIST_EMPTY(&limbo)) {
+		barrier();
+		rd_gen = g + 1;
+		barrier();
+	}
+}
+
+static void
+output(struct frame *f, struct member *dst)
+{
+	if (dst != f->dst)
+		__sync_fetch_and_add(&misdelivered, 1);
+	pthread_mutex_lock(&dst->lock);
+	dst->sent++;
+	pthread_mutex_unlock(&dst->lock);
+}
+
+/* bridge_input() and bridge_forward() */
+static void
+forward_locked(struct frame *f)
+{
+	struct rtnode *brt;
+	struct member *dst;
+	int i;
+
+	pthread_mutex_lock(&sc_mtx);
+	for (i = 0; i < NMEMBERS; i++) {
+		if (memcmp(members[i].lladdr, f->dhost, 6) == 0 ||
+		    memcmp(members[i].lladdr, f->shost, 6) == 0)
+			errx(1, "frame for a member");
+	}
+	if ((brt = rtlookup(f->shost)) == NULL)
+		errx(1, "source not learned");
+	brt->dst = f->src;
+	brt->expire = uptime + TIMEOUT;
+	if ((brt = rtlookup(f->dhost)) == NULL)
+		errx(1, "destination not learned");
+	dst = brt->dst;
+	if (dst->private && f->src->private)
+		dst = NULL;
+	pthread_mutex_unlock(&sc_mtx);
+	if (dst != NULL)
+		output(f, dst);
+}
+
+/* bridge_forward_fast() */
+static int
+forward_fast(struct frame *f, int id)
+{
+	struct rtnode *brt;
+	struct member *dst;
+	unsigned long expire;
+	uint32_t g, seq;
+	int i;
+
+again:
+	g = rd_gen;
+	__sync_fetch_and_add(&readers[id].n[g & 1], 1);
+	barrier();
+	if (rd_gen != g) {
+		__sync_fetch_and_sub(&readers[id].n[g & 1], 1);
+		goto again;
+	}
+	seq = rtseq;
+	barrier();
+
+	for (i = 0; i < NMEMBERS; i++) {
+		if (memcmp(members[i].lladdr, f->dhost, 6) == 0 ||
+		    memcmp(members[i].lladdr, f->shost, 6) == 0)
+			goto slow;
+	}
+	if ((brt = rtlookup(f->shost)) == NULL || brt->dst != f->src)
+		goto slow;
+	expire = uptime + TIMEOUT;
+	if (brt->expire != expire)
+		brt->expire = expire;
+	if ((brt = rtlookup(f->dhost)) == NULL)
+		goto slow;
+	dst = brt->dst;
+	if (dst->private && f->src->private)
+		goto slow;
+	barrier();
+	if ((seq & 1) != 0 || rtseq != seq)
+		goto slow;
+	barrier();
+	__sync_fetch_and_sub(&readers[id].n[g & 1], 1);
+	output(f, dst);
+	return (1);
+
+slow:
+	barrier();
+	__sync_fetch_and_sub(&readers[id].n[g & 1], 1);
+	return (0);
+}
+
+struct input {
+	pthread_t	thr;
+	int		id;
+	uint64_t	frames;
+	struct frame	*f;
+};
+
+static void *
+input_main(void *arg)
+{
+	struct input *in = arg;
+	uint32_t i = 0;
+
+	while (!stop) {
+		struct frame *f = &in->f[i++ % NFRAMES];
+
+		if (!fast || !forward_fast(f, in->id)) {
+			if (fast)
+				__sync_fetch_and_add(&retries, 1);
+			forward_locked(f);
+		}
+		in->frames++;
+	}
+	return (NULL);
+}
+
+/* learning of new hosts and aging of old ones, on other members */
+static void *
+writer_main(void *arg)
+{
+	struct rtnode *brt;
+	uint32_t n = 0;
+	uint8_t a[6];
+
+	while (!stop) {
+		uptime = (unsigned long)now_sec();
+		host_addr(a, n % NMEMBERS, 0x8000 + (n % 4096));
+		pthread_mutex_lock(&sc_mtx);
+		if ((brt = rtlookup(a)) != NULL) {
+			rtremove(brt);
+		} else {
+			if ((brt = calloc(1, sizeof (*brt))) == NULL)
+				err(1, "calloc");
+			memcpy(brt->addr, a, 6);
+			brt->dst = &members[n % NMEMBERS];
+			rtinsert(brt);
+		}
+		pthread_mutex_unlock(&sc_mtx);
+		churn++;
+		n += 7;
+		usleep(20);
+	}
+	return (NULL);
+}
+
+static void
+run(int nthreads, struct input *in)
+{
+	pthread_t wthr;
+	uint64_t frames = 0, sent = 0;
+	double t;
+	int i;
+
+	stop = 0;
+	misdelivered = retries = churn = 0;
+	for (i = 0; i < NMEMBERS; i++)
+		members[i].sent = 0;
+	if (pthread_create(&wthr, NULL, writer_main, NULL) != 0)
+		err(1, "pthread_create");
+	for (i = 0; i < nthreads; i++) {
+		in[i].frames = 0;
+		if (pthread_create(&in[i].thr, NULL, input_main, &in[i]) != 0)
+			err(1, "pthread_create");
+	}
+	t = now_sec();
+	sleep(RUN_SECONDS);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(in[i].thr, NULL);
+		frames += in[i].frames;
+	}
+	t = now_sec() - t;
+	pthread_join(wthr, NULL);
+	for (i = 0; i < NMEMBERS; i++)
+		sent += members[i].sent;
+
+	printf("%-7s %7d %12.0f %10.2f %10.4f%% %9llu\n", fast ? "fast" :
+	    "locked", nthreads, frames / t, frames / t / 1e6,
+	    frames ? 100.0 * retries / frames : 0.0,
+	    (unsigned long long)churn);
+	if (misdelivered != 0 || sent != frames) {
+		printf("FAIL: %llu frames sent to the wrong member, "
+		    "%llu of %llu sent\n", (unsigned long long)misdelivered,
+		    (unsigned long long)sent, (unsigned long long)frames);
+		exit(1);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int counts[] = { 1, 2, 4, 8 };
+	struct input in[MAX_THREADS];
+	struct rtnode *brt;
+	uint32_t i, j, n = sizeof (counts) / sizeof (counts[0]);
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (n > sizeof (counts) / sizeof (counts[0]))
+		n = sizeof (counts) / sizeof (counts[0]);
+
+	uptime = (unsigned long)now_sec();
+	for (i = 0; i < NBUCKETS; i++)
+		LIST_INIT(&rthash[i]);
+	LIST_INIT(&limbo);
+	for (i = 0; i < NMEMBERS; i++) {
+		pthread_mutex_init(&members[i].lock, NULL);
+		host_addr(members[i].lladdr, i, 0xffff);
+		members[i].private = 0;
+		for (j = 0; j < NHOSTS; j++) {
+			if ((brt = calloc(1, sizeof (*brt))) == NULL)
+				err(1, "calloc");
+			host_addr(brt->addr, i, j);
+			brt->dst = &members[i];
+			rtinsert(brt);
+		}
+	}
+	srandom(1);
+	for (i = 0; i < MAX_THREADS; i++) {
+		in[i].id = i;
+		if ((in[i].f = calloc(NFRAMES, sizeof (struct frame))) == NULL)
+			err(1, "calloc");
+		for (j = 0; j < NFRAMES; j++) {
+			struct frame *f = &in[i].f[j];
+			uint32_t s = random() % NMEMBERS;
+			uint32_t d = (s + 1 + random() % (NMEMBERS - 1)) %
+			    NMEMBERS;
+
+			host_addr(f->shost, s, random() % NHOSTS);
+			host_addr(f->dhost, d, random() % NHOSTS);
+			f->src = &members[s];
+			f->dst = &members[d];
+		}
+	}
+
+	printf("%ld CPUs, %d members with %d hosts each\n",
+	    sysconf(_SC_NPROCESSORS_ONLN), NMEMBERS, NHOSTS);
+	printf("%-7s %7s %12s %10s %11s %9s\n", "mode", "threads",
+	    "frames/s", "Mpps", "fallbacks", "churn");
+	for (i = 0; i < n; i++) {
+		for (fast = 0; fast < 2; fast++)
+			run(counts[i], in);
+	}
+	for (i = 0; i < MAX_THREADS; i++)
+		free(in[i].f);
+	printf("PASS\n");
+	return (0);
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Model of the ESP async crypto pipeline (bsd/netinet6/esp_async.c):
+ * one SA's packets are sent by a single thread, encrypted by N worker
+ * threads picked round-robin, and passed on in ticket order through the
+ * same per-SA reorder ring as the kernel's.  The cipher is ChaCha20 with
+ * the sequence number as nonce, standing in for the ESP transform.
+ *
+ * Output is the packet rate and throughput for each worker count, with
+ * 0 meaning inline.  Fails if a packet is passed on out of sequence, or
+ * if the stream passed on differs from the inline one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#define	MAX_WORKERS	16
+#define	WINDOW		256		/* ESP_ASYNC_WINDOW */
+#define	NPACKETS	100000
+#define	PKTLEN		1400
+
+struct job {
+	struct job	*next;
+	uint32_t	ticket;
+	uint8_t		data[PKTLEN];
+};
+
+struct worker {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cv;
+	struct job	*head, **tail;
+	int		sleeping;
+	int		stop;
+	pthread_t	thr;
+};
+
+/* esp_async_order */
+static pthread_mutex_t order_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t order_next, order_head;
+static int order_draining;
+static struct job *order_ring[WINDOW];
+
+static struct worker workers[MAX_WORKERS];
+static int nworkers;
+
+static uint32_t delivered;
+static uint64_t stream_hash;
+static int out_of_order;
+static uint64_t window_stalls;
+
+static const uint32_t key[8] = {
+	0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c,
+	0x13121110, 0x17161514, 0x1b1a1918, 0x1f1e1d1c,
+};
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+#define	ROTL(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+#define	QR(a, b, c, d) do {						\
+	a += b; d ^= a; d = ROTL(d, 16);				\
+	c += d; b ^= c; b = ROTL(b, 12);				\
+	a += b; d ^= a; d = ROTL(d, 8);					\
+	c += d; b ^= c; b = ROTL(b, 7);					\
+} while (0)
+
+static void
+chacha20_xor(uint8_t *buf, size_t len, uint32_t nonce)
+{
+	uint32_t in[16], x[16], ctr = 1;
+	size_t off, i;
+	int r;
+
+	in[0] = 0x61707865; in[1] = 0x3320646e;
+	in[2] = 0x79622d32; in[3] = 0x6b206574;
+	memcpy(&in[4], key, sizeof (key));
+	in[13] = 0;
+	in[14] = nonce;
+	in[15] = 0;
+	for (off = 0; off < len; off += 64, ctr++) {
+		in[12] = ctr;
+		memcpy(x, in, sizeof (x));
+		for (r = 0; r < 10; r++) {
+			QR(x[0], x[4], x[8], x[12]);
+			QR(x[1], x[5], x[9], x[13]);
+			QR(x[2], x[6], x[10], x[14]);
+			QR(x[3], x[7], x[11], x[15]);
+			QR(x[0], x[5], x[10], x[15]);
+			QR(x[1], x[6], x[11], x[12]);
+			QR(x[2], x[7], x[8], x[13]);
+			QR(x[3], x[4], x[9], x[14]);
+		}
+		for (i = 0; i < 16; i++)
+			x[i] += in[i];
+		for (i = 0; i < 64 && off + i < len; i++)
+			buf[off + i] ^= ((uint8_t *)x)[i];
+	}
+}
+
+static void
+fill(struct job *j, uint32_t seq)
+{
+	size_t i;
+
+	for (i = 0; i < PKTLEN; i += 4)
+		memcpy(&j->data[i], &seq, sizeof (seq));
+}
+
+/* ip_output() stand-in */
+static void
+deliver(struct job *j)
+{
+	uint64_t h = stream_hash;
+	size_t i;
+
+	if (j->ticket != delivered)
+		out_of_order = 1;
+	delivered++;
+	for (i = 0; i < PKTLEN; i += 8) {
+		uint64_t v;
+
+		memcpy(&v, &j->data[i], sizeof (v));
+		h = (h ^ v) * 0x100000001b3ULL;
+	}
+	stream_hash = h;
+	free(j);
+}
+
+/* esp_async_complete() */
+static void
+complete(struct job *j)
+{
+	pthread_mutex_lock(&order_lock);
+	order_ring[j->ticket % WINDOW] = j;
+	if (order_draining) {
+		pthread_mutex_unlock(&order_lock);
+		return;
+	}
+	order_draining = 1;
+	while ((j = order_ring[order_head % WINDOW]) != NULL) {
+		order_ring[order_head % WINDOW] = NULL;
+		order_head++;
+		pthread_mutex_unlock(&order_lock);
+		deliver(j);
+		pthread_mutex_lock(&order_lock);
+	}
+	order_draining = 0;
+	pthread_mutex_unlock(&order_lock);
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct job *j;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while ((j = w->head) == NULL && !w->stop) {
+			w->sleeping = 1;
+			pthread_cond_wait(&w->cv, &w->lock);
+			w->sleeping = 0;
+		}
+		if (j == NULL)
+			break;
+		if ((w->head = j->next) == NULL)
+			w->tail = &w->head;
+		pthread_mutex_unlock(&w->lock);
+
+		chacha20_xor(j->data, PKTLEN, j->ticket);
+		complete(j);
+
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return (NULL);
+}
+
+/* esp_async_reserve(); the sender waits rather than drop */
+static uint32_t
+reserve(void)
+{
+	uint32_t t;
+
+	for (;;) {
+		pthread_mutex_lock(&order_lock);
+		if (order_next - order_head < WINDOW) {
+			t = order_next++;
+			pthread_mutex_unlock(&order_lock);
+			return (t);
+		}
+		pthread_mutex_unlock(&order_lock);
+		window_stalls++;
+		sched_yield();
+	}
+}
+
+static void
+submit(struct job *j)
+{
+	static uint32_t rr;
+	struct worker *w = &workers[rr++ % nworkers];
+	int wake;
+
+	j->next = NULL;
+	pthread_mutex_lock(&w->lock);
+	*w->tail = j;
+	w->tail = &j->next;
+	wake = w->sleeping;
+	pthread_mutex_unlock(&w->lock);
+	if (wake)
+		pthread_cond_signal(&w->cv);
+}
+
+static double
+run(int n, uint64_t *hash)
+{
+	struct job *j;
+	uint32_t seq;
+	double t0, t;
+	int i;
+
+	nworkers = n;
+	order_next = order_head = 0;
+	delivered = 0;
+	stream_hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < n; i++) {
+		struct worker *w = &workers[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cv, NULL);
+		w->head = NULL;
+		w->tail = &w->head;
+		w->sleeping = w->stop = 0;
+		if (pthread_create(&w->thr, NULL, worker_main, w) != 0)
+			err(1, "pthread_create");
+	}
+
+	t0 = now_sec();
+	for (seq = 0; seq < NPACKETS; seq++) {
+		if ((j = malloc(sizeof (*j))) == NULL)
+			err(1, "malloc");
+		fill(j, seq);
+		if (n == 0) {
+			j->ticket = seq;
+			chacha20_xor(j->data, PKTLEN, j->ticket);
+			deliver(j);
+			continue;
+		}
+		j->ticket = reserve();
+		submit(j);
+	}
+	while (n > 0) {
+		pthread_mutex_lock(&order_lock);
+		i = (order_head == NPACKETS);
+		pthread_mutex_unlock(&order_lock);
+		if (i)
+			break;
+		sched_yield();
+	}
+	t = now_sec() - t0;
+
+	for (i = 0; i < n; i++) {
+		struct worker *w = &workers[i];
+
+		pthread_mutex_lock(&w->lock);
+		w->stop = 1;
+		pthread_cond_signal(&w->cv);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thr, NULL);
+		pthread_cond_destroy(&w->cv);
+		pthread_mutex_destroy(&w->lock);
+	}
+	*hash = stream_hash;
+	return (t);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int counts[] = { 0, 1, 2, 4, 8, 16 };
+	uint32_t i, n = sizeof (counts) / sizeof (counts[0]);
+	uint64_t hash, inline_hash = 0;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int failed = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (n > sizeof (counts) / sizeof (counts[0]))
+		n = sizeof (counts) / sizeof (counts[0]);
+
+	printf("%ld CPUs, %d packets of %d bytes\n", ncpu, NPACKETS, PKTLEN);
+	printf("%7s %12s %10s %9s %10s\n", "workers", "packets/s", "Gbit/s",
+	    "speedup", "stalls");
+	for (i = 0; i < n; i++) {
+		static double base;
+		double t;
+
+		window_stalls = 0;
+		out_of_order = 0;
+		t = run(counts[i], &hash);
+		if (i == 0) {
+			base = t;
+			inline_hash = hash;
+		}
+		printf("%7d %12.0f %10.2f %8.2fx %10llu\n", counts[i],
+		    NPACKETS / t, NPACKETS * PKTLEN * 8 / t / 1e9, base / t,
+		    (unsigned long long)window_stalls);
+		if (out_of_order) {
+			printf("FAIL: packets passed on out of sequence\n");
+			failed = 1;
+		} else if (delivered != NPACKETS || hash != inline_hash) {
+			printf("FAIL: stream differs from the inline one\n");
+			failed = 1;
+		}
+	}
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
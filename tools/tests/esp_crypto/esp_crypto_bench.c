@@ -0,0 +1,805 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Times the kernel's ESP AES routines, esp_cbc_{en,de}crypt_aes() and
+ * esp_gcm_{en,de}crypt_aes() from bsd/netinet6/esp_rijndael.c, over
+ * packets laid out the way esp_output() and esp_input() hand them over:
+ * the IP header, ESP header, IV and the first few bytes of payload in the
+ * header mbuf, the rest in 2KB clusters, so a cipher block straddles the
+ * first boundary.  Each size is run with net.inet.ipsec.esp_aes_inplace
+ * off (the output goes to newly allocated mbufs) and on (the payload is
+ * transformed where it sits), and the time the routine takes per packet
+ * is reported for both, next to the mbufs and clusters it allocated.
+ *
+ * esp_rijndael.c is compiled in as it is, on top of the headers in
+ * shim/.  The libkern AES calls it makes go to CommonCrypto, which runs
+ * the same corecrypto modes the kernel links against; the mbuf routines
+ * below keep freed mbufs and clusters on LIFO lists, as the mbuf caches
+ * would, so the copy path gets warm memory back.
+ *
+ * Every path and layout, including a chain whose clusters are shared
+ * and so must not be written, is checked against CommonCrypto one-shot
+ * calls over the contiguous payload, and those against published test
+ * vectors.  Prints PASS or FAIL at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/time.h>
+
+#define	BSD_KERNEL_PRIVATE	1
+
+#include "../../../bsd/netinet6/esp_rijndael.c"
+
+/* SPI; from CommonCrypto/CommonCryptorSPI.h */
+#define	kCCModeGCM	11
+extern CCCryptorStatus CCCryptorGCMAddIV(CCCryptorRef, const void *, size_t);
+extern CCCryptorStatus CCCryptorGCMAddAAD(CCCryptorRef, const void *, size_t);
+extern CCCryptorStatus CCCryptorGCMEncrypt(CCCryptorRef, const void *, size_t,
+    void *);
+extern CCCryptorStatus CCCryptorGCMDecrypt(CCCryptorRef, const void *, size_t,
+    void *);
+extern CCCryptorStatus CCCryptorGCMFinal(CCCryptorRef, void *, size_t *);
+extern CCCryptorStatus CCCryptorGCMReset(CCCryptorRef);
+extern CCCryptorStatus CCCryptorGCM(CCOperation op, CCAlgorithm alg,
+    const void *key, size_t keyLength, const void *iv, size_t ivLen,
+    const void *aData, size_t aDataLen, const void *dataIn,
+    size_t dataInLength, void *dataOut, void *tagOut, size_t *tagLength);
+
+#define	BLK		16
+#define	KEYLEN		16
+#define	IPHDR		20	/* ESP header offset */
+#define	LEADING		16	/* room for a link header */
+#define	HDR_PAYLOAD	52	/* payload bytes sharing the header mbuf */
+#define	MAXPKT		(MBIGCLBYTES * 4)
+#define	RUNTIME		0.25	/* seconds per measurement */
+
+int ipsec_debug = 0;
+lck_mtx_t *sadb_mutex;
+
+static int failed;
+
+static void
+check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failed = 1;
+	}
+}
+
+/*
+ * mbufs
+ */
+struct freebuf {
+	struct freebuf	*next;
+};
+
+static struct freebuf *free_mbufs, *free_cl, *free_bigcl;
+static u_int64_t nallocs;	/* mbufs and clusters handed out */
+
+static void *
+buf_get(struct freebuf **list, size_t size)
+{
+	struct freebuf *f;
+
+	nallocs++;
+	if ((f = *list) != NULL) {
+		*list = f->next;
+		return (f);
+	}
+	if ((f = malloc(size)) == NULL)
+		err(1, "malloc");
+	return (f);
+}
+
+static void
+buf_put(struct freebuf **list, void *p)
+{
+	struct freebuf *f = p;
+
+	f->next = *list;
+	*list = f;
+}
+
+struct mbuf *
+m_get(int how, int type)
+{
+#pragma unused(how)
+	struct mbuf *m;
+
+	m = buf_get(&free_mbufs, sizeof (*m));
+	bzero(&m->m_hdr, sizeof (m->m_hdr));
+	m->m_type = type;
+	m->m_data = m->m_dat;
+	return (m);
+}
+
+static struct mbuf *
+m_extget(struct mbuf *m, struct freebuf **list, u_int size)
+{
+	m->m_ext.ext_buf = buf_get(list, size);
+	m->m_ext.ext_size = size;
+	m->m_ext.ext_free = NULL;
+	m->m_ext.ext_refcnt = 1;
+	m->m_data = m->m_ext.ext_buf;
+	m->m_flags |= M_EXT;
+	return (m);
+}
+
+struct mbuf *
+m_mclget(struct mbuf *m, int how)
+{
+#pragma unused(how)
+	return (m_extget(m, &free_cl, MCLBYTES));
+}
+
+struct mbuf *
+m_mbigget(struct mbuf *m, int how)
+{
+#pragma unused(how)
+	return (m_extget(m, &free_bigcl, MBIGCLBYTES));
+}
+
+struct mbuf *
+m_free(struct mbuf *m)
+{
+	struct mbuf *n = m->m_next;
+
+	if (m->m_flags & M_EXT) {
+		if (m->m_ext.ext_free != NULL)
+			m->m_ext.ext_free(m->m_ext.ext_buf,
+			    m->m_ext.ext_size, NULL);
+		else if (--m->m_ext.ext_refcnt == 0)
+			buf_put(m->m_ext.ext_size == MCLBYTES ? &free_cl :
+			    &free_bigcl, m->m_ext.ext_buf);
+	}
+	buf_put(&free_mbufs, m);
+	return (n);
+}
+
+void
+m_freem(struct mbuf *m)
+{
+	while (m != NULL)
+		m = m_free(m);
+}
+
+/* only the case esp_rijndael.c uses: trimming the front of one mbuf */
+void
+m_adj(struct mbuf *m, int len)
+{
+	if (len < 0 || len > m->m_len)
+		errx(1, "m_adj %d", len);
+	m->m_data += len;
+	m->m_len -= len;
+}
+
+void
+m_copydata(struct mbuf *m, int off, int len, void *vp)
+{
+	caddr_t cp = vp;
+	int n;
+
+	while (off >= m->m_len) {
+		off -= m->m_len;
+		m = m->m_next;
+	}
+	for (; len > 0; len -= n, off = 0, m = m->m_next) {
+		if (m == NULL)
+			errx(1, "m_copydata past the end of the chain");
+		n = MIN(m->m_len - off, len);
+		bcopy(mtod(m, caddr_t) + off, cp, n);
+		cp += n;
+	}
+}
+
+/* never extends the chain; the ESP routines only write inside it */
+void
+m_copyback(struct mbuf *m, int off, int len, const void *vp)
+{
+	const char *cp = vp;
+	int n;
+
+	while (off >= m->m_len) {
+		off -= m->m_len;
+		m = m->m_next;
+	}
+	for (; len > 0; len -= n, off = 0, m = m->m_next) {
+		if (m == NULL)
+			errx(1, "m_copyback past the end of the chain");
+		n = MIN(m->m_len - off, len);
+		bcopy(cp, mtod(m, caddr_t) + off, n);
+		cp += n;
+	}
+}
+
+void
+key_sa_stir_iv(struct secasvar *sav)
+{
+	u_int i;
+
+	for (i = 0; i < sav->ivlen; i++)
+		sav->iv[i] = random();
+}
+
+/*
+ * libkern AES over CommonCrypto
+ */
+static aes_rval
+cc_create(CCOperation op, CCMode mode, const unsigned char *key, int key_len,
+    CCCryptorRef *ref)
+{
+	if (key_len >= 128)
+		key_len /= 8;		/* given in bits */
+	if (CCCryptorCreateWithMode(op, mode, kCCAlgorithmAES, ccNoPadding,
+	    NULL, key, key_len, NULL, 0, 0, 0, ref) != kCCSuccess)
+		return (aes_error);
+	return (aes_good);
+}
+
+static aes_rval
+cc_cbc(CCCryptorRef ref, const unsigned char *in, const unsigned char *iv,
+    unsigned int num_blk, unsigned char *out)
+{
+	size_t moved;
+
+	if (CCCryptorReset(ref, iv) != kCCSuccess ||
+	    CCCryptorUpdate(ref, in, num_blk * BLK, out, num_blk * BLK,
+	    &moved) != kCCSuccess || moved != num_blk * BLK)
+		return (aes_error);
+	return (aes_good);
+}
+
+aes_rval
+aes_encrypt_key(const unsigned char *key, int key_len, aes_encrypt_ctx cx[1])
+{
+	return (cc_create(kCCEncrypt, kCCModeCBC, key, key_len, &cx->ref));
+}
+
+aes_rval
+aes_decrypt_key(const unsigned char *key, int key_len, aes_decrypt_ctx cx[1])
+{
+	return (cc_create(kCCDecrypt, kCCModeCBC, key, key_len, &cx->ref));
+}
+
+aes_rval
+aes_encrypt_cbc(const unsigned char *in_blk, const unsigned char *in_iv,
+    unsigned int num_blk, unsigned char *out_blk, aes_encrypt_ctx cx[1])
+{
+	return (cc_cbc(cx->ref, in_blk, in_iv, num_blk, out_blk));
+}
+
+aes_rval
+aes_decrypt_cbc(const unsigned char *in_blk, const unsigned char *in_iv,
+    unsigned int num_blk, unsigned char *out_blk, aes_decrypt_ctx cx[1])
+{
+	return (cc_cbc(cx->ref, in_blk, in_iv, num_blk, out_blk));
+}
+
+unsigned
+aes_encrypt_get_ctx_size_gcm(void)
+{
+	return (sizeof (ccgcm_ctx));
+}
+
+unsigned
+aes_decrypt_get_ctx_size_gcm(void)
+{
+	return (sizeof (ccgcm_ctx));
+}
+
+aes_rval
+aes_encrypt_key_gcm(const unsigned char *key, int key_len, ccgcm_ctx *ctx)
+{
+	return (cc_create(kCCEncrypt, kCCModeGCM, key, key_len, &ctx->ref));
+}
+
+aes_rval
+aes_decrypt_key_gcm(const unsigned char *key, int key_len, ccgcm_ctx *ctx)
+{
+	return (cc_create(kCCDecrypt, kCCModeGCM, key, key_len, &ctx->ref));
+}
+
+aes_rval
+aes_encrypt_set_iv_gcm(const unsigned char *in_iv, unsigned int len,
+    ccgcm_ctx *ctx)
+{
+	if (CCCryptorGCMReset(ctx->ref) != kCCSuccess ||
+	    CCCryptorGCMAddIV(ctx->ref, in_iv, len) != kCCSuccess)
+		return (aes_error);
+	return (aes_good);
+}
+
+aes_rval
+aes_decrypt_set_iv_gcm(const unsigned char *in_iv, unsigned int len,
+    ccgcm_ctx *ctx)
+{
+	return (aes_encrypt_set_iv_gcm(in_iv, len, ctx));
+}
+
+aes_rval
+aes_encrypt_aad_gcm(const unsigned char *aad, unsigned int aad_bytes,
+    ccgcm_ctx *ctx)
+{
+	if (CCCryptorGCMAddAAD(ctx->ref, aad, aad_bytes) != kCCSuccess)
+		return (aes_error);
+	return (aes_good);
+}
+
+aes_rval
+aes_decrypt_aad_gcm(const unsigned char *aad, unsigned int aad_bytes,
+    ccgcm_ctx *ctx)
+{
+	return (aes_encrypt_aad_gcm(aad, aad_bytes, ctx));
+}
+
+aes_rval
+aes_encrypt_gcm(const unsigned char *in_blk, unsigned int num_bytes,
+    unsigned char *out_blk, ccgcm_ctx *ctx)
+{
+	if (CCCryptorGCMEncrypt(ctx->ref, in_blk, num_bytes, out_blk) !=
+	    kCCSuccess)
+		return (aes_error);
+	return (aes_good);
+}
+
+aes_rval
+aes_decrypt_gcm(const unsigned char *in_blk, unsigned int num_bytes,
+    unsigned char *out_blk, ccgcm_ctx *ctx)
+{
+	if (CCCryptorGCMDecrypt(ctx->ref, in_blk, num_bytes, out_blk) !=
+	    kCCSuccess)
+		return (aes_error);
+	return (aes_good);
+}
+
+aes_rval
+aes_encrypt_finalize_gcm(unsigned char *tag, unsigned int tag_bytes,
+    ccgcm_ctx *ctx)
+{
+	size_t len = tag_bytes;
+
+	if (CCCryptorGCMFinal(ctx->ref, tag, &len) != kCCSuccess)
+		return (aes_error);
+	return (aes_good);
+}
+
+aes_rval
+aes_decrypt_finalize_gcm(unsigned char *tag, unsigned int tag_bytes,
+    ccgcm_ctx *ctx)
+{
+	return (aes_encrypt_finalize_gcm(tag, tag_bytes, ctx));
+}
+
+/*
+ * Security associations, one per algorithm, keyed as pfkey would
+ */
+enum alg { ALG_CBC, ALG_GCM, NALGS };
+
+static const char *alg_names[NALGS] = { "cbc", "gcm" };
+static const int alg_ivlen[NALGS] = { BLK, ESP_GCM_IVLEN };
+
+static const struct esp_algorithm esp_algs[NALGS] = {
+	{ "aes-cbc" }, { "aes-gcm" }
+};
+
+static struct secasvar sas[NALGS];
+
+static void
+sa_init(struct secasvar *sav, enum alg alg, const u_int8_t *key, int keylen)
+{
+	static lck_mtx_t mtx;
+
+	bzero(sav, sizeof (*sav));
+	sadb_mutex = &mtx;
+	if ((sav->key_enc = calloc(1, sizeof (struct sadb_key) + keylen)) ==
+	    NULL)
+		err(1, "calloc");
+	sav->key_enc->sadb_key_bits = keylen * 8;
+	bcopy(key, _KEYBUF(sav->key_enc), keylen);
+	sav->ivlen = alg_ivlen[alg];
+	if ((sav->iv = malloc(sav->ivlen)) == NULL)
+		err(1, "malloc");
+	key_sa_stir_iv(sav);
+	if (alg == ALG_CBC) {
+		sav->schedlen = esp_aes_schedlen(&esp_algs[alg]);
+		sav->sched = calloc(1, sav->schedlen);
+		if (sav->sched == NULL ||
+		    esp_aes_schedule(&esp_algs[alg], sav) != 0)
+			errx(1, "esp_aes_schedule");
+	} else {
+		sav->schedlen = esp_gcm_schedlen(&esp_algs[alg]);
+		sav->sched = calloc(1, sav->schedlen);
+		if (sav->sched == NULL ||
+		    esp_gcm_schedule(&esp_algs[alg], sav) != 0)
+			errx(1, "esp_gcm_schedule");
+	}
+}
+
+/*
+ * Packets: IP header, ESP header and IV, then len bytes of payload,
+ * HDR_PAYLOAD of them in the header mbuf and the rest in clusters.
+ * With a segs list, ended by -1, the payload is cut there instead, for
+ * the layout checks; a zero entry makes an empty mbuf.
+ */
+static int
+pkt_nextseg(const int **segsp, int dflt, int left)
+{
+	const int *segs = *segsp;
+
+	if (segs == NULL || *segs < 0)
+		return (MIN(left, dflt));
+	(*segsp)++;
+	return (MIN(left, MIN(*segs, dflt)));
+}
+
+static struct mbuf *
+pkt_build(enum alg alg, const u_int8_t *pt, int len, const int *segs)
+{
+	struct mbuf *m, *n, **np;
+	int hlen = IPHDR + sizeof (struct newesp) + alg_ivlen[alg];
+	int i, seg;
+
+	m = m_get(M_DONTWAIT, MT_DATA);
+	m->m_flags |= M_PKTHDR;
+	m->m_data += LEADING;
+	memset(m->m_data, 0x45, IPHDR);
+	memset(m->m_data + IPHDR, 0xe5, sizeof (struct newesp));
+	memset(m->m_data + IPHDR + sizeof (struct newesp), 0,
+	    alg_ivlen[alg]);
+	m->m_len = hlen;
+	seg = pkt_nextseg(&segs, segs != NULL ? (int)M_TRAILINGSPACE(m) :
+	    HDR_PAYLOAD, len);
+	bcopy(pt, m->m_data + hlen, seg);
+	m->m_len += seg;
+	m->m_pkthdr.len = hlen + len;
+
+	np = &m->m_next;
+	for (i = seg; i < len; i += seg) {
+		seg = pkt_nextseg(&segs, MCLBYTES, len - i);
+		n = m_get(M_DONTWAIT, MT_DATA);
+		m_mclget(n, M_DONTWAIT);
+		bcopy(pt + i, n->m_data, seg);
+		n->m_len = seg;
+		*np = n;
+		np = &n->m_next;
+	}
+	return (m);
+}
+
+static int
+esp_encrypt(enum alg alg, struct mbuf *m, int len, u_int8_t *tag)
+{
+	struct secasvar *sav = &sas[alg];
+	int error;
+
+	if (alg == ALG_CBC)
+		return (esp_cbc_encrypt_aes(m, IPHDR, len, sav,
+		    &esp_algs[alg], sav->ivlen));
+	error = esp_gcm_encrypt_aes(m, IPHDR, len, sav, &esp_algs[alg],
+	    sav->ivlen);
+	if (error == 0)
+		error = esp_gcm_encrypt_finalize(sav, tag, BLK);
+	return (error);
+}
+
+static int
+esp_decrypt(enum alg alg, struct mbuf *m, u_int8_t *tag)
+{
+	struct secasvar *sav = &sas[alg];
+	int error;
+
+	if (alg == ALG_CBC)
+		return (esp_cbc_decrypt_aes(m, IPHDR, sav, &esp_algs[alg],
+		    sav->ivlen));
+	error = esp_gcm_decrypt_aes(m, IPHDR, sav, &esp_algs[alg],
+	    sav->ivlen);
+	if (error == 0)
+		error = esp_gcm_decrypt_finalize(sav, tag, BLK);
+	return (error);
+}
+
+/*
+ * Known answers for the CommonCrypto reference
+ */
+static void
+unhex(u_int8_t *b, const char *hex)
+{
+	unsigned int v;
+
+	for (; hex[0] != '\0'; hex += 2) {
+		sscanf(hex, "%2x", &v);
+		*b++ = v;
+	}
+}
+
+static void
+selftest(void)
+{
+	u_int8_t key[KEYLEN], iv[BLK], nonce[12], aad[20], pt[64], ct[64];
+	u_int8_t exp[64], tag[BLK], etag[BLK];
+	size_t moved, taglen = BLK;
+
+	/* SP 800-38A F.2.1, CBC-AES128.Encrypt */
+	unhex(key, "2b7e151628aed2a6abf7158809cf4f3c");
+	unhex(iv, "000102030405060708090a0b0c0d0e0f");
+	unhex(pt, "6bc1bee22e409f96e93d7e117393172a"
+	    "ae2d8a571e03ac9c9eb76fac45af8e51"
+	    "30c81c46a35ce411e5fbc1191a0a52ef"
+	    "f69f2445df4f9b17ad2b417be66c3710");
+	unhex(exp, "7649abac8119b246cee98e9b12e9197d"
+	    "5086cb9b507219ee95db113a917678b2"
+	    "73bed6b8e3c1743b7116e69e22229516"
+	    "3ff1caa1681fac09120eca307586e1a7");
+	check(CCCrypt(kCCEncrypt, kCCAlgorithmAES, 0, key, KEYLEN, iv, pt, 64,
+	    ct, 64, &moved) == kCCSuccess && memcmp(ct, exp, 64) == 0,
+	    "CBC known answer");
+
+	/* GCM spec test case 4 */
+	unhex(key, "feffe9928665731c6d6a8f9467308308");
+	unhex(nonce, "cafebabefacedbaddecaf888");
+	unhex(aad, "feedfacedeadbeeffeedfacedeadbeefabaddad2");
+	unhex(pt, "d9313225f88406e5a55909c5aff5269a"
+	    "86a7a9531534f7da2e4c303d8a318a72"
+	    "1c3c0c95956809532fcf0e2449a6b525"
+	    "b16aedf5aa0de657ba637b39");
+	unhex(exp, "42831ec2217774244b7221b784d0d49c"
+	    "e3aa212f2c02a4e035c17e2329aca12e"
+	    "21d514b25466931c7d8f6a5aac84aa05"
+	    "1ba30b396a0aac973d58e091");
+	unhex(etag, "5bc94fbc3221a5db94fae95ae7121a47");
+	check(CCCryptorGCM(kCCEncrypt, kCCAlgorithmAES, key, KEYLEN, nonce,
+	    sizeof (nonce), aad, sizeof (aad), pt, 60, ct, tag, &taglen) ==
+	    kCCSuccess && memcmp(ct, exp, 60) == 0 &&
+	    memcmp(tag, etag, BLK) == 0, "GCM known answer");
+}
+
+/*
+ * Run one layout through encryption and back, with the in-place paths
+ * off and on, and compare against a one-shot over contiguous data.  A
+ * shared chain has its clusters referenced from elsewhere, so both
+ * settings must leave them alone.
+ */
+static void
+crosscheck(enum alg alg, int len, const int *segs, int shared,
+    const char *what)
+{
+	static u_int8_t pt[MAXPKT], exp[MAXPKT], buf[MAXPKT + 64];
+	struct secasvar *sav = &sas[alg];
+	u_int8_t iv[BLK], nonce[12], esp[sizeof (struct newesp)];
+	u_int8_t tag[BLK], etag[BLK];
+	caddr_t orig[64];
+	struct mbuf *m, *n;
+	int hlen = IPHDR + sizeof (struct newesp) + sav->ivlen;
+	int i, j, norig, inplace;
+	size_t moved, taglen = BLK;
+	char msg[128];
+
+	for (i = 0; i < len; i++)
+		pt[i] = random();
+	memset(esp, 0xe5, sizeof (esp));
+
+	for (inplace = 0; inplace <= 1; inplace++) {
+		esp_aes_inplace = inplace;
+		snprintf(msg, sizeof (msg), "%s %s %d bytes, inplace %d",
+		    alg_names[alg], what, len, inplace);
+
+		m = pkt_build(alg, pt, len, segs);
+		norig = 0;
+		for (n = m->m_next; shared && n != NULL; n = n->m_next) {
+			n->m_ext.ext_refcnt++;
+			orig[norig++] = n->m_ext.ext_buf;
+		}
+		bcopy(sav->iv, iv, sav->ivlen);
+		if (esp_encrypt(alg, m, len, tag) != 0) {
+			check(0, msg);
+			continue;
+		}
+
+		/* the reference */
+		if (alg == ALG_CBC) {
+			check(CCCrypt(kCCEncrypt, kCCAlgorithmAES, 0,
+			    _KEYBUF(sav->key_enc), KEYLEN, iv, pt, len, exp,
+			    len, &moved) == kCCSuccess, "CCCrypt");
+		} else {
+			bcopy(_KEYBUF(sav->key_enc) + KEYLEN, nonce,
+			    ESP_GCM_SALT_LEN);
+			bcopy(iv, nonce + ESP_GCM_SALT_LEN, ESP_GCM_IVLEN);
+			check(CCCryptorGCM(kCCEncrypt, kCCAlgorithmAES,
+			    _KEYBUF(sav->key_enc), KEYLEN, nonce,
+			    sizeof (nonce), esp, sizeof (esp), pt, len, exp,
+			    etag, &taglen) == kCCSuccess, "CCCryptorGCM");
+		}
+
+		check(m->m_pkthdr.len == hlen + len, msg);
+		m_copydata(m, 0, hlen + len, buf);
+		for (i = 0; i < IPHDR; i++)
+			if (buf[i] != 0x45)
+				break;
+		check(i == IPHDR && memcmp(buf + IPHDR, esp, sizeof (esp)) == 0,
+		    msg);
+		check(memcmp(buf + IPHDR + sizeof (esp), iv, sav->ivlen) == 0,
+		    msg);
+		check(memcmp(buf + hlen, exp, len) == 0, msg);
+		if (alg == ALG_GCM)
+			check(memcmp(tag, etag, BLK) == 0, msg);
+
+		/* what the other references see is still the plaintext */
+		for (i = 0, j = MIN(len, HDR_PAYLOAD); i < norig; i++) {
+			if (segs == NULL) {
+				check(memcmp(orig[i], pt + j,
+				    MIN(len - j, MCLBYTES)) == 0, msg);
+				j += MCLBYTES;
+			}
+			buf_put(&free_cl, orig[i]);
+		}
+
+		if (esp_decrypt(alg, m, tag) != 0) {
+			check(0, msg);
+			m_freem(m);
+			continue;
+		}
+		check(m->m_pkthdr.len == hlen + len, msg);
+		m_copydata(m, hlen, len, buf);
+		check(memcmp(buf, pt, len) == 0, msg);
+		if (alg == ALG_GCM)
+			check(memcmp(tag, etag, BLK) == 0, msg);
+		m_freem(m);
+	}
+}
+
+static void
+layouts(enum alg alg)
+{
+	static const int sizes[] = { 16, 64, 576, 1456, 2048 + 64, 8992 };
+	/* straddling blocks, empty mbufs, a one byte mbuf */
+	static const int split1[] = { 4, 0, 13, 1, 30, 0, -1 };
+	static const int split2[] = { 0, 17, 100, 3, 255, 1, -1 };
+	int i, s, segs[64], n, left;
+
+	for (s = 0; s < (int)(sizeof (sizes) / sizeof (sizes[0])); s++) {
+		crosscheck(alg, sizes[s], NULL, 0, "esp");
+		crosscheck(alg, sizes[s], NULL, 1, "shared");
+		if (sizes[s] >= 64) {
+			crosscheck(alg, sizes[s], split1, 0, "split1");
+			crosscheck(alg, sizes[s], split2, 0, "split2");
+		}
+		/* random cuts, as if from m_split() and m_pullup() */
+		for (i = 0; i < 20; i++) {
+			for (n = 0, left = sizes[s];
+			    left > 0 && n < 62; n++, left -= segs[n - 1])
+				segs[n] = MIN(left, random() % 300);
+			segs[n] = -1;
+			crosscheck(alg, sizes[s], segs, 0, "random");
+		}
+	}
+}
+
+/*
+ * Timing
+ */
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+enum op { OP_NONE, OP_ENCRYPT, OP_DECRYPT };
+
+/*
+ * ns per packet to build a packet, run op over it and free it, and the
+ * mbufs and clusters op itself allocated per packet
+ */
+static double
+measure(enum alg alg, enum op op, int len, double *allocs)
+{
+	static u_int8_t pt[MAXPKT];
+	u_int8_t tag[BLK];
+	struct mbuf *m;
+	u_int64_t n = 0, a, extra = 0;
+	double t0, t = 0;
+
+	t0 = now_sec();
+	do {
+		m = pkt_build(alg, pt, len, NULL);
+		a = nallocs;
+		if (op == OP_ENCRYPT)
+			esp_encrypt(alg, m, len, tag);
+		else if (op == OP_DECRYPT)
+			esp_decrypt(alg, m, tag);
+		extra += nallocs - a;
+		m_freem(m);
+		if ((++n & 63) == 0)
+			t = now_sec() - t0;
+	} while (t < RUNTIME);
+	*allocs = (double)extra / n;
+	return (t * 1e9 / n);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int sizes[] = { 64, 576, 1456, 8992 };
+	static const u_int8_t key[KEYLEN + ESP_GCM_SALT_LEN] =
+	    "esp_crypto_benchsalt";
+	static const char *op_names[] = { "", "encrypt", "decrypt" };
+	u_int32_t s, n = sizeof (sizes) / sizeof (sizes[0]);
+	double base, ns[2], allocs[2];
+	enum alg alg;
+	enum op op;
+	int i;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (n > sizeof (sizes) / sizeof (sizes[0]))
+		n = sizeof (sizes) / sizeof (sizes[0]);
+
+	srandom(1);
+	selftest();
+	sa_init(&sas[ALG_CBC], ALG_CBC, key, KEYLEN);
+	sa_init(&sas[ALG_GCM], ALG_GCM, key, KEYLEN + ESP_GCM_SALT_LEN);
+	for (alg = 0; alg < NALGS; alg++)
+		layouts(alg);
+
+	printf("net.inet.ipsec.esp_aes_inplace 0 vs 1, ns/pkt in the ESP "
+	    "routine, mbufs+clusters allocated per pkt\n");
+	printf("%6s  %-12s %10s %6s %10s %6s %8s\n", "bytes", "path",
+	    "copy", "allocs", "inplace", "allocs", "gain");
+	for (s = 0; s < n; s++) {
+		for (alg = 0; alg < NALGS; alg++) {
+			for (op = OP_ENCRYPT; op <= OP_DECRYPT; op++) {
+				esp_aes_inplace = 0;
+				base = measure(alg, OP_NONE, sizes[s],
+				    &allocs[0]);
+				for (i = 0; i < 2; i++) {
+					esp_aes_inplace = i;
+					ns[i] = measure(alg, op, sizes[s],
+					    &allocs[i]) - base;
+				}
+				printf("%6d  %s-%-8s %10.1f %6.1f %10.1f %6.1f "
+				    "%7.2fx\n", sizes[s], alg_names[alg],
+				    op_names[op], ns[0], allocs[0], ns[1],
+				    allocs[1], ns[0] / ns[1]);
+			}
+		}
+	}
+	esp_aes_inplace = 1;
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
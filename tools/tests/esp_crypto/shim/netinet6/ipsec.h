@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _SHIM_NETINET6_IPSEC_H_
+#define	_SHIM_NETINET6_IPSEC_H_
+
+#include <stdlib.h>
+
+#define	M_SECA		0
+#define	_MALLOC(size, type, flags)	malloc(size)
+#define	FREE(addr, type)		free(addr)
+
+/* as on x86_64, arm64 */
+#define	IPSEC_IS_P2ALIGNED(p)		1
+#define	IPSEC_GET_P2UNALIGNED_OFS(p)	0
+
+extern int ipsec_debug;
+#define	ipseclog(x)	do { if (ipsec_debug) log x; } while (0)
+
+#endif /* _SHIM_NETINET6_IPSEC_H_ */
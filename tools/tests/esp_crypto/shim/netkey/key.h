@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * The security association and key layout, from bsd/netkey/keydb.h,
+ * key_var.h and bsd/net/pfkeyv2.h, trimmed to what ESP encryption uses.
+ */
+#ifndef _SHIM_NETKEY_KEY_H_
+#define	_SHIM_NETKEY_KEY_H_
+
+#include <sys/types.h>
+
+struct sadb_key {
+	u_int16_t	sadb_key_len;
+	u_int16_t	sadb_key_exttype;
+	u_int16_t	sadb_key_bits;
+	u_int16_t	sadb_key_reserved;
+};
+
+#define	SADB_X_EXT_OLD	0x0001	/* old format. */
+
+struct secasvar {
+	u_int32_t	flags;		/* holder for SADB_KEY_FLAGS */
+	struct sadb_key	*key_enc;	/* Key for Encryption */
+	caddr_t		iv;		/* Initilization Vector */
+	u_int		ivlen;		/* length of IV */
+	void		*sched;		/* intermediate encryption key */
+	size_t		schedlen;
+};
+
+#define	_KEYLEN(key)	((u_int)((key)->sadb_key_bits >> 3))
+#define	_KEYBUF(key)	((caddr_t)((caddr_t)(key) + sizeof (struct sadb_key)))
+
+extern void key_sa_stir_iv(struct secasvar *);
+
+#endif /* _SHIM_NETKEY_KEY_H_ */
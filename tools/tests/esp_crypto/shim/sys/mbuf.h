@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Userland stand-in for the kernel mbuf: just what esp_rijndael.c
+ * touches.  The allocation routines are in esp_crypto_bench.c.
+ */
+#ifndef _SHIM_SYS_MBUF_H_
+#define	_SHIM_SYS_MBUF_H_
+
+#include <sys/types.h>
+
+#define	MSIZE		256
+#define	MCLBYTES	2048
+#define	MBIGCLBYTES	4096
+
+struct m_ext {
+	caddr_t		ext_buf;
+	void		(*ext_free)(caddr_t, u_int, caddr_t);
+	u_int		ext_size;
+	u_int		ext_refcnt;	/* other mbufs sharing ext_buf */
+};
+
+struct pkthdr {
+	int32_t		len;
+};
+
+struct m_hdr {
+	struct mbuf	*mh_next;
+	caddr_t		mh_data;
+	int32_t		mh_len;
+	u_int16_t	mh_type;
+	u_int16_t	mh_flags;
+	struct pkthdr	mh_pkthdr;
+	struct m_ext	mh_ext;
+};
+
+#define	MLEN		(MSIZE - sizeof (struct m_hdr))
+
+struct mbuf {
+	struct m_hdr	m_hdr;
+	char		m_dat[MLEN];
+};
+
+#define	m_next		m_hdr.mh_next
+#define	m_data		m_hdr.mh_data
+#define	m_len		m_hdr.mh_len
+#define	m_type		m_hdr.mh_type
+#define	m_flags		m_hdr.mh_flags
+#define	m_pkthdr	m_hdr.mh_pkthdr
+#define	m_ext		m_hdr.mh_ext
+
+#define	M_EXT		0x0001
+#define	M_PKTHDR	0x0002
+
+#define	M_DONTWAIT	1
+#define	MT_DATA		1
+
+#define	mtod(m, t)	((t)(void *)((m)->m_data))
+
+#define	M_TRAILINGSPACE(m)						\
+	(((m)->m_flags & M_EXT) ?					\
+	    (m)->m_ext.ext_buf + (m)->m_ext.ext_size -			\
+	    ((m)->m_data + (m)->m_len) :				\
+	    &(m)->m_dat[MLEN] - ((m)->m_data + (m)->m_len))
+
+#define	m_mclhasreference(m)	((m)->m_ext.ext_refcnt > 1)
+
+#define	MGET(m, how, type)	((m) = m_get((how), (type)))
+#define	MCLGET(m, how)		((m) = m_mclget((m), (how)))
+
+extern struct mbuf *m_get(int, int);
+extern struct mbuf *m_mclget(struct mbuf *, int);
+extern struct mbuf *m_mbigget(struct mbuf *, int);
+extern struct mbuf *m_free(struct mbuf *);
+extern void m_freem(struct mbuf *);
+extern void m_adj(struct mbuf *, int);
+extern void m_copydata(struct mbuf *, int, int, void *);
+extern void m_copyback(struct mbuf *, int, int, const void *);
+
+#endif /* _SHIM_SYS_MBUF_H_ */
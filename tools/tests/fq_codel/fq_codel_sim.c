@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Simulates a bottleneck link fed by a few bulk flows and a sparse
+ * request/response flow, once through a drop-tail class queue and then
+ * through the FQ-CoDel class queue of bsd/net/classq/classq_fq_codel.c,
+ * with CoDel dropping and then ECN marking, and compares the queueing
+ * delay each kind of flow sees.
+ *
+ * The bulk sources are rate based AIMD senders: they grow their rate
+ * every RTT and halve it when one of their packets is dropped or comes
+ * out marked, which is enough to build the standing queue drop-tail
+ * suffers from.
+ *
+ * classq_fq_codel.c and the flow hash in bsd/net/flowhash.c are compiled
+ * in as they are, on top of the headers in shim/; those stand in for the
+ * mbuf, the class queue primitives of classq.c, the interface send queue
+ * and the clock, which here is the simulation's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/errno.h>
+#include <sys/syslog.h>
+
+#define	PRIVATE			1
+#define	BSD_KERNEL_PRIVATE	1
+#define	PF_ECN			1
+
+#include "../../../bsd/net/flowhash.c"
+#include "../../../bsd/net/classq/classq_fq_codel.c"
+
+#define	NSEC_PER_MSEC	(1000ULL * 1000)
+#define	NSEC_PER_SEC	(1000ULL * 1000 * 1000)
+
+static u_int64_t sim_now;		/* simulated uptime, in nsec */
+
+void
+nanouptime(struct timespec *ts)
+{
+	ts->tv_sec = sim_now / NSEC_PER_SEC;
+	ts->tv_nsec = sim_now % NSEC_PER_SEC;
+}
+
+/* every packet the class queue frees is a drop */
+static void sim_drop(struct mbuf *);
+
+void
+m_freem(struct mbuf *m)
+{
+	sim_drop(m);
+}
+
+int
+mark_ecn(struct mbuf *m, struct pf_mtag *t, int flags)
+{
+#pragma unused(t, flags)
+	if (!(m->m_sim_ecn & SIM_ECN_ECT))
+		return (0);
+	m->m_sim_ecn |= SIM_ECN_CE;
+	return (1);
+}
+
+/*
+ * Simulation
+ */
+#define	SIM_TICK	(10 * 1000ULL)		/* 10 usec */
+#define	SIM_WARMUP	(2 * NSEC_PER_SEC)
+#define	SIM_RTT		(50 * NSEC_PER_MSEC)
+
+/* queue disciplines */
+#define	SIM_DROPTAIL	0
+#define	SIM_FQ_CODEL	1		/* CoDel drops */
+#define	SIM_FQ_CODEL_ECN 2		/* CoDel marks the bulk flows */
+#define	SIM_NMODES	3
+
+static const char *mode_names[SIM_NMODES] = {
+	"droptail", "fq_codel", "fq_codel+ecn"
+};
+
+#define	NBULK		4
+#define	SRC_RPC		NBULK
+#define	NSRC		(NBULK + 1)
+
+/* 200 byte request every 5 msec */
+#define	RPC_PKTLEN	200
+#define	RPC_RATE	(RPC_PKTLEN * 8 * 200)
+
+struct source {
+	u_int32_t	flowid;
+	u_int32_t	pktlen;
+	double		rate;		/* bits per second */
+	double		credit;		/* bytes */
+	u_int64_t	last_cut;	/* last rate decrease */
+	u_int64_t	last_grow;	/* last rate increase */
+	int		aimd;
+	/* statistics, after warmup */
+	u_int64_t	sent, dropped, delivered;
+	u_int64_t	*sojourn;
+	u_int64_t	nsojourn, maxsojourn;
+};
+
+static struct source src[NSRC];
+static u_int64_t sim_drops;
+
+/* the sender sees the loss or mark about one RTT later; close enough */
+static void
+sim_congestion(struct source *s)
+{
+	if (s->aimd && sim_now - s->last_cut >= SIM_RTT) {
+		s->rate /= 2;
+		s->last_cut = sim_now;
+	}
+}
+
+static void
+sim_drop(struct mbuf *m)
+{
+	struct source *s = &src[m->m_sim_src];
+
+	sim_congestion(s);
+	if (m->m_sim_ts >= SIM_WARMUP)
+		s->dropped++;
+	sim_drops++;
+	free(m);
+}
+
+static int
+u64cmp(const void *a, const void *b)
+{
+	u_int64_t x = *(const u_int64_t *)a, y = *(const u_int64_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static u_int64_t
+pct(struct source *s, int p)
+{
+	if (s->nsojourn == 0)
+		return (0);
+	return (s->sojourn[(s->nsojourn - 1) * p / 100]);
+}
+
+struct result {
+	u_int64_t	rpc_p50, rpc_p99;
+	u_int64_t	bulk_p50, bulk_p99;
+	double		util;
+	u_int64_t	drop_codel, drop_overflow, marked, new_flows;
+};
+
+static void
+run(int mode, double linkrate, u_int64_t duration, u_int32_t qlim,
+    struct result *res)
+{
+	static u_int64_t *bulk;
+	static struct ifnet ifp;
+	class_queue_t fifo;
+	struct fq_codel *fqc = NULL;
+	class_queue_t cq;
+	u_int64_t busy_until = 0, busy_bits = 0, nbulk = 0;
+	u_int64_t enq = 0, deq = 0;
+	struct mbuf *m;
+	int i, n, fq = (mode != SIM_DROPTAIL);
+
+	bzero(src, sizeof (src));
+	for (i = 0; i < NSRC; i++) {
+		src[i].flowid = 0x1000 + i * 7919;
+		src[i].sojourn = calloc(duration / SIM_TICK, sizeof (u_int64_t));
+		if (src[i].sojourn == NULL)
+			err(1, "calloc");
+		if (i < NBULK) {
+			src[i].pktlen = 1500;
+			src[i].rate = linkrate / NBULK / 2;
+			src[i].aimd = 1;
+		} else {
+			src[i].pktlen = RPC_PKTLEN;
+			src[i].rate = RPC_RATE;
+		}
+	}
+	bzero(res, sizeof (*res));
+	sim_drops = 0;
+	sim_now = 0;
+	_qinit(&fifo, Q_DROPTAIL, qlim);
+	_qinit(&cq, Q_DROPTAIL, qlim);
+	if (fq) {
+		bzero(&ifp, sizeof (ifp));
+		ifp.if_xname = "sim0";
+		ifp.if_mtu = 1500;
+		ifp.if_hdrlen = 14;
+		fqc = fq_codel_alloc(&ifp, 0, qlim,
+		    mode == SIM_FQ_CODEL_ECN ? FQCF_ECN : 0);
+		if (fqc == NULL)
+			errx(1, "fq_codel_alloc");
+	}
+
+	for (sim_now = 0; sim_now < duration; sim_now += SIM_TICK) {
+		/* sources */
+		for (i = 0; i < NSRC; i++) {
+			struct source *s = &src[i];
+
+			if (s->aimd && sim_now - s->last_grow >= SIM_RTT) {
+				s->rate += linkrate / 200;
+				s->last_grow = sim_now;
+			}
+			s->credit += s->rate / 8 * SIM_TICK / NSEC_PER_SEC;
+			while (s->credit >= s->pktlen) {
+				s->credit -= s->pktlen;
+				if ((m = calloc(1, sizeof (*m))) == NULL)
+					err(1, "calloc");
+				m->m_pkthdr.len = s->pktlen;
+				m->m_pkthdr.pkt_flowid = s->flowid;
+				m->m_sim_ts = sim_now;
+				m->m_sim_src = i;
+				if (mode == SIM_FQ_CODEL_ECN && s->aimd)
+					m->m_sim_ecn = SIM_ECN_ECT;
+				if (sim_now >= SIM_WARMUP)
+					s->sent++;
+				enq++;
+				if (fq) {
+					IFCQ_INC_LEN(&ifp.if_snd);
+					IFCQ_INC_BYTES(&ifp.if_snd,
+					    m_pktlen(m));
+					if (fq_codel_addq(fqc, &cq, m, NULL) !=
+					    CLASSQEQ_SUCCESS) {
+						IFCQ_DEC_LEN(&ifp.if_snd);
+						IFCQ_DEC_BYTES(&ifp.if_snd,
+						    m_pktlen(m));
+					}
+				} else if (qlen(&fifo) >= qlimit(&fifo)) {
+					sim_drop(m);
+				} else {
+					_addq(&fifo, m);
+				}
+			}
+		}
+
+		/* link */
+		if (busy_until > sim_now)
+			continue;
+		if (fq) {
+			if ((m = fq_codel_getq(fqc, &cq)) != NULL) {
+				IFCQ_DEC_LEN(&ifp.if_snd);
+				IFCQ_DEC_BYTES(&ifp.if_snd, m_pktlen(m));
+			}
+		} else {
+			m = _getq(&fifo);
+		}
+		if (m == NULL)
+			continue;
+		deq++;
+		busy_until = sim_now +
+		    (u_int64_t)(m_pktlen(m) * 8 * NSEC_PER_SEC / linkrate);
+		if (m->m_sim_ecn & SIM_ECN_CE)
+			sim_congestion(&src[m->m_sim_src]);
+		if (m->m_sim_ts >= SIM_WARMUP) {
+			struct source *s = &src[m->m_sim_src];
+			u_int64_t sj = sim_now - m->m_sim_ts;
+
+			busy_bits += m_pktlen(m) * 8;
+			s->delivered++;
+			s->sojourn[s->nsojourn++] = sj;
+		}
+		free(m);
+	}
+
+	/* conservation: every packet was sent, dropped or is still queued */
+	if (fq) {
+		VERIFY(IFCQ_LEN(&ifp.if_snd) == qlen(&cq));
+		n = qlen(&cq);
+		/* destroy would hand these to m_freem, i.e. count them lost */
+		for (i = 0; i < FQ_CODEL_FLOWS; i++) {
+			while ((m = _getq(&FQ_CODEL_FLOW(fqc, i)->fqf_q)) !=
+			    NULL) {
+				fq_codel_q_dec(&cq, m);
+				free(m);
+			}
+		}
+		VERIFY(qempty(&cq));
+		res->drop_codel = fqc->fqc_stats.drop_codel;
+		res->drop_overflow = fqc->fqc_stats.drop_overflow;
+		res->marked = fqc->fqc_stats.marked_packets;
+		res->new_flows = fqc->fqc_stats.new_flow_count;
+		fq_codel_destroy(fqc);
+	} else {
+		n = qlen(&fifo);
+		while ((m = _getq(&fifo)) != NULL)
+			free(m);
+	}
+	if (enq != deq + sim_drops + n)
+		errx(1, "packet conservation: %llu in, %llu out, %llu dropped, "
+		    "%d queued", (unsigned long long)enq,
+		    (unsigned long long)deq, (unsigned long long)sim_drops, n);
+
+	/* bulk flows are pooled together for the percentiles */
+	bulk = realloc(bulk, (duration / SIM_TICK) * NBULK * sizeof (*bulk));
+	if (bulk == NULL)
+		err(1, "realloc");
+	for (i = 0; i < NSRC; i++) {
+		qsort(src[i].sojourn, src[i].nsojourn, sizeof (u_int64_t),
+		    u64cmp);
+		if (i < NBULK) {
+			bcopy(src[i].sojourn, &bulk[nbulk],
+			    src[i].nsojourn * sizeof (u_int64_t));
+			nbulk += src[i].nsojourn;
+		}
+	}
+	qsort(bulk, nbulk, sizeof (u_int64_t), u64cmp);
+
+	res->rpc_p50 = pct(&src[SRC_RPC], 50);
+	res->rpc_p99 = pct(&src[SRC_RPC], 99);
+	res->bulk_p50 = nbulk ? bulk[(nbulk - 1) / 2] : 0;
+	res->bulk_p99 = nbulk ? bulk[(nbulk - 1) * 99 / 100] : 0;
+	res->util = (double)busy_bits /
+	    (linkrate * (duration - SIM_WARMUP) / NSEC_PER_SEC);
+
+	printf("%-12s rpc p50 %7.2f ms p99 %7.2f ms (%llu/%llu delivered)  "
+	    "bulk p50 %7.2f ms p99 %7.2f ms  util %5.1f%%\n",
+	    mode_names[mode],
+	    (double)res->rpc_p50 / NSEC_PER_MSEC,
+	    (double)res->rpc_p99 / NSEC_PER_MSEC,
+	    (unsigned long long)src[SRC_RPC].delivered,
+	    (unsigned long long)src[SRC_RPC].sent,
+	    (double)res->bulk_p50 / NSEC_PER_MSEC,
+	    (double)res->bulk_p99 / NSEC_PER_MSEC, res->util * 100);
+	if (fq) {
+		printf("%-12s %llu codel drops, %llu overflow drops, "
+		    "%llu marked, %llu new flows\n", "",
+		    (unsigned long long)res->drop_codel,
+		    (unsigned long long)res->drop_overflow,
+		    (unsigned long long)res->marked,
+		    (unsigned long long)res->new_flows);
+	}
+	for (i = 0; i < NSRC; i++)
+		free(src[i].sojourn);
+}
+
+/*
+ * A suspended class queue refuses new packets and hands nothing out,
+ * and keeps what it holds for when it is resumed.
+ */
+static int
+check_suspend(void)
+{
+	static struct ifnet ifp;
+	struct fq_codel *fqc;
+	class_queue_t cq;
+	struct mbuf *m;
+	int fail = 0;
+
+	bzero(&ifp, sizeof (ifp));
+	ifp.if_xname = "sim1";
+	ifp.if_mtu = 1500;
+	ifp.if_hdrlen = 14;
+	_qinit(&cq, Q_DROPTAIL, 16);
+	if ((fqc = fq_codel_alloc(&ifp, 0, 16, 0)) == NULL)
+		errx(1, "fq_codel_alloc");
+	sim_drops = 0;
+
+	if ((m = calloc(1, sizeof (*m))) == NULL)
+		err(1, "calloc");
+	m->m_pkthdr.len = 100;
+	m->m_pkthdr.pkt_flowid = 1;
+	IFCQ_INC_LEN(&ifp.if_snd);
+	if (fq_codel_addq(fqc, &cq, m, NULL) != CLASSQEQ_SUCCESS)
+		fail = 1;
+
+	fq_codel_suspendq(fqc, &cq, TRUE);
+	if ((m = calloc(1, sizeof (*m))) == NULL)
+		err(1, "calloc");
+	m->m_pkthdr.len = 100;
+	m->m_pkthdr.pkt_flowid = 2;
+	if (fq_codel_addq(fqc, &cq, m, NULL) != CLASSQEQ_DROPPED_SP ||
+	    sim_drops != 1 || fqc->fqc_stats.drop_suspended != 1)
+		fail = 1;
+	if (fq_codel_getq(fqc, &cq) != NULL || qlen(&cq) != 1)
+		fail = 1;
+
+	fq_codel_suspendq(fqc, &cq, FALSE);
+	if ((m = fq_codel_getq(fqc, &cq)) == NULL ||
+	    m->m_pkthdr.pkt_flowid != 1)
+		fail = 1;
+	free(m);
+	fq_codel_destroy(fqc);
+
+	if (fail)
+		printf("FAIL: suspended queue\n");
+	return (fail);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: fq_codel_sim [-r link Mbps] [-t seconds] "
+	    "[-q qlimit]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct result res[SIM_NMODES];
+	u_int64_t target;
+	double mbps = 10;
+	u_int64_t secs = 20;
+	u_int32_t qlim = 512;
+	int ch, mode, fail = 0;
+
+	while ((ch = getopt(argc, argv, "r:t:q:")) != -1) {
+		switch (ch) {
+		case 'r':
+			mbps = atof(optarg);
+			break;
+		case 't':
+			secs = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			qlim = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (mbps <= 0 || secs * NSEC_PER_SEC <= SIM_WARMUP || qlim == 0)
+		usage();
+
+	printf("%.1f Mbps link, %d bulk flows + 1 rpc flow, qlimit %u, "
+	    "%llu sec\n", mbps, NBULK, qlim, (unsigned long long)secs);
+
+	fq_codel_init();
+	fail = check_suspend();
+
+	for (mode = 0; mode < SIM_NMODES; mode++) {
+		srandom(1);
+		run(mode, mbps * 1000 * 1000, secs * NSEC_PER_SEC, qlim,
+		    &res[mode]);
+	}
+
+	/*
+	 * The rpc flow should only ever wait behind a few packets, the
+	 * bulk flows' standing queue should be near the 5 msec target
+	 * (or a packet time, on slow links), and the link should stay busy;
+	 * with rate based senders that halve on every loss episode and a
+	 * queue kept well under one RTT, some utilization is given up.
+	 */
+	target = 5 * NSEC_PER_MSEC;
+	if (target < 1500 * 8 * NSEC_PER_SEC / (mbps * 1000 * 1000))
+		target = 1500 * 8 * NSEC_PER_SEC / (mbps * 1000 * 1000);
+	for (mode = SIM_FQ_CODEL; mode < SIM_NMODES; mode++) {
+		struct result *fq = &res[mode];
+		const char *name = mode_names[mode];
+
+		if (RPC_RATE * 2 * NSRC > mbps * 1000 * 1000) {
+			/* well over half its fair share, it isn't sparse */
+			printf("%s: rpc flow not sparse at %.1f Mbps, "
+			    "not checked\n", name, mbps);
+		} else if (fq->rpc_p99 > 3 * target ||
+		    fq->rpc_p99 >= res[SIM_DROPTAIL].rpc_p99) {
+			printf("FAIL: %s: rpc p99 sojourn not reduced\n", name);
+			fail = 1;
+		}
+		if (fq->bulk_p50 > NSRC * target) {	/* a DRR round */
+			printf("FAIL: %s: bulk flows keep a standing queue\n",
+			    name);
+			fail = 1;
+		}
+		if (fq->util < 0.75) {
+			printf("FAIL: %s: link utilization %.1f%%\n", name,
+			    fq->util * 100);
+			fail = 1;
+		}
+	}
+	/* with ECN the bulk flows are marked rather than dropped */
+	if (res[SIM_FQ_CODEL].drop_codel == 0 ||
+	    res[SIM_FQ_CODEL_ECN].marked == 0 ||
+	    res[SIM_FQ_CODEL_ECN].drop_codel >= res[SIM_FQ_CODEL].drop_codel) {
+		printf("FAIL: ECN marking not used\n");
+		fail = 1;
+	}
+	if (!fail)
+		printf("PASS\n");
+
+	return (fail);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _SHIM_KERN_ZALLOC_H_
+#define	_SHIM_KERN_ZALLOC_H_
+
+#include <stdlib.h>
+
+struct zone {
+	size_t		z_elem_size;
+};
+
+#define	Z_EXPAND	0
+#define	Z_CALLERACCT	1
+
+static inline struct zone *
+zinit(size_t size, size_t max, size_t alloc, const char *name)
+{
+#pragma unused(max, alloc, name)
+	struct zone *z = calloc(1, sizeof (*z));
+
+	if (z != NULL)
+		z->z_elem_size = size;
+	return (z);
+}
+
+#define	zone_change(_z, _item, _value)	((void)0)
+#define	zalloc(_z)			calloc(1, (_z)->z_elem_size)
+#define	zfree(_z, _elem)		free(_elem)
+
+#endif /* _SHIM_KERN_ZALLOC_H_ */
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * The class queue and interface send queue pieces FQ-CoDel relies on,
+ * after bsd/net/classq/classq.[ch] and if_classq.h.
+ */
+
+#ifndef _SHIM_NET_CLASSQ_IF_CLASSQ_H_
+#define	_SHIM_NET_CLASSQ_IF_CLASSQ_H_
+
+#include <sys/types.h>
+#include <sys/mbuf.h>
+
+#ifndef TRUE
+#define	TRUE	1
+#define	FALSE	0
+#endif
+typedef int boolean_t;
+
+typedef enum classq_type {
+	Q_DROPHEAD,
+	Q_DROPTAIL,
+} classq_type_t;
+
+typedef struct _class_queue_ {
+	struct mbuf	*head, *tail;
+	u_int32_t	qlen;
+	u_int32_t	qlim;
+	u_int64_t	qsize;
+	classq_type_t	qtype;
+} class_queue_t;
+
+#define	qlimit(q)	(q)->qlim
+#define	qlen(q)		(q)->qlen
+#define	qsize(q)	(q)->qsize
+#define	qempty(q)	(qlen(q) == 0)
+
+#define	CLASSQF_ECN4	0x01
+#define	CLASSQF_ECN6	0x02
+
+#define	CLASSQEQ_DROPPED	(-1)
+#define	CLASSQEQ_SUCCESS	0
+#define	CLASSQEQ_DROPPED_SP	3
+
+typedef enum cqev {
+	CLASSQ_EV_LINK_BANDWIDTH = 1,
+	CLASSQ_EV_LINK_LATENCY = 2,
+	CLASSQ_EV_LINK_MTU =	3,
+	CLASSQ_EV_LINK_UP =	4,
+	CLASSQ_EV_LINK_DOWN =	5,
+} cqev_t;
+
+struct ifclassq {
+	u_int32_t	ifcq_len;
+	u_int64_t	ifcq_bytes;
+	u_int64_t	ifcq_target_qdelay;
+	u_int64_t	ifcq_droppkts;
+	u_int64_t	ifcq_dropbytes;
+};
+
+#define	IFCQ_CONVERT_LOCK(_ifcq)	((void)0)
+#define	IFCQ_LEN(_ifcq)			((_ifcq)->ifcq_len)
+#define	IFCQ_IS_EMPTY(_ifcq)		(IFCQ_LEN(_ifcq) == 0)
+#define	IFCQ_INC_LEN(_ifcq)		(IFCQ_LEN(_ifcq)++)
+#define	IFCQ_DEC_LEN(_ifcq)		(IFCQ_LEN(_ifcq)--)
+#define	IFCQ_TARGET_QDELAY(_ifcq)	((_ifcq)->ifcq_target_qdelay)
+#define	IFCQ_BYTES(_ifcq)		((_ifcq)->ifcq_bytes)
+#define	IFCQ_INC_BYTES(_ifcq, _len)	(IFCQ_BYTES(_ifcq) += (_len))
+#define	IFCQ_DEC_BYTES(_ifcq, _len)	(IFCQ_BYTES(_ifcq) -= (_len))
+#define	IFCQ_DROP_ADD(_ifcq, _pkt, _len) do {				\
+	(_ifcq)->ifcq_droppkts += (_pkt);				\
+	(_ifcq)->ifcq_dropbytes += (_len);				\
+} while (0)
+
+static u_int32_t classq_verbose = 0;
+
+static inline const char *
+ifclassq_ev2str(cqev_t ev)
+{
+#pragma unused(ev)
+	return ("event");
+}
+
+/* provided by the simulation */
+extern int mark_ecn(struct mbuf *, struct pf_mtag *, int);
+
+static inline void
+_qinit(class_queue_t *q, int type, int lim)
+{
+	bzero(q, sizeof (*q));
+	q->qtype = type;
+	q->qlim = lim;
+}
+
+static inline void
+_addq(class_queue_t *q, struct mbuf *m)
+{
+	m->m_nextpkt = NULL;
+	if (q->tail != NULL)
+		q->tail->m_nextpkt = m;
+	else
+		q->head = m;
+	q->tail = m;
+	qlen(q)++;
+	qsize(q) += m_length(m);
+}
+
+static inline struct mbuf *
+_getq(class_queue_t *q)
+{
+	struct mbuf *m;
+
+	if ((m = q->head) == NULL) {
+		qsize(q) = 0;
+		return (NULL);
+	}
+	if ((q->head = m->m_nextpkt) == NULL)
+		q->tail = NULL;
+	m->m_nextpkt = NULL;
+	qlen(q)--;
+	if (((int)qsize(q) - m_length(m)) > 0)
+		qsize(q) -= m_length(m);
+	else if (qsize(q) != 0)
+		qsize(q) = 0;
+	return (m);
+}
+
+/* the simulation only ever purges whole queues */
+static inline struct mbuf *
+_getq_flow(class_queue_t *q, u_int32_t flow)
+{
+#pragma unused(flow)
+	return (_getq(q));
+}
+
+static inline void
+_flushq(class_queue_t *q)
+{
+	struct mbuf *m;
+
+	while ((m = _getq(q)) != NULL)
+		m_freem(m);
+}
+
+#endif /* _SHIM_NET_CLASSQ_IF_CLASSQ_H_ */
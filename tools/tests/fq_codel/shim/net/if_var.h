@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Just the interface fields FQ-CoDel looks at, and its send queue.
+ */
+
+#ifndef _SHIM_NET_IF_VAR_H_
+#define	_SHIM_NET_IF_VAR_H_
+
+#include <net/classq/if_classq.h>
+
+#define	IFEF_ENQUEUE_MULTI	0x00000002
+
+struct ifnet {
+	const char	*if_xname;
+	u_int32_t	if_eflags;
+	u_int32_t	if_mtu;
+	u_int32_t	if_hdrlen;
+	u_int64_t	if_start_delay_timeout;
+	struct ifclassq	if_snd;
+};
+
+#define	if_name(_ifp)	((_ifp)->if_xname)
+
+#endif /* _SHIM_NET_IF_VAR_H_ */
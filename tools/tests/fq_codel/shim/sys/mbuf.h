@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Minimal userland stand-in for the kernel mbuf, sufficient for the
+ * FQ-CoDel code in bsd/net/classq/classq_fq_codel.c; a packet is a
+ * single mbuf with a packet header.  m_freem() is provided by the
+ * simulation, which sees every packet the queue drops through it.
+ */
+
+#ifndef _SHIM_SYS_MBUF_H_
+#define	_SHIM_SYS_MBUF_H_
+
+#include <sys/types.h>
+
+struct pf_mtag;
+
+struct pkthdr {
+	u_int32_t	len;
+	u_int32_t	pkt_flowid;
+	u_int64_t	pkt_enqueue_ts;
+};
+
+struct mbuf {
+	struct mbuf	*m_nextpkt;
+	struct pkthdr	m_pkthdr;
+	/* for the simulation */
+	u_int64_t	m_sim_ts;	/* arrival time */
+	int		m_sim_src;	/* index of the sending source */
+	int		m_sim_ecn;	/* SIM_ECN_* */
+};
+
+#define	SIM_ECN_ECT	0x1		/* ECN capable transport */
+#define	SIM_ECN_CE	0x2		/* congestion experienced */
+
+#define	m_pktlen(m)	((int)(m)->m_pkthdr.len)
+#define	m_length(m)	((int)(m)->m_pkthdr.len)
+#define	m_pftag(m)	((struct pf_mtag *)NULL)
+
+extern void m_freem(struct mbuf *);
+
+#endif /* _SHIM_SYS_MBUF_H_ */
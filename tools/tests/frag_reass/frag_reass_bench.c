@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Model of IP fragment reassembly, before and after the shared
+ * reassembly tables (bsd/netinet/frag_reass.c).
+ *
+ * The old scheme keeps each datagram's fragments on a list sorted by
+ * offset, walked on every insertion and again to check for completeness,
+ * and (for IPv6) all datagrams on one list.  The new one keeps a running
+ * byte count, so that completeness is a comparison, and the datagrams in
+ * a hash table.  Its fragments are on a sorted list searched from the
+ * tail, then from the head, and also in a red-black tree by offset once there are more than
+ * TREE_MIN of them.
+ *
+ * The first test reassembles single datagrams whose fragments arrive in
+ * random order, with the old list, the new list alone, the tree alone
+ * and the two combined, and reports from how many fragments the tree
+ * beats the list; TREE_MIN should be about there.  The second interleaves
+ * the fragments of many datagrams, as a flood of fragmented traffic
+ * would.  Fails if any scheme does not reassemble every datagram with
+ * the right contents.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#include <libkern/tree.h>
+
+#define	FRAGLEN		8		/* smallest non-final fragment */
+#define	NHASH		512		/* IPREASS_NHASH */
+#define	NSINGLE		(1 << 20)	/* fragments per single-datagram run */
+#define	TREE_MIN	128		/* FRAGQ_TREE_MIN */
+
+/* schemes */
+#define	OLD		0		/* ip_reass() before frag_reass.c */
+#define	LIST		1		/* byte count, sorted list only */
+#define	TREE		2		/* byte count, tree only */
+#define	HYBRID		3		/* frag_reass.c */
+#define	NSCHEMES	4
+
+static const char *scheme_names[NSCHEMES] = {
+	"old list", "sorted list", "tree", "list+tree"
+};
+
+struct frag {
+	struct frag	*next;		/* old: sorted list */
+	TAILQ_ENTRY(frag) tq;		/* new: sorted list */
+	RB_ENTRY(frag)	link;		/* new: tree */
+	uint32_t	id;		/* stands in for src, dst, id */
+	uint32_t	off, len;
+	int		more;
+	uint8_t		*data;
+};
+
+TAILQ_HEAD(frag_list, frag);
+
+struct dgram {
+	TAILQ_ENTRY(dgram) link;
+	uint32_t	id;
+	struct frag	*list;		/* old */
+	struct frag_list flist;		/* new */
+	RB_HEAD(frag_tree, frag) tree;	/* new */
+	uint32_t	nfrags, bytes, len;
+	int		last;
+	int		istree;		/* tree is kept */
+};
+
+TAILQ_HEAD(dgram_head, dgram);
+
+static int
+frag_cmp(struct frag *a, struct frag *b)
+{
+	return (a->off < b->off ? -1 : a->off > b->off);
+}
+
+RB_PROTOTYPE(frag_tree, frag, link, frag_cmp);
+RB_GENERATE(frag_tree, frag, link, frag_cmp);
+
+static int failed;
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+shuffle(struct frag **v, uint32_t n)
+{
+	uint32_t i, j;
+	struct frag *t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		t = v[i];
+		v[i] = v[j];
+		v[j] = t;
+	}
+}
+
+static struct frag **
+make_frags(uint32_t nfrags, uint32_t id)
+{
+	struct frag **v;
+	uint32_t i, k;
+
+	if ((v = calloc(nfrags, sizeof (*v))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nfrags; i++) {
+		if ((v[i] = calloc(1, sizeof (**v))) == NULL ||
+		    (v[i]->data = malloc(FRAGLEN)) == NULL)
+			err(1, "calloc");
+		v[i]->id = id;
+		v[i]->off = i * FRAGLEN;
+		v[i]->len = FRAGLEN;
+		v[i]->more = (i != nfrags - 1);
+		for (k = 0; k < FRAGLEN; k++)
+			v[i]->data[k] = (uint8_t)(id * 31 + v[i]->off + k);
+	}
+	return (v);
+}
+
+/* old ip_reass(): sorted insert, then walk for completeness */
+static int
+old_insert(struct dgram *d, struct frag *f)
+{
+	struct frag *p, *q;
+	uint32_t next;
+
+	for (p = NULL, q = d->list; q != NULL; p = q, q = q->next)
+		if (q->off > f->off)
+			break;
+	if (p != NULL && p->off + p->len > f->off)
+		return (0);	/* the model never overlaps */
+	f->next = q;
+	if (p != NULL)
+		p->next = f;
+	else
+		d->list = f;
+
+	next = 0;
+	for (p = NULL, q = d->list; q != NULL; p = q, q = q->next) {
+		if (q->off != next)
+			return (0);
+		next += q->len;
+	}
+	return (!p->more);
+}
+
+static void
+dgram_init(struct dgram *d, uint32_t id)
+{
+	memset(d, 0, sizeof (*d));
+	d->id = id;
+	TAILQ_INIT(&d->flist);
+	RB_INIT(&d->tree);
+}
+
+/* fragq_lookup_le() */
+static struct frag *
+lookup_le(struct dgram *d, uint32_t off, int tree)
+{
+	struct frag *f, *le = NULL;
+
+	if (!tree) {
+		f = TAILQ_LAST(&d->flist, frag_list);
+		if (f == NULL || f->off <= off)
+			return (f);
+		TAILQ_FOREACH(f, &d->flist, tq) {
+			if (f->off > off)
+				break;
+			le = f;
+		}
+		return (le);
+	}
+	f = RB_ROOT(&d->tree);
+	while (f != NULL) {
+		if (f->off <= off) {
+			le = f;
+			f = RB_RIGHT(f, link);
+		} else {
+			f = RB_LEFT(f, link);
+		}
+	}
+	return (le);
+}
+
+/* frag_reass.c: completeness from the byte count */
+static int
+new_insert(struct dgram *d, struct frag *f, int scheme)
+{
+	struct frag *p, *q;
+	int tree = (scheme == TREE || (scheme == HYBRID && d->istree));
+
+	p = lookup_le(d, f->off, tree);
+	if (p != NULL && p->off + p->len > f->off)
+		return (0);	/* the model never overlaps */
+	if (tree) {
+		if (RB_INSERT(frag_tree, &d->tree, f) != NULL)
+			return (0);
+	} else if (p != NULL && p->off == f->off) {
+		return (0);
+	}
+	if (scheme != TREE) {
+		if (p != NULL)
+			TAILQ_INSERT_AFTER(&d->flist, p, f, tq);
+		else
+			TAILQ_INSERT_HEAD(&d->flist, f, tq);
+	}
+	if (++d->nfrags > TREE_MIN && scheme == HYBRID && !d->istree) {
+		TAILQ_FOREACH(q, &d->flist, tq)
+			RB_INSERT(frag_tree, &d->tree, q);
+		d->istree = 1;
+	}
+	d->bytes += f->len;
+	if (!f->more) {
+		d->last = 1;
+		d->len = f->off + f->len;
+	}
+	return (d->last && d->bytes == d->len);
+}
+
+static int
+insert(struct dgram *d, struct frag *f, int scheme)
+{
+	return (scheme == OLD ? old_insert(d, f) : new_insert(d, f, scheme));
+}
+
+static void
+check(struct dgram *d, int scheme, uint32_t nfrags)
+{
+	struct frag *f, *next;
+	uint32_t n = 0, k;
+
+	if (scheme == OLD)
+		f = d->list;
+	else if (scheme == TREE)
+		f = RB_MIN(frag_tree, &d->tree);
+	else
+		f = TAILQ_FIRST(&d->flist);
+	for (; f != NULL; f = next, n++) {
+		if (f->off != n * FRAGLEN)
+			break;
+		for (k = 0; k < f->len; k++)
+			if (f->data[k] != (uint8_t)(d->id * 31 + f->off + k))
+				break;
+		if (k != f->len)
+			break;
+		if (scheme == OLD)
+			next = f->next;
+		else if (scheme == TREE)
+			next = RB_NEXT(frag_tree, &d->tree, f);
+		else
+			next = TAILQ_NEXT(f, tq);
+	}
+	if (n != nfrags || (scheme == HYBRID &&
+	    d->istree != (nfrags > TREE_MIN))) {
+		printf("FAIL: datagram %u reassembled wrong (%s)\n", d->id,
+		    scheme_names[scheme]);
+		failed = 1;
+	}
+}
+
+/* returns the tree's time over the list's */
+static double
+test_single(uint32_t nfrags)
+{
+	struct frag **v = make_frags(nfrags, 1);
+	struct dgram d;
+	double t[NSCHEMES], t0;
+	uint32_t i, r, reps = (NSINGLE + nfrags - 1) / nfrags;
+	int scheme, done = 0;
+
+	for (scheme = 0; scheme < NSCHEMES; scheme++) {
+		srandom(nfrags);
+		t[scheme] = 0;
+		for (r = 0; r < reps; r++) {
+			shuffle(v, nfrags);
+			dgram_init(&d, 1);
+			done = 0;
+			t0 = now_sec();
+			for (i = 0; i < nfrags; i++)
+				done = insert(&d, v[i], scheme);
+			t[scheme] += now_sec() - t0;
+			if (!done)
+				break;
+		}
+		if (!done) {
+			printf("FAIL: datagram of %u fragments not complete "
+			    "(%s)\n", nfrags, scheme_names[scheme]);
+			failed = 1;
+		}
+		check(&d, scheme, nfrags);
+	}
+	printf("%9u", nfrags);
+	for (scheme = 0; scheme < NSCHEMES; scheme++)
+		printf(" %12.1f", t[scheme] * 1e9 / nfrags / reps);
+	printf("\n");
+	for (i = 0; i < nfrags; i++) {
+		free(v[i]->data);
+		free(v[i]);
+	}
+	free(v);
+	return (t[TREE] / t[LIST]);
+}
+
+static void
+test_flood(uint32_t ndgrams, uint32_t nfrags)
+{
+	struct dgram_head global, hash[NHASH], *head;
+	struct dgram *dg, *d;
+	struct frag ***v, **order;
+	uint32_t i, j, n = ndgrams * nfrags, ncomplete;
+	double t[2];
+	int scheme;
+
+	if ((dg = calloc(ndgrams, sizeof (*dg))) == NULL ||
+	    (v = calloc(ndgrams, sizeof (*v))) == NULL ||
+	    (order = calloc(n, sizeof (*order))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < ndgrams; i++) {
+		v[i] = make_frags(nfrags, i);
+		for (j = 0; j < nfrags; j++)
+			order[i * nfrags + j] = v[i][j];
+	}
+	srandom(ndgrams);
+	shuffle(order, n);
+
+	for (scheme = OLD; scheme <= HYBRID; scheme += HYBRID - OLD) {
+		TAILQ_INIT(&global);
+		for (i = 0; i < NHASH; i++)
+			TAILQ_INIT(&hash[i]);
+		ncomplete = 0;
+		t[scheme == HYBRID] = now_sec();
+		for (i = 0; i < n; i++) {
+			uint32_t id = order[i]->id;
+
+			head = scheme == HYBRID ? &hash[((id * 2654435761U) >> 16) &
+			    (NHASH - 1)] : &global;
+			TAILQ_FOREACH(d, head, link)
+				if (d->id == id)
+					break;
+			if (d == NULL) {
+				d = &dg[id];
+				dgram_init(d, id);
+				TAILQ_INSERT_HEAD(head, d, link);
+			}
+			if (insert(d, order[i], scheme)) {
+				check(d, scheme, nfrags);
+				TAILQ_REMOVE(head, d, link);
+				ncomplete++;
+			}
+		}
+		t[scheme == HYBRID] = now_sec() - t[scheme == HYBRID];
+		if (ncomplete != ndgrams) {
+			printf("FAIL: %u of %u datagrams complete\n",
+			    ncomplete, ndgrams);
+			failed = 1;
+		}
+	}
+	printf("%9u %9u %14.1f %14.1f %9.1fx\n", ndgrams, nfrags,
+	    t[0] * 1e9 / n, t[1] * 1e9 / n, t[0] / t[1]);
+
+	for (i = 0; i < ndgrams; i++) {
+		for (j = 0; j < nfrags; j++) {
+			free(v[i][j]->data);
+			free(v[i][j]);
+		}
+		free(v[i]);
+	}
+	free(v);
+	free(order);
+	free(dg);
+}
+
+int
+main(void)
+{
+	static const uint32_t single[] = { 4, 8, 16, 32, 48, 64, 96, 128,
+	    192, 256, 512, 1024, 8192 };
+	static const uint32_t flood[][2] = {
+		{ 64, 8 }, { 1024, 8 }, { 4096, 8 }, { 1024, 45 },
+	};
+	uint32_t i, crossover = 0;
+	int scheme;
+
+	printf("one datagram, fragments in random order (ns/fragment)\n");
+	printf("%9s", "fragments");
+	for (scheme = 0; scheme < NSCHEMES; scheme++)
+		printf(" %12s", scheme_names[scheme]);
+	printf("\n");
+	for (i = 0; i < sizeof (single) / sizeof (single[0]); i++) {
+		if (test_single(single[i]) < 1.0) {
+			if (crossover == 0)
+				crossover = single[i];
+		} else {
+			crossover = 0;
+		}
+	}
+	if (crossover != 0)
+		printf("tree beats the sorted list from %u fragments "
+		    "(TREE_MIN %u)\n", crossover, TREE_MIN);
+	else
+		printf("tree never beats the sorted list\n");
+
+	printf("\ninterleaved datagrams (ns/fragment)\n");
+	printf("%9s %9s %14s %14s %10s\n", "datagrams", "fragments",
+	    "one list", "hashed", "speedup");
+	for (i = 0; i < sizeof (flood) / sizeof (flood[0]); i++)
+		test_flood(flood[i][0], flood[i][1]);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Measures the transmit rate of a loopback-like pseudo driver whose
+ * start routine drains an interface send queue in the three ways
+ * bsd/net/classq/classq_subr.c allows:
+ *
+ *   single	ifnet_dequeue() per packet: one lock round trip and one
+ *		scheduler call per packet
+ *   loop	ifnet_dequeue_multi() without a chain-capable scheduler:
+ *		one lock round trip per chain, one scheduler call per packet
+ *   multi	ifnet_dequeue_multi() with (*ifcq_dequeue_multi): one lock
+ *		round trip and one scheduler call per chain
+ *
+ * The scheduler is a priority queue over the ten service classes, as
+ * with pktsched_priq.c; packets are small and spread over the classes.
+ * Output is sent packets per second and lock acquisitions per packet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define	VERIFY(x)	assert(x)
+#define	IFCQ_SC_MAX	10
+#define	CLASSQ_DEQUEUE_MAX_PKT_LIMIT	2048
+#define	CLASSQ_DEQUEUE_MAX_BYTE_LIMIT	(1024 * 1024)
+
+typedef enum cqdq_op {
+	CLASSQDQ_REMOVE =	1,
+	CLASSQDQ_POLL =		2,
+} cqdq_op_t;
+
+struct mbuf {
+	struct mbuf	*m_nextpkt;
+	u_int32_t	len;
+	u_int32_t	scidx;
+};
+
+typedef struct {
+	struct mbuf	*head, *tail;
+	u_int32_t	qlen;
+} class_queue_t;
+
+struct ifclassq;
+typedef struct mbuf *(*ifclassq_deq_func)(struct ifclassq *, cqdq_op_t);
+typedef int (*ifclassq_deq_multi_func)(struct ifclassq *, u_int32_t,
+    u_int32_t, struct mbuf **, struct mbuf **, u_int32_t *, u_int32_t *);
+
+struct ifclassq {
+	pthread_mutex_t	ifcq_lock;
+	u_int32_t	ifcq_len;
+	u_int32_t	ifcq_flags;
+	u_int64_t	ifcq_xmit_pkts, ifcq_xmit_bytes;
+	class_queue_t	ifcq_cl[IFCQ_SC_MAX];
+	u_int32_t	ifcq_bitmap;		/* non-empty classes */
+	ifclassq_deq_func	ifcq_dequeue;
+	ifclassq_deq_multi_func	ifcq_dequeue_multi;
+};
+
+#define	IFCQF_TBR	0x4
+#define	IFCQ_TBR_IS_ENABLED(_ifcq)	((_ifcq)->ifcq_flags & IFCQF_TBR)
+
+static u_int64_t nlocks;
+
+#define	IFCQ_LOCK(_ifcq) do {						\
+	pthread_mutex_lock(&(_ifcq)->ifcq_lock);			\
+	nlocks++;							\
+} while (0)
+#define	IFCQ_UNLOCK(_ifcq)	pthread_mutex_unlock(&(_ifcq)->ifcq_lock)
+
+/*
+ * Scheduler, after priq_dequeue()
+ */
+static void
+sched_enqueue(struct ifclassq *ifq, struct mbuf *m)
+{
+	class_queue_t *q = &ifq->ifcq_cl[m->scidx];
+
+	m->m_nextpkt = NULL;
+	if (q->tail != NULL)
+		q->tail->m_nextpkt = m;
+	else
+		q->head = m;
+	q->tail = m;
+	q->qlen++;
+	ifq->ifcq_len++;
+	ifq->ifcq_bitmap |= (1 << m->scidx);
+}
+
+static struct mbuf *
+sched_dequeue(struct ifclassq *ifq, cqdq_op_t op)
+{
+	class_queue_t *q;
+	struct mbuf *m;
+	int pri;
+
+	if (ifq->ifcq_len == 0 || ifq->ifcq_bitmap == 0)
+		return (NULL);
+	pri = 31 - __builtin_clz(ifq->ifcq_bitmap);
+	q = &ifq->ifcq_cl[pri];
+	VERIFY(q->qlen > 0);
+	if (op == CLASSQDQ_POLL)
+		return (q->head);
+
+	m = q->head;
+	if ((q->head = m->m_nextpkt) == NULL)
+		q->tail = NULL;
+	m->m_nextpkt = NULL;
+	if (--q->qlen == 0)
+		ifq->ifcq_bitmap &= ~(1 << pri);
+	ifq->ifcq_len--;
+	ifq->ifcq_xmit_pkts++;
+	ifq->ifcq_xmit_bytes += m->len;
+	return (m);
+}
+
+/* as the *_dequeue_multi_ifclassq routines of the schedulers */
+static int
+sched_dequeue_multi(struct ifclassq *ifq, u_int32_t pkt_limit,
+    u_int32_t byte_limit, struct mbuf **head, struct mbuf **tail,
+    u_int32_t *cnt, u_int32_t *len)
+{
+	struct mbuf *m, *last = NULL;
+	u_int32_t i = 0, l = 0;
+
+	*head = NULL;
+	while (i < pkt_limit && l < byte_limit) {
+		if ((m = sched_dequeue(ifq, CLASSQDQ_REMOVE)) == NULL)
+			break;
+		m->m_nextpkt = NULL;
+		if (last == NULL)
+			*head = m;
+		else
+			last->m_nextpkt = m;
+		last = m;
+		l += m->len;
+		i++;
+	}
+	*tail = last;
+	*cnt = i;
+	*len = l;
+	return ((i != 0) ? 0 : 35 /* EAGAIN */);
+}
+
+/*
+ * ifclassq_dequeue_common(), without TBR/ALTQ support
+ */
+static int
+ifclassq_dequeue(struct ifclassq *ifq, u_int32_t pkt_limit,
+    u_int32_t byte_limit, struct mbuf **head, struct mbuf **tail,
+    u_int32_t *cnt, u_int32_t *len)
+{
+	u_int32_t i = 0, l = 0;
+	struct mbuf **first, *last = NULL;
+
+	*head = NULL;
+	first = head;
+
+	IFCQ_LOCK(ifq);
+	if (pkt_limit > 1 && !IFCQ_TBR_IS_ENABLED(ifq) &&
+	    ifq->ifcq_dequeue_multi != NULL) {
+		(void) (*ifq->ifcq_dequeue_multi)(ifq, pkt_limit, byte_limit,
+		    head, &last, &i, &l);
+		goto done;
+	}
+	while (i < pkt_limit && l < byte_limit) {
+		*head = (*ifq->ifcq_dequeue)(ifq, CLASSQDQ_REMOVE);
+		if (*head == NULL)
+			break;
+		(*head)->m_nextpkt = NULL;
+		last = *head;
+		l += (*head)->len;
+		head = &(*head)->m_nextpkt;
+		i++;
+	}
+done:
+	IFCQ_UNLOCK(ifq);
+
+	if (tail != NULL)
+		*tail = last;
+	if (cnt != NULL)
+		*cnt = i;
+	if (len != NULL)
+		*len = l;
+	return ((*first != NULL) ? 0 : 35);
+}
+
+/*
+ * Pseudo driver
+ */
+enum { MODE_SINGLE, MODE_LOOP, MODE_MULTI };
+static const char *mode_name[] = { "single", "loop", "multi" };
+
+static struct mbuf *pool;
+static u_int32_t npool;
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static u_int64_t
+run(int mode, u_int32_t burst, u_int32_t limit, u_int64_t npkts,
+    double *secs)
+{
+	struct ifclassq ifq;
+	struct mbuf *m, *head, *tail;
+	u_int64_t sent = 0, sum = 0;
+	u_int32_t i, cnt, len;
+	double t0;
+
+	bzero(&ifq, sizeof (ifq));
+	pthread_mutex_init(&ifq.ifcq_lock, NULL);
+	ifq.ifcq_dequeue = sched_dequeue;
+	if (mode == MODE_MULTI)
+		ifq.ifcq_dequeue_multi = sched_dequeue_multi;
+	nlocks = 0;
+
+	t0 = now_sec();
+	while (sent < npkts) {
+		/* output path: ifclassq_enqueue(), one lock per packet */
+		for (i = 0; i < burst; i++) {
+			m = &pool[(sent + i) % npool];
+			IFCQ_LOCK(&ifq);
+			sched_enqueue(&ifq, m);
+			IFCQ_UNLOCK(&ifq);
+		}
+		/* starter thread: the driver's if_start routine */
+		for (;;) {
+			if (mode == MODE_SINGLE) {
+				if (ifclassq_dequeue(&ifq, 1,
+				    CLASSQ_DEQUEUE_MAX_BYTE_LIMIT, &head,
+				    NULL, NULL, NULL) != 0)
+					break;
+				cnt = 1;
+				sum += head->len;
+			} else {
+				if (ifclassq_dequeue(&ifq, limit,
+				    CLASSQ_DEQUEUE_MAX_BYTE_LIMIT, &head,
+				    &tail, &cnt, &len) != 0)
+					break;
+				/* "transmit" by walking the chain */
+				for (m = head; m != NULL; m = m->m_nextpkt)
+					sum += m->len;
+				VERIFY(tail != NULL && tail->m_nextpkt == NULL);
+			}
+			sent += cnt;
+		}
+		VERIFY(ifq.ifcq_len == 0);
+	}
+	*secs = now_sec() - t0;
+	VERIFY(ifq.ifcq_xmit_pkts == sent);
+	VERIFY(ifq.ifcq_xmit_bytes == sum);
+	pthread_mutex_destroy(&ifq.ifcq_lock);
+	return (sent);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: ifcq_dequeue_bench [-n packets] [-b burst] "
+	    "[-l dequeue limit]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	u_int64_t npkts = 20 * 1000 * 1000, sent;
+	u_int32_t burst = 256, limit = 256, i;
+	double secs, pps[3];
+	int ch, mode;
+
+	while ((ch = getopt(argc, argv, "n:b:l:")) != -1) {
+		switch (ch) {
+		case 'n':
+			npkts = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			burst = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			limit = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (npkts == 0 || burst == 0 || limit == 0)
+		usage();
+
+	npool = burst;
+	if ((pool = calloc(npool, sizeof (*pool))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < npool; i++) {
+		/* 64 to 127 byte packets, mostly best effort */
+		pool[i].len = 64 + (i * 37) % 64;
+		pool[i].scidx = (i % 4 == 0) ? (i / 4) % IFCQ_SC_MAX : 2;
+	}
+
+	printf("%llu packets, enqueue burst %u, dequeue limit %u\n",
+	    (unsigned long long)npkts, burst, limit);
+	for (mode = MODE_SINGLE; mode <= MODE_MULTI; mode++) {
+		sent = run(mode, burst, limit, npkts, &secs);
+		pps[mode] = sent / secs;
+		printf("%-7s %8.2f Mpps  %5.3f locks/pkt (%.3f on dequeue)\n",
+		    mode_name[mode], pps[mode] / 1e6,
+		    (double)nlocks / sent, (double)nlocks / sent - 1.0);
+	}
+	printf("multi vs single %.2fx, multi vs loop %.2fx\n",
+	    pps[MODE_MULTI] / pps[MODE_SINGLE],
+	    pps[MODE_MULTI] / pps[MODE_LOOP]);
+
+	free(pool);
+	return (0);
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Userland correctness and bandwidth test for the Internet checksum
+ * routines in bsd/netinet/cpu_in_cksum.c.  The kernel source is compiled
+ * in directly, on top of the minimal headers in shim/, so that both the
+ * portable loops and the 64-bit block kernels can be exercised and
+ * compared against a straightforward reference implementation over
+ * mbuf chains of random shape, odd lengths and arbitrary alignments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/time.h>
+
+#include "../../../bsd/netinet/cpu_in_cksum.c"
+
+#define	MAX_SPAN	(64 * 1024)
+#define	MAX_SEGS	16
+
+static int verbose = 0;
+
+/* RFC 1071, one 16-bit word at a time over a contiguous copy */
+static uint16_t
+ref_cksum(const uint8_t *buf, int len)
+{
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i + 1 < len; i += 2) {
+		uint16_t w;
+
+		memcpy(&w, buf + i, sizeof (w));
+		sum += w;
+	}
+	if (len & 1) {
+#if BYTE_ORDER == LITTLE_ENDIAN
+		sum += buf[len - 1];
+#else
+		sum += buf[len - 1] << 8;
+#endif
+	}
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	return (~sum & 0xffff);
+}
+
+struct chain {
+	struct mbuf	m[MAX_SEGS];
+	uint8_t		*store[MAX_SEGS];
+	int		nsegs;
+};
+
+/*
+ * Lay the span out over a random number of segments, each one starting
+ * at a random alignment within its own backing store.  off bytes of
+ * leading data are placed before the span.
+ */
+static void
+chain_build(struct chain *c, const uint8_t *span, int off, int len)
+{
+	int total = off + len, done = 0, i;
+
+	c->nsegs = 1 + (random() % MAX_SEGS);
+	for (i = 0; i < c->nsegs; i++) {
+		int seglen, align = random() % 8;
+
+		if (i == c->nsegs - 1)
+			seglen = total - done;
+		else if (total - done > 0)
+			seglen = random() % (total - done + 1);
+		else
+			seglen = 0;
+
+		c->store[i] = malloc(seglen + 8);
+		if (c->store[i] == NULL)
+			err(1, "malloc");
+		c->m[i].m_data = (caddr_t)c->store[i] + align;
+		c->m[i].m_len = seglen;
+		c->m[i].m_next = (i + 1 < c->nsegs) ? &c->m[i + 1] : NULL;
+
+		/* Bytes before off are garbage, the rest is the span */
+		for (int j = 0; j < seglen; j++) {
+			int pos = done + j;
+
+			c->m[i].m_data[j] = (pos < off) ?
+			    (uint8_t)random() : span[pos - off];
+		}
+		done += seglen;
+	}
+}
+
+static void
+chain_free(struct chain *c)
+{
+	int i;
+
+	for (i = 0; i < c->nsegs; i++)
+		free(c->store[i]);
+}
+
+static int
+verify(const char *mode, int iterations)
+{
+	static uint8_t span[MAX_SPAN], copy[MAX_SPAN + 8];
+	int failures = 0, n;
+
+	for (n = 0; n < iterations; n++) {
+		struct chain c;
+		int len, off, dalign, i;
+		uint16_t expected, sum, csum;
+
+		/* Bias towards short and odd lengths */
+		switch (n % 4) {
+		case 0:
+			len = random() % 128;
+			break;
+		case 1:
+			len = (random() % 1500) | 1;
+			break;
+		case 2:
+			len = random() % 9001;
+			break;
+		default:
+			len = random() % MAX_SPAN;
+			break;
+		}
+		off = random() % 64;
+		dalign = random() % 8;
+		for (i = 0; i < len; i++)
+			span[i] = (uint8_t)random();
+		/* Exercise the partial sum overflow handling as well */
+		if (n % 16 == 0)
+			memset(span, 0xff, len);
+
+		chain_build(&c, span, off, len);
+		expected = ref_cksum(span, len);
+
+		sum = cpu_in_cksum(&c.m[0], len, off, 0);
+		memset(copy, 0, sizeof (copy));
+		csum = cpu_in_cksum_copy(&c.m[0], len, off, copy + dalign, 0);
+
+		if (sum != expected || csum != expected ||
+		    memcmp(copy + dalign, span, len) != 0) {
+			printf("[FAIL] %s: len=%d off=%d segs=%d dalign=%d "
+			    "sum=0x%04x copy_sum=0x%04x expected=0x%04x%s\n",
+			    mode, len, off, c.nsegs, dalign, sum, csum,
+			    expected, memcmp(copy + dalign, span, len) ?
+			    " (copy mismatch)" : "");
+			failures++;
+		}
+		chain_free(&c);
+	}
+	if (verbose || failures == 0)
+		printf("[%s] %s: %d iterations, %d failures\n",
+		    failures ? "FAIL" : "PASS", mode, iterations, failures);
+	return (failures);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/*
+ * Report MB/s for checksumming a contiguous mbuf, for m_copydata() plus
+ * checksum, and for the fused copy-and-checksum.
+ */
+static void
+bandwidth(const char *mode, int len, int align)
+{
+	static uint8_t src[MAX_SPAN + 64], dst[MAX_SPAN + 64];
+	volatile int sink = 0;
+	struct mbuf m;
+	double t0, t1, t2, t3;
+	long iters, i;
+
+	iters = (256L * 1024 * 1024) / len;
+	memset(src, 0x5a, sizeof (src));
+	m.m_next = NULL;
+	m.m_data = (caddr_t)src + align;
+	m.m_len = len;
+
+	t0 = now();
+	for (i = 0; i < iters; i++)
+		sink += cpu_in_cksum(&m, len, 0, 0);
+	t1 = now();
+	for (i = 0; i < iters; i++) {
+		memcpy(dst, m.m_data, len);
+		sink += cpu_in_cksum(&m, len, 0, 0);
+	}
+	t2 = now();
+	for (i = 0; i < iters; i++)
+		sink += cpu_in_cksum_copy(&m, len, 0, dst, 0);
+	t3 = now();
+
+	printf("%-8s len=%6d align=%d  cksum %8.0f MB/s  "
+	    "copy+cksum %8.0f MB/s  fused %8.0f MB/s\n", mode, len, align,
+	    (iters * (double)len) / (t1 - t0) / 1e6,
+	    (iters * (double)len) / (t2 - t1) / 1e6,
+	    (iters * (double)len) / (t3 - t2) / 1e6);
+	(void) sink;
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-b] [-n iterations] [-s seed] [-v]\n",
+	    progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int sizes[] = { 40, 64, 577, 1500, 4096, 9000, 65535 };
+	in_cksum_blocks_func_t wide_blocks, wide_copy_blocks;
+	int bench = 0, iterations = 20000, failures = 0, ch;
+	unsigned seed = (unsigned)getpid();
+	size_t i;
+
+	while ((ch = getopt(argc, argv, "bn:s:v")) != -1) {
+		switch (ch) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			seed = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	printf("seed %u\n", seed);
+	srandom(seed);
+
+	cpu_in_cksum_init();
+	wide_blocks = in_cksum_blocks;
+	wide_copy_blocks = in_cksum_copy_blocks;
+
+	in_cksum_blocks = in_cksum_copy_blocks = NULL;
+	failures += verify("portable", iterations);
+	if (wide_blocks != NULL) {
+		in_cksum_blocks = wide_blocks;
+		in_cksum_copy_blocks = wide_copy_blocks;
+		failures += verify("wide", iterations);
+	} else {
+		printf("block kernels disabled\n");
+	}
+
+	if (bench) {
+		for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+			in_cksum_blocks = in_cksum_copy_blocks = NULL;
+			bandwidth("portable", sizes[i], 0);
+			bandwidth("portable", sizes[i], 1);
+			if (wide_blocks == NULL)
+				continue;
+			in_cksum_blocks = wide_blocks;
+			in_cksum_copy_blocks = wide_copy_blocks;
+			bandwidth("wide", sizes[i], 0);
+			bandwidth("wide", sizes[i], 1);
+		}
+	}
+
+	return (failures ? 1 : 0);
+}
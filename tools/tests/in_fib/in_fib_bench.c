@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Compares IPv4 longest prefix match in a binary trie, standing in for the
+ * radix tree, with the DIR-24-8 table of bsd/netinet/in_fib.c.  The table
+ * is filled the way in_fib_update() does it: the address space is cut at
+ * every prefix boundary and each piece is resolved through the trie.
+ * Every lookup result is checked against the trie.
+ *
+ * Prefixes come from a file with one prefix per line ("10.1/16",
+ * "192.168.1.0/24", "default"; anything after the first word is ignored,
+ * so `netstat -rn -f inet` output works) or are generated with a length
+ * distribution resembling a full Internet table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <mach/mach_time.h>
+
+#define	IN_FIB_GROUP		0x80000000
+#define	IN_FIB_TBL24_SIZE	(1 << 24)
+#define	IN_FIB_TBL8_SIZE	256
+
+struct prefix {
+	u_int32_t	addr;
+	u_int32_t	len;
+};
+
+struct tnode {
+	struct tnode	*child[2];
+	u_int32_t	nh;		/* 0 if no prefix ends here */
+};
+
+static struct tnode *root;
+static size_t tnodes;
+
+static u_int32_t *tbl24;
+static u_int32_t *tbl8;
+static u_int32_t ngroups, maxgroups;
+
+static u_int32_t
+mask(u_int32_t len)
+{
+	return (len == 0 ? 0 : 0xffffffff << (32 - len));
+}
+
+static void
+trie_insert(u_int32_t addr, u_int32_t len, u_int32_t nh)
+{
+	struct tnode **np = &root;
+	u_int32_t i;
+
+	for (i = 0; ; i++) {
+		if (*np == NULL) {
+			if ((*np = calloc(1, sizeof (**np))) == NULL)
+				err(1, "calloc");
+			tnodes++;
+		}
+		if (i == len)
+			break;
+		np = &(*np)->child[(addr >> (31 - i)) & 1];
+	}
+	(*np)->nh = nh;
+}
+
+static u_int32_t
+trie_lookup(u_int32_t addr)
+{
+	struct tnode *n = root;
+	u_int32_t i, nh = 0;
+
+	for (i = 0; n != NULL; i++) {
+		if (n->nh != 0)
+			nh = n->nh;
+		if (i == 32)
+			break;
+		n = n->child[(addr >> (31 - i)) & 1];
+	}
+	return (nh);
+}
+
+static inline u_int32_t
+fib_lookup(u_int32_t addr)
+{
+	u_int32_t e = tbl24[addr >> 8];
+
+	if (e & IN_FIB_GROUP)
+		e = tbl8[(e & ~IN_FIB_GROUP) * IN_FIB_TBL8_SIZE + (addr & 0xff)];
+	return (e);
+}
+
+static int
+cmp32(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Fill the table from the trie, as in_fib_update(0, 0xffffffff) does.
+ */
+static void
+fib_build(struct prefix *p, u_int32_t n)
+{
+	u_int32_t *start, *nh, nb, i, j, k, blk, blo, bhi, end, e, *grp;
+
+	if ((start = malloc((2 * n + 1) * sizeof (*start))) == NULL)
+		err(1, "malloc");
+	nb = 0;
+	start[nb++] = 0;
+	for (i = 0; i < n; i++) {
+		start[nb++] = p[i].addr;
+		if ((p[i].addr | ~mask(p[i].len)) != 0xffffffff)
+			start[nb++] = (p[i].addr | ~mask(p[i].len)) + 1;
+	}
+	qsort(start, nb, sizeof (*start), cmp32);
+	for (i = 1, j = 1; i < nb; i++) {
+		if (start[i] != start[j - 1])
+			start[j++] = start[i];
+	}
+	nb = j;
+	if ((nh = malloc(nb * sizeof (*nh))) == NULL)
+		err(1, "malloc");
+	for (i = 0; i < nb; i++)
+		nh[i] = trie_lookup(start[i]);
+
+#define	END(k)	((k) + 1 < nb ? start[(k) + 1] - 1 : 0xffffffff)
+	ngroups = 0;
+	for (k = 0, blk = 0; blk < IN_FIB_TBL24_SIZE; blk++) {
+		blo = blk << 8;
+		bhi = blo | 0xff;
+		while (END(k) < blo)
+			k++;
+		if (END(k) >= bhi) {
+			tbl24[blk] = nh[k];
+			continue;
+		}
+		if (ngroups == maxgroups) {
+			maxgroups = maxgroups ? maxgroups * 2 : 1024;
+			tbl8 = realloc(tbl8, (size_t)maxgroups *
+			    IN_FIB_TBL8_SIZE * sizeof (*tbl8));
+			if (tbl8 == NULL)
+				err(1, "realloc");
+		}
+		grp = &tbl8[ngroups * IN_FIB_TBL8_SIZE];
+		for (j = k; j < nb && start[j] <= bhi; j++) {
+			end = (END(j) < bhi ? END(j) : bhi) & 0xff;
+			for (e = (start[j] > blo ? start[j] : blo) & 0xff;
+			    e <= end; e++)
+				grp[e] = nh[j];
+		}
+		tbl24[blk] = IN_FIB_GROUP | ngroups++;
+	}
+#undef END
+	free(nh);
+	free(start);
+}
+
+static u_int32_t
+gen_len(void)
+{
+	/* roughly the shape of a full Internet table */
+	u_int32_t r = random() % 1000;
+
+	if (r < 590)
+		return (24);
+	if (r < 690)
+		return (23);
+	if (r < 800)
+		return (22);
+	if (r < 860)
+		return (21);
+	if (r < 900)
+		return (20);
+	if (r < 940)
+		return (16 + random() % 4);
+	if (r < 960)
+		return (8 + random() % 8);
+	return (25 + random() % 8);
+}
+
+static u_int32_t
+load(const char *path, struct prefix **pp)
+{
+	char line[256], word[64];
+	struct prefix *p = NULL;
+	struct in_addr in;
+	u_int32_t n = 0, max = 0;
+	FILE *f;
+	int bits;
+
+	if ((f = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	while (fgets(line, sizeof (line), f) != NULL) {
+		if (sscanf(line, "%63s", word) != 1)
+			continue;
+		if (strcmp(word, "default") == 0) {
+			in.s_addr = 0;
+			bits = 0;
+		} else if ((bits = inet_net_pton(AF_INET, word, &in,
+		    sizeof (in))) < 0) {
+			continue;
+		}
+		if (n == max) {
+			max = max ? max * 2 : 1024;
+			if ((p = realloc(p, max * sizeof (*p))) == NULL)
+				err(1, "realloc");
+		}
+		p[n].len = bits;
+		p[n].addr = ntohl(in.s_addr) & mask(bits);
+		n++;
+	}
+	fclose(f);
+	*pp = p;
+	return (n);
+}
+
+static double
+elapsed(u_int64_t t)
+{
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0)
+		mach_timebase_info(&tb);
+	return ((double)t * tb.numer / tb.denom / 1e9);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct prefix *p = NULL;
+	const char *path = NULL;
+	u_int32_t n = 500000, nlookups = 10000000, i, j, *addrs;
+	u_int64_t t0, t1, t2;
+	volatile u_int32_t sink = 0;
+	u_int32_t errors = 0, pass;
+	unsigned seed = 1;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "f:l:n:s:")) != -1) {
+		switch (ch) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'l':
+			nlookups = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: in_fib_bench [-f prefixes] "
+			    "[-n prefixes] [-l lookups] [-s seed]\n");
+			exit(1);
+		}
+	}
+	srandom(seed);
+
+	if (path != NULL) {
+		n = load(path, &p);
+	} else {
+		if ((p = calloc(n + 1, sizeof (*p))) == NULL)
+			err(1, "calloc");
+		for (i = 0; i < n; i++) {
+			p[i].len = gen_len();
+			p[i].addr = (u_int32_t)random() & mask(p[i].len);
+		}
+		p[n].addr = p[n].len = 0;	/* default route */
+		n++;
+	}
+	if (n == 0)
+		errx(1, "no prefixes");
+
+	for (i = 0; i < n; i++)
+		trie_insert(p[i].addr, p[i].len, i + 1);
+	if ((tbl24 = calloc(IN_FIB_TBL24_SIZE, sizeof (*tbl24))) == NULL)
+		err(1, "calloc");
+	t0 = mach_absolute_time();
+	fib_build(p, n);
+	t1 = mach_absolute_time();
+	printf("%u prefixes, trie %zu KB, tbl24 %u KB, tbl8 %u groups "
+	    "(%u KB), built in %.3f s\n", n,
+	    tnodes * sizeof (struct tnode) / 1024,
+	    (u_int32_t)(IN_FIB_TBL24_SIZE * sizeof (*tbl24) / 1024), ngroups,
+	    (u_int32_t)(ngroups * IN_FIB_TBL8_SIZE * sizeof (*tbl8) / 1024),
+	    elapsed(t1 - t0));
+
+	if ((addrs = malloc(nlookups * sizeof (*addrs))) == NULL)
+		err(1, "malloc");
+	printf("%-10s %14s %14s %8s\n", "traffic", "trie/s", "dir-24-8/s",
+	    "speedup");
+	for (pass = 0; pass < 2; pass++) {
+		/* uniformly random, then inside the installed prefixes */
+		for (i = 0; i < nlookups; i++) {
+			if (pass == 0) {
+				addrs[i] = random() ^ (random() << 16);
+			} else {
+				j = random() % n;
+				addrs[i] = p[j].addr |
+				    (random() & ~mask(p[j].len));
+			}
+		}
+
+		t0 = mach_absolute_time();
+		for (i = 0; i < nlookups; i++)
+			sink += trie_lookup(addrs[i]);
+		t1 = mach_absolute_time();
+		for (i = 0; i < nlookups; i++)
+			sink += fib_lookup(addrs[i]);
+		t2 = mach_absolute_time();
+		for (i = 0; i < nlookups; i++) {
+			if (trie_lookup(addrs[i]) != fib_lookup(addrs[i]) &&
+			    errors++ < 10)
+				printf("%08x: trie %u, dir-24-8 %u\n",
+				    addrs[i], trie_lookup(addrs[i]),
+				    fib_lookup(addrs[i]));
+		}
+		printf("%-10s %14.0f %14.0f %7.1fx\n",
+		    pass == 0 ? "random" : "prefixes",
+		    nlookups / elapsed(t1 - t0), nlookups / elapsed(t2 - t1),
+		    elapsed(t1 - t0) / elapsed(t2 - t1));
+	}
+
+	/* every boundary and its neighbours */
+	for (i = 0; i < n; i++) {
+		u_int32_t lo = p[i].addr, hi = lo | ~mask(p[i].len);
+
+		if (trie_lookup(lo) != fib_lookup(lo) ||
+		    trie_lookup(hi) != fib_lookup(hi) ||
+		    trie_lookup(lo - 1) != fib_lookup(lo - 1) ||
+		    trie_lookup(hi + 1) != fib_lookup(hi + 1)) {
+			if (errors++ < 10)
+				printf("mismatch at boundary of prefix %u\n", i);
+		}
+	}
+
+	printf("%s\n", errors ? "FAIL" : "PASS");
+	return (errors != 0);
+}
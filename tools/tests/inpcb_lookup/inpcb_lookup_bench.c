@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Measures pcb hash lookup throughput as the number of input threads
+ * grows, for the two ways bsd/netinet/in_pcb.c has protected the hash:
+ *
+ *   rwlock	every lookup takes ipi_lock shared; connection setup and
+ *		teardown take it exclusive
+ *   lockless	lookups announce themselves in a per-thread reader count
+ *		for the current generation and validate their walk against
+ *		the bucket's sequence count; writers still serialize, and
+ *		disposed pcbs are parked until the previous generation's
+ *		readers drain
+ *
+ * A writer thread churns connections at a fixed rate the whole time
+ * (a teardown and a setup per connection); with the rwlock, how much of
+ * that rate it manages depends on how often the readers let it in.  Each lookup takes and drops a want
+ * reference like in_pcblookup_hash() callers do, and checks that the
+ * pcb it got carries the key it asked for; freed pcbs are poisoned so a
+ * lookup that touched one is caught.  Output is lookups per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#define	VERIFY(x)	assert(x)
+
+#define	NCONNS		65536
+#define	HASHSIZE	4096		/* tcp_tcbhashsize default */
+#define	RUN_SECS	1
+#define	CHURN_BATCH	16		/* connections replaced per tick */
+#define	CHURN_TICK_US	1000		/* so about 16k per second */
+#define	MAX_READERS	16
+#define	POISON		0xdeadbeefU
+#define	STOPUSING	0xffff
+
+#define	PCBHASH(faddr, lport, fport)					\
+	(((faddr) ^ ((faddr) >> 16) ^ ((lport) ^ (fport))) & (HASHSIZE - 1))
+
+#define	barrier()	__sync_synchronize()
+
+#ifndef LIST_FOREACH_SAFE
+#define	LIST_FOREACH_SAFE(var, head, field, tvar)			\
+	for ((var) = LIST_FIRST((head));				\
+	    (var) && ((tvar) = LIST_NEXT((var), field), 1);		\
+	    (var) = (tvar))
+#endif
+
+struct pcb {
+	LIST_ENTRY(pcb)	hash;
+	LIST_ENTRY(pcb)	limbo;
+	uint32_t	faddr, laddr;
+	uint16_t	fport, lport;
+	volatile uint32_t wantcnt;
+	uint32_t	hash_element;
+	uint32_t	limbo_gen;
+	uint32_t	magic;
+};
+
+LIST_HEAD(pcbhead, pcb);
+
+struct rdcount {
+	volatile int32_t	n[2];
+	char			pad[64 - 2 * sizeof (int32_t)];
+};
+
+static struct pcbhead hashbase[HASHSIZE];
+static volatile uint32_t hashseq[HASHSIZE];
+static struct pcbhead limbo;
+static volatile uint32_t rd_gen;
+static struct rdcount rdcount[MAX_READERS];
+static pthread_rwlock_t ipi_lock;
+static struct pcb **live;		/* writer's view of the table */
+static volatile uint32_t *live_faddr;	/* keys readers pick from */
+static volatile uint16_t *live_fport;
+static volatile int stop;
+static int lockless;
+static uint64_t limbo_freed, retries;
+
+static void
+hash_insert(struct pcb *p)
+{
+	struct pcbhead *head;
+
+	p->hash_element = PCBHASH(p->faddr, p->lport, p->fport);
+	head = &hashbase[p->hash_element];
+	hashseq[p->hash_element]++;
+	barrier();
+	p->hash.le_next = LIST_FIRST(head);
+	p->hash.le_prev = &LIST_FIRST(head);
+	if (LIST_FIRST(head) != NULL)
+		LIST_FIRST(head)->hash.le_prev = &p->hash.le_next;
+	barrier();
+	LIST_FIRST(head) = p;
+	barrier();
+	hashseq[p->hash_element]++;
+}
+
+static void
+hash_remove(struct pcb *p)
+{
+	hashseq[p->hash_element]++;
+	barrier();
+	LIST_REMOVE(p, hash);
+	barrier();
+	hashseq[p->hash_element]++;
+}
+
+static uint32_t
+readers(uint32_t g)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < MAX_READERS; i++)
+		n += rdcount[i].n[g & 1];
+	return (n);
+}
+
+static void
+pcb_free(struct pcb *p)
+{
+	p->magic = POISON;
+	p->faddr = p->laddr = POISON;
+	free(p);
+}
+
+/* in_pcb_reclaim(); called with the write lock held */
+static void
+reclaim(void)
+{
+	struct pcb *p, *tp;
+	uint32_t g = rd_gen;
+
+	if (LIST_EMPTY(&limbo) || readers(g - 1) != 0)
+		return;
+	LIST_FOREACH_SAFE(p, &limbo, limbo, tp) {
+		if (p->limbo_gen == g)
+			continue;
+		LIST_REMOVE(p, limbo);
+		pcb_free(p);
+		limbo_freed++;
+	}
+	if (!LIST_EMPTY(&limbo)) {
+		barrier();
+		rd_gen = g + 1;
+		barrier();
+	}
+}
+
+static struct pcb *
+pcb_new(uint32_t *ev)
+{
+	struct pcb *p;
+
+	if ((p = calloc(1, sizeof (*p))) == NULL)
+		err(1, "calloc");
+	*ev = *ev * 1103515245 + 12345;
+	p->faddr = 0x0a000000 | (*ev >> 8);
+	*ev = *ev * 1103515245 + 12345;
+	p->fport = (uint16_t)(*ev >> 8);
+	p->laddr = 0xc0a80001;
+	p->lport = 80;
+	p->magic = 0x1cb;
+	return (p);
+}
+
+static int
+key_match(struct pcb *p, uint32_t faddr, uint16_t fport, uint32_t laddr,
+    uint16_t lport)
+{
+	return (p->faddr == faddr && p->fport == fport &&
+	    p->laddr == laddr && p->lport == lport);
+}
+
+/* in_pcb_checkstate(WNT_ACQUIRE) */
+static int
+acquire(struct pcb *p)
+{
+	uint32_t o;
+
+	do {
+		o = p->wantcnt;
+		if (o == STOPUSING)
+			return (0);
+	} while (!__sync_bool_compare_and_swap(&p->wantcnt, o, o + 1));
+	return (1);
+}
+
+static void
+release(struct pcb *p)
+{
+	__sync_fetch_and_sub(&p->wantcnt, 1);
+}
+
+static struct pcb *
+walk(uint32_t faddr, uint16_t fport, uint32_t laddr, uint16_t lport,
+    int validate)
+{
+	struct pcb *p;
+	uint32_t b, seq = 0;
+
+	b = PCBHASH(faddr, lport, fport);
+	if (validate) {
+		seq = hashseq[b];
+		barrier();
+	}
+	LIST_FOREACH(p, &hashbase[b], hash) {
+		if (!key_match(p, faddr, fport, laddr, lport))
+			continue;
+		if (!acquire(p))
+			break;
+		if (validate) {
+			barrier();
+			if ((seq & 1) || hashseq[b] != seq ||
+			    !key_match(p, faddr, fport, laddr, lport)) {
+				release(p);
+				return ((struct pcb *)-1);
+			}
+		}
+		return (p);
+	}
+	if (validate) {
+		barrier();
+		if ((seq & 1) || hashseq[b] != seq)
+			return ((struct pcb *)-1);
+	}
+	return (NULL);
+}
+
+struct rdarg {
+	int		id;
+	uint64_t	lookups;
+	uint64_t	found;
+	uint64_t	retries;
+	uint64_t	bad;
+};
+
+static void *
+reader(void *arg)
+{
+	struct rdarg *ra = arg;
+	struct pcb *p;
+	uint32_t ev = 777 + ra->id, g, faddr, laddr;
+	uint16_t fport, lport;
+
+	while (!stop) {
+		ev = ev * 1103515245 + 12345;
+		/* racy, so now and then the key is stale or torn */
+		faddr = live_faddr[(ev >> 8) % NCONNS];
+		fport = live_fport[(ev >> 8) % NCONNS];
+		laddr = 0xc0a80001;
+		lport = 80;
+
+		if (lockless) {
+			g = rd_gen;
+			__sync_fetch_and_add(&rdcount[ra->id].n[g & 1], 1);
+			barrier();
+			if (rd_gen != g) {
+				__sync_fetch_and_sub(&rdcount[ra->id].n[g & 1],
+				    1);
+				continue;
+			}
+			p = walk(faddr, fport, laddr, lport, 1);
+			barrier();
+			__sync_fetch_and_sub(&rdcount[ra->id].n[g & 1], 1);
+			if (p == (struct pcb *)-1) {
+				ra->retries++;
+				pthread_rwlock_rdlock(&ipi_lock);
+				p = walk(faddr, fport, laddr, lport, 0);
+				pthread_rwlock_unlock(&ipi_lock);
+			}
+		} else {
+			pthread_rwlock_rdlock(&ipi_lock);
+			p = walk(faddr, fport, laddr, lport, 0);
+			pthread_rwlock_unlock(&ipi_lock);
+		}
+		if (p != NULL) {
+			/* the reference keeps it from being disposed */
+			if (p->magic != 0x1cb ||
+			    !key_match(p, faddr, fport, laddr, lport))
+				ra->bad++;
+			ra->found++;
+			release(p);
+		}
+		ra->lookups++;
+	}
+	return (NULL);
+}
+
+static void *
+writer(void *arg)
+{
+	uint64_t *churn = arg;
+	struct pcb *p, *np;
+	uint32_t ev = 4242, i, batch = 0;
+
+	while (!stop) {
+		if (++batch == CHURN_BATCH) {
+			batch = 0;
+			usleep(CHURN_TICK_US);
+		}
+		ev = ev * 1103515245 + 12345;
+		i = (ev >> 8) % NCONNS;
+		np = pcb_new(&ev);
+
+		pthread_rwlock_wrlock(&ipi_lock);
+		p = live[i];
+		hash_remove(p);
+		/* in_pcb_checkstate(WNT_STOPUSING) once the refs drain */
+		while (!__sync_bool_compare_and_swap(&p->wantcnt, 0,
+		    STOPUSING)) {
+			pthread_rwlock_unlock(&ipi_lock);
+			sched_yield();
+			pthread_rwlock_wrlock(&ipi_lock);
+		}
+		hash_insert(np);
+		live[i] = np;
+		live_faddr[i] = np->faddr;
+		live_fport[i] = np->fport;
+		if (lockless) {
+			p->limbo_gen = rd_gen;
+			LIST_INSERT_HEAD(&limbo, p, limbo);
+			if (batch == 0)
+				reclaim();
+		} else {
+			pcb_free(p);
+		}
+		pthread_rwlock_unlock(&ipi_lock);
+		++*churn;
+	}
+	return (NULL);
+}
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+run(int nreaders, int mode, double *rate, double *hit, uint64_t *nchurn,
+    uint64_t *nretry, uint64_t *nbad)
+{
+	pthread_t rt[MAX_READERS], wt;
+	struct rdarg ra[MAX_READERS];
+	struct pcb *p, *tp;
+	uint64_t churn = 0, lookups = 0, found = 0;
+	uint32_t ev = 99, i;
+	double t0;
+
+	lockless = mode;
+	stop = 0;
+	rd_gen = 0;
+	limbo_freed = retries = 0;
+	memset(rdcount, 0, sizeof (rdcount));
+	memset((void *)hashseq, 0, sizeof (hashseq));
+	for (i = 0; i < HASHSIZE; i++)
+		LIST_INIT(&hashbase[i]);
+	LIST_INIT(&limbo);
+	pthread_rwlock_init(&ipi_lock, NULL);
+	live = calloc(NCONNS, sizeof (*live));
+	live_faddr = calloc(NCONNS, sizeof (*live_faddr));
+	live_fport = calloc(NCONNS, sizeof (*live_fport));
+	if (live == NULL || live_faddr == NULL || live_fport == NULL)
+		err(1, "calloc");
+	for (i = 0; i < NCONNS; i++) {
+		live[i] = pcb_new(&ev);
+		hash_insert(live[i]);
+		live_faddr[i] = live[i]->faddr;
+		live_fport[i] = live[i]->fport;
+	}
+
+	t0 = now_sec();
+	memset(ra, 0, sizeof (ra));
+	for (i = 0; i < (uint32_t)nreaders; i++) {
+		ra[i].id = i;
+		if (pthread_create(&rt[i], NULL, reader, &ra[i]) != 0)
+			err(1, "pthread_create");
+	}
+	if (pthread_create(&wt, NULL, writer, &churn) != 0)
+		err(1, "pthread_create");
+	sleep(RUN_SECS);
+	stop = 1;
+	for (i = 0; i < (uint32_t)nreaders; i++) {
+		pthread_join(rt[i], NULL);
+		lookups += ra[i].lookups;
+		found += ra[i].found;
+		retries += ra[i].retries;
+		*nbad += ra[i].bad;
+	}
+	pthread_join(wt, NULL);
+	t0 = now_sec() - t0;
+
+	*rate = lookups / t0;
+	*hit = lookups ? 100.0 * found / lookups : 0;
+	*nchurn = churn;
+	*nretry = retries;
+
+	for (i = 0; i < NCONNS; i++) {
+		hash_remove(live[i]);
+		pcb_free(live[i]);
+	}
+	LIST_FOREACH_SAFE(p, &limbo, limbo, tp) {
+		LIST_REMOVE(p, limbo);
+		pcb_free(p);
+	}
+	free(live);
+	free((void *)live_faddr);
+	free((void *)live_fport);
+	pthread_rwlock_destroy(&ipi_lock);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int threads[] = { 1, 2, 4, 8, 16 };
+	uint32_t i, n = sizeof (threads) / sizeof (threads[0]);
+	uint64_t bad = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (n > sizeof (threads) / sizeof (threads[0]))
+		n = sizeof (threads) / sizeof (threads[0]);
+
+	printf("%7s %9s %14s %7s %10s %9s\n", "threads", "mode",
+	    "lookups/s", "hit %", "churn", "retries");
+	for (i = 0; i < n; i++) {
+		int mode;
+
+		for (mode = 0; mode < 2; mode++) {
+			double rate, hit;
+			uint64_t churn, nretry;
+
+			run(threads[i], mode, &rate, &hit, &churn, &nretry,
+			    &bad);
+			printf("%7d %9s %14.0f %7.1f %10llu %9llu\n",
+			    threads[i], mode ? "lockless" : "rwlock", rate,
+			    hit, (unsigned long long)churn,
+			    (unsigned long long)nretry);
+		}
+	}
+	if (bad != 0)
+		printf("FAIL: %llu lookups returned the wrong pcb\n",
+		    (unsigned long long)bad);
+	printf("%s\n", bad ? "FAIL" : "PASS");
+	return (bad != 0);
+}
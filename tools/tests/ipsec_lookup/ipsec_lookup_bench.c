@@ -0,0 +1,462 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Per-packet SPD and SAD lookup cost against the number of tunnels, for
+ * the linear walks bsd/netkey/key.c used to do and its hash indexes:
+ *
+ *   SP		sptree in order, first match wins; against the wildcard
+ *		list plus one bucket per destination prefix length in use,
+ *		lowest SPD position wins
+ *   SA out	sahtree walk for the SA head; against the proto/dst hash
+ *   SA in	spihash with the old and the new bucket count
+ *
+ * The SPD mixes per-tunnel /24 policies, host policies, address range
+ * policies (which stay on the wildcard list) and a generate policy for
+ * 0/0 that is added first but sorts last.  Every hashed lookup is
+ * checked against the linear one, so a result of PASS also means the
+ * index kept the first-match semantics.  IPv4 only; the kernel hashes IPv6 the same way by word.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#define	SPHASHSIZE	1024
+#define	SAHHASHSIZE	1024
+#define	OLD_SPIHASHSIZE	128
+#define	SPIHASHSIZE	1024
+#define	SPORDER_GENERATE	(1ULL << 63)
+#define	ULPROTO_ANY	255
+#define	NLOOKUPS	200000
+
+struct sp {
+	LIST_ENTRY(sp) chain;		/* sptree, in SPD order */
+	LIST_ENTRY(sp) idxchain;
+	uint64_t order;
+	int hashed;
+	int generate;
+	uint32_t src, dst;		/* host byte order */
+	uint8_t prefs, prefd;
+	uint32_t dst_lo, dst_hi;	/* dst range if dst_lo != 0 */
+	uint16_t ul_proto;
+};
+
+struct sah {
+	LIST_ENTRY(sah) chain;
+	LIST_ENTRY(sah) addrhash;
+	uint8_t proto;
+	uint32_t dst;			/* network byte order, like saidx */
+};
+
+struct sav {
+	LIST_ENTRY(sav) spihash;
+	uint32_t spi;
+	struct sah *sah;
+};
+
+static LIST_HEAD(, sp) sptree;
+static LIST_HEAD(, sp) spwild;
+static LIST_HEAD(, sp) sphash[SPHASHSIZE];
+static uint32_t sphash_plens[2];	/* prefd 0..32 in use */
+static uint32_t sphash_plencnt[33];
+static uint64_t sp_order;
+
+static LIST_HEAD(, sah) sahtree;
+static LIST_HEAD(, sah) sahhash[SAHHASHSIZE];
+static LIST_HEAD(, sav) old_spihash[OLD_SPIHASHSIZE];
+static LIST_HEAD(, sav) spihash[SPIHASHSIZE];
+
+static uint32_t
+mask(uint32_t a, int plen)
+{
+	return (plen == 0 ? 0 : plen < 32 ? a & (0xffffffffU << (32 - plen)) : a);
+}
+
+/* key_hashmix() */
+static uint32_t
+hashmix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return (h);
+}
+
+/* key_sphash() for AF_INET */
+static uint32_t
+sphash_fn(uint32_t dst, uint8_t plen)
+{
+	return (hashmix(plen ^ mask(dst, plen)) % SPHASHSIZE);
+}
+
+/* key_sahhash() for AF_INET */
+static uint32_t
+sahhash_fn(uint8_t proto, uint32_t dst)
+{
+	return (hashmix(proto ^ dst) % SAHHASHSIZE);
+}
+
+static int
+sp_match(struct sp *sp, uint32_t src, uint32_t dst, uint16_t proto)
+{
+	if (sp->ul_proto != ULPROTO_ANY && sp->ul_proto != proto)
+		return (0);
+	if (mask(sp->src, sp->prefs) != mask(src, sp->prefs))
+		return (0);
+	if (sp->dst_lo != 0)
+		return (dst >= sp->dst_lo && dst <= sp->dst_hi);
+	return (mask(sp->dst, sp->prefd) == mask(dst, sp->prefd));
+}
+
+/* key_spdadd() and key_spindex_insert() */
+static void
+sp_add(struct sp *sp)
+{
+	struct sp *tmp, *prev = NULL;
+
+	if (sp->generate) {
+		LIST_FOREACH(tmp, &sptree, chain)
+			prev = tmp;
+		if (prev != NULL)
+			LIST_INSERT_AFTER(prev, sp, chain);
+		else
+			LIST_INSERT_HEAD(&sptree, sp, chain);
+	} else {
+		LIST_FOREACH(tmp, &sptree, chain) {
+			if (tmp->generate)
+				break;
+			prev = tmp;
+		}
+		if (prev != NULL)
+			LIST_INSERT_AFTER(prev, sp, chain);
+		else
+			LIST_INSERT_HEAD(&sptree, sp, chain);
+	}
+
+	sp->order = ++sp_order | (sp->generate ? SPORDER_GENERATE : 0);
+	if (sp->dst_lo == 0) {
+		sp->hashed = 1;
+		LIST_INSERT_HEAD(&sphash[sphash_fn(sp->dst, sp->prefd)], sp,
+		    idxchain);
+		if (sphash_plencnt[sp->prefd]++ == 0)
+			sphash_plens[sp->prefd >> 5] |= 1U << (sp->prefd & 31);
+		return;
+	}
+	prev = NULL;
+	LIST_FOREACH(tmp, &spwild, idxchain) {
+		if (tmp->order > sp->order)
+			break;
+		prev = tmp;
+	}
+	if (prev != NULL)
+		LIST_INSERT_AFTER(prev, sp, idxchain);
+	else
+		LIST_INSERT_HEAD(&spwild, sp, idxchain);
+}
+
+static struct sp *
+sp_lookup_linear(uint32_t src, uint32_t dst, uint16_t proto)
+{
+	struct sp *sp;
+
+	LIST_FOREACH(sp, &sptree, chain)
+		if (sp_match(sp, src, dst, proto))
+			return (sp);
+	return (NULL);
+}
+
+/* key_allocsp() */
+static struct sp *
+sp_lookup_hashed(uint32_t src, uint32_t dst, uint16_t proto)
+{
+	struct sp *sp, *match = NULL;
+	uint32_t plens;
+	int i, plen;
+
+	LIST_FOREACH(sp, &spwild, idxchain) {
+		if (sp_match(sp, src, dst, proto)) {
+			match = sp;
+			break;
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		plens = sphash_plens[i];
+		while (plens != 0) {
+			plen = (i << 5) + ffs(plens) - 1;
+			plens &= plens - 1;
+			LIST_FOREACH(sp, &sphash[sphash_fn(dst, plen)],
+			    idxchain) {
+				if (sp->prefd != plen ||
+				    (match != NULL && sp->order > match->order))
+					continue;
+				if (sp_match(sp, src, dst, proto))
+					match = sp;
+			}
+		}
+	}
+	return (match);
+}
+
+static struct sah *
+sah_lookup_linear(uint8_t proto, uint32_t dst)
+{
+	struct sah *sah;
+
+	LIST_FOREACH(sah, &sahtree, chain)
+		if (sah->proto == proto && sah->dst == dst)
+			return (sah);
+	return (NULL);
+}
+
+static struct sah *
+sah_lookup_hashed(uint8_t proto, uint32_t dst)
+{
+	struct sah *sah;
+
+	LIST_FOREACH(sah, &sahhash[sahhash_fn(proto, dst)], addrhash)
+		if (sah->proto == proto && sah->dst == dst)
+			return (sah);
+	return (NULL);
+}
+
+#define	SPIHASH(x, n)	(((x) ^ ((x) >> 16)) % (n))
+
+static struct sav *
+sav_lookup_old(uint32_t spi, uint32_t dst)
+{
+	struct sav *sav;
+
+	LIST_FOREACH(sav, &old_spihash[SPIHASH(spi, OLD_SPIHASHSIZE)],
+	    spihash)
+		if (sav->spi == spi && sav->sah->dst == dst)
+			return (sav);
+	return (NULL);
+}
+
+static struct sav *
+sav_lookup_new(uint32_t spi, uint32_t dst)
+{
+	struct sav *sav;
+
+	LIST_FOREACH(sav, &spihash[SPIHASH(spi, SPIHASHSIZE)], spihash)
+		if (sav->spi == spi && sav->sah->dst == dst)
+			return (sav);
+	return (NULL);
+}
+
+static double
+now_ns(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1e9 + tv.tv_usec * 1e3);
+}
+
+struct pkt {
+	uint32_t src, dst;
+	uint16_t proto;
+	uint32_t spi, sadst;
+};
+
+static int
+run(int ntunnels)
+{
+	struct sp *sps;
+	struct sah *sahs;
+	struct sav *savs, *s_old, *s_new;
+	struct pkt *pkts;
+	struct sp *a, *b;
+	struct sah *ha, *hb;
+	double t0, t_sp_lin, t_sp_hash, t_sa_lin, t_sa_hash, t_in_old, t_in_new;
+	volatile uintptr_t sink = 0;
+	int i, nsp = 0, mismatches = 0;
+
+	LIST_INIT(&sptree);
+	LIST_INIT(&spwild);
+	for (i = 0; i < SPHASHSIZE; i++)
+		LIST_INIT(&sphash[i]);
+	memset(sphash_plens, 0, sizeof (sphash_plens));
+	memset(sphash_plencnt, 0, sizeof (sphash_plencnt));
+	LIST_INIT(&sahtree);
+	for (i = 0; i < SAHHASHSIZE; i++)
+		LIST_INIT(&sahhash[i]);
+	for (i = 0; i < OLD_SPIHASHSIZE; i++)
+		LIST_INIT(&old_spihash[i]);
+	for (i = 0; i < SPIHASHSIZE; i++)
+		LIST_INIT(&spihash[i]);
+
+	if ((sps = calloc(2 * ntunnels + 8, sizeof (*sps))) == NULL ||
+	    (sahs = calloc(ntunnels, sizeof (*sahs))) == NULL ||
+	    (savs = calloc(ntunnels, sizeof (*savs))) == NULL ||
+	    (pkts = calloc(NLOOKUPS, sizeof (*pkts))) == NULL)
+		err(1, "calloc");
+
+	/* a generate policy first; it must still lose to everything else */
+	sps[nsp].generate = 1;
+	sps[nsp].ul_proto = ULPROTO_ANY;
+	sp_add(&sps[nsp++]);
+	for (i = 0; i < ntunnels; i++) {
+		/* 10.x.y.0/24 behind tunnel i, from 192.168/16 */
+		sps[nsp].src = 0xc0a80000;
+		sps[nsp].prefs = 16;
+		sps[nsp].dst = 0x0a000000 | (i << 8);
+		sps[nsp].prefd = 24;
+		sps[nsp].ul_proto = ULPROTO_ANY;
+		sp_add(&sps[nsp++]);
+		if ((i % 16) == 0) {
+			/* a host exception inside it, added later: loses */
+			sps[nsp].src = 0xc0a80000;
+			sps[nsp].prefs = 16;
+			sps[nsp].dst = 0x0a000000 | (i << 8) | 1;
+			sps[nsp].prefd = 32;
+			sps[nsp].ul_proto = 6;
+			sp_add(&sps[nsp++]);
+		}
+		if (i == ntunnels / 2) {
+			/* a range over the first tunnels, mid-SPD */
+			sps[nsp].src = 0;
+			sps[nsp].prefs = 0;
+			sps[nsp].dst_lo = 0x0a000000;
+			sps[nsp].dst_hi = 0x0a000000 | ((ntunnels / 4) << 8);
+			sps[nsp].ul_proto = 17;
+			sp_add(&sps[nsp++]);
+		}
+
+		sahs[i].proto = 50;
+		sahs[i].dst = htonl(0xcb007100 + i);
+		LIST_INSERT_HEAD(&sahtree, &sahs[i], chain);
+		LIST_INSERT_HEAD(&sahhash[sahhash_fn(50, sahs[i].dst)],
+		    &sahs[i], addrhash);
+
+		savs[i].spi = htonl(0x100 + arc4random_uniform(0x0fffff00));
+		savs[i].sah = &sahs[i];
+	}
+
+	/* two passes, since a sav sits on one list at a time */
+	for (i = 0; i < NLOOKUPS; i++) {
+		int t = arc4random_uniform(ntunnels);
+
+		pkts[i].src = 0xc0a80000 | arc4random_uniform(0x10000);
+		pkts[i].dst = 0x0a000000 | (arc4random_uniform(ntunnels + 8) << 8) |
+		    arc4random_uniform(4);
+		pkts[i].proto = (i & 1) ? 6 : 17;
+		pkts[i].spi = savs[t].spi;
+		pkts[i].sadst = sahs[t].dst;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; i++)
+		sink += (uintptr_t)sp_lookup_linear(pkts[i].src, pkts[i].dst,
+		    pkts[i].proto);
+	t_sp_lin = (now_ns() - t0) / NLOOKUPS;
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; i++)
+		sink += (uintptr_t)sp_lookup_hashed(pkts[i].src, pkts[i].dst,
+		    pkts[i].proto);
+	t_sp_hash = (now_ns() - t0) / NLOOKUPS;
+
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; i++)
+		sink += (uintptr_t)sah_lookup_linear(50, pkts[i].sadst);
+	t_sa_lin = (now_ns() - t0) / NLOOKUPS;
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; i++)
+		sink += (uintptr_t)sah_lookup_hashed(50, pkts[i].sadst);
+	t_sa_hash = (now_ns() - t0) / NLOOKUPS;
+
+	for (i = 0; i < ntunnels; i++)
+		LIST_INSERT_HEAD(&old_spihash[SPIHASH(savs[i].spi,
+		    OLD_SPIHASHSIZE)], &savs[i], spihash);
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; i++)
+		sink += (uintptr_t)sav_lookup_old(pkts[i].spi, pkts[i].sadst);
+	t_in_old = (now_ns() - t0) / NLOOKUPS;
+	s_old = sav_lookup_old(pkts[0].spi, pkts[0].sadst);
+	for (i = 0; i < ntunnels; i++)
+		LIST_REMOVE(&savs[i], spihash);
+	for (i = 0; i < ntunnels; i++)
+		LIST_INSERT_HEAD(&spihash[SPIHASH(savs[i].spi, SPIHASHSIZE)],
+		    &savs[i], spihash);
+	t0 = now_ns();
+	for (i = 0; i < NLOOKUPS; i++)
+		sink += (uintptr_t)sav_lookup_new(pkts[i].spi, pkts[i].sadst);
+	t_in_new = (now_ns() - t0) / NLOOKUPS;
+	s_new = sav_lookup_new(pkts[0].spi, pkts[0].sadst);
+	if (s_old != s_new || s_new == NULL)
+		mismatches++;
+
+	for (i = 0; i < NLOOKUPS; i++) {
+		a = sp_lookup_linear(pkts[i].src, pkts[i].dst, pkts[i].proto);
+		b = sp_lookup_hashed(pkts[i].src, pkts[i].dst, pkts[i].proto);
+		ha = sah_lookup_linear(50, pkts[i].sadst);
+		hb = sah_lookup_hashed(50, pkts[i].sadst);
+		if (a != b || ha != hb)
+			mismatches++;
+	}
+
+	printf("%8d %6d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", ntunnels,
+	    nsp, t_sp_lin, t_sp_hash, t_sa_lin, t_sa_hash, t_in_old, t_in_new);
+	if (mismatches != 0)
+		printf("FAIL: %d lookups disagree with the linear walk\n",
+		    mismatches);
+
+	free(sps);
+	free(sahs);
+	free(savs);
+	free(pkts);
+	return (mismatches != 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int tunnels[] = { 16, 256, 1024, 4096, 16384 };
+	int i, failed = 0;
+
+	(void)argc;
+	(void)argv;
+	printf("%8s %6s %9s %9s %9s %9s %9s %9s\n", "tunnels", "SPs",
+	    "sp lin", "sp hash", "sa lin", "sa hash", "in 128", "in 1024");
+	printf("%8s %6s %9s %9s %9s %9s %9s %9s\n", "", "", "ns", "ns", "ns",
+	    "ns", "ns", "ns");
+	for (i = 0; i < (int)(sizeof (tunnels) / sizeof (tunnels[0])); i++)
+		failed |= run(tunnels[i]);
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Measures the latency from a datagram being sent to it being read by a
+ * thread waiting in kevent(), while other threads keep the receiving
+ * socket's lock busy.  Each message carries its send timestamp; the
+ * reader records the difference when it reads it and reports percentiles.
+ *
+ * When run as root the test is repeated with kern.ipc.so_filt_nolock
+ * off and on, to compare the locked and lock-free readiness checks in
+ * the socket kevent filters.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/event.h>
+#include <sys/sysctl.h>
+#include <mach/mach_time.h>
+
+struct msg {
+	uint64_t	ts;
+	uint64_t	seq;
+};
+
+static int		sv[2];
+static volatile int	done;
+static uint32_t		nmsgs = 100000;
+static uint32_t		nwriters = 2;
+static uint32_t		ncontenders = 2;
+static useconds_t	interval = 20;
+static uint64_t		*lat;
+static volatile uint32_t nlat;
+static mach_timebase_info_data_t tb;
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-n messages] [-w writers] "
+	    "[-c contenders] [-i interval_us]\n", progname);
+	exit(1);
+}
+
+static void *
+writer(void *arg)
+{
+	struct msg m;
+
+	(void)arg;
+	m.seq = 0;
+	while (!done) {
+		m.ts = mach_absolute_time();
+		if (send(sv[0], &m, sizeof (m), MSG_DONTWAIT) < 0 &&
+		    errno != ENOBUFS && errno != EAGAIN)
+			err(1, "send");
+		m.seq++;
+		if (interval != 0)
+			usleep(interval);
+	}
+	return (NULL);
+}
+
+/*
+ * Each of these takes and drops the receiving socket's lock as fast as
+ * it can, the way a busy protocol or a monitoring tool would.
+ */
+static void *
+contender(void *arg)
+{
+	int nread;
+
+	(void)arg;
+	while (!done) {
+		if (ioctl(sv[1], FIONREAD, &nread) < 0)
+			err(1, "FIONREAD");
+	}
+	return (NULL);
+}
+
+static void *
+reader(void *arg)
+{
+	struct kevent kev;
+	struct msg m;
+	uint64_t now;
+	int kq;
+
+	(void)arg;
+	if ((kq = kqueue()) < 0)
+		err(1, "kqueue");
+	EV_SET(&kev, sv[1], EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(kq, &kev, 1, NULL, 0, NULL) < 0)
+		err(1, "kevent");
+
+	while (nlat < nmsgs) {
+		if (kevent(kq, NULL, 0, &kev, 1, NULL) < 0)
+			err(1, "kevent");
+		while (nlat < nmsgs &&
+		    recv(sv[1], &m, sizeof (m), MSG_DONTWAIT) == sizeof (m)) {
+			now = mach_absolute_time();
+			lat[nlat++] = now - m.ts;
+		}
+	}
+	done = 1;
+	close(kq);
+	return (NULL);
+}
+
+static int
+cmp64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static double
+pct_us(double pct)
+{
+	uint64_t v = lat[(uint32_t)((nmsgs - 1) * pct / 100.0)];
+
+	return ((double)v * tb.numer / tb.denom / 1000.0);
+}
+
+static void
+run(const char *label)
+{
+	pthread_t rt, *wt, *ct;
+	uint32_t i;
+	int bufsize = 1024 * 1024;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+		err(1, "socketpair");
+	(void) setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufsize,
+	    sizeof (bufsize));
+
+	done = 0;
+	nlat = 0;
+	wt = calloc(nwriters, sizeof (*wt));
+	ct = calloc(ncontenders, sizeof (*ct));
+	if (wt == NULL || ct == NULL)
+		err(1, "calloc");
+
+	if (pthread_create(&rt, NULL, reader, NULL) != 0)
+		errx(1, "pthread_create");
+	for (i = 0; i < ncontenders; i++)
+		if (pthread_create(&ct[i], NULL, contender, NULL) != 0)
+			errx(1, "pthread_create");
+	for (i = 0; i < nwriters; i++)
+		if (pthread_create(&wt[i], NULL, writer, NULL) != 0)
+			errx(1, "pthread_create");
+
+	pthread_join(rt, NULL);
+	for (i = 0; i < nwriters; i++)
+		pthread_join(wt[i], NULL);
+	for (i = 0; i < ncontenders; i++)
+		pthread_join(ct[i], NULL);
+	free(wt);
+	free(ct);
+	close(sv[0]);
+	close(sv[1]);
+
+	qsort(lat, nmsgs, sizeof (*lat), cmp64);
+	printf("%-10s p50 %8.2f us  p90 %8.2f us  p99 %8.2f us  "
+	    "p99.9 %8.2f us  max %8.2f us\n", label, pct_us(50),
+	    pct_us(90), pct_us(99), pct_us(99.9), pct_us(100));
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, val, saved;
+	size_t len = sizeof (saved);
+
+	while ((ch = getopt(argc, argv, "n:w:c:i:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nmsgs = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			nwriters = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			ncontenders = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = (useconds_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nmsgs == 0 || nwriters == 0)
+		usage(argv[0]);
+
+	mach_timebase_info(&tb);
+	if ((lat = calloc(nmsgs, sizeof (*lat))) == NULL)
+		err(1, "calloc");
+
+	printf("%u messages, %u writers, %u contenders, %u us interval\n",
+	    nmsgs, nwriters, ncontenders, interval);
+
+	if (sysctlbyname("kern.ipc.so_filt_nolock", &saved, &len,
+	    NULL, 0) != 0) {
+		run("default");
+		return (0);
+	}
+
+	val = 0;
+	if (sysctlbyname("kern.ipc.so_filt_nolock", NULL, NULL,
+	    &val, sizeof (val)) != 0) {
+		warnx("cannot set kern.ipc.so_filt_nolock (not root?); "
+		    "measuring current setting only");
+		run(saved ? "lock-free" : "locked");
+		return (0);
+	}
+	run("locked");
+
+	val = 1;
+	(void) sysctlbyname("kern.ipc.so_filt_nolock", NULL, NULL,
+	    &val, sizeof (val));
+	run("lock-free");
+
+	(void) sysctlbyname("kern.ipc.so_filt_nolock", NULL, NULL,
+	    &saved, sizeof (saved));
+	return (0);
+}
@@ -0,0 +1,899 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Loopback test of kernel TLS (TCP_TLS_TX and TCP_TLS_RX, see
+ * bsd/netinet/tcp_tls.c).
+ *
+ * For each TLS version and AES-GCM key size, a writer socket seals and a
+ * reader socket opens records with the same keys, and the plaintext read
+ * must be the one written, whatever the write sizes.  Then:
+ *  - the raw records from the writer must be framed as TLS records, of
+ *    at most 16 KB of plaintext, with the expected explicit nonces;
+ *  - an alert sent with a TCP_TLS_TX control message must stop the
+ *    reader with ENOMSG and be fetched with TCP_TLS_RX_RECORD;
+ *  - a record with one bit flipped, relayed to a reader, must make the
+ *    read fail with EBADMSG;
+ *  - a file sent with sendfile(2) must arrive intact.
+ * None of these would notice a kernel that seals and opens records the
+ * same wrong way, so the records are also checked against CommonCrypto's
+ * AES-GCM, itself first checked against the GCM specification's test
+ * vectors:
+ *  - each record the writer puts on the wire must decrypt in userspace,
+ *    with the RFC 5288 or RFC 8446 nonce and additional data, to the
+ *    plaintext and content type written, and sealing that plaintext
+ *    again must give back the record byte for byte;
+ *  - records sealed in userspace must be opened by a reader.
+ * Last, the throughput of plain, kTLS write(2) and kTLS sendfile(2)
+ * transfers over loopback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <CommonCrypto/CommonCryptor.h>
+
+/* SPI; from CommonCrypto/CommonCryptorSPI.h */
+extern CCCryptorStatus CCCryptorGCM(CCOperation op, CCAlgorithm alg,
+    const void *key, size_t keyLength, const void *iv, size_t ivLen,
+    const void *aData, size_t aDataLen, const void *dataIn,
+    size_t dataInLength, void *dataOut, void *tagOut, size_t *tagLength);
+
+#ifndef TCP_TLS_TX
+/* private; from bsd/netinet/tcp.h */
+#define	TCP_TLS_TX			0x212
+#define	TCP_TLS_RX			0x213
+#define	TCP_TLS_RX_RECORD		0x214
+#define	TLS_VERSION_1_2		0x0303
+#define	TLS_VERSION_1_3		0x0304
+#define	TLS_CIPHER_AES_128_GCM	1
+#define	TLS_CIPHER_AES_256_GCM	2
+#define	TLS_RT_ALERT			21
+#define	TLS_RT_APPLICATION_DATA		23
+#define	TLS_MAX_KEYLEN		32
+#define	TLS_IVLEN		12
+#define	TLS_MAX_PLAINTEXT	16384
+
+struct tcp_tls_crypto {
+	u_int16_t	tls_version;
+	u_int16_t	tls_cipher;
+	u_int8_t	tls_key[TLS_MAX_KEYLEN];
+	u_int8_t	tls_iv[TLS_IVLEN];
+	u_int64_t	tls_seq __attribute__((aligned(8)));
+};
+
+struct tcp_tls_record {
+	u_int8_t	tls_type;
+	u_int8_t	tls_pad;
+	u_int16_t	tls_len;
+	u_int8_t	tls_data[];
+};
+#endif /* TCP_TLS_TX */
+
+#define	TLS_HDRLEN	5
+#define	TLS_NONCELEN	8
+#define	TLS_TAGLEN	16
+
+#define	BIG		(4 * 1024 * 1024)
+#define	BENCH		(256 * 1024 * 1024)
+
+static int failed;
+
+#define	CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		printf("FAIL: " __VA_ARGS__);				\
+		printf("\n");						\
+		failed = 1;						\
+	}								\
+} while (0)
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+tcp_pair(int *wfd, int *rfd)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof (sin);
+	int lfd;
+
+	memset(&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	if (bind(lfd, (struct sockaddr *)&sin, sizeof (sin)) < 0 ||
+	    listen(lfd, 1) < 0 ||
+	    getsockname(lfd, (struct sockaddr *)&sin, &len) < 0)
+		err(1, "listen");
+	if ((*wfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	if (connect(*wfd, (struct sockaddr *)&sin, sizeof (sin)) < 0)
+		err(1, "connect");
+	if ((*rfd = accept(lfd, NULL, NULL)) < 0)
+		err(1, "accept");
+	close(lfd);
+}
+
+static void
+keys(struct tcp_tls_crypto *tc, int version, int cipher, uint64_t seq)
+{
+	int i;
+
+	memset(tc, 0, sizeof (*tc));
+	tc->tls_version = version;
+	tc->tls_cipher = cipher;
+	for (i = 0; i < TLS_MAX_KEYLEN; i++)
+		tc->tls_key[i] = (uint8_t)(0x40 + i);
+	for (i = 0; i < TLS_IVLEN; i++)
+		tc->tls_iv[i] = (uint8_t)(0xa0 + i);
+	tc->tls_seq = seq;
+}
+
+static int
+set_keys(int fd, int opt, int version, int cipher)
+{
+	struct tcp_tls_crypto tc;
+
+	keys(&tc, version, cipher, 1000);
+	return (setsockopt(fd, IPPROTO_TCP, opt, &tc, sizeof (tc)));
+}
+
+static void
+fill(uint8_t *p, size_t len, uint32_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+static int
+read_full(int fd, uint8_t *p, size_t len)
+{
+	ssize_t n;
+	size_t got = 0;
+
+	while (got < len) {
+		if ((n = read(fd, p + got, len - got)) <= 0)
+			return (n < 0 ? -errno : (int)got);
+		got += n;
+	}
+	return ((int)got);
+}
+
+struct writer {
+	int		fd;
+	const uint8_t	*buf;
+	const size_t	*sizes;
+	int		nsizes;
+	int		repeat;		/* write the sizes this many times */
+	int		shut;		/* shutdown(SHUT_WR) when done */
+	int		file;		/* sendfile from this fd instead */
+	off_t		filelen;
+};
+
+static void *
+writer_main(void *arg)
+{
+	struct writer *w = arg;
+	size_t off;
+	ssize_t n;
+	int i, r;
+
+	for (r = 0; w->file >= 0 && r < (w->repeat ? w->repeat : 1); r++) {
+#ifdef __APPLE__
+		off_t len = w->filelen;
+
+		if (sendfile(w->file, w->fd, 0, &len, NULL, 0) < 0 ||
+		    len != w->filelen) {
+			warn("sendfile");
+			goto done;
+		}
+#endif
+	}
+	if (w->file >= 0)
+		goto done;
+	for (r = 0; r < (w->repeat ? w->repeat : 1); r++) {
+		for (i = 0, off = 0; i < w->nsizes; i++) {
+			size_t sent = 0;
+
+			while (sent < w->sizes[i]) {
+				n = write(w->fd, w->buf + off + sent,
+				    w->sizes[i] - sent);
+				if (n < 0) {
+					warn("write");
+					goto done;
+				}
+				sent += n;
+			}
+			off += w->sizes[i];
+		}
+	}
+done:
+	if (w->shut)
+		shutdown(w->fd, SHUT_WR);
+	return (NULL);
+}
+
+static const size_t sizes[] = { 1, 100, 16383, 16384, 16385, 65536, 99999,
+    BIG - 1, 7 };
+#define	NSIZES	(sizeof (sizes) / sizeof (sizes[0]))
+
+static size_t
+total(void)
+{
+	size_t t = 0;
+	unsigned int i;
+
+	for (i = 0; i < NSIZES; i++)
+		t += sizes[i];
+	return (t);
+}
+
+static void
+roundtrip(int version, int cipher, uint8_t *src, uint8_t *dst)
+{
+	struct writer w = { 0 };
+	pthread_t thr;
+	size_t len = total();
+	int wfd, rfd, n;
+
+	tcp_pair(&wfd, &rfd);
+	if (set_keys(wfd, TCP_TLS_TX, version, cipher) < 0 ||
+	    set_keys(rfd, TCP_TLS_RX, version, cipher) < 0)
+		err(1, "TCP_TLS_TX/RX");
+	w.fd = wfd;
+	w.buf = src;
+	w.sizes = sizes;
+	w.nsizes = NSIZES;
+	w.file = -1;
+	pthread_create(&thr, NULL, writer_main, &w);
+	n = read_full(rfd, dst, len);
+	pthread_join(thr, NULL);
+	CHECK(n == (int)len, "%04x/%d: read %d of %zu", version, cipher, n,
+	    len);
+	CHECK(memcmp(src, dst, len) == 0, "%04x/%d: plaintext differs",
+	    version, cipher);
+	close(wfd);
+	close(rfd);
+}
+
+/* the writer's records as they go on the wire */
+static void
+framing(int version, uint8_t *src)
+{
+	struct writer w = { 0 };
+	pthread_t thr;
+	uint8_t *dst, *wirebuf;
+	size_t len = total(), plain = 0, off = 0, wire;
+	uint64_t seq = 1000;
+	int wfd, rfd, n, bad = 0;
+
+	tcp_pair(&wfd, &rfd);
+	if (set_keys(wfd, TCP_TLS_TX, version, TLS_CIPHER_AES_128_GCM) < 0)
+		err(1, "TCP_TLS_TX");
+	w.fd = wfd;
+	w.buf = src;
+	w.sizes = sizes;
+	w.nsizes = NSIZES;
+	w.shut = 1;
+	w.file = -1;
+	pthread_create(&thr, NULL, writer_main, &w);
+	/* at most 29 bytes of overhead per record */
+	wire = len + (len / 1000 + NSIZES) * 29;
+	if ((wirebuf = malloc(wire)) == NULL)
+		err(1, "malloc");
+	n = read_full(rfd, wirebuf, wire);
+	pthread_join(thr, NULL);
+	CHECK(n > 0, "%04x: nothing to frame", version);
+	dst = wirebuf;
+
+	while (n > 0 && off + 5 <= (size_t)n) {
+		size_t reclen = (dst[off + 3] << 8) | dst[off + 4], plen;
+		uint64_t nonce = 0;
+		int i;
+
+		if (dst[off] != TLS_RT_APPLICATION_DATA ||
+		    dst[off + 1] != 3 || dst[off + 2] != 3 ||
+		    off + 5 + reclen > (size_t)n) {
+			bad = 1;
+			break;
+		}
+		if (version == TLS_VERSION_1_2) {
+			plen = reclen - 8 - 16;
+			for (i = 0; i < 8; i++)
+				nonce = (nonce << 8) | dst[off + 5 + i];
+			if (nonce != seq)
+				bad = 1;
+			if (plen >= 16 &&
+			    memcmp(&dst[off + 13], src + plain, 16) == 0)
+				bad = 1;	/* not encrypted */
+		} else {
+			plen = reclen - 1 - 16;
+		}
+		if (plen > TLS_MAX_PLAINTEXT)
+			bad = 1;
+		plain += plen;
+		seq++;
+		off += 5 + reclen;
+	}
+	CHECK(!bad && off == (size_t)n, "%04x: bad record framing at %zu",
+	    version, off);
+	CHECK(plain == len, "%04x: %zu bytes of plaintext framed, not %zu",
+	    version, plain, len);
+	free(wirebuf);
+	close(wfd);
+	close(rfd);
+}
+
+static void
+control(int version)
+{
+	static const uint8_t alert[2] = { 1, 0 };	/* close_notify */
+	uint8_t buf[sizeof (struct tcp_tls_record) + TLS_MAX_PLAINTEXT];
+	struct tcp_tls_record *tr = (struct tcp_tls_record *)buf;
+	union {
+		struct cmsghdr	hdr;
+		uint8_t		buf[CMSG_SPACE(1)];
+	} cm;
+	struct msghdr msg;
+	struct iovec iov;
+	socklen_t len;
+	int wfd, rfd, n;
+
+	tcp_pair(&wfd, &rfd);
+	if (set_keys(wfd, TCP_TLS_TX, version, TLS_CIPHER_AES_256_GCM) < 0 ||
+	    set_keys(rfd, TCP_TLS_RX, version, TLS_CIPHER_AES_256_GCM) < 0)
+		err(1, "TCP_TLS_TX/RX");
+
+	if (write(wfd, "before", 6) != 6)
+		err(1, "write");
+	memset(&msg, 0, sizeof (msg));
+	memset(&cm, 0, sizeof (cm));
+	iov.iov_base = (void *)alert;
+	iov.iov_len = sizeof (alert);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cm.buf;
+	msg.msg_controllen = sizeof (cm.buf);
+	cm.hdr.cmsg_len = CMSG_LEN(1);
+	cm.hdr.cmsg_level = IPPROTO_TCP;
+	cm.hdr.cmsg_type = TCP_TLS_TX;
+	*CMSG_DATA(&cm.hdr) = TLS_RT_ALERT;
+	if (sendmsg(wfd, &msg, 0) != sizeof (alert))
+		err(1, "sendmsg");
+	if (write(wfd, "after", 5) != 5)
+		err(1, "write");
+
+	n = read_full(rfd, buf, 6);
+	CHECK(n == 6 && memcmp(buf, "before", 6) == 0,
+	    "%04x: data before the alert", version);
+	n = read(rfd, buf, sizeof (buf));
+	CHECK(n < 0 && errno == ENOMSG, "%04x: read %d (%s), not ENOMSG",
+	    version, n, n < 0 ? strerror(errno) : "data");
+	len = sizeof (buf);
+	n = getsockopt(rfd, IPPROTO_TCP, TCP_TLS_RX_RECORD, buf, &len);
+	CHECK(n == 0 && tr->tls_type == TLS_RT_ALERT && tr->tls_len == 2 &&
+	    memcmp(tr->tls_data, alert, 2) == 0,
+	    "%04x: alert record not returned", version);
+	if (setsockopt(rfd, IPPROTO_TCP, TCP_TLS_RX, NULL, 0) < 0)
+		err(1, "TCP_TLS_RX resume");
+	n = read_full(rfd, buf, 5);
+	CHECK(n == 5 && memcmp(buf, "after", 5) == 0,
+	    "%04x: data after the alert", version);
+	close(wfd);
+	close(rfd);
+}
+
+/* relay the records of a writer to a reader, one bit changed */
+static void
+tamper(int version, uint8_t *src, uint8_t *dst)
+{
+	int wfd, tfd, sfd, rfd, n;
+
+	tcp_pair(&wfd, &tfd);
+	tcp_pair(&sfd, &rfd);
+	if (set_keys(wfd, TCP_TLS_TX, version, TLS_CIPHER_AES_128_GCM) < 0 ||
+	    set_keys(rfd, TCP_TLS_RX, version, TLS_CIPHER_AES_128_GCM) < 0)
+		err(1, "TCP_TLS_TX/RX");
+	fill(src, 1000, 7);
+	if (write(wfd, src, 1000) != 1000)
+		err(1, "write");
+	shutdown(wfd, SHUT_WR);
+	n = read_full(tfd, dst, BIG);
+	if (n <= 100)
+		errx(1, "%04x: no record to relay", version);
+	dst[n / 2] ^= 0x10;
+	if (write(sfd, dst, n) != n)
+		err(1, "write");
+	n = read(rfd, dst, BIG);
+	CHECK(n < 0 && errno == EBADMSG, "%04x: read %d (%s), not EBADMSG",
+	    version, n, n < 0 ? strerror(errno) : "data");
+	close(wfd);
+	close(tfd);
+	close(sfd);
+	close(rfd);
+}
+
+/*
+ * AES-GCM test cases 1, 2, 13 and 14 of "The Galois/Counter Mode of
+ * Operation" (McGrew and Viega): all-zero key and 96-bit IV, with no
+ * plaintext or 16 zero bytes of it.
+ */
+static void
+gcm_kat(void)
+{
+	static const struct {
+		size_t		keylen;
+		size_t		plen;
+		uint8_t		c[16];
+		uint8_t		t[16];
+	} tc[] = {
+		{ 16, 0, { 0 },
+		  { 0x58, 0xe2, 0xfc, 0xce, 0xfa, 0x7e, 0x30, 0x61,
+		    0x36, 0x7f, 0x1d, 0x57, 0xa4, 0xe7, 0x45, 0x5a } },
+		{ 16, 16,
+		  { 0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+		    0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78 },
+		  { 0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd,
+		    0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf } },
+		{ 32, 0, { 0 },
+		  { 0x53, 0x0f, 0x8a, 0xfb, 0xc7, 0x45, 0x36, 0xb9,
+		    0xa9, 0x63, 0xb4, 0xf1, 0xc4, 0xcb, 0x73, 0x8b } },
+		{ 32, 16,
+		  { 0xce, 0xa7, 0x40, 0x3d, 0x4d, 0x60, 0x6b, 0x6e,
+		    0x07, 0x4e, 0xc5, 0xd3, 0xba, 0xf3, 0x9d, 0x18 },
+		  { 0xd0, 0xd1, 0xc8, 0xa7, 0x99, 0x99, 0x6b, 0xf0,
+		    0x26, 0x5b, 0x98, 0xb5, 0xd4, 0x8a, 0xb9, 0x19 } },
+	};
+	uint8_t key[32] = { 0 }, iv[TLS_IVLEN] = { 0 }, p[16] = { 0 };
+	uint8_t c[16], t[TLS_TAGLEN];
+	size_t tlen;
+	unsigned int i;
+
+	for (i = 0; i < sizeof (tc) / sizeof (tc[0]); i++) {
+		tlen = sizeof (t);
+		if (CCCryptorGCM(kCCEncrypt, kCCAlgorithmAES, key,
+		    tc[i].keylen, iv, sizeof (iv), NULL, 0, p, tc[i].plen, c,
+		    t, &tlen) != kCCSuccess)
+			errx(1, "CCCryptorGCM");
+		if (memcmp(c, tc[i].c, tc[i].plen) != 0 ||
+		    memcmp(t, tc[i].t, TLS_TAGLEN) != 0)
+			errx(1, "CommonCrypto fails GCM test vector %u", i);
+	}
+}
+
+static void
+be64(uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (uint8_t)(v >> (56 - 8 * i));
+}
+
+static size_t
+keylen(int cipher)
+{
+	return (cipher == TLS_CIPHER_AES_256_GCM ? 32 : 16);
+}
+
+/*
+ * Seal a record in userspace with the same keys as set_keys(): RFC 5288
+ * (TLS 1.2, explicit nonce equal to the sequence number, additional data
+ * seq_num | type | version | length) or RFC 8446 section 5.2 (TLS 1.3,
+ * nonce of the IV XOR the sequence number, additional data the record
+ * header, content type after the plaintext).  Returns the record length.
+ */
+static size_t
+ref_seal(int version, int cipher, uint64_t seq, uint8_t type,
+    const uint8_t *plain, size_t plen, uint8_t *rec)
+{
+	struct tcp_tls_crypto tc;
+	uint8_t nonce[TLS_IVLEN], aad[13], sq[8], *p, *inner = NULL;
+	size_t hlen, clen, alen, tlen = TLS_TAGLEN;
+	int i;
+
+	keys(&tc, version, cipher, seq);
+	be64(sq, seq);
+	memcpy(nonce, tc.tls_iv, TLS_IVLEN);
+	if (version == TLS_VERSION_1_2) {
+		memcpy(&nonce[TLS_IVLEN - 8], sq, 8);
+		hlen = TLS_HDRLEN + TLS_NONCELEN;
+		clen = plen;
+		rec[0] = type;
+		memcpy(&rec[TLS_HDRLEN], sq, 8);
+		memcpy(aad, sq, 8);
+		aad[8] = type;
+		aad[9] = aad[10] = 3;
+		aad[11] = (uint8_t)(plen >> 8);
+		aad[12] = (uint8_t)plen;
+		alen = 13;
+		p = (uint8_t *)plain;
+	} else {
+		for (i = 0; i < 8; i++)
+			nonce[TLS_IVLEN - 8 + i] ^= sq[i];
+		hlen = TLS_HDRLEN;
+		clen = plen + 1;
+		rec[0] = TLS_RT_APPLICATION_DATA;
+		alen = TLS_HDRLEN;
+		if ((inner = malloc(clen)) == NULL)
+			err(1, "malloc");
+		memcpy(inner, plain, plen);
+		inner[plen] = type;
+		p = inner;
+	}
+	rec[1] = rec[2] = 3;
+	rec[3] = (uint8_t)((hlen - TLS_HDRLEN + clen + TLS_TAGLEN) >> 8);
+	rec[4] = (uint8_t)(hlen - TLS_HDRLEN + clen + TLS_TAGLEN);
+	if (version != TLS_VERSION_1_2)
+		memcpy(aad, rec, TLS_HDRLEN);
+	if (CCCryptorGCM(kCCEncrypt, kCCAlgorithmAES, tc.tls_key,
+	    keylen(cipher), nonce, TLS_IVLEN, aad, alen, p, clen, rec + hlen,
+	    rec + hlen + clen, &tlen) != kCCSuccess || tlen != TLS_TAGLEN)
+		errx(1, "CCCryptorGCM");
+	free(inner);
+	return (hlen + clen + TLS_TAGLEN);
+}
+
+/*
+ * Open a record from the wire in userspace.  GCM decryption is the
+ * counter mode keystream, so the tag is checked by sealing the plaintext
+ * again and comparing the whole record.  Returns the plaintext length,
+ * or -1 if the record is not what the sequence number and keys give.
+ */
+static int
+ref_open(int version, int cipher, uint64_t seq, const uint8_t *rec,
+    uint8_t *plain, uint8_t *type, uint8_t *scratch)
+{
+	struct tcp_tls_crypto tc;
+	uint8_t nonce[TLS_IVLEN], aad[13], sq[8], t[TLS_TAGLEN];
+	size_t reclen = (rec[3] << 8) | rec[4], hlen, clen, alen;
+	size_t tlen = sizeof (t);
+	int i;
+
+	/* what the plaintext and scratch buffers are sized for */
+	if (reclen > TLS_MAX_PLAINTEXT + 256)
+		return (-1);
+	keys(&tc, version, cipher, seq);
+	be64(sq, seq);
+	memcpy(nonce, tc.tls_iv, TLS_IVLEN);
+	if (version == TLS_VERSION_1_2) {
+		if (reclen < TLS_NONCELEN + TLS_TAGLEN)
+			return (-1);
+		memcpy(&nonce[TLS_IVLEN - 8], sq, 8);
+		hlen = TLS_HDRLEN + TLS_NONCELEN;
+		clen = reclen - TLS_NONCELEN - TLS_TAGLEN;
+		memcpy(aad, sq, 8);
+		memcpy(&aad[8], rec, 3);
+		aad[11] = (uint8_t)(clen >> 8);
+		aad[12] = (uint8_t)clen;
+		alen = 13;
+	} else {
+		if (reclen < 1 + TLS_TAGLEN)
+			return (-1);
+		for (i = 0; i < 8; i++)
+			nonce[TLS_IVLEN - 8 + i] ^= sq[i];
+		hlen = TLS_HDRLEN;
+		clen = reclen - TLS_TAGLEN;
+		memcpy(aad, rec, TLS_HDRLEN);
+		alen = TLS_HDRLEN;
+	}
+	if (CCCryptorGCM(kCCDecrypt, kCCAlgorithmAES, tc.tls_key,
+	    keylen(cipher), nonce, TLS_IVLEN, aad, alen, rec + hlen, clen,
+	    plain, t, &tlen) != kCCSuccess)
+		return (-1);
+	if (version == TLS_VERSION_1_2) {
+		*type = rec[0];
+	} else {
+		/* the content type is the last byte that is not padding */
+		while (clen > 0 && plain[clen - 1] == 0)
+			clen--;
+		if (clen-- == 0)
+			return (-1);
+		*type = plain[clen];
+	}
+	if (ref_seal(version, cipher, seq, *type, plain, clen, scratch) !=
+	    TLS_HDRLEN + reclen ||
+	    memcmp(scratch, rec, TLS_HDRLEN + reclen) != 0)
+		return (-1);
+	return ((int)clen);
+}
+
+static const size_t kat_sizes[] = { 1, 100, 16384, 16385, 40000 };
+#define	KAT_NSIZES	(sizeof (kat_sizes) / sizeof (kat_sizes[0]))
+#define	KAT_TOTAL	(1 + 100 + 16384 + 16385 + 40000)
+
+/* the writer's records, decrypted in userspace */
+static void
+kat_tx(int version, int cipher, uint8_t *src)
+{
+	static const uint8_t alert[2] = { 1, 0 };	/* close_notify */
+	struct writer w = { 0 };
+	union {
+		struct cmsghdr	hdr;
+		uint8_t		buf[CMSG_SPACE(1)];
+	} cm;
+	struct msghdr msg;
+	struct iovec iov;
+	pthread_t thr;
+	uint8_t *wirebuf, *plain, *scratch, type;
+	size_t wire, off = 0, got = 0;
+	uint64_t seq = 1000;
+	int wfd, rfd, n, plen, records = 0, alerts = 0;
+
+	tcp_pair(&wfd, &rfd);
+	if (set_keys(wfd, TCP_TLS_TX, version, cipher) < 0)
+		err(1, "TCP_TLS_TX");
+	w.fd = wfd;
+	w.buf = src;
+	w.sizes = kat_sizes;
+	w.nsizes = KAT_NSIZES;
+	w.file = -1;
+	pthread_create(&thr, NULL, writer_main, &w);
+	pthread_join(thr, NULL);
+
+	memset(&msg, 0, sizeof (msg));
+	memset(&cm, 0, sizeof (cm));
+	iov.iov_base = (void *)alert;
+	iov.iov_len = sizeof (alert);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cm.buf;
+	msg.msg_controllen = sizeof (cm.buf);
+	cm.hdr.cmsg_len = CMSG_LEN(1);
+	cm.hdr.cmsg_level = IPPROTO_TCP;
+	cm.hdr.cmsg_type = TCP_TLS_TX;
+	*CMSG_DATA(&cm.hdr) = TLS_RT_ALERT;
+	if (sendmsg(wfd, &msg, 0) != sizeof (alert))
+		err(1, "sendmsg");
+	shutdown(wfd, SHUT_WR);
+
+	wire = KAT_TOTAL + 64 * 1024;
+	if ((wirebuf = malloc(wire)) == NULL ||
+	    (plain = malloc(TLS_MAX_PLAINTEXT + 256)) == NULL ||
+	    (scratch = malloc(TLS_MAX_PLAINTEXT + 512)) == NULL)
+		err(1, "malloc");
+	n = read_full(rfd, wirebuf, wire);
+	while (n > 0 && off + TLS_HDRLEN <= (size_t)n) {
+		size_t reclen = (wirebuf[off + 3] << 8) | wirebuf[off + 4];
+
+		if (off + TLS_HDRLEN + reclen > (size_t)n)
+			break;
+		plen = ref_open(version, cipher, seq, &wirebuf[off], plain,
+		    &type, scratch);
+		if (plen < 0) {
+			CHECK(0, "%04x/%d: record %llu at %zu does not open",
+			    version, cipher, (unsigned long long)seq, off);
+			break;
+		}
+		if (type == TLS_RT_APPLICATION_DATA) {
+			CHECK(alerts == 0 && got + plen <= KAT_TOTAL &&
+			    memcmp(plain, src + got, plen) == 0,
+			    "%04x/%d: record %llu plaintext differs", version,
+			    cipher, (unsigned long long)seq);
+			got += plen;
+		} else {
+			CHECK(type == TLS_RT_ALERT && plen == 2 &&
+			    memcmp(plain, alert, 2) == 0,
+			    "%04x/%d: record %llu type %u", version, cipher,
+			    (unsigned long long)seq, type);
+			alerts++;
+		}
+		records++;
+		seq++;
+		off += TLS_HDRLEN + reclen;
+	}
+	CHECK(off == (size_t)n && got == KAT_TOTAL && alerts == 1,
+	    "%04x/%d: %zu of %d bytes and %d alerts in %d records",
+	    version, cipher, got, KAT_TOTAL, alerts, records);
+	free(scratch);
+	free(plain);
+	free(wirebuf);
+	close(wfd);
+	close(rfd);
+}
+
+/* records sealed in userspace, opened by the reader */
+static void
+kat_rx(int version, int cipher, uint8_t *src, uint8_t *dst)
+{
+	uint8_t *rec;
+	size_t off = 0, len;
+	uint64_t seq = 1000;
+	unsigned int i;
+	int wfd, rfd, n;
+
+	tcp_pair(&wfd, &rfd);
+	if (set_keys(rfd, TCP_TLS_RX, version, cipher) < 0)
+		err(1, "TCP_TLS_RX");
+	if ((rec = malloc(TLS_MAX_PLAINTEXT + 512)) == NULL)
+		err(1, "malloc");
+	for (i = 0; i < KAT_NSIZES; i++) {
+		size_t plen = kat_sizes[i];
+
+		/* the same cut as a sender's: at most 16 KB a record */
+		while (plen > 0) {
+			size_t chunk = plen > TLS_MAX_PLAINTEXT ?
+			    TLS_MAX_PLAINTEXT : plen;
+
+			len = ref_seal(version, cipher, seq++,
+			    TLS_RT_APPLICATION_DATA, src + off, chunk, rec);
+			if (write(wfd, rec, len) != (ssize_t)len)
+				err(1, "write");
+			off += chunk;
+			plen -= chunk;
+		}
+	}
+	shutdown(wfd, SHUT_WR);
+	n = read_full(rfd, dst, KAT_TOTAL);
+	CHECK(n == KAT_TOTAL && memcmp(src, dst, KAT_TOTAL) == 0,
+	    "%04x/%d: userspace records read back as %d bytes%s", version,
+	    cipher, n, n == KAT_TOTAL ? ", differing" : "");
+	free(rec);
+	close(wfd);
+	close(rfd);
+}
+
+static int
+tmpfile_of(const uint8_t *src, size_t len)
+{
+	char path[] = "/tmp/ktls.XXXXXX";
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0)
+		err(1, "mkstemp");
+	unlink(path);
+	if (write(fd, src, len) != (ssize_t)len)
+		err(1, "write");
+	return (fd);
+}
+
+/* returns MB/s; ktls: 0 none, 1 write, 2 sendfile */
+static double
+transfer(int ktls, const uint8_t *src, uint8_t *dst, size_t len, int file,
+    int check)
+{
+	struct writer w = { 0 };
+	size_t chunk = BIG, got = 0;
+	pthread_t thr;
+	double t0, t;
+	int wfd, rfd, n;
+
+	tcp_pair(&wfd, &rfd);
+	if (ktls && (set_keys(wfd, TCP_TLS_TX, TLS_VERSION_1_3,
+	    TLS_CIPHER_AES_128_GCM) < 0 || set_keys(rfd, TCP_TLS_RX,
+	    TLS_VERSION_1_3, TLS_CIPHER_AES_128_GCM) < 0))
+		err(1, "TCP_TLS_TX/RX");
+	/* the same BIG buffer or file, len / BIG times */
+	w.fd = wfd;
+	w.buf = src;
+	w.sizes = &chunk;
+	w.nsizes = 1;
+	w.repeat = len / BIG;
+	w.file = (ktls == 2) ? file : -1;
+	w.filelen = BIG;
+
+	t0 = now_sec();
+	pthread_create(&thr, NULL, writer_main, &w);
+	while (got < len) {
+		if ((n = read_full(rfd, dst, BIG)) <= 0)
+			break;
+		if (check && memcmp(dst, src, n) != 0) {
+			CHECK(0, "data differs at %zu", got);
+			break;
+		}
+		got += n;
+	}
+	t = now_sec() - t0;
+	pthread_join(thr, NULL);
+	CHECK(got == len, "transfer %d: %zu of %zu bytes", ktls, got, len);
+	close(wfd);
+	close(rfd);
+	return (len / t / 1e6);
+}
+
+int
+main(void)
+{
+	static const int versions[] = { TLS_VERSION_1_2, TLS_VERSION_1_3 };
+	static const int ciphers[] = { TLS_CIPHER_AES_128_GCM,
+	    TLS_CIPHER_AES_256_GCM };
+	struct tcp_tls_crypto tc;
+	uint8_t *src, *dst;
+	int i, j, wfd, rfd, file;
+
+	/* without kTLS there is nothing to test */
+	tcp_pair(&wfd, &rfd);
+	keys(&tc, TLS_VERSION_1_3, TLS_CIPHER_AES_128_GCM, 0);
+	if (setsockopt(wfd, IPPROTO_TCP, TCP_TLS_TX, &tc, sizeof (tc)) < 0) {
+		printf("kernel TLS not available: %s\nSKIP\n", strerror(errno));
+		return (0);
+	}
+	close(wfd);
+	close(rfd);
+
+	if ((src = malloc(BIG + total())) == NULL ||
+	    (dst = malloc(BIG + total())) == NULL)
+		err(1, "malloc");
+	fill(src, BIG + total(), 1);
+	gcm_kat();
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2; j++) {
+			roundtrip(versions[i], ciphers[j], src, dst);
+			kat_tx(versions[i], ciphers[j], src);
+			kat_rx(versions[i], ciphers[j], src, dst);
+		}
+		framing(versions[i], src);
+		control(versions[i]);
+		tamper(versions[i], src, dst);
+		fill(src, BIG + total(), 1);
+	}
+
+	file = tmpfile_of(src, BIG);
+#ifdef __APPLE__
+	(void) transfer(2, src, dst, BIG, file, 1);
+#endif
+
+	printf("%d MB over loopback, TLS 1.3 AES-128-GCM\n", BENCH >> 20);
+	printf("%-18s %10.0f MB/s\n", "plain write",
+	    transfer(0, src, dst, BENCH, -1, 0));
+	printf("%-18s %10.0f MB/s\n", "kTLS write",
+	    transfer(1, src, dst, BENCH, -1, 0));
+#ifdef __APPLE__
+	printf("%-18s %10.0f MB/s\n", "kTLS sendfile",
+	    transfer(2, src, dst, BENCH, file, 0));
+#endif
+	close(file);
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2016 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Measures moving a burst of small messages over a connected stream
+ * socket, one send()/recv() per message (-x 1) versus batches of
+ * messages per sendmsg_x()/recvmsg_x() call (-x batch).
+ */
+
+#ifdef	__sun
+#pragma ident	"@(#)msgx.c	1.0	16/01/01 Apple Inc."
+#endif
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../libmicro.h"
+
+/*
+ * Private interface, see <sys/socket.h>
+ */
+struct msghdr_x {
+	void		*msg_name;
+	socklen_t	msg_namelen;
+	struct iovec	*msg_iov;
+	int		msg_iovlen;
+	void		*msg_control;
+	socklen_t	msg_controllen;
+	int		msg_flags;
+	size_t		msg_datalen;
+};
+
+extern ssize_t sendmsg_x(int, const struct msghdr_x *, u_int, int);
+extern ssize_t recvmsg_x(int, const struct msghdr_x *, u_int, int);
+
+typedef struct {
+	int			ts_once;
+	int			ts_fds[2];
+	char			*ts_sbuf;
+	char			*ts_rbuf;
+	struct iovec		*ts_siov;
+	struct iovec		*ts_riov;
+	struct msghdr_x		*ts_smsg;
+	struct msghdr_x		*ts_rmsg;
+} tsd_t;
+
+#define	DEFM			64
+#define	DEFN			64
+#define	DEFX			1
+
+static int			optm = DEFM;
+static int			optn = DEFN;
+static int			optx = DEFX;
+static int			optt = 0;
+
+int
+benchmark_init()
+{
+	lm_tsdsize = sizeof (tsd_t);
+
+	(void) sprintf(lm_optstr, "m:n:x:t");
+
+	(void) sprintf(lm_usage,
+	    "       [-m message-size (default %d)]\n"
+	    "       [-n messages-per-burst (default %d)]\n"
+	    "       [-x messages-per-call (default %d)]\n"
+	    "       [-t] (use TCP over loopback instead of AF_UNIX)\n"
+	    "notes: measures a burst sent and received over a stream socket\n"
+	    "       with send/recv (-x 1) or sendmsg_x/recvmsg_x (-x > 1)\n",
+	    DEFM, DEFN, DEFX);
+
+	(void) sprintf(lm_header, "%6s %5s %5s %5s", "size", "burst",
+	    "batch", "proto");
+
+	lm_defB = 100;
+
+	return (0);
+}
+
+int
+benchmark_optswitch(int opt, char *optarg)
+{
+	switch (opt) {
+	case 'm':
+		optm = sizetoint(optarg);
+		break;
+	case 'n':
+		optn = atoi(optarg);
+		break;
+	case 'x':
+		optx = atoi(optarg);
+		break;
+	case 't':
+		optt = 1;
+		break;
+	default:
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+tcp_pair(int fds[2])
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof (sin);
+	int lfd, on = 1;
+
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		return (-1);
+	memset(&sin, 0, sizeof (sin));
+	sin.sin_len = sizeof (sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lfd, (struct sockaddr *)&sin, sizeof (sin)) == -1 ||
+	    getsockname(lfd, (struct sockaddr *)&sin, &len) == -1 ||
+	    listen(lfd, 1) == -1 ||
+	    (fds[0] = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+	    connect(fds[0], (struct sockaddr *)&sin, sizeof (sin)) == -1 ||
+	    (fds[1] = accept(lfd, NULL, NULL)) == -1) {
+		(void) close(lfd);
+		return (-1);
+	}
+	(void) close(lfd);
+	(void) setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+	return (0);
+}
+
+int
+benchmark_initbatch(void *tsd)
+{
+	tsd_t			*ts = (tsd_t *)tsd;
+	int			bufsize = 4 * optm * optn;
+	int			i;
+
+	if (ts->ts_once++ != 0)
+		return (0);
+
+	if (optx < 1 || optx > optn || optm < 1)
+		return (1);
+
+	if (optt) {
+		if (tcp_pair(ts->ts_fds) == -1)
+			return (1);
+	} else if (socketpair(AF_UNIX, SOCK_STREAM, 0, ts->ts_fds) == -1) {
+		return (1);
+	}
+	(void) setsockopt(ts->ts_fds[0], SOL_SOCKET, SO_SNDBUF,
+	    &bufsize, sizeof (bufsize));
+	(void) setsockopt(ts->ts_fds[1], SOL_SOCKET, SO_RCVBUF,
+	    &bufsize, sizeof (bufsize));
+
+	ts->ts_sbuf = malloc(optm * optn);
+	ts->ts_rbuf = malloc(optm * optn);
+	ts->ts_siov = calloc(optn, sizeof (struct iovec));
+	ts->ts_riov = calloc(optn, sizeof (struct iovec));
+	ts->ts_smsg = calloc(optn, sizeof (struct msghdr_x));
+	ts->ts_rmsg = calloc(optn, sizeof (struct msghdr_x));
+	if (ts->ts_sbuf == NULL || ts->ts_rbuf == NULL ||
+	    ts->ts_siov == NULL || ts->ts_riov == NULL ||
+	    ts->ts_smsg == NULL || ts->ts_rmsg == NULL)
+		return (1);
+	memset(ts->ts_sbuf, 'a', optm * optn);
+
+	for (i = 0; i < optn; i++) {
+		ts->ts_siov[i].iov_base = ts->ts_sbuf + i * optm;
+		ts->ts_siov[i].iov_len = optm;
+		ts->ts_riov[i].iov_base = ts->ts_rbuf + i * optm;
+		ts->ts_riov[i].iov_len = optm;
+	}
+
+	return (0);
+}
+
+static int
+burst_single(tsd_t *ts)
+{
+	ssize_t			n, done;
+	int			i;
+
+	for (i = 0; i < optn; i++) {
+		if (send(ts->ts_fds[0], ts->ts_siov[i].iov_base, optm, 0) !=
+		    optm)
+			return (-1);
+	}
+	for (done = 0; done < optm * optn; done += n) {
+		n = recv(ts->ts_fds[1], ts->ts_rbuf + done,
+		    MIN(optm, optm * optn - done), 0);
+		if (n <= 0)
+			return (-1);
+	}
+	return (0);
+}
+
+static int
+burst_batch(tsd_t *ts)
+{
+	ssize_t			n, done;
+	int			i, cnt;
+
+	for (i = 0; i < optn; i += cnt) {
+		cnt = optn - i < optx ? optn - i : optx;
+		n = sendmsg_x(ts->ts_fds[0], ts->ts_smsg + i, cnt, 0);
+		if (n != cnt)
+			return (-1);
+	}
+	for (done = 0; done < optm * optn; ) {
+		/*
+		 * Each batch fills its buffers in order, so a short batch
+		 * just means the rest has not arrived yet.
+		 */
+		cnt = optn < optx ? optn : optx;
+		for (i = 0; i < cnt; i++) {
+			ts->ts_rmsg[i].msg_iov = &ts->ts_riov[i];
+			ts->ts_rmsg[i].msg_iovlen = 1;
+			ts->ts_rmsg[i].msg_flags = 0;
+		}
+		n = recvmsg_x(ts->ts_fds[1], ts->ts_rmsg, cnt, 0);
+		if (n <= 0)
+			return (-1);
+		for (i = 0; i < n; i++)
+			done += ts->ts_rmsg[i].msg_datalen;
+	}
+	return (0);
+}
+
+int
+benchmark(void *tsd, result_t *res)
+{
+	tsd_t			*ts = (tsd_t *)tsd;
+	int			i;
+
+	if (optx > 1) {
+		for (i = 0; i < optn; i++) {
+			ts->ts_smsg[i].msg_iov = &ts->ts_siov[i];
+			ts->ts_smsg[i].msg_iovlen = 1;
+		}
+	}
+
+	for (i = 0; i < lm_optB; i++) {
+		if ((optx > 1 ? burst_batch(ts) : burst_single(ts)) != 0)
+			res->re_errors++;
+	}
+	res->re_count = i;
+
+	return (0);
+}
+
+char *
+benchmark_result()
+{
+	static char		result[256];
+
+	(void) sprintf(result, "%6d %5d %5d %5s", optm, optn, optx,
+	    optt ? "tcp" : "unix");
+
+	return (result);
+}
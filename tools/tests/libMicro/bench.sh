@@ -417,6 +417,11 @@ lmbench_select_tcp $OPTS -N "lmbench_select_tcp_100" -n 100 -B 100
 lmbench_select_tcp $OPTS -N "lmbench_select_tcp_250" -n 250 -B 100
 lmbench_select_tcp $OPTS -N "lmbench_select_tcp_500" -n 500 -B 100
 
+msgx		$OPTS -N "msgx_unix_1"	-m 64 -n 64 -x 1
+msgx		$OPTS -N "msgx_unix_64"	-m 64 -n 64 -x 64
+msgx		$OPTS -N "msgx_tcp_1"	-m 64 -n 64 -x 1 -t
+msgx		$OPTS -N "msgx_tcp_64"	-m 64 -n 64 -x 64 -t
+
 fcntl		$OPTS -N "fcntl_tmp"	-I 100	-f $TFILE
 fcntl		$OPTS -N "fcntl_usr"	-I 100	-f $VFILE
 fcntl_ndelay	$OPTS -N "fcntl_ndelay"	-I 100	
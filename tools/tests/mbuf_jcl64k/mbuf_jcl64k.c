@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Exercises the 64KB cluster pool, which only exists when the kernel was
+ * booted with mbuf_jcl64k=<percent of the jumbo pool>:
+ *
+ *  1. drives kern.ipc.mb_jcl64k_test (DEBUG/DEVELOPMENT kernels) to
+ *     allocate, free and drain MC_64KCL and MC_MBUF_64KCL objects;
+ *  2. runs a loopback TCP bulk send with kern.ipc.sosendjcl64k off and
+ *     on, and reports throughput along with the number of clusters each
+ *     write was built from, taken from the kern.ipc.mb_stat deltas.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* Must match struct mb_jcl64k_test in <sys/mbuf.h> */
+struct mb_jcl64k_test {
+	u_int32_t	mjt_count;
+	u_int32_t	mjt_rounds;
+	u_int64_t	mjt_raw;
+	u_int64_t	mjt_composite;
+	u_int64_t	mjt_raw_ns;
+	u_int64_t	mjt_composite_ns;
+	u_int32_t	mjt_total_before;
+	u_int32_t	mjt_total_peak;
+	u_int32_t	mjt_total_after;
+	u_int32_t	mjt_drained;
+};
+
+/* Must match mb_class_stat_t/mb_stat_t in <sys/mbuf.h> */
+struct mb_class_stat {
+	char		mbcl_cname[16];
+	u_int32_t	mbcl_size;
+	u_int32_t	mbcl_total;
+	u_int32_t	mbcl_active;
+	u_int32_t	mbcl_infree;
+	u_int32_t	mbcl_slab_cnt;
+#ifdef __LP64__
+	u_int32_t	mbcl_pad;
+#endif
+	u_int64_t	mbcl_alloc_cnt;
+	u_int64_t	mbcl_free_cnt;
+	u_int64_t	mbcl_notified;
+	u_int64_t	mbcl_purge_cnt;
+	u_int64_t	mbcl_fail_cnt;
+	u_int32_t	mbcl_ctotal;
+	u_int32_t	mbcl_release_cnt;
+	u_int32_t	mbcl_mc_state;
+	u_int32_t	mbcl_mc_cached;
+	u_int32_t	mbcl_mc_waiter_cnt;
+	u_int32_t	mbcl_mc_wretry_cnt;
+	u_int32_t	mbcl_mc_nwretry_cnt;
+	u_int32_t	mbcl_peak_reported;
+	u_int32_t	mbcl_reserved[7];
+};
+
+struct mb_stat {
+	u_int32_t		mbs_cnt;
+#ifdef __LP64__
+	u_int32_t		mbs_pad;
+#endif
+	struct mb_class_stat	mbs_class[1];
+};
+
+/* Cluster classes sosend() may build a chain from */
+static const char *send_classes[] = {
+	"cl", "bigcl", "16kcl", "64kcl",
+	"mbuf_cl", "mbuf_bigcl", "mbuf_16kcl", "mbuf_64kcl",
+};
+#define	NCLASSES	(sizeof (send_classes) / sizeof (send_classes[0]))
+
+#define	WRITE_SIZE	(1024 * 1024)
+
+static size_t total_bytes = 1024UL * 1024 * 1024;
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-c count] [-n rounds] [-m megabytes]\n",
+	    progname);
+	exit(1);
+}
+
+static void
+class_allocs(u_int64_t *cnt)
+{
+	struct mb_stat *mbs;
+	size_t len = 0;
+	unsigned int i, j;
+
+	if (sysctlbyname("kern.ipc.mb_stat", NULL, &len, NULL, 0) != 0)
+		err(1, "kern.ipc.mb_stat");
+	if ((mbs = malloc(len)) == NULL)
+		err(1, "malloc");
+	if (sysctlbyname("kern.ipc.mb_stat", mbs, &len, NULL, 0) != 0)
+		err(1, "kern.ipc.mb_stat");
+	for (i = 0; i < NCLASSES; i++) {
+		cnt[i] = 0;
+		for (j = 0; j < mbs->mbs_cnt; j++) {
+			if (strcmp(mbs->mbs_class[j].mbcl_cname,
+			    send_classes[i]) == 0)
+				cnt[i] = mbs->mbs_class[j].mbcl_alloc_cnt;
+		}
+	}
+	free(mbs);
+}
+
+static void
+run_sysctl_test(u_int32_t count, u_int32_t rounds)
+{
+	struct mb_jcl64k_test mjt;
+	size_t len = sizeof (mjt);
+	int maxint, newint = 1, force = 1;
+	size_t ilen = sizeof (maxint);
+
+	/*
+	 * m_drain() only runs when kern.ipc.mb_drain_maxint is non-zero
+	 * and at least that many seconds have passed since the last call;
+	 * the first call only starts the clock.
+	 */
+	if (sysctlbyname("kern.ipc.mb_drain_maxint", &maxint, &ilen,
+	    &newint, sizeof (newint)) != 0)
+		err(1, "kern.ipc.mb_drain_maxint");
+	(void) sysctlbyname("kern.ipc.mb_drain_force", NULL, NULL, &force,
+	    sizeof (force));
+	sleep(2);
+
+	memset(&mjt, 0, sizeof (mjt));
+	mjt.mjt_count = count;
+	mjt.mjt_rounds = rounds;
+	if (sysctlbyname("kern.ipc.mb_jcl64k_test", &mjt, &len, &mjt,
+	    sizeof (mjt)) != 0) {
+		if (errno == ENOTSUP)
+			errx(1, "no 64KB cluster pool; boot with mbuf_jcl64k=");
+		err(1, "kern.ipc.mb_jcl64k_test");
+	}
+	(void) sysctlbyname("kern.ipc.mb_drain_maxint", NULL, NULL, &maxint,
+	    sizeof (maxint));
+
+	if (mjt.mjt_raw == 0 || mjt.mjt_composite == 0)
+		errx(1, "no 64KB clusters could be allocated");
+	printf("64kcl      %8llu allocated %8.1f ns each\n",
+	    (unsigned long long)mjt.mjt_raw,
+	    (double)mjt.mjt_raw_ns / mjt.mjt_raw);
+	printf("mbuf_64kcl %8llu allocated %8.1f ns each\n",
+	    (unsigned long long)mjt.mjt_composite,
+	    (double)mjt.mjt_composite_ns / mjt.mjt_composite);
+	printf("64kcl pool: %u before, %u allocated, %u after %s\n",
+	    mjt.mjt_total_before, mjt.mjt_total_peak, mjt.mjt_total_after,
+	    mjt.mjt_drained ? "drain" : "purge (m_drain() declined)");
+}
+
+static void *
+sink(void *arg)
+{
+	int s = *(int *)arg;
+	char *buf;
+	ssize_t n;
+
+	if ((buf = malloc(WRITE_SIZE)) == NULL)
+		err(1, "malloc");
+	while ((n = read(s, buf, WRITE_SIZE)) > 0)
+		;
+	free(buf);
+	close(s);
+	return (NULL);
+}
+
+static void
+run_bulk_send(int jcl64k)
+{
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof (sin);
+	u_int64_t before[NCLASSES], after[NCLASSES], clusters = 0;
+	struct timeval t0, t1;
+	pthread_t thr;
+	size_t sent = 0;
+	char *buf;
+	double secs;
+	int ls, s, peer, on = 1, sndbuf = 4 * WRITE_SIZE;
+	unsigned int i;
+
+	if (sysctlbyname("kern.ipc.sosendjcl64k", NULL, NULL, &jcl64k,
+	    sizeof (jcl64k)) != 0)
+		err(1, "kern.ipc.sosendjcl64k");
+
+	if ((ls = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	memset(&sin, 0, sizeof (sin));
+	sin.sin_len = sizeof (sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(ls, (struct sockaddr *)&sin, sizeof (sin)) != 0 ||
+	    listen(ls, 1) != 0 ||
+	    getsockname(ls, (struct sockaddr *)&sin, &slen) != 0)
+		err(1, "listen");
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	(void) setsockopt(s, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof (sndbuf));
+	(void) setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+	if (connect(s, (struct sockaddr *)&sin, sizeof (sin)) != 0)
+		err(1, "connect");
+	if ((peer = accept(ls, NULL, NULL)) < 0)
+		err(1, "accept");
+	close(ls);
+	if (pthread_create(&thr, NULL, sink, &peer) != 0)
+		errx(1, "pthread_create");
+
+	if ((buf = malloc(WRITE_SIZE)) == NULL)
+		err(1, "malloc");
+	memset(buf, 0xa5, WRITE_SIZE);
+
+	class_allocs(before);
+	gettimeofday(&t0, NULL);
+	while (sent < total_bytes) {
+		ssize_t n = write(s, buf, WRITE_SIZE);
+		if (n < 0)
+			err(1, "write");
+		sent += n;
+	}
+	gettimeofday(&t1, NULL);
+	class_allocs(after);
+	close(s);
+	pthread_join(thr, NULL);
+	free(buf);
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	printf("sosendjcl64k=%d: %8.2f Gb/s,", jcl64k, sent * 8 / secs / 1e9);
+	for (i = 0; i < NCLASSES; i++)
+		clusters += after[i] - before[i];
+	/* The receive side on loopback shares the same clusters */
+	printf(" %6.1f clusters per %d KB write (", (double)clusters /
+	    (sent / WRITE_SIZE), WRITE_SIZE / 1024);
+	for (i = 0; i < NCLASSES; i++) {
+		if (after[i] != before[i])
+			printf(" %s %llu", send_classes[i],
+			    (unsigned long long)(after[i] - before[i]));
+	}
+	printf(" )\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	u_int32_t count = 16, rounds = 100;
+	int ch, saved, nj64cl;
+	size_t len;
+
+	while ((ch = getopt(argc, argv, "c:n:m:")) != -1) {
+		switch (ch) {
+		case 'c':
+			count = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			rounds = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			total_bytes = strtoul(optarg, NULL, 0) * 1024 * 1024;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	len = sizeof (nj64cl);
+	if (sysctlbyname("kern.ipc.nj64cl", &nj64cl, &len, NULL, 0) != 0)
+		err(1, "kern.ipc.nj64cl");
+	if (nj64cl == 0)
+		errx(1, "no 64KB cluster pool; boot with mbuf_jcl64k=");
+	printf("64KB cluster pool: %d KB\n", nj64cl * 2);
+
+	run_sysctl_test(count, rounds);
+
+	len = sizeof (saved);
+	if (sysctlbyname("kern.ipc.sosendjcl64k", &saved, &len, NULL, 0) != 0)
+		err(1, "kern.ipc.sosendjcl64k");
+	run_bulk_send(0);
+	run_bulk_send(1);
+	(void) sysctlbyname("kern.ipc.sosendjcl64k", NULL, NULL, &saved,
+	    sizeof (saved));
+
+	return (0);
+}
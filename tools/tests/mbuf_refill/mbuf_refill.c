@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Drives the kern.ipc.mb_refill_bench sysctl (DEBUG/DEVELOPMENT kernels)
+ * and reports the per-packet cost of refilling a driver receive ring one
+ * packet at a time versus with the batched allocator, relative to the
+ * packet rate of a 10 Gb/s link.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/sysctl.h>
+
+/* Must match struct mb_refill_bench in <sys/mbuf.h> */
+struct mb_refill_bench {
+	u_int32_t	mrb_ringsize;
+	u_int32_t	mrb_rounds;
+	u_int32_t	mrb_bufsize;
+	u_int32_t	mrb_pad;
+	u_int64_t	mrb_packets;
+	u_int64_t	mrb_single_ns;
+	u_int64_t	mrb_bulk_ns;
+};
+
+/* 10 Gb/s with 20 bytes of preamble and inter-frame gap per frame */
+#define	LINE_RATE_PPS(_framelen)	(10e9 / (((_framelen) + 20) * 8))
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-r ringsize] [-n rounds] [-s bufsize]\n",
+	    progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct mb_refill_bench mrb;
+	size_t len = sizeof (mrb);
+	double single, bulk;
+	int ch;
+
+	memset(&mrb, 0, sizeof (mrb));
+	mrb.mrb_ringsize = 512;
+	mrb.mrb_rounds = 2000;
+	mrb.mrb_bufsize = 2048;
+
+	while ((ch = getopt(argc, argv, "r:n:s:")) != -1) {
+		switch (ch) {
+		case 'r':
+			mrb.mrb_ringsize = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			mrb.mrb_rounds = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			mrb.mrb_bufsize = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (sysctlbyname("kern.ipc.mb_refill_bench", &mrb, &len, &mrb,
+	    sizeof (mrb)) != 0)
+		err(1, "kern.ipc.mb_refill_bench");
+	if (mrb.mrb_packets == 0)
+		errx(1, "no packets could be allocated");
+
+	single = (double)mrb.mrb_single_ns / mrb.mrb_packets;
+	bulk = (double)mrb.mrb_bulk_ns / mrb.mrb_packets;
+
+	printf("ring %u x %u-byte clusters, %u rounds, %llu packets\n",
+	    mrb.mrb_ringsize, mrb.mrb_bufsize, mrb.mrb_rounds,
+	    (unsigned long long)mrb.mrb_packets);
+	printf("%-8s %8.1f ns/pkt  %8.2f Mpps\n", "single", single,
+	    1e3 / single);
+	printf("%-8s %8.1f ns/pkt  %8.2f Mpps  (%.2fx)\n", "bulk", bulk,
+	    1e3 / bulk, single / bulk);
+	printf("10GbE line rate: %.2f Mpps (64-byte frames), "
+	    "%.3f Mpps (1518-byte frames)\n", LINE_RATE_PPS(64) / 1e6,
+	    LINE_RATE_PPS(1518) / 1e6);
+
+	return (0);
+}
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Model of the MPTCP subflow schedulers (bsd/netinet/mptcp_sched.c).
+ *
+ * The first part emulates two links of different RTT and bandwidth in
+ * 1 ms steps.  Each subflow has a bounded send buffer that drains at its
+ * link's rate and is freed one RTT after sending; the receiver puts the
+ * data back in DSN order.  "default" keeps all data on one subflow and
+ * rewinds to the data-level snd_una on failover; "lowrtt" fills the
+ * lowest-RTT subflow first, then the other, and reinjects what is stuck
+ * on a failed subflow.  Each is run on healthy links, and with the fast
+ * link failing part way through.
+ *
+ * The second part times the DSS mapping lookups tcp_output does for
+ * every segment, walking the send buffer from its head as before, and
+ * resuming from the mbuf found by the previous lookup.
+ *
+ * Fails if the data stops being delivered in order after a failover, or
+ * if the two lookups disagree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <err.h>
+#include <sys/time.h>
+
+#define	MSS		1448
+#define	SBMAX		(128 * 1024)	/* subflow send buffer */
+#define	DURATION	10000		/* ms */
+#define	FAIL_AT		3000		/* ms */
+#define	NSEG		((DURATION * 4000) / MSS)
+#define	NFLOWS		2
+#define	SBSEGS		(SBMAX / MSS + 1)
+
+struct link {
+	const char	*name;
+	int		bw;		/* bytes per ms */
+	int		owd;		/* one-way delay, ms */
+};
+
+static const struct link links[NFLOWS] = {
+	{ "20Mb/s 20ms", 2500, 10 },
+	{ "10Mb/s 60ms", 1250, 30 },
+};
+
+struct seg {
+	uint32_t	dsn;		/* in MSS units */
+	int		sent;
+	int		acktime;
+};
+
+struct subflow {
+	struct seg	sb[SBSEGS];	/* ring: unacked, then unsent */
+	int		head, count, unsent;
+	int		credit;
+	int		up;
+	int		failing;
+	int		lastack;	/* time of the last ACK progress */
+	/* segments in flight to the receiver */
+	struct { uint32_t dsn; int at; } fl[SBSEGS];
+	int		fhead, fcount;
+};
+
+static struct subflow flows[NFLOWS];
+static uint8_t *rcvd;			/* per segment */
+static uint32_t rcv_nxt;		/* data-level in-order point */
+static uint32_t snd_nxt;		/* next new segment */
+static uint32_t reorder_max;		/* most segments held out of order */
+static uint32_t nrcvd;
+static uint64_t resent;
+
+/* reinjection queue, segment ranges */
+static struct { uint32_t start, end; } rq[SBSEGS * NFLOWS];
+static int nrq;
+
+static int
+sb_space(struct subflow *sf)
+{
+	return (SBMAX - sf->count * MSS);
+}
+
+static void
+sb_append(struct subflow *sf, uint32_t dsn)
+{
+	struct seg *s = &sf->sb[(sf->head + sf->count) % SBSEGS];
+
+	s->dsn = dsn;
+	s->sent = 0;
+	sf->count++;
+	sf->unsent++;
+}
+
+static void
+receive(uint32_t dsn)
+{
+	if (dsn < rcv_nxt || rcvd[dsn])
+		return;
+	rcvd[dsn] = 1;
+	nrcvd++;
+	while (rcv_nxt < NSEG && rcvd[rcv_nxt])
+		rcv_nxt++;
+	if (nrcvd - rcv_nxt > reorder_max)
+		reorder_max = nrcvd - rcv_nxt;
+}
+
+/* mptcp_reinject_subflow() */
+static void
+reinject(struct subflow *sf)
+{
+	int i;
+
+	for (i = 0; i < sf->count; i++) {
+		uint32_t dsn = sf->sb[(sf->head + i) % SBSEGS].dsn;
+
+		if (nrq > 0 && rq[nrq - 1].end == dsn)
+			rq[nrq - 1].end++;
+		else {
+			rq[nrq].start = dsn;
+			rq[nrq].end = dsn + 1;
+			nrq++;
+		}
+	}
+	sf->head = sf->count = sf->unsent = 0;
+}
+
+static int
+next_seg(uint32_t *dsn)
+{
+	while (nrq > 0) {
+		if (rq[0].start < rq[0].end && rq[0].start >= rcv_nxt) {
+			*dsn = rq[0].start++;
+			resent++;
+			return (1);
+		}
+		if (rq[0].start < rcv_nxt && rcv_nxt < rq[0].end) {
+			rq[0].start = rcv_nxt;
+			continue;
+		}
+		nrq--;
+		memmove(&rq[0], &rq[1], nrq * sizeof (rq[0]));
+	}
+	if (snd_nxt >= NSEG)
+		return (0);
+	*dsn = snd_nxt++;
+	return (1);
+}
+
+static double
+simulate(int stripe, int fail, uint32_t *at_fail)
+{
+	int t, i, active = 0;
+
+	memset(flows, 0, sizeof (flows));
+	memset(rcvd, 0, NSEG);
+	rcv_nxt = snd_nxt = reorder_max = nrcvd = 0;
+	resent = 0;
+	nrq = 0;
+	for (i = 0; i < NFLOWS; i++)
+		flows[i].up = 1;
+	*at_fail = 0;
+
+	for (t = 0; t < DURATION; t++) {
+		if (fail && t == FAIL_AT) {
+			flows[0].up = 0;
+			*at_fail = rcv_nxt;
+		}
+
+		for (i = 0; i < NFLOWS; i++) {
+			struct subflow *sf = &flows[i];
+
+			/* receiver */
+			while (sf->fcount > 0 && sf->fl[sf->fhead].at <= t) {
+				if (sf->up)
+					receive(sf->fl[sf->fhead].dsn);
+				sf->fhead = (sf->fhead + 1) % SBSEGS;
+				sf->fcount--;
+			}
+			/* ACKs free the send buffer */
+			while (sf->up && sf->count > sf->unsent &&
+			    sf->sb[sf->head].acktime <= t) {
+				sf->head = (sf->head + 1) % SBSEGS;
+				sf->count--;
+				sf->lastack = t;
+			}
+			/* retransmission timeout: fail over */
+			if (!sf->failing && sf->count > sf->unsent &&
+			    t - sf->lastack > 4 * 2 * links[i].owd) {
+				sf->failing = 1;
+				if (stripe) {
+					reinject(sf);
+				} else if (i == active) {
+					/* rewind to the data-level snd_una */
+					active = (i + 1) % NFLOWS;
+					resent += snd_nxt - rcv_nxt;
+					snd_nxt = rcv_nxt;
+					flows[active].head = 0;
+					flows[active].count = 0;
+					flows[active].unsent = 0;
+				}
+			}
+		}
+
+		/* mptcp_output() */
+		if (!stripe) {
+			struct subflow *sf = &flows[active];
+			uint32_t dsn;
+
+			while (sb_space(sf) >= MSS && next_seg(&dsn))
+				sb_append(sf, dsn);
+		} else {
+			/* links[] is sorted by RTT */
+			for (i = 0; i < NFLOWS; i++) {
+				struct subflow *sf = &flows[i];
+				uint32_t dsn;
+
+				if (sf->failing)
+					continue;
+				while (sb_space(sf) >= MSS && next_seg(&dsn))
+					sb_append(sf, dsn);
+			}
+		}
+
+		/* each subflow transmits at its link's rate */
+		for (i = 0; i < NFLOWS; i++) {
+			struct subflow *sf = &flows[i];
+
+			if (sf->unsent == 0) {
+				sf->credit = 0;
+				continue;
+			}
+			sf->credit += links[i].bw;
+			while (sf->unsent > 0 && sf->credit >= MSS) {
+				struct seg *s = &sf->sb[(sf->head + sf->count -
+				    sf->unsent) % SBSEGS];
+
+				s->sent = 1;
+				s->acktime = t + 2 * links[i].owd;
+				sf->fl[(sf->fhead + sf->fcount) % SBSEGS].dsn =
+				    s->dsn;
+				sf->fl[(sf->fhead + sf->fcount) % SBSEGS].at =
+				    t + links[i].owd;
+				sf->fcount++;
+				sf->unsent--;
+				sf->credit -= MSS;
+				if (sf->count == sf->unsent + 1)
+					sf->lastack = t;
+			}
+		}
+	}
+	return ((double)rcv_nxt * MSS * 8 / (DURATION / 1000.0) / 1e6);
+}
+
+/*
+ * DSS mapping lookups, after mptcp_output_getm_dsnmap64().
+ */
+#define	NMBUF		4096
+#define	WRITELEN	512		/* application write size */
+
+struct mb {
+	struct mb	*next;
+	uint64_t	dsn;
+	uint32_t	rseq;
+	uint32_t	rlen;
+};
+
+static struct mb mbufs[NMBUF];
+static struct mb *cache_m;
+static int cache_off;
+
+static void
+getm_dsnmap(struct mb *m, int off, uint32_t datalen, int cached,
+    uint64_t *dsn, uint32_t *relseq, uint16_t *data_len)
+{
+	uint32_t runlen;
+	int moff = 0;
+
+	if (cached && cache_m != NULL && off >= cache_off) {
+		m = cache_m;
+		moff = cache_off;
+	}
+	off -= moff;
+	while (m != NULL && (uint32_t)off >= m->rlen) {
+		off -= m->rlen;
+		moff += m->rlen;
+		m = m->next;
+	}
+	if (m == NULL)
+		errx(1, "bad offset");
+	cache_m = m;
+	cache_off = moff;
+
+	*dsn = m->dsn + off;
+	*relseq = m->rseq + off;
+	runlen = m->rlen - off;
+	for (m = m->next; datalen > runlen && m != NULL &&
+	    m->dsn == *dsn + runlen; m = m->next)
+		runlen += m->rlen;
+	*data_len = datalen < runlen ? datalen : runlen;
+}
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* send a buffer of n mbufs once, looking each segment up twice */
+static double
+lookups(int n, int cached, uint64_t *sum)
+{
+	uint32_t total = n * WRITELEN, relseq;
+	uint64_t dsn, s = 0;
+	uint16_t len;
+	double t0;
+	int off, pass, passes = (NMBUF * 64) / n;
+
+	t0 = now_sec();
+	for (pass = 0; pass < passes; pass++) {
+		cache_m = NULL;
+		for (off = 0; off < (int)total; off += MSS) {
+			uint32_t want = total - off < MSS ? total - off : MSS;
+
+			/* mptcp_adj_sendlen(), then mptcp_setup_opts() */
+			getm_dsnmap(&mbufs[0], off, want, cached, &dsn,
+			    &relseq, &len);
+			getm_dsnmap(&mbufs[0], off, len, cached, &dsn,
+			    &relseq, &len);
+			s += dsn + relseq + len;
+		}
+	}
+	*sum = s;
+	return ((now_sec() - t0) * 1e9 / passes /
+	    (2 * ((total + MSS - 1) / MSS)));
+}
+
+int
+main(void)
+{
+	static const int sizes[] = { 64, 256, 1024, 4096 };
+	double def, low;
+	uint32_t at_fail, before;
+	uint64_t s1, s2;
+	int failed = 0, fail, i;
+
+	if ((rcvd = malloc(NSEG)) == NULL)
+		err(1, "malloc");
+
+	printf("links: %s, %s; %d KB subflow send buffers; %d s\n",
+	    links[0].name, links[1].name, SBMAX / 1024, DURATION / 1000);
+	printf("%-24s %10s %10s %12s %10s\n", "", "default", "lowrtt",
+	    "reorder max", "resent");
+	for (fail = 0; fail < 2; fail++) {
+		def = simulate(0, fail, &at_fail);
+		before = rcv_nxt;
+		if (fail && before <= at_fail) {
+			printf("FAIL: default stalled after the failover\n");
+			failed = 1;
+		}
+		printf("%-24s %8.2f Mb %8s %12s %10llu\n", fail ?
+		    "fast link fails at 3 s" : "both links up", def, "", "",
+		    (unsigned long long)resent);
+		low = simulate(1, fail, &at_fail);
+		if (fail && rcv_nxt <= at_fail) {
+			printf("FAIL: lowrtt stalled after the failover\n");
+			failed = 1;
+		}
+		printf("%-24s %10s %8.2f Mb %9u KB %10llu\n", "", "", low,
+		    reorder_max * MSS / 1024, (unsigned long long)resent);
+	}
+
+	printf("\nDSS lookups, %d-byte writes, ns per lookup\n", WRITELEN);
+	printf("%8s %10s %10s %9s\n", "mbufs", "walk", "cached", "speedup");
+	for (i = 0; i < NMBUF; i++) {
+		mbufs[i].next = i + 1 < NMBUF ? &mbufs[i + 1] : NULL;
+		mbufs[i].dsn = 1000000 + (uint64_t)i * WRITELEN +
+		    (i / 100) * 7;		/* a gap every 100 writes */
+		mbufs[i].rseq = i * WRITELEN;
+		mbufs[i].rlen = WRITELEN;
+	}
+	for (i = 0; i < (int)(sizeof (sizes) / sizeof (sizes[0])); i++) {
+		double walk, cached;
+
+		mbufs[sizes[i] - 1].next = NULL;
+		walk = lookups(sizes[i], 0, &s1);
+		cached = lookups(sizes[i], 1, &s2);
+		if (sizes[i] < NMBUF)
+			mbufs[sizes[i] - 1].next = &mbufs[sizes[i]];
+		printf("%8d %10.1f %10.1f %8.1fx\n", sizes[i], walk, cached,
+		    walk / cached);
+		if (s1 != s2) {
+			printf("FAIL: cached lookup disagrees\n");
+			failed = 1;
+		}
+	}
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
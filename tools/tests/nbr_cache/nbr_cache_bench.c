@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Model of the neighbor cache (bsd/net/if_nbr.c) against the radix tree
+ * it sits in front of, with tens of thousands of neighbors on a link.
+ *
+ * Lookup, per thread count:
+ *   tree	rtalloc1_scoped() and RT_LOCK(): a walk down a search tree
+ *		of all the routes under one global lock, then the entry's
+ *		own lock and a reference
+ *   hash	nbr_lookup(): the interface's hash bucket under its lock,
+ *		then only a try for the entry's lock, falling back to the
+ *		tree if it stays busy
+ *
+ * Expiry, over simulated seconds of the periodic timer:
+ *   list	arp_timeout()/nd6_service() as they were: every entry on
+ *		the global list is looked at on every run
+ *   wheel	nbr_wheel_advance() and nbr_wheel_pop(): only the entries
+ *		that are due, with those further out than a turn kept on
+ *		the far list
+ *
+ * Every expired entry is rearmed, as a refreshed neighbor would be.
+ * Fails if a lookup returns the wrong entry, or if the two expiry modes
+ * do not expire the same entries at the same times.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#define	NNEIGHBORS	32768
+#define	NBUCKETS	16384		/* grown to from nbr_buckets */
+#define	SLOTS		256		/* NBR_WHEEL_SLOTS */
+#define	LOOKUP_TRIES	4		/* NBR_LOOKUP_TRIES */
+#define	NLOOKUPS	(1 << 20)	/* per thread */
+#define	MAX_THREADS	8
+#define	LIFETIME	1200		/* arpt_keep */
+#define	NSECONDS	3600		/* simulated */
+#define	PRUNE		1		/* timer period in seconds */
+
+struct nbr {
+	/* radix tree stand-in */
+	struct nbr	*left, *right;
+	/* neighbor table */
+	LIST_ENTRY(nbr)	link;
+	uint32_t	hash;
+	/* global list and wheel */
+	LIST_ENTRY(nbr)	glink;
+	TAILQ_ENTRY(nbr) tlink;
+	int		slot;
+	uint64_t	expire;
+	uint64_t	expired;	/* times */
+	/* rtentry */
+	pthread_mutex_t	lock;
+	uint32_t	refcnt;
+	uint32_t	addr;
+};
+
+#define	SLOT_NONE	-1
+#define	SLOT_FAR	-2
+#define	SLOT_DUE	-3
+
+TAILQ_HEAD(nbr_list, nbr);
+
+struct bucket {
+	pthread_mutex_t	lock;
+	LIST_HEAD(, nbr) head;
+} __attribute__((aligned(64)));
+
+static struct nbr nbrs[NNEIGHBORS];
+static struct nbr *root;
+static pthread_mutex_t rnh_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bucket buckets[NBUCKETS];
+static uint32_t seed = 0x5bd1e995;
+static LIST_HEAD(, nbr) llinfo;
+
+static struct {
+	uint64_t	time;
+	struct nbr_list	due, far, slot[SLOTS];
+} wheel;
+
+static int hashed;
+static int failed;
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* net_flowhash() stand-in */
+static uint32_t
+hash32(uint32_t v)
+{
+	v ^= seed;
+	v ^= v >> 16;
+	v *= 0x85ebca6b;
+	v ^= v >> 13;
+	v *= 0xc2b2ae35;
+	v ^= v >> 16;
+	return (v);
+}
+
+static void
+tree_insert(struct nbr *n)
+{
+	struct nbr **p = &root;
+
+	while (*p != NULL)
+		p = (n->addr < (*p)->addr) ? &(*p)->left : &(*p)->right;
+	*p = n;
+}
+
+static struct nbr *
+tree_lookup(uint32_t addr)
+{
+	struct nbr *n;
+
+	pthread_mutex_lock(&rnh_lock);
+	for (n = root; n != NULL && n->addr != addr; )
+		n = (addr < n->addr) ? n->left : n->right;
+	if (n != NULL) {
+		pthread_mutex_lock(&n->lock);
+		n->refcnt++;
+	}
+	pthread_mutex_unlock(&rnh_lock);
+	return (n);
+}
+
+static struct nbr *
+hash_lookup(uint32_t addr)
+{
+	uint32_t hash = hash32(addr);
+	struct bucket *b = &buckets[hash % NBUCKETS];
+	struct nbr *n;
+	int tries;
+
+	for (tries = 0; tries < LOOKUP_TRIES; tries++) {
+		pthread_mutex_lock(&b->lock);
+		LIST_FOREACH(n, &b->head, link) {
+			if (n->hash == hash && n->addr == addr)
+				break;
+		}
+		if (n == NULL) {
+			pthread_mutex_unlock(&b->lock);
+			break;
+		}
+		if (pthread_mutex_trylock(&n->lock) == 0) {
+			pthread_mutex_unlock(&b->lock);
+			n->refcnt++;
+			return (n);
+		}
+		pthread_mutex_unlock(&b->lock);
+	}
+	return (tree_lookup(addr));
+}
+
+static void *
+lookup_main(void *arg)
+{
+	uint32_t r = (uint32_t)(uintptr_t)arg * 2654435761U + 1;
+	struct nbr *n, *want;
+	int i;
+
+	for (i = 0; i < NLOOKUPS; i++) {
+		r = r * 1103515245 + 12345;
+		want = &nbrs[(r >> 8) % NNEIGHBORS];
+		n = hashed ? hash_lookup(want->addr) : tree_lookup(want->addr);
+		if (n != want) {
+			failed = 1;
+			if (n == NULL)
+				continue;
+		}
+		/* RT_REMREF_LOCKED(); RT_UNLOCK() */
+		n->refcnt--;
+		pthread_mutex_unlock(&n->lock);
+	}
+	return (NULL);
+}
+
+static void
+run_lookup(int nthreads)
+{
+	pthread_t thr[MAX_THREADS];
+	double t0, t;
+	int i;
+
+	t0 = now_sec();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&thr[i], NULL, lookup_main,
+		    (void *)(uintptr_t)i) != 0)
+			err(1, "pthread_create");
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thr[i], NULL);
+	t = now_sec() - t0;
+	printf("%-6s %7d %14.0f %9.1f\n", hashed ? "hash" : "tree", nthreads,
+	    (double)NLOOKUPS * nthreads / t, t * 1e9 / NLOOKUPS / nthreads);
+}
+
+/* nbr_wheel_link() */
+static void
+wheel_link(struct nbr *n, uint64_t deadline)
+{
+	n->expire = deadline;
+	if (deadline < wheel.time + SLOTS) {
+		n->slot = (deadline > wheel.time ? deadline : wheel.time) %
+		    SLOTS;
+		TAILQ_INSERT_TAIL(&wheel.slot[n->slot], n, tlink);
+	} else {
+		n->slot = SLOT_FAR;
+		TAILQ_INSERT_TAIL(&wheel.far, n, tlink);
+	}
+}
+
+static void
+wheel_take(struct nbr_list *head)
+{
+	struct nbr *n;
+
+	while ((n = TAILQ_FIRST(head)) != NULL) {
+		TAILQ_REMOVE(head, n, tlink);
+		TAILQ_INSERT_TAIL(&wheel.due, n, tlink);
+		n->slot = SLOT_DUE;
+	}
+}
+
+/* nbr_wheel_far() */
+static uint64_t
+wheel_far(uint64_t now)
+{
+	struct nbr *n, *nn;
+	uint64_t visited = 0;
+
+	for (n = TAILQ_FIRST(&wheel.far); n != NULL; n = nn) {
+		nn = TAILQ_NEXT(n, tlink);
+		visited++;
+		if (n->expire >= wheel.time + SLOTS)
+			continue;
+		TAILQ_REMOVE(&wheel.far, n, tlink);
+		if (n->expire <= now) {
+			TAILQ_INSERT_TAIL(&wheel.due, n, tlink);
+			n->slot = SLOT_DUE;
+		} else {
+			n->slot = n->expire % SLOTS;
+			TAILQ_INSERT_TAIL(&wheel.slot[n->slot], n, tlink);
+		}
+	}
+	return (visited);
+}
+
+/* nbr_wheel_advance(); returns the far entries looked at */
+static uint64_t
+wheel_advance(uint64_t now)
+{
+	uint64_t visited = 0;
+	int i;
+
+	if (now >= wheel.time + SLOTS) {
+		for (i = 0; i < SLOTS; i++)
+			wheel_take(&wheel.slot[i]);
+		wheel.time = now + 1;
+		visited += wheel_far(now);
+	} else {
+		while (wheel.time <= now) {
+			wheel_take(&wheel.slot[wheel.time % SLOTS]);
+			if ((++wheel.time % SLOTS) == 0)
+				visited += wheel_far(now);
+		}
+	}
+	return (visited);
+}
+
+/* Spread the first expiries over a lifetime, as a busy link would */
+static void
+expiry_reset(int wheeled)
+{
+	uint32_t r = 1;
+	int i;
+
+	wheel.time = 0;
+	TAILQ_INIT(&wheel.due);
+	TAILQ_INIT(&wheel.far);
+	for (i = 0; i < SLOTS; i++)
+		TAILQ_INIT(&wheel.slot[i]);
+	for (i = 0; i < NNEIGHBORS; i++) {
+		struct nbr *n = &nbrs[i];
+
+		r = r * 1103515245 + 12345;
+		n->expired = 0;
+		n->slot = SLOT_NONE;
+		if (wheeled)
+			wheel_link(n, 1 + (r >> 8) % LIFETIME);
+		else
+			n->expire = 1 + (r >> 8) % LIFETIME;
+	}
+}
+
+static void
+run_expiry(int wheeled, uint64_t *sum)
+{
+	uint64_t now, visited = 0, expired = 0;
+	struct nbr *n;
+	double t0, t;
+	int i;
+
+	expiry_reset(wheeled);
+	t0 = now_sec();
+	for (now = PRUNE; now <= NSECONDS; now += PRUNE) {
+		if (!wheeled) {
+			LIST_FOREACH(n, &llinfo, glink) {
+				visited++;
+				pthread_mutex_lock(&n->lock);
+				if (n->expire <= now) {
+					n->expired++;
+					expired++;
+					n->expire = now + LIFETIME;
+				}
+				pthread_mutex_unlock(&n->lock);
+			}
+			continue;
+		}
+		visited += wheel_advance(now);
+		while ((n = TAILQ_FIRST(&wheel.due)) != NULL) {
+			TAILQ_REMOVE(&wheel.due, n, tlink);
+			n->slot = SLOT_NONE;
+			visited++;
+			pthread_mutex_lock(&n->lock);
+			if (n->expire <= now) {
+				n->expired++;
+				expired++;
+				wheel_link(n, now + LIFETIME);
+			} else {
+				wheel_link(n, n->expire);
+			}
+			pthread_mutex_unlock(&n->lock);
+		}
+	}
+	t = now_sec() - t0;
+
+	*sum = 0;
+	for (i = 0; i < NNEIGHBORS; i++)
+		*sum = (*sum ^ nbrs[i].expired ^ nbrs[i].expire) *
+		    0x100000001b3ULL;
+	printf("%-6s %9d %12llu %12llu %10.2f\n", wheeled ? "wheel" : "list",
+	    NSECONDS / PRUNE, (unsigned long long)expired,
+	    (unsigned long long)visited, t * 1e3);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int counts[] = { 1, 2, 4, 8 };
+	uint32_t i, n = sizeof (counts) / sizeof (counts[0]);
+	uint64_t list_sum, wheel_sum;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (n > sizeof (counts) / sizeof (counts[0]))
+		n = sizeof (counts) / sizeof (counts[0]);
+
+	LIST_INIT(&llinfo);
+	for (i = 0; i < NBUCKETS; i++) {
+		pthread_mutex_init(&buckets[i].lock, NULL);
+		LIST_INIT(&buckets[i].head);
+	}
+	for (i = 0; i < NNEIGHBORS; i++) {
+		struct nbr *nb = &nbrs[i];
+
+		/* 10.0.0.0/16 and up, in address order */
+		nb->addr = 0x0a000000 + i;
+		nb->hash = hash32(nb->addr);
+		pthread_mutex_init(&nb->lock, NULL);
+		LIST_INSERT_HEAD(&buckets[nb->hash % NBUCKETS].head, nb, link);
+		LIST_INSERT_HEAD(&llinfo, nb, glink);
+	}
+	/* insert in a random order so that the tree stays shallow */
+	srandom(1);
+	{
+		uint32_t *perm;
+
+		if ((perm = malloc(NNEIGHBORS * sizeof (*perm))) == NULL)
+			err(1, "malloc");
+		for (i = 0; i < NNEIGHBORS; i++)
+			perm[i] = i;
+		for (i = NNEIGHBORS - 1; i > 0; i--) {
+			uint32_t j = random() % (i + 1), v = perm[i];
+
+			perm[i] = perm[j];
+			perm[j] = v;
+		}
+		for (i = 0; i < NNEIGHBORS; i++)
+			tree_insert(&nbrs[perm[i]]);
+		free(perm);
+	}
+
+	printf("%ld CPUs, %d neighbors, %d buckets\n",
+	    sysconf(_SC_NPROCESSORS_ONLN), NNEIGHBORS, NBUCKETS);
+	printf("%-6s %7s %14s %9s\n", "lookup", "threads", "lookups/s",
+	    "ns/op");
+	for (i = 0; i < n; i++) {
+		for (hashed = 0; hashed < 2; hashed++)
+			run_lookup(counts[i]);
+	}
+	if (failed)
+		printf("FAIL: lookup returned the wrong neighbor\n");
+
+	printf("%-6s %9s %12s %12s %10s\n", "expiry", "seconds", "expired",
+	    "visited", "ms");
+	run_expiry(0, &list_sum);
+	run_expiry(1, &wheel_sum);
+	if (list_sum != wheel_sum) {
+		printf("FAIL: wheel and list expire differently\n");
+		failed = 1;
+	}
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Loads a blocklist-sized set of prefixes into the compact pf table
+ * representation of bsd/net/pf_cset.c (struct pfr_cset) and reports the
+ * load time and the memory used per entry, next to the size of the
+ * pfr_kentry each address costs in a radix-backed table.  Every lookup
+ * result, including negated entries, is checked against a binary trie.
+ *
+ * pf_cset.c is compiled in as it is, on top of the headers in shim/.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <mach/mach_time.h>
+
+#define	INET		1
+#define	INET6		1
+
+#include "../../../bsd/net/pf_cset.c"
+
+/* layout of struct pfr_kentry, for the size comparison */
+struct radix_node_model {
+	void		*rn_mklist;
+	void		*rn_parent;
+	short		 rn_bit;
+	char		 rn_bmask;
+	u_char		 rn_flags;
+	void		*rn_u[3];
+};
+
+struct pfr_kentry_model {
+	struct radix_node_model	 pfrke_node[2];
+	union {
+		struct sockaddr_in	sin;
+		struct sockaddr_in6	sin6;
+	}			 pfrke_sa;
+	u_int64_t		 pfrke_packets[2][2];
+	u_int64_t		 pfrke_bytes[2][2];
+	void			*pfrke_workq;
+	u_int64_t		 pfrke_tzero;
+	u_int8_t		 pfrke_af;
+	u_int8_t		 pfrke_net;
+	u_int8_t		 pfrke_not;
+	u_int8_t		 pfrke_mark;
+	u_int8_t		 pfrke_intrpool;
+};
+
+struct tnode {
+	struct tnode	*child[2];
+	u_int32_t	 ent;		/* pcs_ent index + 1, 0 if none */
+};
+
+static struct tnode *root4, *root6;
+static size_t tnodes;
+
+static int
+bit(const struct pf_addr *a, u_int32_t i)
+{
+	return ((ntohl(a->addr32[i / 32]) >> (31 - i % 32)) & 1);
+}
+
+static void
+trie_insert(struct pfr_centry *ce, u_int32_t ent)
+{
+	struct tnode **np = ce->pfrce_af == AF_INET ? &root4 : &root6;
+	u_int32_t i;
+
+	for (i = 0; ; i++) {
+		if (*np == NULL) {
+			if ((*np = calloc(1, sizeof (**np))) == NULL)
+				err(1, "calloc");
+			tnodes++;
+		}
+		if (i == ce->pfrce_net)
+			break;
+		np = &(*np)->child[bit(&ce->pfrce_addr, i)];
+	}
+	(*np)->ent = ent + 1;
+}
+
+static struct pfr_centry *
+trie_lookup(struct pfr_cset *cs, struct pf_addr *a, int af)
+{
+	struct tnode *n = af == AF_INET ? root4 : root6;
+	u_int32_t i, ent = 0, nbits = af == AF_INET ? 32 : 128;
+
+	for (i = 0; n != NULL; i++) {
+		if (n->ent != 0)
+			ent = n->ent;
+		if (i == nbits)
+			break;
+		n = n->child[bit(a, i)];
+	}
+	return (ent ? &cs->pcs_ent[ent - 1] : NULL);
+}
+
+static void
+mkaddr(struct pf_addr *a, int af, u_int32_t net)
+{
+	u_int32_t i, nbits = af == AF_INET ? 32 : 128;
+
+	memset(a, 0, sizeof (*a));
+	for (i = 0; i < nbits / 32; i++)
+		a->addr32[i] = (u_int32_t)random() ^ ((u_int32_t)random() << 16);
+	if (af == AF_INET6)
+		a->addr32[0] = htonl(0x20010000 |
+		    (ntohl(a->addr32[0]) & 0x3ff));	/* keep some overlap */
+	for (i = net; i < nbits; i++)
+		a->addr32[i / 32] &= htonl(~(0x80000000U >> (i % 32)));
+}
+
+static u_int32_t
+gen_net(int af)
+{
+	/* blocklists are mostly hosts with a tail of networks */
+	u_int32_t r = random() % 100;
+
+	if (af == AF_INET6)
+		return (r < 50 ? 128 : 32 + random() % 33);
+	if (r < 80)
+		return (32);
+	if (r < 95)
+		return (24);
+	return (8 + random() % 24);
+}
+
+static void
+randaddr(struct pfr_centry *p, u_int32_t n, struct pf_addr *a, int *af)
+{
+	struct pfr_centry *ce;
+	u_int32_t i, nbits;
+
+	if (random() % 2) {
+		*af = random() % 10 ? AF_INET : AF_INET6;
+		mkaddr(a, *af, *af == AF_INET ? 32 : 128);
+		return;
+	}
+	/* somewhere inside a loaded prefix */
+	ce = &p[random() % n];
+	*af = ce->pfrce_af;
+	nbits = *af == AF_INET ? 32 : 128;
+	mkaddr(a, *af, nbits);
+	for (i = 0; i < ce->pfrce_net; i++) {
+		a->addr32[i / 32] &= htonl(~(0x80000000U >> (i % 32)));
+		a->addr32[i / 32] |= ce->pfrce_addr.addr32[i / 32] &
+		    htonl(0x80000000U >> (i % 32));
+	}
+}
+
+static double
+elapsed(u_int64_t t)
+{
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0)
+		mach_timebase_info(&tb);
+	return ((double)t * tb.numer / tb.denom / 1e9);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct pfr_centry *p, *ent, *x, *y;
+	struct pfr_cset *cs;
+	struct pf_addr *addrs;
+	int *afs;
+	u_int32_t n = 1000000, nlookups = 5000000, i, errors = 0;
+	u_int64_t t0, t1, t2, t3;
+	volatile uintptr_t sink = 0;
+	unsigned seed = 1;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "l:n:s:")) != -1) {
+		switch (ch) {
+		case 'l':
+			nlookups = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: pf_cset_bench [-n entries] "
+			    "[-l lookups] [-s seed]\n");
+			exit(1);
+		}
+	}
+	if (n == 0)
+		errx(1, "no entries");
+	srandom(seed);
+
+	/* what pfr_ina_define() would copy in, 5% IPv6, 2% negated */
+	if ((p = calloc(n, sizeof (*p))) == NULL ||
+	    (ent = malloc(n * sizeof (*ent))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++) {
+		p[i].pfrce_af = random() % 20 ? AF_INET : AF_INET6;
+		p[i].pfrce_net = gen_net(p[i].pfrce_af);
+		p[i].pfrce_not = (random() % 50) == 0;
+		mkaddr(&p[i].pfrce_addr, p[i].pfrce_af, p[i].pfrce_net);
+		p[i].pfrce_seq = i;
+	}
+	if (n > 4) {
+		/* both ends of each address space */
+		p[0].pfrce_net = 0;
+		memset(&p[0].pfrce_addr, 0, sizeof (p[0].pfrce_addr));
+		p[1].pfrce_af = AF_INET6;
+		p[1].pfrce_net = 0;
+		memset(&p[1].pfrce_addr, 0, sizeof (p[1].pfrce_addr));
+		p[2].pfrce_af = AF_INET;
+		p[2].pfrce_net = 24;
+		p[2].pfrce_addr.addr32[0] = htonl(0xffffff00);
+		p[3].pfrce_af = AF_INET6;
+		p[3].pfrce_net = 128;
+		memset(&p[3].pfrce_addr, 0xff, sizeof (p[3].pfrce_addr));
+	}
+	memcpy(ent, p, n * sizeof (*ent));
+
+	/* what pfr_cset_load() does after copyin */
+	t0 = mach_absolute_time();
+	if ((cs = pfr_cset_create(ent, n)) == NULL)
+		errx(1, "pfr_cset_create failed");
+	t1 = mach_absolute_time();
+
+	for (i = 0; i < cs->pcs_nent; i++)
+		trie_insert(&cs->pcs_ent[i], i);
+	t2 = mach_absolute_time();
+
+	printf("%u entries (%u unique), %u IPv4 + %u IPv6 intervals, "
+	    "%u index bits\n", n, cs->pcs_nent, cs->pcs_v4cnt,
+	    cs->pcs_v6cnt, cs->pcs_v4bits);
+	printf("cset load  %.3f s, %zu KB, %.1f bytes/entry\n",
+	    elapsed(t1 - t0), cs->pcs_size / 1024,
+	    (double)cs->pcs_size / cs->pcs_nent);
+	printf("pfr_kentry %zu bytes/entry plus radix masks, "
+	    "%.1fx the cset\n", sizeof (struct pfr_kentry_model),
+	    sizeof (struct pfr_kentry_model) /
+	    ((double)cs->pcs_size / cs->pcs_nent));
+	printf("trie load  %.3f s, %zu KB\n", elapsed(t2 - t1),
+	    tnodes * sizeof (struct tnode) / 1024);
+
+	/* first definition of a duplicate wins, as in the radix load */
+	for (i = 0; i < n; i++) {
+		struct pfr_centry *c;
+		struct pfr_addr ad;
+
+		bzero(&ad, sizeof (ad));
+		bcopy(&p[i].pfrce_addr, &ad.pfra_u, sizeof (ad.pfra_u));
+		ad.pfra_af = p[i].pfrce_af;
+		ad.pfra_net = p[i].pfrce_net;
+		c = pfr_cset_lookup(cs, &ad);
+		if (c == NULL || c->pfrce_seq > p[i].pfrce_seq ||
+		    (c->pfrce_seq == p[i].pfrce_seq &&
+		    c->pfrce_not != p[i].pfrce_not)) {
+			if (errors++ < 10)
+				printf("entry %u lost or superseded\n", i);
+		}
+	}
+
+	if ((addrs = malloc(nlookups * sizeof (*addrs))) == NULL ||
+	    (afs = malloc(nlookups * sizeof (*afs))) == NULL)
+		err(1, "malloc");
+	for (i = 0; i < nlookups; i++)
+		randaddr(cs->pcs_ent, cs->pcs_nent, &addrs[i], &afs[i]);
+	t0 = mach_absolute_time();
+	for (i = 0; i < nlookups; i++)
+		sink += (uintptr_t)trie_lookup(cs, &addrs[i], afs[i]);
+	t1 = mach_absolute_time();
+	for (i = 0; i < nlookups; i++)
+		sink += (uintptr_t)pfr_cset_match(cs, &addrs[i], afs[i]);
+	t3 = mach_absolute_time();
+	for (i = 0; i < nlookups; i++) {
+		x = trie_lookup(cs, &addrs[i], afs[i]);
+		y = pfr_cset_match(cs, &addrs[i], afs[i]);
+		if (x != y && errors++ < 10)
+			printf("lookup %u: trie %ld, cset %ld\n", i,
+			    x ? (long)(x - cs->pcs_ent) : -1L,
+			    y ? (long)(y - cs->pcs_ent) : -1L);
+	}
+	printf("lookups/s  trie %.0f, cset %.0f\n",
+	    nlookups / elapsed(t1 - t0), nlookups / elapsed(t3 - t1));
+
+	pfr_cset_free(cs);
+	printf("%s\n", errors ? "FAIL" : "PASS");
+	return (errors != 0);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * The parts of bsd/net/pfvar.h that pf_cset.c uses; the structures are
+ * copied from there and must be kept in step with it.
+ */
+
+#ifndef _SHIM_NET_PFVAR_H_
+#define	_SHIM_NET_PFVAR_H_
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#define	__private_extern__	extern
+
+struct pf_addr {
+	union {
+		struct in_addr		v4;
+		struct in6_addr		v6;
+		u_int8_t		addr8[16];
+		u_int16_t		addr16[8];
+		u_int32_t		addr32[4];
+	} pfa;		    /* 128-bit address */
+#define v4	pfa.v4
+#define v6	pfa.v6
+#define addr8	pfa.addr8
+#define addr16	pfa.addr16
+#define addr32	pfa.addr32
+};
+
+struct pfr_addr {
+	union {
+		struct in_addr	 _pfra_ip4addr;
+		struct in6_addr	 _pfra_ip6addr;
+	}		 pfra_u;
+	u_int8_t	 pfra_af;
+	u_int8_t	 pfra_net;
+	u_int8_t	 pfra_not;
+	u_int8_t	 pfra_fback;
+};
+#define	pfra_ip4addr	pfra_u._pfra_ip4addr
+#define	pfra_ip6addr	pfra_u._pfra_ip6addr
+
+struct pfr_centry {
+	struct pf_addr		 pfrce_addr;
+	u_int32_t		 pfrce_seq;	/* load order, build only */
+	u_int8_t		 pfrce_af;
+	u_int8_t		 pfrce_net;
+	u_int8_t		 pfrce_not;
+	u_int8_t		 pfrce_pad;
+};
+
+struct pfr_cset_k6 {
+	u_int64_t		 hi;
+	u_int64_t		 lo;
+};
+
+#define	PFR_CSET_NONE		0xffffffff
+
+struct pfr_cset {
+	struct pfr_centry	*pcs_ent;	/* sorted by af, addr, net */
+	u_int32_t		 pcs_nent;
+	u_int32_t		 pcs_v4cnt;
+	u_int32_t		*pcs_v4start;	/* interval starts, host order */
+	u_int32_t		*pcs_v4ent;	/* pcs_ent index or NONE */
+	u_int32_t		*pcs_v4idx;	/* first interval per top bits */
+	u_int32_t		 pcs_v4bits;
+	u_int32_t		 pcs_v6cnt;
+	struct pfr_cset_k6	*pcs_v6start;
+	u_int32_t		*pcs_v6ent;
+	size_t			 pcs_size;	/* bytes, including pcs_ent */
+};
+
+__private_extern__ struct pfr_cset *pfr_cset_create(struct pfr_centry *,
+    u_int32_t);
+__private_extern__ void pfr_cset_free(struct pfr_cset *);
+__private_extern__ struct pfr_centry *pfr_cset_match(struct pfr_cset *,
+    struct pf_addr *, sa_family_t);
+__private_extern__ struct pfr_centry *pfr_cset_lookup(struct pfr_cset *,
+    struct pfr_addr *);
+
+#endif /* _SHIM_NET_PFVAR_H_ */
@@ -0,0 +1,1222 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Differential test for the pf rule classifier.  Generates rulesets and
+ * packets and checks that walking the ruleset the way pf_test_rule()
+ * does, with skip steps, picks the same rule as walking only the
+ * classifier's candidates.  The rule, skip step and matching code mirror
+ * bsd/net/pf.c; the classifier itself is copied verbatim from there.
+ * Also reports the rules evaluated per packet and the time taken by each
+ * walk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <netinet/in.h>
+#include <mach/mach_time.h>
+
+#define	INET			1
+#define	INET6			1
+
+#define	M_TEMP			0
+#define	M_WAITOK		0
+#define	M_ZERO			0
+#define	_MALLOC(size, type, flags)	calloc(1, (size))
+#define	_FREE(addr, type)	free(addr)
+
+#define	PF_RULECLS_MAXSIZE	(32 * 1024 * 1024)
+
+#define	PF_INOUT		0
+#define	PF_IN			1
+#define	PF_OUT			2
+
+enum	{ PF_OP_NONE, PF_OP_IRG, PF_OP_EQ, PF_OP_NE, PF_OP_LT,
+	  PF_OP_LE, PF_OP_GT, PF_OP_GE, PF_OP_XRG, PF_OP_RRG };
+enum	{ PF_ADDR_ADDRMASK, PF_ADDR_NOROUTE, PF_ADDR_DYNIFTL,
+	  PF_ADDR_TABLE, PF_ADDR_RTLABEL, PF_ADDR_URPFFAILED,
+	  PF_ADDR_RANGE };
+
+#define	PF_SKIP_IFP		0
+#define	PF_SKIP_DIR		1
+#define	PF_SKIP_AF		2
+#define	PF_SKIP_PROTO		3
+#define	PF_SKIP_SRC_ADDR	4
+#define	PF_SKIP_SRC_PORT	5
+#define	PF_SKIP_DST_ADDR	6
+#define	PF_SKIP_DST_PORT	7
+#define	PF_SKIP_COUNT		8
+
+struct pfi_kif {
+	char			 pfik_name[16];
+};
+
+struct pf_addr {
+	u_int32_t		 addr32[4];
+};
+
+struct pf_addr_wrap {
+	union {
+		struct {
+			struct pf_addr	 addr;
+			struct pf_addr	 mask;
+		}			 a;
+	}			 v;
+	union {
+		u_int32_t		 tbl;	/* stands in for a table */
+	}			 p;
+	u_int8_t		 type;
+};
+
+struct pf_port_range {
+	u_int16_t		 port[2];
+	u_int8_t		 op;
+};
+
+union pf_rule_xport {
+	struct pf_port_range	 range;
+};
+
+struct pf_rule_addr {
+	struct pf_addr_wrap	 addr;
+	union pf_rule_xport	 xport;
+	u_int8_t		 neg;
+};
+
+struct pf_rule {
+	struct pf_rule_addr	 src;
+	struct pf_rule_addr	 dst;
+	union {
+		struct pf_rule	*ptr;
+	}			 skip[PF_SKIP_COUNT];
+	struct pfi_kif		*kif;
+	TAILQ_ENTRY(pf_rule)	 entries;
+	u_int32_t		 nr;
+	u_int8_t		 ifnot;
+	u_int8_t		 direction;
+	u_int8_t		 af;
+	u_int8_t		 proto;
+	u_int8_t		 flags;
+	u_int8_t		 flagset;
+	u_int8_t		 quick;
+};
+
+TAILQ_HEAD(pf_rulequeue, pf_rule);
+
+#define	PF_AZERO(a, c) \
+	((c == AF_INET && !(a)->addr32[0]) || \
+	(!(a)->addr32[0] && !(a)->addr32[1] && \
+	!(a)->addr32[2] && !(a)->addr32[3]))
+
+#define	PF_ANEQ(a, b, c) \
+	((c == AF_INET && (a)->addr32[0] != (b)->addr32[0]) || \
+	((a)->addr32[3] != (b)->addr32[3] || \
+	(a)->addr32[2] != (b)->addr32[2] || \
+	(a)->addr32[1] != (b)->addr32[1] || \
+	(a)->addr32[0] != (b)->addr32[0]))
+
+struct pf_rulecls_key {
+	u_int64_t		 pck_hi;
+	u_int64_t		 pck_lo;
+};
+
+struct pf_rulecls_dim {
+	u_int32_t		 pcd_nranges;
+	struct pf_rulecls_key	*pcd_lo;	/* range starts, ascending */
+	u_int64_t		*pcd_bits;	/* pcd_nranges bitmaps */
+};
+
+enum {
+	PF_RULECLS_SRC_ADDR,
+	PF_RULECLS_DST_ADDR,
+	PF_RULECLS_SRC_PORT,
+	PF_RULECLS_DST_PORT,
+	PF_RULECLS_NDIMS
+};
+
+struct pf_rulecls {
+	u_int32_t		 pcl_nrules;
+	u_int32_t		 pcl_nwords;	/* 64-bit words per bitmap */
+	struct pf_rule		**pcl_rules;	/* indexed by nr */
+	u_int64_t		*pcl_dir;	/* PF_IN, PF_OUT */
+	u_int16_t		 pcl_proto_row[256];
+	u_int64_t		*pcl_proto;	/* row 0: unnamed protocols */
+	u_int32_t		 pcl_nkifs;
+	struct pfi_kif		**pcl_kifs;	/* ascending */
+	u_int64_t		*pcl_kif;	/* pcl_nkifs + 1 rows */
+	struct pf_rulecls_dim	 pcl_dim[2][PF_RULECLS_NDIMS];	/* by af */
+	size_t			 pcl_size;
+};
+
+/* rows of a pf_rulecls that a packet selects */
+struct pf_rulecls_match {
+	int			 pcm_nrows;
+	u_int64_t		*pcm_row[3 + PF_RULECLS_NDIMS];
+};
+
+static int
+pfi_kif_match(struct pfi_kif *rule_kif, struct pfi_kif *packet_kif)
+{
+
+	if (rule_kif == NULL || rule_kif == packet_kif)
+		return (1);
+
+	return (0);
+}
+
+struct pf_rulecls_range {
+	struct pf_rulecls_key	 lo;
+	struct pf_rulecls_key	 hi;
+};
+
+extern void qsort(void *, size_t, size_t,
+    int (*)(const void *, const void *));
+
+#define	PF_RULECLS_ROW(pcl, bits, row)					\
+	((bits) + (size_t)(row) * (pcl)->pcl_nwords)
+#define	PF_RULECLS_SET(row, i)						\
+	((row)[(i) / 64] |= (1ULL << ((i) % 64)))
+
+static int
+pf_rulecls_key_cmp(const void *a, const void *b)
+{
+	const struct pf_rulecls_key *ka = a, *kb = b;
+
+	if (ka->pck_hi != kb->pck_hi)
+		return ((ka->pck_hi < kb->pck_hi) ? -1 : 1);
+	if (ka->pck_lo != kb->pck_lo)
+		return ((ka->pck_lo < kb->pck_lo) ? -1 : 1);
+	return (0);
+}
+
+static int
+pf_rulecls_ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t pa = (uintptr_t)*(void * const *)a;
+	uintptr_t pb = (uintptr_t)*(void * const *)b;
+
+	return ((pa < pb) ? -1 : (pa > pb));
+}
+
+static void
+pf_rulecls_key_inc(struct pf_rulecls_key *k)
+{
+	if (++k->pck_lo == 0)
+		k->pck_hi++;
+}
+
+static void
+pf_rulecls_key_dec(struct pf_rulecls_key *k)
+{
+	if (k->pck_lo-- == 0)
+		k->pck_hi--;
+}
+
+/*
+ * Addresses are ordered as numbers in network byte order, so that the
+ * addresses under a prefix mask form a single range.
+ */
+static void
+pf_rulecls_addr_key(struct pf_addr *a, sa_family_t af,
+    struct pf_rulecls_key *k)
+{
+	if (af == AF_INET) {
+		k->pck_hi = 0;
+		k->pck_lo = ntohl(a->addr32[0]);
+	} else {
+		k->pck_hi = ((u_int64_t)ntohl(a->addr32[0]) << 32) |
+		    ntohl(a->addr32[1]);
+		k->pck_lo = ((u_int64_t)ntohl(a->addr32[2]) << 32) |
+		    ntohl(a->addr32[3]);
+	}
+}
+
+static void
+pf_rulecls_max_key(int d, sa_family_t af, struct pf_rulecls_key *k)
+{
+	k->pck_hi = 0;
+	if (d == PF_RULECLS_SRC_PORT || d == PF_RULECLS_DST_PORT)
+		k->pck_lo = 0xffff;
+	else if (af == AF_INET)
+		k->pck_lo = 0xffffffff;
+	else
+		k->pck_hi = k->pck_lo = ~0ULL;
+}
+
+static int
+pf_rulecls_port_range(struct pf_rulecls_range *rg, int n, int lo, int hi)
+{
+	if (lo < 0)
+		lo = 0;
+	if (hi > 0xffff)
+		hi = 0xffff;
+	if (lo <= hi) {
+		rg[n].lo.pck_hi = rg[n].hi.pck_hi = 0;
+		rg[n].lo.pck_lo = lo;
+		rg[n].hi.pck_lo = hi;
+		n++;
+	}
+	return (n);
+}
+
+/* the ports pf_match_port() accepts, as host order ranges */
+static int
+pf_rulecls_port_ranges(u_int8_t op, u_int16_t p1, u_int16_t p2,
+    struct pf_rulecls_range *rg)
+{
+	int a1 = ntohs(p1), a2 = ntohs(p2), n = 0;
+
+	switch (op) {
+	case PF_OP_IRG:
+		return (pf_rulecls_port_range(rg, n, a1 + 1, a2 - 1));
+	case PF_OP_XRG:
+		n = pf_rulecls_port_range(rg, n, 0, a1 - 1);
+		return (pf_rulecls_port_range(rg, n, a2 + 1, 0xffff));
+	case PF_OP_RRG:
+		return (pf_rulecls_port_range(rg, n, a1, a2));
+	case PF_OP_EQ:
+		return (pf_rulecls_port_range(rg, n, a1, a1));
+	case PF_OP_NE:
+		n = pf_rulecls_port_range(rg, n, 0, a1 - 1);
+		return (pf_rulecls_port_range(rg, n, a1 + 1, 0xffff));
+	case PF_OP_LT:
+		return (pf_rulecls_port_range(rg, n, 0, a1 - 1));
+	case PF_OP_LE:
+		return (pf_rulecls_port_range(rg, n, 0, a1));
+	case PF_OP_GT:
+		return (pf_rulecls_port_range(rg, n, a1 + 1, 0xffff));
+	case PF_OP_GE:
+		return (pf_rulecls_port_range(rg, n, a1, 0xffff));
+	}
+	return (-1);
+}
+
+/*
+ * The addresses PF_MISMATCHAW() lets through.  Only prefix masks are
+ * expressed; pf_match_addr_range() compares addresses in host byte order,
+ * so address ranges (and everything else) match the whole dimension.
+ */
+static int
+pf_rulecls_addr_ranges(struct pf_rule_addr *ra, sa_family_t af,
+    struct pf_rulecls_range *rg)
+{
+	struct pf_rulecls_key a, m, lo, hi, max;
+	int n = 0;
+
+	if (ra->addr.type != PF_ADDR_ADDRMASK)
+		return (-1);
+	if (PF_AZERO(&ra->addr.v.a.mask, af))
+		return (ra->neg ? 0 : -1);
+
+	pf_rulecls_addr_key(&ra->addr.v.a.addr, af, &a);
+	pf_rulecls_addr_key(&ra->addr.v.a.mask, af, &m);
+	pf_rulecls_max_key(PF_RULECLS_SRC_ADDR, af, &max);
+	/* host part of the mask, which must be all the low bits */
+	m.pck_hi = ~m.pck_hi & max.pck_hi;
+	m.pck_lo = ~m.pck_lo & max.pck_lo;
+	if (m.pck_hi == 0 ? (m.pck_lo & (m.pck_lo + 1)) != 0 :
+	    (m.pck_lo != ~0ULL || (m.pck_hi & (m.pck_hi + 1)) != 0))
+		return (-1);
+	lo.pck_hi = a.pck_hi & ~m.pck_hi;
+	lo.pck_lo = a.pck_lo & ~m.pck_lo;
+	hi.pck_hi = lo.pck_hi | m.pck_hi;
+	hi.pck_lo = lo.pck_lo | m.pck_lo;
+
+	if (!ra->neg) {
+		rg[n].lo = lo;
+		rg[n].hi = hi;
+		return (++n);
+	}
+	if (lo.pck_hi != 0 || lo.pck_lo != 0) {
+		rg[n].lo.pck_hi = rg[n].lo.pck_lo = 0;
+		rg[n].hi = lo;
+		pf_rulecls_key_dec(&rg[n++].hi);
+	}
+	if (pf_rulecls_key_cmp(&hi, &max) != 0) {
+		rg[n].lo = hi;
+		pf_rulecls_key_inc(&rg[n].lo);
+		rg[n++].hi = max;
+	}
+	return (n);
+}
+
+/*
+ * The values in dimension d, for packets of family af, at which rule r
+ * can match: at most two ranges in rg, their number returned, or -1 if
+ * r can match at any value.
+ */
+static int
+pf_rulecls_ranges(struct pf_rule *r, int d, sa_family_t af,
+    struct pf_rulecls_range *rg)
+{
+	struct pf_rule_addr *ra;
+
+	if (r->af != 0 && r->af != af)
+		return (0);
+
+	switch (d) {
+	case PF_RULECLS_SRC_ADDR:
+	case PF_RULECLS_DST_ADDR:
+		ra = (d == PF_RULECLS_SRC_ADDR) ? &r->src : &r->dst;
+		return (pf_rulecls_addr_ranges(ra, af, rg));
+	default:
+		/* pf_test_rule() looks at ports of TCP and UDP rules only */
+		if (r->proto != IPPROTO_TCP && r->proto != IPPROTO_UDP)
+			return (-1);
+		ra = (d == PF_RULECLS_SRC_PORT) ? &r->src : &r->dst;
+		return (pf_rulecls_port_ranges(ra->xport.range.op,
+		    ra->xport.range.port[0], ra->xport.range.port[1], rg));
+	}
+}
+
+/* index of the range containing k */
+static u_int32_t
+pf_rulecls_find(struct pf_rulecls_dim *pcd, struct pf_rulecls_key *k)
+{
+	u_int32_t lo = 0, hi = pcd->pcd_nranges, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (pf_rulecls_key_cmp(&pcd->pcd_lo[mid], k) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+static u_int64_t *
+pf_rulecls_alloc_rows(struct pf_rulecls *pcl, u_int32_t nrows)
+{
+	size_t size = (size_t)nrows * pcl->pcl_nwords * sizeof (u_int64_t);
+
+	if ((pcl->pcl_size += size) > PF_RULECLS_MAXSIZE)
+		return (NULL);
+	return (_MALLOC(size, M_TEMP, M_WAITOK | M_ZERO));
+}
+
+static int
+pf_rulecls_build_dim(struct pf_rulecls *pcl, int d, sa_family_t af)
+{
+	struct pf_rulecls_dim *pcd = &pcl->pcl_dim[af == AF_INET6][d];
+	struct pf_rulecls_range rg[2];
+	struct pf_rulecls_key max, *b;
+	u_int64_t *any, *row;
+	u_int32_t n = pcl->pcl_nrules, nb, i, j, w;
+	int c, k;
+
+	pf_rulecls_max_key(d, af, &max);
+	pcl->pcl_size += (4 * n + 1) * sizeof (*b);
+	b = _MALLOC((4 * n + 1) * sizeof (*b), M_TEMP, M_WAITOK | M_ZERO);
+	if (b == NULL)
+		return (ENOMEM);
+	pcd->pcd_lo = b;
+
+	/* every range start and every value just past a range's end */
+	nb = 1;
+	for (i = 0; i < n; i++) {
+		c = pf_rulecls_ranges(pcl->pcl_rules[i], d, af, rg);
+		for (k = 0; k < c; k++) {
+			b[nb++] = rg[k].lo;
+			if (pf_rulecls_key_cmp(&rg[k].hi, &max) != 0) {
+				b[nb] = rg[k].hi;
+				pf_rulecls_key_inc(&b[nb++]);
+			}
+		}
+	}
+	qsort(b, nb, sizeof (*b), pf_rulecls_key_cmp);
+	for (i = j = 1; i < nb; i++) {
+		if (pf_rulecls_key_cmp(&b[i], &b[j - 1]) != 0)
+			b[j++] = b[i];
+	}
+	pcd->pcd_nranges = j;
+
+	if ((pcd->pcd_bits = pf_rulecls_alloc_rows(pcl, j + 1)) == NULL)
+		return (ENOMEM);
+	/* scratch row past the end for the rules matching anywhere */
+	any = PF_RULECLS_ROW(pcl, pcd->pcd_bits, j);
+	for (i = 0; i < n; i++) {
+		c = pf_rulecls_ranges(pcl->pcl_rules[i], d, af, rg);
+		if (c < 0) {
+			PF_RULECLS_SET(any, i);
+			continue;
+		}
+		for (k = 0; k < c; k++) {
+			u_int32_t first = pf_rulecls_find(pcd, &rg[k].lo);
+			u_int32_t last = pf_rulecls_find(pcd, &rg[k].hi);
+
+			for (j = first; j <= last; j++) {
+				row = PF_RULECLS_ROW(pcl, pcd->pcd_bits, j);
+				PF_RULECLS_SET(row, i);
+			}
+		}
+	}
+	for (j = 0; j < pcd->pcd_nranges; j++) {
+		row = PF_RULECLS_ROW(pcl, pcd->pcd_bits, j);
+		for (w = 0; w < pcl->pcl_nwords; w++)
+			row[w] |= any[w];
+	}
+	return (0);
+}
+
+static int
+pf_rulecls_build(struct pf_rulecls *pcl)
+{
+	struct pf_rule *r;
+	u_int64_t *row;
+	u_int32_t n = pcl->pcl_nrules, nprotos = 1, i, j;
+	int d, error;
+
+	if ((pcl->pcl_dir = pf_rulecls_alloc_rows(pcl, 2)) == NULL)
+		return (ENOMEM);
+	for (i = 0; i < n; i++) {
+		r = pcl->pcl_rules[i];
+		if (r->direction != PF_OUT)
+			PF_RULECLS_SET(PF_RULECLS_ROW(pcl, pcl->pcl_dir, 0), i);
+		if (r->direction != PF_IN)
+			PF_RULECLS_SET(PF_RULECLS_ROW(pcl, pcl->pcl_dir, 1), i);
+		if (r->proto != 0 && pcl->pcl_proto_row[r->proto] == 0)
+			pcl->pcl_proto_row[r->proto] = nprotos++;
+	}
+
+	if ((pcl->pcl_proto = pf_rulecls_alloc_rows(pcl, nprotos)) == NULL)
+		return (ENOMEM);
+	for (i = 0; i < n; i++) {
+		r = pcl->pcl_rules[i];
+		for (j = 0; j < nprotos; j++) {
+			if (r->proto != 0 && pcl->pcl_proto_row[r->proto] != j)
+				continue;
+			PF_RULECLS_SET(PF_RULECLS_ROW(pcl, pcl->pcl_proto, j),
+			    i);
+		}
+	}
+
+	pcl->pcl_kifs = _MALLOC(n * sizeof (struct pfi_kif *), M_TEMP,
+	    M_WAITOK);
+	if (pcl->pcl_kifs == NULL)
+		return (ENOMEM);
+	for (i = j = 0; i < n; i++) {
+		if (pcl->pcl_rules[i]->kif != NULL)
+			pcl->pcl_kifs[j++] = pcl->pcl_rules[i]->kif;
+	}
+	qsort(pcl->pcl_kifs, j, sizeof (struct pfi_kif *), pf_rulecls_ptr_cmp);
+	for (i = 0, pcl->pcl_nkifs = 0; i < j; i++) {
+		if (pcl->pcl_nkifs == 0 ||
+		    pcl->pcl_kifs[pcl->pcl_nkifs - 1] != pcl->pcl_kifs[i])
+			pcl->pcl_kifs[pcl->pcl_nkifs++] = pcl->pcl_kifs[i];
+	}
+	/* the last row is for interfaces no rule names */
+	pcl->pcl_kif = pf_rulecls_alloc_rows(pcl, pcl->pcl_nkifs + 1);
+	if (pcl->pcl_kif == NULL)
+		return (ENOMEM);
+	for (i = 0; i < n; i++) {
+		r = pcl->pcl_rules[i];
+		for (j = 0; j <= pcl->pcl_nkifs; j++) {
+			if ((j < pcl->pcl_nkifs ?
+			    pfi_kif_match(r->kif, pcl->pcl_kifs[j]) :
+			    r->kif == NULL) == r->ifnot)
+				continue;
+			row = PF_RULECLS_ROW(pcl, pcl->pcl_kif, j);
+			PF_RULECLS_SET(row, i);
+		}
+	}
+
+	for (d = 0; d < PF_RULECLS_NDIMS; d++) {
+#if INET
+		if ((error = pf_rulecls_build_dim(pcl, d, AF_INET)) != 0)
+			return (error);
+#endif /* INET */
+#if INET6
+		if ((error = pf_rulecls_build_dim(pcl, d, AF_INET6)) != 0)
+			return (error);
+#endif /* INET6 */
+	}
+	return (0);
+}
+
+static void
+pf_rulecls_free(struct pf_rulecls *pcl)
+{
+	struct pf_rulecls_dim *pcd;
+	int a, d;
+
+	for (a = 0; a < 2; a++) {
+		for (d = 0; d < PF_RULECLS_NDIMS; d++) {
+			pcd = &pcl->pcl_dim[a][d];
+			if (pcd->pcd_lo != NULL)
+				_FREE(pcd->pcd_lo, M_TEMP);
+			if (pcd->pcd_bits != NULL)
+				_FREE(pcd->pcd_bits, M_TEMP);
+		}
+	}
+	if (pcl->pcl_kif != NULL)
+		_FREE(pcl->pcl_kif, M_TEMP);
+	if (pcl->pcl_kifs != NULL)
+		_FREE(pcl->pcl_kifs, M_TEMP);
+	if (pcl->pcl_proto != NULL)
+		_FREE(pcl->pcl_proto, M_TEMP);
+	if (pcl->pcl_dir != NULL)
+		_FREE(pcl->pcl_dir, M_TEMP);
+	if (pcl->pcl_rules != NULL)
+		_FREE(pcl->pcl_rules, M_TEMP);
+	_FREE(pcl, M_TEMP);
+}
+
+/*
+ * Select the rows for a packet.  Ports are in network byte order and
+ * are ignored unless proto is TCP or UDP.
+ */
+static void
+pf_rulecls_lookup(struct pf_rulecls *pcl, struct pfi_kif *kif, int dir,
+    sa_family_t af, u_int8_t proto, struct pf_addr *saddr,
+    struct pf_addr *daddr, u_int16_t sport, u_int16_t dport,
+    struct pf_rulecls_match *pcm)
+{
+	struct pf_rulecls_dim *pcd;
+	struct pf_rulecls_key k;
+	u_int32_t lo = 0, hi = pcl->pcl_nkifs, mid;
+	int n = 0;
+
+	if (dir == PF_IN || dir == PF_OUT)
+		pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl, pcl->pcl_dir,
+		    dir == PF_OUT);
+	pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl, pcl->pcl_proto,
+	    pcl->pcl_proto_row[proto]);
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((uintptr_t)pcl->pcl_kifs[mid] < (uintptr_t)kif)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == pcl->pcl_nkifs || pcl->pcl_kifs[lo] != kif)
+		lo = pcl->pcl_nkifs;
+	pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl, pcl->pcl_kif, lo);
+
+	if (af == AF_INET || af == AF_INET6) {
+		pcd = pcl->pcl_dim[af == AF_INET6];
+		pf_rulecls_addr_key(saddr, af, &k);
+		pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+		    pcd[PF_RULECLS_SRC_ADDR].pcd_bits,
+		    pf_rulecls_find(&pcd[PF_RULECLS_SRC_ADDR], &k));
+		pf_rulecls_addr_key(daddr, af, &k);
+		pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+		    pcd[PF_RULECLS_DST_ADDR].pcd_bits,
+		    pf_rulecls_find(&pcd[PF_RULECLS_DST_ADDR], &k));
+		if (proto == IPPROTO_TCP || proto == IPPROTO_UDP) {
+			k.pck_hi = 0;
+			k.pck_lo = ntohs(sport);
+			pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+			    pcd[PF_RULECLS_SRC_PORT].pcd_bits,
+			    pf_rulecls_find(&pcd[PF_RULECLS_SRC_PORT], &k));
+			k.pck_lo = ntohs(dport);
+			pcm->pcm_row[n++] = PF_RULECLS_ROW(pcl,
+			    pcd[PF_RULECLS_DST_PORT].pcd_bits,
+			    pf_rulecls_find(&pcd[PF_RULECLS_DST_PORT], &k));
+		}
+	}
+	pcm->pcm_nrows = n;
+}
+
+/*
+ * The first candidate rule numbered i or higher, or pcl_nrules if none.
+ */
+static u_int32_t
+pf_rulecls_next(struct pf_rulecls *pcl, struct pf_rulecls_match *pcm,
+    u_int32_t i)
+{
+	u_int32_t w = i / 64;
+	u_int64_t bits;
+	int j;
+
+	if (i >= pcl->pcl_nrules)
+		return (pcl->pcl_nrules);
+	bits = ~0ULL << (i % 64);
+	for (;;) {
+		for (j = 0; j < pcm->pcm_nrows && bits != 0; j++)
+			bits &= pcm->pcm_row[j][w];
+		if (bits != 0)
+			return (w * 64 + __builtin_ctzll(bits));
+		if (++w == pcl->pcl_nwords)
+			return (pcl->pcl_nrules);
+		bits = ~0ULL;
+	}
+}
+
+static int
+pf_match_addr(u_int8_t n, struct pf_addr *a, struct pf_addr *m,
+    struct pf_addr *b, sa_family_t af)
+{
+	int	match = 0;
+
+	switch (af) {
+	case AF_INET:
+		if ((a->addr32[0] & m->addr32[0]) ==
+		    (b->addr32[0] & m->addr32[0]))
+			match++;
+		break;
+	case AF_INET6:
+		if (((a->addr32[0] & m->addr32[0]) ==
+		     (b->addr32[0] & m->addr32[0])) &&
+		    ((a->addr32[1] & m->addr32[1]) ==
+		     (b->addr32[1] & m->addr32[1])) &&
+		    ((a->addr32[2] & m->addr32[2]) ==
+		     (b->addr32[2] & m->addr32[2])) &&
+		    ((a->addr32[3] & m->addr32[3]) ==
+		     (b->addr32[3] & m->addr32[3])))
+			match++;
+		break;
+	}
+	return (match ? !n : n);
+}
+
+static int
+pf_match_addr_range(struct pf_addr *b, struct pf_addr *e,
+    struct pf_addr *a, sa_family_t af)
+{
+	int	i;
+
+	switch (af) {
+	case AF_INET:
+		if ((a->addr32[0] < b->addr32[0]) ||
+		    (a->addr32[0] > e->addr32[0]))
+			return (0);
+		break;
+	case AF_INET6:
+		for (i = 0; i < 4; ++i)
+			if (a->addr32[i] > b->addr32[i])
+				break;
+			else if (a->addr32[i] < b->addr32[i])
+				return (0);
+		for (i = 0; i < 4; ++i)
+			if (a->addr32[i] < e->addr32[i])
+				break;
+			else if (a->addr32[i] > e->addr32[i])
+				return (0);
+		break;
+	}
+	return (1);
+}
+
+/* an arbitrary, fixed address set */
+static int
+pfr_match_addr(u_int32_t tbl, struct pf_addr *a, sa_family_t af)
+{
+	u_int32_t h = tbl;
+	int i;
+
+	for (i = 0; i < (af == AF_INET ? 1 : 4); i++)
+		h = (h ^ a->addr32[i]) * 16777619;
+	return ((h >> 7) % 3 == 0);
+}
+
+static int
+pf_mismatchaw(struct pf_addr_wrap *aw, struct pf_addr *x, sa_family_t af,
+    u_int8_t neg)
+{
+	return (((aw->type == PF_ADDR_TABLE &&
+	    !pfr_match_addr(aw->p.tbl, x, af)) ||
+	    (aw->type == PF_ADDR_RANGE &&
+	    !pf_match_addr_range(&aw->v.a.addr, &aw->v.a.mask, x, af)) ||
+	    (aw->type == PF_ADDR_ADDRMASK &&
+	    !PF_AZERO(&aw->v.a.mask, af) &&
+	    !pf_match_addr(0, &aw->v.a.addr, &aw->v.a.mask, x, af))) != neg);
+}
+
+static int
+pf_match_port(u_int8_t op, u_int16_t a1, u_int16_t a2, u_int16_t p)
+{
+	a1 = ntohs(a1);
+	a2 = ntohs(a2);
+	p = ntohs(p);
+	switch (op) {
+	case PF_OP_IRG:
+		return ((p > a1) && (p < a2));
+	case PF_OP_XRG:
+		return ((p < a1) || (p > a2));
+	case PF_OP_RRG:
+		return ((p >= a1) && (p <= a2));
+	case PF_OP_EQ:
+		return (p == a1);
+	case PF_OP_NE:
+		return (p != a1);
+	case PF_OP_LT:
+		return (p < a1);
+	case PF_OP_LE:
+		return (p <= a1);
+	case PF_OP_GT:
+		return (p > a1);
+	case PF_OP_GE:
+		return (p >= a1);
+	}
+	return (0);
+}
+
+static int
+pf_addr_wrap_neq(struct pf_addr_wrap *aw1, struct pf_addr_wrap *aw2)
+{
+	if (aw1->type != aw2->type)
+		return (1);
+	if (aw1->type == PF_ADDR_TABLE)
+		return (aw1->p.tbl != aw2->p.tbl);
+	return (PF_ANEQ(&aw1->v.a.addr, &aw2->v.a.addr, 0) ||
+	    PF_ANEQ(&aw1->v.a.mask, &aw2->v.a.mask, 0));
+}
+
+#define	PF_SET_SKIP_STEPS(i)					\
+	do {							\
+		while (head[i] != cur) {			\
+			head[i]->skip[i].ptr = cur;		\
+			head[i] = TAILQ_NEXT(head[i], entries);	\
+		}						\
+	} while (0)
+
+static void
+pf_calc_skip_steps(struct pf_rulequeue *rules)
+{
+	struct pf_rule *cur, *prev, *head[PF_SKIP_COUNT];
+	int i;
+
+	cur = TAILQ_FIRST(rules);
+	prev = cur;
+	for (i = 0; i < PF_SKIP_COUNT; ++i)
+		head[i] = cur;
+	while (cur != NULL) {
+		if (cur->kif != prev->kif || cur->ifnot != prev->ifnot)
+			PF_SET_SKIP_STEPS(PF_SKIP_IFP);
+		if (cur->direction != prev->direction)
+			PF_SET_SKIP_STEPS(PF_SKIP_DIR);
+		if (cur->af != prev->af)
+			PF_SET_SKIP_STEPS(PF_SKIP_AF);
+		if (cur->proto != prev->proto)
+			PF_SET_SKIP_STEPS(PF_SKIP_PROTO);
+		if (cur->src.neg != prev->src.neg ||
+		    pf_addr_wrap_neq(&cur->src.addr, &prev->src.addr))
+			PF_SET_SKIP_STEPS(PF_SKIP_SRC_ADDR);
+		if (memcmp(&cur->src.xport, &prev->src.xport,
+		    sizeof (cur->src.xport)) != 0)
+			PF_SET_SKIP_STEPS(PF_SKIP_SRC_PORT);
+		if (cur->dst.neg != prev->dst.neg ||
+		    pf_addr_wrap_neq(&cur->dst.addr, &prev->dst.addr))
+			PF_SET_SKIP_STEPS(PF_SKIP_DST_ADDR);
+		if (memcmp(&cur->dst.xport, &prev->dst.xport,
+		    sizeof (cur->dst.xport)) != 0)
+			PF_SET_SKIP_STEPS(PF_SKIP_DST_PORT);
+
+		prev = cur;
+		cur = TAILQ_NEXT(cur, entries);
+	}
+	for (i = 0; i < PF_SKIP_COUNT; ++i)
+		PF_SET_SKIP_STEPS(i);
+}
+
+struct pkt {
+	struct pfi_kif		*kif;
+	int			 dir;
+	sa_family_t		 af;
+	u_int8_t		 proto;
+	u_int8_t		 th_flags;
+	struct pf_addr		 saddr;
+	struct pf_addr		 daddr;
+	u_int16_t		 sport;	/* network byte order */
+	u_int16_t		 dport;
+};
+
+static struct pf_rule	 default_rule;
+static u_int64_t	 evaluations;
+
+/*
+ * The filter loop of pf_test_rule(), for the fields modelled here; with
+ * a classifier, only its candidates are evaluated.
+ */
+static struct pf_rule *
+walk(struct pf_rulequeue *rules, struct pf_rulecls *pcl, struct pkt *p)
+{
+	struct pf_rule *r, *rm = &default_rule;
+	struct pf_rulecls_match pcm;
+	u_int32_t ci;
+
+	if (pcl != NULL)
+		pf_rulecls_lookup(pcl, p->kif, p->dir, p->af, p->proto,
+		    &p->saddr, &p->daddr, p->sport, p->dport, &pcm);
+	r = TAILQ_FIRST(rules);
+	while (r != NULL) {
+		if (pcl != NULL &&
+		    (ci = pf_rulecls_next(pcl, &pcm, r->nr)) != r->nr) {
+			if (ci >= pcl->pcl_nrules)
+				break;
+			r = pcl->pcl_rules[ci];
+		}
+		evaluations++;
+		if (pfi_kif_match(r->kif, p->kif) == r->ifnot)
+			r = r->skip[PF_SKIP_IFP].ptr;
+		else if (r->direction && r->direction != p->dir)
+			r = r->skip[PF_SKIP_DIR].ptr;
+		else if (r->af && r->af != p->af)
+			r = r->skip[PF_SKIP_AF].ptr;
+		else if (r->proto && r->proto != p->proto)
+			r = r->skip[PF_SKIP_PROTO].ptr;
+		else if (pf_mismatchaw(&r->src.addr, &p->saddr, p->af,
+		    r->src.neg))
+			r = r->skip[PF_SKIP_SRC_ADDR].ptr;
+		else if (r->proto == p->proto &&
+		    (r->proto == IPPROTO_TCP || r->proto == IPPROTO_UDP) &&
+		    r->src.xport.range.op &&
+		    !pf_match_port(r->src.xport.range.op,
+		    r->src.xport.range.port[0], r->src.xport.range.port[1],
+		    p->sport))
+			r = r->skip[PF_SKIP_SRC_PORT].ptr;
+		else if (pf_mismatchaw(&r->dst.addr, &p->daddr, p->af,
+		    r->dst.neg))
+			r = r->skip[PF_SKIP_DST_ADDR].ptr;
+		else if (r->proto == p->proto &&
+		    (r->proto == IPPROTO_TCP || r->proto == IPPROTO_UDP) &&
+		    r->dst.xport.range.op &&
+		    !pf_match_port(r->dst.xport.range.op,
+		    r->dst.xport.range.port[0], r->dst.xport.range.port[1],
+		    p->dport))
+			r = r->skip[PF_SKIP_DST_PORT].ptr;
+		else if (p->proto == IPPROTO_TCP &&
+		    (r->flagset & p->th_flags) != r->flags)
+			r = TAILQ_NEXT(r, entries);
+		else {
+			rm = r;
+			if (rm->quick)
+				break;
+			r = TAILQ_NEXT(r, entries);
+		}
+	}
+	return (rm);
+}
+
+#define	NKIFS		6
+#define	NPOOL		32
+
+static struct pfi_kif	 kifs[NKIFS + 1];	/* the last is never named */
+static struct pf_addr	 pool[2][NPOOL];	/* addresses rules use */
+
+static u_int32_t
+rnd(u_int32_t n)
+{
+	return (n ? (u_int32_t)(random() % n) : 0);
+}
+
+static void
+mkmask(struct pf_addr *m, sa_family_t af, int bits)
+{
+	int i;
+
+	bzero(m, sizeof (*m));
+	for (i = 0; i < (af == AF_INET ? 1 : 4); i++, bits -= 32) {
+		if (bits >= 32)
+			m->addr32[i] = 0xffffffff;
+		else if (bits > 0)
+			m->addr32[i] = htonl(~0U << (32 - bits));
+	}
+}
+
+static void
+mkaddr(struct pf_rule_addr *ra, sa_family_t af)
+{
+	struct pf_addr *a = &ra->addr.v.a.addr, *m = &ra->addr.v.a.mask;
+	int i, bits;
+
+	bzero(ra, sizeof (*ra));
+	ra->neg = (rnd(8) == 0);
+	switch (rnd(10)) {
+	case 0:
+		ra->addr.type = PF_ADDR_TABLE;
+		ra->addr.p.tbl = rnd(4);
+		return;
+	case 1:
+		ra->addr.type = PF_ADDR_RANGE;
+		*a = pool[af == AF_INET6][rnd(NPOOL)];
+		*m = pool[af == AF_INET6][rnd(NPOOL)];
+		return;
+	case 2:
+		/* a mask that isn't a prefix */
+		ra->addr.type = PF_ADDR_ADDRMASK;
+		*a = pool[af == AF_INET6][rnd(NPOOL)];
+		for (i = 0; i < 4; i++)
+			m->addr32[i] = random() | 1;
+		return;
+	case 3:
+	case 4:
+		ra->addr.type = PF_ADDR_ADDRMASK;	/* any */
+		return;
+	default:
+		ra->addr.type = PF_ADDR_ADDRMASK;
+		bits = (af == AF_INET) ? 8 + rnd(25) : 16 + rnd(113);
+		*a = pool[af == AF_INET6][rnd(NPOOL)];
+		mkmask(m, af, bits);
+		for (i = 0; i < 4; i++)
+			a->addr32[i] &= m->addr32[i];
+		return;
+	}
+}
+
+static void
+mkport(struct pf_rule_addr *ra, int portheavy)
+{
+	static const u_int16_t ports[] = { 0, 1, 22, 53, 80, 443, 1023,
+	    1024, 8080, 49152, 65534, 65535 };
+	u_int16_t a, b;
+
+	a = rnd(2) ? ports[rnd(sizeof (ports) / sizeof (ports[0]))] :
+	    rnd(65536);
+	b = a + rnd(2000);
+	if (b < a)
+		b = 65535;
+	ra->xport.range.port[0] = htons(a);
+	ra->xport.range.port[1] = htons(b);
+	ra->xport.range.op = portheavy ? PF_OP_EQ :
+	    (rnd(3) == 0 ? PF_OP_NONE : 1 + rnd(PF_OP_RRG));
+}
+
+static void
+mkrule(struct pf_rule *r, int style)
+{
+	bzero(r, sizeof (*r));
+	r->quick = rnd(4) == 0;
+	r->direction = rnd(3);
+	r->af = (rnd(4) == 0) ? 0 : (rnd(3) ? AF_INET : AF_INET6);
+	switch (rnd(5)) {
+	case 0:
+		r->proto = 0;
+		break;
+	case 1:
+		r->proto = IPPROTO_ICMP;
+		break;
+	case 2:
+		r->proto = IPPROTO_UDP;
+		break;
+	default:
+		r->proto = IPPROTO_TCP;
+		break;
+	}
+	if (rnd(3) == 0) {
+		r->kif = &kifs[rnd(NKIFS)];
+		r->ifnot = rnd(4) == 0;
+	}
+	if (r->proto == IPPROTO_TCP && rnd(4) == 0) {
+		r->flags = 0x02;		/* flags S/SA */
+		r->flagset = 0x12;
+	}
+	if (r->af == 0) {
+		r->src.addr.type = r->dst.addr.type = PF_ADDR_ADDRMASK;
+	} else if (style == 1) {
+		/* many rules telling hosts apart by port */
+		r->dst.addr.type = PF_ADDR_ADDRMASK;
+		r->dst.addr.v.a.addr = pool[r->af == AF_INET6][rnd(4)];
+		mkmask(&r->dst.addr.v.a.mask, r->af,
+		    r->af == AF_INET ? 32 : 128);
+	} else {
+		mkaddr(&r->src, r->af);
+		mkaddr(&r->dst, r->af);
+	}
+	if (r->proto == IPPROTO_TCP || r->proto == IPPROTO_UDP) {
+		if (style != 1)
+			mkport(&r->src, 0);
+		mkport(&r->dst, style == 1);
+	}
+}
+
+/* a packet close to what rule r matches, so that rules do match */
+static void
+mkpkt(struct pkt *p, struct pf_rule *rules, u_int32_t n)
+{
+	struct pf_rule *r = &rules[rnd(n)];
+	struct pf_addr *a;
+	int i;
+
+	bzero(p, sizeof (*p));
+	p->kif = (r->kif != NULL && rnd(4)) ? r->kif : &kifs[rnd(NKIFS + 1)];
+	p->dir = r->direction ? r->direction : PF_IN + rnd(2);
+	p->af = r->af ? r->af : (rnd(2) ? AF_INET : AF_INET6);
+	p->proto = r->proto ? r->proto :
+	    (rnd(2) ? IPPROTO_TCP : IPPROTO_UDP);
+	p->th_flags = rnd(2) ? 0x02 : rnd(256);
+	for (i = 0; i < 2; i++) {
+		struct pf_rule_addr *ra = i ? &r->dst : &r->src;
+
+		a = i ? &p->daddr : &p->saddr;
+		*a = pool[p->af == AF_INET6][rnd(NPOOL)];
+		if (r->af == p->af && ra->addr.type == PF_ADDR_ADDRMASK &&
+		    rnd(4)) {
+			struct pf_addr *ra_a = &ra->addr.v.a.addr;
+			struct pf_addr *ra_m = &ra->addr.v.a.mask;
+			int j;
+
+			for (j = 0; j < 4; j++)
+				a->addr32[j] = (ra_a->addr32[j] &
+				    ra_m->addr32[j]) | (random() &
+				    ~ra_m->addr32[j]);
+		}
+	}
+	if (p->af == AF_INET)
+		p->saddr.addr32[1] = p->saddr.addr32[2] =
+		    p->saddr.addr32[3] = p->daddr.addr32[1] =
+		    p->daddr.addr32[2] = p->daddr.addr32[3] = 0;
+	p->sport = rnd(2) ? r->src.xport.range.port[rnd(2)] : random();
+	p->dport = rnd(2) ? r->dst.xport.range.port[rnd(2)] : random();
+	if (rnd(4) == 0)
+		p->dport = htons(ntohs(p->dport) + rnd(3) - 1);
+}
+
+static double
+elapsed(u_int64_t t)
+{
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0)
+		mach_timebase_info(&tb);
+	return ((double)t * tb.numer / tb.denom / 1e9);
+}
+
+static int
+run(u_int32_t n, int style, u_int32_t npkts)
+{
+	struct pf_rulequeue rules;
+	struct pf_rulecls *pcl;
+	struct pf_rule *rs, *r1, *r2;
+	struct pkt *pkts;
+	u_int64_t t0, t1, t2, ev_walk, ev_cls;
+	u_int32_t i, errors = 0;
+
+	if ((rs = calloc(n, sizeof (*rs))) == NULL ||
+	    (pkts = calloc(npkts, sizeof (*pkts))) == NULL)
+		err(1, "calloc");
+	TAILQ_INIT(&rules);
+	for (i = 0; i < n; i++) {
+		mkrule(&rs[i], style);
+		rs[i].nr = i;
+		TAILQ_INSERT_TAIL(&rules, &rs[i], entries);
+	}
+	pf_calc_skip_steps(&rules);
+
+	/* as pf_rulecls_update(), without the minimum size */
+	if ((pcl = calloc(1, sizeof (*pcl))) == NULL ||
+	    (pcl->pcl_rules = calloc(n, sizeof (*pcl->pcl_rules))) == NULL)
+		err(1, "calloc");
+	pcl->pcl_nrules = n;
+	pcl->pcl_nwords = (n + 63) / 64;
+	for (i = 0; i < n; i++)
+		pcl->pcl_rules[i] = &rs[i];
+	if (pf_rulecls_build(pcl) != 0)
+		errx(1, "pf_rulecls_build failed for %u rules", n);
+
+	for (i = 0; i < npkts; i++)
+		mkpkt(&pkts[i], rs, n);
+
+	evaluations = 0;
+	t0 = mach_absolute_time();
+	for (i = 0; i < npkts; i++)
+		(void) walk(&rules, NULL, &pkts[i]);
+	t1 = mach_absolute_time();
+	ev_walk = evaluations;
+	evaluations = 0;
+	for (i = 0; i < npkts; i++)
+		(void) walk(&rules, pcl, &pkts[i]);
+	t2 = mach_absolute_time();
+	ev_cls = evaluations;
+
+	for (i = 0; i < npkts; i++) {
+		r1 = walk(&rules, NULL, &pkts[i]);
+		r2 = walk(&rules, pcl, &pkts[i]);
+		if (r1 != r2 && errors++ < 10)
+			printf("packet %u: skip steps chose rule %d, "
+			    "classifier rule %d\n", i,
+			    r1 == &default_rule ? -1 : (int)r1->nr,
+			    r2 == &default_rule ? -1 : (int)r2->nr);
+	}
+
+	printf("%6u %-8s %8zu KB %10.1f %10.1f %10.0f %10.0f %s\n", n,
+	    style ? "ports" : "mixed", pcl->pcl_size / 1024,
+	    (double)ev_walk / npkts, (double)ev_cls / npkts,
+	    npkts / elapsed(t1 - t0), npkts / elapsed(t2 - t1),
+	    errors ? "FAIL" : "ok");
+
+	pf_rulecls_free(pcl);
+	free(pkts);
+	free(rs);
+	return (errors != 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u_int32_t sizes[] = { 1, 10, 64, 100, 500, 1000, 4000 };
+	u_int32_t npkts = 20000, i, j;
+	int ch, style, failed = 0;
+	unsigned seed = 1;
+
+	while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			npkts = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+			    "usage: pf_rulecls_test [-n packets] [-s seed]\n");
+			exit(1);
+		}
+	}
+	srandom(seed);
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < NPOOL; j++) {
+			pool[i][j].addr32[0] = random();
+			if (i == 0)
+				continue;
+			pool[i][j].addr32[0] = htonl(0x20010db8);
+			pool[i][j].addr32[1] = random() & htonl(0xffff);
+			pool[i][j].addr32[2] = random();
+			pool[i][j].addr32[3] = random();
+		}
+	}
+
+	printf("%6s %-8s %11s %10s %10s %10s %10s\n", "rules", "ruleset",
+	    "size", "evals", "evals/cls", "pkts/s", "pkts/s/cls");
+	for (style = 0; style < 2; style++) {
+		for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+			failed |= run(sizes[i], style, npkts);
+	}
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Measures aggregate UDP loopback throughput as the number of sending
+ * threads grows.  Each thread owns a connected pair of UDP sockets and
+ * ping-pongs datagrams across lo0 for a fixed interval, so every packet
+ * crosses pf twice.  Run it once with pf disabled and once with pf
+ * enabled and a stateless ruleset, e.g.
+ *
+ *	set skip on { }
+ *	pass quick proto udp from 127.0.0.1 to 127.0.0.1 no state
+ *	pass quick all no state
+ *
+ * When the ruleset can be snapshotted, pf filters these packets without
+ * taking pf_lock and throughput should scale with the thread count the
+ * same way it does with pf disabled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <mach/mach_time.h>
+
+#define	DEF_SECONDS	5
+#define	DEF_PKTLEN	64
+
+static int		seconds = DEF_SECONDS;
+static int		pktlen = DEF_PKTLEN;
+static volatile int	running;
+
+struct worker {
+	pthread_t	w_thread;
+	int		w_tx;
+	int		w_rx;
+	uint64_t	w_packets;
+};
+
+static int
+udp_bind(struct sockaddr_in *sin)
+{
+	socklen_t len = sizeof (*sin);
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+		err(1, "socket");
+	bzero(sin, sizeof (*sin));
+	sin->sin_len = sizeof (*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)sin, sizeof (*sin)) < 0)
+		err(1, "bind");
+	if (getsockname(fd, (struct sockaddr *)sin, &len) < 0)
+		err(1, "getsockname");
+	return (fd);
+}
+
+static void
+worker_setup(struct worker *w)
+{
+	struct sockaddr_in tx, rx;
+
+	w->w_tx = udp_bind(&tx);
+	w->w_rx = udp_bind(&rx);
+	if (connect(w->w_tx, (struct sockaddr *)&rx, sizeof (rx)) < 0)
+		err(1, "connect");
+	if (connect(w->w_rx, (struct sockaddr *)&tx, sizeof (tx)) < 0)
+		err(1, "connect");
+	w->w_packets = 0;
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	char buf[2048];
+
+	bzero(buf, sizeof (buf));
+	while (running) {
+		if (send(w->w_tx, buf, pktlen, 0) != pktlen)
+			err(1, "send");
+		if (recv(w->w_rx, buf, sizeof (buf), 0) != pktlen)
+			err(1, "recv");
+		if (send(w->w_rx, buf, pktlen, 0) != pktlen)
+			err(1, "send");
+		if (recv(w->w_tx, buf, sizeof (buf), 0) != pktlen)
+			err(1, "recv");
+		w->w_packets += 2;
+	}
+	return (NULL);
+}
+
+static double
+run(int nthreads)
+{
+	mach_timebase_info_data_t tb;
+	struct worker *w;
+	uint64_t start, end, total = 0;
+	double secs;
+	int i;
+
+	if ((w = calloc(nthreads, sizeof (*w))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nthreads; i++)
+		worker_setup(&w[i]);
+
+	running = 1;
+	start = mach_absolute_time();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&w[i].w_thread, NULL, worker_main, &w[i]))
+			err(1, "pthread_create");
+	}
+	sleep(seconds);
+	running = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(w[i].w_thread, NULL);
+		total += w[i].w_packets;
+		close(w[i].w_tx);
+		close(w[i].w_rx);
+	}
+	end = mach_absolute_time();
+	free(w);
+
+	mach_timebase_info(&tb);
+	secs = (double)(end - start) * tb.numer / tb.denom / 1e9;
+	return ((double)total / secs);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: pf_rulesnap_bench [-t maxthreads] "
+	    "[-s seconds] [-l length]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t len = sizeof (int);
+	int maxthreads = 0, n, ch;
+	double pps, base = 0;
+
+	while ((ch = getopt(argc, argv, "t:s:l:")) != -1) {
+		switch (ch) {
+		case 't':
+			maxthreads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'l':
+			pktlen = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (maxthreads <= 0 &&
+	    sysctlbyname("hw.ncpu", &maxthreads, &len, NULL, 0) < 0)
+		err(1, "sysctlbyname hw.ncpu");
+	if (seconds <= 0 || pktlen <= 0 || pktlen > 2048)
+		usage();
+
+	printf("%8s %14s %10s\n", "threads", "packets/s", "scaling");
+	for (n = 1; ; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+		pps = run(n);
+		if (n == 1)
+			base = pps;
+		printf("%8d %14.0f %9.2fx\n", n, pps, pps / base);
+		if (n == maxthreads)
+			break;
+	}
+	return (0);
+}
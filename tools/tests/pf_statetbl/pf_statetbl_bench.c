@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Compares pf state key lookups in a red-black tree ordered by the
+ * lan_ext comparator (the old pf_statetbl_lan_ext) with lookups in the
+ * hashed state table, for a large population of TCP and UDP states.
+ * The key layout, comparator, hashed fields and hash function mirror
+ * bsd/net/pf.c; every lookup is checked to give the same answer in both.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <netinet/in.h>
+#include <mach/mach_time.h>
+
+#include <libkern/tree.h>
+
+#define	PF_EXTFILTER_APD	1
+#define	PF_EXTFILTER_AD		2
+#define	PF_EXTFILTER_EI		3
+
+union xport {
+	u_int16_t	port;
+	u_int32_t	spi;
+};
+
+struct host {
+	u_int32_t	addr32[4];
+	union xport	xport;
+};
+
+struct skey {
+	struct host	lan;
+	struct host	gwy;
+	struct host	ext_lan;
+	struct host	ext_gwy;
+	u_int8_t	af_lan;
+	u_int8_t	af_gwy;
+	u_int8_t	proto;
+	u_int8_t	direction;
+	u_int8_t	proto_variant;
+
+	RB_ENTRY(skey)	entry_tree;
+	LIST_ENTRY(skey) entry_hash;
+	u_int32_t	hash;
+};
+
+/* as pf_state_compare_lan_ext(), AF_INET only and without app state */
+static int
+skey_compare(struct skey *a, struct skey *b)
+{
+	int diff, extfilter = PF_EXTFILTER_APD;
+
+	if ((diff = a->proto - b->proto) != 0)
+		return (diff);
+	if ((diff = a->af_lan - b->af_lan) != 0)
+		return (diff);
+
+	switch (a->proto) {
+	case IPPROTO_TCP:
+		if ((diff = a->lan.xport.port - b->lan.xport.port) != 0)
+			return (diff);
+		if ((diff = a->ext_lan.xport.port - b->ext_lan.xport.port) != 0)
+			return (diff);
+		break;
+	case IPPROTO_UDP:
+		if ((diff = a->proto_variant - b->proto_variant))
+			return (diff);
+		extfilter = a->proto_variant;
+		if ((diff = a->lan.xport.port - b->lan.xport.port) != 0)
+			return (diff);
+		if ((extfilter < PF_EXTFILTER_AD) &&
+		    (diff = a->ext_lan.xport.port - b->ext_lan.xport.port) != 0)
+			return (diff);
+		break;
+	}
+
+	if (a->lan.addr32[0] > b->lan.addr32[0])
+		return (1);
+	if (a->lan.addr32[0] < b->lan.addr32[0])
+		return (-1);
+	if (extfilter < PF_EXTFILTER_EI) {
+		if (a->ext_lan.addr32[0] > b->ext_lan.addr32[0])
+			return (1);
+		if (a->ext_lan.addr32[0] < b->ext_lan.addr32[0])
+			return (-1);
+	}
+	return (0);
+}
+
+RB_HEAD(skey_tree, skey);
+RB_PROTOTYPE(skey_tree, skey, entry_tree, skey_compare);
+RB_GENERATE(skey_tree, skey, entry_tree, skey_compare);
+
+/* net_flowhash_mh3_x64_128(), truncated to 32 bits */
+#define	ROTL64(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline u_int64_t
+fmix64(u_int64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdLLU;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53LLU;
+	k ^= k >> 33;
+	return (k);
+}
+
+static u_int32_t
+mh3_x64_128(const void *key, u_int32_t len, const u_int32_t seed)
+{
+	const u_int8_t *data = (const u_int8_t *)key;
+	const u_int32_t nblocks = len / 16;
+	const u_int64_t c1 = 0x87c37b91114253d5LLU;
+	const u_int64_t c2 = 0x4cf5ad432745937fLLU;
+	u_int64_t h1 = seed, h2 = seed, k1, k2;
+	const u_int8_t *tail;
+	u_int32_t i;
+
+	for (i = 0; i < nblocks; i++) {
+		memcpy(&k1, data + i * 16, 8);
+		memcpy(&k2, data + i * 16 + 8, 8);
+
+		k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	tail = data + nblocks * 16;
+	k1 = k2 = 0;
+	switch (len & 15) {
+	case 15: k2 ^= ((u_int64_t)tail[14]) << 48;
+	case 14: k2 ^= ((u_int64_t)tail[13]) << 40;
+	case 13: k2 ^= ((u_int64_t)tail[12]) << 32;
+	case 12: k2 ^= ((u_int64_t)tail[11]) << 24;
+	case 11: k2 ^= ((u_int64_t)tail[10]) << 16;
+	case 10: k2 ^= ((u_int64_t)tail[9]) << 8;
+	case 9: k2 ^= ((u_int64_t)tail[8]);
+		k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+	case 8: k1 ^= ((u_int64_t)tail[7]) << 56;
+	case 7: k1 ^= ((u_int64_t)tail[6]) << 48;
+	case 6: k1 ^= ((u_int64_t)tail[5]) << 40;
+	case 5: k1 ^= ((u_int64_t)tail[4]) << 32;
+	case 4: k1 ^= ((u_int64_t)tail[3]) << 24;
+	case 3: k1 ^= ((u_int64_t)tail[2]) << 16;
+	case 2: k1 ^= ((u_int64_t)tail[1]) << 8;
+	case 1: k1 ^= ((u_int64_t)tail[0]);
+		k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len; h2 ^= len;
+	h1 += h2; h2 += h1;
+	h1 = fmix64(h1); h2 = fmix64(h2);
+	h1 += h2;
+
+	return ((u_int32_t)(h1 & 0xffffffff));
+}
+
+/* as struct pf_statetbl_hkey and pf_state_key_hash() */
+struct hkey {
+	u_int32_t	addr1[4];
+	u_int32_t	addr2[4];
+	u_int32_t	xport1;
+	u_int32_t	xport2;
+	u_int8_t	af;
+	u_int8_t	proto;
+	u_int8_t	proto_variant;
+	u_int8_t	pad;
+};
+
+static u_int32_t seed;
+
+static u_int32_t
+skey_hash(struct skey *sk)
+{
+	struct hkey hk __attribute__((aligned(8)));
+	int extfilter = PF_EXTFILTER_APD;
+
+	memset(&hk, 0, sizeof (hk));
+	hk.af = sk->af_lan;
+	hk.proto = sk->proto;
+	if (sk->proto == IPPROTO_TCP) {
+		hk.xport1 = sk->lan.xport.port;
+		hk.xport2 = sk->ext_lan.xport.port;
+	} else if (sk->proto == IPPROTO_UDP) {
+		hk.proto_variant = sk->proto_variant;
+		extfilter = sk->proto_variant;
+		hk.xport1 = sk->lan.xport.port;
+		if (extfilter < PF_EXTFILTER_AD)
+			hk.xport2 = sk->ext_lan.xport.port;
+	}
+	hk.addr1[0] = sk->lan.addr32[0];
+	if (extfilter < PF_EXTFILTER_EI)
+		hk.addr2[0] = sk->ext_lan.addr32[0];
+
+	return (mh3_x64_128(&hk, sizeof (hk), seed));
+}
+
+LIST_HEAD(skey_head, skey);
+
+struct skey_hash {
+	struct skey_head	*buckets;
+	u_int32_t		nbuckets;
+};
+
+static struct skey *
+hash_find(struct skey_hash *tbl, struct skey *key)
+{
+	u_int32_t h = skey_hash(key);
+	struct skey *sk;
+
+	LIST_FOREACH(sk, &tbl->buckets[h & (tbl->nbuckets - 1)], entry_hash) {
+		if (sk->hash == h && skey_compare(key, sk) == 0)
+			return (sk);
+	}
+	return (NULL);
+}
+
+static struct skey *
+hash_insert(struct skey_hash *tbl, struct skey *sk)
+{
+	struct skey *cur;
+
+	if ((cur = hash_find(tbl, sk)) != NULL)
+		return (cur);
+	sk->hash = skey_hash(sk);
+	LIST_INSERT_HEAD(&tbl->buckets[sk->hash & (tbl->nbuckets - 1)], sk,
+	    entry_hash);
+	return (NULL);
+}
+
+static void
+random_key(struct skey *sk)
+{
+	memset(sk, 0, sizeof (*sk));
+	sk->af_lan = sk->af_gwy = AF_INET;
+	if ((random() & 3) == 0) {
+		sk->proto = IPPROTO_UDP;
+		sk->proto_variant = PF_EXTFILTER_APD + (random() % 3);
+	} else {
+		sk->proto = IPPROTO_TCP;
+	}
+	/* a /16 of clients talking to a few thousand servers */
+	sk->lan.addr32[0] = htonl(0x0a000000 | (random() & 0xffff));
+	sk->lan.xport.port = htons(1024 + (random() % 64512));
+	sk->ext_lan.addr32[0] = htonl(0x11000000 | (random() % 4096));
+	sk->ext_lan.xport.port = htons((random() & 1) ? 443 : 80);
+	sk->gwy = sk->lan;
+	sk->ext_gwy = sk->ext_lan;
+}
+
+static double
+now_sec(void)
+{
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0)
+		mach_timebase_info(&tb);
+	return ((double)mach_absolute_time() * tb.numer / tb.denom / 1e9);
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-n states] [-l lookups]\n", progname);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct skey_tree tree = RB_INITIALIZER(&tree);
+	struct skey_hash tbl;
+	struct skey *keys, *probes, *t, *h;
+	u_int32_t nstates = 1000000, nlookups = 10000000, nprobes;
+	u_int32_t i, n, hits = 0, mismatches = 0;
+	double start, tree_s, hash_s;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:l:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nstates = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			nlookups = (u_int32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nstates == 0 || nlookups == 0)
+		usage(argv[0]);
+
+	srandom(getpid());
+	seed = (u_int32_t)random();
+
+	/* size the table as the purge thread would: at most 2 per bucket */
+	for (tbl.nbuckets = 1024; nstates / tbl.nbuckets > 2; )
+		tbl.nbuckets <<= 1;
+	if ((tbl.buckets = calloc(tbl.nbuckets, sizeof (*tbl.buckets))) == NULL ||
+	    (keys = calloc(nstates, sizeof (*keys))) == NULL)
+		err(1, "calloc");
+
+	for (i = n = 0; i < nstates; i++) {
+		random_key(&keys[n]);
+		t = RB_INSERT(skey_tree, &tree, &keys[n]);
+		h = hash_insert(&tbl, &keys[n]);
+		if ((t == NULL) != (h == NULL))
+			mismatches++;
+		if (t == NULL && h == NULL)
+			n++;
+	}
+	nstates = n;
+
+	/* half the probes hit existing states, half are new flows */
+	nprobes = 1 << 20;
+	if ((probes = calloc(nprobes, sizeof (*probes))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nprobes; i++) {
+		if (i & 1)
+			random_key(&probes[i]);
+		else
+			probes[i] = keys[random() % nstates];
+	}
+
+	start = now_sec();
+	for (i = 0; i < nlookups; i++)
+		if (RB_FIND(skey_tree, &tree, &probes[i & (nprobes - 1)]))
+			hits++;
+	tree_s = now_sec() - start;
+
+	start = now_sec();
+	for (i = 0; i < nlookups; i++)
+		if (hash_find(&tbl, &probes[i & (nprobes - 1)]))
+			hits--;
+	hash_s = now_sec() - start;
+
+	for (i = 0; i < nprobes; i++) {
+		if ((RB_FIND(skey_tree, &tree, &probes[i]) == NULL) !=
+		    (hash_find(&tbl, &probes[i]) == NULL))
+			mismatches++;
+	}
+
+	printf("%u states, %u buckets, %u lookups\n", nstates,
+	    tbl.nbuckets, nlookups);
+	printf("rbtree  %8.2f Mlookups/s\n", nlookups / tree_s / 1e6);
+	printf("hash    %8.2f Mlookups/s\n", nlookups / hash_s / 1e6);
+	if (hits != 0 || mismatches != 0) {
+		printf("FAIL: %u lookups disagree\n", mismatches + hits);
+		return (1);
+	}
+	printf("PASS\n");
+	return (0);
+}
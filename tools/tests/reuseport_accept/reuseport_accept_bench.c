@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Accept rate of N server processes, each with its own SO_REUSEPORT
+ * listener on the same loopback address and port, while client
+ * processes open and abort connections as fast as they can.  With
+ * load-balancing groups (net.inet.ip.reuseport_lb, off by default and
+ * turned on for the run when possible) the connections are spread across
+ * the listeners; without, the first listener in the hash chain takes all
+ * of them.
+ *
+ * Output is the total accept rate and each configuration's share of the
+ * busiest and the idlest server.  Fails if a connection goes missing,
+ * or, with load balancing on, if some server accepted nothing although
+ * there was plenty to go around.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define	MAX_SERVERS	16
+#define	NCLIENTS	4
+#define	CONNS		8000		/* per configuration */
+#define	BACKLOG		512
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static int
+listener(struct sockaddr_in *sin)
+{
+	int fd, on = 1;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)) < 0)
+		err(1, "SO_REUSEPORT");
+	if (bind(fd, (struct sockaddr *)sin, sizeof (*sin)) < 0)
+		err(1, "bind");
+	return (fd);
+}
+
+/*
+ * Accept until told to stop, then drain what's queued and report the
+ * count on the result pipe.
+ */
+static void
+server(int lfd, int ctl, int res)
+{
+	struct pollfd pfd[2];
+	uint64_t accepted = 0;
+	int fd, stopping = 0;
+
+	fcntl(lfd, F_SETFL, O_NONBLOCK);
+	pfd[0].fd = lfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = ctl;
+	pfd[1].events = POLLIN;
+	for (;;) {
+		if (!stopping && poll(pfd, 2, -1) < 0 && errno != EINTR)
+			err(1, "poll");
+		if (pfd[1].revents & (POLLIN | POLLHUP))
+			stopping = 1;
+		while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+			accepted++;
+			close(fd);
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK &&
+		    errno != ECONNABORTED && errno != EINTR)
+			err(1, "accept");
+		if (stopping)
+			break;
+	}
+	if (write(res, &accepted, sizeof (accepted)) != sizeof (accepted))
+		err(1, "write");
+	_exit(0);
+}
+
+static void
+client(struct sockaddr_in *sin, int nconns)
+{
+	struct linger l = { 1, 0 };
+	int fd, i;
+
+	for (i = 0; i < nconns; i++) {
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			err(1, "socket");
+		/* abort on close; no TIME_WAIT to run out of ports */
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof (l));
+		if (connect(fd, (struct sockaddr *)sin, sizeof (*sin)) < 0)
+			err(1, "connect");
+		close(fd);
+	}
+	_exit(0);
+}
+
+static int
+run(int nservers, double *rate, uint64_t *counts)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof (sin);
+	pid_t pids[MAX_SERVERS + NCLIENTS];
+	int ctl[2], res[MAX_SERVERS][2];
+	int i, pfd, lfd, status, failed = 0;
+	double t0;
+
+	/* pick a port; this socket never listens, so it gets no connections */
+	memset(&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_len = sizeof (sin);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	pfd = listener(&sin);
+	if (getsockname(pfd, (struct sockaddr *)&sin, &len) < 0)
+		err(1, "getsockname");
+
+	if (pipe(ctl) < 0)
+		err(1, "pipe");
+	for (i = 0; i < nservers; i++) {
+		if (pipe(res[i]) < 0)
+			err(1, "pipe");
+		lfd = listener(&sin);
+		if (listen(lfd, BACKLOG) < 0)
+			err(1, "listen");
+		if ((pids[i] = fork()) < 0)
+			err(1, "fork");
+		if (pids[i] == 0) {
+			close(ctl[1]);
+			server(lfd, ctl[0], res[i][1]);
+		}
+		close(lfd);
+		close(res[i][1]);
+	}
+	close(ctl[0]);
+	close(pfd);
+
+	t0 = now_sec();
+	for (i = 0; i < NCLIENTS; i++) {
+		if ((pids[nservers + i] = fork()) < 0)
+			err(1, "fork");
+		if (pids[nservers + i] == 0)
+			client(&sin, CONNS / NCLIENTS);
+	}
+	for (i = 0; i < NCLIENTS; i++) {
+		if (waitpid(pids[nservers + i], &status, 0) < 0)
+			err(1, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = 1;
+	}
+	*rate = CONNS / (now_sec() - t0);
+
+	/* closing the control pipe tells the servers to drain and report */
+	close(ctl[1]);
+	for (i = 0; i < nservers; i++) {
+		if (read(res[i][0], &counts[i], sizeof (counts[i])) !=
+		    sizeof (counts[i]))
+			failed = 1;
+		close(res[i][0]);
+		waitpid(pids[i], &status, 0);
+	}
+	return (failed);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int servers[] = { 1, 2, 4, 8, 16 };
+	uint32_t i, n = sizeof (servers) / sizeof (servers[0]);
+	int failed = 0, balanced = 1, saved, val;
+	size_t len = sizeof (saved);
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (n > sizeof (servers) / sizeof (servers[0]))
+		n = sizeof (servers) / sizeof (servers[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	/* without the sysctl, assume the system balances on its own */
+	if (sysctlbyname("net.inet.ip.reuseport_lb", &saved, &len,
+	    NULL, 0) == 0) {
+		val = 1;
+		if (sysctlbyname("net.inet.ip.reuseport_lb", NULL, NULL,
+		    &val, sizeof (val)) != 0 && !saved) {
+			warnx("cannot set net.inet.ip.reuseport_lb (not "
+			    "root?); not checking the spread");
+			balanced = 0;
+		}
+	} else {
+		len = 0;
+	}
+
+	printf("%7s %12s %10s %8s %8s\n", "servers", "accepts/s", "accepted",
+	    "max %", "min %");
+	for (i = 0; i < n; i++) {
+		uint64_t counts[MAX_SERVERS], total = 0, max = 0, min = ~0ULL;
+		double rate;
+		int j;
+
+		memset(counts, 0, sizeof (counts));
+		failed |= run(servers[i], &rate, counts);
+		for (j = 0; j < servers[i]; j++) {
+			total += counts[j];
+			if (counts[j] > max)
+				max = counts[j];
+			if (counts[j] < min)
+				min = counts[j];
+		}
+		printf("%7d %12.0f %10llu %8.1f %8.1f\n", servers[i], rate,
+		    (unsigned long long)total, total ? 100.0 * max / total : 0,
+		    total ? 100.0 * min / total : 0);
+		if (total != CONNS) {
+			printf("FAIL: %llu of %d connections accepted\n",
+			    (unsigned long long)total, CONNS);
+			failed = 1;
+		} else if (balanced && min == 0) {
+			printf("FAIL: a server accepted no connections\n");
+			failed = 1;
+		}
+	}
+	if (len != 0)
+		(void) sysctlbyname("net.inet.ip.reuseport_lb", NULL, NULL,
+		    &saved, sizeof (saved));
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}
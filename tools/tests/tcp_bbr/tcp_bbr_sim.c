@@ -0,0 +1,979 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Simulates one bulk TCP transfer through a bottleneck link with the
+ * congestion control hooks of bsd/netinet/tcp_bbr.c and, for comparison,
+ * NewReno style AIMD as in bsd/netinet/tcp_newreno.c.
+ *
+ * The sender has SACK and unlimited data; the bottleneck is a drop-tail
+ * FIFO in front of a fixed rate link, followed by a fixed propagation
+ * delay.  Every segment is acknowledged.  BBR output is paced with the
+ * same credit bucket as tcp_output.c; the pacing timer has millisecond
+ * resolution like the TCP clock.
+ *
+ * Two paths are run:
+ *
+ *   lossy	long RTT, shallow buffer, 1% random loss: BBR must keep
+ *		using most of the link while AIMD collapses
+ *   deep	no random loss and a buffer of twice the BDP: BBR must
+ *		keep a much shorter standing queue than AIMD, which fills
+ *		the buffer before backing off
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <err.h>
+#include <assert.h>
+
+#define	VERIFY(x)	assert(x)
+
+#define	SEQ_LT(a, b)	((int32_t)((a) - (b)) < 0)
+#define	SEQ_LEQ(a, b)	((int32_t)((a) - (b)) <= 0)
+#define	SEQ_GT(a, b)	((int32_t)((a) - (b)) > 0)
+#define	SEQ_GEQ(a, b)	((int32_t)((a) - (b)) >= 0)
+#define	TSTMP_GT(a, b)	((int32_t)((a) - (b)) > 0)
+#define	TSTMP_GEQ(a, b)	((int32_t)((a) - (b)) >= 0)
+
+#define	USEC_PER_SEC	1000000ULL
+#define	TCP_RETRANSHZ	1000
+#define	TCP_MAXWIN	65535
+#define	TCP_MAX_WINSHIFT 14
+#define	TCP_RTT_SHIFT	5
+
+#define	MSS		1448
+#define	MAXPKTS		(1 << 20)
+#define	DUPTHRESH	3
+#define	SIM_TIME	(30 * USEC_PER_SEC)
+#define	WARMUP		(5 * USEC_PER_SEC)
+
+#define	min(a, b)	((a) < (b) ? (a) : (b))
+#define	max(a, b)	((a) > (b) ? (a) : (b))
+
+typedef uint32_t tcp_seq;
+
+/* BBR state, as in struct tcp_ccstate */
+#define	TCP_BBR_NSAMPLES	8
+
+struct tcp_bbr_state {
+	uint32_t tb_mode;
+	uint32_t tb_flags;
+	uint32_t tb_delivered;
+	uint32_t tb_delivered_us;
+	uint32_t tb_first_sent_us;
+	uint32_t tb_app_limited;
+	uint32_t tb_sample_head;
+	uint32_t tb_nsamples;
+	tcp_seq	tb_snd_max;
+	struct tcp_bbr_sample {
+		tcp_seq	bs_end_seq;
+		uint32_t bs_sent_us;
+		uint32_t bs_delivered;
+		uint32_t bs_delivered_us;
+		uint32_t bs_first_sent_us;
+		uint32_t bs_app_limited;
+	} tb_samples[TCP_BBR_NSAMPLES];
+	uint64_t tb_bw[3];
+	uint32_t tb_bw_round[3];
+	uint32_t tb_round;
+	uint32_t tb_next_round_delivered;
+	uint32_t tb_min_rtt_us;
+	uint32_t tb_min_rtt_stamp;
+	uint32_t tb_probe_rtt_done;
+	uint32_t tb_cycle_index;
+	uint32_t tb_cycle_stamp_us;
+	uint64_t tb_full_bw;
+	uint32_t tb_full_bw_count;
+	uint32_t tb_prior_cwnd;
+	uint32_t tb_pacing_gain;
+	uint32_t tb_cwnd_gain;
+};
+
+/* the parts of struct tcpcb the hooks use */
+struct tcpcb {
+	tcp_seq		snd_una;
+	tcp_seq		snd_max;
+	tcp_seq		snd_fack;
+	tcp_seq		snd_recover;
+	uint32_t	snd_cwnd;
+	uint32_t	snd_ssthresh;
+	uint32_t	t_maxseg;
+	uint32_t	t_srtt;
+	uint32_t	snd_scale;
+	int		in_recovery;
+	int		holes;		/* SACK scoreboard not empty */
+	uint64_t	t_pacing_rate;
+	uint64_t	t_pacing_ts;
+	uint32_t	t_pacing_credit;
+	struct tcp_bbr_state bbr_state;
+};
+
+#define	IN_FASTRECOVERY(tp)	((tp)->in_recovery)
+#define	BYTES_ACKED(ack, tp)	((ack) - (tp)->snd_una)
+
+static double sim_now;		/* usec */
+static uint32_t tcp_now;	/* msec */
+
+/*
+ * BBR model, following tcp_bbr.c
+ */
+#define	TCP_BBR_STARTUP		1
+#define	TCP_BBR_DRAIN		2
+#define	TCP_BBR_PROBE_BW	3
+#define	TCP_BBR_PROBE_RTT	4
+
+#define	TCP_BBRF_FULL_PIPE	0x1
+#define	TCP_BBRF_ROUND_START	0x2
+#define	TCP_BBRF_PROBE_ROUND	0x4
+#define	TCP_BBRF_IDLE_RESTART	0x8
+#define	TCP_BBRF_SENT		0x10
+
+#define	TCP_BBR_UNIT		256
+#define	TCP_BBR_HIGH_GAIN	739
+#define	TCP_BBR_DRAIN_GAIN	89
+#define	TCP_BBR_CWND_GAIN	512
+#define	TCP_BBR_FULL_BW_THRESH	320
+#define	TCP_BBR_FULL_BW_COUNT	3
+#define	TCP_BBR_CYCLE_LEN	8
+#define	TCP_BBR_BW_RTTS		10
+#define	TCP_BBR_MIN_TSO_SEGS	4
+#define	TCP_BBR_RTT_UNKNOWN	0xffffffff
+
+static const uint32_t tcp_bbr_pacing_gain[TCP_BBR_CYCLE_LEN] = {
+	320, 192, 256, 256, 256, 256, 256, 256
+};
+
+static int tcp_bbr_min_rtt_win = 10 * TCP_RETRANSHZ;
+static int tcp_bbr_probe_rtt_time = 200;
+
+static inline uint32_t
+tcp_bbr_now_us(void)
+{
+	return ((uint32_t)(uint64_t)sim_now);
+}
+
+static inline uint64_t
+tcp_bbr_max_bw(struct tcp_bbr_state *st)
+{
+	return (st->tb_bw[0]);
+}
+
+static uint32_t
+tcp_bbr_bdp(struct tcpcb *tp, uint32_t gain)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+	uint64_t bdp;
+
+	if (st->tb_min_rtt_us == TCP_BBR_RTT_UNKNOWN ||
+	    tcp_bbr_max_bw(st) == 0)
+		return (0);
+	bdp = (tcp_bbr_max_bw(st) * st->tb_min_rtt_us) / USEC_PER_SEC;
+	bdp = (bdp * gain) / TCP_BBR_UNIT;
+	if (bdp > (TCP_MAXWIN << TCP_MAX_WINSHIFT))
+		bdp = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+	return ((uint32_t)bdp);
+}
+
+static uint32_t
+tcp_bbr_target_cwnd(struct tcpcb *tp, uint32_t gain)
+{
+	uint32_t bdp;
+
+	bdp = tcp_bbr_bdp(tp, gain);
+	if (bdp == 0)
+		return (max(tp->snd_cwnd, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg));
+	bdp += 3 * tp->t_maxseg;
+	return (max(bdp, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg));
+}
+
+static uint32_t
+tcp_bbr_grow_cwnd(struct tcpcb *tp, uint32_t cw, uint32_t acked)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+	uint32_t target;
+
+	target = tcp_bbr_target_cwnd(tp, st->tb_cwnd_gain);
+	if (st->tb_flags & TCP_BBRF_FULL_PIPE)
+		cw = min(cw + acked, target);
+	else if (cw < target || tcp_bbr_bdp(tp, TCP_BBR_UNIT) == 0)
+		cw += acked;
+	cw = max(cw, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg);
+	if (st->tb_mode == TCP_BBR_PROBE_RTT)
+		cw = min(cw, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg);
+	return (min(cw, (uint32_t)TCP_MAXWIN << tp->snd_scale));
+}
+
+static void
+tcp_bbr_bw_update(struct tcp_bbr_state *st, uint64_t bw)
+{
+	uint32_t round = st->tb_round, dt;
+
+	if (bw >= st->tb_bw[0] ||
+	    round - st->tb_bw_round[2] > TCP_BBR_BW_RTTS) {
+		st->tb_bw[0] = st->tb_bw[1] = st->tb_bw[2] = bw;
+		st->tb_bw_round[0] = st->tb_bw_round[1] =
+		    st->tb_bw_round[2] = round;
+		return;
+	}
+	if (bw >= st->tb_bw[1]) {
+		st->tb_bw[1] = st->tb_bw[2] = bw;
+		st->tb_bw_round[1] = st->tb_bw_round[2] = round;
+	} else if (bw >= st->tb_bw[2]) {
+		st->tb_bw[2] = bw;
+		st->tb_bw_round[2] = round;
+	}
+
+	dt = round - st->tb_bw_round[0];
+	if (dt > TCP_BBR_BW_RTTS) {
+		st->tb_bw[0] = st->tb_bw[1];
+		st->tb_bw_round[0] = st->tb_bw_round[1];
+		st->tb_bw[1] = st->tb_bw[2];
+		st->tb_bw_round[1] = st->tb_bw_round[2];
+		st->tb_bw[2] = bw;
+		st->tb_bw_round[2] = round;
+		if (round - st->tb_bw_round[0] > TCP_BBR_BW_RTTS) {
+			st->tb_bw[0] = st->tb_bw[1];
+			st->tb_bw_round[0] = st->tb_bw_round[1];
+			st->tb_bw[1] = st->tb_bw[2];
+			st->tb_bw_round[1] = st->tb_bw_round[2];
+		}
+	} else if (st->tb_bw_round[1] == st->tb_bw_round[0] &&
+	    dt > TCP_BBR_BW_RTTS / 4) {
+		st->tb_bw[1] = st->tb_bw[2] = bw;
+		st->tb_bw_round[1] = st->tb_bw_round[2] = round;
+	} else if (st->tb_bw_round[2] == st->tb_bw_round[1] &&
+	    dt > TCP_BBR_BW_RTTS / 2) {
+		st->tb_bw[2] = bw;
+		st->tb_bw_round[2] = round;
+	}
+}
+
+static void
+tcp_bbr_set_pacing_rate(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+	uint64_t rate;
+	uint32_t srtt;
+
+	if (tcp_bbr_max_bw(st) != 0) {
+		rate = (tcp_bbr_max_bw(st) * st->tb_pacing_gain) /
+		    TCP_BBR_UNIT;
+	} else {
+		srtt = tp->t_srtt >> TCP_RTT_SHIFT;
+		if (srtt == 0)
+			return;
+		rate = ((uint64_t)tp->snd_cwnd * TCP_RETRANSHZ) / srtt;
+		rate = (rate * TCP_BBR_HIGH_GAIN) / TCP_BBR_UNIT;
+	}
+	if ((st->tb_flags & TCP_BBRF_FULL_PIPE) || rate > tp->t_pacing_rate)
+		tp->t_pacing_rate = rate;
+}
+
+static void
+tcp_bbr_enter_probe_bw(struct tcpcb *tp, uint32_t now_us)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+
+	st->tb_mode = TCP_BBR_PROBE_BW;
+	st->tb_cwnd_gain = TCP_BBR_CWND_GAIN;
+	st->tb_cycle_index = TCP_BBR_CYCLE_LEN - 1 -
+	    (random() % (TCP_BBR_CYCLE_LEN - 1));
+	st->tb_cycle_stamp_us = now_us;
+	st->tb_pacing_gain = tcp_bbr_pacing_gain[st->tb_cycle_index];
+}
+
+static void
+tcp_bbr_update_cycle(struct tcpcb *tp, uint32_t inflight, uint32_t now_us)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+	uint32_t gain, elapsed;
+	int next;
+
+	gain = st->tb_pacing_gain;
+	elapsed = now_us - st->tb_cycle_stamp_us;
+	next = (elapsed > st->tb_min_rtt_us);
+	if (gain > TCP_BBR_UNIT) {
+		next = next && (IN_FASTRECOVERY(tp) ||
+		    inflight >= tcp_bbr_bdp(tp, gain));
+	} else if (gain < TCP_BBR_UNIT) {
+		next = next || inflight <= tcp_bbr_bdp(tp, TCP_BBR_UNIT);
+	}
+	if (!next)
+		return;
+	st->tb_cycle_index = (st->tb_cycle_index + 1) % TCP_BBR_CYCLE_LEN;
+	st->tb_cycle_stamp_us = now_us;
+	st->tb_pacing_gain = tcp_bbr_pacing_gain[st->tb_cycle_index];
+}
+
+static void
+tcp_bbr_update_mode(struct tcpcb *tp, uint32_t inflight, uint32_t now_us,
+    int expired)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+
+	if ((st->tb_flags & (TCP_BBRF_FULL_PIPE | TCP_BBRF_ROUND_START)) ==
+	    TCP_BBRF_ROUND_START && st->tb_app_limited == 0) {
+		if (tcp_bbr_max_bw(st) >= (st->tb_full_bw *
+		    TCP_BBR_FULL_BW_THRESH) / TCP_BBR_UNIT) {
+			st->tb_full_bw = tcp_bbr_max_bw(st);
+			st->tb_full_bw_count = 0;
+		} else if (++st->tb_full_bw_count >= TCP_BBR_FULL_BW_COUNT) {
+			st->tb_flags |= TCP_BBRF_FULL_PIPE;
+		}
+	}
+	if (st->tb_mode == TCP_BBR_STARTUP &&
+	    (st->tb_flags & TCP_BBRF_FULL_PIPE)) {
+		st->tb_mode = TCP_BBR_DRAIN;
+		st->tb_pacing_gain = TCP_BBR_DRAIN_GAIN;
+		st->tb_cwnd_gain = TCP_BBR_HIGH_GAIN;
+	}
+	if (st->tb_mode == TCP_BBR_DRAIN &&
+	    inflight <= tcp_bbr_bdp(tp, TCP_BBR_UNIT))
+		tcp_bbr_enter_probe_bw(tp, now_us);
+	if (st->tb_mode == TCP_BBR_PROBE_BW)
+		tcp_bbr_update_cycle(tp, inflight, now_us);
+
+	if (expired && st->tb_mode != TCP_BBR_PROBE_RTT &&
+	    !(st->tb_flags & TCP_BBRF_IDLE_RESTART)) {
+		st->tb_mode = TCP_BBR_PROBE_RTT;
+		st->tb_pacing_gain = TCP_BBR_UNIT;
+		st->tb_cwnd_gain = TCP_BBR_UNIT;
+		if (!IN_FASTRECOVERY(tp))
+			st->tb_prior_cwnd = tp->snd_cwnd;
+		st->tb_probe_rtt_done = 0;
+	}
+	if (st->tb_mode == TCP_BBR_PROBE_RTT) {
+		if (st->tb_probe_rtt_done == 0 &&
+		    inflight <= TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg) {
+			st->tb_probe_rtt_done = tcp_now +
+			    tcp_bbr_probe_rtt_time;
+			if (st->tb_probe_rtt_done == 0)
+				st->tb_probe_rtt_done = 1;
+			st->tb_flags &= ~TCP_BBRF_PROBE_ROUND;
+			st->tb_next_round_delivered = st->tb_delivered;
+		} else if (st->tb_probe_rtt_done != 0) {
+			if (st->tb_flags & TCP_BBRF_ROUND_START)
+				st->tb_flags |= TCP_BBRF_PROBE_ROUND;
+			if ((st->tb_flags & TCP_BBRF_PROBE_ROUND) &&
+			    TSTMP_GEQ(tcp_now, st->tb_probe_rtt_done)) {
+				st->tb_min_rtt_stamp = tcp_now;
+				tp->snd_cwnd = max(tp->snd_cwnd,
+				    st->tb_prior_cwnd);
+				if (st->tb_flags & TCP_BBRF_FULL_PIPE) {
+					tcp_bbr_enter_probe_bw(tp, now_us);
+				} else {
+					st->tb_mode = TCP_BBR_STARTUP;
+					st->tb_pacing_gain = TCP_BBR_HIGH_GAIN;
+					st->tb_cwnd_gain = TCP_BBR_HIGH_GAIN;
+				}
+			}
+		}
+	}
+	st->tb_flags &= ~TCP_BBRF_IDLE_RESTART;
+}
+
+static void
+tcp_bbr_clear_state(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+
+	memset(st, 0, sizeof (*st));
+	st->tb_mode = TCP_BBR_STARTUP;
+	st->tb_pacing_gain = TCP_BBR_HIGH_GAIN;
+	st->tb_cwnd_gain = TCP_BBR_HIGH_GAIN;
+	st->tb_min_rtt_us = TCP_BBR_RTT_UNKNOWN;
+	st->tb_min_rtt_stamp = tcp_now;
+	st->tb_delivered_us = st->tb_first_sent_us = tcp_bbr_now_us();
+	tp->t_pacing_rate = 0;
+	tp->t_pacing_credit = 0;
+	tp->t_pacing_ts = 0;
+}
+
+static void
+tcp_bbr_data_sent(struct tcpcb *tp, uint32_t len, uint32_t unsent)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+	struct tcp_bbr_sample *bs;
+	uint32_t now_us, inflight, gap, i;
+
+	now_us = tcp_bbr_now_us();
+	inflight = tp->snd_max - tp->snd_una;
+	if (inflight <= len) {
+		st->tb_first_sent_us = now_us;
+		st->tb_delivered_us = now_us;
+	}
+	if (unsent == 0 && inflight < tp->snd_cwnd)
+		st->tb_app_limited = max(st->tb_delivered + inflight, 1);
+
+	if ((st->tb_flags & TCP_BBRF_SENT) &&
+	    SEQ_LEQ(tp->snd_max, st->tb_snd_max))
+		return;
+	st->tb_snd_max = tp->snd_max;
+	st->tb_flags |= TCP_BBRF_SENT;
+	if (st->tb_nsamples > 0) {
+		i = (st->tb_sample_head + st->tb_nsamples - 1) %
+		    TCP_BBR_NSAMPLES;
+		gap = max(tp->snd_cwnd / TCP_BBR_NSAMPLES, tp->t_maxseg);
+		if (SEQ_LT(tp->snd_max, st->tb_samples[i].bs_end_seq + gap) ||
+		    st->tb_nsamples == TCP_BBR_NSAMPLES)
+			return;
+	}
+	i = (st->tb_sample_head + st->tb_nsamples) % TCP_BBR_NSAMPLES;
+	bs = &st->tb_samples[i];
+	bs->bs_end_seq = tp->snd_max;
+	bs->bs_sent_us = now_us;
+	bs->bs_delivered = st->tb_delivered;
+	bs->bs_delivered_us = st->tb_delivered_us;
+	bs->bs_first_sent_us = st->tb_first_sent_us;
+	bs->bs_app_limited = (st->tb_app_limited != 0);
+	st->tb_nsamples++;
+}
+
+static void
+tcp_bbr_data_delivered(struct tcpcb *tp, tcp_seq th_ack, uint32_t delivered)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+	struct tcp_bbr_sample *bs = NULL;
+	tcp_seq highest;
+	uint32_t now_us, interval, rtt, inflight;
+	uint64_t bw;
+	int expired;
+
+	now_us = tcp_bbr_now_us();
+	st->tb_delivered += delivered;
+	st->tb_delivered_us = now_us;
+	st->tb_flags &= ~TCP_BBRF_ROUND_START;
+	if (st->tb_app_limited != 0 &&
+	    SEQ_GT(st->tb_delivered, st->tb_app_limited))
+		st->tb_app_limited = 0;
+
+	highest = th_ack;
+	if (tp->holes && SEQ_GT(tp->snd_fack, highest))
+		highest = tp->snd_fack;
+
+	while (st->tb_nsamples > 0 &&
+	    SEQ_LEQ(st->tb_samples[st->tb_sample_head].bs_end_seq, highest)) {
+		bs = &st->tb_samples[st->tb_sample_head];
+		st->tb_sample_head = (st->tb_sample_head + 1) %
+		    TCP_BBR_NSAMPLES;
+		st->tb_nsamples--;
+	}
+
+	expired = TSTMP_GT(tcp_now,
+	    st->tb_min_rtt_stamp + tcp_bbr_min_rtt_win);
+	if (bs != NULL) {
+		st->tb_first_sent_us = bs->bs_sent_us;
+		if (SEQ_GEQ(bs->bs_delivered, st->tb_next_round_delivered)) {
+			st->tb_next_round_delivered = st->tb_delivered;
+			st->tb_round++;
+			st->tb_flags |= TCP_BBRF_ROUND_START;
+		}
+		rtt = now_us - bs->bs_sent_us;
+		if (rtt < st->tb_min_rtt_us || expired) {
+			st->tb_min_rtt_us = max(rtt, 1);
+			st->tb_min_rtt_stamp = tcp_now;
+		}
+		interval = max(bs->bs_sent_us - bs->bs_first_sent_us,
+		    now_us - bs->bs_delivered_us);
+		if (interval >= st->tb_min_rtt_us && interval > 0) {
+			bw = ((uint64_t)(st->tb_delivered - bs->bs_delivered) *
+			    USEC_PER_SEC) / interval;
+			if (!bs->bs_app_limited || bw >= tcp_bbr_max_bw(st))
+				tcp_bbr_bw_update(st, bw);
+		}
+	}
+
+	inflight = SEQ_GT(th_ack, tp->snd_una) ? tp->snd_max - th_ack :
+	    tp->snd_max - tp->snd_una;
+	tcp_bbr_update_mode(tp, inflight, now_us, expired);
+	tcp_bbr_set_pacing_rate(tp);
+
+	/*
+	 * The recovery code bounds the data in flight by ssthresh and
+	 * does not call the other hooks; keep it in line with the model
+	 * so that random loss does not hold the connection back.
+	 */
+	if (IN_FASTRECOVERY(tp))
+		tp->snd_ssthresh = tcp_bbr_grow_cwnd(tp, tp->snd_ssthresh,
+		    delivered);
+}
+
+static void
+tcp_bbr_set_cwnd(struct tcpcb *tp, tcp_seq th_ack)
+{
+	tp->snd_cwnd = tcp_bbr_grow_cwnd(tp, tp->snd_cwnd, BYTES_ACKED(th_ack, tp));
+}
+
+static void
+tcp_bbr_pre_fr(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *st = &tp->bbr_state;
+	uint32_t win;
+
+	st->tb_prior_cwnd = tp->snd_cwnd;
+	win = min(tcp_bbr_target_cwnd(tp, TCP_BBR_UNIT), tp->snd_cwnd);
+	win = max(win, TCP_BBR_MIN_TSO_SEGS * tp->t_maxseg);
+	tp->snd_ssthresh = win;
+}
+
+static void
+tcp_bbr_post_fr(struct tcpcb *tp)
+{
+	tp->snd_cwnd = max(tp->snd_ssthresh, tp->bbr_state.tb_prior_cwnd);
+}
+
+/*
+ * NewReno, following tcp_newreno.c
+ */
+static void
+newreno_ack_rcvd(struct tcpcb *tp, tcp_seq th_ack)
+{
+	uint32_t cw = tp->snd_cwnd, incr, acked;
+
+	acked = BYTES_ACKED(th_ack, tp);
+	if (cw >= tp->snd_ssthresh)
+		incr = max((uint64_t)acked * tp->t_maxseg / cw, 1);
+	else
+		incr = min(acked, 2 * tp->t_maxseg);
+	tp->snd_cwnd = min(cw + incr, (uint32_t)TCP_MAXWIN << tp->snd_scale);
+}
+
+static void
+newreno_pre_fr(struct tcpcb *tp)
+{
+	uint32_t win;
+
+	win = tp->snd_cwnd / 2 / tp->t_maxseg;
+	if (win < 2)
+		win = 2;
+	tp->snd_ssthresh = win * tp->t_maxseg;
+}
+
+static void
+newreno_post_fr(struct tcpcb *tp, tcp_seq th_ack)
+{
+	int32_t ss;
+
+	ss = tp->snd_max - th_ack;
+	if (ss < (int32_t)tp->snd_ssthresh)
+		tp->snd_cwnd = max((uint32_t)ss, tp->t_maxseg) + tp->t_maxseg;
+	else
+		tp->snd_cwnd = tp->snd_ssthresh;
+}
+
+/*
+ * The network and the sender
+ */
+struct path {
+	const char	*name;
+	double		mbps;		/* bottleneck rate */
+	double		rtt_ms;		/* two way propagation delay */
+	double		buf_bdp;	/* buffer, in BDPs */
+	double		loss;		/* random loss on the forward path */
+};
+
+enum { ALGO_NEWRENO, ALGO_BBR };
+
+struct pkt {
+	double		sent;		/* last transmission */
+	uint64_t	order;		/* transmission counter at last send */
+	uint8_t		sacked;
+	uint8_t		lost;
+	uint8_t		inflight;
+	uint8_t		rexmit;
+};
+
+struct ev {
+	double		t;
+	uint32_t	idx;
+	uint64_t	order;
+};
+
+struct fifo {
+	struct ev	*e;
+	uint32_t	head, tail, size;
+};
+
+struct result {
+	double		goodput_mbps;
+	double		qdelay_ms;
+	uint64_t	rexmits;
+};
+
+static struct pkt *pkts;
+
+static void
+fifo_init(struct fifo *f, uint32_t size)
+{
+	f->e = calloc(size, sizeof (*f->e));
+	if (f->e == NULL)
+		err(1, "calloc");
+	f->head = f->tail = 0;
+	f->size = size;
+}
+
+static inline uint32_t
+fifo_len(struct fifo *f)
+{
+	return (f->tail - f->head);
+}
+
+static inline void
+fifo_push(struct fifo *f, double t, uint32_t idx, uint64_t order)
+{
+	struct ev *e;
+
+	VERIFY(fifo_len(f) < f->size);
+	e = &f->e[f->tail++ % f->size];
+	e->t = t;
+	e->idx = idx;
+	e->order = order;
+}
+
+static inline struct ev *
+fifo_head(struct fifo *f)
+{
+	return (fifo_len(f) ? &f->e[f->head % f->size] : NULL);
+}
+
+static struct result
+simulate(const struct path *path, int algo)
+{
+	struct tcpcb tcb, *tp = &tcb;
+	struct fifo queue, wire, acks;
+	struct ev *e;
+	struct result res;
+	double tx_us, owd_us, link_next, link_free, pace_timer, next;
+	double qsum = 0, last_ack = 0;
+	uint64_t order = 0, max_sacked_order = 0, qsamples = 0, rexmits = 0;
+	uint32_t qcap, una_idx = 0, nxt_idx = 0, i;
+	tcp_seq warm_una = 0;
+	int warm = 0;
+
+	memset(pkts, 0, MAXPKTS * sizeof (*pkts));
+	srandom(1);
+	srand48(1);
+
+	tx_us = MSS * 8.0 / path->mbps;
+	owd_us = path->rtt_ms * 1000.0 / 2;
+	qcap = (uint32_t)(path->buf_bdp * path->rtt_ms * 1000.0 / tx_us);
+	if (qcap < 4)
+		qcap = 4;
+	fifo_init(&queue, qcap + 1);
+	fifo_init(&wire, 1 << 16);
+	fifo_init(&acks, 1 << 16);
+
+	sim_now = 0;
+	tcp_now = 0;
+	memset(tp, 0, sizeof (*tp));
+	tp->t_maxseg = MSS;
+	tp->snd_scale = TCP_MAX_WINSHIFT;
+	tp->snd_cwnd = 10 * MSS;
+	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+	if (algo == ALGO_BBR)
+		tcp_bbr_clear_state(tp);
+	link_next = link_free = 0;
+	pace_timer = -1;
+
+	while (sim_now < SIM_TIME) {
+		/* bottleneck link */
+		while (fifo_len(&queue) && link_next <= sim_now) {
+			e = fifo_head(&queue);
+			fifo_push(&wire, link_next + owd_us, e->idx, e->order);
+			queue.head++;
+			link_free = link_next;
+			link_next = link_free + tx_us;
+		}
+
+		/* receiver: acknowledge every segment */
+		while ((e = fifo_head(&wire)) != NULL && e->t <= sim_now) {
+			fifo_push(&acks, e->t + owd_us, e->idx, e->order);
+			wire.head++;
+		}
+
+		/* sender: process acks */
+		while ((e = fifo_head(&acks)) != NULL && e->t <= sim_now) {
+			tcp_seq th_ack;
+			uint32_t delivered = 0, idx = e->idx, cum;
+
+			/*
+			 * Without reordering, the cumulative ack is the
+			 * first segment not yet sacked.
+			 */
+			if (!pkts[idx].sacked) {
+				pkts[idx].sacked = 1;
+				pkts[idx].inflight = 0;
+				delivered += MSS;
+				if (e->order > max_sacked_order)
+					max_sacked_order = e->order;
+				if (!pkts[idx].rexmit && tp->t_srtt == 0)
+					tp->t_srtt = (uint32_t)((sim_now -
+					    pkts[idx].sent) / 1000) <<
+					    TCP_RTT_SHIFT;
+			}
+			cum = una_idx;
+			while (cum < nxt_idx && pkts[cum].sacked)
+				cum++;
+			th_ack = cum * MSS;
+			if (SEQ_GT((idx + 1) * MSS, tp->snd_fack))
+				tp->snd_fack = (idx + 1) * MSS;
+			tp->holes = SEQ_GT(tp->snd_fack, th_ack);
+			acks.head++;
+			last_ack = sim_now;
+
+			/* loss detection: DUPTHRESH later sends were sacked */
+			for (i = cum; i < nxt_idx; i++) {
+				struct pkt *p = &pkts[i];
+
+				if (p->sacked || p->lost || !p->inflight)
+					continue;
+				if (p->order + DUPTHRESH > max_sacked_order)
+					break;
+				p->lost = 1;
+				p->inflight = 0;
+				if (!tp->in_recovery) {
+					if (algo == ALGO_BBR)
+						tcp_bbr_pre_fr(tp);
+					else
+						newreno_pre_fr(tp);
+					tp->in_recovery = 1;
+					tp->snd_recover = tp->snd_max;
+				}
+			}
+
+			if (algo == ALGO_BBR && delivered > 0)
+				tcp_bbr_data_delivered(tp, th_ack, delivered);
+			if (SEQ_GT(th_ack, tp->snd_una)) {
+				if (!tp->in_recovery) {
+					if (algo == ALGO_BBR)
+						tcp_bbr_set_cwnd(tp, th_ack);
+					else
+						newreno_ack_rcvd(tp, th_ack);
+				} else if (SEQ_GEQ(th_ack, tp->snd_recover)) {
+					if (algo == ALGO_BBR)
+						tcp_bbr_post_fr(tp);
+					else
+						newreno_post_fr(tp, th_ack);
+					tp->in_recovery = 0;
+				}
+				tp->snd_una = th_ack;
+				una_idx = cum;
+			}
+			if (!warm && sim_now >= WARMUP) {
+				warm = 1;
+				warm_una = tp->snd_una;
+			}
+		}
+
+		/* sender: output */
+		if (pace_timer >= 0 && pace_timer <= sim_now)
+			pace_timer = -1;
+		for (;;) {
+			uint32_t pipe = 0, limit, idx;
+			int rexmt = 0;
+
+			for (i = una_idx; i < nxt_idx; i++)
+				if (pkts[i].inflight)
+					pipe += MSS;
+			limit = tp->in_recovery ? tp->snd_ssthresh :
+			    tp->snd_cwnd;
+			if (pipe + MSS > limit)
+				break;
+
+			idx = nxt_idx;
+			for (i = una_idx; i < nxt_idx; i++) {
+				if (pkts[i].lost) {
+					idx = i;
+					rexmt = 1;
+					break;
+				}
+			}
+			if (idx >= MAXPKTS - 1)
+				break;
+
+			/* pacing, as tcp_pacing_limit() */
+			if (tp->t_pacing_rate != 0 && !rexmt) {
+				uint64_t now_us = (uint64_t)sim_now;
+				uint64_t burst, credit, elapsed;
+
+				burst = tp->t_pacing_rate * 1000 / USEC_PER_SEC;
+				if (burst < 2 * tp->t_maxseg)
+					burst = 2 * tp->t_maxseg;
+				credit = tp->t_pacing_credit;
+				if (tp->t_pacing_ts != 0 &&
+				    now_us > tp->t_pacing_ts) {
+					elapsed = now_us - tp->t_pacing_ts;
+					if (elapsed > USEC_PER_SEC)
+						elapsed = USEC_PER_SEC;
+					credit += tp->t_pacing_rate * elapsed /
+					    USEC_PER_SEC;
+				} else if (tp->t_pacing_ts == 0) {
+					credit = burst;
+				}
+				tp->t_pacing_ts = now_us;
+				if (credit > burst)
+					credit = burst;
+				if (credit < MSS) {
+					tp->t_pacing_credit = (uint32_t)credit;
+					if (pace_timer < 0) {
+						uint32_t wait_ms;
+
+						wait_ms = (uint32_t)((MSS -
+						    credit) * TCP_RETRANSHZ /
+						    tp->t_pacing_rate) + 1;
+						pace_timer = (double)(tcp_now +
+						    wait_ms) * 1000;
+					}
+					break;
+				}
+				tp->t_pacing_credit = (uint32_t)(credit - MSS);
+			}
+
+			pkts[idx].sent = sim_now;
+			pkts[idx].order = ++order;
+			pkts[idx].inflight = 1;
+			pkts[idx].lost = 0;
+			if (rexmt) {
+				pkts[idx].rexmit = 1;
+				rexmits++;
+			} else {
+				nxt_idx++;
+				tp->snd_max = nxt_idx * MSS;
+			}
+			if (algo == ALGO_BBR)
+				tcp_bbr_data_sent(tp, MSS, 1);
+
+			/* random loss, then drop tail */
+			if (drand48() < path->loss)
+				continue;
+			if (fifo_len(&queue) >= qcap)
+				continue;
+			if (fifo_len(&queue) == 0)
+				link_next = max(sim_now, link_free) + tx_us;
+			fifo_push(&queue, sim_now, idx, pkts[idx].order);
+			if (warm) {
+				qsum += fifo_len(&queue) * tx_us;
+				qsamples++;
+			}
+		}
+
+		/* retransmit timeout */
+		if (sim_now - last_ack > 1000000 && una_idx < nxt_idx) {
+			for (i = una_idx; i < nxt_idx; i++) {
+				if (!pkts[i].sacked) {
+					pkts[i].lost = 1;
+					pkts[i].inflight = 0;
+				}
+			}
+			if (algo == ALGO_BBR && !tp->in_recovery)
+				tcp_bbr_pre_fr(tp);
+			else if (!tp->in_recovery)
+				newreno_pre_fr(tp);
+			tp->in_recovery = 0;
+			tp->snd_cwnd = MSS;
+			last_ack = sim_now;
+		}
+
+		/* next event */
+		next = SIM_TIME;
+		if (fifo_len(&queue) && link_next < next)
+			next = link_next;
+		if ((e = fifo_head(&wire)) != NULL && e->t < next)
+			next = e->t;
+		if ((e = fifo_head(&acks)) != NULL && e->t < next)
+			next = e->t;
+		if (pace_timer >= 0 && pace_timer < next)
+			next = pace_timer;
+		if (next > sim_now)
+			sim_now = next;
+		tcp_now = (uint32_t)(sim_now / 1000);
+	}
+
+	res.goodput_mbps = (double)(tp->snd_una - warm_una) * 8 /
+	    (SIM_TIME - WARMUP);
+	res.qdelay_ms = qsamples ? qsum / qsamples / 1000 : 0;
+	res.rexmits = rexmits;
+	free(queue.e);
+	free(wire.e);
+	free(acks.e);
+	return (res);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const struct path paths[] = {
+		{ "lossy", 50, 100, 0.5, 0.01 },
+		{ "deep", 50, 40, 2, 0 },
+	};
+	struct result nr[2], bbr[2];
+	int i, failed = 0;
+
+	(void) argc;
+	(void) argv;
+
+	pkts = calloc(MAXPKTS, sizeof (*pkts));
+	if (pkts == NULL)
+		err(1, "calloc");
+
+	printf("%-6s %6s %6s %5s %5s   %-8s %10s %10s %8s\n", "path", "Mbps",
+	    "RTT", "buf", "loss", "algo", "goodput", "qdelay ms", "rexmits");
+	for (i = 0; i < 2; i++) {
+		const struct path *p = &paths[i];
+
+		nr[i] = simulate(p, ALGO_NEWRENO);
+		bbr[i] = simulate(p, ALGO_BBR);
+		printf("%-6s %6.0f %6.0f %5.1f %5.3f   %-8s %10.2f %10.2f %8llu\n",
+		    p->name, p->mbps, p->rtt_ms, p->buf_bdp, p->loss, "newreno",
+		    nr[i].goodput_mbps, nr[i].qdelay_ms,
+		    (unsigned long long)nr[i].rexmits);
+		printf("%-6s %6s %6s %5s %5s   %-8s %10.2f %10.2f %8llu\n",
+		    "", "", "", "", "", "bbr", bbr[i].goodput_mbps,
+		    bbr[i].qdelay_ms, (unsigned long long)bbr[i].rexmits);
+	}
+
+	/* under random loss BBR must keep most of the link busy */
+	if (bbr[0].goodput_mbps < 0.6 * paths[0].mbps ||
+	    bbr[0].goodput_mbps < 5 * nr[0].goodput_mbps) {
+		printf("FAIL: lossy path goodput %.2f vs %.2f Mbps\n",
+		    bbr[0].goodput_mbps, nr[0].goodput_mbps);
+		failed = 1;
+	}
+	/* with a deep buffer it must fill the link with a shorter queue */
+	if (bbr[1].goodput_mbps < 0.9 * paths[1].mbps ||
+	    bbr[1].qdelay_ms * 2 > nr[1].qdelay_ms) {
+		printf("FAIL: deep buffer queue delay %.2f vs %.2f ms\n",
+		    bbr[1].qdelay_ms, nr[1].qdelay_ms);
+		failed = 1;
+	}
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	free(pkts);
+	return (failed);
+}
@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Measures the cost of one run of the TCP timer list as the number of
+ * connections grows, for the two ways bsd/netinet/tcp_timer.c has kept
+ * timer entries:
+ *
+ *   list	one unordered list; every run visits every entry to find
+ *		the ones that are due and the next deadline
+ *   wheel	the hierarchical timing wheel; a run visits only the
+ *		slots between the last run and now, plus the entries that
+ *		are due or that need to be cascaded
+ *
+ * Most connections are idle with a keepalive deadline that each
+ * incoming segment pushes out; a small fraction are active with a
+ * retransmit timer that is re-armed on every ACK and fires now and then.
+ * Both models are driven by the same sequence of events and must fire
+ * the same timers, never before their deadline and never more than one
+ * run interval after it.  Output is the average time per run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#define	VERIFY(x)	assert(x)
+
+#define	TSTMP_LT(a, b)	((int32_t)((a) - (b)) < 0)
+#define	TSTMP_LEQ(a, b)	((int32_t)((a) - (b)) <= 0)
+#define	TSTMP_GT(a, b)	((int32_t)((a) - (b)) > 0)
+#define	TSTMP_GEQ(a, b)	((int32_t)((a) - (b)) >= 0)
+
+#define	TCP_WHEEL_BITS		8
+#define	TCP_WHEEL_SIZE		(1 << TCP_WHEEL_BITS)
+#define	TCP_WHEEL_MASK		(TCP_WHEEL_SIZE - 1)
+#define	TCP_WHEEL_LEVELS	4
+#define	TCP_WHEEL_EXPIRED	0xffff
+
+#define	TCP_TIMERLIST_MAX_OFFSET	(60 * 60 * 1000)
+
+#define	RUN_INTERVAL	100		/* ticks (ms) between runs */
+#define	SIM_TICKS	(120 * 1000)	/* two minutes of tcp clock */
+#define	KEEPIDLE	(7200 * 1000)
+#define	REXMT_MIN	200
+#define	REXMT_MAX	1500
+#define	ACTIVE_PCT	1		/* percent of active connections */
+#define	SEGS_PER_TICK_PER_1K	2	/* segments per tick per 1k conns */
+
+struct tcptimerentry {
+	LIST_ENTRY(tcptimerentry) le;
+	uint32_t runtime;
+	uint32_t wheel_runtime;
+	uint16_t wheel_slot;
+	uint16_t armed;
+};
+
+LIST_HEAD(timerlisthead, tcptimerentry);
+
+struct tcptimerlist {
+	struct timerlisthead wheel[TCP_WHEEL_LEVELS][TCP_WHEEL_SIZE];
+	struct timerlisthead expired;
+	struct timerlisthead lhead;	/* list model */
+	uint32_t wheel_time;
+	uint32_t level_entries[TCP_WHEEL_LEVELS];
+	uint32_t entries;
+};
+
+struct conn {
+	struct tcptimerentry te;
+	int active;
+};
+
+static uint32_t tcp_now;
+static uint64_t fired, late_max, scanned;
+static struct conn *conns;
+
+static void
+tcp_timer_wheel_insert(struct tcptimerlist *listp, struct tcptimerentry *te)
+{
+	uint32_t runtime, level, slot;
+	int32_t delta;
+
+	runtime = te->armed ? te->runtime : listp->wheel_time;
+	delta = (int32_t)(runtime - listp->wheel_time);
+	if (delta < 0) {
+		runtime = listp->wheel_time;
+		delta = 0;
+	}
+	for (level = 0; level < TCP_WHEEL_LEVELS - 1; level++) {
+		if ((uint32_t)delta < (1U << ((level + 1) * TCP_WHEEL_BITS)))
+			break;
+	}
+	slot = (runtime >> (level * TCP_WHEEL_BITS)) & TCP_WHEEL_MASK;
+	LIST_INSERT_HEAD(&listp->wheel[level][slot], te, le);
+	te->wheel_slot = (level << TCP_WHEEL_BITS) | slot;
+	te->wheel_runtime = runtime;
+	listp->level_entries[level]++;
+}
+
+static void
+tcp_timer_wheel_unlink(struct tcptimerlist *listp, struct tcptimerentry *te)
+{
+	LIST_REMOVE(te, le);
+	if (te->wheel_slot == TCP_WHEEL_EXPIRED)
+		return;
+	listp->level_entries[te->wheel_slot >> TCP_WHEEL_BITS]--;
+	te->wheel_slot = TCP_WHEEL_EXPIRED;
+}
+
+static void
+tcp_timer_wheel_advance(struct tcptimerlist *listp)
+{
+	struct timerlisthead *head;
+	struct tcptimerentry *te;
+	uint32_t level, span, next;
+
+	while (TSTMP_GEQ(tcp_now, listp->wheel_time)) {
+		if (listp->entries == 0) {
+			listp->wheel_time = tcp_now + 1;
+			break;
+		}
+		for (level = 1; level < TCP_WHEEL_LEVELS; level++) {
+			uint32_t shift = level * TCP_WHEEL_BITS;
+
+			if ((listp->wheel_time & ((1U << shift) - 1)) != 0)
+				break;
+			head = &listp->wheel[level][(listp->wheel_time >>
+			    shift) & TCP_WHEEL_MASK];
+			while ((te = LIST_FIRST(head)) != NULL) {
+				tcp_timer_wheel_unlink(listp, te);
+				tcp_timer_wheel_insert(listp, te);
+				scanned++;
+			}
+		}
+		if (listp->level_entries[0] == 0) {
+			span = TCP_WHEEL_SIZE;
+			for (level = 1; level < TCP_WHEEL_LEVELS - 1 &&
+			    listp->level_entries[level] == 0; level++)
+				span <<= TCP_WHEEL_BITS;
+			next = (listp->wheel_time | (span - 1)) + 1;
+			if (TSTMP_GT(next, tcp_now + 1))
+				next = tcp_now + 1;
+			listp->wheel_time = next;
+			continue;
+		}
+		head = &listp->wheel[0][listp->wheel_time & TCP_WHEEL_MASK];
+		while ((te = LIST_FIRST(head)) != NULL) {
+			tcp_timer_wheel_unlink(listp, te);
+			LIST_INSERT_HEAD(&listp->expired, te, le);
+		}
+		listp->wheel_time++;
+	}
+}
+
+static uint32_t
+tcp_timer_wheel_next(struct tcptimerlist *listp)
+{
+	uint32_t level, shift, base, k, when, next = 0;
+	int found = 0;
+
+	for (k = 0; listp->level_entries[0] > 0 && k < TCP_WHEEL_SIZE; k++) {
+		when = listp->wheel_time + k;
+		if (!LIST_EMPTY(&listp->wheel[0][when & TCP_WHEEL_MASK])) {
+			next = when;
+			found = 1;
+			break;
+		}
+	}
+	for (level = 1; level < TCP_WHEEL_LEVELS; level++) {
+		if (listp->level_entries[level] == 0)
+			continue;
+		shift = level * TCP_WHEEL_BITS;
+		base = listp->wheel_time >> shift;
+		k = ((listp->wheel_time & ((1U << shift) - 1)) == 0) ? 0 : 1;
+		for (; k <= TCP_WHEEL_SIZE; k++) {
+			if (LIST_EMPTY(&listp->wheel[level][(base + k) &
+			    TCP_WHEEL_MASK]))
+				continue;
+			when = (base + k) << shift;
+			if (!found || TSTMP_LT(when, next)) {
+				next = when;
+				found = 1;
+			}
+			break;
+		}
+	}
+	if (!found)
+		return (TCP_TIMERLIST_MAX_OFFSET);
+	if (TSTMP_LEQ(next, tcp_now))
+		return (1);
+	return (next - tcp_now);
+}
+
+/*
+ * What tcp_run_conn_timer does to an entry that is due.  The new
+ * deadline depends only on the connection and the clock, so that both
+ * models fire the same timers whatever order they visit entries in.
+ */
+static void
+conn_fire(struct conn *c)
+{
+	uint32_t late = tcp_now - c->te.runtime;
+	uint32_t h = (uint32_t)(c - conns) * 2654435761U ^ tcp_now;
+
+	VERIFY(c->te.armed && TSTMP_LEQ(c->te.runtime, tcp_now));
+	if (late > late_max)
+		late_max = late;
+	fired++;
+	/* a retransmit backs off, an idle keepalive probe re-arms */
+	h = h * 1103515245 + 12345;
+	c->te.runtime = tcp_now + (c->active ?
+	    REXMT_MIN + (h >> 8) % (REXMT_MAX - REXMT_MIN) : KEEPIDLE);
+}
+
+static void
+run_list(struct tcptimerlist *listp)
+{
+	struct tcptimerentry *te;
+	uint32_t next_timer = 0;
+
+	LIST_FOREACH(te, &listp->lhead, le) {
+		scanned++;
+		if (te->armed && TSTMP_GT(te->runtime, tcp_now)) {
+			uint32_t offset = te->runtime - tcp_now;
+			if (next_timer == 0 || offset < next_timer)
+				next_timer = offset;
+			continue;
+		}
+		conn_fire((struct conn *)te);
+	}
+	(void) next_timer;
+}
+
+static void
+run_wheel(struct tcptimerlist *listp)
+{
+	struct tcptimerentry *te;
+
+	tcp_timer_wheel_advance(listp);
+	while ((te = LIST_FIRST(&listp->expired)) != NULL) {
+		LIST_REMOVE(te, le);
+		scanned++;
+		if (te->armed && TSTMP_GT(te->runtime, tcp_now)) {
+			tcp_timer_wheel_insert(listp, te);
+			continue;
+		}
+		conn_fire((struct conn *)te);
+		tcp_timer_wheel_insert(listp, te);
+	}
+	(void) tcp_timer_wheel_next(listp);
+}
+
+/* what tcp_sched_timers does when a segment moves a deadline */
+static void
+sched_wheel(struct tcptimerlist *listp, struct tcptimerentry *te)
+{
+	if (te->wheel_slot != TCP_WHEEL_EXPIRED &&
+	    TSTMP_LT(te->runtime, te->wheel_runtime)) {
+		tcp_timer_wheel_unlink(listp, te);
+		tcp_timer_wheel_insert(listp, te);
+	}
+}
+
+static double
+now_nsec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1e9 + tv.tv_usec * 1e3);
+}
+
+static void
+run(uint32_t nconns, int wheel, double *run_ns, uint64_t *nfired,
+    uint64_t *nscanned, uint64_t *maxlate)
+{
+	struct tcptimerlist *listp;
+	uint32_t i, t, ev = 54321, nsegs, runs = 0;
+	double elapsed = 0, t0;
+
+	listp = calloc(1, sizeof (*listp));
+	conns = calloc(nconns, sizeof (*conns));
+	if (listp == NULL || conns == NULL)
+		err(1, "calloc");
+	for (i = 0; i < TCP_WHEEL_LEVELS; i++)
+		for (t = 0; t < TCP_WHEEL_SIZE; t++)
+			LIST_INIT(&listp->wheel[i][t]);
+	LIST_INIT(&listp->expired);
+	LIST_INIT(&listp->lhead);
+	tcp_now = 0U - SIM_TICKS / 2;	/* wrap the tcp clock mid-run */
+	listp->wheel_time = tcp_now;
+	fired = scanned = late_max = 0;
+
+	for (i = 0; i < nconns; i++) {
+		struct conn *c = &conns[i];
+
+		ev = ev * 1103515245 + 12345;
+		c->active = ((ev >> 8) % 100) < ACTIVE_PCT;
+		c->te.armed = 1;
+		c->te.runtime = tcp_now + (c->active ?
+		    REXMT_MIN + (ev >> 4) % (REXMT_MAX - REXMT_MIN) :
+		    (ev >> 4) % KEEPIDLE);
+		if (wheel)
+			tcp_timer_wheel_insert(listp, &c->te);
+		else
+			LIST_INSERT_HEAD(&listp->lhead, &c->te, le);
+		listp->entries++;
+	}
+
+	nsegs = (nconns / 1000 + 1) * SEGS_PER_TICK_PER_1K;
+	for (t = 1; t <= SIM_TICKS; t++) {
+		tcp_now++;
+		/* segments arrive: ACKs on active, keepalive resets on idle */
+		for (i = 0; i < nsegs; i++) {
+			struct conn *c;
+
+			ev = ev * 1103515245 + 12345;
+			c = &conns[(ev >> 4) % nconns];
+			c->te.runtime = tcp_now + (c->active ?
+			    REXMT_MAX + (ev >> 8) % REXMT_MAX : KEEPIDLE);
+			if (wheel)
+				sched_wheel(listp, &c->te);
+		}
+		if ((t % RUN_INTERVAL) != 0)
+			continue;
+		t0 = now_nsec();
+		if (wheel)
+			run_wheel(listp);
+		else
+			run_list(listp);
+		elapsed += now_nsec() - t0;
+		runs++;
+	}
+
+	*run_ns = elapsed / runs;
+	*nfired = fired;
+	*nscanned = scanned / runs;
+	*maxlate = late_max;
+	free(conns);
+	free(listp);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const uint32_t sizes[] = { 1000, 10000, 100000, 1000000 };
+	uint32_t i, n = sizeof (sizes) / sizeof (sizes[0]);
+	int failed = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (n > sizeof (sizes) / sizeof (sizes[0]))
+		n = sizeof (sizes) / sizeof (sizes[0]);
+
+	printf("%9s %12s %12s %10s %10s %8s\n", "conns", "list ns/run",
+	    "wheel ns/run", "list scan", "wheel scan", "fired");
+	for (i = 0; i < n; i++) {
+		double lns, wns;
+		uint64_t lf, wf, ls, ws, llate, wlate;
+
+		run(sizes[i], 0, &lns, &lf, &ls, &llate);
+		run(sizes[i], 1, &wns, &wf, &ws, &wlate);
+		printf("%9u %12.0f %12.0f %10llu %10llu %8llu\n", sizes[i],
+		    lns, wns, (unsigned long long)ls, (unsigned long long)ws,
+		    (unsigned long long)wf);
+		if (lf != wf || wlate >= RUN_INTERVAL || llate >= RUN_INTERVAL) {
+			printf("FAIL: fired %llu/%llu, max late %llu/%llu\n",
+			    (unsigned long long)lf, (unsigned long long)wf,
+			    (unsigned long long)llate,
+			    (unsigned long long)wlate);
+			failed = 1;
+		}
+	}
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return (failed);
+}